@@ -15,10 +15,15 @@
 #include <linux/types.h>
 #include <linux/crypto.h>
 #include <linux/err.h>
+#include <linux/slab.h>
 #include <crypto/algapi.h>
+#include <crypto/aead.h>
 #include <crypto/aes.h>
+#include <crypto/b128ops.h>
 #include <crypto/cryptd.h>
 #include <crypto/ctr.h>
+#include <crypto/gf128mul.h>
+#include <crypto/scatterwalk.h>
 #include <asm/i387.h>
 #include <asm/aes.h>
 
@@ -34,10 +39,6 @@
 #define HAS_PCBC
 #endif
 
-#if defined(CONFIG_CRYPTO_XTS) || defined(CONFIG_CRYPTO_XTS_MODULE)
-#define HAS_XTS
-#endif
-
 struct async_aes_ctx {
 	struct cryptd_ablkcipher *cryptd_tfm;
 };
@@ -45,6 +46,23 @@ struct async_aes_ctx {
 #define AESNI_ALIGN	16
 #define AES_BLOCK_MASK	(~(AES_BLOCK_SIZE-1))
 
+/* Blocks handled by each call of aesni_xts_crypt8() */
+#define XTS_PARALLEL_BLOCKS	8
+
+struct aesni_xts_ctx {
+	struct crypto_aes_ctx tweak_ctx __aligned(AESNI_ALIGN);
+	struct crypto_aes_ctx crypt_ctx __aligned(AESNI_ALIGN);
+};
+
+struct aesni_gcm_ctx {
+	struct crypto_aes_ctx aes_ctx __aligned(AESNI_ALIGN);
+	/* H^1..H^4 in the layout of aesni_gcm_ghash() */
+	be128 hkey[4];
+	/* H itself, for gf128mul_lle() when the fpu is not usable */
+	be128 h;
+	bool hkey_ready;
+};
+
 asmlinkage int aesni_set_key(struct crypto_aes_ctx *ctx, const u8 *in_key,
 			     unsigned int key_len);
 asmlinkage void aesni_enc(struct crypto_aes_ctx *ctx, u8 *out,
@@ -61,6 +79,11 @@ asmlinkage void aesni_cbc_dec(struct crypto_aes_ctx *ctx, u8 *out,
 			      const u8 *in, unsigned int len, u8 *iv);
 asmlinkage void aesni_ctr_enc(struct crypto_aes_ctx *ctx, u8 *out,
 			      const u8 *in, unsigned int len, u8 *iv);
+asmlinkage void aesni_xts_crypt8(struct crypto_aes_ctx *ctx, u8 *out,
+				 const u8 *in, bool enc, u8 *iv);
+asmlinkage void aesni_gcm_ghash_setkey(be128 *hkey, const u8 *h);
+asmlinkage void aesni_gcm_ghash(u8 *hash, const u8 *src, unsigned int len,
+				const be128 *hkey);
 
 static inline struct crypto_aes_ctx *aes_ctx(void *raw_ctx)
 {
@@ -390,6 +413,375 @@ static struct crypto_alg blk_ctr_alg = {
 	},
 };
 
+static inline struct aesni_xts_ctx *xts_ctx(void *raw_ctx)
+{
+	return (struct aesni_xts_ctx *)ALIGN((unsigned long)raw_ctx,
+					     AESNI_ALIGN);
+}
+
+static int xts_set_key(struct crypto_tfm *tfm, const u8 *key,
+		       unsigned int keylen)
+{
+	struct aesni_xts_ctx *ctx = xts_ctx(crypto_tfm_ctx(tfm));
+	int err;
+
+	/* key consists of keys of equal size concatenated */
+	if (keylen % 2) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+
+	/* first half of xts-key is for crypt */
+	err = aes_set_key_common(tfm, &ctx->crypt_ctx, key, keylen / 2);
+	if (err)
+		return err;
+
+	/* second half of xts-key is for tweak */
+	return aes_set_key_common(tfm, &ctx->tweak_ctx, key + keylen / 2,
+				  keylen / 2);
+}
+
+static void xts_crypt_blocks(struct aesni_xts_ctx *ctx, u8 *dst,
+			     const u8 *src, unsigned int nblocks, u8 *iv,
+			     bool enc)
+{
+	be128 *t = (be128 *)iv;
+
+	for (; nblocks >= XTS_PARALLEL_BLOCKS;
+	     nblocks -= XTS_PARALLEL_BLOCKS) {
+		aesni_xts_crypt8(&ctx->crypt_ctx, dst, src, enc, iv);
+		src += XTS_PARALLEL_BLOCKS * AES_BLOCK_SIZE;
+		dst += XTS_PARALLEL_BLOCKS * AES_BLOCK_SIZE;
+	}
+
+	for (; nblocks; nblocks--) {
+		be128_xor((be128 *)dst, t, (be128 *)src);
+		if (enc)
+			aesni_enc(&ctx->crypt_ctx, dst, dst);
+		else
+			aesni_dec(&ctx->crypt_ctx, dst, dst);
+		be128_xor((be128 *)dst, (be128 *)dst, t);
+		gf128mul_x_ble(t, t);
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+	}
+}
+
+static int xts_crypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		     struct scatterlist *src, unsigned int nbytes, bool enc)
+{
+	struct aesni_xts_ctx *ctx = xts_ctx(crypto_blkcipher_ctx(desc->tfm));
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+	desc->flags &= ~CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	kernel_fpu_begin();
+	/* calculate first value of T */
+	if (walk.nbytes)
+		aesni_enc(&ctx->tweak_ctx, walk.iv, walk.iv);
+	while ((nbytes = walk.nbytes)) {
+		xts_crypt_blocks(ctx, walk.dst.virt.addr, walk.src.virt.addr,
+				 nbytes / AES_BLOCK_SIZE, walk.iv, enc);
+		nbytes &= AES_BLOCK_SIZE - 1;
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	kernel_fpu_end();
+
+	return err;
+}
+
+static int xts_encrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int xts_decrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, false);
+}
+
+static struct crypto_alg blk_xts_alg = {
+	.cra_name		= "__xts-aes-aesni",
+	.cra_driver_name	= "__driver-xts-aes-aesni",
+	.cra_priority		= 0,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesni_xts_ctx)+AESNI_ALIGN-1,
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(blk_xts_alg.cra_list),
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= xts_set_key,
+			.encrypt	= xts_encrypt,
+			.decrypt	= xts_decrypt,
+		},
+	},
+};
+
+static inline struct aesni_gcm_ctx *gcm_ctx(struct crypto_aead *tfm)
+{
+	return (struct aesni_gcm_ctx *)ALIGN(
+		(unsigned long)crypto_aead_ctx(tfm), AESNI_ALIGN);
+}
+
+/*
+ * Like aes_encrypt(), the aesni path is taken only when the caller
+ * already owns the fpu, everything below falls back to C otherwise.
+ */
+static void gcm_aes_encrypt(struct aesni_gcm_ctx *ctx, u8 *dst,
+			    const u8 *src, bool fpu)
+{
+	if (fpu)
+		aesni_enc(&ctx->aes_ctx, dst, src);
+	else
+		crypto_aes_encrypt_x86(&ctx->aes_ctx, dst, src);
+}
+
+static int gcm_set_key(struct crypto_aead *tfm, const u8 *key,
+		       unsigned int keylen)
+{
+	struct aesni_gcm_ctx *ctx = gcm_ctx(tfm);
+	bool fpu = irq_fpu_usable();
+	int err;
+
+	err = aes_set_key_common(crypto_aead_tfm(tfm), &ctx->aes_ctx,
+				 key, keylen);
+	if (err)
+		return err;
+
+	/* hash key H = E(K, 0^128) */
+	memset(&ctx->h, 0, sizeof(ctx->h));
+	if (fpu)
+		kernel_fpu_begin();
+	gcm_aes_encrypt(ctx, (u8 *)&ctx->h, (u8 *)&ctx->h, fpu);
+	if (fpu) {
+		aesni_gcm_ghash_setkey(ctx->hkey, (u8 *)&ctx->h);
+		kernel_fpu_end();
+	}
+	ctx->hkey_ready = fpu;
+
+	return 0;
+}
+
+static int gcm_set_authsize(struct crypto_aead *tfm, unsigned int authsize)
+{
+	switch (authsize) {
+	case 4:
+	case 8:
+	case 12:
+	case 13:
+	case 14:
+	case 15:
+	case 16:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* hash ^= src, zero padded to a whole number of blocks, times H */
+static void gcm_ghash(struct aesni_gcm_ctx *ctx, u8 *hash, const u8 *src,
+		      unsigned int len, bool fpu)
+{
+	unsigned int padlen = len & (AES_BLOCK_SIZE - 1);
+	u8 pad[AES_BLOCK_SIZE];
+
+	len -= padlen;
+	if (fpu) {
+		aesni_gcm_ghash(hash, src, len, ctx->hkey);
+		src += len;
+	} else {
+		for (; len; len -= AES_BLOCK_SIZE, src += AES_BLOCK_SIZE) {
+			crypto_xor(hash, src, AES_BLOCK_SIZE);
+			gf128mul_lle((be128 *)hash, &ctx->h);
+		}
+	}
+
+	if (padlen) {
+		memset(pad, 0, sizeof(pad));
+		memcpy(pad, src, padlen);
+		gcm_ghash(ctx, hash, pad, sizeof(pad), fpu);
+	}
+}
+
+/*
+ * GCM increments only the low 32 bits of the counter, aesni_ctr_enc()
+ * all 128: they agree as the 32 bits start at 2 and cryptlen is an
+ * unsigned int.
+ */
+static void gcm_ctr(struct aesni_gcm_ctx *ctx, u8 *dst, const u8 *src,
+		    unsigned int len, u8 *ctrblk, bool fpu)
+{
+	unsigned int tail = len & (AES_BLOCK_SIZE - 1);
+	u8 keystream[AES_BLOCK_SIZE];
+
+	len -= tail;
+	if (fpu) {
+		aesni_ctr_enc(&ctx->aes_ctx, dst, src, len, ctrblk);
+	} else {
+		for (; len; len -= AES_BLOCK_SIZE) {
+			crypto_aes_encrypt_x86(&ctx->aes_ctx, keystream,
+					       ctrblk);
+			crypto_inc(ctrblk, AES_BLOCK_SIZE);
+			crypto_xor(keystream, src, AES_BLOCK_SIZE);
+			memcpy(dst, keystream, AES_BLOCK_SIZE);
+			src += AES_BLOCK_SIZE;
+			dst += AES_BLOCK_SIZE;
+		}
+	}
+	src += len;
+	dst += len;
+
+	if (tail) {
+		gcm_aes_encrypt(ctx, keystream, ctrblk, fpu);
+		crypto_xor(keystream, src, tail);
+		memcpy(dst, keystream, tail);
+	}
+}
+
+static void gcm_crypt_linear(struct aesni_gcm_ctx *ctx, const u8 *iv,
+			     const u8 *assoc, unsigned int assoclen,
+			     u8 *dst, const u8 *src, unsigned int textlen,
+			     u8 *tag, bool enc)
+{
+	u8 ctrblk[AES_BLOCK_SIZE], mask[AES_BLOCK_SIZE];
+	bool fpu = ctx->hkey_ready && irq_fpu_usable();
+	be128 lengths;
+
+	/* J0 = IV || 0^31 || 1, the data starts at J0 + 1 */
+	memcpy(ctrblk, iv, 12);
+	*(__be32 *)(ctrblk + 12) = cpu_to_be32(1);
+	memset(tag, 0, AES_BLOCK_SIZE);
+	lengths.a = cpu_to_be64((u64)assoclen * 8);
+	lengths.b = cpu_to_be64((u64)textlen * 8);
+
+	if (fpu)
+		kernel_fpu_begin();
+	gcm_aes_encrypt(ctx, mask, ctrblk, fpu);
+	crypto_inc(ctrblk, AES_BLOCK_SIZE);
+
+	gcm_ghash(ctx, tag, assoc, assoclen, fpu);
+	if (enc) {
+		gcm_ctr(ctx, dst, src, textlen, ctrblk, fpu);
+		gcm_ghash(ctx, tag, dst, textlen, fpu);
+	} else {
+		gcm_ghash(ctx, tag, src, textlen, fpu);
+		gcm_ctr(ctx, dst, src, textlen, ctrblk, fpu);
+	}
+	gcm_ghash(ctx, tag, (u8 *)&lengths, sizeof(lengths), fpu);
+	if (fpu)
+		kernel_fpu_end();
+
+	crypto_xor(tag, mask, AES_BLOCK_SIZE);
+}
+
+/* Whether the first len bytes of sg can be used in place */
+static bool gcm_sg_is_linear(struct scatterlist *sg, unsigned int len)
+{
+	return !len || (sg->length >= len && !PageHighMem(sg_page(sg)));
+}
+
+static int gcm_crypt(struct aead_request *req, bool enc)
+{
+	struct crypto_aead *tfm = crypto_aead_reqtfm(req);
+	struct aesni_gcm_ctx *ctx = gcm_ctx(tfm);
+	unsigned int authsize = crypto_aead_authsize(tfm);
+	unsigned int assoclen = req->assoclen;
+	unsigned int textlen = req->cryptlen;
+	u8 tag[AES_BLOCK_SIZE], authtag[AES_BLOCK_SIZE];
+	u8 *assoc, *src, *dst, *buf = NULL;
+
+	if (!enc) {
+		if (textlen < authsize)
+			return -EINVAL;
+		textlen -= authsize;
+		scatterwalk_map_and_copy(authtag, req->src, textlen,
+					 authsize, 0);
+	}
+
+	/*
+	 * The common single buffer requests are done in place, anything
+	 * else goes through a linear copy.
+	 */
+	if (gcm_sg_is_linear(req->assoc, assoclen) &&
+	    gcm_sg_is_linear(req->src, textlen) &&
+	    gcm_sg_is_linear(req->dst, textlen)) {
+		assoc = assoclen ? sg_virt(req->assoc) : NULL;
+		src = textlen ? sg_virt(req->src) : NULL;
+		dst = textlen ? sg_virt(req->dst) : NULL;
+	} else {
+		buf = kmalloc(assoclen + textlen,
+			      req->base.flags & CRYPTO_TFM_REQ_MAY_SLEEP ?
+			      GFP_KERNEL : GFP_ATOMIC);
+		if (!buf)
+			return -ENOMEM;
+		assoc = buf;
+		src = dst = buf + assoclen;
+		scatterwalk_map_and_copy(assoc, req->assoc, 0, assoclen, 0);
+		scatterwalk_map_and_copy(src, req->src, 0, textlen, 0);
+	}
+
+	gcm_crypt_linear(ctx, req->iv, assoc, assoclen, dst, src, textlen,
+			 tag, enc);
+
+	if (buf) {
+		scatterwalk_map_and_copy(dst, req->dst, 0, textlen, 1);
+		kfree(buf);
+	}
+
+	if (enc) {
+		scatterwalk_map_and_copy(tag, req->dst, textlen, authsize, 1);
+		return 0;
+	}
+
+	return memcmp(tag, authtag, authsize) ? -EBADMSG : 0;
+}
+
+static int gcm_encrypt(struct aead_request *req)
+{
+	return gcm_crypt(req, true);
+}
+
+static int gcm_decrypt(struct aead_request *req)
+{
+	return gcm_crypt(req, false);
+}
+
+static struct crypto_alg aesni_gcm_alg = {
+	.cra_name		= "gcm(aes)",
+	.cra_driver_name	= "gcm-aes-aesni",
+	.cra_priority		= 400,
+	.cra_flags		= CRYPTO_ALG_TYPE_AEAD,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct aesni_gcm_ctx)+AESNI_ALIGN-1,
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_aead_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aesni_gcm_alg.cra_list),
+	.cra_u = {
+		.aead = {
+			.setkey		= gcm_set_key,
+			.setauthsize	= gcm_set_authsize,
+			.encrypt	= gcm_encrypt,
+			.decrypt	= gcm_decrypt,
+			.ivsize		= 16,
+			.maxauthsize	= 16,
+		},
+	},
+};
+
 static int ablk_set_key(struct crypto_ablkcipher *tfm, const u8 *key,
 			unsigned int key_len)
 {
@@ -691,13 +1083,11 @@ static struct crypto_alg ablk_pcbc_alg = {
 };
 #endif
 
-#ifdef HAS_XTS
 static int ablk_xts_init(struct crypto_tfm *tfm)
 {
 	struct cryptd_ablkcipher *cryptd_tfm;
 
-	cryptd_tfm = cryptd_alloc_ablkcipher("fpu(xts(__driver-aes-aesni))",
-					     0, 0);
+	cryptd_tfm = cryptd_alloc_ablkcipher("__driver-xts-aes-aesni", 0, 0);
 	if (IS_ERR(cryptd_tfm))
 		return PTR_ERR(cryptd_tfm);
 	ablk_init_common(tfm, cryptd_tfm);
@@ -728,7 +1118,6 @@ static struct crypto_alg ablk_xts_alg = {
 		},
 	},
 };
-#endif
 
 static int __init aesni_init(void)
 {
@@ -748,6 +1137,8 @@ static int __init aesni_init(void)
 		goto blk_cbc_err;
 	if ((err = crypto_register_alg(&blk_ctr_alg)))
 		goto blk_ctr_err;
+	if ((err = crypto_register_alg(&blk_xts_alg)))
+		goto blk_xts_err;
 	if ((err = crypto_register_alg(&ablk_ecb_alg)))
 		goto ablk_ecb_err;
 	if ((err = crypto_register_alg(&ablk_cbc_alg)))
@@ -766,16 +1157,17 @@ static int __init aesni_init(void)
 	if ((err = crypto_register_alg(&ablk_pcbc_alg)))
 		goto ablk_pcbc_err;
 #endif
-#ifdef HAS_XTS
 	if ((err = crypto_register_alg(&ablk_xts_alg)))
 		goto ablk_xts_err;
-#endif
+	/* GHASH is done with pclmulqdq */
+	if (cpu_has_pclmulqdq && (err = crypto_register_alg(&aesni_gcm_alg)))
+		goto aesni_gcm_err;
 
 	return err;
 
-#ifdef HAS_XTS
+aesni_gcm_err:
+	crypto_unregister_alg(&ablk_xts_alg);
 ablk_xts_err:
-#endif
 #ifdef HAS_PCBC
 	crypto_unregister_alg(&ablk_pcbc_alg);
 ablk_pcbc_err:
@@ -794,6 +1186,8 @@ ablk_ctr_err:
 ablk_cbc_err:
 	crypto_unregister_alg(&ablk_ecb_alg);
 ablk_ecb_err:
+	crypto_unregister_alg(&blk_xts_alg);
+blk_xts_err:
 	crypto_unregister_alg(&blk_ctr_alg);
 blk_ctr_err:
 	crypto_unregister_alg(&blk_cbc_alg);
@@ -809,9 +1203,9 @@ aes_err:
 
 static void __exit aesni_exit(void)
 {
-#ifdef HAS_XTS
+	if (cpu_has_pclmulqdq)
+		crypto_unregister_alg(&aesni_gcm_alg);
 	crypto_unregister_alg(&ablk_xts_alg);
-#endif
 #ifdef HAS_PCBC
 	crypto_unregister_alg(&ablk_pcbc_alg);
 #endif
@@ -824,6 +1218,7 @@ static void __exit aesni_exit(void)
 	crypto_unregister_alg(&ablk_ctr_alg);
 	crypto_unregister_alg(&ablk_cbc_alg);
 	crypto_unregister_alg(&ablk_ecb_alg);
+	crypto_unregister_alg(&blk_xts_alg);
 	crypto_unregister_alg(&blk_ctr_alg);
 	crypto_unregister_alg(&blk_cbc_alg);
 	crypto_unregister_alg(&blk_ecb_alg);
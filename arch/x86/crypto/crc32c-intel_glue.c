@@ -31,6 +31,7 @@
 #include <crypto/internal/hash.h>
 
 #include <asm/cpufeature.h>
+#include <asm/i387.h>
 
 #define CHKSUM_BLOCK_SIZE	1
 #define CHKSUM_DIGEST_SIZE	4
@@ -79,6 +80,106 @@ static u32 __pure crc32c_intel_le_hw(u32 crc, unsigned char const *p, size_t len
 	return crc;
 }
 
+#ifdef CONFIG_X86_64
+/*
+ * The crc32 instruction has a latency of 3 cycles but a throughput of
+ * one per cycle: large buffers are split in three lanes crc'ed at once,
+ * whose crcs are then shifted into place with pclmulqdq and combined.
+ * Below the breakeven, saving the fpu state costs more than it gains.
+ */
+#define CRC32C_PCL_BREAKEVEN	512
+#define CRC32C_LANE_LONG	1024
+#define CRC32C_LANE_SHORT	128
+
+asmlinkage u64 crc32c_pcl_shift(u32 crc0, u32 k0, u32 crc1, u32 k1);
+
+static bool crc32c_use_pcl __read_mostly;
+
+/* Shift constants for the long and short lanes, by one and two lanes */
+static u32 crc32c_lane_k[2][2] __read_mostly;
+
+static inline u32 crc32c_intel_le_hw_word(u32 crc, unsigned long data)
+{
+	__asm__ __volatile__(
+		".byte 0xf2, " REX_PRE "0xf, 0x38, 0xf1, 0xf1;"
+		:"=S"(crc)
+		:"0"(crc), "c"(data)
+	);
+
+	return crc;
+}
+
+/* x^(8 * bytes - 33) mod P, bit reflected: see crc32c-pcl-intel-asm_64.S */
+static u32 __init crc32c_shift_k(unsigned int bytes)
+{
+	unsigned int n = 8 * bytes - 33;
+	u32 k = 0x80000000;
+
+	while (n--)
+		k = (k >> 1) ^ ((k & 1) ? 0x82F63B78 : 0);
+
+	return k;
+}
+
+static u32 crc32c_3way_block(u32 crc, unsigned long const *p0,
+			     unsigned int words, const u32 *k)
+{
+	unsigned long const *p1 = p0 + words, *p2 = p1 + words;
+	u32 crc1 = 0, crc2 = 0;
+	unsigned int i;
+
+	for (i = 0; i < words; i++) {
+		crc = crc32c_intel_le_hw_word(crc, p0[i]);
+		crc1 = crc32c_intel_le_hw_word(crc1, p1[i]);
+		crc2 = crc32c_intel_le_hw_word(crc2, p2[i]);
+	}
+
+	return crc32c_intel_le_hw_word(0, crc32c_pcl_shift(crc, k[1],
+							  crc1, k[0])) ^ crc2;
+}
+
+static u32 crc32c_pcl_le_hw(u32 crc, unsigned char const *p, size_t len)
+{
+	if (!crc32c_use_pcl || len < CRC32C_PCL_BREAKEVEN ||
+	    !irq_fpu_usable())
+		return crc32c_intel_le_hw(crc, p, len);
+
+	kernel_fpu_begin();
+	while (len >= 3 * CRC32C_LANE_LONG) {
+		crc = crc32c_3way_block(crc, (unsigned long const *)p,
+					CRC32C_LANE_LONG / SCALE_F,
+					crc32c_lane_k[0]);
+		p += 3 * CRC32C_LANE_LONG;
+		len -= 3 * CRC32C_LANE_LONG;
+	}
+	while (len >= 3 * CRC32C_LANE_SHORT) {
+		crc = crc32c_3way_block(crc, (unsigned long const *)p,
+					CRC32C_LANE_SHORT / SCALE_F,
+					crc32c_lane_k[1]);
+		p += 3 * CRC32C_LANE_SHORT;
+		len -= 3 * CRC32C_LANE_SHORT;
+	}
+	kernel_fpu_end();
+
+	return crc32c_intel_le_hw(crc, p, len);
+}
+
+static void __init crc32c_pcl_init(void)
+{
+	if (!cpu_has_pclmulqdq)
+		return;
+
+	crc32c_lane_k[0][0] = crc32c_shift_k(CRC32C_LANE_LONG);
+	crc32c_lane_k[0][1] = crc32c_shift_k(2 * CRC32C_LANE_LONG);
+	crc32c_lane_k[1][0] = crc32c_shift_k(CRC32C_LANE_SHORT);
+	crc32c_lane_k[1][1] = crc32c_shift_k(2 * CRC32C_LANE_SHORT);
+	crc32c_use_pcl = true;
+}
+#else
+#define crc32c_pcl_le_hw(crc, p, len)	crc32c_intel_le_hw(crc, p, len)
+static inline void crc32c_pcl_init(void) { }
+#endif
+
 /*
  * Setting the seed allows arbitrary accumulators and flexible XOR policy
  * If your algorithm starts with ~0, then XOR with ~0 before you set
@@ -112,14 +213,14 @@ static int crc32c_intel_update(struct shash_desc *desc, const u8 *data,
 {
 	u32 *crcp = shash_desc_ctx(desc);
 
-	*crcp = crc32c_intel_le_hw(*crcp, data, len);
+	*crcp = crc32c_pcl_le_hw(*crcp, data, len);
 	return 0;
 }
 
 static int __crc32c_intel_finup(u32 *crcp, const u8 *data, unsigned int len,
 				u8 *out)
 {
-	*(__le32 *)out = ~cpu_to_le32(crc32c_intel_le_hw(*crcp, data, len));
+	*(__le32 *)out = ~cpu_to_le32(crc32c_pcl_le_hw(*crcp, data, len));
 	return 0;
 }
 
@@ -176,10 +277,11 @@ static struct shash_alg alg = {
 
 static int __init crc32c_intel_mod_init(void)
 {
-	if (cpu_has_xmm4_2)
-		return crypto_register_shash(&alg);
-	else
+	if (!cpu_has_xmm4_2)
 		return -ENODEV;
+
+	crc32c_pcl_init();
+	return crypto_register_shash(&alg);
 }
 
 static void __exit crc32c_intel_mod_fini(void)
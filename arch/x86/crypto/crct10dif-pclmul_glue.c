@@ -0,0 +1,136 @@
+/*
+ * T10 DIF CRC16 calculation accelerated with the PCLMULQDQ instruction.
+ *
+ * The buffer is folded down to 16 bytes with the same crc by
+ * crct10dif-pcl-asm_64.S, and the table of crct10dif-generic does the rest.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/crc-t10dif.h>
+#include <crypto/internal/hash.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/kernel.h>
+#include <asm/i387.h>
+#include <asm/cpufeature.h>
+
+/* Below this, saving the fpu state costs more than folding gains */
+#define CRCT10DIF_PCL_BREAKEVEN	64
+
+asmlinkage void crc_t10dif_pcl_fold(u8 *out, const u8 *buf, unsigned long len,
+				    u16 crc);
+
+struct chksum_desc_ctx {
+	__u16 crc;
+};
+
+static __u16 crc_t10dif_pcl(__u16 crc, const u8 *buf, size_t len)
+{
+	u8 folded[16];
+	size_t bulk = len & ~15UL;
+
+	if (len < CRCT10DIF_PCL_BREAKEVEN || !irq_fpu_usable())
+		return crc_t10dif_generic(crc, buf, len);
+
+	kernel_fpu_begin();
+	crc_t10dif_pcl_fold(folded, buf, bulk, crc);
+	kernel_fpu_end();
+
+	crc = crc_t10dif_generic(0, folded, sizeof(folded));
+	return crc_t10dif_generic(crc, buf + bulk, len - bulk);
+}
+
+static int chksum_init(struct shash_desc *desc)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = 0;
+
+	return 0;
+}
+
+static int chksum_update(struct shash_desc *desc, const u8 *data,
+			 unsigned int length)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = crc_t10dif_pcl(ctx->crc, data, length);
+	return 0;
+}
+
+static int chksum_final(struct shash_desc *desc, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	*(__u16 *)out = ctx->crc;
+	return 0;
+}
+
+static int __chksum_finup(__u16 *crcp, const u8 *data, unsigned int len,
+			u8 *out)
+{
+	*(__u16 *)out = crc_t10dif_pcl(*crcp, data, len);
+	return 0;
+}
+
+static int chksum_finup(struct shash_desc *desc, const u8 *data,
+			unsigned int len, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	return __chksum_finup(&ctx->crc, data, len, out);
+}
+
+static int chksum_digest(struct shash_desc *desc, const u8 *data,
+			 unsigned int length, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = 0;
+	return __chksum_finup(&ctx->crc, data, length, out);
+}
+
+static struct shash_alg alg = {
+	.digestsize		=	CRC_T10DIF_DIGEST_SIZE,
+	.init			=	chksum_init,
+	.update			=	chksum_update,
+	.final			=	chksum_final,
+	.finup			=	chksum_finup,
+	.digest			=	chksum_digest,
+	.descsize		=	sizeof(struct chksum_desc_ctx),
+	.base			=	{
+		.cra_name		=	"crct10dif",
+		.cra_driver_name	=	"crct10dif-pclmul",
+		.cra_priority		=	200,
+		.cra_blocksize		=	CRC_T10DIF_BLOCK_SIZE,
+		.cra_module		=	THIS_MODULE,
+	}
+};
+
+static int __init crct10dif_pclmul_mod_init(void)
+{
+	/* The folding byte swaps its blocks with pshufb */
+	if (!cpu_has_pclmulqdq || !boot_cpu_has(X86_FEATURE_SSSE3))
+		return -ENODEV;
+
+	return crypto_register_shash(&alg);
+}
+
+static void __exit crct10dif_pclmul_mod_fini(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(crct10dif_pclmul_mod_init);
+module_exit(crct10dif_pclmul_mod_fini);
+
+MODULE_DESCRIPTION("T10 DIF CRC calculation accelerated with PCLMULQDQ.");
+MODULE_LICENSE("GPL");
+
+MODULE_ALIAS("crct10dif");
+MODULE_ALIAS("crct10dif-pclmul");
@@ -0,0 +1,570 @@
+/*
+ * Multi-buffer SHA-1 and SHA-256.
+ *
+ * A single SHA stream is serial, one block depends on the digest of the
+ * one before, so a vector unit cannot speed it up.  Independent streams
+ * can share it though: requests submitted on a cpu are queued to a
+ * per cpu manager, whose worker hashes up to four of them at once, one
+ * per 32 bit lane of the SSE registers.  A partially filled batch is
+ * flushed after SHA_MB_FLUSH_DELAY, so a lone request only waits that
+ * long for company.
+ *
+ * The latency added by the batching makes this a throughput choice for
+ * users with many requests in flight, so the priority is below that of
+ * the generic code and it has to be asked for by driver name.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/scatterlist.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <crypto/algapi.h>
+#include <crypto/crypto_wq.h>
+#include <crypto/scatterwalk.h>
+#include <crypto/sha.h>
+#include <crypto/internal/hash.h>
+#include <asm/byteorder.h>
+#include <asm/cpufeature.h>
+#include <asm/i387.h>
+
+#define SHA_MB_LANES		4
+#define SHA_MB_BLOCK_SIZE	64
+#define SHA_MB_MAX_WORDS	8
+#define SHA_MB_MAX_CPU_QLEN	100
+#define SHA_MB_FLUSH_DELAY	1
+
+typedef void (sha_mb_x4_fn)(u32 digest[][SHA_MB_LANES], const u8 *data[],
+			    unsigned int blocks);
+
+asmlinkage void sha1_mb_x4_sse(u32 digest[][SHA_MB_LANES], const u8 *data[],
+			       unsigned int blocks);
+asmlinkage void sha256_mb_x4_sse(u32 digest[][SHA_MB_LANES],
+				 const u8 *data[], unsigned int blocks);
+
+struct sha_mb_lane {
+	struct ahash_request *req;
+	const u8 *data;
+	unsigned int blocks;
+};
+
+struct sha_mb_alg;
+
+struct sha_mb_mgr {
+	/* The digests of the lanes, transposed as the x4 routines want */
+	u32 digest[SHA_MB_MAX_WORDS][SHA_MB_LANES] __aligned(16);
+	struct sha_mb_lane lane[SHA_MB_LANES];
+	struct crypto_queue queue;
+	struct work_struct work;
+	struct delayed_work flush;
+	struct sha_mb_alg *alg;
+};
+
+struct sha_mb_alg {
+	struct ahash_alg alg;
+	struct sha_mb_mgr __percpu *mgr;
+	unsigned int words;
+	const u32 *iv;
+	sha_mb_x4_fn *x4;
+};
+
+struct sha_mb_req_ctx {
+	u32 state[SHA_MB_MAX_WORDS];
+	u64 count;
+	u8 buf[2 * SHA_MB_BLOCK_SIZE];
+
+	/* What is left of the data of the request being processed */
+	struct scatterlist *sg;
+	unsigned int offset;
+	unsigned int nbytes;
+	bool final;
+	u8 *out;
+};
+
+static const u32 sha1_mb_iv[SHA1_DIGEST_SIZE / 4] = {
+	SHA1_H0, SHA1_H1, SHA1_H2, SHA1_H3, SHA1_H4,
+};
+
+static const u32 sha256_mb_iv[SHA256_DIGEST_SIZE / 4] = {
+	SHA256_H0, SHA256_H1, SHA256_H2, SHA256_H3,
+	SHA256_H4, SHA256_H5, SHA256_H6, SHA256_H7,
+};
+
+static struct sha_mb_alg *sha_mb_alg(struct ahash_request *req)
+{
+	struct crypto_tfm *tfm = crypto_ahash_tfm(crypto_ahash_reqtfm(req));
+
+	return container_of(__crypto_ahash_alg(tfm->__crt_alg),
+			    struct sha_mb_alg, alg);
+}
+
+static void sha_mb_consume(struct sha_mb_req_ctx *rctx, unsigned int n)
+{
+	rctx->count += n;
+	rctx->offset += n;
+	rctx->nbytes -= n;
+}
+
+/* Append the padding in buf and return the number of blocks it takes */
+static unsigned int sha_mb_pad(struct sha_mb_req_ctx *rctx)
+{
+	unsigned int partial = rctx->count % SHA_MB_BLOCK_SIZE;
+	unsigned int len = partial < SHA_MB_BLOCK_SIZE - 8 ?
+			   SHA_MB_BLOCK_SIZE : 2 * SHA_MB_BLOCK_SIZE;
+
+	rctx->buf[partial] = 0x80;
+	memset(rctx->buf + partial + 1, 0, len - 8 - partial - 1);
+	*(__be64 *)(rctx->buf + len - 8) = cpu_to_be64(rctx->count << 3);
+
+	return len / SHA_MB_BLOCK_SIZE;
+}
+
+/*
+ * Point the lane at the next whole blocks of its request: straight into
+ * the scatterlist where it can, through buf for blocks straddling a
+ * segment and for the padding.  Returns false when the request is done.
+ */
+static bool sha_mb_next_job(struct sha_mb_lane *lane)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(lane->req);
+	unsigned int partial, avail, n;
+	const u8 *p;
+
+	while (rctx->nbytes) {
+		while (rctx->offset >= rctx->sg->length) {
+			rctx->sg = scatterwalk_sg_next(rctx->sg);
+			rctx->offset = 0;
+		}
+
+		partial = rctx->count % SHA_MB_BLOCK_SIZE;
+		avail = min(rctx->sg->length - rctx->offset, rctx->nbytes);
+		p = sg_virt(rctx->sg) + rctx->offset;
+
+		if (!partial && avail >= SHA_MB_BLOCK_SIZE) {
+			n = avail / SHA_MB_BLOCK_SIZE;
+			sha_mb_consume(rctx, n * SHA_MB_BLOCK_SIZE);
+			lane->data = p;
+			lane->blocks = n;
+			return true;
+		}
+
+		n = min(avail, SHA_MB_BLOCK_SIZE - partial);
+		memcpy(rctx->buf + partial, p, n);
+		sha_mb_consume(rctx, n);
+		if (partial + n == SHA_MB_BLOCK_SIZE) {
+			lane->data = rctx->buf;
+			lane->blocks = 1;
+			return true;
+		}
+	}
+
+	if (!rctx->final)
+		return false;
+
+	rctx->final = false;
+	lane->data = rctx->buf;
+	lane->blocks = sha_mb_pad(rctx);
+	return true;
+}
+
+static void sha_mb_complete(struct crypto_async_request *async, int err)
+{
+	local_bh_disable();
+	async->complete(async, err);
+	local_bh_enable();
+}
+
+static void sha_mb_finish(struct sha_mb_mgr *mgr, int i)
+{
+	struct ahash_request *req = mgr->lane[i].req;
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+	unsigned int w;
+
+	mgr->lane[i].req = NULL;
+
+	for (w = 0; w < mgr->alg->words; w++)
+		rctx->state[w] = mgr->digest[w][i];
+
+	if (rctx->out) {
+		__be32 *out = (__be32 *)rctx->out;
+
+		for (w = 0; w < mgr->alg->words; w++)
+			out[w] = cpu_to_be32(rctx->state[w]);
+	}
+
+	sha_mb_complete(&req->base, 0);
+}
+
+/* Move queued requests into the free lanes */
+static void sha_mb_fill_lanes(struct sha_mb_mgr *mgr)
+{
+	struct crypto_async_request *async, *backlog;
+	struct sha_mb_req_ctx *rctx;
+	struct sha_mb_lane *lane;
+	unsigned int w;
+	int i;
+
+	for (i = 0; i < SHA_MB_LANES; i++) {
+		lane = &mgr->lane[i];
+		while (!lane->req) {
+			local_bh_disable();
+			backlog = crypto_get_backlog(&mgr->queue);
+			async = crypto_dequeue_request(&mgr->queue);
+			local_bh_enable();
+
+			if (!async)
+				return;
+			if (backlog)
+				sha_mb_complete(backlog, -EINPROGRESS);
+
+			lane->req = ahash_request_cast(async);
+			rctx = ahash_request_ctx(lane->req);
+			for (w = 0; w < mgr->alg->words; w++)
+				mgr->digest[w][i] = rctx->state[w];
+
+			if (!sha_mb_next_job(lane))
+				sha_mb_finish(mgr, i);
+		}
+	}
+}
+
+static void sha_mb_run(struct sha_mb_mgr *mgr)
+{
+	const u8 *data[SHA_MB_LANES];
+	struct sha_mb_lane *lane;
+	unsigned int blocks;
+	int i, active;
+
+	for (;;) {
+		sha_mb_fill_lanes(mgr);
+
+		active = -1;
+		blocks = UINT_MAX;
+		for (i = 0; i < SHA_MB_LANES; i++) {
+			if (mgr->lane[i].req) {
+				active = i;
+				blocks = min(blocks, mgr->lane[i].blocks);
+			}
+		}
+		if (active < 0)
+			return;
+
+		/* Idle lanes hash a copy of a busy one, and nobody looks */
+		for (i = 0; i < SHA_MB_LANES; i++)
+			data[i] = mgr->lane[mgr->lane[i].req ? i : active].data;
+
+		kernel_fpu_begin();
+		mgr->alg->x4(mgr->digest, data, blocks);
+		kernel_fpu_end();
+
+		for (i = 0; i < SHA_MB_LANES; i++) {
+			lane = &mgr->lane[i];
+			if (!lane->req)
+				continue;
+			lane->data += blocks * SHA_MB_BLOCK_SIZE;
+			lane->blocks -= blocks;
+			if (!lane->blocks && !sha_mb_next_job(lane))
+				sha_mb_finish(mgr, i);
+		}
+
+		if (need_resched()) {
+			queue_work(kcrypto_wq, &mgr->work);
+			return;
+		}
+	}
+}
+
+static void sha_mb_work(struct work_struct *work)
+{
+	sha_mb_run(container_of(work, struct sha_mb_mgr, work));
+}
+
+static void sha_mb_flush(struct work_struct *work)
+{
+	sha_mb_run(container_of(work, struct sha_mb_mgr, flush.work));
+}
+
+/*
+ * Queue req to the manager of this cpu.  A full batch is started right
+ * away, anything less waits for the flush in case more requests come.
+ */
+static int sha_mb_enqueue(struct ahash_request *req)
+{
+	struct sha_mb_alg *alg = sha_mb_alg(req);
+	struct sha_mb_mgr *mgr;
+	bool full;
+	int cpu, err;
+
+	cpu = get_cpu();
+	mgr = per_cpu_ptr(alg->mgr, cpu);
+
+	local_bh_disable();
+	err = crypto_enqueue_request(&mgr->queue, &req->base);
+	full = mgr->queue.qlen >= SHA_MB_LANES;
+	local_bh_enable();
+
+	if (full)
+		queue_work_on(cpu, kcrypto_wq, &mgr->work);
+	else
+		queue_delayed_work_on(cpu, kcrypto_wq, &mgr->flush,
+				      SHA_MB_FLUSH_DELAY);
+	put_cpu();
+
+	return err;
+}
+
+static int sha_mb_submit(struct ahash_request *req, unsigned int nbytes,
+			 bool final)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+
+	rctx->sg = req->src;
+	rctx->offset = 0;
+	rctx->nbytes = nbytes;
+	rctx->final = final;
+	rctx->out = final ? req->result : NULL;
+
+	return sha_mb_enqueue(req);
+}
+
+static int sha_mb_init(struct ahash_request *req)
+{
+	struct sha_mb_alg *alg = sha_mb_alg(req);
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+
+	memcpy(rctx->state, alg->iv, alg->words * sizeof(u32));
+	rctx->count = 0;
+
+	return 0;
+}
+
+static int sha_mb_update(struct ahash_request *req)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+	unsigned int partial = rctx->count % SHA_MB_BLOCK_SIZE;
+
+	/* Not worth a trip through the queue if no block gets completed */
+	if (partial + req->nbytes < SHA_MB_BLOCK_SIZE) {
+		scatterwalk_map_and_copy(rctx->buf + partial, req->src, 0,
+					 req->nbytes, 0);
+		rctx->count += req->nbytes;
+		return 0;
+	}
+
+	return sha_mb_submit(req, req->nbytes, false);
+}
+
+static int sha_mb_final(struct ahash_request *req)
+{
+	return sha_mb_submit(req, 0, true);
+}
+
+static int sha_mb_finup(struct ahash_request *req)
+{
+	return sha_mb_submit(req, req->nbytes, true);
+}
+
+static int sha_mb_digest(struct ahash_request *req)
+{
+	sha_mb_init(req);
+	return sha_mb_finup(req);
+}
+
+static int sha1_mb_export(struct ahash_request *req, void *out)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+	struct sha1_state *sctx = out;
+
+	sctx->count = rctx->count;
+	memcpy(sctx->state, rctx->state, sizeof(sctx->state));
+	memcpy(sctx->buffer, rctx->buf, sizeof(sctx->buffer));
+
+	return 0;
+}
+
+static int sha1_mb_import(struct ahash_request *req, const void *in)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+	const struct sha1_state *sctx = in;
+
+	rctx->count = sctx->count;
+	memcpy(rctx->state, sctx->state, sizeof(sctx->state));
+	memcpy(rctx->buf, sctx->buffer, sizeof(sctx->buffer));
+
+	return 0;
+}
+
+static int sha256_mb_export(struct ahash_request *req, void *out)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+	struct sha256_state *sctx = out;
+
+	sctx->count = rctx->count;
+	memcpy(sctx->state, rctx->state, sizeof(sctx->state));
+	memcpy(sctx->buf, rctx->buf, sizeof(sctx->buf));
+
+	return 0;
+}
+
+static int sha256_mb_import(struct ahash_request *req, const void *in)
+{
+	struct sha_mb_req_ctx *rctx = ahash_request_ctx(req);
+	const struct sha256_state *sctx = in;
+
+	rctx->count = sctx->count;
+	memcpy(rctx->state, sctx->state, sizeof(sctx->state));
+	memcpy(rctx->buf, sctx->buf, sizeof(sctx->buf));
+
+	return 0;
+}
+
+static int sha_mb_cra_init(struct crypto_tfm *tfm)
+{
+	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm),
+				 sizeof(struct sha_mb_req_ctx));
+	return 0;
+}
+
+static struct sha_mb_alg sha_mb_algs[] = { {
+	.alg = {
+		.init		=	sha_mb_init,
+		.update		=	sha_mb_update,
+		.final		=	sha_mb_final,
+		.finup		=	sha_mb_finup,
+		.digest		=	sha_mb_digest,
+		.export		=	sha1_mb_export,
+		.import		=	sha1_mb_import,
+		.halg = {
+			.digestsize	=	SHA1_DIGEST_SIZE,
+			.statesize	=	sizeof(struct sha1_state),
+			.base		=	{
+				.cra_name		=	"sha1",
+				.cra_driver_name	=	"sha1-mb",
+				.cra_priority		=	50,
+				.cra_flags		=	CRYPTO_ALG_TYPE_AHASH |
+								CRYPTO_ALG_ASYNC,
+				.cra_blocksize		=	SHA1_BLOCK_SIZE,
+				.cra_init		=	sha_mb_cra_init,
+				.cra_module		=	THIS_MODULE,
+			}
+		}
+	},
+	.words	= SHA1_DIGEST_SIZE / 4,
+	.iv	= sha1_mb_iv,
+	.x4	= sha1_mb_x4_sse,
+}, {
+	.alg = {
+		.init		=	sha_mb_init,
+		.update		=	sha_mb_update,
+		.final		=	sha_mb_final,
+		.finup		=	sha_mb_finup,
+		.digest		=	sha_mb_digest,
+		.export		=	sha256_mb_export,
+		.import		=	sha256_mb_import,
+		.halg = {
+			.digestsize	=	SHA256_DIGEST_SIZE,
+			.statesize	=	sizeof(struct sha256_state),
+			.base		=	{
+				.cra_name		=	"sha256",
+				.cra_driver_name	=	"sha256-mb",
+				.cra_priority		=	50,
+				.cra_flags		=	CRYPTO_ALG_TYPE_AHASH |
+								CRYPTO_ALG_ASYNC,
+				.cra_blocksize		=	SHA256_BLOCK_SIZE,
+				.cra_init		=	sha_mb_cra_init,
+				.cra_module		=	THIS_MODULE,
+			}
+		}
+	},
+	.words	= SHA256_DIGEST_SIZE / 4,
+	.iv	= sha256_mb_iv,
+	.x4	= sha256_mb_x4_sse,
+} };
+
+static void sha_mb_free(struct sha_mb_alg *alg)
+{
+	struct sha_mb_mgr *mgr;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		mgr = per_cpu_ptr(alg->mgr, cpu);
+		cancel_delayed_work_sync(&mgr->flush);
+		cancel_work_sync(&mgr->work);
+		BUG_ON(mgr->queue.qlen);
+	}
+	free_percpu(alg->mgr);
+}
+
+static int sha_mb_register(struct sha_mb_alg *alg)
+{
+	struct sha_mb_mgr *mgr;
+	int cpu, err;
+
+	alg->mgr = alloc_percpu(struct sha_mb_mgr);
+	if (!alg->mgr)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		mgr = per_cpu_ptr(alg->mgr, cpu);
+		crypto_init_queue(&mgr->queue, SHA_MB_MAX_CPU_QLEN);
+		INIT_WORK(&mgr->work, sha_mb_work);
+		INIT_DELAYED_WORK(&mgr->flush, sha_mb_flush);
+		mgr->alg = alg;
+	}
+
+	err = crypto_register_ahash(&alg->alg);
+	if (err)
+		free_percpu(alg->mgr);
+	return err;
+}
+
+static void sha_mb_unregister(struct sha_mb_alg *alg)
+{
+	crypto_unregister_ahash(&alg->alg);
+	sha_mb_free(alg);
+}
+
+static int __init sha_mb_mod_init(void)
+{
+	int i, err;
+
+	/* The input words are byte swapped with pshufb */
+	if (!boot_cpu_has(X86_FEATURE_SSSE3))
+		return -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(sha_mb_algs); i++) {
+		err = sha_mb_register(&sha_mb_algs[i]);
+		if (err)
+			goto err_unregister;
+	}
+
+	return 0;
+
+err_unregister:
+	while (--i >= 0)
+		sha_mb_unregister(&sha_mb_algs[i]);
+	return err;
+}
+
+static void __exit sha_mb_mod_fini(void)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(sha_mb_algs) - 1; i >= 0; i--)
+		sha_mb_unregister(&sha_mb_algs[i]);
+}
+
+module_init(sha_mb_mod_init);
+module_exit(sha_mb_mod_fini);
+
+MODULE_DESCRIPTION("SHA1 and SHA256 of four buffers at once, SSSE3 accelerated");
+MODULE_LICENSE("GPL");
+
+MODULE_ALIAS("sha1-mb");
+MODULE_ALIAS("sha256-mb");
@@ -182,6 +182,7 @@
 
 /* Intel-defined CPU features, CPUID level 0x00000007:0 (ebx), word 9 */
 #define X86_FEATURE_FSGSBASE	(9*32+ 0) /* {RD/WR}{FS/GS}BASE instructions*/
+#define X86_FEATURE_AVX2	(9*32+ 5) /* AVX2 instructions */
 
 #if defined(__KERNEL__) && !defined(__ASSEMBLY__)
 
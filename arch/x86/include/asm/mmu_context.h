@@ -41,6 +41,8 @@ static inline void switch_mm(struct mm_struct *prev, struct mm_struct *next,
 #ifdef CONFIG_SMP
 		percpu_write(cpu_tlbstate.state, TLBSTATE_OK);
 		percpu_write(cpu_tlbstate.active_mm, next);
+		/* the CR3 load below flushes anyway */
+		percpu_write(cpu_tlbstate.lazy_flush, 0);
 #endif
 		cpumask_set_cpu(cpu, mm_cpumask(next));
 
@@ -65,6 +67,14 @@ static inline void switch_mm(struct mm_struct *prev, struct mm_struct *next,
 			 */
 			load_cr3(next->pgd);
 			load_LDT_nolock(&next->context);
+		} else if (unlikely(percpu_read(cpu_tlbstate.lazy_flush))) {
+			/*
+			 * A flush for next was skipped while we were lazy.
+			 * The locked test_and_set above orders our TLBSTATE_OK
+			 * store before this load: see flush_tlb_skip_lazy().
+			 */
+			percpu_write(cpu_tlbstate.lazy_flush, 0);
+			local_flush_tlb();
 		}
 	}
 #endif
@@ -99,6 +99,13 @@ static inline void flush_tlb_mm(struct mm_struct *mm)
 		__flush_tlb();
 }
 
+static inline void flush_tlb_mm_range(struct mm_struct *mm,
+				      unsigned long start, unsigned long end,
+				      bool freed_tables)
+{
+	flush_tlb_mm(mm);
+}
+
 static inline void flush_tlb_page(struct vm_area_struct *vma,
 				  unsigned long addr)
 {
@@ -132,6 +139,8 @@ static inline void reset_lazy_tlbstate(void)
 extern void flush_tlb_all(void);
 extern void flush_tlb_current_task(void);
 extern void flush_tlb_mm(struct mm_struct *);
+extern void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
+			       unsigned long end, bool freed_tables);
 extern void flush_tlb_page(struct vm_area_struct *, unsigned long);
 
 #define flush_tlb()	flush_tlb_current_task()
@@ -151,6 +160,8 @@ void native_flush_tlb_others(const struct cpumask *cpumask,
 struct tlb_state {
 	struct mm_struct *active_mm;
 	int state;
+	/* a flush was skipped while lazy: flush before using active_mm */
+	int lazy_flush;
 };
 DECLARE_PER_CPU_SHARED_ALIGNED(struct tlb_state, cpu_tlbstate);
 
@@ -158,6 +169,7 @@ static inline void reset_lazy_tlbstate(void)
 {
 	percpu_write(cpu_tlbstate.state, 0);
 	percpu_write(cpu_tlbstate.active_mm, &init_mm);
+	percpu_write(cpu_tlbstate.lazy_flush, 0);
 }
 
 #endif	/* SMP */
@@ -669,6 +669,12 @@ __SYSCALL(__NR_fanotify_init, sys_fanotify_init)
 __SYSCALL(__NR_fanotify_mark, sys_fanotify_mark)
 #define __NR_prlimit64				302
 __SYSCALL(__NR_prlimit64, sys_prlimit64)
+#define __NR_sendmmsg				303
+__SYSCALL(__NR_sendmmsg, sys_sendmmsg)
+#define __NR_syncfs				304
+__SYSCALL(__NR_syncfs, sys_syncfs)
+#define __NR_mq_timedreceive_batch		305
+__SYSCALL(__NR_mq_timedreceive_batch, sys_mq_timedreceive_batch)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
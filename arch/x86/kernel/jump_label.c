@@ -0,0 +1,97 @@
+/*
+ * Patching of the jump label sites, see include/linux/jump_label.h.
+ *
+ * A disabled site is a single 5 byte nop, an enabled one a jmp rel32 to
+ * the label; both are one instruction, so the site is never seen half
+ * patched by a cpu that was inside it.
+ */
+#include <linux/jump_label.h>
+#include <linux/memory.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/cpu.h>
+#include <asm/alternative.h>
+
+#ifdef HAVE_JUMP_LABEL
+
+/* Sites patched per stop_machine() */
+#define JUMP_LABEL_POKE_BATCH	16
+
+union jump_code_union {
+	char code[JUMP_LABEL_NOP_SIZE];
+	struct {
+		char jump;
+		int offset;
+	} __attribute__((packed));
+};
+
+/* ds lea 0(%esi),%esi on 32 bit, o16 o16 o16 o16 nop on 64 bit */
+#ifdef CONFIG_X86_64
+static const unsigned char jump_label_nop[JUMP_LABEL_NOP_SIZE] = {
+	0x66, 0x66, 0x66, 0x66, 0x90
+};
+#else
+static const unsigned char jump_label_nop[JUMP_LABEL_NOP_SIZE] = {
+	0x3e, 0x8d, 0x74, 0x26, 0x00
+};
+#endif
+
+static void jump_label_set_code(union jump_code_union *code,
+				struct jump_entry *entry,
+				enum jump_label_type type)
+{
+	if (type == JUMP_LABEL_ENABLE) {
+		code->jump = 0xe9;
+		code->offset = entry->target -
+			       (entry->code + JUMP_LABEL_NOP_SIZE);
+	} else
+		memcpy(code->code, jump_label_nop, JUMP_LABEL_NOP_SIZE);
+}
+
+/* Serialized by jump_label_mutex in the callers */
+static struct text_poke_param jump_label_params[JUMP_LABEL_POKE_BATCH];
+static union jump_code_union jump_label_codes[JUMP_LABEL_POKE_BATCH];
+
+void arch_jump_label_transform(struct jump_entry *entries, int nr,
+			       enum jump_label_type type)
+{
+	struct jump_entry *entry;
+	union jump_code_union *code;
+	int i, c = 0;
+
+	get_online_cpus();
+	mutex_lock(&text_mutex);
+	for (i = 0; i < nr; i++) {
+		entry = &entries[i];
+		/* init text is gone once booted or the module initialized */
+		if (!kernel_text_address(entry->code))
+			continue;
+
+		code = &jump_label_codes[c];
+		jump_label_set_code(code, entry, type);
+		jump_label_params[c].addr = (void *)entry->code;
+		jump_label_params[c].opcode = code->code;
+		jump_label_params[c].len = JUMP_LABEL_NOP_SIZE;
+		if (++c == JUMP_LABEL_POKE_BATCH) {
+			text_poke_smp_batch(jump_label_params, c);
+			c = 0;
+		}
+	}
+	if (c)
+		text_poke_smp_batch(jump_label_params, c);
+	mutex_unlock(&text_mutex);
+	put_online_cpus();
+}
+
+/* Before the code can run on another cpu: at boot, or module load */
+void __init_or_module
+arch_jump_label_text_poke_early(struct jump_entry *entry,
+				enum jump_label_type type)
+{
+	union jump_code_union code;
+
+	jump_label_set_code(&code, entry, type);
+	text_poke_early((void *)entry->code, code.code, JUMP_LABEL_NOP_SIZE);
+}
+
+#endif
@@ -50,6 +50,7 @@
 #include <linux/kdebug.h>
 #include <linux/kallsyms.h>
 #include <linux/ftrace.h>
+#include <linux/jump_label.h>
 
 #include <asm/cacheflush.h>
 #include <asm/desc.h>
@@ -562,6 +563,7 @@ static int __kprobes kprobe_handler(struct pt_regs *regs)
 		} else {
 			set_current_kprobe(p, regs, kcb);
 			kcb->kprobe_status = KPROBE_HIT_ACTIVE;
+			kprobes_inc_nhit_count(p);
 
 			/*
 			 * If we have no pre-handler or it returned 0, we
@@ -1184,27 +1186,88 @@ static void __kprobes optimized_callback(struct optimized_kprobe *op,
 
 		__get_cpu_var(current_kprobe) = &op->kp;
 		kcb->kprobe_status = KPROBE_HIT_ACTIVE;
+		kprobes_inc_nhit_count(&op->kp);
 		opt_pre_handler(&op->kp, regs);
 		__get_cpu_var(current_kprobe) = NULL;
 	}
 	preempt_enable_no_resched();
 }
 
-static int __kprobes copy_optimized_instructions(u8 *dest, u8 *src)
+/*
+ * Make a relative jump copied from src to dest still reach its target.
+ * The short forms are widened to the rel32 ones, the copy is usually out
+ * of their reach.  Returns the length of the relocated jump, or 0 if the
+ * instruction at dest is not a relative jump.
+ */
+static int __kprobes relocate_relative_jump(u8 *dest, u8 *src)
 {
-	int len = 0, ret;
+	struct insn insn;
+	unsigned long target;
+	u8 opcode;
+	long rel;
+	int len;
+
+	kernel_insn_init(&insn, dest);
+	insn_get_length(&insn);
+	/* Leave prefixed (branch hinted, 16 bit) jumps to can_boost() */
+	if (insn.prefixes.nbytes)
+		return 0;
+
+	opcode = insn.opcode.bytes[0];
+	target = (unsigned long)src + insn.length + insn.immediate.value;
+	if (opcode == 0xe9 || opcode == 0xeb) {	/* jmp */
+		dest[0] = RELATIVEJUMP_OPCODE;
+		len = RELATIVEJUMP_SIZE;
+	} else if ((opcode & 0xf0) == 0x70) {	/* jcc short */
+		dest[0] = 0x0f;
+		dest[1] = 0x80 | (opcode & 0x0f);
+		len = RELATIVEJUMP_SIZE + 1;
+	} else if (opcode == 0x0f &&
+		   (insn.opcode.bytes[1] & 0xf0) == 0x80) {	/* jcc near */
+		len = RELATIVEJUMP_SIZE + 1;
+	} else
+		return 0;
+
+	rel = (long)target - ((long)dest + len);
+	BUG_ON((long)(s32)rel != rel);	/* slots are within 2GB */
+	*(s32 *)(dest + len - RELATIVE_ADDR_SIZE) = (s32)rel;
+	return len;
+}
+
+/*
+ * Copy the instructions replaced by the jump to dest.  Returns the length
+ * of the replaced instructions; *copied is set to the length of the copy,
+ * which differs from it when short jumps had to be widened.
+ */
+static int __kprobes copy_optimized_instructions(u8 *dest, u8 *src,
+						 int *copied)
+{
+	int len = 0, dlen = 0, ret, n;
 
 	while (len < RELATIVEJUMP_SIZE) {
-		ret = __copy_instruction(dest + len, src + len, 1);
-		if (!ret || !can_boost(dest + len))
+		ret = __copy_instruction(dest + dlen, src + len, 1);
+		if (!ret)
 			return -EINVAL;
+		/*
+		 * Relative jumps leave the copy for good, either to their
+		 * target or to the jump back, so they only need relocating.
+		 */
+		n = relocate_relative_jump(dest + dlen, src + len);
+		if (!n) {
+			if (!can_boost(dest + dlen))
+				return -EINVAL;
+			n = ret;
+		}
 		len += ret;
+		dlen += n;
 	}
 	/* Check whether the address range is reserved */
 	if (ftrace_text_reserved(src, src + len - 1) ||
-	    alternatives_text_reserved(src, src + len - 1))
+	    alternatives_text_reserved(src, src + len - 1) ||
+	    jump_label_text_reserved(src, src + len - 1))
 		return -EBUSY;
 
+	*copied = dlen;
 	return len;
 }
 
@@ -1339,7 +1402,7 @@ void __kprobes arch_remove_optimized_kprobe(struct optimized_kprobe *op)
 int __kprobes arch_prepare_optimized_kprobe(struct optimized_kprobe *op)
 {
 	u8 *buf;
-	int ret;
+	int ret, copied;
 	long rel;
 
 	if (!can_optimize((unsigned long)op->kp.addr))
@@ -1360,7 +1423,8 @@ int __kprobes arch_prepare_optimized_kprobe(struct optimized_kprobe *op)
 	buf = (u8 *)op->optinsn.insn;
 
 	/* Copy instructions into the out-of-line buffer */
-	ret = copy_optimized_instructions(buf + TMPL_END_IDX, op->kp.addr);
+	ret = copy_optimized_instructions(buf + TMPL_END_IDX, op->kp.addr,
+					  &copied);
 	if (ret < 0) {
 		__arch_remove_optimized_kprobe(op, 0);
 		return ret;
@@ -1377,19 +1441,25 @@ int __kprobes arch_prepare_optimized_kprobe(struct optimized_kprobe *op)
 	synthesize_relcall(buf + TMPL_CALL_IDX, optimized_callback);
 
 	/* Set returning jmp instruction at the tail of out-of-line buffer */
-	synthesize_reljump(buf + TMPL_END_IDX + op->optinsn.size,
+	synthesize_reljump(buf + TMPL_END_IDX + copied,
 			   (u8 *)op->kp.addr + op->optinsn.size);
 
 	flush_icache_range((unsigned long) buf,
 			   (unsigned long) buf + TMPL_END_IDX +
-			   op->optinsn.size + RELATIVEJUMP_SIZE);
+			   copied + RELATIVEJUMP_SIZE);
 	return 0;
 }
 
-/* Replace a breakpoint (int3) with a relative jump.  */
-int __kprobes arch_optimize_kprobe(struct optimized_kprobe *op)
+#define MAX_OPTIMIZE_PROBES 256
+static struct text_poke_param *jump_poke_params;
+static struct jump_poke_buffer {
+	u8 buf[RELATIVEJUMP_SIZE];
+} *jump_poke_bufs;
+
+static void __kprobes setup_optimize_kprobe(struct text_poke_param *tprm,
+					    u8 *insn_buf,
+					    struct optimized_kprobe *op)
 {
-	unsigned char jmp_code[RELATIVEJUMP_SIZE];
 	s32 rel = (s32)((long)op->optinsn.insn -
 			((long)op->kp.addr + RELATIVEJUMP_SIZE));
 
@@ -1397,16 +1467,43 @@ int __kprobes arch_optimize_kprobe(struct optimized_kprobe *op)
 	memcpy(op->optinsn.copied_insn, op->kp.addr + INT3_SIZE,
 	       RELATIVE_ADDR_SIZE);
 
-	jmp_code[0] = RELATIVEJUMP_OPCODE;
-	*(s32 *)(&jmp_code[1]) = rel;
+	insn_buf[0] = RELATIVEJUMP_OPCODE;
+	*(s32 *)(&insn_buf[1]) = rel;
 
-	/*
-	 * text_poke_smp doesn't support NMI/MCE code modifying.
-	 * However, since kprobes itself also doesn't support NMI/MCE
-	 * code probing, it's not a problem.
-	 */
-	text_poke_smp(op->kp.addr, jmp_code, RELATIVEJUMP_SIZE);
-	return 0;
+	tprm->addr = op->kp.addr;
+	tprm->opcode = insn_buf;
+	tprm->len = RELATIVEJUMP_SIZE;
+}
+
+/*
+ * Replace breakpoints (int3) with relative jumps, for all the kprobes on
+ * oplist, emptying it.  Up to MAX_OPTIMIZE_PROBES of them are patched
+ * in one stop_machine().
+ * Caller must hold text_mutex.
+ */
+void __kprobes arch_optimize_kprobes(struct list_head *oplist)
+{
+	struct optimized_kprobe *op, *tmp;
+	int c;
+
+	while (!list_empty(oplist)) {
+		c = 0;
+		list_for_each_entry_safe(op, tmp, oplist, list) {
+			WARN_ON(kprobe_disabled(&op->kp));
+			setup_optimize_kprobe(&jump_poke_params[c],
+					      jump_poke_bufs[c].buf, op);
+			list_del_init(&op->list);
+			if (++c >= MAX_OPTIMIZE_PROBES)
+				break;
+		}
+
+		/*
+		 * text_poke_smp doesn't support NMI/MCE code modifying.
+		 * However, since kprobes itself also doesn't support NMI/MCE
+		 * code probing, it's not a problem.
+		 */
+		text_poke_smp_batch(jump_poke_params, c);
+	}
 }
 
 /* Replace a relative jump with a breakpoint (int3).  */
@@ -1442,6 +1539,21 @@ static int  __kprobes setup_detour_execution(struct kprobe *p,
 
 int __init arch_init_kprobes(void)
 {
+#ifdef CONFIG_OPTPROBES
+	/* Allocate code buffer and parameter array */
+	jump_poke_bufs = kmalloc(sizeof(struct jump_poke_buffer) *
+				 MAX_OPTIMIZE_PROBES, GFP_KERNEL);
+	if (!jump_poke_bufs)
+		return -ENOMEM;
+
+	jump_poke_params = kmalloc(sizeof(struct text_poke_param) *
+				   MAX_OPTIMIZE_PROBES, GFP_KERNEL);
+	if (!jump_poke_params) {
+		kfree(jump_poke_bufs);
+		jump_poke_bufs = NULL;
+		return -ENOMEM;
+	}
+#endif
 	return 0;
 }
 
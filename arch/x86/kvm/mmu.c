@@ -18,6 +18,7 @@
  *
  */
 
+#include "irq.h"
 #include "mmu.h"
 #include "x86.h"
 #include "kvm_cache_regs.h"
@@ -152,6 +153,8 @@ module_param(oos_shadow, bool, 0644);
 #include "mmutrace.h"
 
 #define SPTE_HOST_WRITEABLE (1ULL << PT_FIRST_AVAIL_BITS_SHIFT)
+/* The spte may be writable as far as the mmu is concerned */
+#define SPTE_MMU_WRITEABLE (1ULL << (PT_FIRST_AVAIL_BITS_SHIFT + 1))
 
 #define SHADOW_PT_INDEX(addr, level) PT64_INDEX(addr, level)
 
@@ -173,6 +176,16 @@ struct kvm_shadow_walk_iterator {
 	     shadow_walk_okay(&(_walker));			\
 	     shadow_walk_next(&(_walker)))
 
+/*
+ * Walks without mmu_lock, under rcu_read_lock(): shadow pages are freed
+ * after a grace period, but each spte must only be read once.
+ */
+#define for_each_shadow_entry_lockless(_vcpu, _addr, _walker, _spte)	\
+	for (shadow_walk_init(&(_walker), _vcpu, _addr);		\
+	     shadow_walk_okay(&(_walker)) &&				\
+		({ _spte = ACCESS_ONCE(*(_walker).sptep); 1; });		\
+	     __shadow_walk_next(&(_walker), _spte))
+
 typedef void (*mmu_parent_walk_fn) (struct kvm_mmu_page *sp, u64 *spte);
 
 static struct kmem_cache *pte_chain_cache;
@@ -258,6 +271,17 @@ static int is_rmap_spte(u64 pte)
 	return is_shadow_present_pte(pte);
 }
 
+/*
+ * A spte write protected only for dirty logging, which the lockless
+ * fault path may make writable again behind the back of mmu_lock holders.
+ */
+static bool spte_is_locklessly_modifiable(u64 spte)
+{
+	return !is_writable_pte(spte) &&
+	       (spte & (SPTE_HOST_WRITEABLE | SPTE_MMU_WRITEABLE)) ==
+	       (SPTE_HOST_WRITEABLE | SPTE_MMU_WRITEABLE);
+}
+
 static int is_last_spte(u64 pte, int level)
 {
 	if (level == PT_PAGE_TABLE_LEVEL)
@@ -301,16 +325,22 @@ static u64 __xchg_spte(u64 *sptep, u64 new_spte)
 
 static void update_spte(u64 *sptep, u64 new_spte)
 {
-	u64 old_spte;
+	u64 old_spte = *sptep;
 
-	if (!shadow_accessed_mask || (new_spte & shadow_accessed_mask) ||
-	      !is_rmap_spte(*sptep))
+	if (!spte_is_locklessly_modifiable(old_spte) &&
+	    (!shadow_accessed_mask || (new_spte & shadow_accessed_mask) ||
+	      !is_rmap_spte(old_spte))) {
 		__set_spte(sptep, new_spte);
-	else {
-		old_spte = __xchg_spte(sptep, new_spte);
-		if (old_spte & shadow_accessed_mask)
-			mark_page_accessed(pfn_to_page(spte_to_pfn(old_spte)));
+		return;
 	}
+
+	old_spte = __xchg_spte(sptep, new_spte);
+	if (shadow_accessed_mask && !(new_spte & shadow_accessed_mask) &&
+	    (old_spte & shadow_accessed_mask))
+		mark_page_accessed(pfn_to_page(spte_to_pfn(old_spte)));
+	/* The lockless fault path may have made it writable meanwhile */
+	if (is_writable_pte(old_spte) && !is_writable_pte(new_spte))
+		kvm_set_pfn_dirty(spte_to_pfn(old_spte));
 }
 
 static int mmu_topup_memory_cache(struct kvm_mmu_memory_cache *cache,
@@ -680,8 +710,9 @@ static void set_spte_track_bits(u64 *sptep, u64 new_spte)
 	pfn_t pfn;
 	u64 old_spte = *sptep;
 
-	if (!shadow_accessed_mask || !is_shadow_present_pte(old_spte) ||
-	      old_spte & shadow_accessed_mask) {
+	if (!spte_is_locklessly_modifiable(old_spte) &&
+	    (!shadow_accessed_mask || !is_shadow_present_pte(old_spte) ||
+	      old_spte & shadow_accessed_mask)) {
 		__set_spte(sptep, new_spte);
 	} else
 		old_spte = __xchg_spte(sptep, new_spte);
@@ -740,9 +771,11 @@ static int rmap_write_protect(struct kvm *kvm, u64 gfn)
 		BUG_ON(!spte);
 		BUG_ON(!(*spte & PT_PRESENT_MASK));
 		rmap_printk("rmap_write_protect: spte %p %llx\n", spte, *spte);
-		if (is_writable_pte(*spte)) {
-			update_spte(spte, *spte & ~PT_WRITABLE_MASK);
-			write_protected = 1;
+		if (*spte & (PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE)) {
+			if (is_writable_pte(*spte))
+				write_protected = 1;
+			update_spte(spte, *spte & ~(PT_WRITABLE_MASK |
+						    SPTE_MMU_WRITEABLE));
 		}
 		spte = rmap_next(kvm, rmapp, spte);
 	}
@@ -947,15 +980,26 @@ static int is_empty_shadow_page(u64 *spt)
 }
 #endif
 
-static void kvm_mmu_free_page(struct kvm *kvm, struct kvm_mmu_page *sp)
+static void kvm_mmu_free_page_rcu(struct rcu_head *head)
 {
-	ASSERT(is_empty_shadow_page(sp->spt));
-	hlist_del(&sp->hash_link);
-	list_del(&sp->link);
+	struct kvm_mmu_page *sp = container_of(head, struct kvm_mmu_page, rcu);
+
 	__free_page(virt_to_page(sp->spt));
 	if (!sp->role.direct)
 		__free_page(virt_to_page(sp->gfns));
 	kmem_cache_free(mmu_page_header_cache, sp);
+}
+
+/*
+ * The memory is only freed after a grace period, as the lockless fault
+ * path may still be walking the page.
+ */
+static void kvm_mmu_free_page(struct kvm *kvm, struct kvm_mmu_page *sp)
+{
+	ASSERT(is_empty_shadow_page(sp->spt));
+	hlist_del(&sp->hash_link);
+	list_del(&sp->link);
+	call_rcu(&sp->rcu, kvm_mmu_free_page_rcu);
 	++kvm->arch.n_free_mmu_pages;
 }
 
@@ -1482,6 +1526,18 @@ static bool shadow_walk_okay(struct kvm_shadow_walk_iterator *iterator)
 	return true;
 }
 
+static void __shadow_walk_next(struct kvm_shadow_walk_iterator *iterator,
+			       u64 spte)
+{
+	if (is_last_spte(spte, iterator->level)) {
+		iterator->level = 0;
+		return;
+	}
+
+	iterator->shadow_addr = spte & PT64_BASE_ADDR_MASK;
+	--iterator->level;
+}
+
 static void shadow_walk_next(struct kvm_shadow_walk_iterator *iterator)
 {
 	iterator->shadow_addr = *iterator->sptep & PT64_BASE_ADDR_MASK;
@@ -1502,6 +1558,7 @@ static void drop_large_spte(struct kvm_vcpu *vcpu, u64 *sptep)
 {
 	if (is_large_pte(*sptep)) {
 		drop_spte(vcpu->kvm, sptep, shadow_trap_nonpresent_pte);
+		--vcpu->kvm->stat.lpages;
 		kvm_flush_remote_tlbs(vcpu->kvm);
 	}
 }
@@ -1958,7 +2015,7 @@ static int set_spte(struct kvm_vcpu *vcpu, u64 *sptep,
 			goto done;
 		}
 
-		spte |= PT_WRITABLE_MASK;
+		spte |= PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE;
 
 		if (!tdp_enabled && !(pte_access & ACC_WRITE_MASK))
 			spte &= ~PT_USER_MASK;
@@ -1977,8 +2034,7 @@ static int set_spte(struct kvm_vcpu *vcpu, u64 *sptep,
 				 __func__, gfn);
 			ret = 1;
 			pte_access &= ~ACC_WRITE_MASK;
-			if (is_writable_pte(spte))
-				spte &= ~PT_WRITABLE_MASK;
+			spte &= ~(PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE);
 		}
 	}
 
@@ -2081,6 +2137,12 @@ static int __direct_map(struct kvm_vcpu *vcpu, gpa_t v, int write,
 			break;
 		}
 
+		/*
+		 * A 2M mapping made before dirty logging was enabled: it
+		 * is now to be mapped with 4k pages below it.
+		 */
+		drop_large_spte(vcpu, iterator.sptep);
+
 		if (*iterator.sptep == shadow_trap_nonpresent_pte) {
 			u64 base_addr = iterator.addr;
 
@@ -2347,6 +2409,113 @@ static int nonpaging_page_fault(struct kvm_vcpu *vcpu, gva_t gva,
 			     error_code & PFERR_WRITE_MASK, gfn);
 }
 
+/*
+ * Handles, without mmu_lock, the write faults that need no change to the
+ * shadow page tables themselves: on a spte that another vcpu has already
+ * fixed, or on one write protected only for dirty logging. Returns false
+ * if the slow path has to handle the fault.
+ */
+static bool fast_page_fault(struct kvm_vcpu *vcpu, gva_t gpa, u32 error_code)
+{
+	struct kvm_shadow_walk_iterator iterator;
+	u64 *sptep = NULL;
+	u64 spte = 0ull;
+	int level = 0;
+	bool ret = false;
+
+	if ((error_code & (PFERR_WRITE_MASK | PFERR_RSVD_MASK)) !=
+	    PFERR_WRITE_MASK)
+		return false;
+
+	rcu_read_lock();
+	for_each_shadow_entry_lockless(vcpu, (u64)gpa, iterator, spte) {
+		sptep = iterator.sptep;
+		level = iterator.level;
+		if (!is_shadow_present_pte(spte))
+			break;
+	}
+
+	if (!sptep || !is_shadow_present_pte(spte) || !is_last_spte(spte, level))
+		goto out;
+
+	if (is_writable_pte(spte)) {
+		ret = true;
+		goto out;
+	}
+
+	/* Dirty logging never leaves large sptes in place */
+	if (level != PT_PAGE_TABLE_LEVEL ||
+	    !spte_is_locklessly_modifiable(spte))
+		goto out;
+
+	/*
+	 * If an mmu_lock holder changed the spte meanwhile, the cmpxchg
+	 * fails and the slow path sorts it out; the holders use xchg on
+	 * such sptes, so they see the writable bit set here.
+	 */
+	if (cmpxchg64(sptep, spte, spte | PT_WRITABLE_MASK) == spte) {
+		mark_page_dirty(vcpu->kvm, gpa >> PAGE_SHIFT);
+		ret = true;
+	}
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * A page fault can only be completed asynchronously if the guest is
+ * able to run something else meanwhile: it asked for it, and the fault
+ * hit a user task that the guest may put to sleep.
+ */
+static bool can_do_async_pf(struct kvm_vcpu *vcpu)
+{
+	if (!(vcpu->arch.apf.msr_val & KVM_ASYNC_PF_ENABLED))
+		return false;
+
+	if (kvm_x86_ops->get_cpl(vcpu) == 0)
+		return false;
+
+	if (unlikely(!irqchip_in_kernel(vcpu->kvm) ||
+		     kvm_event_needs_reinjection(vcpu)))
+		return false;
+
+	return kvm_x86_ops->interrupt_allowed(vcpu);
+}
+
+static int kvm_arch_setup_async_pf(struct kvm_vcpu *vcpu, gfn_t gfn)
+{
+	struct kvm_arch_async_pf arch;
+
+	arch.token = (vcpu->arch.apf.id++ << 12) | vcpu->vcpu_id;
+	arch.gfn = gfn;
+
+	return kvm_setup_async_pf(vcpu, gfn_to_hva(vcpu->kvm, gfn), &arch);
+}
+
+/*
+ * Returns true if the page is being swapped in behind the guest's back,
+ * in which case there is no pfn and the fault is done with for now.
+ */
+static bool try_async_pf(struct kvm_vcpu *vcpu, gfn_t gfn, pfn_t *pfn)
+{
+	bool async;
+
+	if (!can_do_async_pf(vcpu)) {
+		*pfn = gfn_to_pfn(vcpu->kvm, gfn);
+		return false;
+	}
+
+	*pfn = gfn_to_pfn_async(vcpu->kvm, gfn, &async);
+	if (!async)
+		return false;
+
+	if (kvm_arch_setup_async_pf(vcpu, gfn))
+		return true;
+
+	*pfn = gfn_to_pfn(vcpu->kvm, gfn);
+	return false;
+}
+
 static int tdp_page_fault(struct kvm_vcpu *vcpu, gva_t gpa,
 				u32 error_code)
 {
@@ -2359,6 +2528,12 @@ static int tdp_page_fault(struct kvm_vcpu *vcpu, gva_t gpa,
 	ASSERT(vcpu);
 	ASSERT(VALID_PAGE(vcpu->arch.mmu.root_hpa));
 
+	if (fast_page_fault(vcpu, gpa, error_code)) {
+		++vcpu->stat.pf_fast;
+		return 0;
+	}
+	++vcpu->stat.pf_slow;
+
 	r = mmu_topup_memory_caches(vcpu);
 	if (r)
 		return r;
@@ -2369,7 +2544,8 @@ static int tdp_page_fault(struct kvm_vcpu *vcpu, gva_t gpa,
 
 	mmu_seq = vcpu->kvm->mmu_notifier_seq;
 	smp_rmb();
-	pfn = gfn_to_pfn(vcpu->kvm, gfn);
+	if (try_async_pf(vcpu, gfn, &pfn))
+		return 0;
 	if (is_error_pfn(pfn))
 		return kvm_handle_bad_page(vcpu->kvm, gfn, pfn);
 	spin_lock(&vcpu->kvm->mmu_lock);
@@ -3075,14 +3251,56 @@ void kvm_mmu_slot_remove_write_access(struct kvm *kvm, int slot)
 			continue;
 
 		pt = sp->spt;
-		for (i = 0; i < PT64_ENT_PER_PAGE; ++i)
+		for (i = 0; i < PT64_ENT_PER_PAGE; ++i) {
+			/*
+			 * Write faults are logged per 4k page: split the
+			 * large mappings now rather than logging 2M at once.
+			 */
+			if (sp->role.level > PT_PAGE_TABLE_LEVEL &&
+			    is_shadow_present_pte(pt[i]) &&
+			    is_large_pte(pt[i])) {
+				drop_spte(kvm, &pt[i],
+					  shadow_trap_nonpresent_pte);
+				--kvm->stat.lpages;
+				continue;
+			}
+
 			/* avoid RMW */
 			if (is_writable_pte(pt[i]))
 				pt[i] &= ~PT_WRITABLE_MASK;
+		}
 	}
 	kvm_flush_remote_tlbs(kvm);
 }
 
+/*
+ * Write protects gfn again once userspace harvested it from a dirty
+ * ring, so that the next write faults and logs it.  The sptes stay
+ * SPTE_MMU_WRITEABLE for fast_page_fault() to restore.  Logged slots
+ * have no large sptes left (see kvm_mmu_slot_remove_write_access).
+ *
+ * Called with mmu_lock held; the caller flushes the tlbs.
+ */
+int kvm_mmu_protect_dirty_gfn(struct kvm *kvm, gfn_t gfn)
+{
+	unsigned long *rmapp;
+	u64 *spte;
+	int write_protected = 0;
+
+	rmapp = gfn_to_rmap(kvm, gfn, PT_PAGE_TABLE_LEVEL);
+
+	for (spte = rmap_next(kvm, rmapp, NULL); spte;
+	     spte = rmap_next(kvm, rmapp, spte)) {
+		if (is_writable_pte(*spte)) {
+			update_spte(spte, *spte & ~PT_WRITABLE_MASK);
+			kvm_set_pfn_dirty(spte_to_pfn(*spte));
+			write_protected = 1;
+		}
+	}
+
+	return write_protected;
+}
+
 void kvm_mmu_zap_all(struct kvm *kvm)
 {
 	struct kvm_mmu_page *sp, *node;
@@ -3162,6 +3380,8 @@ static void mmu_destroy_caches(void)
 
 void kvm_mmu_module_exit(void)
 {
+	/* Wait for the shadow pages still being freed by RCU */
+	rcu_barrier();
 	mmu_destroy_caches();
 	unregister_shrinker(&mmu_shrinker);
 }
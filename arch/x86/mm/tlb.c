@@ -12,6 +12,9 @@
 #include <asm/apic.h>
 #include <asm/uv/uv.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/tlb.h>
+
 DEFINE_PER_CPU_SHARED_ALIGNED(struct tlb_state, cpu_tlbstate)
 			= { &init_mm, 0, };
 
@@ -155,6 +158,9 @@ void smp_invalidate_interrupt(struct pt_regs *regs)
 				local_flush_tlb();
 			else
 				__flush_tlb_one(f->flush_va);
+			trace_tlb_flush(TLB_REMOTE_SHOOTDOWN,
+					f->flush_va == TLB_FLUSH_ALL ?
+					TLB_FLUSH_ALL : 1);
 		} else
 			leave_mm(cpu);
 	}
@@ -190,6 +196,8 @@ static void flush_tlb_others_ipi(const struct cpumask *cpumask,
 		 * We have to send the IPI only to
 		 * CPUs affected.
 		 */
+		trace_tlb_flush(TLB_REMOTE_SEND_IPI,
+				cpumask_weight(to_cpumask(f->flush_cpumask)));
 		apic->send_IPI_mask(to_cpumask(f->flush_cpumask),
 			      INVALIDATE_TLB_VECTOR_START + sender);
 
@@ -218,6 +226,10 @@ void native_flush_tlb_others(const struct cpumask *cpumask,
 	flush_tlb_others_ipi(cpumask, mm, va);
 }
 
+/* Scratch masks for flush_tlb_skip_lazy(), once they are allocated */
+static DEFINE_PER_CPU(cpumask_var_t, flush_tlb_mask);
+static bool flush_tlb_mask_ready __read_mostly;
+
 static int __cpuinit init_smp_flush(void)
 {
 	int i;
@@ -225,6 +237,13 @@ static int __cpuinit init_smp_flush(void)
 	for (i = 0; i < ARRAY_SIZE(flush_state); i++)
 		raw_spin_lock_init(&flush_state[i].tlbstate_lock);
 
+	for_each_possible_cpu(i) {
+		if (!zalloc_cpumask_var_node(&per_cpu(flush_tlb_mask, i),
+					     GFP_KERNEL, cpu_to_node(i)))
+			return 0;
+	}
+	flush_tlb_mask_ready = true;
+
 	return 0;
 }
 core_initcall(init_smp_flush);
@@ -241,14 +260,115 @@ void flush_tlb_current_task(void)
 	preempt_enable();
 }
 
+/*
+ * A CPU in lazy TLB mode keeps @mm's page tables loaded for a kernel
+ * thread, which does not touch user addresses.  As long as no page tables
+ * were freed, it need not be interrupted: set its lazy_flush and let
+ * switch_mm() flush when it goes back to @mm.
+ *
+ * We store lazy_flush and then load state; switch_mm() stores state and
+ * then loads lazy_flush, with full barriers in between.  So either we see
+ * the CPU back in TLBSTATE_OK and send it the IPI after all, or it sees
+ * lazy_flush set, or both.
+ */
+static const struct cpumask *flush_tlb_skip_lazy(const struct cpumask *cpumask,
+						 struct mm_struct *mm)
+{
+	struct cpumask *mask;
+	unsigned int cpu, skipped = 0;
+
+	if (!flush_tlb_mask_ready)
+		return cpumask;
+
+	mask = per_cpu(flush_tlb_mask, smp_processor_id());
+	cpumask_copy(mask, cpumask);
+
+	for_each_cpu(cpu, cpumask) {
+		struct tlb_state *ts = &per_cpu(cpu_tlbstate, cpu);
+
+		if (ACCESS_ONCE(ts->state) != TLBSTATE_LAZY ||
+		    ACCESS_ONCE(ts->active_mm) != mm)
+			continue;
+
+		ts->lazy_flush = 1;
+		smp_mb();
+		if (ACCESS_ONCE(ts->state) == TLBSTATE_LAZY) {
+			cpumask_clear_cpu(cpu, mask);
+			skipped++;
+		}
+	}
+
+	if (skipped)
+		trace_tlb_flush(TLB_LAZY_SKIPPED, skipped);
+	return mask;
+}
+
+/*
+ * Up to this many pages are flushed one at a time by the local CPU,
+ * bigger ranges flush the whole TLB.
+ */
+static unsigned long tlb_single_page_flush_ceiling __read_mostly = 33;
+
+/**
+ * flush_tlb_mm_range - flush the TLB entries of @mm after an unmap
+ * @mm: the address space
+ * @start: first address unmapped
+ * @end: end of the unmapped range, or 0 if no ptes were unmapped
+ * @freed_tables: page tables were freed as well
+ *
+ * Used by the mmu_gather code (tlb_flush()) for munmap, madvise and
+ * friends: small ranges are flushed page by page locally, and CPUs in
+ * lazy TLB mode are not sent an IPI unless page tables went away.
+ */
+void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
+			unsigned long end, bool freed_tables)
+{
+	const struct cpumask *cpumask = mm_cpumask(mm);
+	unsigned long va = TLB_FLUSH_ALL, nr = 0, addr;
+	unsigned int cpu;
+
+	if (!freed_tables && end > start) {
+		nr = (end - start) >> PAGE_SHIFT;
+		if (nr > tlb_single_page_flush_ceiling)
+			nr = 0;
+		else if (nr == 1)
+			va = start;
+	}
+
+	cpu = get_cpu();
+
+	if (current->active_mm == mm) {
+		if (!current->mm)
+			leave_mm(cpu);
+		else if (nr) {
+			for (addr = start; addr < end; addr += PAGE_SIZE)
+				__flush_tlb_one(addr);
+			trace_tlb_flush(TLB_LOCAL_SHOOTDOWN, nr);
+		} else {
+			local_flush_tlb();
+			trace_tlb_flush(TLB_LOCAL_SHOOTDOWN, TLB_FLUSH_ALL);
+		}
+	}
+
+	if (cpumask_any_but(cpumask, cpu) < nr_cpu_ids) {
+		if (!freed_tables)
+			cpumask = flush_tlb_skip_lazy(cpumask, mm);
+		if (cpumask_any_but(cpumask, cpu) < nr_cpu_ids)
+			flush_tlb_others(cpumask, mm, va);
+	}
+
+	put_cpu();
+}
+
 void flush_tlb_mm(struct mm_struct *mm)
 {
 	preempt_disable();
 
 	if (current->active_mm == mm) {
-		if (current->mm)
+		if (current->mm) {
 			local_flush_tlb();
-		else
+			trace_tlb_flush(TLB_LOCAL_MM_SHOOTDOWN, TLB_FLUSH_ALL);
+		} else
 			leave_mm(smp_processor_id());
 	}
 	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids)
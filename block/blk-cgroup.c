@@ -444,9 +444,12 @@ blkiocg_weight_write(struct cgroup *cgroup, struct cftype *cftype, u64 val)
 		if (pn)
 			continue;
 
-		list_for_each_entry(blkiop, &blkio_list, list)
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid)
+				continue;
 			blkiop->ops.blkio_update_group_weight_fn(blkg,
 					blkcg->weight);
+		}
 	}
 	spin_unlock_irq(&blkcg->lock);
 	spin_unlock(&blkio_list_lock);
@@ -608,7 +611,7 @@ static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 	blkcg = cgroup_to_blkio_cgroup(cgroup);				\
 	rcu_read_lock();						\
 	hlist_for_each_entry_rcu(blkg, n, &blkcg->blkg_list, blkcg_node) {\
-		if (blkg->dev) {					\
+		if (blkg->dev && blkg->plid == BLKIO_POLICY_PROP) {	\
 			spin_lock_irq(&blkg->stats_lock);		\
 			cgroup_total += blkio_get_stat(blkg, cb,	\
 						blkg->dev, type);	\
@@ -651,12 +654,15 @@ static int blkio_check_dev_num(dev_t dev)
 	return 0;
 }
 
-static int blkio_policy_parse_and_set(char *buf,
-				      struct blkio_policy_node *newpn)
+/*
+ * Parse "<major>:<minor> <value>" into the whole disk it names and the
+ * value string.
+ */
+static int blkio_parse_dev_value(char *buf, dev_t *devp, char **valp)
 {
 	char *s[4], *p, *major_s = NULL, *minor_s = NULL;
 	int ret;
-	unsigned long major, minor, temp;
+	unsigned long major, minor;
 	int i = 0;
 	dev_t dev;
 
@@ -700,12 +706,26 @@ static int blkio_policy_parse_and_set(char *buf,
 	if (ret)
 		return ret;
 
-	newpn->dev = dev;
-
 	if (s[1] == NULL)
 		return -EINVAL;
 
-	ret = strict_strtoul(s[1], 10, &temp);
+	*devp = dev;
+	*valp = s[1];
+	return 0;
+}
+
+static int blkio_policy_parse_and_set(char *buf,
+				      struct blkio_policy_node *newpn)
+{
+	unsigned long temp;
+	char *val;
+	int ret;
+
+	ret = blkio_parse_dev_value(buf, &newpn->dev, &val);
+	if (ret)
+		return ret;
+
+	ret = strict_strtoul(val, 10, &temp);
 	if (ret || (temp < BLKIO_WEIGHT_MIN && temp > 0) ||
 	    temp > BLKIO_WEIGHT_MAX)
 		return -EINVAL;
@@ -785,9 +805,12 @@ update_io_group:
 	spin_lock_irq(&blkcg->lock);
 
 	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
-		if (newpn->dev == blkg->dev) {
-			list_for_each_entry(blkiop, &blkio_list, list)
-				blkiop->ops.blkio_update_group_weight_fn(blkg,
+		if (newpn->dev != blkg->dev)
+			continue;
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid)
+				continue;
+			blkiop->ops.blkio_update_group_weight_fn(blkg,
 							 newpn->weight ?
 							 newpn->weight :
 							 blkcg->weight);
@@ -826,6 +849,177 @@ static int blkiocg_weight_device_read(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+#ifdef CONFIG_BLK_DEV_THROTTLING
+enum blkio_throtl_file {
+	BLKIO_THROTL_read_bps_device,
+	BLKIO_THROTL_write_bps_device,
+	BLKIO_THROTL_read_iops_device,
+	BLKIO_THROTL_write_iops_device,
+};
+
+static struct blkio_throtl_node *
+blkio_throtl_search_node(struct blkio_cgroup *blkcg, dev_t dev)
+{
+	struct blkio_throtl_node *tn;
+
+	list_for_each_entry(tn, &blkcg->throtl_list, node) {
+		if (tn->dev == dev)
+			return tn;
+	}
+
+	return NULL;
+}
+
+void blkcg_get_throtl_limits(struct blkio_cgroup *blkcg, dev_t dev,
+			     struct blkio_throtl_limits *limits)
+{
+	struct blkio_throtl_node *tn;
+	unsigned long flags;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	tn = blkio_throtl_search_node(blkcg, dev);
+	if (tn)
+		*limits = tn->limits;
+	else
+		memset(limits, 0, sizeof(*limits));
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+}
+EXPORT_SYMBOL_GPL(blkcg_get_throtl_limits);
+
+static u64 blkio_throtl_get(const struct blkio_throtl_limits *limits,
+			    int file)
+{
+	switch (file) {
+	case BLKIO_THROTL_read_bps_device:
+		return limits->bps[READ];
+	case BLKIO_THROTL_write_bps_device:
+		return limits->bps[WRITE];
+	case BLKIO_THROTL_read_iops_device:
+		return limits->iops[READ];
+	case BLKIO_THROTL_write_iops_device:
+		return limits->iops[WRITE];
+	}
+	BUG();
+}
+
+static void blkio_throtl_set(struct blkio_throtl_limits *limits, int file,
+			     u64 val)
+{
+	switch (file) {
+	case BLKIO_THROTL_read_bps_device:
+		limits->bps[READ] = val;
+		break;
+	case BLKIO_THROTL_write_bps_device:
+		limits->bps[WRITE] = val;
+		break;
+	case BLKIO_THROTL_read_iops_device:
+		limits->iops[READ] = val;
+		break;
+	case BLKIO_THROTL_write_iops_device:
+		limits->iops[WRITE] = val;
+		break;
+	}
+}
+
+static bool blkio_throtl_unlimited(const struct blkio_throtl_limits *limits)
+{
+	return !limits->bps[READ] && !limits->bps[WRITE] &&
+		!limits->iops[READ] && !limits->iops[WRITE];
+}
+
+static int blkiocg_throtl_write(struct cgroup *cgrp, struct cftype *cft,
+				const char *buffer)
+{
+	int file = cft->private;
+	struct blkio_throtl_node *newtn, *tn;
+	struct blkio_throtl_limits limits;
+	struct blkio_cgroup *blkcg;
+	struct blkio_group *blkg;
+	struct blkio_policy_type *blkiop;
+	struct hlist_node *n;
+	char *buf, *val;
+	dev_t dev;
+	u64 temp;
+	int ret;
+
+	buf = kstrdup(buffer, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = blkio_parse_dev_value(buf, &dev, &val);
+	if (!ret && strict_strtoull(val, 10, &temp))
+		ret = -EINVAL;
+	if (!ret && temp > UINT_MAX &&
+	    (file == BLKIO_THROTL_read_iops_device ||
+	     file == BLKIO_THROTL_write_iops_device))
+		ret = -EINVAL;
+	kfree(buf);
+	if (ret)
+		return ret;
+
+	newtn = kzalloc(sizeof(*newtn), GFP_KERNEL);
+	if (!newtn)
+		return -ENOMEM;
+	newtn->dev = dev;
+
+	blkcg = cgroup_to_blkio_cgroup(cgrp);
+
+	spin_lock(&blkio_list_lock);
+	spin_lock_irq(&blkcg->lock);
+
+	tn = blkio_throtl_search_node(blkcg, dev);
+	if (!tn) {
+		tn = newtn;
+		newtn = NULL;
+		list_add(&tn->node, &blkcg->throtl_list);
+	}
+	blkio_throtl_set(&tn->limits, file, temp);
+	limits = tn->limits;
+	if (blkio_throtl_unlimited(&limits)) {
+		/* all four at 0 means deleting the device's limits */
+		list_del(&tn->node);
+		kfree(tn);
+	}
+
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		if (blkg->dev != dev || blkg->plid != BLKIO_POLICY_THROTL)
+			continue;
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid)
+				continue;
+			blkiop->ops.blkio_update_group_limits_fn(blkg->key,
+							blkg, &limits);
+		}
+	}
+
+	spin_unlock_irq(&blkcg->lock);
+	spin_unlock(&blkio_list_lock);
+
+	kfree(newtn);
+	return 0;
+}
+
+static int blkiocg_throtl_read(struct cgroup *cgrp, struct cftype *cft,
+			       struct seq_file *m)
+{
+	struct blkio_cgroup *blkcg;
+	struct blkio_throtl_node *tn;
+	u64 val;
+
+	blkcg = cgroup_to_blkio_cgroup(cgrp);
+	spin_lock_irq(&blkcg->lock);
+	list_for_each_entry(tn, &blkcg->throtl_list, node) {
+		val = blkio_throtl_get(&tn->limits, cft->private);
+		if (val)
+			seq_printf(m, "%u:%u\t%llu\n", MAJOR(tn->dev),
+				   MINOR(tn->dev), (unsigned long long)val);
+	}
+	spin_unlock_irq(&blkcg->lock);
+
+	return 0;
+}
+#endif
+
 struct cftype blkio_files[] = {
 	{
 		.name = "weight_device",
@@ -874,6 +1068,36 @@ struct cftype blkio_files[] = {
 		.name = "reset_stats",
 		.write_u64 = blkiocg_reset_stats,
 	},
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	{
+		.name = "throttle.read_bps_device",
+		.private = BLKIO_THROTL_read_bps_device,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.write_bps_device",
+		.private = BLKIO_THROTL_write_bps_device,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.read_iops_device",
+		.private = BLKIO_THROTL_read_iops_device,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.write_iops_device",
+		.private = BLKIO_THROTL_write_iops_device,
+		.read_seq_string = blkiocg_throtl_read,
+		.write_string = blkiocg_throtl_write,
+		.max_write_len = 256,
+	},
+#endif
 #ifdef CONFIG_DEBUG_BLK_CGROUP
 	{
 		.name = "avg_queue_size",
@@ -912,6 +1136,7 @@ static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 	void *key;
 	struct blkio_policy_type *blkiop;
 	struct blkio_policy_node *pn, *pntmp;
+	struct blkio_throtl_node *tn, *tntmp;
 
 	rcu_read_lock();
 	do {
@@ -932,13 +1157,15 @@ static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 		/*
 		 * This blkio_group is being unlinked as associated cgroup is
 		 * going away. Let all the IO controlling policies know about
-		 * this event. Currently this is static call to one io
-		 * controlling policy. Once we have more policies in place, we
-		 * need some dynamic registration of callback function.
+		 * this event: the group belongs to the policy which created
+		 * it.
 		 */
 		spin_lock(&blkio_list_lock);
-		list_for_each_entry(blkiop, &blkio_list, list)
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid)
+				continue;
 			blkiop->ops.blkio_unlink_group_fn(key, blkg);
+		}
 		spin_unlock(&blkio_list_lock);
 	} while (1);
 
@@ -947,6 +1174,11 @@ static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 		kfree(pn);
 	}
 
+	list_for_each_entry_safe(tn, tntmp, &blkcg->throtl_list, node) {
+		list_del(&tn->node);
+		kfree(tn);
+	}
+
 	free_css_id(&blkio_subsys, &blkcg->css);
 	rcu_read_unlock();
 	if (blkcg != &blkio_root_cgroup)
@@ -978,6 +1210,7 @@ done:
 	INIT_HLIST_HEAD(&blkcg->blkg_list);
 
 	INIT_LIST_HEAD(&blkcg->policy_list);
+	INIT_LIST_HEAD(&blkcg->throtl_list);
 	return &blkcg->css;
 }
 
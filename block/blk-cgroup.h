@@ -23,6 +23,12 @@ extern struct cgroup_subsys blkio_subsys;
 #define blkio_subsys_id blkio_subsys.subsys_id
 #endif
 
+/* The policy a group belongs to */
+enum blkio_policy_id {
+	BLKIO_POLICY_PROP = 0,		/* Proportional weight, CFQ */
+	BLKIO_POLICY_THROTL,		/* Bandwidth and iops limits */
+};
+
 enum stat_type {
 	/* Total time spent (in ns) between request dispatch to the driver and
 	 * request completion for IOs doen by this cgroup. This may not be
@@ -71,6 +77,7 @@ struct blkio_cgroup {
 	spinlock_t lock;
 	struct hlist_head blkg_list;
 	struct list_head policy_list; /* list of blkio_policy_node */
+	struct list_head throtl_list; /* list of blkio_throtl_node */
 };
 
 struct blkio_group_stats {
@@ -112,6 +119,8 @@ struct blkio_group {
 	char path[128];
 	/* The device MKDEV(major, minor), this group has been created for */
 	dev_t dev;
+	/* The policy which created the group */
+	enum blkio_policy_id plid;
 
 	/* Need to serialize the stats in the case of reset/update */
 	spinlock_t stats_lock;
@@ -124,21 +133,40 @@ struct blkio_policy_node {
 	unsigned int weight;
 };
 
+/* Limits of a group on a device, for READ and WRITE, 0 is unlimited */
+struct blkio_throtl_limits {
+	u64 bps[2];
+	unsigned int iops[2];
+};
+
+struct blkio_throtl_node {
+	struct list_head node;
+	dev_t dev;
+	struct blkio_throtl_limits limits;
+};
+
 extern unsigned int blkcg_get_weight(struct blkio_cgroup *blkcg,
 				     dev_t dev);
+extern void blkcg_get_throtl_limits(struct blkio_cgroup *blkcg, dev_t dev,
+				    struct blkio_throtl_limits *limits);
 
 typedef void (blkio_unlink_group_fn) (void *key, struct blkio_group *blkg);
 typedef void (blkio_update_group_weight_fn) (struct blkio_group *blkg,
 						unsigned int weight);
+typedef void (blkio_update_group_limits_fn) (void *key,
+		struct blkio_group *blkg,
+		const struct blkio_throtl_limits *limits);
 
 struct blkio_policy_ops {
 	blkio_unlink_group_fn *blkio_unlink_group_fn;
 	blkio_update_group_weight_fn *blkio_update_group_weight_fn;
+	blkio_update_group_limits_fn *blkio_update_group_limits_fn;
 };
 
 struct blkio_policy_type {
 	struct list_head list;
 	struct blkio_policy_ops ops;
+	enum blkio_policy_id plid;
 };
 
 /* Blkio controller policy registration */
@@ -11,6 +11,8 @@
 #include <linux/cpu.h>
 #include <linux/blk-iopoll.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
 
 #include "blk.h"
 
@@ -189,6 +191,163 @@ void blk_iopoll_init(struct blk_iopoll *iop, int weight, blk_iopoll_fn *poll_fn)
 }
 EXPORT_SYMBOL(blk_iopoll_init);
 
+/*
+ * Run the iopoll handler of @iop from the calling context, if nobody
+ * else holds it.  Returns the number of completions reaped, or -1 if the
+ * interrupt or the softirq has it, or it's disabled.
+ */
+static int blk_iopoll_run(struct blk_iopoll *iop)
+{
+	int work, weight;
+
+	/* ->poll() is run in softirq context, and the completions too */
+	local_bh_disable();
+
+	if (blk_iopoll_sched_prep(iop)) {
+		local_bh_enable();
+		return -1;
+	}
+
+	/* not on a list, the handler may blk_iopoll_complete() it still */
+	INIT_LIST_HEAD(&iop->list);
+	weight = iop->weight;
+	work = iop->poll(iop, weight);
+
+	/* the budget was used up, we still own it: same as the softirq */
+	if (work >= weight) {
+		if (blk_iopoll_disable_pending(iop))
+			blk_iopoll_complete(iop);
+		else
+			blk_iopoll_sched(iop);
+	}
+
+	local_bh_enable();
+	return work;
+}
+
+/**
+ * blk_queue_iopoll - set the iopoll instance the submitters may poll
+ * @q:        The request queue
+ * @iop:      The parent iopoll structure, or NULL
+ *
+ * Description:
+ *     A driver reaping its completions through @iop lets the synchronous
+ *     submitters to @q run it themselves, instead of sleeping until the
+ *     interrupt, once polling is enabled through the io_poll queue
+ *     attribute.  See blk_poll().
+ **/
+void blk_queue_iopoll(struct request_queue *q, struct blk_iopoll *iop)
+{
+	q->poll_iop = iop;
+	if (!iop)
+		queue_flag_clear_unlocked(QUEUE_FLAG_POLL, q);
+}
+EXPORT_SYMBOL(blk_queue_iopoll);
+
+/*
+ * Account the time @rq took from blk_start_request() to its completion,
+ * for the hybrid sleep.  The mean moves by 1/8th of each sample.
+ */
+void blk_poll_stat_add(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_poll_stat *stat = &q->poll_stat[rq_data_dir(rq)];
+	s64 delta = ktime_to_ns(ktime_get()) - rq->issue_time_ns;
+	unsigned long flags;
+
+	if (delta < 0)
+		return;
+
+	spin_lock_irqsave(&q->poll_lock, flags);
+	if (!stat->nr++)
+		stat->mean_ns = delta;
+	else
+		stat->mean_ns = stat->mean_ns - (stat->mean_ns >> 3) +
+				(delta >> 3);
+	spin_unlock_irqrestore(&q->poll_lock, flags);
+}
+
+/*
+ * Nothing to poll for during the first part of the request's service
+ * time: sleep through half of the mean, or the set delay, before
+ * polling.  Returns true if we slept, the completion may have come.
+ */
+static bool blk_poll_hybrid_sleep(struct request_queue *q, int rw)
+{
+	struct hrtimer_sleeper hs;
+	u64 nsecs;
+
+	if (q->poll_nsec < 0)
+		return false;
+
+	if (q->poll_nsec)
+		nsecs = q->poll_nsec;
+	else
+		nsecs = q->poll_stat[rw].mean_ns / 2;
+	if (!nsecs)
+		return false;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_init_sleeper(&hs, current);
+	hrtimer_start(&hs.timer, ns_to_ktime(nsecs), HRTIMER_MODE_REL);
+
+	/* the caller set us TASK_UNINTERRUPTIBLE, as for io_schedule() */
+	if (hs.task)
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	destroy_hrtimer_on_stack(&hs.timer);
+
+	__set_current_state(TASK_RUNNING);
+	return true;
+}
+
+/**
+ * blk_poll - poll for the completion of synchronous IO
+ * @q:        The request queue the IO was submitted to
+ * @rw:       READ or WRITE, the direction of the IO
+ * @slept:    false on the first call for the IO
+ *
+ * Description:
+ *     Called instead of io_schedule() by a task waiting for its IO, in
+ *     TASK_UNINTERRUPTIBLE and woken by the completion.  On the first
+ *     call, sleeps for a part of the expected service time; then runs the
+ *     driver's iopoll handler until the task is woken or has to give up
+ *     the cpu.  Returns false if the caller should io_schedule() as usual,
+ *     true if it is TASK_RUNNING and should recheck its wait condition.
+ **/
+bool blk_poll(struct request_queue *q, int rw, bool *slept)
+{
+	struct blk_iopoll *iop = q->poll_iop;
+	long state = current->state;
+
+	if (!iop || !blk_queue_poll(q))
+		return false;
+
+	if (!*slept) {
+		*slept = true;
+		if (blk_poll_hybrid_sleep(q, rw))
+			return true;
+	}
+
+	while (!need_resched()) {
+		int ret = blk_iopoll_run(iop);
+
+		/* the completion woke us */
+		if (current->state == TASK_RUNNING)
+			return true;
+		if (signal_pending_state(state, current)) {
+			__set_current_state(TASK_RUNNING);
+			return true;
+		}
+		if (ret < 0)
+			break;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL(blk_poll);
+
 static int __cpuinit blk_iopoll_cpu_notify(struct notifier_block *self,
 					  unsigned long action, void *hcpu)
 {
@@ -6,6 +6,8 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
 
 #include "blk.h"
 
@@ -23,6 +25,22 @@ static void blkdev_discard_end_io(struct bio *bio, int err)
 	bio_put(bio);
 }
 
+/*
+ * Ensure that max_discard_sectors is of the proper granularity
+ */
+static unsigned int blk_max_discard_sectors(struct request_queue *q)
+{
+	unsigned int max_discard_sectors;
+
+	max_discard_sectors = min(q->limits.max_discard_sectors, UINT_MAX >> 9);
+	if (q->limits.discard_granularity) {
+		unsigned int disc_sects = q->limits.discard_granularity >> 9;
+
+		max_discard_sectors &= ~(disc_sects - 1);
+	}
+	return max_discard_sectors;
+}
+
 /**
  * blkdev_issue_discard - queue a discard
  * @bdev:	blockdev to issue discard for
@@ -51,16 +69,7 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 	if (!blk_queue_discard(q))
 		return -EOPNOTSUPP;
 
-	/*
-	 * Ensure that max_discard_sectors is of the proper
-	 * granularity
-	 */
-	max_discard_sectors = min(q->limits.max_discard_sectors, UINT_MAX >> 9);
-	if (q->limits.discard_granularity) {
-		unsigned int disc_sects = q->limits.discard_granularity >> 9;
-
-		max_discard_sectors &= ~(disc_sects - 1);
-	}
+	max_discard_sectors = blk_max_discard_sectors(q);
 
 	if (flags & BLKDEV_IFL_SECURE) {
 		if (!blk_queue_secdiscard(q))
@@ -107,6 +116,297 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 }
 EXPORT_SYMBOL(blkdev_issue_discard);
 
+struct blk_discard_range {
+	struct rb_node		node;
+	sector_t		sector;
+	sector_t		nr_sects;
+};
+
+static struct kmem_cache *blk_discard_range_cachep;
+
+static void blk_discard_queue_end_io(struct bio *bio, int err)
+{
+	struct blk_discard_queue *dq = bio->bi_private;
+
+	if (err) {
+		if (err == -EOPNOTSUPP)
+			set_bit(BIO_EOPNOTSUPP, &dq->flags);
+		else
+			clear_bit(BIO_UPTODATE, &dq->flags);
+	}
+
+	if (atomic_dec_and_test(&dq->inflight))
+		wake_up(&dq->wait);
+	bio_put(bio);
+}
+
+/*
+ * Issue the discard of one range without waiting for it: its bios are
+ * accounted in dq->inflight.
+ */
+static void blk_discard_queue_submit(struct blk_discard_queue *dq,
+				     sector_t sector, sector_t nr_sects)
+{
+	struct request_queue *q = bdev_get_queue(dq->bdev);
+	unsigned int max_discard_sectors, len;
+	struct bio *bio;
+
+	if (!blk_queue_discard(q)) {
+		set_bit(BIO_EOPNOTSUPP, &dq->flags);
+		return;
+	}
+
+	max_discard_sectors = blk_max_discard_sectors(q);
+
+	while (nr_sects) {
+		bio = bio_alloc(GFP_NOIO, 1);
+
+		len = min_t(sector_t, nr_sects, max_discard_sectors);
+		bio->bi_sector = sector;
+		bio->bi_size = len << 9;
+		bio->bi_end_io = blk_discard_queue_end_io;
+		bio->bi_bdev = dq->bdev;
+		bio->bi_private = dq;
+
+		atomic_inc(&dq->inflight);
+		submit_bio(DISCARD_NOBARRIER, bio);
+
+		sector += len;
+		nr_sects -= len;
+	}
+}
+
+static inline struct blk_discard_range *rb_entry_dr(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct blk_discard_range, node) : NULL;
+}
+
+/*
+ * Absorb the neighbours of dr it now overlaps or touches
+ */
+static void blk_discard_range_merge(struct blk_discard_queue *dq,
+				    struct blk_discard_range *dr)
+{
+	struct blk_discard_range *prev, *next;
+	sector_t end;
+
+	while ((prev = rb_entry_dr(rb_prev(&dr->node))) &&
+	       prev->sector + prev->nr_sects >= dr->sector) {
+		end = max(dr->sector + dr->nr_sects,
+			  prev->sector + prev->nr_sects);
+		dr->sector = prev->sector;
+		dr->nr_sects = end - dr->sector;
+		rb_erase(&prev->node, &dq->ranges);
+		dq->nr_ranges--;
+		kmem_cache_free(blk_discard_range_cachep, prev);
+	}
+
+	while ((next = rb_entry_dr(rb_next(&dr->node))) &&
+	       dr->sector + dr->nr_sects >= next->sector) {
+		end = max(dr->sector + dr->nr_sects,
+			  next->sector + next->nr_sects);
+		dr->nr_sects = end - dr->sector;
+		rb_erase(&next->node, &dq->ranges);
+		dq->nr_ranges--;
+		kmem_cache_free(blk_discard_range_cachep, next);
+	}
+}
+
+/**
+ * blk_discard_queue_add - queue a range for discard
+ * @dq:		the discard queue
+ * @sector:	start sector
+ * @nr_sects:	number of sectors to discard
+ * @gfp_mask:	memory allocation flags
+ *
+ * Description:
+ *    Merges the range with the queued ones it overlaps or touches.  If
+ *    no memory can be had for it, the range is issued right away.
+ */
+int blk_discard_queue_add(struct blk_discard_queue *dq, sector_t sector,
+			  sector_t nr_sects, gfp_t gfp_mask)
+{
+	struct rb_node **p = &dq->ranges.rb_node, *parent = NULL;
+	struct blk_discard_range *dr, *new;
+
+	if (!nr_sects)
+		return 0;
+
+	new = kmem_cache_alloc(blk_discard_range_cachep, gfp_mask);
+
+	spin_lock(&dq->lock);
+	while (*p) {
+		parent = *p;
+		dr = rb_entry_dr(parent);
+
+		if (sector + nr_sects < dr->sector)
+			p = &parent->rb_left;
+		else if (sector > dr->sector + dr->nr_sects)
+			p = &parent->rb_right;
+		else {
+			sector_t end = max(sector + nr_sects,
+					   dr->sector + dr->nr_sects);
+
+			dr->sector = min(sector, dr->sector);
+			dr->nr_sects = end - dr->sector;
+			blk_discard_range_merge(dq, dr);
+			spin_unlock(&dq->lock);
+			if (new)
+				kmem_cache_free(blk_discard_range_cachep, new);
+			return 0;
+		}
+	}
+
+	if (!new) {
+		spin_unlock(&dq->lock);
+		blk_discard_queue_submit(dq, sector, nr_sects);
+		return 0;
+	}
+
+	new->sector = sector;
+	new->nr_sects = nr_sects;
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &dq->ranges);
+	dq->nr_ranges++;
+	spin_unlock(&dq->lock);
+	return 0;
+}
+EXPORT_SYMBOL(blk_discard_queue_add);
+
+/*
+ * Issue the queued ranges in sector order, up to budget sectors.
+ * Returns whether ranges are left.
+ */
+static bool blk_discard_queue_run(struct blk_discard_queue *dq,
+				  sector_t budget)
+{
+	struct blk_discard_range *dr;
+	sector_t sector, nr_sects;
+	bool more;
+
+	spin_lock(&dq->lock);
+	while (budget && (dr = rb_entry_dr(rb_first(&dq->ranges)))) {
+		sector = dr->sector;
+		nr_sects = min(dr->nr_sects, budget);
+		if (nr_sects == dr->nr_sects) {
+			rb_erase(&dr->node, &dq->ranges);
+			dq->nr_ranges--;
+			kmem_cache_free(blk_discard_range_cachep, dr);
+		} else {
+			dr->sector += nr_sects;
+			dr->nr_sects -= nr_sects;
+		}
+		spin_unlock(&dq->lock);
+
+		blk_discard_queue_submit(dq, sector, nr_sects);
+		budget -= nr_sects;
+
+		spin_lock(&dq->lock);
+	}
+	more = !RB_EMPTY_ROOT(&dq->ranges);
+	spin_unlock(&dq->lock);
+
+	return more;
+}
+
+static void blk_discard_queue_work(struct work_struct *work)
+{
+	struct blk_discard_queue *dq =
+		container_of(work, struct blk_discard_queue, work.work);
+	sector_t budget = dq->max_sectors ? dq->max_sectors : ~(sector_t)0;
+
+	if (blk_discard_queue_run(dq, budget))
+		kblockd_schedule_delayed_work(bdev_get_queue(dq->bdev),
+					      &dq->work, dq->delay);
+}
+
+/**
+ * blk_discard_queue_kick - issue the queued ranges in the background
+ * @dq:		the discard queue
+ *
+ * Description:
+ *    The ranges are issued from kblockd, max_sectors every delay, the
+ *    first ones delay from now.
+ */
+void blk_discard_queue_kick(struct blk_discard_queue *dq)
+{
+	kblockd_schedule_delayed_work(bdev_get_queue(dq->bdev), &dq->work,
+				      dq->delay);
+}
+EXPORT_SYMBOL(blk_discard_queue_kick);
+
+/**
+ * blk_discard_queue_flush - issue all the queued ranges and wait for them
+ * @dq:		the discard queue
+ *
+ * Description:
+ *    Returns -EOPNOTSUPP if the device does not support discard, -EIO
+ *    if a discard failed since the last flush.
+ */
+int blk_discard_queue_flush(struct blk_discard_queue *dq)
+{
+	int ret = 0;
+
+	cancel_delayed_work_sync(&dq->work);
+	blk_discard_queue_run(dq, ~(sector_t)0);
+	wait_event(dq->wait, !atomic_read(&dq->inflight));
+
+	if (test_and_clear_bit(BIO_EOPNOTSUPP, &dq->flags))
+		ret = -EOPNOTSUPP;
+	if (!test_and_set_bit(BIO_UPTODATE, &dq->flags) && !ret)
+		ret = -EIO;
+	return ret;
+}
+EXPORT_SYMBOL(blk_discard_queue_flush);
+
+/**
+ * blk_alloc_discard_queue - set up a discard queue
+ * @bdev:	blockdev the ranges are on
+ * @gfp_mask:	memory allocation flags
+ *
+ * Description:
+ *    The queue starts with no background rate limit, 1s between runs.
+ *    It must be freed before @bdev is released.
+ */
+struct blk_discard_queue *blk_alloc_discard_queue(struct block_device *bdev,
+						  gfp_t gfp_mask)
+{
+	struct blk_discard_queue *dq;
+
+	dq = kzalloc(sizeof(*dq), gfp_mask);
+	if (!dq)
+		return NULL;
+
+	dq->bdev = bdev;
+	spin_lock_init(&dq->lock);
+	dq->ranges = RB_ROOT;
+	INIT_DELAYED_WORK(&dq->work, blk_discard_queue_work);
+	dq->delay = HZ;
+	atomic_set(&dq->inflight, 0);
+	init_waitqueue_head(&dq->wait);
+	set_bit(BIO_UPTODATE, &dq->flags);
+	return dq;
+}
+EXPORT_SYMBOL(blk_alloc_discard_queue);
+
+/**
+ * blk_free_discard_queue - flush and free a discard queue
+ * @dq:		the discard queue
+ */
+void blk_free_discard_queue(struct blk_discard_queue *dq)
+{
+	blk_discard_queue_flush(dq);
+	kfree(dq);
+}
+EXPORT_SYMBOL(blk_free_discard_queue);
+
+static int __init blk_discard_init(void)
+{
+	blk_discard_range_cachep = KMEM_CACHE(blk_discard_range, 0);
+	return 0;
+}
+subsys_initcall(blk_discard_init);
+
 struct bio_batch
 {
 	atomic_t 		done;
@@ -0,0 +1,292 @@
+/*
+ * Tag allocation of the multi-queue block layer.
+ *
+ * The tags are bits of a bitmap whose words are spread over cachelines,
+ * and each software queue keeps a hint of where to look next, so that
+ * the cpus sharing a hardware queue mostly allocate from their own words:
+ * getting and freeing a tag is a test_and_set_bit() and a clear_bit() on
+ * a mostly cpu local line.  Tasks waiting for a tag are spread over a few
+ * wait queues, woken one queue at a time after a batch of tags has been
+ * freed rather than all of them on each free.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#include "blk-mq-tag.h"
+
+#define TAG_TO_INDEX(bt, tag)	((tag) >> (bt)->bits_per_word)
+#define TAG_TO_BIT(bt, tag)	((tag) & ((1 << (bt)->bits_per_word) - 1))
+
+static inline void bt_index_inc(atomic_t *index)
+{
+	int old = atomic_read(index);
+	int new = (old + 1) & (BT_WAIT_QUEUES - 1);
+
+	atomic_cmpxchg(index, old, new);
+}
+
+/*
+ * Find a free bit in the word, from start to its end then wrapping
+ */
+static int __bt_get_word(struct blk_align_bitmap *bm, unsigned int start)
+{
+	unsigned int end = bm->depth, tag = start;
+	bool wrap = start != 0;
+
+	for (;;) {
+		tag = find_next_zero_bit(&bm->word, end, tag);
+		if (unlikely(tag >= end)) {
+			if (!wrap)
+				return -1;
+			wrap = false;
+			end = start;
+			tag = 0;
+			continue;
+		}
+		if (!test_and_set_bit(tag, &bm->word))
+			return tag;
+		tag++;
+	}
+}
+
+/**
+ * blk_mq_bt_get - get a free tag
+ * @bt:		the tag space
+ * @last_tag:	allocation hint of the caller, updated
+ *
+ * Description:
+ *     Looks for a free tag from *@last_tag on, in its word first then in
+ *     the following ones.  Returns the tag, or -1 if all are in use.
+ */
+int blk_mq_bt_get(struct blk_mq_bitmap_tags *bt, unsigned int *last_tag)
+{
+	unsigned int start = *last_tag < bt->depth ? *last_tag : 0;
+	unsigned int index = TAG_TO_INDEX(bt, start);
+	unsigned int bit = TAG_TO_BIT(bt, start);
+	unsigned int i;
+	int tag;
+
+	for (i = 0; i < bt->map_nr; i++) {
+		tag = __bt_get_word(&bt->map[index], bit);
+		if (tag != -1) {
+			tag += index << bt->bits_per_word;
+			*last_tag = tag + 1 < bt->depth ? tag + 1 : 0;
+			return tag;
+		}
+
+		bit = 0;
+		if (++index >= bt->map_nr)
+			index = 0;
+	}
+
+	return -1;
+}
+
+bool blk_mq_bt_has_free(struct blk_mq_bitmap_tags *bt)
+{
+	unsigned int i;
+
+	for (i = 0; i < bt->map_nr; i++) {
+		struct blk_align_bitmap *bm = &bt->map[i];
+
+		if (find_first_zero_bit(&bm->word, bm->depth) < bm->depth)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * blk_mq_bt_wait - wait for a tag to be freed
+ * @bt:		the tag space
+ *
+ * Description:
+ *     Sleeps until a batch of tags has been freed, unless one is free
+ *     already.  The caller retries blk_mq_bt_get() afterwards and must
+ *     make sure the tags in use will be freed, by running its queue.
+ */
+void blk_mq_bt_wait(struct blk_mq_bitmap_tags *bt)
+{
+	struct bt_wait_state *bs;
+	DEFINE_WAIT(wait);
+
+	bs = &bt->bs[atomic_read(&bt->wait_index)];
+	bt_index_inc(&bt->wait_index);
+
+	prepare_to_wait(&bs->wait, &wait, TASK_UNINTERRUPTIBLE);
+	if (!blk_mq_bt_has_free(bt))
+		io_schedule();
+	finish_wait(&bs->wait, &wait);
+}
+
+/*
+ * The wait queue to account frees to: the current one if it has waiters,
+ * else the next one which has.
+ */
+static struct bt_wait_state *bt_wake_ptr(struct blk_mq_bitmap_tags *bt)
+{
+	int i, wake_index = atomic_read(&bt->wake_index);
+
+	for (i = 0; i < BT_WAIT_QUEUES; i++) {
+		struct bt_wait_state *bs = &bt->bs[wake_index];
+
+		if (waitqueue_active(&bs->wait)) {
+			int o = atomic_read(&bt->wake_index);
+
+			if (wake_index != o)
+				atomic_cmpxchg(&bt->wake_index, o, wake_index);
+			return bs;
+		}
+
+		wake_index = (wake_index + 1) & (BT_WAIT_QUEUES - 1);
+	}
+
+	return NULL;
+}
+
+void blk_mq_bt_put(struct blk_mq_bitmap_tags *bt, unsigned int tag)
+{
+	struct bt_wait_state *bs;
+
+	clear_bit(TAG_TO_BIT(bt, tag), &bt->map[TAG_TO_INDEX(bt, tag)].word);
+	smp_mb__after_clear_bit();
+
+	bs = bt_wake_ptr(bt);
+	if (bs && atomic_dec_and_test(&bs->wait_cnt)) {
+		atomic_add(bt->wake_cnt, &bs->wait_cnt);
+		bt_index_inc(&bt->wake_index);
+		wake_up(&bs->wait);
+	}
+}
+
+/**
+ * blk_mq_init_bitmap_tags - set up a tag space
+ * @bt:		the tag space
+ * @depth:	number of tags
+ * @node:	numa node to allocate on
+ *
+ * Description:
+ *     Small tag spaces get fewer tags per word, so that they still span
+ *     a few cachelines.  Returns 0 or -ENOMEM.
+ */
+int blk_mq_init_bitmap_tags(struct blk_mq_bitmap_tags *bt, unsigned int depth,
+			    int node)
+{
+	unsigned int tags_per_word, i;
+
+	bt->depth = depth;
+	bt->bits_per_word = ilog2(BITS_PER_LONG);
+	tags_per_word = 1U << bt->bits_per_word;
+	if (depth >= 4) {
+		while (tags_per_word * 4 > depth) {
+			bt->bits_per_word--;
+			tags_per_word = 1U << bt->bits_per_word;
+		}
+	}
+
+	bt->map_nr = DIV_ROUND_UP(depth, tags_per_word);
+	bt->map = kzalloc_node(bt->map_nr * sizeof(struct blk_align_bitmap),
+			       GFP_KERNEL, node);
+	bt->bs = kzalloc_node(BT_WAIT_QUEUES * sizeof(struct bt_wait_state),
+			      GFP_KERNEL, node);
+	if (!bt->map || !bt->bs) {
+		blk_mq_free_bitmap_tags(bt);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < bt->map_nr; i++) {
+		bt->map[i].depth = min(depth, tags_per_word);
+		depth -= bt->map[i].depth;
+	}
+
+	/*
+	 * Every wait queue must be woken before all the tags in use have
+	 * been freed, whatever their number.
+	 */
+	bt->wake_cnt = clamp_t(unsigned int, bt->depth / BT_WAIT_QUEUES, 1,
+			       BT_WAIT_BATCH);
+	for (i = 0; i < BT_WAIT_QUEUES; i++) {
+		init_waitqueue_head(&bt->bs[i].wait);
+		atomic_set(&bt->bs[i].wait_cnt, bt->wake_cnt);
+	}
+	atomic_set(&bt->wait_index, 0);
+	atomic_set(&bt->wake_index, 0);
+	return 0;
+}
+
+void blk_mq_free_bitmap_tags(struct blk_mq_bitmap_tags *bt)
+{
+	kfree(bt->map);
+	kfree(bt->bs);
+	bt->map = NULL;
+	bt->bs = NULL;
+}
+
+/**
+ * blk_mq_tag_busy_iter - call a function on the requests whose tag is in use
+ * @tags:	the tags of a hardware queue
+ * @fn:		called on each request
+ * @data:	passed to @fn
+ *
+ * Description:
+ *     The requests may be freed or reused as it runs, @fn has to check
+ *     their state atomically.
+ */
+void blk_mq_tag_busy_iter(struct blk_mq_tags *tags, busy_tag_iter_fn *fn,
+			  void *data)
+{
+	struct blk_mq_bitmap_tags *bt = &tags->bitmap_tags;
+	unsigned int i, bit;
+
+	for (i = 0; i < bt->map_nr; i++) {
+		struct blk_align_bitmap *bm = &bt->map[i];
+
+		for_each_set_bit(bit, &bm->word, bm->depth)
+			fn(tags->rqs[(i << bt->bits_per_word) + bit], data);
+	}
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	unsigned int i;
+
+	if (tags->rqs)
+		for (i = 0; i < tags->nr_tags; i++)
+			kfree(tags->rqs[i]);
+	kfree(tags->rqs);
+	blk_mq_free_bitmap_tags(&tags->bitmap_tags);
+	kfree(tags);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+				     unsigned int rq_size, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int i;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->nr_tags = nr_tags;
+	tags->rqs = kzalloc_node(nr_tags * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!tags->rqs ||
+	    blk_mq_init_bitmap_tags(&tags->bitmap_tags, nr_tags, node))
+		goto fail;
+
+	for (i = 0; i < nr_tags; i++) {
+		tags->rqs[i] = kzalloc_node(rq_size, GFP_KERNEL, node);
+		if (!tags->rqs[i])
+			goto fail;
+	}
+	return tags;
+
+fail:
+	blk_mq_free_tags(tags);
+	return NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef INT_BLK_MQ_TAG_H
+#define INT_BLK_MQ_TAG_H
+
+/*
+ * A word of the tag bitmap, alone in its cacheline so that the cpus
+ * allocating from different words don't bounce it.
+ */
+struct blk_align_bitmap {
+	unsigned long word;
+	unsigned long depth;
+} ____cacheline_aligned_in_smp;
+
+#define BT_WAIT_QUEUES	8
+#define BT_WAIT_BATCH	8
+
+struct bt_wait_state {
+	atomic_t		wait_cnt;
+	wait_queue_head_t	wait;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Tag space of depth tags, in map_nr words of 1 << bits_per_word tags.
+ * The waiters are spread over BT_WAIT_QUEUES wait queues, which are
+ * woken in turn once wake_cnt tags have been freed.  Neither getting nor
+ * freeing a tag takes a lock.
+ */
+struct blk_mq_bitmap_tags {
+	unsigned int		depth;
+	unsigned int		wake_cnt;
+	unsigned int		bits_per_word;
+
+	unsigned int		map_nr;
+	struct blk_align_bitmap	*map;
+
+	atomic_t		wait_index;
+	atomic_t		wake_index;
+	struct bt_wait_state	*bs;
+};
+
+/*
+ * Pre-allocated requests of a hardware queue, and the tags in use:
+ * rqs[tag] is the request for tag.
+ */
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	struct blk_mq_bitmap_tags bitmap_tags;
+	struct request		**rqs;
+};
+
+int blk_mq_init_bitmap_tags(struct blk_mq_bitmap_tags *bt, unsigned int depth,
+			    int node);
+void blk_mq_free_bitmap_tags(struct blk_mq_bitmap_tags *bt);
+int blk_mq_bt_get(struct blk_mq_bitmap_tags *bt, unsigned int *last_tag);
+void blk_mq_bt_put(struct blk_mq_bitmap_tags *bt, unsigned int tag);
+bool blk_mq_bt_has_free(struct blk_mq_bitmap_tags *bt);
+void blk_mq_bt_wait(struct blk_mq_bitmap_tags *bt);
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+				     unsigned int rq_size, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+
+static inline int blk_mq_get_tag(struct blk_mq_tags *tags,
+				 unsigned int *last_tag)
+{
+	return blk_mq_bt_get(&tags->bitmap_tags, last_tag);
+}
+
+static inline void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	blk_mq_bt_put(&tags->bitmap_tags, tag);
+}
+
+typedef void (busy_tag_iter_fn)(struct request *, void *);
+void blk_mq_tag_busy_iter(struct blk_mq_tags *tags, busy_tag_iter_fn *fn,
+			  void *data);
+
+#endif
@@ -0,0 +1,854 @@
+/*
+ * Multi-queue block layer: per-cpu software queues feeding the hardware
+ * dispatch queues of a driver.
+ *
+ * A bio is turned into a request taken from the tags of the hardware
+ * queue serving the submitting cpu, and queued on that cpu's software
+ * queue.  Running the hardware queue splices the software queues that
+ * have requests to a local list, which is handed to the driver one
+ * request at a time.  The only locks are the per-cpu ones of the
+ * software queues and the one of the hardware queue dispatch list: the
+ * queue_lock, the elevator and the request_list are not used.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/sched.h>
+#include <linux/percpu.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+/*
+ * Mark this software queue as having requests, with ctx->lock held
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
+			       struct request *rq, unsigned int rw_flags)
+{
+	blk_rq_init(q, rq);
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+	ctx->rq_dispatched[rw_is_sync(rw_flags)]++;
+}
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      struct blk_mq_ctx *ctx,
+					      unsigned int rw_flags)
+{
+	struct request *rq;
+	int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, &ctx->last_tag);
+	if (tag < 0)
+		return NULL;
+
+	rq = hctx->tags->rqs[tag];
+	blk_mq_rq_ctx_init(hctx->queue, ctx, rq, rw_flags);
+	rq->tag = tag;
+	return rq;
+}
+
+/*
+ * Get a request from the hardware queue of the current cpu, waiting for
+ * one to be freed if __GFP_WAIT is set.  Returns with the software queue
+ * pinned, as blk_mq_get_ctx() does, if a request was found.
+ */
+static struct request *blk_mq_alloc_request_pinned(struct request_queue *q,
+						   unsigned int rw_flags,
+						   gfp_t gfp,
+						   struct blk_mq_ctx **ctxp,
+						   struct blk_mq_hw_ctx **hctxp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	for (;;) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+		rq = __blk_mq_alloc_request(hctx, ctx, rw_flags);
+		if (rq)
+			break;
+		blk_mq_put_ctx(ctx);
+		if (!(gfp & __GFP_WAIT))
+			return NULL;
+
+		/* what is still queued holds tags, get it going */
+		blk_mq_run_hw_queue(hctx, false);
+
+		blk_mq_bt_wait(&hctx->tags->bitmap_tags);
+	}
+
+	*ctxp = ctx;
+	*hctxp = hctx;
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - get a request for a passthrough command
+ * @q:		the multi-queue request queue
+ * @rw:		READ or WRITE
+ * @gfp:	__GFP_WAIT to wait for a tag
+ *
+ * Description:
+ *     Counterpart of blk_get_request(), which calls it for these queues.
+ *     The request is freed with blk_mq_free_request() or blk_put_request().
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	rq = blk_mq_alloc_request_pinned(q, rw, gfp, &ctx, &hctx);
+	if (rq)
+		blk_mq_put_ctx(ctx);
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	/* this is a bio leak */
+	WARN_ON(rq->bio != NULL);
+
+	ctx->rq_completed[rq_is_sync(rq)]++;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+	/* the next request of this software queue reuses its cache hot tag */
+	ctx->last_tag = rq->tag;
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void blk_mq_arm_timer(struct request_queue *q, unsigned long deadline)
+{
+	unsigned long expiry = round_jiffies_up(deadline);
+
+	if (!timer_pending(&q->timeout) ||
+	    time_before(expiry, q->timeout.expires))
+		mod_timer(&q->timeout, expiry);
+}
+
+static void blk_mq_start_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	trace_block_rq_issue(q, rq);
+
+	if (!q->mq_ops->timeout)
+		return;
+
+	if (!rq->timeout)
+		rq->timeout = q->rq_timeout;
+	rq->deadline = jiffies + rq->timeout;
+	set_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+	blk_mq_arm_timer(q, rq->deadline);
+}
+
+/**
+ * blk_mq_end_io - end all the I/O of a multi-queue request
+ * @rq:		the request being completed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Description:
+ *     Completes all the bios of @rq, then calls its ->end_io or frees
+ *     it.  May be called from any context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	bool pending;
+
+	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+
+	pending = blk_update_request(rq, error, blk_rq_bytes(rq));
+	BUG_ON(pending);
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_complete_local(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (q->mq_ops->complete)
+		q->mq_ops->complete(rq);
+	else
+		blk_mq_end_io(rq, rq->errors);
+}
+
+static void blk_mq_complete_remote(void *data)
+{
+	blk_mq_complete_local(data);
+}
+
+/*
+ * Finish the request on the cpu that submitted it, where its data and
+ * its submitter are likely still cache hot, unless told otherwise.
+ */
+static void __blk_mq_complete_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	int cpu, target;
+
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags)) {
+		blk_mq_complete_local(rq);
+		return;
+	}
+
+	target = blk_rq_cpu_valid(rq) ? rq->cpu : ctx->cpu;
+	cpu = get_cpu();
+	if (cpu != target && cpu_online(target)) {
+		rq->csd.func = blk_mq_complete_remote;
+		rq->csd.info = rq;
+		rq->csd.flags = 0;
+		__smp_call_function_single(target, &rq->csd, 0);
+	} else
+		blk_mq_complete_local(rq);
+	put_cpu();
+}
+
+/**
+ * blk_mq_complete_request - end I/O on a request
+ * @rq:		the request being processed
+ *
+ * Description:
+ *     Called by the driver from its interrupt handler when the hardware
+ *     is done with @rq.  ->complete() is then run, or blk_mq_end_io(),
+ *     on the submitting cpu, unless the request has already timed out.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	if (!blk_mark_rq_complete(rq))
+		__blk_mq_complete_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+static void blk_mq_rq_timed_out(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	enum blk_eh_timer_return ret;
+
+	ret = q->mq_ops->timeout(rq);
+	switch (ret) {
+	case BLK_EH_HANDLED:
+		__blk_mq_complete_request(rq);
+		break;
+	case BLK_EH_RESET_TIMER:
+		rq->deadline = jiffies + rq->timeout;
+		blk_clear_rq_complete(rq);
+		blk_mq_arm_timer(q, rq->deadline);
+		break;
+	case BLK_EH_NOT_HANDLED:
+		break;
+	default:
+		printk(KERN_ERR "block: bad eh return: %d\n", ret);
+		break;
+	}
+}
+
+/*
+ * Requests in flight are found through the tags in use, so starting and
+ * ending a request don't have to put it on a list under a lock.
+ */
+struct blk_mq_timeout_data {
+	unsigned long next;
+	int next_set;
+};
+
+static void blk_mq_check_expired(struct request *rq, void *priv)
+{
+	struct blk_mq_timeout_data *data = priv;
+
+	if (!test_bit(REQ_ATOM_STARTED, &rq->atomic_flags))
+		return;
+
+	if (time_after_eq(jiffies, rq->deadline)) {
+		/* check if we raced with end io completion */
+		if (!blk_mark_rq_complete(rq))
+			blk_mq_rq_timed_out(rq);
+	} else if (!data->next_set || time_after(data->next, rq->deadline)) {
+		data->next = rq->deadline;
+		data->next_set = 1;
+	}
+}
+
+static void blk_mq_rq_timer(unsigned long data)
+{
+	struct request_queue *q = (struct request_queue *) data;
+	struct blk_mq_timeout_data td = { .next = 0, .next_set = 0 };
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_tag_busy_iter(hctx->tags, blk_mq_check_expired, &td);
+
+	if (td.next_set)
+		blk_mq_arm_timer(q, td.next);
+}
+
+/**
+ * blk_mq_requeue_request - hand a started request back to the block layer
+ * @rq:		the request to requeue
+ *
+ * Description:
+ *     @rq goes to the head of its hardware queue, to be dispatched again
+ *     the next time that queue is run.  Any context.
+ */
+void blk_mq_requeue_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	unsigned long flags;
+
+	trace_block_rq_requeue(q, rq);
+	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+	blk_clear_rq_complete(rq);
+
+	spin_lock_irqsave(&hctx->lock, flags);
+	list_add(&rq->queuelist, &hctx->dispatch);
+	spin_unlock_irqrestore(&hctx->lock, flags);
+}
+EXPORT_SYMBOL(blk_mq_requeue_request);
+
+/*
+ * Move everything queued for this hardware queue to the driver, until
+ * it tells us it is busy.  Process context, from one of the cpus the
+ * queue serves or from kblockd; may run on several cpus at once.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	unsigned long queued = 0;
+	unsigned int bit;
+	int ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/* the driver could not take these on the last run, they go first */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock_irq(&hctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_entry_rq(rq_list.next);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK) {
+			queued++;
+			continue;
+		}
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		if (ret != BLK_MQ_RQ_QUEUE_ERROR)
+			printk(KERN_ERR "blk-mq: bad queue_rq return: %d\n", ret);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, rq->errors);
+	}
+
+	hctx->dispatched += queued;
+
+	if (!list_empty(&rq_list)) {
+		spin_lock_irq(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock_irq(&hctx->lock);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the requests of a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	leave it to kblockd
+ *
+ * Description:
+ *     Runs the queue right away if we are on one of the cpus it serves
+ *     and @async is not set, from kblockd otherwise.  Interrupt handlers
+ *     must set @async.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async) {
+		preempt_disable();
+		if (cpumask_test_cpu(smp_processor_id(), hctx->cpumask)) {
+			__blk_mq_run_hw_queue(hctx);
+			preempt_enable();
+			return;
+		}
+		preempt_enable();
+	}
+
+	kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx))
+			continue;
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/*
+ * A stopped hardware queue is not run until restarted, typically by the
+ * driver when it returned BLK_MQ_RQ_QUEUE_BUSY and got room again.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	blk_mq_run_hw_queue(hctx, true);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_stop_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_stop_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/*
+ * Queue rq on its software queue, with ctx->lock held
+ */
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+	hctx->queued++;
+}
+
+/**
+ * blk_mq_insert_request - queue a passthrough request
+ * @rq:		request from blk_mq_alloc_request()
+ * @at_head:	insert at the head of the software queue
+ * @run_queue:	run the hardware queue afterwards
+ * @async:	run it from kblockd
+ *
+ * Description:
+ *     Counterpart of elv_add_request(), blk_execute_rq_nowait() calls it
+ *     for these queues.  Process context.
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, rq, at_head);
+	spin_unlock(&ctx->lock);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Try to add bio at the back of the last request of this software queue,
+ * which is as far as lookups go without an elevator.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	bool merged = false;
+
+	spin_lock(&ctx->lock);
+	if (list_empty(&ctx->rq_list))
+		goto out;
+
+	rq = list_entry_rq(ctx->rq_list.prev);
+	if (elv_rq_merge_ok(rq, bio) &&
+	    blk_rq_pos(rq) + blk_rq_sectors(rq) == bio->bi_sector &&
+	    bio_attempt_back_merge(q, rq, bio)) {
+		ctx->rq_merged++;
+		merged = true;
+	}
+out:
+	spin_unlock(&ctx->lock);
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	unsigned int rw_flags;
+	bool async;
+
+	/* FLUSH and FUA aren't sequenced without an elevator */
+	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	rw_flags = bio_data_dir(bio);
+	if (bio->bi_rw & REQ_SYNC)
+		rw_flags |= REQ_SYNC;
+
+	/*
+	 * Writeback may leave it to kblockd, so that the next bios have a
+	 * chance to be merged before the queue is run.
+	 */
+	async = !rw_is_sync(rw_flags) && !(bio->bi_rw & REQ_UNPLUG);
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) && !blk_queue_nomerges(q) &&
+	    blk_mq_attempt_merge(q, ctx, bio)) {
+		blk_mq_put_ctx(ctx);
+		return 0;
+	}
+	blk_mq_put_ctx(ctx);
+
+	trace_block_getrq(q, bio, rw_flags & 1);
+
+	/* this may sleep, but can not fail */
+	rq = blk_mq_alloc_request_pinned(q, rw_flags, GFP_NOIO, &ctx, &hctx);
+
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, rq, false);
+	spin_unlock(&ctx->lock);
+	blk_mq_put_ctx(ctx);
+
+	blk_mq_run_hw_queue(hctx, async);
+	return 0;
+}
+
+static void blk_mq_free_hw_queues(struct blk_mq_hw_ctx **hctxs,
+				  unsigned int nr)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		hctx = hctxs[i];
+		if (!hctx)
+			continue;
+		if (hctx->tags)
+			blk_mq_free_tags(hctx->tags);
+		kfree(hctx->ctxs);
+		kfree(hctx->ctx_map);
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+	}
+	kfree(hctxs);
+}
+
+static struct blk_mq_hw_ctx **blk_mq_alloc_hw_queues(struct request_queue *q,
+						     struct blk_mq_reg *reg)
+{
+	unsigned int rq_size = sizeof(struct request) + reg->cmd_size;
+	struct blk_mq_hw_ctx **hctxs, *hctx;
+	unsigned int i;
+
+	hctxs = kzalloc_node(reg->nr_hw_queues * sizeof(*hctxs), GFP_KERNEL,
+			     reg->numa_node);
+	if (!hctxs)
+		return NULL;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		if (!hctx)
+			goto fail;
+		hctxs[i] = hctx;
+
+		if (!zalloc_cpumask_var(&hctx->cpumask, GFP_KERNEL))
+			goto fail;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_work_fn);
+		hctx->queue = q;
+		hctx->flags = reg->flags;
+		hctx->queue_num = i;
+		hctx->queue_depth = reg->queue_depth;
+		hctx->numa_node = reg->numa_node;
+
+		hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, reg->numa_node);
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(long), GFP_KERNEL,
+					     reg->numa_node);
+		hctx->tags = blk_mq_init_tags(reg->queue_depth, rq_size,
+					      reg->numa_node);
+		if (!hctx->ctxs || !hctx->ctx_map || !hctx->tags)
+			goto fail;
+	}
+	return hctxs;
+
+fail:
+	blk_mq_free_hw_queues(hctxs, reg->nr_hw_queues);
+	return NULL;
+}
+
+/*
+ * Spread the cpus over the hardware queues in contiguous ranges, which
+ * keeps the siblings of a core on the same queue.
+ */
+static unsigned int *blk_mq_make_queue_map(struct blk_mq_reg *reg)
+{
+	unsigned int *map;
+	unsigned int cpu;
+
+	map = kzalloc_node(nr_cpu_ids * sizeof(*map), GFP_KERNEL,
+			   reg->numa_node);
+	if (!map)
+		return NULL;
+
+	for_each_possible_cpu(cpu)
+		map[cpu] = cpu * reg->nr_hw_queues / nr_cpu_ids;
+	return map;
+}
+
+static void blk_mq_map_swqueue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int cpu, j;
+	int i;
+
+	for_each_possible_cpu(cpu) {
+		ctx = __blk_mq_get_ctx(q, cpu);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, cpu);
+		cpumask_set_cpu(cpu, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		hctx_for_each_ctx(hctx, ctx, j)
+			ctx->last_tag = j * hctx->tags->nr_tags / hctx->nr_ctx;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	the hardware queues of the device
+ * @driver_data: passed to ->init_hctx()
+ *
+ * Description:
+ *     Allocates a request queue with a software queue per cpu and
+ *     @reg->nr_hw_queues hardware queues of @reg->queue_depth requests
+ *     each, carrying @reg->cmd_size bytes for the driver.  Torn down by
+ *     blk_cleanup_queue() as any other queue.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx **hctxs;
+	struct request_queue *q;
+	unsigned int *map;
+	int i, err;
+
+	if (!reg->nr_hw_queues || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH ||
+	    !reg->ops->queue_rq || !reg->ops->map_queue)
+		return ERR_PTR(-EINVAL);
+
+	if (reg->nr_hw_queues > nr_cpu_ids)
+		reg->nr_hw_queues = nr_cpu_ids;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	if (!q->queue_ctx)
+		goto err_queue;
+
+	map = blk_mq_make_queue_map(reg);
+	if (!map)
+		goto err_ctx;
+
+	hctxs = blk_mq_alloc_hw_queues(q, reg);
+	if (!hctxs)
+		goto err_map;
+
+	for (i = 0; reg->ops->init_hctx && i < reg->nr_hw_queues; i++) {
+		err = reg->ops->init_hctx(hctxs[i], driver_data, i);
+		if (err)
+			goto err_hctx;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->nr_requests = reg->queue_depth;
+	blk_queue_rq_timeout(q, reg->timeout ? reg->timeout : 30 * HZ);
+	setup_timer_coarse(&q->timeout, blk_mq_rq_timer, (unsigned long) q);
+
+	q->mq_map = map;
+	q->queue_hw_ctx = hctxs;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->mq_ops = reg->ops;
+
+	blk_mq_map_swqueue(q);
+	return q;
+
+err_hctx:
+	while (reg->ops->exit_hctx && --i >= 0)
+		reg->ops->exit_hctx(hctxs[i], i);
+	blk_mq_free_hw_queues(hctxs, reg->nr_hw_queues);
+err_map:
+	kfree(map);
+err_ctx:
+	free_percpu(q->queue_ctx);
+	q->queue_ctx = NULL;
+err_queue:
+	blk_cleanup_queue(q);
+	return ERR_PTR(err);
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Stop the dispatch works, the caller already made sure that no new
+ * I/O comes in
+ */
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		cancel_work_sync(&hctx->run_work);
+}
+
+/*
+ * Last reference to the queue dropped
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+	}
+
+	blk_mq_free_hw_queues(q->queue_hw_ctx, q->nr_hw_queues);
+	kfree(q->mq_map);
+	free_percpu(q->queue_ctx);
+	q->mq_ops = NULL;
+}
@@ -8,11 +8,35 @@
 #include <linux/blkdev.h>
 #include <linux/interrupt.h>
 #include <linux/cpu.h>
+#include <linux/ktime.h>
 
 #include "blk.h"
 
 static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
 
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+/*
+ * Requests completed on other cpus on behalf of this one.  They are
+ * batched here and the cpu is sent a single IPI when the list goes from
+ * empty to non empty, whatever the number of requests queued until it
+ * gets to them.
+ */
+struct blk_remote_done {
+	spinlock_t		lock;
+	struct list_head	list;
+	struct call_single_data	csd;
+};
+
+static DEFINE_PER_CPU(struct blk_remote_done, blk_remote_done);
+#endif
+
+static inline void blk_account_comp_latency(struct request *rq)
+{
+	u64 delta = ktime_to_ns(ktime_get()) - rq->complete_time_ns;
+
+	irqsafe_cpu_add(rq->q->comp_stats->latency_ns, delta);
+}
+
 /*
  * Softirq action handler - move entries to local list and loop over them
  * while passing them to the queue registered handler.
@@ -31,6 +55,7 @@ static void blk_done_softirq(struct softirq_action *h)
 
 		rq = list_entry(local_list.next, struct request, csd.list);
 		list_del_init(&rq->csd.list);
+		blk_account_comp_latency(rq);
 		rq->q->softirq_done_fn(rq);
 	}
 }
@@ -38,43 +63,79 @@ static void blk_done_softirq(struct softirq_action *h)
 #if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
 static void trigger_softirq(void *data)
 {
-	struct request *rq = data;
+	struct blk_remote_done *rd = data;
 	unsigned long flags;
-	struct list_head *list;
 
 	local_irq_save(flags);
-	list = &__get_cpu_var(blk_cpu_done);
-	list_add_tail(&rq->csd.list, list);
-
-	if (list->next == &rq->csd.list)
-		raise_softirq_irqoff(BLOCK_SOFTIRQ);
+	spin_lock(&rd->lock);
+	list_splice_tail_init(&rd->list, &__get_cpu_var(blk_cpu_done));
+	spin_unlock(&rd->lock);
 
+	raise_softirq_irqoff(BLOCK_SOFTIRQ);
 	local_irq_restore(flags);
 }
 
 /*
- * Setup and invoke a run of 'trigger_softirq' on the given cpu.
+ * Queue @rq for completion on @cpu, and kick a run of 'trigger_softirq'
+ * there unless one is already pending.  Called with irqs disabled.
  */
 static int raise_blk_irq(int cpu, struct request *rq)
 {
-	if (cpu_online(cpu)) {
-		struct call_single_data *data = &rq->csd;
+	struct blk_comp_stats __percpu *stats = rq->q->comp_stats;
+	struct blk_remote_done *rd;
+	bool kick;
+
+	if (!cpu_online(cpu))
+		return 1;
+
+	rd = &per_cpu(blk_remote_done, cpu);
+	spin_lock(&rd->lock);
+	kick = list_empty(&rd->list);
+	list_add_tail(&rq->csd.list, &rd->list);
+	spin_unlock(&rd->lock);
+
+	/* @rq may be completed and gone from here on */
+	__this_cpu_inc(stats->remote);
+	if (kick) {
+		__smp_call_function_single(cpu, &rd->csd, 0);
+		__this_cpu_inc(stats->ipis);
+	}
+	return 0;
+}
+
+static void blk_remote_done_init(int cpu)
+{
+	struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
 
-		data->func = trigger_softirq;
-		data->info = rq;
-		data->flags = 0;
+	spin_lock_init(&rd->lock);
+	INIT_LIST_HEAD(&rd->list);
+	rd->csd.func = trigger_softirq;
+	rd->csd.info = rd;
+	rd->csd.flags = 0;
+}
 
-		__smp_call_function_single(cpu, data, 0);
-		return 0;
-	}
+/* A dead cpu won't run its IPIs: take what was queued for it */
+static void blk_remote_done_splice(int cpu)
+{
+	struct blk_remote_done *rd = &per_cpu(blk_remote_done, cpu);
 
-	return 1;
+	spin_lock(&rd->lock);
+	list_splice_tail_init(&rd->list, &__get_cpu_var(blk_cpu_done));
+	spin_unlock(&rd->lock);
 }
 #else /* CONFIG_SMP && CONFIG_USE_GENERIC_SMP_HELPERS */
 static int raise_blk_irq(int cpu, struct request *rq)
 {
 	return 1;
 }
+
+static inline void blk_remote_done_init(int cpu)
+{
+}
+
+static inline void blk_remote_done_splice(int cpu)
+{
+}
 #endif
 
 static int __cpuinit blk_cpu_notify(struct notifier_block *self,
@@ -90,6 +151,7 @@ static int __cpuinit blk_cpu_notify(struct notifier_block *self,
 		local_irq_disable();
 		list_splice_init(&per_cpu(blk_cpu_done, cpu),
 				 &__get_cpu_var(blk_cpu_done));
+		blk_remote_done_splice(cpu);
 		raise_softirq_irqoff(BLOCK_SOFTIRQ);
 		local_irq_enable();
 	}
@@ -105,25 +167,31 @@ void __blk_complete_request(struct request *req)
 {
 	struct request_queue *q = req->q;
 	unsigned long flags;
-	int ccpu, cpu, group_cpu;
+	bool shared = false;
+	int ccpu, cpu;
 
 	BUG_ON(!q->softirq_done_fn);
 
+	req->complete_time_ns = ktime_to_ns(ktime_get());
+
 	local_irq_save(flags);
 	cpu = smp_processor_id();
-	group_cpu = blk_cpu_to_group(cpu);
 
 	/*
-	 * Select completion CPU
+	 * Select completion CPU: the submitting one, or with rq_affinity=1
+	 * any cpu sharing its cache.
 	 */
-	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) && req->cpu != -1)
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) && req->cpu != -1) {
 		ccpu = req->cpu;
-	else
+		if (!test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags))
+			shared = blk_cpu_to_group(ccpu) == blk_cpu_to_group(cpu);
+	} else
 		ccpu = cpu;
 
-	if (ccpu == cpu || ccpu == group_cpu) {
+	if (ccpu == cpu || shared) {
 		struct list_head *list;
 do_local:
+		__this_cpu_inc(q->comp_stats->local);
 		list = &__get_cpu_var(blk_cpu_done);
 		list_add_tail(&req->csd.list, list);
 
@@ -165,8 +233,10 @@ static __init int blk_softirq_init(void)
 {
 	int i;
 
-	for_each_possible_cpu(i)
+	for_each_possible_cpu(i) {
 		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+		blk_remote_done_init(i);
+	}
 
 	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq);
 	register_hotcpu_notifier(&blk_cpu_notifier);
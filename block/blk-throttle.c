@@ -0,0 +1,625 @@
+/*
+ * Interface for controlling IO bandwidth on a request queue
+ *
+ * Each cgroup may be given, per device, a bytes per second and an IOs
+ * per second limit for reads and for writes.  The limits are enforced
+ * when the bios are submitted, in generic_make_request() and before the
+ * queue's make_request_fn: a bio over its group's limits is held in a
+ * per group fifo, and released later by a delayed work on kblockd when
+ * enough time went by.  This works above any IO scheduler and for the
+ * bio based, stacked devices alike.
+ *
+ * The rates are measured over time slices of throtl_slice jiffies, which
+ * are extended while bios are waiting and trimmed of the part already
+ * used up, so that an idle group doesn't build up credit.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/blktrace_api.h>
+#include "blk-cgroup.h"
+#include "blk.h"
+
+/* Length of the slices the rates are measured over */
+static unsigned long throtl_slice = HZ/10;	/* 100 ms */
+
+struct throtl_grp {
+	/* must be the first member */
+	struct blkio_group blkg;
+
+	/* on td->tg_list, and on td->active_list while bios are queued */
+	struct hlist_node tg_node;
+	struct list_head active_node;
+
+	/* bios waiting for dispatch, READ and WRITE */
+	struct bio_list bio_lists[2];
+	unsigned int nr_queued[2];
+
+	/* the limits in force, and the ones written in the cgroup */
+	struct blkio_throtl_limits limits;
+	struct blkio_throtl_limits new_limits;
+	bool limits_changed;
+
+	/* dispatched in the current slice */
+	u64 bytes_disp[2];
+	unsigned int io_disp[2];
+	unsigned long slice_start[2];
+	unsigned long slice_end[2];
+
+	struct rcu_head rcu_head;
+};
+
+struct throtl_data {
+	/* all the groups but the root one */
+	struct hlist_head tg_list;
+	/* the groups having bios queued */
+	struct list_head active_list;
+	struct throtl_grp root_tg;
+
+	struct request_queue *queue;
+	unsigned int nr_queued;
+
+	/* set when a group's limits were updated through the cgroup */
+	bool limits_changed;
+
+	struct delayed_work dispatch_work;
+	unsigned long dispatch_time;
+};
+
+static inline struct throtl_grp *tg_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct throtl_grp, blkg);
+
+	return NULL;
+}
+
+static void throtl_init_group(struct throtl_grp *tg)
+{
+	INIT_HLIST_NODE(&tg->tg_node);
+	INIT_LIST_HEAD(&tg->active_node);
+	bio_list_init(&tg->bio_lists[READ]);
+	bio_list_init(&tg->bio_lists[WRITE]);
+	tg->blkg.plid = BLKIO_POLICY_THROTL;
+}
+
+/* The limits are set per disk, the bdi is named after its dev_t */
+static dev_t throtl_queue_dev(struct request_queue *q)
+{
+	struct backing_dev_info *bdi = &q->backing_dev_info;
+	unsigned int major, minor;
+
+	if (!bdi->dev || sscanf(dev_name(bdi->dev), "%u:%u", &major,
+				&minor) != 2)
+		return 0;
+
+	return MKDEV(major, minor);
+}
+
+/*
+ * Find or create the group of the current task, called with the queue
+ * lock held.  The root group is set up with the queue, before its disk
+ * is known, and gets its device and limits here.
+ */
+static struct throtl_grp *throtl_get_tg(struct throtl_data *td)
+{
+	struct blkio_cgroup *blkcg;
+	struct throtl_grp *tg;
+	dev_t dev;
+
+	rcu_read_lock();
+	blkcg = cgroup_to_blkio_cgroup(task_cgroup(current, blkio_subsys_id));
+
+	if (blkcg == &blkio_root_cgroup) {
+		tg = &td->root_tg;
+		if (!tg->blkg.dev) {
+			tg->blkg.dev = throtl_queue_dev(td->queue);
+			blkcg_get_throtl_limits(blkcg, tg->blkg.dev,
+						&tg->limits);
+		}
+		goto out;
+	}
+
+	tg = tg_of_blkg(blkiocg_lookup_group(blkcg, td));
+	if (tg)
+		goto out;
+
+	/* can't sleep here, whatever fails is accounted to the root group */
+	tg = kzalloc_node(sizeof(*tg), GFP_ATOMIC, td->queue->node);
+	if (!tg) {
+		tg = &td->root_tg;
+		goto out;
+	}
+
+	throtl_init_group(tg);
+	dev = throtl_queue_dev(td->queue);
+	blkiocg_add_blkio_group(blkcg, &tg->blkg, td, dev);
+	blkcg_get_throtl_limits(blkcg, dev, &tg->limits);
+	hlist_add_head(&tg->tg_node, &td->tg_list);
+out:
+	rcu_read_unlock();
+	return tg;
+}
+
+static void throtl_free_tg(struct rcu_head *head)
+{
+	kfree(container_of(head, struct throtl_grp, rcu_head));
+}
+
+/* Whatever is still queued in tg goes on with the root group */
+static void throtl_destroy_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	struct throtl_grp *root_tg = &td->root_tg;
+	int rw;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		bio_list_merge(&root_tg->bio_lists[rw], &tg->bio_lists[rw]);
+		root_tg->nr_queued[rw] += tg->nr_queued[rw];
+	}
+	if ((root_tg->nr_queued[READ] || root_tg->nr_queued[WRITE]) &&
+	    list_empty(&root_tg->active_node))
+		list_add_tail(&root_tg->active_node, &td->active_list);
+
+	list_del_init(&tg->active_node);
+	hlist_del_init(&tg->tg_node);
+
+	/* blkiocg_lookup_group() walks the cgroup's groups under rcu */
+	call_rcu(&tg->rcu_head, throtl_free_tg);
+}
+
+static void throtl_schedule_dispatch(struct throtl_data *td,
+				     unsigned long delay)
+{
+	unsigned long when = jiffies + delay;
+
+	/* an earlier run is already on its way */
+	if (delayed_work_pending(&td->dispatch_work) &&
+	    time_before_eq(td->dispatch_time, when))
+		return;
+
+	cancel_delayed_work(&td->dispatch_work);
+	td->dispatch_time = when;
+	kblockd_schedule_delayed_work(td->queue, &td->dispatch_work, delay);
+}
+
+static void throtl_start_new_slice(struct throtl_grp *tg, bool rw)
+{
+	tg->bytes_disp[rw] = 0;
+	tg->io_disp[rw] = 0;
+	tg->slice_start[rw] = jiffies;
+	tg->slice_end[rw] = jiffies + throtl_slice;
+}
+
+static void throtl_extend_slice(struct throtl_grp *tg, bool rw,
+				unsigned long jiffy_end)
+{
+	tg->slice_end[rw] = roundup(jiffy_end, throtl_slice);
+}
+
+static bool throtl_slice_used(struct throtl_grp *tg, bool rw)
+{
+	return !time_in_range(jiffies, tg->slice_start[rw], tg->slice_end[rw]);
+}
+
+/*
+ * Drop the whole slices already gone by, and what could be dispatched
+ * in them, keeping the slice going for the bios still queued.
+ */
+static void throtl_trim_slice(struct throtl_grp *tg, bool rw)
+{
+	unsigned long nr_slices;
+	unsigned int io_trim;
+	u64 bytes_trim;
+
+	if (throtl_slice_used(tg, rw))
+		return;
+
+	throtl_extend_slice(tg, rw, jiffies + throtl_slice);
+
+	nr_slices = (jiffies - tg->slice_start[rw]) / throtl_slice;
+	if (!nr_slices)
+		return;
+
+	bytes_trim = tg->limits.bps[rw] * throtl_slice * nr_slices;
+	do_div(bytes_trim, HZ);
+	io_trim = div_u64((u64)tg->limits.iops[rw] * throtl_slice * nr_slices,
+			  HZ);
+
+	if (!bytes_trim && !io_trim)
+		return;
+
+	tg->bytes_disp[rw] -= min(tg->bytes_disp[rw], bytes_trim);
+	tg->io_disp[rw] -= min(tg->io_disp[rw], io_trim);
+	tg->slice_start[rw] += nr_slices * throtl_slice;
+}
+
+/* The slice so far, rounded up to whole slices */
+static unsigned long throtl_slice_elapsed(struct throtl_grp *tg, bool rw,
+					  unsigned long *elapsed)
+{
+	*elapsed = jiffies - tg->slice_start[rw];
+
+	return roundup(*elapsed ? *elapsed : 1, throtl_slice);
+}
+
+static bool tg_within_bps_limit(struct throtl_grp *tg, struct bio *bio,
+				unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long elapsed, elapsed_rnd, jiffy_wait;
+	u64 bytes_allowed, extra_bytes;
+
+	elapsed_rnd = throtl_slice_elapsed(tg, rw, &elapsed);
+
+	bytes_allowed = tg->limits.bps[rw] * elapsed_rnd;
+	do_div(bytes_allowed, HZ);
+
+	if (tg->bytes_disp[rw] + bio->bi_size <= bytes_allowed) {
+		*wait = 0;
+		return true;
+	}
+
+	/* the time it takes for the rate to cover the excess */
+	extra_bytes = tg->bytes_disp[rw] + bio->bi_size - bytes_allowed;
+	jiffy_wait = div64_u64(extra_bytes * HZ, tg->limits.bps[rw]);
+	if (!jiffy_wait)
+		jiffy_wait = 1;
+
+	*wait = jiffy_wait + (elapsed_rnd - elapsed);
+	return false;
+}
+
+static bool tg_within_iops_limit(struct throtl_grp *tg, struct bio *bio,
+				 unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long elapsed, elapsed_rnd, jiffy_wait;
+	u64 io_allowed;
+
+	elapsed_rnd = throtl_slice_elapsed(tg, rw, &elapsed);
+
+	io_allowed = (u64)tg->limits.iops[rw] * elapsed_rnd;
+	do_div(io_allowed, HZ);
+
+	if (tg->io_disp[rw] + 1 <= io_allowed) {
+		*wait = 0;
+		return true;
+	}
+
+	jiffy_wait = div_u64((u64)(tg->io_disp[rw] + 1) * HZ,
+			     tg->limits.iops[rw]) + 1;
+	if (jiffy_wait > elapsed)
+		jiffy_wait -= elapsed;
+	else
+		jiffy_wait = 1;
+
+	*wait = jiffy_wait;
+	return false;
+}
+
+/*
+ * Can bio go now, within tg's limits?  If not, *wait is the number of
+ * jiffies until it can.
+ */
+static bool tg_may_dispatch(struct throtl_grp *tg, struct bio *bio,
+			    unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long bps_wait = 0, iops_wait = 0, max_wait;
+
+	*wait = 0;
+	if (!tg->limits.bps[rw] && !tg->limits.iops[rw])
+		return true;
+
+	/*
+	 * Start a new slice if the previous one is over, otherwise make
+	 * sure the current one lasts at least throtl_slice from now.
+	 */
+	if (throtl_slice_used(tg, rw))
+		throtl_start_new_slice(tg, rw);
+	else if (time_before(tg->slice_end[rw], jiffies + throtl_slice))
+		throtl_extend_slice(tg, rw, jiffies + throtl_slice);
+
+	if ((!tg->limits.bps[rw] || tg_within_bps_limit(tg, bio, &bps_wait)) &&
+	    (!tg->limits.iops[rw] || tg_within_iops_limit(tg, bio, &iops_wait)))
+		return true;
+
+	max_wait = max(bps_wait, iops_wait);
+	if (time_before(tg->slice_end[rw], jiffies + max_wait))
+		throtl_extend_slice(tg, rw, jiffies + max_wait);
+
+	*wait = max_wait;
+	return false;
+}
+
+static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+
+	tg->bytes_disp[rw] += bio->bi_size;
+	tg->io_disp[rw]++;
+}
+
+/* Apply the limits written in the cgroups since the last dispatch */
+static void throtl_process_limits(struct throtl_data *td)
+{
+	struct throtl_grp *tg;
+	struct hlist_node *pos;
+	int rw;
+
+	td->limits_changed = false;
+	smp_mb();
+
+	hlist_for_each_entry(tg, pos, &td->tg_list, tg_node) {
+		if (!tg->limits_changed)
+			continue;
+		tg->limits_changed = false;
+		smp_mb();
+		tg->limits = tg->new_limits;
+		for (rw = READ; rw <= WRITE; rw++)
+			throtl_start_new_slice(tg, rw);
+	}
+
+	tg = &td->root_tg;
+	if (tg->limits_changed) {
+		tg->limits_changed = false;
+		smp_mb();
+		tg->limits = tg->new_limits;
+		for (rw = READ; rw <= WRITE; rw++)
+			throtl_start_new_slice(tg, rw);
+	}
+}
+
+/*
+ * Move the bios of tg which are now within its limits to bl, returns
+ * false and the time until the next one can go if any is left.
+ */
+static bool throtl_dispatch_tg(struct throtl_data *td, struct throtl_grp *tg,
+			       struct bio_list *bl, unsigned long *wait)
+{
+	unsigned long rw_wait;
+	bool done = true;
+	struct bio *bio;
+	int rw, nr;
+
+	*wait = ULONG_MAX;
+	for (rw = READ; rw <= WRITE; rw++) {
+		nr = 0;
+		while ((bio = bio_list_peek(&tg->bio_lists[rw]))) {
+			if (!tg_may_dispatch(tg, bio, &rw_wait)) {
+				*wait = min(*wait, rw_wait);
+				done = false;
+				break;
+			}
+			bio_list_pop(&tg->bio_lists[rw]);
+			tg->nr_queued[rw]--;
+			td->nr_queued--;
+			throtl_charge_bio(tg, bio);
+			bio->bi_rw |= REQ_THROTTLED;
+			bio_list_add(bl, bio);
+			nr++;
+		}
+		if (nr)
+			throtl_trim_slice(tg, rw);
+	}
+
+	return done;
+}
+
+static void throtl_dispatch_work(struct work_struct *work)
+{
+	struct throtl_data *td = container_of(work, struct throtl_data,
+					      dispatch_work.work);
+	struct request_queue *q = td->queue;
+	struct throtl_grp *tg, *n;
+	unsigned long wait, min_wait = ULONG_MAX;
+	struct bio_list bio_list_on_stack;
+	struct blk_plug plug;
+	struct bio *bio;
+
+	bio_list_init(&bio_list_on_stack);
+
+	spin_lock_irq(q->queue_lock);
+
+	if (td->limits_changed)
+		throtl_process_limits(td);
+
+	list_for_each_entry_safe(tg, n, &td->active_list, active_node) {
+		if (throtl_dispatch_tg(td, tg, &bio_list_on_stack, &wait))
+			list_del_init(&tg->active_node);
+		else
+			min_wait = min(min_wait, wait);
+	}
+
+	if (td->nr_queued)
+		throtl_schedule_dispatch(td, min_wait);
+
+	spin_unlock_irq(q->queue_lock);
+
+	if (bio_list_empty(&bio_list_on_stack))
+		return;
+
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(&bio_list_on_stack)))
+		generic_make_request(bio);
+	blk_finish_plug(&plug);
+}
+
+/**
+ * blk_throtl_bio - apply the limits of the submitter's cgroup to a bio
+ * @q:		the queue the bio is submitted to
+ * @bio:	the bio
+ *
+ * Description:
+ *    Called from __generic_make_request() before the queue's
+ *    make_request_fn.  Returns true if @bio was queued, in which case it
+ *    is submitted again once within its group's limits and the caller
+ *    must leave it alone.
+ */
+bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
+{
+	struct throtl_data *td = q->td;
+	bool rw = bio_data_dir(bio);
+	struct throtl_grp *tg;
+	unsigned long wait;
+
+	/* resubmitted by the dispatch work, it was charged already */
+	if (bio->bi_rw & REQ_THROTTLED) {
+		bio->bi_rw &= ~REQ_THROTTLED;
+		return false;
+	}
+
+	spin_lock_irq(q->queue_lock);
+
+	if (td->limits_changed)
+		throtl_process_limits(td);
+
+	tg = throtl_get_tg(td);
+
+	/* behind bios already waiting, to keep them in order */
+	if (!tg->nr_queued[rw]) {
+		if (tg_may_dispatch(tg, bio, &wait)) {
+			throtl_charge_bio(tg, bio);
+			spin_unlock_irq(q->queue_lock);
+			return false;
+		}
+		throtl_schedule_dispatch(td, wait);
+	}
+
+	bio_list_add(&tg->bio_lists[rw], bio);
+	tg->nr_queued[rw]++;
+	td->nr_queued++;
+	if (list_empty(&tg->active_node))
+		list_add_tail(&tg->active_node, &td->active_list);
+
+	spin_unlock_irq(q->queue_lock);
+	return true;
+}
+
+/*
+ * The cgroup of blkg is going away, called with the rcu read lock held
+ * so td can't be freed under us.
+ */
+static void throtl_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct throtl_data *td = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(td->queue->queue_lock, flags);
+	throtl_destroy_tg(td, tg_of_blkg(blkg));
+	spin_unlock_irqrestore(td->queue->queue_lock, flags);
+
+	/* the bios moved to the root group are dispatched by its limits */
+	if (td->nr_queued)
+		kblockd_schedule_delayed_work(td->queue, &td->dispatch_work, 0);
+}
+
+/*
+ * New limits were written in the cgroup of blkg.  Called with the
+ * cgroup's lock held, which nests inside the queue lock: the limits are
+ * only handed over here, the dispatch work applies them.
+ */
+static void throtl_update_blkio_group_limits(void *key,
+		struct blkio_group *blkg,
+		const struct blkio_throtl_limits *limits)
+{
+	struct throtl_data *td = key;
+	struct throtl_grp *tg = tg_of_blkg(blkg);
+
+	tg->new_limits = *limits;
+	smp_wmb();
+	tg->limits_changed = true;
+	smp_wmb();
+	td->limits_changed = true;
+
+	/* run now, the bios waiting may go sooner */
+	cancel_delayed_work(&td->dispatch_work);
+	kblockd_schedule_delayed_work(td->queue, &td->dispatch_work, 0);
+}
+
+static struct blkio_policy_type blkio_policy_throtl = {
+	.ops = {
+		.blkio_unlink_group_fn = throtl_unlink_blkio_group,
+		.blkio_update_group_limits_fn =
+					throtl_update_blkio_group_limits,
+	},
+	.plid = BLKIO_POLICY_THROTL,
+};
+
+int blk_throtl_init(struct request_queue *q)
+{
+	struct throtl_data *td;
+
+	td = kzalloc_node(sizeof(*td), GFP_KERNEL, q->node);
+	if (!td)
+		return -ENOMEM;
+
+	INIT_HLIST_HEAD(&td->tg_list);
+	INIT_LIST_HEAD(&td->active_list);
+	INIT_DELAYED_WORK(&td->dispatch_work, throtl_dispatch_work);
+	td->queue = q;
+
+	/* the device isn't known yet, see throtl_get_tg() */
+	throtl_init_group(&td->root_tg);
+	blkiocg_add_blkio_group(&blkio_root_cgroup, &td->root_tg.blkg, td, 0);
+
+	q->td = td;
+	return 0;
+}
+
+/*
+ * The queue is going away: the bios still queued are failed, there will
+ * be no driver to take them.
+ */
+void blk_throtl_exit(struct request_queue *q)
+{
+	struct throtl_data *td = q->td;
+	struct throtl_grp *tg;
+	struct hlist_node *pos, *n;
+	struct bio_list bl;
+	struct bio *bio;
+	int rw;
+
+	if (!td)
+		return;
+
+	spin_lock_irq(q->queue_lock);
+	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
+		/*
+		 * If the cgroup removal got to the group first, it calls
+		 * throtl_unlink_blkio_group() for it.
+		 */
+		if (!blkiocg_del_blkio_group(&tg->blkg))
+			throtl_destroy_tg(td, tg);
+	}
+	blkiocg_del_blkio_group(&td->root_tg.blkg);
+	spin_unlock_irq(q->queue_lock);
+
+	/*
+	 * Wait for the cgroup removals which found our groups, nobody can
+	 * reach td after that and schedule the dispatch work.
+	 */
+	synchronize_rcu();
+	cancel_delayed_work_sync(&td->dispatch_work);
+
+	bio_list_init(&bl);
+	spin_lock_irq(q->queue_lock);
+	for (rw = READ; rw <= WRITE; rw++)
+		bio_list_merge(&bl, &td->root_tg.bio_lists[rw]);
+	q->td = NULL;
+	spin_unlock_irq(q->queue_lock);
+
+	while ((bio = bio_list_pop(&bl)))
+		bio_endio(bio, -EIO);
+
+	kfree(td);
+}
+
+static int __init throtl_init(void)
+{
+	blkio_policy_register(&blkio_policy_throtl);
+	return 0;
+}
+
+module_init(throtl_init);
@@ -52,6 +52,14 @@ static const int cfq_hist_divisor = 4;
 #define CFQQ_SECT_THR_NONROT	(sector_t)(2 * 32)
 #define CFQQ_SEEKY(cfqq)	(hweight32(cfqq->seek_history) > 32/8)
 
+/*
+ * Service time learning: the requests measured are small enough for the
+ * positioning to dominate, and we need that many of each kind, sequential
+ * and after a seek, to trust the means.
+ */
+#define CFQ_SVC_MAX_SECTORS	64
+#define CFQ_SVC_MIN_SAMPLES	16
+
 #define RQ_CIC(rq)		\
 	((struct cfq_io_context *) (rq)->elevator_private)
 #define RQ_CFQQ(rq)		(struct cfq_queue *) ((rq)->elevator_private2)
@@ -273,6 +281,19 @@ struct cfq_data {
 	unsigned int cfq_slice_idle;
 	unsigned int cfq_latency;
 	unsigned int cfq_group_isolation;
+	unsigned int cfq_slice_idle_auto;
+
+	/*
+	 * service time of the device, sequential [0] and after a seek [1],
+	 * measured on one request alone in the drive at a time
+	 */
+	struct request *svc_rq;
+	u64 svc_start_ns;
+	int svc_seeky;
+	u64 svc_mean_ns[2];
+	unsigned int svc_samples[2];
+	/* the seek penalty, in jiffies: idling longer than that is a loss */
+	unsigned int svc_idle;
 
 	unsigned int cic_index;
 	struct list_head cic_list;
@@ -1451,10 +1472,81 @@ cfq_find_rq_fmerge(struct cfq_data *cfqd, struct bio *bio)
 	return NULL;
 }
 
+/*
+ * The idle window in force: slice_idle, shortened to the seek penalty we
+ * measured on the device, down to no idling at all where seeking costs
+ * nothing (RAID arrays, SSDs not flagged non-rotational...)
+ */
+static unsigned int cfq_slice_idle_window(struct cfq_data *cfqd)
+{
+	if (!cfqd->cfq_slice_idle_auto ||
+	    cfqd->svc_samples[0] < CFQ_SVC_MIN_SAMPLES ||
+	    cfqd->svc_samples[1] < CFQ_SVC_MIN_SAMPLES)
+		return cfqd->cfq_slice_idle;
+
+	return min(cfqd->cfq_slice_idle, cfqd->svc_idle);
+}
+
+/*
+ * Time a small sync request the driver gets while it has nothing else,
+ * so that what we measure is the device's, not queueing.
+ */
+static void cfq_svc_sample_start(struct cfq_data *cfqd, struct request *rq)
+{
+	sector_t pos = blk_rq_pos(rq), sdist;
+
+	if (!cfqd->cfq_slice_idle_auto || cfqd->svc_rq || cfqd->rq_in_driver ||
+	    !rq_is_sync(rq) || blk_rq_sectors(rq) > CFQ_SVC_MAX_SECTORS ||
+	    !cfqd->last_position)
+		return;
+
+	if (pos > cfqd->last_position)
+		sdist = pos - cfqd->last_position;
+	else
+		sdist = cfqd->last_position - pos;
+
+	cfqd->svc_rq = rq;
+	cfqd->svc_seeky = sdist > CFQQ_SEEK_THR;
+	cfqd->svc_start_ns = ktime_to_ns(ktime_get());
+}
+
+static void cfq_svc_sample_end(struct cfq_data *cfqd)
+{
+	int seeky = cfqd->svc_seeky;
+	u64 *mean = &cfqd->svc_mean_ns[seeky];
+	u64 penalty = 0;
+	unsigned int idle;
+	s64 delta;
+
+	cfqd->svc_rq = NULL;
+	delta = ktime_to_ns(ktime_get()) - cfqd->svc_start_ns;
+	if (delta <= 0)
+		return;
+
+	/* moving average, each sample counts 1/8th */
+	if (!cfqd->svc_samples[seeky])
+		*mean = delta;
+	else
+		*mean = *mean - (*mean >> 3) + (delta >> 3);
+	if (cfqd->svc_samples[seeky] < CFQ_SVC_MIN_SAMPLES)
+		cfqd->svc_samples[seeky]++;
+
+	if (cfqd->svc_mean_ns[1] > cfqd->svc_mean_ns[0])
+		penalty = cfqd->svc_mean_ns[1] - cfqd->svc_mean_ns[0];
+	idle = div_u64(penalty * HZ + NSEC_PER_SEC / 2, NSEC_PER_SEC);
+
+	if (idle != cfqd->svc_idle) {
+		cfqd->svc_idle = idle;
+		cfq_log(cfqd, "seek penalty %llu ns, idle %u",
+			(unsigned long long)penalty, idle);
+	}
+}
+
 static void cfq_activate_request(struct request_queue *q, struct request *rq)
 {
 	struct cfq_data *cfqd = q->elevator->elevator_data;
 
+	cfq_svc_sample_start(cfqd, rq);
 	cfqd->rq_in_driver++;
 	cfq_log_cfqq(cfqd, RQ_CFQQ(rq), "activate rq, drv=%d",
 						cfqd->rq_in_driver);
@@ -1468,6 +1560,8 @@ static void cfq_deactivate_request(struct request_queue *q, struct request *rq)
 
 	WARN_ON(!cfqd->rq_in_driver);
 	cfqd->rq_in_driver--;
+	if (cfqd->svc_rq == rq)
+		cfqd->svc_rq = NULL;
 	cfq_log_cfqq(cfqd, RQ_CFQQ(rq), "deactivate rq, drv=%d",
 						cfqd->rq_in_driver);
 }
@@ -1863,7 +1957,7 @@ static void cfq_arm_slice_timer(struct cfq_data *cfqd)
 {
 	struct cfq_queue *cfqq = cfqd->active_queue;
 	struct cfq_io_context *cic;
-	unsigned long sl;
+	unsigned long sl = cfq_slice_idle_window(cfqd);
 
 	/*
 	 * SSD device without seek penalty, disable idling. But only do so
@@ -1877,9 +1971,10 @@ static void cfq_arm_slice_timer(struct cfq_data *cfqd)
 	WARN_ON(cfq_cfqq_slice_new(cfqq));
 
 	/*
-	 * idle is disabled, either manually or by past process history
+	 * idle is disabled, either manually, by the device's seek penalty or
+	 * by past process history
 	 */
-	if (!cfqd->cfq_slice_idle || !cfq_should_idle(cfqd, cfqq))
+	if (!sl || !cfq_should_idle(cfqd, cfqq))
 		return;
 
 	/*
@@ -1909,8 +2004,6 @@ static void cfq_arm_slice_timer(struct cfq_data *cfqd)
 
 	cfq_mark_cfqq_wait_request(cfqq);
 
-	sl = cfqd->cfq_slice_idle;
-
 	mod_timer(&cfqd->idle_slice_timer, jiffies + sl);
 	cfq_blkiocg_update_set_idle_time_stats(&cfqq->cfqg->blkg);
 	cfq_log_cfqq(cfqd, cfqq, "arm_idle: %lu", sl);
@@ -3108,11 +3201,11 @@ cfq_update_idle_window(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 	if (cfqq->queued[0] + cfqq->queued[1] >= 4)
 		cfq_mark_cfqq_deep(cfqq);
 
-	if (!atomic_read(&cic->ioc->nr_tasks) || !cfqd->cfq_slice_idle ||
+	if (!atomic_read(&cic->ioc->nr_tasks) || !cfq_slice_idle_window(cfqd) ||
 	    (!cfq_cfqq_deep(cfqq) && CFQQ_SEEKY(cfqq)))
 		enable_idle = 0;
 	else if (sample_valid(cic->ttime_samples)) {
-		if (cic->ttime_mean > cfqd->cfq_slice_idle)
+		if (cic->ttime_mean > cfq_slice_idle_window(cfqd))
 			enable_idle = 0;
 		else
 			enable_idle = 1;
@@ -3375,6 +3468,8 @@ static void cfq_completed_request(struct request_queue *q, struct request *rq)
 	WARN_ON(!cfqq->dispatched);
 	cfqd->rq_in_driver--;
 	cfqq->dispatched--;
+	if (cfqd->svc_rq == rq)
+		cfq_svc_sample_end(cfqd);
 	cfq_blkiocg_update_completion_stats(&cfqq->cfqg->blkg,
 			rq_start_time_ns(rq), rq_io_start_time_ns(rq),
 			rq_data_dir(rq), rq_is_sync(rq));
@@ -3852,6 +3947,7 @@ static void *cfq_init_queue(struct request_queue *q)
 	cfqd->cfq_slice_idle = cfq_slice_idle;
 	cfqd->cfq_latency = 1;
 	cfqd->cfq_group_isolation = 0;
+	cfqd->cfq_slice_idle_auto = 1;
 	cfqd->hw_tag = -1;
 	/*
 	 * we optimistically start assuming sync ops weren't delayed in last
@@ -3927,6 +4023,7 @@ SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
 SHOW_FUNCTION(cfq_slice_async_rq_show, cfqd->cfq_slice_async_rq, 0);
 SHOW_FUNCTION(cfq_low_latency_show, cfqd->cfq_latency, 0);
 SHOW_FUNCTION(cfq_group_isolation_show, cfqd->cfq_group_isolation, 0);
+SHOW_FUNCTION(cfq_slice_idle_auto_show, cfqd->cfq_slice_idle_auto, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -3960,8 +4057,23 @@ STORE_FUNCTION(cfq_slice_async_rq_store, &cfqd->cfq_slice_async_rq, 1,
 		UINT_MAX, 0);
 STORE_FUNCTION(cfq_low_latency_store, &cfqd->cfq_latency, 0, 1, 0);
 STORE_FUNCTION(cfq_group_isolation_store, &cfqd->cfq_group_isolation, 0, 1, 0);
+STORE_FUNCTION(cfq_slice_idle_auto_store, &cfqd->cfq_slice_idle_auto, 0, 1, 0);
 #undef STORE_FUNCTION
 
+/*
+ * The idle window in force in msecs, then the mean service times it was
+ * derived from in usecs, sequential and after a seek
+ */
+static ssize_t cfq_idle_window_show(struct elevator_queue *e, char *page)
+{
+	struct cfq_data *cfqd = e->elevator_data;
+
+	return sprintf(page, "%u %llu %llu\n",
+		       jiffies_to_msecs(cfq_slice_idle_window(cfqd)),
+		       div_u64(cfqd->svc_mean_ns[0], NSEC_PER_USEC),
+		       div_u64(cfqd->svc_mean_ns[1], NSEC_PER_USEC));
+}
+
 #define CFQ_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, cfq_##name##_show, cfq_##name##_store)
 
@@ -3977,6 +4089,8 @@ static struct elv_fs_entry cfq_attrs[] = {
 	CFQ_ATTR(slice_idle),
 	CFQ_ATTR(low_latency),
 	CFQ_ATTR(group_isolation),
+	CFQ_ATTR(slice_idle_auto),
+	__ATTR(idle_window, S_IRUGO, cfq_idle_window_show, NULL),
 	__ATTR_NULL
 };
 
@@ -4013,6 +4127,7 @@ static struct blkio_policy_type blkio_policy_cfq = {
 		.blkio_unlink_group_fn =	cfq_unlink_blkio_group,
 		.blkio_update_group_weight_fn =	cfq_update_blkio_group_weight,
 	},
+	.plid = BLKIO_POLICY_PROP,
 };
 #else
 static struct blkio_policy_type blkio_policy_cfq;
@@ -13,50 +13,105 @@
 #include <linux/init.h>
 #include <linux/compiler.h>
 #include <linux/rbtree.h>
+#include <linux/ioprio.h>
+#include <linux/sched.h>
 
 /*
  * See Documentation/block/deadline-iosched.txt
  */
 static const int read_expire = HZ / 2;  /* max time before a read is submitted. */
 static const int write_expire = 5 * HZ; /* ditto for writes, these limits are SOFT! */
+static const int rt_read_expire = HZ / 10;	/* same for the RT class */
+static const int rt_write_expire = HZ;
+static const int idle_read_expire = 5 * HZ;	/* and for the idle class */
+static const int idle_write_expire = 10 * HZ;
 static const int writes_starved = 2;    /* max times reads can starve a write */
 static const int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
+static const int fifo_batch_kb = 0;	/* and their size limit, 0 for none */
 
-struct deadline_data {
-	/*
-	 * run time data
-	 */
+/*
+ * The requests are sorted by the io priority class of their submitter,
+ * each class has its own sort and fifo lists.
+ */
+enum deadline_prio {
+	DD_RT_PRIO,
+	DD_BE_PRIO,
+	DD_IDLE_PRIO,
+	DD_PRIO_COUNT,
+};
 
+struct deadline_per_prio {
 	/*
 	 * requests (deadline_rq s) are present on both sort_list and fifo_list
 	 */
-	struct rb_root sort_list[2];	
+	struct rb_root sort_list[2];
 	struct list_head fifo_list[2];
+};
+
+struct deadline_data {
+	/*
+	 * run time data
+	 */
+	struct deadline_per_prio per_prio[DD_PRIO_COUNT];
 
 	/*
-	 * next in sort order. read, write or both are NULL
+	 * next in sort order, in the class of the batch. read, write or
+	 * both are NULL
 	 */
 	struct request *next_rq[2];
 	unsigned int batching;		/* number of sequential requests made */
+	unsigned long batch_bytes;	/* and their size */
 	sector_t last_sector;		/* head position */
 	unsigned int starved;		/* times reads have starved writes */
 
 	/*
 	 * settings that change how the i/o scheduler behaves
 	 */
-	int fifo_expire[2];
+	int fifo_expire[DD_PRIO_COUNT][2];
 	int fifo_batch;
+	int fifo_batch_kb;
 	int writes_starved;
 	int front_merges;
 };
 
 static void deadline_move_request(struct deadline_data *, struct request *);
 
+/* deadline_add_request() stores the class in the unused elevator_private */
+static inline enum deadline_prio deadline_rq_prio(struct request *rq)
+{
+	return (unsigned long)rq->elevator_private;
+}
+
+/*
+ * The class of an explicitly prioritized bio, or of its submitter
+ */
+static enum deadline_prio deadline_ioprio_class(struct request *rq)
+{
+	struct io_context *ioc = current->io_context;
+	int class;
+
+	if (ioprio_valid(rq->ioprio))
+		class = IOPRIO_PRIO_CLASS(rq->ioprio);
+	else if (ioc && ioprio_valid(ioc->ioprio))
+		class = IOPRIO_PRIO_CLASS(ioc->ioprio);
+	else
+		class = task_nice_ioclass(current);
+
+	switch (class) {
+	case IOPRIO_CLASS_RT:
+		return DD_RT_PRIO;
+	case IOPRIO_CLASS_IDLE:
+		return DD_IDLE_PRIO;
+	default:
+		return DD_BE_PRIO;
+	}
+}
+
 static inline struct rb_root *
 deadline_rb_root(struct deadline_data *dd, struct request *rq)
 {
-	return &dd->sort_list[rq_data_dir(rq)];
+	return &dd->per_prio[deadline_rq_prio(rq)].sort_list[rq_data_dir(rq)];
 }
 
 /*
@@ -102,14 +157,16 @@ deadline_add_request(struct request_queue *q, struct request *rq)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
 	const int data_dir = rq_data_dir(rq);
+	enum deadline_prio prio = deadline_ioprio_class(rq);
 
+	rq->elevator_private = (void *)(unsigned long)prio;
 	deadline_add_rq_rb(dd, rq);
 
 	/*
 	 * set expire time and add to fifo list
 	 */
-	rq_set_fifo_time(rq, jiffies + dd->fifo_expire[data_dir]);
-	list_add_tail(&rq->queuelist, &dd->fifo_list[data_dir]);
+	rq_set_fifo_time(rq, jiffies + dd->fifo_expire[prio][data_dir]);
+	list_add_tail(&rq->queuelist, &dd->per_prio[prio].fifo_list[data_dir]);
 }
 
 /*
@@ -128,7 +185,7 @@ deadline_merge(struct request_queue *q, struct request **req, struct bio *bio)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
 	struct request *__rq;
-	int ret;
+	int ret, prio;
 
 	/*
 	 * check for front merge
@@ -136,8 +193,12 @@ deadline_merge(struct request_queue *q, struct request **req, struct bio *bio)
 	if (dd->front_merges) {
 		sector_t sector = bio->bi_sector + bio_sectors(bio);
 
-		__rq = elv_rb_find(&dd->sort_list[bio_data_dir(bio)], sector);
-		if (__rq) {
+		for (prio = 0; prio < DD_PRIO_COUNT; prio++) {
+			__rq = elv_rb_find(&dd->per_prio[prio].sort_list[bio_data_dir(bio)],
+					   sector);
+			if (!__rq)
+				continue;
+
 			BUG_ON(sector != blk_rq_pos(__rq));
 
 			if (elv_rq_merge_ok(__rq, bio)) {
@@ -173,9 +234,11 @@ deadline_merged_requests(struct request_queue *q, struct request *req,
 {
 	/*
 	 * if next expires before rq, assign its expire time to rq
-	 * and move into next position (next will be deleted) in fifo
+	 * and move into next position (next will be deleted) in fifo,
+	 * staying in the fifo of its own class
 	 */
-	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist) &&
+	    deadline_rq_prio(req) == deadline_rq_prio(next)) {
 		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
 			list_move(&req->queuelist, &next->queuelist);
 			rq_set_fifo_time(req, rq_fifo_time(next));
@@ -223,11 +286,12 @@ deadline_move_request(struct deadline_data *dd, struct request *rq)
 
 /*
  * deadline_check_fifo returns 0 if there are no expired requests on the fifo,
- * 1 otherwise. Requires !list_empty(&dd->fifo_list[data_dir])
+ * 1 otherwise. Requires !list_empty(&per_prio->fifo_list[data_dir])
  */
-static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
+static inline int deadline_check_fifo(struct deadline_per_prio *per_prio,
+				      int ddir)
 {
-	struct request *rq = rq_entry_fifo(dd->fifo_list[ddir].next);
+	struct request *rq = rq_entry_fifo(per_prio->fifo_list[ddir].next);
 
 	/*
 	 * rq is expired!
@@ -238,37 +302,49 @@ static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
 	return 0;
 }
 
+static inline int deadline_prio_busy(struct deadline_data *dd,
+				     enum deadline_prio prio)
+{
+	return !list_empty(&dd->per_prio[prio].fifo_list[READ]) ||
+		!list_empty(&dd->per_prio[prio].fifo_list[WRITE]);
+}
+
 /*
- * deadline_dispatch_requests selects the best request according to
- * read/write expire, fifo_batch, etc
+ * A request of a lower class than a busy one went past its expiry: it
+ * goes first, the classes only starve each other up to the expiries.
  */
-static int deadline_dispatch_requests(struct request_queue *q, int force)
+static struct request *deadline_aged_request(struct deadline_data *dd)
 {
-	struct deadline_data *dd = q->elevator->elevator_data;
-	const int reads = !list_empty(&dd->fifo_list[READ]);
-	const int writes = !list_empty(&dd->fifo_list[WRITE]);
-	struct request *rq;
-	int data_dir;
-
-	/*
-	 * batches are currently reads XOR writes
-	 */
-	if (dd->next_rq[WRITE])
-		rq = dd->next_rq[WRITE];
-	else
-		rq = dd->next_rq[READ];
+	struct deadline_per_prio *per_prio;
+	int prio, data_dir, busy = 0;
+
+	for (prio = 0; prio < DD_PRIO_COUNT; prio++) {
+		per_prio = &dd->per_prio[prio];
+		for (data_dir = READ; busy && data_dir <= WRITE; data_dir++) {
+			if (!list_empty(&per_prio->fifo_list[data_dir]) &&
+			    deadline_check_fifo(per_prio, data_dir))
+				return rq_entry_fifo(per_prio->fifo_list[data_dir].next);
+		}
+		busy |= deadline_prio_busy(dd, prio);
+	}
 
-	if (rq && dd->batching < dd->fifo_batch)
-		/* we have a next request are still entitled to batch */
-		goto dispatch_request;
+	return NULL;
+}
 
-	/*
-	 * at this point we are not running a batch. select the appropriate
-	 * data direction (read / write)
-	 */
+/*
+ * select the appropriate data direction (read / write) within a class,
+ * and the request to start a batch from
+ */
+static struct request *deadline_prio_request(struct deadline_data *dd,
+					     enum deadline_prio prio)
+{
+	struct deadline_per_prio *per_prio = &dd->per_prio[prio];
+	const int reads = !list_empty(&per_prio->fifo_list[READ]);
+	const int writes = !list_empty(&per_prio->fifo_list[WRITE]);
+	int data_dir;
 
 	if (reads) {
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[READ]));
+		BUG_ON(RB_EMPTY_ROOT(&per_prio->sort_list[READ]));
 
 		if (writes && (dd->starved++ >= dd->writes_starved))
 			goto dispatch_writes;
@@ -284,7 +360,7 @@ static int deadline_dispatch_requests(struct request_queue *q, int force)
 
 	if (writes) {
 dispatch_writes:
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[WRITE]));
+		BUG_ON(RB_EMPTY_ROOT(&per_prio->sort_list[WRITE]));
 
 		dd->starved = 0;
 
@@ -293,34 +369,93 @@ dispatch_writes:
 		goto dispatch_find_request;
 	}
 
-	return 0;
+	return NULL;
 
 dispatch_find_request:
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
-	if (deadline_check_fifo(dd, data_dir) || !dd->next_rq[data_dir]) {
+	if (deadline_check_fifo(per_prio, data_dir) || !dd->next_rq[data_dir] ||
+	    deadline_rq_prio(dd->next_rq[data_dir]) != prio) {
 		/*
 		 * A deadline has expired, the last request was in the other
-		 * direction, or we have run out of higher-sectored requests.
-		 * Start again from the request with the earliest expiry time.
+		 * direction or class, or we have run out of higher-sectored
+		 * requests.  Start again from the request with the earliest
+		 * expiry time.
 		 */
-		rq = rq_entry_fifo(dd->fifo_list[data_dir].next);
-	} else {
-		/*
-		 * The last req was the same dir and we have a next request in
-		 * sort order. No expired requests so continue on from here.
-		 */
-		rq = dd->next_rq[data_dir];
+		return rq_entry_fifo(per_prio->fifo_list[data_dir].next);
 	}
 
+	/*
+	 * The last req was the same dir and we have a next request in
+	 * sort order. No expired requests so continue on from here.
+	 */
+	return dd->next_rq[data_dir];
+}
+
+/*
+ * Can the batch go on with rq: within fifo_batch and fifo_batch_kb, and
+ * no request of a higher class is waiting
+ */
+static int deadline_batch_continues(struct deadline_data *dd,
+				    struct request *rq)
+{
+	int prio;
+
+	if (dd->batching >= dd->fifo_batch)
+		return 0;
+	if (dd->fifo_batch_kb &&
+	    dd->batch_bytes >= (unsigned long)dd->fifo_batch_kb << 10)
+		return 0;
+
+	for (prio = 0; prio < deadline_rq_prio(rq); prio++)
+		if (deadline_prio_busy(dd, prio))
+			return 0;
+
+	return 1;
+}
+
+/*
+ * deadline_dispatch_requests selects the best request according to
+ * the classes, read/write expire, fifo_batch, etc
+ */
+static int deadline_dispatch_requests(struct request_queue *q, int force)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct request *rq;
+	int prio;
+
+	/*
+	 * batches are currently reads XOR writes, of one class
+	 */
+	if (dd->next_rq[WRITE])
+		rq = dd->next_rq[WRITE];
+	else
+		rq = dd->next_rq[READ];
+
+	if (rq && deadline_batch_continues(dd, rq))
+		/* we have a next request are still entitled to batch */
+		goto dispatch_request;
+
+	/*
+	 * at this point we are not running a batch. select the class, the
+	 * highest busy one unless a lower one has expired requests
+	 */
+	rq = deadline_aged_request(dd);
+	for (prio = 0; !rq && prio < DD_PRIO_COUNT; prio++)
+		rq = deadline_prio_request(dd, prio);
+	if (!rq)
+		return 0;
+
 	dd->batching = 0;
+	dd->batch_bytes = 0;
 
 dispatch_request:
 	/*
 	 * rq is the selected appropriate request.
 	 */
 	dd->batching++;
+	dd->batch_bytes += blk_rq_bytes(rq);
 	deadline_move_request(dd, rq);
 
 	return 1;
@@ -329,17 +464,24 @@ dispatch_request:
 static int deadline_queue_empty(struct request_queue *q)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
+	int prio;
 
-	return list_empty(&dd->fifo_list[WRITE])
-		&& list_empty(&dd->fifo_list[READ]);
+	for (prio = 0; prio < DD_PRIO_COUNT; prio++)
+		if (deadline_prio_busy(dd, prio))
+			return 0;
+
+	return 1;
 }
 
 static void deadline_exit_queue(struct elevator_queue *e)
 {
 	struct deadline_data *dd = e->elevator_data;
+	int prio;
 
-	BUG_ON(!list_empty(&dd->fifo_list[READ]));
-	BUG_ON(!list_empty(&dd->fifo_list[WRITE]));
+	for (prio = 0; prio < DD_PRIO_COUNT; prio++) {
+		BUG_ON(!list_empty(&dd->per_prio[prio].fifo_list[READ]));
+		BUG_ON(!list_empty(&dd->per_prio[prio].fifo_list[WRITE]));
+	}
 
 	kfree(dd);
 }
@@ -350,20 +492,30 @@ static void deadline_exit_queue(struct elevator_queue *e)
 static void *deadline_init_queue(struct request_queue *q)
 {
 	struct deadline_data *dd;
+	int prio;
 
 	dd = kmalloc_node(sizeof(*dd), GFP_KERNEL | __GFP_ZERO, q->node);
 	if (!dd)
 		return NULL;
 
-	INIT_LIST_HEAD(&dd->fifo_list[READ]);
-	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
-	dd->sort_list[READ] = RB_ROOT;
-	dd->sort_list[WRITE] = RB_ROOT;
-	dd->fifo_expire[READ] = read_expire;
-	dd->fifo_expire[WRITE] = write_expire;
+	for (prio = 0; prio < DD_PRIO_COUNT; prio++) {
+		struct deadline_per_prio *per_prio = &dd->per_prio[prio];
+
+		INIT_LIST_HEAD(&per_prio->fifo_list[READ]);
+		INIT_LIST_HEAD(&per_prio->fifo_list[WRITE]);
+		per_prio->sort_list[READ] = RB_ROOT;
+		per_prio->sort_list[WRITE] = RB_ROOT;
+	}
+	dd->fifo_expire[DD_RT_PRIO][READ] = rt_read_expire;
+	dd->fifo_expire[DD_RT_PRIO][WRITE] = rt_write_expire;
+	dd->fifo_expire[DD_BE_PRIO][READ] = read_expire;
+	dd->fifo_expire[DD_BE_PRIO][WRITE] = write_expire;
+	dd->fifo_expire[DD_IDLE_PRIO][READ] = idle_read_expire;
+	dd->fifo_expire[DD_IDLE_PRIO][WRITE] = idle_write_expire;
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
+	dd->fifo_batch_kb = fifo_batch_kb;
 	return dd;
 }
 
@@ -395,11 +547,16 @@ static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
 		__data = jiffies_to_msecs(__data);			\
 	return deadline_var_show(__data, (page));			\
 }
-SHOW_FUNCTION(deadline_read_expire_show, dd->fifo_expire[READ], 1);
-SHOW_FUNCTION(deadline_write_expire_show, dd->fifo_expire[WRITE], 1);
+SHOW_FUNCTION(deadline_read_expire_show, dd->fifo_expire[DD_BE_PRIO][READ], 1);
+SHOW_FUNCTION(deadline_write_expire_show, dd->fifo_expire[DD_BE_PRIO][WRITE], 1);
+SHOW_FUNCTION(deadline_rt_read_expire_show, dd->fifo_expire[DD_RT_PRIO][READ], 1);
+SHOW_FUNCTION(deadline_rt_write_expire_show, dd->fifo_expire[DD_RT_PRIO][WRITE], 1);
+SHOW_FUNCTION(deadline_idle_read_expire_show, dd->fifo_expire[DD_IDLE_PRIO][READ], 1);
+SHOW_FUNCTION(deadline_idle_write_expire_show, dd->fifo_expire[DD_IDLE_PRIO][WRITE], 1);
 SHOW_FUNCTION(deadline_writes_starved_show, dd->writes_starved, 0);
 SHOW_FUNCTION(deadline_front_merges_show, dd->front_merges, 0);
 SHOW_FUNCTION(deadline_fifo_batch_show, dd->fifo_batch, 0);
+SHOW_FUNCTION(deadline_fifo_batch_kb_show, dd->fifo_batch_kb, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -418,11 +575,16 @@ static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)
 		*(__PTR) = __data;					\
 	return ret;							\
 }
-STORE_FUNCTION(deadline_read_expire_store, &dd->fifo_expire[READ], 0, INT_MAX, 1);
-STORE_FUNCTION(deadline_write_expire_store, &dd->fifo_expire[WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(deadline_read_expire_store, &dd->fifo_expire[DD_BE_PRIO][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(deadline_write_expire_store, &dd->fifo_expire[DD_BE_PRIO][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(deadline_rt_read_expire_store, &dd->fifo_expire[DD_RT_PRIO][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(deadline_rt_write_expire_store, &dd->fifo_expire[DD_RT_PRIO][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(deadline_idle_read_expire_store, &dd->fifo_expire[DD_IDLE_PRIO][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(deadline_idle_write_expire_store, &dd->fifo_expire[DD_IDLE_PRIO][WRITE], 0, INT_MAX, 1);
 STORE_FUNCTION(deadline_writes_starved_store, &dd->writes_starved, INT_MIN, INT_MAX, 0);
 STORE_FUNCTION(deadline_front_merges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifo_batch_store, &dd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(deadline_fifo_batch_kb_store, &dd->fifo_batch_kb, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -432,9 +594,14 @@ STORE_FUNCTION(deadline_fifo_batch_store, &dd->fifo_batch, 0, INT_MAX, 0);
 static struct elv_fs_entry deadline_attrs[] = {
 	DD_ATTR(read_expire),
 	DD_ATTR(write_expire),
+	DD_ATTR(rt_read_expire),
+	DD_ATTR(rt_write_expire),
+	DD_ATTR(idle_read_expire),
+	DD_ATTR(idle_write_expire),
 	DD_ATTR(writes_starved),
 	DD_ATTR(front_merges),
 	DD_ATTR(fifo_batch),
+	DD_ATTR(fifo_batch_kb),
 	__ATTR_NULL
 };
 
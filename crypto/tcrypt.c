@@ -26,6 +26,7 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/slab.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -483,11 +484,9 @@ static void tcrypt_complete(struct crypto_async_request *req, int err)
 	complete(&res->completion);
 }
 
-static inline int do_one_ahash_op(struct ahash_request *req, int ret)
+static inline int do_one_async_op(struct tcrypt_result *tr, int ret)
 {
 	if (ret == -EINPROGRESS || ret == -EBUSY) {
-		struct tcrypt_result *tr = req->base.data;
-
 		ret = wait_for_completion_interruptible(&tr->completion);
 		if (!ret)
 			ret = tr->err;
@@ -496,6 +495,11 @@ static inline int do_one_ahash_op(struct ahash_request *req, int ret)
 	return ret;
 }
 
+static inline int do_one_ahash_op(struct ahash_request *req, int ret)
+{
+	return do_one_async_op(req->base.data, ret);
+}
+
 static int test_ahash_jiffies_digest(struct ahash_request *req, int blen,
 				     char *out, int sec)
 {
@@ -711,6 +715,306 @@ out:
 	crypto_free_ahash(tfm);
 }
 
+static int do_one_acipher_op(void *data, int enc)
+{
+	struct ablkcipher_request *req = data;
+
+	return do_one_async_op(req->base.data,
+			       enc ? crypto_ablkcipher_encrypt(req) :
+				     crypto_ablkcipher_decrypt(req));
+}
+
+static int do_one_aead_op(void *data, int enc)
+{
+	struct aead_request *req = data;
+
+	return do_one_async_op(req->base.data,
+			       enc ? crypto_aead_encrypt(req) :
+				     crypto_aead_decrypt(req));
+}
+
+static int test_async_jiffies(int (*op)(void *, int), void *req, int enc,
+			      int blen, int sec)
+{
+	unsigned long start, end;
+	int bcount;
+	int ret;
+
+	for (start = jiffies, end = start + sec * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount++) {
+		ret = op(req, enc);
+		if (ret)
+			return ret;
+	}
+
+	printk("%d operations in %d seconds (%ld bytes)\n",
+	       bcount, sec, (long)bcount * blen);
+	return 0;
+}
+
+/* Async requests may complete from cryptd, so irqs stay enabled here */
+static int test_async_cycles(int (*op)(void *, int), void *req, int enc,
+			     int blen)
+{
+	unsigned long cycles = 0;
+	int ret = 0;
+	int i;
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		ret = op(req, enc);
+		if (ret)
+			goto out;
+	}
+
+	/* The real thing. */
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+		ret = op(req, enc);
+		end = get_cycles();
+
+		if (ret)
+			goto out;
+
+		cycles += end - start;
+	}
+
+out:
+	if (ret == 0)
+		printk("1 operation in %lu cycles (%d bytes)\n",
+		       (cycles + 4) / 8, blen);
+
+	return ret;
+}
+
+static void test_acipher_speed(const char *algo, int enc, unsigned int sec,
+			       struct cipher_speed_template *template,
+			       unsigned int tcount, u8 *keysize)
+{
+	unsigned int ret, i, j, iv_len;
+	struct tcrypt_result tresult;
+	const char *key;
+	char iv[128];
+	struct ablkcipher_request *req;
+	struct crypto_ablkcipher *tfm;
+	const char *e;
+	u32 *b_size;
+
+	if (enc == ENCRYPT)
+		e = "encryption";
+	else
+		e = "decryption";
+
+	printk("\ntesting speed of async %s %s\n", algo, e);
+
+	tfm = crypto_alloc_ablkcipher(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		printk("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	req = ablkcipher_request_alloc(tfm, GFP_KERNEL);
+	if (!req) {
+		printk("ablkcipher request allocation failure for %s\n",
+		       algo);
+		goto out;
+	}
+
+	init_completion(&tresult.completion);
+	ablkcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+					tcrypt_complete, &tresult);
+
+	i = 0;
+	do {
+
+		b_size = block_sizes;
+		do {
+			struct scatterlist sg[TVMEMSIZE];
+
+			if ((*keysize + *b_size) > TVMEMSIZE * PAGE_SIZE) {
+				printk("template (%u) too big for "
+				       "tvmem (%lu)\n", *keysize + *b_size,
+				       TVMEMSIZE * PAGE_SIZE);
+				goto out_free_req;
+			}
+
+			printk("test %u (%d bit key, %d byte blocks): ", i,
+					*keysize * 8, *b_size);
+
+			memset(tvmem[0], 0xff, PAGE_SIZE);
+
+			/* set key, plain text and IV */
+			key = tvmem[0];
+			for (j = 0; j < tcount; j++) {
+				if (template[j].klen == *keysize) {
+					key = template[j].key;
+					break;
+				}
+			}
+
+			crypto_ablkcipher_clear_flags(tfm, ~0);
+			ret = crypto_ablkcipher_setkey(tfm, key, *keysize);
+			if (ret) {
+				printk("setkey() failed flags=%x\n",
+				       crypto_ablkcipher_get_flags(tfm));
+				goto out_free_req;
+			}
+
+			sg_init_table(sg, TVMEMSIZE);
+			sg_set_buf(sg, tvmem[0] + *keysize,
+				   PAGE_SIZE - *keysize);
+			for (j = 1; j < TVMEMSIZE; j++) {
+				sg_set_buf(sg + j, tvmem[j], PAGE_SIZE);
+				memset(tvmem[j], 0xff, PAGE_SIZE);
+			}
+
+			iv_len = crypto_ablkcipher_ivsize(tfm);
+			if (iv_len)
+				memset(&iv, 0xff, iv_len);
+
+			ablkcipher_request_set_crypt(req, sg, sg, *b_size, iv);
+
+			if (sec)
+				ret = test_async_jiffies(do_one_acipher_op, req,
+							 enc, *b_size, sec);
+			else
+				ret = test_async_cycles(do_one_acipher_op, req,
+							enc, *b_size);
+
+			if (ret) {
+				printk("%s() failed flags=%x\n", e,
+				       crypto_ablkcipher_get_flags(tfm));
+				break;
+			}
+			b_size++;
+			i++;
+		} while (*b_size);
+		keysize++;
+	} while (*keysize);
+
+out_free_req:
+	ablkcipher_request_free(req);
+out:
+	crypto_free_ablkcipher(tfm);
+}
+
+/*
+ * The plain and cipher texts are each kept in one linear buffer, the way
+ * IPsec hands its packets over; decryption goes from the one encrypted
+ * first, so that the tag checks.
+ */
+static void test_aead_speed(const char *algo, int enc, unsigned int sec,
+			    unsigned int authsize, u8 *keysize)
+{
+	unsigned int ret, i;
+	struct tcrypt_result tresult;
+	struct scatterlist asg, ptsg, ctsg;
+	struct aead_request *req;
+	struct crypto_aead *tfm;
+	char key[64], iv[128];
+	u8 *ptext, *ctext;
+	const char *e;
+	u32 *b_size;
+
+	if (enc == ENCRYPT)
+		e = "encryption";
+	else
+		e = "decryption";
+
+	printk("\ntesting speed of %s %s\n", algo, e);
+
+	tfm = crypto_alloc_aead(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		printk("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	ret = crypto_aead_setauthsize(tfm, authsize);
+	if (ret) {
+		printk("setauthsize(%u) failed for %s\n", authsize, algo);
+		goto out;
+	}
+
+	ptext = kmalloc(AEAD_SPEED_ASSOC_SIZE + AEAD_SPEED_MAX_SIZE + authsize,
+			GFP_KERNEL);
+	ctext = kmalloc(AEAD_SPEED_MAX_SIZE + authsize, GFP_KERNEL);
+	req = aead_request_alloc(tfm, GFP_KERNEL);
+	if (!ptext || !ctext || !req) {
+		printk("aead allocation failure for %s\n", algo);
+		goto out_free;
+	}
+
+	init_completion(&tresult.completion);
+	aead_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				  tcrypt_complete, &tresult);
+
+	memset(ptext, 0xff, AEAD_SPEED_ASSOC_SIZE + AEAD_SPEED_MAX_SIZE);
+	sg_init_one(&asg, ptext, AEAD_SPEED_ASSOC_SIZE);
+	memset(key, 0xff, sizeof(key));
+	memset(iv, 0xff, crypto_aead_ivsize(tfm));
+
+	i = 0;
+	do {
+
+		b_size = block_sizes;
+		do {
+			printk("test %u (%d bit key, %d byte blocks): ", i,
+					*keysize * 8, *b_size);
+
+			crypto_aead_clear_flags(tfm, ~0);
+			ret = crypto_aead_setkey(tfm, key, *keysize);
+			if (ret) {
+				printk("setkey() failed flags=%x\n",
+				       crypto_aead_get_flags(tfm));
+				goto out_free;
+			}
+
+			sg_init_one(&ptsg, ptext + AEAD_SPEED_ASSOC_SIZE,
+				    *b_size + authsize);
+			sg_init_one(&ctsg, ctext, *b_size + authsize);
+			aead_request_set_assoc(req, &asg,
+					       AEAD_SPEED_ASSOC_SIZE);
+			aead_request_set_crypt(req, &ptsg, &ctsg, *b_size, iv);
+
+			if (enc == DECRYPT) {
+				ret = do_one_aead_op(req, ENCRYPT);
+				if (ret) {
+					printk("encryption failed: %d\n", ret);
+					break;
+				}
+				aead_request_set_crypt(req, &ctsg, &ptsg,
+						       *b_size + authsize, iv);
+			}
+
+			if (sec)
+				ret = test_async_jiffies(do_one_aead_op, req,
+							 enc, *b_size, sec);
+			else
+				ret = test_async_cycles(do_one_aead_op, req,
+							enc, *b_size);
+
+			if (ret) {
+				printk("%s() failed: %d\n", e, ret);
+				break;
+			}
+			b_size++;
+			i++;
+		} while (*b_size);
+		keysize++;
+	} while (*keysize);
+
+out_free:
+	aead_request_free(req);
+	kfree(ctext);
+	kfree(ptext);
+out:
+	crypto_free_aead(tfm);
+}
+
 static void test_available(void)
 {
 	char **name = check;
@@ -1063,6 +1367,13 @@ static int do_test(int m)
 				  speed_template_16_32);
 		break;
 
+	case 207:
+		test_aead_speed("gcm(aes)", ENCRYPT, sec, 16,
+				speed_template_16_24_32);
+		test_aead_speed("gcm(aes)", DECRYPT, sec, 16,
+				speed_template_16_24_32);
+		break;
+
 	case 300:
 		/* fall through */
 
@@ -1215,6 +1526,29 @@ static int do_test(int m)
 	case 499:
 		break;
 
+	case 500:
+		test_acipher_speed("ecb(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("ecb(aes)", DECRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("cbc(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("cbc(aes)", DECRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("ctr(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("ctr(aes)", DECRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("lrw(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_32_40_48);
+		test_acipher_speed("lrw(aes)", DECRYPT, sec, NULL, 0,
+				   speed_template_32_40_48);
+		test_acipher_speed("xts(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_32_48_64);
+		test_acipher_speed("xts(aes)", DECRYPT, sec, NULL, 0,
+				   speed_template_32_48_64);
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -53,6 +53,12 @@ static u8 speed_template_16_24_32[] = {16, 24, 32, 0};
 static u8 speed_template_32_40_48[] = {32, 40, 48, 0};
 static u8 speed_template_32_48_64[] = {32, 48, 64, 0};
 
+/*
+ * AEAD speed tests
+ */
+#define AEAD_SPEED_ASSOC_SIZE	16
+#define AEAD_SPEED_MAX_SIZE	8192
+
 /*
  * Digest speed tests
  */
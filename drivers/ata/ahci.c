@@ -1029,6 +1029,40 @@ static inline void ahci_gtf_filter_workaround(struct ata_host *host)
 {}
 #endif
 
+/*
+ * Ask for an MSI vector per port, and settle for a single one shared by
+ * them if the platform or the controller can't do that.  Returns the
+ * number of MSI vectors enabled, 0 for the pin interrupt.
+ */
+static int ahci_init_interrupts(struct pci_dev *pdev, unsigned int n_ports,
+				struct ahci_host_priv *hpriv)
+{
+	if (hpriv->flags & AHCI_HFLAG_NO_MSI)
+		goto intx;
+
+	/*
+	 * With fewer vectors than ports the last one is shared by the
+	 * remaining ports, which buys little over a single one.
+	 */
+	if (n_ports > 1 && pci_enable_msi_block(pdev, n_ports) == 0) {
+		/* the controller may still make do with a single message */
+		if (!(readl(hpriv->mmio + HOST_CTL) & HOST_MRSM)) {
+			hpriv->flags |= AHCI_HFLAG_MULTI_MSI;
+			return n_ports;
+		}
+		pci_disable_msi(pdev);
+		dev_printk(KERN_INFO, &pdev->dev,
+			   "MRSM is on, falling back to single MSI\n");
+	}
+
+	if (pci_enable_msi(pdev) == 0)
+		return 1;
+
+ intx:
+	pci_intx(pdev, 1);
+	return 0;
+}
+
 static int ahci_init_one(struct pci_dev *pdev, const struct pci_device_id *ent)
 {
 	static int printed_version;
@@ -1038,7 +1072,7 @@ static int ahci_init_one(struct pci_dev *pdev, const struct pci_device_id *ent)
 	struct device *dev = &pdev->dev;
 	struct ahci_host_priv *hpriv;
 	struct ata_host *host;
-	int n_ports, i, rc;
+	int n_ports, n_msis, i, rc;
 
 	VPRINTK("ENTER\n");
 
@@ -1119,9 +1153,6 @@ static int ahci_init_one(struct pci_dev *pdev, const struct pci_device_id *ent)
 	if (ahci_sb600_enable_64bit(pdev))
 		hpriv->flags &= ~AHCI_HFLAG_32BIT_ONLY;
 
-	if ((hpriv->flags & AHCI_HFLAG_NO_MSI) || pci_enable_msi(pdev))
-		pci_intx(pdev, 1);
-
 	hpriv->mmio = pcim_iomap_table(pdev)[AHCI_PCI_BAR];
 
 	/* save initial config */
@@ -1170,6 +1201,8 @@ static int ahci_init_one(struct pci_dev *pdev, const struct pci_device_id *ent)
 	 */
 	n_ports = max(ahci_nr_ports(hpriv->cap), fls(hpriv->port_map));
 
+	n_msis = ahci_init_interrupts(pdev, n_ports, hpriv);
+
 	host = ata_host_alloc_pinfo(&pdev->dev, ppi, n_ports);
 	if (!host)
 		return -ENOMEM;
@@ -1222,8 +1255,7 @@ static int ahci_init_one(struct pci_dev *pdev, const struct pci_device_id *ent)
 	ahci_pci_print_info(host);
 
 	pci_set_master(pdev);
-	return ata_host_activate(host, pdev->irq, ahci_interrupt, IRQF_SHARED,
-				 &ahci_sht);
+	return ahci_host_activate(host, pdev->irq, n_msis);
 }
 
 static int __init ahci_init(void)
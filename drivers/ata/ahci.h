@@ -89,6 +89,7 @@ enum {
 	/* HOST_CTL bits */
 	HOST_RESET		= (1 << 0),  /* reset controller; self-clear */
 	HOST_IRQ_EN		= (1 << 1),  /* global IRQ enable */
+	HOST_MRSM		= (1 << 2),  /* MSI Revert to Single Message */
 	HOST_AHCI_EN		= (1 << 31), /* AHCI enabled */
 
 	/* HOST_CAP bits */
@@ -209,6 +210,7 @@ enum {
 							link offline */
 	AHCI_HFLAG_NO_SNTF		= (1 << 12), /* no sntf */
 	AHCI_HFLAG_NO_FPDMA_AA		= (1 << 13), /* no FPDMA AA */
+	AHCI_HFLAG_MULTI_MSI		= (1 << 14), /* an MSI vector per port */
 
 	/* ap->flags bits */
 
@@ -279,6 +281,7 @@ struct ahci_port_priv {
 	int			fbs_last_dev;	/* save FBS.DEV of last FIS */
 	/* enclosure management info per PM slot */
 	struct ahci_em_priv	em_priv[EM_MAX_SLOTS];
+	spinlock_t		lock;		/* ap->lock with AHCI_HFLAG_MULTI_MSI */
 };
 
 struct ahci_host_priv {
@@ -319,6 +322,8 @@ void ahci_set_em_messages(struct ahci_host_priv *hpriv,
 			  struct ata_port_info *pi);
 int ahci_reset_em(struct ata_host *host);
 irqreturn_t ahci_interrupt(int irq, void *dev_instance);
+irqreturn_t ahci_port_interrupt(int irq, void *dev_instance);
+int ahci_host_activate(struct ata_host *host, int irq, unsigned int n_msis);
 void ahci_print_info(struct ata_host *host, const char *scc_s);
 
 static inline void __iomem *__ahci_port_base(struct ata_host *host,
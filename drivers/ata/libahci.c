@@ -273,17 +273,17 @@ static ssize_t ahci_read_em_buffer(struct device *dev,
 	size_t count;
 	int i;
 
-	spin_lock_irqsave(ap->lock, flags);
+	spin_lock_irqsave(&ap->host->lock, flags);
 
 	em_ctl = readl(mmio + HOST_EM_CTL);
 	if (!(ap->flags & ATA_FLAG_EM) || em_ctl & EM_CTL_XMT ||
 	    !(hpriv->em_msg_type & EM_MSG_TYPE_SGPIO)) {
-		spin_unlock_irqrestore(ap->lock, flags);
+		spin_unlock_irqrestore(&ap->host->lock, flags);
 		return -EINVAL;
 	}
 
 	if (!(em_ctl & EM_CTL_MR)) {
-		spin_unlock_irqrestore(ap->lock, flags);
+		spin_unlock_irqrestore(&ap->host->lock, flags);
 		return -EAGAIN;
 	}
 
@@ -310,7 +310,7 @@ static ssize_t ahci_read_em_buffer(struct device *dev,
 		buf[i + 3] = (msg >> 24) & 0xff;
 	}
 
-	spin_unlock_irqrestore(ap->lock, flags);
+	spin_unlock_irqrestore(&ap->host->lock, flags);
 
 	return i;
 }
@@ -335,11 +335,11 @@ static ssize_t ahci_store_em_buffer(struct device *dev,
 	    size % 4 || size > hpriv->em_buf_sz)
 		return -EINVAL;
 
-	spin_lock_irqsave(ap->lock, flags);
+	spin_lock_irqsave(&ap->host->lock, flags);
 
 	em_ctl = readl(mmio + HOST_EM_CTL);
 	if (em_ctl & EM_CTL_TM) {
-		spin_unlock_irqrestore(ap->lock, flags);
+		spin_unlock_irqrestore(&ap->host->lock, flags);
 		return -EBUSY;
 	}
 
@@ -351,7 +351,7 @@ static ssize_t ahci_store_em_buffer(struct device *dev,
 
 	writel(em_ctl | EM_CTL_TM, mmio + HOST_EM_CTL);
 
-	spin_unlock_irqrestore(ap->lock, flags);
+	spin_unlock_irqrestore(&ap->host->lock, flags);
 
 	return size;
 }
@@ -1005,7 +1005,7 @@ static ssize_t ahci_transmit_led_message(struct ata_port *ap, u32 state,
 	else
 		return -EINVAL;
 
-	spin_lock_irqsave(ap->lock, flags);
+	spin_lock_irqsave(&ap->host->lock, flags);
 
 	/*
 	 * if we are still busy transmitting a previous message,
@@ -1013,7 +1013,7 @@ static ssize_t ahci_transmit_led_message(struct ata_port *ap, u32 state,
 	 */
 	em_ctl = readl(mmio + HOST_EM_CTL);
 	if (em_ctl & EM_CTL_TM) {
-		spin_unlock_irqrestore(ap->lock, flags);
+		spin_unlock_irqrestore(&ap->host->lock, flags);
 		return -EBUSY;
 	}
 
@@ -1040,7 +1040,7 @@ static ssize_t ahci_transmit_led_message(struct ata_port *ap, u32 state,
 	/* save off new led state for port/slot */
 	emp->led_state = state;
 
-	spin_unlock_irqrestore(ap->lock, flags);
+	spin_unlock_irqrestore(&ap->host->lock, flags);
 	return size;
 }
 
@@ -1645,19 +1645,16 @@ static void ahci_error_intr(struct ata_port *ap, u32 irq_stat)
 		ata_port_abort(ap);
 }
 
-static void ahci_port_intr(struct ata_port *ap)
+static void ahci_handle_port_interrupt(struct ata_port *ap,
+				       void __iomem *port_mmio, u32 status)
 {
-	void __iomem *port_mmio = ahci_port_base(ap);
 	struct ata_eh_info *ehi = &ap->link.eh_info;
 	struct ahci_port_priv *pp = ap->private_data;
 	struct ahci_host_priv *hpriv = ap->host->private_data;
 	int resetting = !!(ap->pflags & ATA_PFLAG_RESETTING);
-	u32 status, qc_active = 0;
+	u32 qc_active = 0;
 	int rc;
 
-	status = readl(port_mmio + PORT_IRQ_STAT);
-	writel(status, port_mmio + PORT_IRQ_STAT);
-
 	/* ignore BAD_PMP while resetting */
 	if (unlikely(resetting))
 		status &= ~PORT_IRQ_BAD_PMP;
@@ -1738,6 +1735,54 @@ static void ahci_port_intr(struct ata_port *ap)
 	}
 }
 
+static void ahci_port_intr(struct ata_port *ap)
+{
+	void __iomem *port_mmio = ahci_port_base(ap);
+	u32 status;
+
+	status = readl(port_mmio + PORT_IRQ_STAT);
+	writel(status, port_mmio + PORT_IRQ_STAT);
+
+	ahci_handle_port_interrupt(ap, port_mmio, status);
+}
+
+/**
+ *	ahci_port_interrupt - interrupt handler of a port with its own vector
+ *	@irq: the port's MSI vector
+ *	@dev_instance: the port
+ *
+ *	With a vector per port, each port's events are handled under the
+ *	port's own lock, so that the ports of the host complete their
+ *	commands in parallel.  All the NCQ tags found done are completed
+ *	at once, by ata_qc_complete_multiple().
+ */
+irqreturn_t ahci_port_interrupt(int irq, void *dev_instance)
+{
+	struct ata_port *ap = dev_instance;
+	struct ahci_host_priv *hpriv = ap->host->private_data;
+	void __iomem *port_mmio = ahci_port_base(ap);
+	u32 status;
+
+	VPRINTK("ENTER\n");
+
+	status = readl(port_mmio + PORT_IRQ_STAT);
+	if (!status)
+		return IRQ_NONE;
+	writel(status, port_mmio + PORT_IRQ_STAT);
+
+	/* our bit of the host latch, once the port events are cleared */
+	writel(1 << ap->port_no, hpriv->mmio + HOST_IRQ_STAT);
+
+	spin_lock(ap->lock);
+	ahci_handle_port_interrupt(ap, port_mmio, status);
+	spin_unlock(ap->lock);
+
+	VPRINTK("EXIT\n");
+
+	return IRQ_HANDLED;
+}
+EXPORT_SYMBOL_GPL(ahci_port_interrupt);
+
 irqreturn_t ahci_interrupt(int irq, void *dev_instance)
 {
 	struct ata_host *host = dev_instance;
@@ -1799,6 +1844,62 @@ irqreturn_t ahci_interrupt(int irq, void *dev_instance)
 }
 EXPORT_SYMBOL_GPL(ahci_interrupt);
 
+/**
+ *	ahci_host_activate - start the host and request its interrupts
+ *	@host: the AHCI host
+ *	@irq: the interrupt, or the first of the per-port MSI vectors
+ *	@n_msis: the number of MSI vectors enabled, at least one per port
+ *	when the host has AHCI_HFLAG_MULTI_MSI
+ *
+ *	With a vector per port, port i interrupts on @irq + i and each is
+ *	handled by ahci_port_interrupt(); otherwise all the ports share
+ *	@irq, handled by ahci_interrupt().
+ *
+ *	LOCKING:
+ *	Inherited from calling layer (may sleep).
+ */
+int ahci_host_activate(struct ata_host *host, int irq, unsigned int n_msis)
+{
+	struct ahci_host_priv *hpriv = host->private_data;
+	int i, rc;
+
+	if (!(hpriv->flags & AHCI_HFLAG_MULTI_MSI))
+		return ata_host_activate(host, irq, ahci_interrupt,
+					 IRQF_SHARED, &ahci_sht);
+
+	/* the ports switch to their own locks as they start */
+	rc = ata_host_start(host);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < host->n_ports; i++) {
+		struct ata_port *ap = host->ports[i];
+
+		/* dummy ports don't interrupt */
+		if (ata_port_is_dummy(ap))
+			continue;
+
+		rc = devm_request_irq(host->dev, irq + i, ahci_port_interrupt,
+				      0, dev_driver_string(host->dev), ap);
+		if (rc)
+			goto out_free_irqs;
+		ata_port_desc(ap, "irq %d", irq + i);
+	}
+
+	rc = ata_host_register(host, &ahci_sht);
+	if (rc)
+		goto out_free_irqs;
+
+	return 0;
+
+ out_free_irqs:
+	for (i--; i >= 0; i--)
+		if (!ata_port_is_dummy(host->ports[i]))
+			devm_free_irq(host->dev, irq + i, host->ports[i]);
+	return rc;
+}
+EXPORT_SYMBOL_GPL(ahci_host_activate);
+
 static unsigned int ahci_qc_issue(struct ata_queued_cmd *qc)
 {
 	struct ata_port *ap = qc->ap;
@@ -2030,6 +2131,15 @@ static int ahci_port_start(struct ata_port *ap)
 	if (!pp)
 		return -ENOMEM;
 
+	/*
+	 * With a vector per port, the ports are each serialized by their
+	 * own lock rather than all by the host one.
+	 */
+	if (hpriv->flags & AHCI_HFLAG_MULTI_MSI) {
+		spin_lock_init(&pp->lock);
+		ap->lock = &pp->lock;
+	}
+
 	/* check FBS capability */
 	if ((hpriv->cap & HOST_CAP_FBS) && sata_pmp_supported(ap)) {
 		void __iomem *port_mmio = ahci_port_base(ap);
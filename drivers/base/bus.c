@@ -512,6 +512,10 @@ void bus_probe_device(struct device *dev)
 	int ret;
 
 	if (bus && bus->p->drivers_autoprobe) {
+		if (bus->async_probe) {
+			device_attach_async(dev);
+			return;
+		}
 		ret = device_attach(dev);
 		WARN_ON(ret < 0);
 	}
@@ -869,6 +873,32 @@ static ssize_t bus_uevent_store(struct bus_type *bus,
 }
 static BUS_ATTR(uevent, S_IWUSR, NULL, bus_uevent_store);
 
+/* "bus_async_probe=scsi,pci" probes the devices of those buses in parallel */
+static char bus_async_probe[128];
+
+static int __init bus_async_probe_setup(char *str)
+{
+	strlcpy(bus_async_probe, str, sizeof(bus_async_probe));
+	return 1;
+}
+__setup("bus_async_probe=", bus_async_probe_setup);
+
+static bool bus_async_probe_listed(const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = bus_async_probe;
+
+	while (*p) {
+		if (!strncmp(p, name, len) && (p[len] == ',' || !p[len]))
+			return true;
+		p = strchr(p, ',');
+		if (!p)
+			break;
+		p++;
+	}
+	return false;
+}
+
 /**
  * bus_register - register a bus with the system.
  * @bus: bus.
@@ -898,6 +928,8 @@ int bus_register(struct bus_type *bus)
 	priv->subsys.kobj.kset = bus_kset;
 	priv->subsys.kobj.ktype = &bus_ktype;
 	priv->drivers_autoprobe = 1;
+	if (bus_async_probe_listed(bus->name))
+		bus->async_probe = true;
 
 	retval = kset_register(&priv->subsys);
 	if (retval)
@@ -24,6 +24,7 @@
 #include <linux/wait.h>
 #include <linux/async.h>
 #include <linux/pm_runtime.h>
+#include <linux/slab.h>
 
 #include "base.h"
 #include "power/power.h"
@@ -105,6 +106,12 @@ EXPORT_SYMBOL_GPL(device_bind_driver);
 static atomic_t probe_count = ATOMIC_INIT(0);
 static DECLARE_WAIT_QUEUE_HEAD(probe_waitqueue);
 
+/*
+ * Probes of devices on buses with ->async_probe set are run from async
+ * threads in this domain, and count in probe_count until they are done.
+ */
+static LIST_HEAD(async_probe_domain);
+
 static int really_probe(struct device *dev, struct device_driver *drv)
 {
 	int ret = 0;
@@ -225,6 +232,36 @@ static int __device_attach(struct device_driver *drv, void *data)
 	return driver_probe_device(drv, dev);
 }
 
+static void probe_async_done(void)
+{
+	atomic_dec(&probe_count);
+	wake_up(&probe_waitqueue);
+}
+
+static void __device_attach_async(void *data, async_cookie_t cookie)
+{
+	struct device *dev = data;
+
+	if (device_attach(dev) < 0)
+		dev_dbg(dev, "went away before its async probe\n");
+	put_device(dev);
+	probe_async_done();
+}
+
+/**
+ * device_attach_async - attach the device to a driver from an async thread
+ * @dev: device.
+ *
+ * For buses that have asked for asynchronous probing, so that slow
+ * probes of devices on them run in parallel.
+ */
+void device_attach_async(struct device *dev)
+{
+	get_device(dev);
+	atomic_inc(&probe_count);
+	async_schedule_domain(__device_attach_async, dev, &async_probe_domain);
+}
+
 /**
  * device_attach - try to attach device to a driver.
  * @dev: device.
@@ -262,6 +299,52 @@ int device_attach(struct device *dev)
 }
 EXPORT_SYMBOL_GPL(device_attach);
 
+static void driver_attach_one(struct device_driver *drv, struct device *dev)
+{
+	if (dev->parent)	/* Needed for USB */
+		device_lock(dev->parent);
+	device_lock(dev);
+	if (!dev->driver)
+		driver_probe_device(drv, dev);
+	device_unlock(dev);
+	if (dev->parent)
+		device_unlock(dev->parent);
+}
+
+struct driver_attach_work {
+	struct device_driver *drv;
+	struct device *dev;
+};
+
+static void __driver_attach_async(void *data, async_cookie_t cookie)
+{
+	struct driver_attach_work *work = data;
+
+	driver_attach_one(work->drv, work->dev);
+	put_device(work->dev);
+	kfree(work);
+	probe_async_done();
+}
+
+/*
+ * The driver can't go away under the async probe: driver_detach() waits
+ * for all of them first.
+ */
+static int driver_attach_async(struct device_driver *drv, struct device *dev)
+{
+	struct driver_attach_work *work;
+
+	work = kmalloc(sizeof(*work), GFP_KERNEL);
+	if (!work)
+		return -ENOMEM;
+
+	work->drv = drv;
+	work->dev = get_device(dev);
+	atomic_inc(&probe_count);
+	async_schedule_domain(__driver_attach_async, work, &async_probe_domain);
+	return 0;
+}
+
 static int __driver_attach(struct device *dev, void *data)
 {
 	struct device_driver *drv = data;
@@ -279,15 +362,10 @@ static int __driver_attach(struct device *dev, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
-	if (dev->parent)	/* Needed for USB */
-		device_lock(dev->parent);
-	device_lock(dev);
-	if (!dev->driver)
-		driver_probe_device(drv, dev);
-	device_unlock(dev);
-	if (dev->parent)
-		device_unlock(dev->parent);
+	if (drv->bus->async_probe && !driver_attach_async(drv, dev))
+		return 0;
 
+	driver_attach_one(drv, dev);
 	return 0;
 }
 
@@ -371,6 +449,9 @@ void driver_detach(struct device_driver *drv)
 	struct device_private *dev_prv;
 	struct device *dev;
 
+	if (drv->bus->async_probe)
+		async_synchronize_full_domain(&async_probe_domain);
+
 	for (;;) {
 		spin_lock(&drv->p->klist_devices.k_lock);
 		if (list_empty(&drv->p->klist_devices.k_list)) {
@@ -74,6 +74,7 @@
 #include <linux/highmem.h>
 #include <linux/kthread.h>
 #include <linux/splice.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
@@ -507,6 +508,207 @@ out:
 	return ret;
 }
 
+/*
+ * Direct I/O: the bios are remapped onto the extents of the backing
+ * file on the block device under it, bypassing both the page cache and
+ * the loop thread.  Like a swap file, the file must not have holes, and
+ * is kept from being truncated while it is in use.
+ */
+struct loop_extent {
+	sector_t start;		/* in the loop device */
+	sector_t disk;		/* on lo_extent_bdev */
+	sector_t len;
+};
+
+/* a bio in flight on the extents, as one clone per extent it covers */
+struct loop_dio {
+	struct loop_device *lo;
+	struct bio *bio;
+	atomic_t remaining;
+	int error;
+};
+
+#define LOOP_DIO_POOL_SIZE	16
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	struct loop_extent *ext = lo->lo_extents;
+	unsigned first = 0, last = lo->lo_nr_extents;
+
+	while (first < last) {
+		unsigned mid = (first + last) / 2;
+
+		if (sector < ext[mid].start)
+			last = mid;
+		else if (sector >= ext[mid].start + ext[mid].len)
+			first = mid + 1;
+		else
+			return &ext[mid];
+	}
+	return NULL;
+}
+
+/* with lo_lock held: whether the bio goes onto the extents */
+static bool loop_dio_get(struct loop_device *lo)
+{
+	if (!(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return false;
+	atomic_inc(&lo->lo_dio_pending);
+	return true;
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->remaining))
+		return;
+
+	bio_endio(dio->bio, dio->error);
+	mempool_free(dio, lo->lo_dio_pool);
+	if (atomic_dec_and_test(&lo->lo_dio_pending))
+		wake_up(&lo->lo_dio_wait);
+}
+
+static void loop_dio_end_io(struct bio *clone, int error)
+{
+	struct loop_dio *dio = clone->bi_private;
+
+	if (!error && !test_bit(BIO_UPTODATE, &clone->bi_flags))
+		error = -EIO;
+	if (error)
+		dio->error = error;
+	bio_put(clone);
+	loop_dio_put(dio);
+}
+
+/*
+ * A clone of the @len sectors of @bio at @sector, trimmed down to the
+ * bvecs, or the parts of them, which hold these.
+ */
+static struct bio *loop_clone_bio(struct loop_device *lo, struct bio *bio,
+				  sector_t sector, sector_t len)
+{
+	struct bio *clone;
+	struct bio_vec *bv;
+	unsigned skip, size;
+
+	clone = bio_alloc_bioset(GFP_NOIO, bio->bi_max_vecs, lo->lo_bio_set);
+	__bio_clone(clone, bio);
+	if (len == bio_sectors(bio))
+		return clone;
+
+	skip = (sector - bio->bi_sector) << 9;
+	bv = clone->bi_io_vec + clone->bi_idx;
+	while (skip >= bv->bv_len) {
+		skip -= bv->bv_len;
+		bv++;
+	}
+	clone->bi_idx = bv - clone->bi_io_vec;
+	bv->bv_offset += skip;
+	bv->bv_len -= skip;
+
+	size = len << 9;
+	while (size > bv->bv_len) {
+		size -= bv->bv_len;
+		bv++;
+	}
+	bv->bv_len = size;
+	clone->bi_vcnt = bv - clone->bi_io_vec + 1;
+
+	clone->bi_sector = sector;
+	clone->bi_size = len << 9;
+	clone->bi_flags &= ~(1 << BIO_SEG_VALID);
+	return clone;
+}
+
+static void loop_dio_submit(struct loop_dio *dio, struct bio *clone,
+			    sector_t sector)
+{
+	clone->bi_sector = sector;
+	clone->bi_bdev = dio->lo->lo_extent_bdev;
+	clone->bi_end_io = loop_dio_end_io;
+	clone->bi_private = dio;
+	atomic_inc(&dio->remaining);
+	generic_make_request(clone);
+}
+
+/* called after loop_dio_get() said so */
+static void loop_remap_bio(struct loop_device *lo, struct bio *bio)
+{
+	sector_t sector = bio->bi_sector, end = sector + bio_sectors(bio);
+	struct loop_dio *dio;
+
+	dio = mempool_alloc(lo->lo_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	/* held until all the clones are submitted */
+	atomic_set(&dio->remaining, 1);
+
+	/* a flush has no data: it is for the disk as a whole */
+	if (sector == end)
+		loop_dio_submit(dio, loop_clone_bio(lo, bio, sector, 0), 0);
+
+	while (sector < end) {
+		struct loop_extent *ext = loop_find_extent(lo, sector);
+		sector_t len;
+
+		if (unlikely(!ext)) {
+			dio->error = -EIO;
+			break;
+		}
+		len = min(end, ext->start + ext->len) - sector;
+		loop_dio_submit(dio, loop_clone_bio(lo, bio, sector, len),
+				ext->disk + (sector - ext->start));
+		sector += len;
+	}
+
+	loop_dio_put(dio);
+}
+
+/*
+ * Keep the bios within an extent, and within what the disk under it
+ * takes, so that they need not be split.
+ */
+static int loop_merge_bvec(struct request_queue *q,
+			   struct bvec_merge_data *bvm,
+			   struct bio_vec *biovec)
+{
+	struct loop_device *lo = q->queuedata;
+	sector_t sector = bvm->bi_sector + get_start_sect(bvm->bi_bdev);
+	struct request_queue *dq;
+	struct loop_extent *ext;
+	int max_size = biovec->bv_len;
+	sector_t left;
+
+	rcu_read_lock();
+	if (!(ACCESS_ONCE(lo->lo_flags) & LO_FLAGS_DIRECT_IO))
+		goto out;
+	/* pairs with the switch to direct I/O, made once the map is set */
+	smp_rmb();
+	ext = loop_find_extent(lo, sector);
+	if (!ext)
+		goto out;
+
+	left = min_t(sector_t, ext->start + ext->len - sector, INT_MAX >> 9);
+	max_size = max_t(int, (left << 9) - bvm->bi_size, 0);
+
+	dq = bdev_get_queue(lo->lo_extent_bdev);
+	if (dq->merge_bvec_fn) {
+		bvm->bi_bdev = lo->lo_extent_bdev;
+		bvm->bi_sector = ext->disk + (sector - ext->start);
+		max_size = min(max_size, dq->merge_bvec_fn(dq, bvm, biovec));
+	}
+out:
+	rcu_read_unlock();
+	/* a bio always takes its first page, splitting it if need be */
+	if (max_size <= biovec->bv_len && !bvm->bi_size)
+		max_size = biovec->bv_len;
+	return max_size;
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -538,6 +740,11 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	if (loop_dio_get(lo)) {
+		spin_unlock_irq(&lo->lo_lock);
+		loop_remap_bio(lo, old_bio);
+		return 0;
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -562,6 +769,7 @@ static void loop_unplug(struct request_queue *q)
 
 struct switch_request {
 	struct file *file;
+	int direct_io;
 	struct completion wait;
 };
 
@@ -569,10 +777,21 @@ static void do_loop_switch(struct loop_device *, struct switch_request *);
 
 static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 {
+	bool direct;
+
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
-	} else {
+		return;
+	}
+
+	/* queued before the switch to direct I/O made it to the thread */
+	spin_lock_irq(&lo->lo_lock);
+	direct = loop_dio_get(lo);
+	spin_unlock_irq(&lo->lo_lock);
+	if (direct)
+		loop_remap_bio(lo, bio);
+	else {
 		int ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, ret);
 	}
@@ -621,7 +840,8 @@ static int loop_thread(void *data)
  * First it needs to flush existing IO, it does this by sending a magic
  * BIO down the pipe. The completion of this BIO does the actual switch.
  */
-static int loop_switch(struct loop_device *lo, struct file *file)
+static int loop_switch(struct loop_device *lo, struct file *file,
+		       int direct_io)
 {
 	struct switch_request w;
 	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
@@ -629,6 +849,7 @@ static int loop_switch(struct loop_device *lo, struct file *file)
 		return -ENOMEM;
 	init_completion(&w.wait);
 	w.file = file;
+	w.direct_io = direct_io;
 	bio->bi_private = &w;
 	bio->bi_bdev = NULL;
 	loop_make_request(lo->lo_queue, bio);
@@ -645,7 +866,7 @@ static int loop_flush(struct loop_device *lo)
 	if (!lo->lo_thread)
 		return 0;
 
-	return loop_switch(lo, NULL);
+	return loop_switch(lo, NULL, 0);
 }
 
 /*
@@ -657,6 +878,20 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	struct file *old_file = lo->lo_backing_file;
 	struct address_space *mapping;
 
+	if (p->direct_io) {
+		/*
+		 * What the thread wrote so far is in the page cache, where
+		 * the bios from now on will not look.
+		 */
+		if (old_file->f_op->fsync)
+			vfs_fsync(old_file, 0);
+		invalidate_inode_pages2(old_file->f_mapping);
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+		spin_unlock_irq(&lo->lo_lock);
+		goto out;
+	}
+
 	/* if no new file, only flush of queued bios requested */
 	if (!file)
 		goto out;
@@ -697,6 +932,11 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* while on the extents of the old file */
+	error = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -715,7 +955,7 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 		goto out_putf;
 
 	/* and ... switch */
-	error = loop_switch(lo, file);
+	error = loop_switch(lo, file, 0);
 	if (error)
 		goto out_putf;
 
@@ -730,6 +970,189 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	return error;
 }
 
+/*
+ * Look the blocks of the backing file up, merging them into extents.
+ * With @extents NULL, only count them.
+ */
+static int loop_walk_extents(struct loop_device *lo, struct inode *inode,
+			     struct loop_extent *extents, unsigned max,
+			     unsigned *nr)
+{
+	unsigned blkbits = inode->i_blkbits;
+	loff_t end = lo->lo_offset + ((loff_t)get_capacity(lo->lo_disk) << 9);
+	sector_t block = lo->lo_offset >> blkbits;
+	struct loop_extent cur = { 0, 0, 0 };
+	unsigned n = 0;
+
+	for (; ((loff_t)block << blkbits) < end; block++) {
+		loff_t pos = max_t(loff_t, (loff_t)block << blkbits,
+				   lo->lo_offset);
+		loff_t next = min_t(loff_t, (loff_t)(block + 1) << blkbits, end);
+		sector_t start = (pos - lo->lo_offset) >> 9;
+		sector_t disk = bmap(inode, block);
+
+		if (!disk)
+			return -EINVAL;		/* a hole */
+		disk = (disk << (blkbits - 9)) +
+			((pos & ((1 << blkbits) - 1)) >> 9);
+
+		if (n && cur.start + cur.len == start &&
+		    cur.disk + cur.len == disk) {
+			cur.len += (next - pos) >> 9;
+			continue;
+		}
+		if (n && extents)
+			extents[n - 1] = cur;
+		/* the file changed under us */
+		if (extents && n == max)
+			return -EBUSY;
+		cur.start = start;
+		cur.disk = disk;
+		cur.len = (next - pos) >> 9;
+		n++;
+		cond_resched();
+	}
+	if (n && extents)
+		extents[n - 1] = cur;
+	*nr = n;
+	return 0;
+}
+
+/* called with i_mutex held */
+static int loop_map_file(struct loop_device *lo, struct inode *inode,
+			 struct loop_extent **extents, unsigned *nr)
+{
+	unsigned count;
+	int err;
+
+	if (IS_SWAPFILE(inode))
+		return -EBUSY;
+	err = loop_walk_extents(lo, inode, NULL, 0, &count);
+	if (err)
+		return err;
+	*extents = vmalloc(max(count, 1U) * sizeof(**extents));
+	if (!*extents)
+		return -ENOMEM;
+	err = loop_walk_extents(lo, inode, *extents, count, nr);
+	if (err) {
+		vfree(*extents);
+		*extents = NULL;
+	}
+	return err;
+}
+
+static void loop_exit_direct_io(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+
+	/* for loop_merge_bvec, and the bios still on the extents */
+	synchronize_rcu();
+	wait_event(lo->lo_dio_wait, !atomic_read(&lo->lo_dio_pending));
+
+	if (S_ISREG(inode->i_mode)) {
+		mutex_lock(&inode->i_mutex);
+		inode->i_flags &= ~S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+	}
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_extent_bdev = NULL;
+	mempool_destroy(lo->lo_dio_pool);
+	lo->lo_dio_pool = NULL;
+	bioset_free(lo->lo_bio_set);
+	lo->lo_bio_set = NULL;
+}
+
+static int loop_set_direct_io(struct loop_device *lo, unsigned long arg)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+	struct loop_extent *extents = NULL;
+	struct block_device *bdev;
+	unsigned nr = 1;
+	int err;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+	if (!arg) {
+		loop_exit_direct_io(lo);
+		return 0;
+	}
+
+	/* the data goes to the disk as it is, in whole sectors */
+	if (lo->transfer != transfer_none || (lo->lo_offset & 511))
+		return -EINVAL;
+
+	if (S_ISBLK(inode->i_mode)) {
+		bdev = inode->i_bdev;
+		extents = vmalloc(sizeof(*extents));
+		if (!extents)
+			return -ENOMEM;
+		extents->start = 0;
+		extents->disk = lo->lo_offset >> 9;
+		extents->len = get_capacity(lo->lo_disk);
+	} else {
+		bdev = inode->i_sb->s_bdev;
+		if (!bdev || !file->f_mapping->a_ops->bmap)
+			return -EINVAL;
+
+		mutex_lock(&inode->i_mutex);
+		err = loop_map_file(lo, inode, &extents, &nr);
+		if (!err)
+			inode->i_flags |= S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+		if (err)
+			return err;
+	}
+
+	err = -ENOMEM;
+	lo->lo_bio_set = bioset_create(LOOP_DIO_POOL_SIZE, 0);
+	if (!lo->lo_bio_set)
+		goto out_free;
+	lo->lo_dio_pool = mempool_create_kmalloc_pool(LOOP_DIO_POOL_SIZE,
+						      sizeof(struct loop_dio));
+	if (!lo->lo_dio_pool)
+		goto out_free;
+
+	lo->lo_extents = extents;
+	lo->lo_nr_extents = nr;
+	lo->lo_extent_bdev = bdev;
+	atomic_set(&lo->lo_dio_pending, 0);
+	blk_queue_stack_limits(lo->lo_queue, bdev_get_queue(bdev));
+
+	/* the loop thread switches over, once done with the bios before */
+	err = loop_switch(lo, NULL, 1);
+	if (err) {
+		lo->lo_extents = NULL;
+		lo->lo_nr_extents = 0;
+		lo->lo_extent_bdev = NULL;
+		goto out_free;
+	}
+	return 0;
+
+out_free:
+	if (lo->lo_dio_pool)
+		mempool_destroy(lo->lo_dio_pool);
+	lo->lo_dio_pool = NULL;
+	if (lo->lo_bio_set)
+		bioset_free(lo->lo_bio_set);
+	lo->lo_bio_set = NULL;
+	if (S_ISREG(inode->i_mode)) {
+		mutex_lock(&inode->i_mutex);
+		inode->i_flags &= ~S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+	}
+	vfree(extents);
+	return err;
+}
+
 static inline int is_loop_device(struct file *file)
 {
 	struct inode *i = file->f_mapping->host;
@@ -828,6 +1251,7 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	 * device
 	 */
 	blk_queue_make_request(lo->lo_queue, loop_make_request);
+	blk_queue_merge_bvec(lo->lo_queue, loop_merge_bvec);
 	lo->lo_queue->queuedata = lo;
 	lo->lo_queue->unplug_fn = loop_unplug;
 
@@ -929,6 +1353,9 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	kthread_stop(lo->lo_thread);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_exit_direct_io(lo);
+
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
 
@@ -985,6 +1412,12 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* the extents are those of the data as it is, where it is */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type ||
+	     lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit))
+		return -EBUSY;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1187,6 +1620,10 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	err = -ENXIO;
 	if (unlikely(lo->lo_state != Lo_bound))
 		goto out;
+	/* the extents only cover the old size */
+	err = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
 	err = figure_loop_size(lo);
 	if (unlikely(err))
 		goto out;
@@ -1241,6 +1678,11 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_direct_io(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1395,6 +1837,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1530,6 +1973,7 @@ static struct loop_device *loop_alloc(int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	init_waitqueue_head(&lo->lo_dio_wait);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -60,18 +60,6 @@ static unsigned int nbds_max = 16;
 static struct nbd_device *nbd_dev;
 static int max_part;
 
-/*
- * Use just one lock (or at most 1 per NIC). Two arguments for this:
- * 1. Each NIC is essentially a synchronization point for all servers
- *    accessed through that NIC so there's no need to have more locks
- *    than NICs anyway.
- * 2. More locks lead to more "Dirty cache line bouncing" which will slow
- *    down each lock to the point where they're actually slower than just
- *    a single lock.
- * Thanks go to Jens Axboe and Al Viro for their LKML emails explaining this!
- */
-static DEFINE_SPINLOCK(nbd_lock);
-
 #ifndef NDEBUG
 static const char *ioctl_cmd_to_ascii(int cmd)
 {
@@ -102,10 +90,37 @@ static const char *nbdcmd_to_ascii(int cmd)
 }
 #endif /* NDEBUG */
 
+/*
+ * One connection to the server.  Each has a thread sending the requests
+ * it takes from the queue, and a thread receiving their replies, in
+ * whatever order the server completes them: the reply carries the tag
+ * of its request.  The replies of the first connection are received by
+ * the NBD_DO_IT caller itself.
+ */
+struct nbd_sock {
+	struct nbd_device *lo;
+	struct socket *sock;
+	struct file *file;
+	unsigned long flags;		/* NBD_SOCK_* */
+	struct mutex tx_lock;		/* serializes the sends */
+	int active_tag;			/* being sent, or -1 */
+	wait_queue_head_t active_wq;
+	struct task_struct *send_thread;
+	struct task_struct *recv_thread;
+};
+
+enum {
+	NBD_SOCK_DEAD,			/* shut down */
+};
+
+/* requests in flight on a device, over all its connections */
+#define NBD_QUEUE_DEPTH	256
+
 static void nbd_end_request(struct request *req)
 {
 	int error = req->errors ? -EIO : 0;
 	struct request_queue *q = req->q;
+	struct nbd_device *lo = q->queuedata;
 	unsigned long flags;
 
 	dprintk(DBG_BLKDEV, "%s: request %p: %s\n", req->rq_disk->disk_name,
@@ -113,27 +128,33 @@ static void nbd_end_request(struct request *req)
 
 	spin_lock_irqsave(q->queue_lock, flags);
 	__blk_end_request_all(req, error);
+	/* its tag is free again, for a sender that ran out of them */
+	if (lo->tag_starved) {
+		lo->tag_starved = 0;
+		wake_up(&lo->waiting_wq);
+	}
 	spin_unlock_irqrestore(q->queue_lock, flags);
 }
 
-static void sock_shutdown(struct nbd_device *lo, int lock)
+static void sock_shutdown(struct nbd_device *lo)
 {
-	/* Forcibly shutdown the socket causing all listeners
-	 * to error
+	int i;
+
+	/* Forcibly shutdown the sockets causing all listeners
+	 * to error: one connection lost takes the device down.
 	 *
 	 * FIXME: This code is duplicated from sys_shutdown, but
 	 * there should be a more generic interface rather than
 	 * calling socket ops directly here */
-	if (lock)
-		mutex_lock(&lo->tx_lock);
-	if (lo->sock) {
-		printk(KERN_WARNING "%s: shutting down socket\n",
-			lo->disk->disk_name);
-		kernel_sock_shutdown(lo->sock, SHUT_RDWR);
-		lo->sock = NULL;
+	for (i = 0; i < lo->num_connections; i++) {
+		struct nbd_sock *nsock = lo->socks[i];
+
+		if (test_and_set_bit(NBD_SOCK_DEAD, &nsock->flags))
+			continue;
+		printk(KERN_WARNING "%s: shutting down socket %d\n",
+			lo->disk->disk_name, i);
+		kernel_sock_shutdown(nsock->sock, SHUT_RDWR);
 	}
-	if (lock)
-		mutex_unlock(&lo->tx_lock);
 }
 
 static void nbd_xmit_timeout(unsigned long arg)
@@ -148,21 +169,15 @@ static void nbd_xmit_timeout(unsigned long arg)
 /*
  *  Send or receive packet.
  */
-static int sock_xmit(struct nbd_device *lo, int send, void *buf, int size,
-		int msg_flags)
+static int sock_xmit(struct nbd_device *lo, struct nbd_sock *nsock, int send,
+		void *buf, int size, int msg_flags)
 {
-	struct socket *sock = lo->sock;
+	struct socket *sock = nsock->sock;
 	int result;
 	struct msghdr msg;
 	struct kvec iov;
 	sigset_t blocked, oldset;
 
-	if (unlikely(!sock)) {
-		printk(KERN_ERR "%s: Attempted %s on closed socket in sock_xmit\n",
-		       lo->disk->disk_name, (send ? "send" : "recv"));
-		return -EINVAL;
-	}
-
 	/* Allow interception of SIGKILL only
 	 * Don't allow other signals to interrupt the transmission */
 	siginitsetinv(&blocked, sigmask(SIGKILL));
@@ -200,7 +215,7 @@ static int sock_xmit(struct nbd_device *lo, int send, void *buf, int size,
 				task_pid_nr(current), current->comm,
 				dequeue_signal_lock(current, &current->blocked, &info));
 			result = -EINTR;
-			sock_shutdown(lo, !send);
+			sock_shutdown(lo);
 			break;
 		}
 
@@ -218,35 +233,39 @@ static int sock_xmit(struct nbd_device *lo, int send, void *buf, int size,
 	return result;
 }
 
-static inline int sock_send_bvec(struct nbd_device *lo, struct bio_vec *bvec,
-		int flags)
+static inline int sock_send_bvec(struct nbd_device *lo, struct nbd_sock *nsock,
+		struct bio_vec *bvec, int flags)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(lo, 1, kaddr + bvec->bv_offset, bvec->bv_len, flags);
+	result = sock_xmit(lo, nsock, 1, kaddr + bvec->bv_offset, bvec->bv_len,
+			flags);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
-/* always call with the tx_lock held */
-static int nbd_send_req(struct nbd_device *lo, struct request *req)
+/* always call with the tx_lock of the connection held */
+static int nbd_send_req(struct nbd_device *lo, struct nbd_sock *nsock,
+		struct request *req)
 {
 	int result, flags;
 	struct nbd_request request;
 	unsigned long size = blk_rq_bytes(req);
+	u32 tag = req->tag;
 
 	request.magic = htonl(NBD_REQUEST_MAGIC);
 	request.type = htonl(nbd_cmd(req));
 	request.from = cpu_to_be64((u64)blk_rq_pos(req) << 9);
 	request.len = htonl(size);
-	memcpy(request.handle, &req, sizeof(req));
+	memset(request.handle, 0, sizeof(request.handle));
+	memcpy(request.handle, &tag, sizeof(tag));
 
 	dprintk(DBG_TX, "%s: request %p: sending control (%s@%llu,%uB)\n",
 			lo->disk->disk_name, req,
 			nbdcmd_to_ascii(nbd_cmd(req)),
 			(unsigned long long)blk_rq_pos(req) << 9,
 			blk_rq_bytes(req));
-	result = sock_xmit(lo, 1, &request, sizeof(request),
+	result = sock_xmit(lo, nsock, 1, &request, sizeof(request),
 			(nbd_cmd(req) == NBD_CMD_WRITE) ? MSG_MORE : 0);
 	if (result <= 0) {
 		printk(KERN_ERR "%s: Send control failed (result %d)\n",
@@ -267,7 +286,7 @@ static int nbd_send_req(struct nbd_device *lo, struct request *req)
 				flags = MSG_MORE;
 			dprintk(DBG_TX, "%s: request %p: sending %d bytes data\n",
 					lo->disk->disk_name, req, bvec->bv_len);
-			result = sock_send_bvec(lo, bvec, flags);
+			result = sock_send_bvec(lo, nsock, bvec, flags);
 			if (result <= 0) {
 				printk(KERN_ERR "%s: Send data failed (result %d)\n",
 						lo->disk->disk_name, result);
@@ -281,51 +300,59 @@ error_out:
 	return -EIO;
 }
 
+/*
+ * The request a reply is for, taken off the connection so that its
+ * sender no longer fails it behind our back.
+ */
 static struct request *nbd_find_request(struct nbd_device *lo,
-					struct request *xreq)
+					struct nbd_sock *nsock, int tag)
 {
-	struct request *req, *tmp;
+	struct request_queue *q = lo->disk->queue;
+	struct request *req = NULL;
 	int err;
 
-	err = wait_event_interruptible(lo->active_wq, lo->active_req != xreq);
+	/* the reply may have raced ahead of the end of the send */
+	err = wait_event_interruptible(nsock->active_wq,
+				       nsock->active_tag != tag);
 	if (unlikely(err))
-		goto out;
+		return ERR_PTR(err);
 
-	spin_lock(&lo->queue_lock);
-	list_for_each_entry_safe(req, tmp, &lo->queue_head, queuelist) {
-		if (req != xreq)
-			continue;
-		list_del_init(&req->queuelist);
-		spin_unlock(&lo->queue_lock);
-		return req;
-	}
-	spin_unlock(&lo->queue_lock);
+	if (tag < 0)
+		return ERR_PTR(-ENOENT);
 
-	err = -ENOENT;
+	spin_lock_irq(q->queue_lock);
+	req = blk_queue_find_tag(q, tag);
+	if (req && req->special == nsock)
+		req->special = NULL;
+	else
+		req = NULL;
+	spin_unlock_irq(q->queue_lock);
 
-out:
-	return ERR_PTR(err);
+	return req ? req : ERR_PTR(-ENOENT);
 }
 
-static inline int sock_recv_bvec(struct nbd_device *lo, struct bio_vec *bvec)
+static inline int sock_recv_bvec(struct nbd_device *lo, struct nbd_sock *nsock,
+		struct bio_vec *bvec)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(lo, 0, kaddr + bvec->bv_offset, bvec->bv_len,
+	result = sock_xmit(lo, nsock, 0, kaddr + bvec->bv_offset, bvec->bv_len,
 			MSG_WAITALL);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
 /* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *lo)
+static struct request *nbd_read_stat(struct nbd_device *lo,
+				     struct nbd_sock *nsock)
 {
 	int result;
 	struct nbd_reply reply;
 	struct request *req;
+	u32 tag;
 
 	reply.magic = 0;
-	result = sock_xmit(lo, 0, &reply, sizeof(reply), MSG_WAITALL);
+	result = sock_xmit(lo, nsock, 0, &reply, sizeof(reply), MSG_WAITALL);
 	if (result <= 0) {
 		printk(KERN_ERR "%s: Receive control failed (result %d)\n",
 				lo->disk->disk_name, result);
@@ -340,14 +367,15 @@ static struct request *nbd_read_stat(struct nbd_device *lo)
 		goto harderror;
 	}
 
-	req = nbd_find_request(lo, *(struct request **)reply.handle);
+	memcpy(&tag, reply.handle, sizeof(tag));
+	req = nbd_find_request(lo, nsock, tag);
 	if (IS_ERR(req)) {
 		result = PTR_ERR(req);
 		if (result != -ENOENT)
 			goto harderror;
 
-		printk(KERN_ERR "%s: Unexpected reply (%p)\n",
-				lo->disk->disk_name, reply.handle);
+		printk(KERN_ERR "%s: Unexpected reply (tag %u)\n",
+				lo->disk->disk_name, tag);
 		result = -EBADR;
 		goto harderror;
 	}
@@ -366,7 +394,7 @@ static struct request *nbd_read_stat(struct nbd_device *lo)
 		struct bio_vec *bvec;
 
 		rq_for_each_segment(bvec, req, iter) {
-			result = sock_recv_bvec(lo, bvec);
+			result = sock_recv_bvec(lo, nsock, bvec);
 			if (result <= 0) {
 				printk(KERN_ERR "%s: Receive data failed (result %d)\n",
 						lo->disk->disk_name, result);
@@ -383,72 +411,52 @@ harderror:
 	return NULL;
 }
 
-static ssize_t pid_show(struct device *dev,
-			struct device_attribute *attr, char *buf)
+static void nbd_recv_replies(struct nbd_device *lo, struct nbd_sock *nsock)
 {
-	struct gendisk *disk = dev_to_disk(dev);
+	struct request *req;
 
-	return sprintf(buf, "%ld\n",
-		(long) ((struct nbd_device *)disk->private_data)->pid);
-}
+	while ((req = nbd_read_stat(lo, nsock)) != NULL)
+		nbd_end_request(req);
 
-static struct device_attribute pid_attr = {
-	.attr = { .name = "pid", .mode = S_IRUGO},
-	.show = pid_show,
-};
+	/* the requests in flight on the others go down with this one */
+	sock_shutdown(lo);
+}
 
-static int nbd_do_it(struct nbd_device *lo)
+static int nbd_recv_thread(void *data)
 {
-	struct request *req;
-	int ret;
+	struct nbd_sock *nsock = data;
 
-	BUG_ON(lo->magic != LO_MAGIC);
+	set_user_nice(current, -20);
+	nbd_recv_replies(nsock->lo, nsock);
 
-	lo->pid = current->pid;
-	ret = sysfs_create_file(&disk_to_dev(lo->disk)->kobj, &pid_attr.attr);
-	if (ret) {
-		printk(KERN_ERR "nbd: sysfs_create_file failed!");
-		lo->pid = 0;
-		return ret;
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
 	}
-
-	while ((req = nbd_read_stat(lo)) != NULL)
-		nbd_end_request(req);
-
-	sysfs_remove_file(&disk_to_dev(lo->disk)->kobj, &pid_attr.attr);
-	lo->pid = 0;
+	__set_current_state(TASK_RUNNING);
 	return 0;
 }
 
-static void nbd_clear_que(struct nbd_device *lo)
+static ssize_t pid_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
 {
-	struct request *req;
-
-	BUG_ON(lo->magic != LO_MAGIC);
-
-	/*
-	 * Because we have set lo->sock to NULL under the tx_lock, all
-	 * modifications to the list must have completed by now.  For
-	 * the same reason, the active_req must be NULL.
-	 *
-	 * As a consequence, we don't need to take the spin lock while
-	 * purging the list here.
-	 */
-	BUG_ON(lo->sock);
-	BUG_ON(lo->active_req);
+	struct gendisk *disk = dev_to_disk(dev);
 
-	while (!list_empty(&lo->queue_head)) {
-		req = list_entry(lo->queue_head.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		req->errors++;
-		nbd_end_request(req);
-	}
+	return sprintf(buf, "%ld\n",
+		(long) ((struct nbd_device *)disk->private_data)->pid);
 }
 
+static struct device_attribute pid_attr = {
+	.attr = { .name = "pid", .mode = S_IRUGO},
+	.show = pid_show,
+};
 
-static void nbd_handle_req(struct nbd_device *lo, struct request *req)
+static void nbd_handle_req(struct nbd_device *lo, struct nbd_sock *nsock,
+			   struct request *req)
 {
+	struct request_queue *q = lo->disk->queue;
+
 	if (req->cmd_type != REQ_TYPE_FS)
 		goto error_out;
 
@@ -464,30 +472,36 @@ static void nbd_handle_req(struct nbd_device *lo, struct request *req)
 
 	req->errors = 0;
 
-	mutex_lock(&lo->tx_lock);
-	if (unlikely(!lo->sock)) {
-		mutex_unlock(&lo->tx_lock);
+	mutex_lock(&nsock->tx_lock);
+	if (unlikely(test_bit(NBD_SOCK_DEAD, &nsock->flags))) {
+		mutex_unlock(&nsock->tx_lock);
 		printk(KERN_ERR "%s: Attempted send on closed socket\n",
 		       lo->disk->disk_name);
 		goto error_out;
 	}
 
-	lo->active_req = req;
+	/*
+	 * The receiver leaves the request alone until active_tag moves
+	 * on, so that it is ours to fail if the send does not make it.
+	 */
+	nsock->active_tag = req->tag;
+	spin_lock_irq(q->queue_lock);
+	req->special = nsock;
+	spin_unlock_irq(q->queue_lock);
 
-	if (nbd_send_req(lo, req) != 0) {
+	if (nbd_send_req(lo, nsock, req) != 0) {
 		printk(KERN_ERR "%s: Request send failed\n",
 				lo->disk->disk_name);
+		spin_lock_irq(q->queue_lock);
+		req->special = NULL;
+		spin_unlock_irq(q->queue_lock);
 		req->errors++;
 		nbd_end_request(req);
-	} else {
-		spin_lock(&lo->queue_lock);
-		list_add(&req->queuelist, &lo->queue_head);
-		spin_unlock(&lo->queue_lock);
 	}
 
-	lo->active_req = NULL;
-	mutex_unlock(&lo->tx_lock);
-	wake_up_all(&lo->active_wq);
+	nsock->active_tag = -1;
+	mutex_unlock(&nsock->tx_lock);
+	wake_up_all(&nsock->active_wq);
 
 	return;
 
@@ -496,32 +510,168 @@ error_out:
 	nbd_end_request(req);
 }
 
-static int nbd_thread(void *data)
+/*
+ * The next request to send, tagged: whichever sender is free takes it,
+ * which spreads the requests over the connections.
+ */
+static struct request *nbd_next_request(struct nbd_device *lo)
 {
-	struct nbd_device *lo = data;
+	struct request_queue *q = lo->disk->queue;
+	struct request *req;
+
+	spin_lock_irq(q->queue_lock);
+	req = blk_peek_request(q);
+	if (req && blk_queue_start_tag(q, req)) {
+		lo->tag_starved = 1;
+		req = NULL;
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	if (req)
+		dprintk(DBG_BLKDEV, "%s: request %p: dequeued (flags=%x)\n",
+				req->rq_disk->disk_name, req, req->cmd_type);
+	return req;
+}
+
+static int nbd_send_thread(void *data)
+{
+	struct nbd_sock *nsock = data;
+	struct nbd_device *lo = nsock->lo;
 	struct request *req;
 
 	set_user_nice(current, -20);
-	while (!kthread_should_stop() || !list_empty(&lo->waiting_queue)) {
+	while (!kthread_should_stop()) {
 		/* wait for something to do */
+		req = NULL;
 		wait_event_interruptible(lo->waiting_wq,
 					 kthread_should_stop() ||
-					 !list_empty(&lo->waiting_queue));
+					 (req = nbd_next_request(lo)) != NULL);
 
-		/* extract request */
-		if (list_empty(&lo->waiting_queue))
-			continue;
+		/* handle request */
+		if (req)
+			nbd_handle_req(lo, nsock, req);
+	}
+	return 0;
+}
 
-		spin_lock_irq(&lo->queue_lock);
-		req = list_entry(lo->waiting_queue.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		spin_unlock_irq(&lo->queue_lock);
+static void nbd_stop_threads(struct nbd_device *lo)
+{
+	int i;
 
-		/* handle request */
-		nbd_handle_req(lo, req);
+	for (i = 0; i < lo->num_connections; i++) {
+		struct nbd_sock *nsock = lo->socks[i];
+
+		if (nsock->send_thread)
+			kthread_stop(nsock->send_thread);
+		if (nsock->recv_thread)
+			kthread_stop(nsock->recv_thread);
+		nsock->send_thread = nsock->recv_thread = NULL;
+	}
+}
+
+static int nbd_start_threads(struct nbd_device *lo)
+{
+	struct task_struct *thread;
+	int i;
+
+	for (i = 0; i < lo->num_connections; i++) {
+		struct nbd_sock *nsock = lo->socks[i];
+
+		thread = kthread_create(nbd_send_thread, nsock, "%s-send%d",
+					lo->disk->disk_name, i);
+		if (IS_ERR(thread))
+			goto out;
+		nsock->send_thread = thread;
+		wake_up_process(thread);
+
+		/* the first connection is received by NBD_DO_IT itself */
+		if (!i)
+			continue;
+
+		thread = kthread_create(nbd_recv_thread, nsock, "%s-recv%d",
+					lo->disk->disk_name, i);
+		if (IS_ERR(thread))
+			goto out;
+		nsock->recv_thread = thread;
+		wake_up_process(thread);
 	}
 	return 0;
+
+out:
+	nbd_stop_threads(lo);
+	return PTR_ERR(thread);
+}
+
+static int nbd_do_it(struct nbd_device *lo)
+{
+	int ret;
+
+	BUG_ON(lo->magic != LO_MAGIC);
+
+	ret = sysfs_create_file(&disk_to_dev(lo->disk)->kobj, &pid_attr.attr);
+	if (ret) {
+		printk(KERN_ERR "nbd: sysfs_create_file failed!");
+		goto out;
+	}
+
+	ret = nbd_start_threads(lo);
+	if (ret)
+		goto out_remove;
+
+	nbd_recv_replies(lo, lo->socks[0]);
+	nbd_stop_threads(lo);
+
+out_remove:
+	sysfs_remove_file(&disk_to_dev(lo->disk)->kobj, &pid_attr.attr);
+out:
+	lo->pid = 0;
+	return ret;
+}
+
+static void nbd_free_socks(struct nbd_device *lo)
+{
+	struct request_queue *q = lo->disk->queue;
+	int i, n;
+
+	spin_lock_irq(q->queue_lock);
+	n = lo->num_connections;
+	lo->num_connections = 0;
+	spin_unlock_irq(q->queue_lock);
+
+	for (i = 0; i < n; i++) {
+		fput(lo->socks[i]->file);
+		kfree(lo->socks[i]);
+		lo->socks[i] = NULL;
+	}
+}
+
+static void nbd_clear_que(struct nbd_device *lo)
+{
+	struct request_queue *q = lo->disk->queue;
+	struct request *req;
+	int tag;
+
+	BUG_ON(lo->magic != LO_MAGIC);
+
+	/*
+	 * The connections are gone and their threads stopped, so that
+	 * the requests still tagged will never get a reply, and no new
+	 * ones can be taken from the queue.
+	 */
+	BUG_ON(lo->num_connections);
+
+	spin_lock_irq(q->queue_lock);
+	for (tag = 0; tag < NBD_QUEUE_DEPTH; tag++) {
+		req = blk_queue_find_tag(q, tag);
+		if (!req)
+			continue;
+		req->special = NULL;
+		req->errors++;
+		__blk_end_request_all(req, -EIO);
+	}
+	/* and do_nbd_request fails the ones never sent */
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
 }
 
 /*
@@ -533,36 +683,22 @@ static int nbd_thread(void *data)
 
 static void do_nbd_request(struct request_queue *q)
 {
+	struct nbd_device *lo = q->queuedata;
 	struct request *req;
-	
-	while ((req = blk_fetch_request(q)) != NULL) {
-		struct nbd_device *lo;
-
-		spin_unlock_irq(q->queue_lock);
-
-		dprintk(DBG_BLKDEV, "%s: request %p: dequeued (flags=%x)\n",
-				req->rq_disk->disk_name, req, req->cmd_type);
-
-		lo = req->rq_disk->private_data;
-
-		BUG_ON(lo->magic != LO_MAGIC);
-
-		if (unlikely(!lo->sock)) {
-			printk(KERN_ERR "%s: Attempted send on closed socket\n",
-				lo->disk->disk_name);
-			req->errors++;
-			nbd_end_request(req);
-			spin_lock_irq(q->queue_lock);
-			continue;
-		}
 
-		spin_lock_irq(&lo->queue_lock);
-		list_add_tail(&req->queuelist, &lo->waiting_queue);
-		spin_unlock_irq(&lo->queue_lock);
+	BUG_ON(lo->magic != LO_MAGIC);
 
+	/* the senders take the requests, once NBD_DO_IT starts them */
+	if (lo->num_connections) {
 		wake_up(&lo->waiting_wq);
+		return;
+	}
 
-		spin_lock_irq(q->queue_lock);
+	while ((req = blk_fetch_request(q)) != NULL) {
+		printk(KERN_ERR "%s: Attempted send on closed socket\n",
+			lo->disk->disk_name);
+		req->errors++;
+		__blk_end_request_all(req, -EIO);
 	}
 }
 
@@ -574,49 +710,71 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 	switch (cmd) {
 	case NBD_DISCONNECT: {
 		struct request sreq;
+		int i;
 
 	        printk(KERN_INFO "%s: NBD_DISCONNECT\n", lo->disk->disk_name);
 
 		blk_rq_init(NULL, &sreq);
 		sreq.cmd_type = REQ_TYPE_SPECIAL;
 		nbd_cmd(&sreq) = NBD_CMD_DISC;
-		if (!lo->sock)
+		if (!lo->num_connections)
 			return -EINVAL;
-		nbd_send_req(lo, &sreq);
+		for (i = 0; i < lo->num_connections; i++) {
+			struct nbd_sock *nsock = lo->socks[i];
+
+			mutex_lock(&nsock->tx_lock);
+			if (!test_bit(NBD_SOCK_DEAD, &nsock->flags))
+				nbd_send_req(lo, nsock, &sreq);
+			mutex_unlock(&nsock->tx_lock);
+		}
                 return 0;
 	}
  
-	case NBD_CLEAR_SOCK: {
-		struct file *file;
-
-		lo->sock = NULL;
-		file = lo->file;
-		lo->file = NULL;
+	case NBD_CLEAR_SOCK:
+		if (lo->pid) {
+			/* NBD_DO_IT cleans up, once its connections fail */
+			sock_shutdown(lo);
+			return 0;
+		}
+		nbd_free_socks(lo);
 		nbd_clear_que(lo);
-		BUG_ON(!list_empty(&lo->queue_head));
-		if (file)
-			fput(file);
 		return 0;
-	}
 
 	case NBD_SET_SOCK: {
+		struct request_queue *q = lo->disk->queue;
+		struct nbd_sock *nsock;
+		struct inode *inode;
 		struct file *file;
-		if (lo->file)
+
+		/* connections are added before NBD_DO_IT, never during */
+		if (lo->pid || lo->num_connections == NBD_MAX_CONNECTIONS)
 			return -EBUSY;
 		file = fget(arg);
-		if (file) {
-			struct inode *inode = file->f_path.dentry->d_inode;
-			if (S_ISSOCK(inode->i_mode)) {
-				lo->file = file;
-				lo->sock = SOCKET_I(inode);
-				if (max_part > 0)
-					bdev->bd_invalidated = 1;
-				return 0;
-			} else {
-				fput(file);
-			}
+		if (!file)
+			return -EINVAL;
+		inode = file->f_path.dentry->d_inode;
+		if (!S_ISSOCK(inode->i_mode)) {
+			fput(file);
+			return -EINVAL;
 		}
-		return -EINVAL;
+		nsock = kzalloc(sizeof(*nsock), GFP_KERNEL);
+		if (!nsock) {
+			fput(file);
+			return -ENOMEM;
+		}
+		nsock->lo = lo;
+		nsock->file = file;
+		nsock->sock = SOCKET_I(inode);
+		mutex_init(&nsock->tx_lock);
+		nsock->active_tag = -1;
+		init_waitqueue_head(&nsock->active_wq);
+
+		spin_lock_irq(q->queue_lock);
+		lo->socks[lo->num_connections++] = nsock;
+		spin_unlock_irq(q->queue_lock);
+		if (max_part > 0)
+			bdev->bd_invalidated = 1;
+		return 0;
 	}
 
 	case NBD_SET_BLKSIZE:
@@ -646,36 +804,22 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 		return 0;
 
 	case NBD_DO_IT: {
-		struct task_struct *thread;
-		struct file *file;
 		int error;
 
 		if (lo->pid)
 			return -EBUSY;
-		if (!lo->file)
+		if (!lo->num_connections)
 			return -EINVAL;
 
+		lo->pid = current->pid;
 		mutex_unlock(&lo->tx_lock);
-
-		thread = kthread_create(nbd_thread, lo, lo->disk->disk_name);
-		if (IS_ERR(thread)) {
-			mutex_lock(&lo->tx_lock);
-			return PTR_ERR(thread);
-		}
-		wake_up_process(thread);
 		error = nbd_do_it(lo);
-		kthread_stop(thread);
-
 		mutex_lock(&lo->tx_lock);
 		if (error)
 			return error;
-		sock_shutdown(lo, 0);
-		file = lo->file;
-		lo->file = NULL;
+		nbd_free_socks(lo);
 		nbd_clear_que(lo);
 		printk(KERN_WARNING "%s: queue cleared\n", lo->disk->disk_name);
-		if (file)
-			fput(file);
 		lo->bytesize = 0;
 		bdev->bd_inode->i_size = 0;
 		set_capacity(lo->disk, 0);
@@ -689,14 +833,13 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *lo,
 		 * This is for compatibility only.  The queue is always cleared
 		 * by NBD_DO_IT or NBD_CLEAR_SOCK.
 		 */
-		BUG_ON(!lo->sock && !list_empty(&lo->queue_head));
 		return 0;
 
 	case NBD_PRINT_DEBUG:
-		printk(KERN_INFO "%s: next = %p, prev = %p, head = %p\n",
-			bdev->bd_disk->disk_name,
-			lo->queue_head.next, lo->queue_head.prev,
-			&lo->queue_head);
+		printk(KERN_INFO "%s: %d connections, %d requests in flight\n",
+			bdev->bd_disk->disk_name, lo->num_connections,
+			lo->disk->queue->in_flight[0] +
+			lo->disk->queue->in_flight[1]);
 		return 0;
 	}
 	return -ENOTTY;
@@ -768,11 +911,18 @@ static int __init nbd_init(void)
 		 * every gendisk to have its very own request_queue struct.
 		 * These structs are big so we dynamically allocate them.
 		 */
-		disk->queue = blk_init_queue(do_nbd_request, &nbd_lock);
+		disk->queue = blk_init_queue(do_nbd_request, NULL);
 		if (!disk->queue) {
 			put_disk(disk);
 			goto out;
 		}
+		disk->queue->queuedata = &nbd_dev[i];
+		/* the tag of a request is its handle on the wire */
+		if (blk_queue_init_tags(disk->queue, NBD_QUEUE_DEPTH, NULL)) {
+			blk_cleanup_queue(disk->queue);
+			put_disk(disk);
+			goto out;
+		}
 		/*
 		 * Tell the block layer that we are not a rotational device
 		 */
@@ -789,14 +939,10 @@ static int __init nbd_init(void)
 
 	for (i = 0; i < nbds_max; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
-		nbd_dev[i].file = NULL;
+		nbd_dev[i].num_connections = 0;
 		nbd_dev[i].magic = LO_MAGIC;
 		nbd_dev[i].flags = 0;
-		INIT_LIST_HEAD(&nbd_dev[i].waiting_queue);
-		spin_lock_init(&nbd_dev[i].queue_lock);
-		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
 		mutex_init(&nbd_dev[i].tx_lock);
-		init_waitqueue_head(&nbd_dev[i].active_wq);
 		init_waitqueue_head(&nbd_dev[i].waiting_wq);
 		nbd_dev[i].blksize = 1024;
 		nbd_dev[i].bytesize = 0;
@@ -0,0 +1,1547 @@
+/*
+ * NVM Express device driver
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * The controller has an admin queue pair and up to 64k I/O queue pairs,
+ * each with its own doorbells and interrupt vector.  The driver creates
+ * one I/O queue pair per cpu (or as many as the controller and the MSI-X
+ * vectors allow, shared round robin by the cpus), and submits a bio on
+ * the queue of the cpu it is issued from.  Each queue pair has its own
+ * lock, taken by its cpus and by its interrupt, so nothing is shared
+ * between cpus on the I/O path.
+ *
+ * Bios are mapped straight to the PRP lists of the commands; a bio whose
+ * segments can't be described by a single PRP list is sent in several
+ * commands, one after the other.  Bios which don't fit in the queue wait
+ * on it, and are sent as commands complete.
+ */
+
+#include <linux/nvme.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/idr.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/kdev_t.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/pci.h>
+#include <linux/sched.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#define NVME_Q_DEPTH		1024
+#define NVME_AQ_DEPTH		64
+#define SQ_SIZE(depth)		(depth * sizeof(struct nvme_command))
+#define CQ_SIZE(depth)		(depth * sizeof(struct nvme_completion))
+#define NVME_MINORS		64
+#define NVME_IO_TIMEOUT		(5 * HZ)
+#define ADMIN_TIMEOUT		(60 * HZ)
+
+#ifndef PCI_CLASS_STORAGE_EXPRESS
+#define PCI_CLASS_STORAGE_EXPRESS	0x010802
+#endif
+
+static int nvme_major;
+module_param(nvme_major, int, 0);
+
+static DEFINE_SPINLOCK(dev_list_lock);
+static LIST_HEAD(dev_list);
+static struct task_struct *nvme_thread;
+
+/*
+ * Represents an NVM Express device.  Each nvme_dev is a PCI function.
+ */
+struct nvme_dev {
+	struct list_head node;
+	struct nvme_queue **queues;
+	u32 __iomem *dbs;
+	struct pci_dev *pci_dev;
+	struct dma_pool *prp_page_pool;
+	int instance;
+	int queue_count;
+	int nr_io_queues;
+	int db_stride;
+	u32 ctrl_config;
+	struct msix_entry *entry;
+	struct nvme_bar __iomem *bar;
+	struct list_head namespaces;
+	char serial[20];
+	char model[40];
+	char firmware_rev[8];
+	unsigned max_hw_sectors;
+	u8 vwc;
+};
+
+/*
+ * An NVM Express namespace is equivalent to a SCSI LUN
+ */
+struct nvme_ns {
+	struct list_head list;
+
+	struct nvme_dev *dev;
+	struct request_queue *queue;
+	struct gendisk *disk;
+
+	int ns_id;
+	int lba_shift;
+};
+
+struct nvme_queue;
+
+typedef void (*nvme_completion_fn)(struct nvme_queue *, void *,
+						struct nvme_completion *);
+
+struct nvme_cmd_info {
+	nvme_completion_fn fn;
+	void *ctx;
+	unsigned long timeout;
+};
+
+/*
+ * An NVM Express queue.  Each device has at least two (one for admin
+ * commands and one for I/O commands).
+ */
+struct nvme_queue {
+	struct device *q_dmadev;
+	struct nvme_dev *dev;
+	spinlock_t q_lock;
+	struct nvme_command *sq_cmds;
+	volatile struct nvme_completion *cqes;
+	dma_addr_t sq_dma_addr;
+	dma_addr_t cq_dma_addr;
+	struct bio_list sq_cong;	/* bios waiting for room */
+	struct bio_list done;		/* bios to end out of q_lock */
+	u32 __iomem *q_db;
+	u16 q_depth;
+	u16 cq_vector;
+	u16 sq_head;
+	u16 sq_tail;
+	u16 cq_head;
+	u16 cq_phase;
+	cpumask_var_t cpumask;		/* the cpus submitting here */
+	unsigned long *cmdid_data;
+	struct nvme_cmd_info *cmdinfo;
+};
+
+/*
+ * Check we didn't inadvertently grow the command struct
+ */
+static inline void _nvme_check_size(void)
+{
+	BUILD_BUG_ON(sizeof(struct nvme_rw_command) != 64);
+	BUILD_BUG_ON(sizeof(struct nvme_create_cq) != 64);
+	BUILD_BUG_ON(sizeof(struct nvme_create_sq) != 64);
+	BUILD_BUG_ON(sizeof(struct nvme_delete_queue) != 64);
+	BUILD_BUG_ON(sizeof(struct nvme_features) != 64);
+	BUILD_BUG_ON(sizeof(struct nvme_command) != 64);
+	BUILD_BUG_ON(sizeof(struct nvme_id_ctrl) != 4096);
+	BUILD_BUG_ON(sizeof(struct nvme_id_ns) != 4096);
+	BUILD_BUG_ON(sizeof(struct nvme_lbaf) != 4);
+	BUILD_BUG_ON(sizeof(struct nvme_completion) != 16);
+}
+
+/* The 64 bit registers, accessed as two halves, low first */
+static u64 nvme_readq(__u64 __iomem *reg)
+{
+	u32 __iomem *p = (u32 __iomem *)reg;
+
+	return readl(p) | ((u64)readl(p + 1) << 32);
+}
+
+static void nvme_writeq(u64 val, __u64 __iomem *reg)
+{
+	u32 __iomem *p = (u32 __iomem *)reg;
+
+	writel(val, p);
+	writel(val >> 32, p + 1);
+}
+
+/*
+ * A command id is allocated for each command in flight, and indexes the
+ * cmdinfo array.  There is one id less than there are entries in the
+ * submission queue, so that a command holding an id always finds room
+ * in it.  Called with the q_lock held.
+ */
+static int alloc_cmdid(struct nvme_queue *nvmeq, void *ctx,
+				nvme_completion_fn handler, unsigned timeout)
+{
+	int depth = nvmeq->q_depth - 1;
+	int cmdid;
+
+	cmdid = find_first_zero_bit(nvmeq->cmdid_data, depth);
+	if (cmdid >= depth)
+		return -EBUSY;
+	__set_bit(cmdid, nvmeq->cmdid_data);
+
+	nvmeq->cmdinfo[cmdid].fn = handler;
+	nvmeq->cmdinfo[cmdid].ctx = ctx;
+	nvmeq->cmdinfo[cmdid].timeout = jiffies + timeout;
+	return cmdid;
+}
+
+static void special_completion(struct nvme_queue *nvmeq, void *ctx,
+						struct nvme_completion *cqe)
+{
+	/* The command was cancelled: what it now completes with is moot */
+}
+
+/* Called with the q_lock held, returns false for a bogus id */
+static bool free_cmdid(struct nvme_queue *nvmeq, int cmdid,
+				struct nvme_cmd_info *info)
+{
+	if (cmdid >= nvmeq->q_depth - 1 ||
+	    !test_bit(cmdid, nvmeq->cmdid_data)) {
+		dev_warn(nvmeq->q_dmadev, "invalid id %d completed on queue\n",
+								cmdid);
+		return false;
+	}
+
+	*info = nvmeq->cmdinfo[cmdid];
+	__clear_bit(cmdid, nvmeq->cmdid_data);
+	return true;
+}
+
+/*
+ * Complete the command now with an abort status.  Its id stays in use
+ * until the controller is done with it, and is only then freed.
+ */
+static void cancel_cmdid(struct nvme_queue *nvmeq, int cmdid)
+{
+	struct nvme_cmd_info *info = &nvmeq->cmdinfo[cmdid];
+	struct nvme_completion cqe = {
+		.status = cpu_to_le16(NVME_SC_ABORT_REQ << 1),
+	};
+
+	if (info->fn == special_completion)
+		return;
+
+	info->fn(nvmeq, info->ctx, &cqe);
+	info->fn = special_completion;
+	info->ctx = NULL;
+}
+
+static struct nvme_queue *get_nvmeq(struct nvme_dev *dev)
+{
+	return dev->queues[get_cpu() % dev->nr_io_queues + 1];
+}
+
+static void put_nvmeq(struct nvme_queue *nvmeq)
+{
+	put_cpu();
+}
+
+/**
+ * nvme_submit_cmd() - Copy a command into a queue and ring the doorbell
+ * @nvmeq: The queue to use
+ * @cmd: The command to send
+ *
+ * Called with the q_lock held, and a command id allocated.
+ */
+static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
+{
+	u16 tail = nvmeq->sq_tail;
+
+	memcpy(&nvmeq->sq_cmds[tail], cmd, sizeof(*cmd));
+	if (++tail == nvmeq->q_depth)
+		tail = 0;
+	writel(tail, nvmeq->q_db);
+	nvmeq->sq_tail = tail;
+}
+
+/* End the bios completed on the queue, once its q_lock is released */
+static void nvme_end_bios(struct bio_list *bios)
+{
+	struct bio *bio;
+
+	while ((bio = bio_list_pop(bios)))
+		bio_endio(bio, 0);
+}
+
+static void nvme_bio_done(struct nvme_queue *nvmeq, struct bio *bio,
+								u16 status)
+{
+	if (status)
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_list_add(&nvmeq->done, bio);
+}
+
+/*
+ * The part of a bio sent in one command: its segments, and the PRP list
+ * describing them to the controller.
+ */
+struct nvme_iod {
+	struct bio *bio;
+	int nents;		/* Used in scatterlist */
+	__le64 *prp_list;
+	dma_addr_t prp_dma;
+	struct scatterlist sg[0];
+};
+
+static struct nvme_iod *nvme_alloc_iod(unsigned nseg, gfp_t gfp)
+{
+	struct nvme_iod *iod;
+
+	iod = kmalloc(sizeof(*iod) + sizeof(struct scatterlist) * nseg, gfp);
+	if (iod) {
+		iod->nents = 0;
+		iod->prp_list = NULL;
+	}
+	return iod;
+}
+
+static void nvme_free_iod(struct nvme_dev *dev, struct nvme_iod *iod)
+{
+	if (iod->prp_list)
+		dma_pool_free(dev->prp_page_pool, iod->prp_list, iod->prp_dma);
+	kfree(iod);
+}
+
+static enum dma_data_direction nvme_dma_dir(struct bio *bio)
+{
+	return bio_data_dir(bio) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+}
+
+static void bio_completion(struct nvme_queue *nvmeq, void *ctx,
+						struct nvme_completion *cqe)
+{
+	struct nvme_iod *iod = ctx;
+	struct bio *bio = iod->bio;
+	u16 status = le16_to_cpu(cqe->status) >> 1;
+
+	dma_unmap_sg(nvmeq->q_dmadev, iod->sg, iod->nents, nvme_dma_dir(bio));
+	nvme_free_iod(nvmeq->dev, iod);
+
+	/* Send the rest of the bio, ahead of those waiting for room */
+	if (!status && bio->bi_size)
+		bio_list_add_head(&nvmeq->sq_cong, bio);
+	else
+		nvme_bio_done(nvmeq, bio, status);
+}
+
+static void flush_completion(struct nvme_queue *nvmeq, void *ctx,
+						struct nvme_completion *cqe)
+{
+	struct bio *bio = ctx;
+	u16 status = le16_to_cpu(cqe->status) >> 1;
+
+	/* The cache is flushed, the data of the bio can go now */
+	bio->bi_rw &= ~REQ_FLUSH;
+	if (!status && bio->bi_size)
+		bio_list_add_head(&nvmeq->sq_cong, bio);
+	else
+		nvme_bio_done(nvmeq, bio, status);
+}
+
+/*
+ * The controller takes PRP entries of a page each, of which only the first
+ * may start inside the page, and only the last end inside it.  Two bio_vecs
+ * which can't be in the same command without breaking this:
+ */
+#define BIOVEC_NOT_VIRT_MERGEABLE(vec1, vec2)	((vec2)->bv_offset || \
+			(((vec1)->bv_offset + (vec1)->bv_len) % PAGE_SIZE))
+
+/*
+ * Map the bio_vecs of the bio up to the first that can't follow the others
+ * in the same command, and return the length mapped.  bi_idx is left at
+ * that bio_vec.
+ */
+static int nvme_map_bio(struct device *dmadev, struct nvme_iod *iod,
+						struct bio *bio)
+{
+	struct bio_vec *bvec, *bvprv = NULL;
+	struct scatterlist *sg = NULL;
+	int i, length = 0, nsegs = 0;
+
+	sg_init_table(iod->sg, bio->bi_vcnt - bio->bi_idx);
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvprv && BIOVEC_PHYS_MERGEABLE(bvprv, bvec)) {
+			sg->length += bvec->bv_len;
+		} else {
+			if (bvprv && BIOVEC_NOT_VIRT_MERGEABLE(bvprv, bvec))
+				break;
+			sg = sg ? sg + 1 : iod->sg;
+			sg_set_page(sg, bvec->bv_page, bvec->bv_len,
+							bvec->bv_offset);
+			nsegs++;
+		}
+		length += bvec->bv_len;
+		bvprv = bvec;
+	}
+	sg_mark_end(sg);
+
+	if (dma_map_sg(dmadev, iod->sg, nsegs, nvme_dma_dir(bio)) == 0)
+		return -ENOMEM;
+	iod->nents = nsegs;
+	bio->bi_idx = i;
+	return length;
+}
+
+/*
+ * Fill in the PRP entries of the command.  The length of a command is
+ * limited by max_hw_sectors so that its entries after the first two fit
+ * in a single page of PRP list.
+ */
+static int nvme_setup_prps(struct nvme_dev *dev, struct nvme_iod *iod,
+				struct nvme_common_command *cmd, int length)
+{
+	struct scatterlist *sg = iod->sg;
+	int dma_len = sg_dma_len(sg);
+	u64 dma_addr = sg_dma_address(sg);
+	int offset = offset_in_page(dma_addr);
+	__le64 *prp_list;
+	int i;
+
+	cmd->prp1 = cpu_to_le64(dma_addr);
+	length -= (PAGE_SIZE - offset);
+	if (length <= 0)
+		return 0;
+
+	dma_len -= (PAGE_SIZE - offset);
+	if (dma_len) {
+		dma_addr += (PAGE_SIZE - offset);
+	} else {
+		sg = sg_next(sg);
+		dma_addr = sg_dma_address(sg);
+		dma_len = sg_dma_len(sg);
+	}
+
+	if (length <= PAGE_SIZE) {
+		cmd->prp2 = cpu_to_le64(dma_addr);
+		return 0;
+	}
+
+	prp_list = dma_pool_alloc(dev->prp_page_pool, GFP_ATOMIC,
+							&iod->prp_dma);
+	if (!prp_list)
+		return -ENOMEM;
+	iod->prp_list = prp_list;
+	cmd->prp2 = cpu_to_le64(iod->prp_dma);
+
+	i = 0;
+	for (;;) {
+		BUG_ON(i == PAGE_SIZE / 8);
+		prp_list[i++] = cpu_to_le64(dma_addr);
+		dma_len -= PAGE_SIZE;
+		dma_addr += PAGE_SIZE;
+		length -= PAGE_SIZE;
+		if (length <= 0)
+			break;
+		if (dma_len > 0)
+			continue;
+		BUG_ON(dma_len < 0);
+		sg = sg_next(sg);
+		dma_addr = sg_dma_address(sg);
+		dma_len = sg_dma_len(sg);
+	}
+
+	return 0;
+}
+
+/* The data of the bio is sent on once the flush completed */
+static int nvme_submit_flush(struct nvme_queue *nvmeq, struct nvme_ns *ns,
+								struct bio *bio)
+{
+	struct nvme_command *cmnd;
+	int cmdid;
+
+	cmdid = alloc_cmdid(nvmeq, bio, flush_completion, NVME_IO_TIMEOUT);
+	if (unlikely(cmdid < 0))
+		return cmdid;
+
+	cmnd = &nvmeq->sq_cmds[nvmeq->sq_tail];
+	memset(cmnd, 0, sizeof(*cmnd));
+	cmnd->common.opcode = nvme_cmd_flush;
+	cmnd->common.command_id = cmdid;
+	cmnd->common.nsid = cpu_to_le32(ns->ns_id);
+
+	if (++nvmeq->sq_tail == nvmeq->q_depth)
+		nvmeq->sq_tail = 0;
+	writel(nvmeq->sq_tail, nvmeq->q_db);
+
+	return 0;
+}
+
+/*
+ * Send the bio, or as much of it as fits in a command.  Called with the
+ * q_lock held; returns -EBUSY or -ENOMEM when the bio has to wait.
+ */
+static int nvme_submit_bio_queue(struct nvme_queue *nvmeq, struct nvme_ns *ns,
+								struct bio *bio)
+{
+	struct nvme_command *cmnd;
+	struct nvme_iod *iod;
+	int cmdid, length, result;
+	unsigned short old_idx = bio->bi_idx;
+	u16 control = 0;
+
+	/*
+	 * Stacking drivers see FLUSH|FUA as barriers; those left are
+	 * flushes with FUA writes too, their writers wait for what they
+	 * depend on.
+	 */
+	if (bio->bi_rw & REQ_HARDBARRIER) {
+		bio->bi_rw &= ~REQ_HARDBARRIER;
+		bio->bi_rw |= REQ_FLUSH | REQ_FUA;
+	}
+	if (bio->bi_rw & REQ_FLUSH) {
+		/* Without a volatile write cache, there is nothing to flush */
+		if (ns->dev->vwc)
+			return nvme_submit_flush(nvmeq, ns, bio);
+		bio->bi_rw &= ~REQ_FLUSH;
+	}
+	if (unlikely(!bio->bi_size)) {
+		nvme_bio_done(nvmeq, bio, 0);
+		return 0;
+	}
+
+	iod = nvme_alloc_iod(bio->bi_vcnt - bio->bi_idx, GFP_ATOMIC);
+	if (!iod)
+		return -ENOMEM;
+	iod->bio = bio;
+
+	result = -EBUSY;
+	cmdid = alloc_cmdid(nvmeq, iod, bio_completion, NVME_IO_TIMEOUT);
+	if (unlikely(cmdid < 0))
+		goto free_iod;
+
+	cmnd = &nvmeq->sq_cmds[nvmeq->sq_tail];
+	memset(cmnd, 0, sizeof(*cmnd));
+
+	length = nvme_map_bio(nvmeq->q_dmadev, iod, bio);
+	if (length < 0) {
+		result = length;
+		goto free_cmdid;
+	}
+
+	result = -EINVAL;
+	if (unlikely(length & ((1 << ns->lba_shift) - 1)))
+		goto unmap;
+
+	result = nvme_setup_prps(nvmeq->dev, iod, &cmnd->common, length);
+	if (result)
+		goto unmap;
+
+	if (bio->bi_rw & REQ_FUA)
+		control |= NVME_RW_FUA;
+
+	cmnd->rw.opcode = bio_data_dir(bio) ? nvme_cmd_write : nvme_cmd_read;
+	cmnd->rw.command_id = cmdid;
+	cmnd->rw.nsid = cpu_to_le32(ns->ns_id);
+	cmnd->rw.slba = cpu_to_le64(bio->bi_sector >> (ns->lba_shift - 9));
+	cmnd->rw.length = cpu_to_le16((length >> ns->lba_shift) - 1);
+	cmnd->rw.control = cpu_to_le16(control);
+
+	bio->bi_sector += length >> 9;
+	bio->bi_size -= length;
+
+	if (++nvmeq->sq_tail == nvmeq->q_depth)
+		nvmeq->sq_tail = 0;
+	writel(nvmeq->sq_tail, nvmeq->q_db);
+
+	return 0;
+
+ unmap:
+	dma_unmap_sg(nvmeq->q_dmadev, iod->sg, iod->nents, nvme_dma_dir(bio));
+	bio->bi_idx = old_idx;
+ free_cmdid:
+	__clear_bit(cmdid, nvmeq->cmdid_data);
+ free_iod:
+	nvme_free_iod(nvmeq->dev, iod);
+	if (result == -EINVAL) {
+		/* Only a bio not made of whole blocks can't go in pieces */
+		nvme_bio_done(nvmeq, bio, NVME_SC_INVALID_FIELD);
+		return 0;
+	}
+	return result;
+}
+
+/*
+ * Send the bios waiting on the queue, in order, until it is full again.
+ * Called with the q_lock held.
+ */
+static void nvme_resubmit_bios(struct nvme_queue *nvmeq)
+{
+	struct bio *bio;
+
+	while ((bio = bio_list_peek(&nvmeq->sq_cong))) {
+		struct nvme_ns *ns = bio->bi_bdev->bd_disk->private_data;
+
+		bio_list_pop(&nvmeq->sq_cong);
+		if (nvme_submit_bio_queue(nvmeq, ns, bio)) {
+			bio_list_add_head(&nvmeq->sq_cong, bio);
+			break;
+		}
+	}
+}
+
+static int nvme_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct nvme_ns *ns = q->queuedata;
+	struct nvme_queue *nvmeq = get_nvmeq(ns->dev);
+	struct bio_list done;
+	int result = -EBUSY;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	if (bio_list_empty(&nvmeq->sq_cong))
+		result = nvme_submit_bio_queue(nvmeq, ns, bio);
+	if (unlikely(result))
+		bio_list_add(&nvmeq->sq_cong, bio);
+	done = nvmeq->done;
+	bio_list_init(&nvmeq->done);
+	spin_unlock_irq(&nvmeq->q_lock);
+	put_nvmeq(nvmeq);
+
+	nvme_end_bios(&done);
+	return 0;
+}
+
+/*
+ * Reap the completion queue, calling the completion of each command.
+ * Called with the q_lock held.
+ */
+static irqreturn_t nvme_process_cq(struct nvme_queue *nvmeq)
+{
+	u16 head, phase;
+
+	head = nvmeq->cq_head;
+	phase = nvmeq->cq_phase;
+
+	for (;;) {
+		struct nvme_completion cqe = nvmeq->cqes[head];
+		struct nvme_cmd_info info;
+
+		if ((le16_to_cpu(cqe.status) & 1) != phase)
+			break;
+		nvmeq->sq_head = le16_to_cpu(cqe.sq_head);
+		if (++head == nvmeq->q_depth) {
+			head = 0;
+			phase = !phase;
+		}
+
+		if (free_cmdid(nvmeq, cqe.command_id, &info))
+			info.fn(nvmeq, info.ctx, &cqe);
+	}
+
+	/* If the controller ignores the cq head doorbell and continuously
+	 * writes to the queue, it is theoretically possible to wrap around
+	 * the queue twice and mistakenly return IRQ_NONE.  Linux only
+	 * requires that 0.1% of your interrupts are handled, so this isn't
+	 * a big problem.
+	 */
+	if (head == nvmeq->cq_head && phase == nvmeq->cq_phase)
+		return IRQ_NONE;
+
+	writel(head, nvmeq->q_db + (1 << nvmeq->dev->db_stride));
+	nvmeq->cq_head = head;
+	nvmeq->cq_phase = phase;
+
+	return IRQ_HANDLED;
+}
+
+static irqreturn_t nvme_irq(int irq, void *data)
+{
+	struct nvme_queue *nvmeq = data;
+	struct bio_list done;
+	irqreturn_t result;
+
+	spin_lock(&nvmeq->q_lock);
+	result = nvme_process_cq(nvmeq);
+	nvme_resubmit_bios(nvmeq);
+	done = nvmeq->done;
+	bio_list_init(&nvmeq->done);
+	spin_unlock(&nvmeq->q_lock);
+
+	nvme_end_bios(&done);
+	return result;
+}
+
+/*
+ * Cancel the commands which timed out, or all of them when @timeout is
+ * false.  Called with the q_lock held.
+ */
+static void nvme_cancel_ios(struct nvme_queue *nvmeq, bool timeout)
+{
+	int depth = nvmeq->q_depth - 1;
+	unsigned long now = jiffies;
+	int cmdid;
+
+	for_each_set_bit(cmdid, nvmeq->cmdid_data, depth) {
+		struct nvme_cmd_info *info = &nvmeq->cmdinfo[cmdid];
+
+		if (info->fn == special_completion)
+			continue;
+		if (timeout && !time_after(now, info->timeout))
+			continue;
+		dev_warn(nvmeq->q_dmadev, "cancelling I/O %d\n", cmdid);
+		cancel_cmdid(nvmeq, cmdid);
+	}
+}
+
+struct sync_cmd_info {
+	struct completion done;
+	u32 result;
+	int status;
+};
+
+static void sync_completion(struct nvme_queue *nvmeq, void *ctx,
+						struct nvme_completion *cqe)
+{
+	struct sync_cmd_info *cmdinfo = ctx;
+
+	cmdinfo->result = le32_to_cpu(cqe->result);
+	cmdinfo->status = le16_to_cpu(cqe->status) >> 1;
+	complete(&cmdinfo->done);
+}
+
+/*
+ * Returns 0 on success.  If the result is negative, it's a Linux error code;
+ * if the result is positive, it's an NVM Express status code.  A command
+ * the controller doesn't complete in time is cancelled by nvme_kthread.
+ */
+static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
+			struct nvme_command *cmd, u32 *result, unsigned timeout)
+{
+	struct sync_cmd_info cmdinfo;
+	int cmdid;
+
+	init_completion(&cmdinfo.done);
+
+	spin_lock_irq(&nvmeq->q_lock);
+	cmdid = alloc_cmdid(nvmeq, &cmdinfo, sync_completion, timeout);
+	if (cmdid >= 0) {
+		cmd->common.command_id = cmdid;
+		nvme_submit_cmd(nvmeq, cmd);
+	}
+	spin_unlock_irq(&nvmeq->q_lock);
+	if (cmdid < 0)
+		return cmdid;
+
+	wait_for_completion(&cmdinfo.done);
+
+	if (result)
+		*result = cmdinfo.result;
+
+	return cmdinfo.status;
+}
+
+static int nvme_submit_admin_cmd(struct nvme_dev *dev, struct nvme_command *cmd,
+								u32 *result)
+{
+	return nvme_submit_sync_cmd(dev->queues[0], cmd, result, ADMIN_TIMEOUT);
+}
+
+static int adapter_delete_queue(struct nvme_dev *dev, u8 opcode, u16 id)
+{
+	int status;
+	struct nvme_command c;
+
+	memset(&c, 0, sizeof(c));
+	c.delete_queue.opcode = opcode;
+	c.delete_queue.qid = cpu_to_le16(id);
+
+	status = nvme_submit_admin_cmd(dev, &c, NULL);
+	if (status)
+		return -EIO;
+	return 0;
+}
+
+static int adapter_alloc_cq(struct nvme_dev *dev, u16 qid,
+						struct nvme_queue *nvmeq)
+{
+	int status;
+	struct nvme_command c;
+	int flags = NVME_QUEUE_PHYS_CONTIG | NVME_CQ_IRQ_ENABLED;
+
+	memset(&c, 0, sizeof(c));
+	c.create_cq.opcode = nvme_admin_create_cq;
+	c.create_cq.prp1 = cpu_to_le64(nvmeq->cq_dma_addr);
+	c.create_cq.cqid = cpu_to_le16(qid);
+	c.create_cq.qsize = cpu_to_le16(nvmeq->q_depth - 1);
+	c.create_cq.cq_flags = cpu_to_le16(flags);
+	c.create_cq.irq_vector = cpu_to_le16(nvmeq->cq_vector);
+
+	status = nvme_submit_admin_cmd(dev, &c, NULL);
+	if (status)
+		return -EIO;
+	return 0;
+}
+
+static int adapter_alloc_sq(struct nvme_dev *dev, u16 qid,
+						struct nvme_queue *nvmeq)
+{
+	int status;
+	struct nvme_command c;
+	int flags = NVME_QUEUE_PHYS_CONTIG | NVME_SQ_PRIO_MEDIUM;
+
+	memset(&c, 0, sizeof(c));
+	c.create_sq.opcode = nvme_admin_create_sq;
+	c.create_sq.prp1 = cpu_to_le64(nvmeq->sq_dma_addr);
+	c.create_sq.sqid = cpu_to_le16(qid);
+	c.create_sq.qsize = cpu_to_le16(nvmeq->q_depth - 1);
+	c.create_sq.sq_flags = cpu_to_le16(flags);
+	c.create_sq.cqid = cpu_to_le16(qid);
+
+	status = nvme_submit_admin_cmd(dev, &c, NULL);
+	if (status)
+		return -EIO;
+	return 0;
+}
+
+static int nvme_identify(struct nvme_dev *dev, unsigned nsid, unsigned cns,
+							dma_addr_t dma_addr)
+{
+	struct nvme_command c;
+
+	memset(&c, 0, sizeof(c));
+	c.identify.opcode = nvme_admin_identify;
+	c.identify.nsid = cpu_to_le32(nsid);
+	c.identify.prp1 = cpu_to_le64(dma_addr);
+	c.identify.cns = cpu_to_le32(cns);
+
+	return nvme_submit_admin_cmd(dev, &c, NULL);
+}
+
+static int nvme_set_features(struct nvme_dev *dev, unsigned fid,
+					unsigned dword11, u32 *result)
+{
+	struct nvme_command c;
+
+	memset(&c, 0, sizeof(c));
+	c.features.opcode = nvme_admin_set_features;
+	c.features.fid = cpu_to_le32(fid);
+	c.features.dword11 = cpu_to_le32(dword11);
+
+	return nvme_submit_admin_cmd(dev, &c, result);
+}
+
+static void nvme_free_queue_mem(struct nvme_queue *nvmeq)
+{
+	dma_free_coherent(nvmeq->q_dmadev, CQ_SIZE(nvmeq->q_depth),
+				(void *)nvmeq->cqes, nvmeq->cq_dma_addr);
+	dma_free_coherent(nvmeq->q_dmadev, SQ_SIZE(nvmeq->q_depth),
+					nvmeq->sq_cmds, nvmeq->sq_dma_addr);
+	free_cpumask_var(nvmeq->cpumask);
+	kfree(nvmeq->cmdinfo);
+	kfree(nvmeq->cmdid_data);
+	kfree(nvmeq);
+}
+
+static struct nvme_queue *nvme_alloc_queue(struct nvme_dev *dev, int qid,
+							int depth, int vector)
+{
+	struct device *dmadev = &dev->pci_dev->dev;
+	struct nvme_queue *nvmeq = kzalloc(sizeof(*nvmeq), GFP_KERNEL);
+
+	if (!nvmeq)
+		return NULL;
+
+	nvmeq->cmdid_data = kcalloc(BITS_TO_LONGS(depth), sizeof(long),
+								GFP_KERNEL);
+	nvmeq->cmdinfo = kcalloc(depth, sizeof(struct nvme_cmd_info),
+								GFP_KERNEL);
+	if (!nvmeq->cmdid_data || !nvmeq->cmdinfo)
+		goto free_nvmeq;
+	if (!zalloc_cpumask_var(&nvmeq->cpumask, GFP_KERNEL))
+		goto free_nvmeq;
+
+	nvmeq->cqes = dma_alloc_coherent(dmadev, CQ_SIZE(depth),
+					&nvmeq->cq_dma_addr, GFP_KERNEL);
+	if (!nvmeq->cqes)
+		goto free_cpumask;
+	memset((void *)nvmeq->cqes, 0, CQ_SIZE(depth));
+
+	nvmeq->sq_cmds = dma_alloc_coherent(dmadev, SQ_SIZE(depth),
+					&nvmeq->sq_dma_addr, GFP_KERNEL);
+	if (!nvmeq->sq_cmds)
+		goto free_cqdma;
+
+	nvmeq->q_dmadev = dmadev;
+	nvmeq->dev = dev;
+	spin_lock_init(&nvmeq->q_lock);
+	nvmeq->cq_head = 0;
+	nvmeq->cq_phase = 1;
+	bio_list_init(&nvmeq->sq_cong);
+	bio_list_init(&nvmeq->done);
+	nvmeq->q_db = &dev->dbs[qid << (dev->db_stride + 1)];
+	nvmeq->q_depth = depth;
+	nvmeq->cq_vector = vector;
+
+	return nvmeq;
+
+ free_cqdma:
+	dma_free_coherent(dmadev, CQ_SIZE(depth), (void *)nvmeq->cqes,
+							nvmeq->cq_dma_addr);
+ free_cpumask:
+	free_cpumask_var(nvmeq->cpumask);
+ free_nvmeq:
+	kfree(nvmeq->cmdinfo);
+	kfree(nvmeq->cmdid_data);
+	kfree(nvmeq);
+	return NULL;
+}
+
+static int queue_request_irq(struct nvme_dev *dev, struct nvme_queue *nvmeq,
+							const char *name)
+{
+	return request_irq(dev->entry[nvmeq->cq_vector].vector, nvme_irq,
+				IRQF_DISABLED | IRQF_SHARED, name, nvmeq);
+}
+
+/*
+ * End the commands still in flight and the bios still waiting, once the
+ * queue is gone from the controller.
+ */
+static void nvme_drain_queue(struct nvme_queue *nvmeq)
+{
+	struct bio_list done;
+	struct bio *bio;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	nvme_cancel_ios(nvmeq, false);
+	while ((bio = bio_list_pop(&nvmeq->sq_cong)))
+		nvme_bio_done(nvmeq, bio, NVME_SC_ABORT_QUEUE);
+	done = nvmeq->done;
+	bio_list_init(&nvmeq->done);
+	spin_unlock_irq(&nvmeq->q_lock);
+
+	nvme_end_bios(&done);
+}
+
+static void nvme_free_queue(struct nvme_dev *dev, int qid)
+{
+	struct nvme_queue *nvmeq = dev->queues[qid];
+	int vector = dev->entry[nvmeq->cq_vector].vector;
+
+	/* nvme_kthread no longer looks at it once it is out of the count */
+	spin_lock(&dev_list_lock);
+	dev->queue_count--;
+	spin_unlock(&dev_list_lock);
+
+	irq_set_affinity_hint(vector, NULL);
+	free_irq(vector, nvmeq);
+
+	/* Don't tell the adapter to delete the admin queue */
+	if (qid) {
+		adapter_delete_queue(dev, nvme_admin_delete_sq, qid);
+		adapter_delete_queue(dev, nvme_admin_delete_cq, qid);
+	}
+
+	nvme_drain_queue(nvmeq);
+	dev->queues[qid] = NULL;
+	nvme_free_queue_mem(nvmeq);
+}
+
+/* Make a queue visible to nvme_kthread, once it is all set up */
+static void nvme_add_queue(struct nvme_dev *dev, int qid,
+						struct nvme_queue *nvmeq)
+{
+	dev->queues[qid] = nvmeq;
+	spin_lock(&dev_list_lock);
+	dev->queue_count++;
+	spin_unlock(&dev_list_lock);
+}
+
+static struct nvme_queue *nvme_create_queue(struct nvme_dev *dev, int qid,
+						int depth, int vector)
+{
+	int result;
+	struct nvme_queue *nvmeq = nvme_alloc_queue(dev, qid, depth, vector);
+
+	if (!nvmeq)
+		return ERR_PTR(-ENOMEM);
+
+	result = adapter_alloc_cq(dev, qid, nvmeq);
+	if (result < 0)
+		goto free_nvmeq;
+
+	result = adapter_alloc_sq(dev, qid, nvmeq);
+	if (result < 0)
+		goto release_cq;
+
+	result = queue_request_irq(dev, nvmeq, "nvme");
+	if (result < 0)
+		goto release_sq;
+
+	return nvmeq;
+
+ release_sq:
+	adapter_delete_queue(dev, nvme_admin_delete_sq, qid);
+ release_cq:
+	adapter_delete_queue(dev, nvme_admin_delete_cq, qid);
+ free_nvmeq:
+	nvme_free_queue_mem(nvmeq);
+	return ERR_PTR(result);
+}
+
+static int nvme_wait_ready(struct nvme_dev *dev, u64 cap, bool enabled)
+{
+	unsigned long timeout;
+	u32 bit = enabled ? NVME_CSTS_RDY : 0;
+
+	timeout = ((NVME_CAP_TIMEOUT(cap) + 1) * HZ / 2) + jiffies;
+	while ((readl(&dev->bar->csts) & NVME_CSTS_RDY) != bit) {
+		msleep(100);
+		if (fatal_signal_pending(current))
+			return -EINTR;
+		if (time_after(jiffies, timeout)) {
+			dev_err(&dev->pci_dev->dev,
+				"Device not ready; aborting %s\n",
+				enabled ? "initialisation" : "reset");
+			return -ENODEV;
+		}
+	}
+
+	return 0;
+}
+
+static int __devinit nvme_configure_admin_queue(struct nvme_dev *dev)
+{
+	int result;
+	u32 aqa;
+	u64 cap = nvme_readq(&dev->bar->cap);
+	struct nvme_queue *nvmeq;
+
+	if (NVME_CAP_MPSMIN(cap) > PAGE_SHIFT - 12) {
+		dev_err(&dev->pci_dev->dev, "pages of %d bytes unsupported\n",
+							(int)PAGE_SIZE);
+		return -ENODEV;
+	}
+
+	dev->db_stride = NVME_CAP_STRIDE(cap);
+	dev->dbs = ((void __iomem *)dev->bar) + NVME_DB_OFFSET;
+
+	writel(0, &dev->bar->cc);
+	result = nvme_wait_ready(dev, cap, false);
+	if (result)
+		return result;
+
+	nvmeq = nvme_alloc_queue(dev, 0, NVME_AQ_DEPTH, 0);
+	if (!nvmeq)
+		return -ENOMEM;
+
+	aqa = nvmeq->q_depth - 1;
+	aqa |= aqa << 16;
+
+	dev->ctrl_config = NVME_CC_ENABLE | NVME_CC_CSS_NVM;
+	dev->ctrl_config |= (PAGE_SHIFT - 12) << NVME_CC_MPS_SHIFT;
+	dev->ctrl_config |= NVME_CC_ARB_RR | NVME_CC_SHN_NONE;
+	dev->ctrl_config |= NVME_CC_IOSQES | NVME_CC_IOCQES;
+
+	writel(aqa, &dev->bar->aqa);
+	nvme_writeq(nvmeq->sq_dma_addr, &dev->bar->asq);
+	nvme_writeq(nvmeq->cq_dma_addr, &dev->bar->acq);
+	writel(dev->ctrl_config, &dev->bar->cc);
+
+	result = nvme_wait_ready(dev, cap, true);
+	if (result)
+		goto free_q;
+
+	result = queue_request_irq(dev, nvmeq, "nvme admin");
+	if (result)
+		goto free_q;
+
+	nvme_add_queue(dev, 0, nvmeq);
+	return 0;
+
+ free_q:
+	nvme_free_queue_mem(nvmeq);
+	return result;
+}
+
+static const struct block_device_operations nvme_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static DEFINE_IDA(nvme_index_ida);
+static DEFINE_IDA(nvme_instance_ida);
+static DEFINE_SPINLOCK(nvme_ida_lock);
+
+static int nvme_get_id(struct ida *ida)
+{
+	int id, error;
+
+	do {
+		if (!ida_pre_get(ida, GFP_KERNEL))
+			return -ENOMEM;
+
+		spin_lock(&nvme_ida_lock);
+		error = ida_get_new(ida, &id);
+		spin_unlock(&nvme_ida_lock);
+	} while (error == -EAGAIN);
+
+	return error ? error : id;
+}
+
+static void nvme_put_id(struct ida *ida, int id)
+{
+	spin_lock(&nvme_ida_lock);
+	ida_remove(ida, id);
+	spin_unlock(&nvme_ida_lock);
+}
+
+static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, int nsid,
+						struct nvme_id_ns *id)
+{
+	struct nvme_ns *ns;
+	struct gendisk *disk;
+	int lbaf, index;
+
+	index = nvme_get_id(&nvme_index_ida);
+	if (index < 0)
+		return NULL;
+	if (index >= (1 << MINORBITS) / NVME_MINORS)
+		goto out_put_id;
+
+	ns = kzalloc(sizeof(*ns), GFP_KERNEL);
+	if (!ns)
+		goto out_put_id;
+	ns->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!ns->queue)
+		goto out_free_ns;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
+	blk_queue_make_request(ns->queue, nvme_make_request);
+	ns->dev = dev;
+	ns->queue->queuedata = ns;
+
+	disk = alloc_disk(NVME_MINORS);
+	if (!disk)
+		goto out_free_queue;
+	ns->ns_id = nsid;
+	ns->disk = disk;
+	lbaf = id->flbas & 0xf;
+	ns->lba_shift = id->lbaf[lbaf].ds;
+	blk_queue_logical_block_size(ns->queue, 1 << ns->lba_shift);
+	blk_queue_max_hw_sectors(ns->queue, dev->max_hw_sectors);
+	if (dev->vwc)
+		blk_queue_flush(ns->queue, REQ_FLUSH | REQ_FUA);
+
+	disk->major = nvme_major;
+	disk->first_minor = NVME_MINORS * index;
+	disk->fops = &nvme_fops;
+	disk->private_data = ns;
+	disk->queue = ns->queue;
+	disk->driverfs_dev = &dev->pci_dev->dev;
+	sprintf(disk->disk_name, "nvme%dn%d", dev->instance, nsid);
+	set_capacity(disk, le64_to_cpu(id->nsze) << (ns->lba_shift - 9));
+
+	return ns;
+
+ out_free_queue:
+	blk_cleanup_queue(ns->queue);
+ out_free_ns:
+	kfree(ns);
+ out_put_id:
+	nvme_put_id(&nvme_index_ida, index);
+	return NULL;
+}
+
+static void nvme_ns_free(struct nvme_ns *ns)
+{
+	int index = ns->disk->first_minor / NVME_MINORS;
+
+	put_disk(ns->disk);
+	nvme_put_id(&nvme_index_ida, index);
+	kfree(ns);
+}
+
+/*
+ * Ask for one I/O queue pair per cpu.  What the controller grants, and the
+ * MSI-X vectors the platform has for it, may be fewer: the cpus then share
+ * them round robin.  It always leaves us at least one.
+ */
+static int __devinit nvme_setup_io_queues(struct nvme_dev *dev)
+{
+	struct pci_dev *pdev = dev->pci_dev;
+	int result, cpu, i, nr_io_queues, q_depth;
+	u32 q_count;
+	u64 cap;
+
+	nr_io_queues = num_possible_cpus();
+	q_count = nr_io_queues - 1;
+	result = nvme_set_features(dev, NVME_FEAT_NUM_QUEUES,
+					q_count | (q_count << 16), &q_count);
+	if (result)
+		return result < 0 ? result : -EIO;
+	nr_io_queues = min_t(int, nr_io_queues,
+			min(q_count & 0xffff, q_count >> 16) + 1);
+
+	/* Deregister the admin queue's interrupt */
+	free_irq(dev->entry[0].vector, dev->queues[0]);
+
+	for (i = 0; i < nr_io_queues; i++)
+		dev->entry[i].entry = i;
+	for (;;) {
+		result = pci_enable_msix(pdev, dev->entry, nr_io_queues);
+		if (result == 0)
+			break;
+		if (result < 0) {
+			/* Everything on the pin interrupt then */
+			nr_io_queues = 1;
+			dev->entry[0].vector = pdev->irq;
+			break;
+		}
+		nr_io_queues = result;
+	}
+
+	result = queue_request_irq(dev, dev->queues[0], "nvme admin");
+	if (result)
+		return result;
+
+	cap = nvme_readq(&dev->bar->cap);
+	q_depth = min_t(int, NVME_CAP_MQES(cap) + 1, NVME_Q_DEPTH);
+	for (i = 0; i < nr_io_queues; i++) {
+		struct nvme_queue *nvmeq;
+
+		nvmeq = nvme_create_queue(dev, i + 1, q_depth, i);
+		if (IS_ERR(nvmeq)) {
+			if (!i)
+				return PTR_ERR(nvmeq);
+			break;
+		}
+		nvme_add_queue(dev, i + 1, nvmeq);
+	}
+	dev->nr_io_queues = i;
+
+	/* Have each queue's interrupt taken by the cpus submitting to it */
+	for_each_possible_cpu(cpu)
+		cpumask_set_cpu(cpu,
+			dev->queues[cpu % dev->nr_io_queues + 1]->cpumask);
+	for (i = 1; i <= dev->nr_io_queues; i++) {
+		struct nvme_queue *nvmeq = dev->queues[i];
+
+		irq_set_affinity_hint(dev->entry[nvmeq->cq_vector].vector,
+							nvmeq->cpumask);
+	}
+
+	return 0;
+}
+
+static void nvme_free_queues(struct nvme_dev *dev)
+{
+	int i;
+
+	for (i = dev->queue_count - 1; i >= 0; i--)
+		nvme_free_queue(dev, i);
+	if (dev->pci_dev->msix_enabled)
+		pci_disable_msix(dev->pci_dev);
+}
+
+static void nvme_disable_ctrl(struct nvme_dev *dev)
+{
+	writel(0, &dev->bar->cc);
+	nvme_wait_ready(dev, nvme_readq(&dev->bar->cap), false);
+}
+
+static int __devinit nvme_dev_add(struct nvme_dev *dev)
+{
+	int res, nn, i;
+	struct nvme_ns *ns;
+	struct nvme_id_ctrl *ctrl;
+	struct nvme_id_ns *id_ns;
+	void *mem;
+	dma_addr_t dma_addr;
+	u64 cap;
+
+	res = nvme_configure_admin_queue(dev);
+	if (res)
+		return res;
+
+	/* Commands which time out are cancelled by nvme_kthread */
+	spin_lock(&dev_list_lock);
+	list_add(&dev->node, &dev_list);
+	spin_unlock(&dev_list_lock);
+
+	res = nvme_setup_io_queues(dev);
+	if (res)
+		goto out;
+
+	mem = dma_alloc_coherent(&dev->pci_dev->dev, 8192, &dma_addr,
+								GFP_KERNEL);
+	if (!mem) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	res = nvme_identify(dev, 0, 1, dma_addr);
+	if (res) {
+		res = -EIO;
+		goto out_free;
+	}
+
+	ctrl = mem;
+	nn = le32_to_cpu(ctrl->nn);
+	memcpy(dev->serial, ctrl->sn, sizeof(ctrl->sn));
+	memcpy(dev->model, ctrl->mn, sizeof(ctrl->mn));
+	memcpy(dev->firmware_rev, ctrl->fr, sizeof(ctrl->fr));
+	dev->vwc = ctrl->vwc & NVME_CTRL_VWC_PRESENT;
+
+	/* A single page of PRP list for the entries after the first two */
+	dev->max_hw_sectors = (PAGE_SIZE / 8) << (PAGE_SHIFT - 9);
+	if (ctrl->mdts) {
+		cap = nvme_readq(&dev->bar->cap);
+		dev->max_hw_sectors = min_t(unsigned, dev->max_hw_sectors,
+			1 << (ctrl->mdts + 12 + NVME_CAP_MPSMIN(cap) - 9));
+	}
+
+	id_ns = mem;
+	for (i = 1; i <= nn; i++) {
+		res = nvme_identify(dev, i, 0, dma_addr);
+		if (res)
+			continue;
+
+		if (id_ns->ncap == 0)
+			continue;
+
+		ns = nvme_alloc_ns(dev, i, mem);
+		if (ns)
+			list_add_tail(&ns->list, &dev->namespaces);
+	}
+	list_for_each_entry(ns, &dev->namespaces, list)
+		add_disk(ns->disk);
+
+	dev_info(&dev->pci_dev->dev, "%.40s, %d I/O queues, %d namespaces\n",
+			dev->model, dev->nr_io_queues, nn);
+
+	dma_free_coherent(&dev->pci_dev->dev, 8192, mem, dma_addr);
+	return 0;
+
+ out_free:
+	dma_free_coherent(&dev->pci_dev->dev, 8192, mem, dma_addr);
+ out:
+	nvme_free_queues(dev);
+	nvme_disable_ctrl(dev);
+	spin_lock(&dev_list_lock);
+	list_del(&dev->node);
+	spin_unlock(&dev_list_lock);
+	return res;
+}
+
+static void nvme_dev_remove(struct nvme_dev *dev)
+{
+	struct nvme_ns *ns, *next;
+
+	list_for_each_entry_safe(ns, next, &dev->namespaces, list) {
+		list_del(&ns->list);
+		del_gendisk(ns->disk);
+		blk_cleanup_queue(ns->queue);
+		nvme_ns_free(ns);
+	}
+
+	nvme_free_queues(dev);
+	nvme_disable_ctrl(dev);
+
+	spin_lock(&dev_list_lock);
+	list_del(&dev->node);
+	spin_unlock(&dev_list_lock);
+}
+
+/*
+ * Looks for the commands which timed out, reaps the completions of
+ * interrupts which got lost, and sends the bios which waited for memory
+ * rather than for room in the queue.
+ */
+static int nvme_kthread(void *data)
+{
+	struct nvme_dev *dev;
+
+	while (!kthread_should_stop()) {
+		__set_current_state(TASK_RUNNING);
+		spin_lock(&dev_list_lock);
+		list_for_each_entry(dev, &dev_list, node) {
+			int i;
+
+			for (i = 0; i < dev->queue_count; i++) {
+				struct nvme_queue *nvmeq = dev->queues[i];
+				struct bio_list done;
+
+				spin_lock_irq(&nvmeq->q_lock);
+				nvme_process_cq(nvmeq);
+				nvme_cancel_ios(nvmeq, true);
+				nvme_resubmit_bios(nvmeq);
+				done = nvmeq->done;
+				bio_list_init(&nvmeq->done);
+				spin_unlock_irq(&nvmeq->q_lock);
+
+				nvme_end_bios(&done);
+			}
+		}
+		spin_unlock(&dev_list_lock);
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_timeout(HZ);
+	}
+	return 0;
+}
+
+static int __devinit nvme_setup_prp_pools(struct nvme_dev *dev)
+{
+	struct device *dmadev = &dev->pci_dev->dev;
+
+	dev->prp_page_pool = dma_pool_create("prp list page", dmadev,
+						PAGE_SIZE, PAGE_SIZE, 0);
+	if (!dev->prp_page_pool)
+		return -ENOMEM;
+	return 0;
+}
+
+static int __devinit nvme_probe(struct pci_dev *pdev,
+				const struct pci_device_id *id)
+{
+	int bars, result = -ENOMEM;
+	struct nvme_dev *dev;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+	dev->entry = kcalloc(num_possible_cpus(), sizeof(*dev->entry),
+								GFP_KERNEL);
+	if (!dev->entry)
+		goto free;
+	dev->queues = kcalloc(num_possible_cpus() + 1, sizeof(void *),
+								GFP_KERNEL);
+	if (!dev->queues)
+		goto free;
+
+	if (pci_enable_device_mem(pdev))
+		goto free;
+	pci_set_master(pdev);
+	bars = pci_select_bars(pdev, IORESOURCE_MEM);
+	if (pci_request_selected_regions(pdev, bars, "nvme"))
+		goto disable;
+
+	INIT_LIST_HEAD(&dev->namespaces);
+	dev->pci_dev = pdev;
+	pci_set_drvdata(pdev, dev);
+	if (dma_set_mask(&pdev->dev, DMA_BIT_MASK(64)) ||
+	    dma_set_coherent_mask(&pdev->dev, DMA_BIT_MASK(64))) {
+		if (dma_set_mask(&pdev->dev, DMA_BIT_MASK(32)) ||
+		    dma_set_coherent_mask(&pdev->dev, DMA_BIT_MASK(32)))
+			goto release_regions;
+	}
+
+	result = nvme_get_id(&nvme_instance_ida);
+	if (result < 0)
+		goto release_regions;
+	dev->instance = result;
+
+	dev->entry[0].vector = pdev->irq;
+
+	result = nvme_setup_prp_pools(dev);
+	if (result)
+		goto put_instance;
+
+	result = -ENOMEM;
+	dev->bar = ioremap(pci_resource_start(pdev, 0),
+					pci_resource_len(pdev, 0));
+	if (!dev->bar)
+		goto release_pools;
+
+	result = nvme_dev_add(dev);
+	if (result)
+		goto unmap;
+
+	return 0;
+
+ unmap:
+	iounmap(dev->bar);
+ release_pools:
+	dma_pool_destroy(dev->prp_page_pool);
+ put_instance:
+	nvme_put_id(&nvme_instance_ida, dev->instance);
+ release_regions:
+	pci_set_drvdata(pdev, NULL);
+	pci_release_regions(pdev);
+ disable:
+	pci_disable_device(pdev);
+ free:
+	kfree(dev->queues);
+	kfree(dev->entry);
+	kfree(dev);
+	return result;
+}
+
+static void __devexit nvme_remove(struct pci_dev *pdev)
+{
+	struct nvme_dev *dev = pci_get_drvdata(pdev);
+
+	nvme_dev_remove(dev);
+	iounmap(dev->bar);
+	dma_pool_destroy(dev->prp_page_pool);
+	nvme_put_id(&nvme_instance_ida, dev->instance);
+	pci_set_drvdata(pdev, NULL);
+	pci_release_regions(pdev);
+	pci_disable_device(pdev);
+	kfree(dev->queues);
+	kfree(dev->entry);
+	kfree(dev);
+}
+
+static DEFINE_PCI_DEVICE_TABLE(nvme_id_table) = {
+	{ PCI_DEVICE_CLASS(PCI_CLASS_STORAGE_EXPRESS, 0xffffff) },
+	{ 0, }
+};
+MODULE_DEVICE_TABLE(pci, nvme_id_table);
+
+static struct pci_driver nvme_driver = {
+	.name		= "nvme",
+	.id_table	= nvme_id_table,
+	.probe		= nvme_probe,
+	.remove		= __devexit_p(nvme_remove),
+};
+
+static int __init nvme_init(void)
+{
+	int result;
+
+	nvme_thread = kthread_run(nvme_kthread, NULL, "nvme");
+	if (IS_ERR(nvme_thread))
+		return PTR_ERR(nvme_thread);
+
+	result = register_blkdev(nvme_major, "nvme");
+	if (result < 0)
+		goto kill_kthread;
+	else if (result > 0)
+		nvme_major = result;
+
+	result = pci_register_driver(&nvme_driver);
+	if (result)
+		goto unregister_blkdev;
+	return 0;
+
+ unregister_blkdev:
+	unregister_blkdev(nvme_major, "nvme");
+ kill_kthread:
+	kthread_stop(nvme_thread);
+	return result;
+}
+
+static void __exit nvme_exit(void)
+{
+	pci_unregister_driver(&nvme_driver);
+	unregister_blkdev(nvme_major, "nvme");
+	kthread_stop(nvme_thread);
+}
+
+MODULE_LICENSE("GPL");
+MODULE_VERSION("0.1");
+module_init(nvme_init);
+module_exit(nvme_exit);
@@ -0,0 +1,426 @@
+/*
+ *  drivers/cpufreq/cpufreq_schedutil.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A governor driven by the scheduler instead of a sampling timer: the
+ * scheduler calls it from the tick and from the wakeups of each cpu with
+ * the utilization of its runqueue (see cpufreq_set_update_util_data()),
+ * and the frequency is chosen then, for the busiest cpu of the policy:
+ *
+ *	next_freq = 1.25 * max_freq * util / max
+ *
+ * so that a cpu at 80% of the highest frequency gets it.  The change is
+ * made by a realtime kthread of the policy, as the callback may not
+ * sleep, at most once per rate_limit_us.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpu.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#define TRANSITION_LATENCY_LIMIT	(10 * 1000 * 1000)
+
+/* default rate_limit_us, in transition latencies, and at least */
+#define LATENCY_MULTIPLIER		(10)
+#define MIN_RATE_LIMIT_US		(500)
+
+static int cpufreq_governor_schedutil(struct cpufreq_policy *policy,
+				      unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL
+static
+#endif
+struct cpufreq_governor cpufreq_gov_schedutil = {
+	.name			= "schedutil",
+	.governor		= cpufreq_governor_schedutil,
+	.max_transition_latency	= TRANSITION_LATENCY_LIMIT,
+	.owner			= THIS_MODULE,
+};
+
+struct sugov_policy {
+	struct cpufreq_policy *policy;
+
+	/* update_lock protects the fields below, and the sugov_cpu ones */
+	spinlock_t update_lock;
+	u64 last_freq_update_time;	/* runqueue clock of the last request */
+	unsigned int next_freq;
+	ktime_t request_time;		/* when next_freq was asked for */
+	int work_in_progress;
+
+	/* serializes the kthread with GOV_LIMITS */
+	struct mutex work_lock;
+	struct task_struct *thread;
+};
+
+struct sugov_cpu {
+	struct update_util_data update_util;
+	struct sugov_policy *sg_policy;
+
+	/* the last utilization the scheduler gave */
+	unsigned long util, max;
+	u64 last_update;
+};
+static DEFINE_PER_CPU(struct sugov_cpu, sugov_cpu);
+
+static unsigned int sugov_enable;	/* number of policies using us */
+
+/* protects sugov_tunables and sugov_enable */
+static DEFINE_MUTEX(sugov_mutex);
+
+static struct sugov_tunables {
+	unsigned int rate_limit_us;
+} sugov_tunables;
+
+/* the frequency transitions done, from request to completion */
+static DEFINE_SPINLOCK(sugov_stats_lock);
+static struct sugov_stats {
+	unsigned long transitions;
+	u64 latency_total_us;
+	u64 latency_max_us;
+} sugov_stats;
+
+/*
+ * The frequency for the busiest cpu of the policy.  A cpu which has not
+ * been updated for a tick is idle, with its tick stopped, and is left
+ * out.  Called with update_lock held.
+ */
+static unsigned int sugov_next_freq(struct sugov_policy *sg_policy, u64 time)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+	unsigned int freq = policy->cpuinfo.max_freq;
+	unsigned long util = 0, max = 1;
+	unsigned int j;
+
+	for_each_cpu(j, policy->cpus) {
+		struct sugov_cpu *j_sg_cpu = &per_cpu(sugov_cpu, j);
+
+		if ((s64)(time - j_sg_cpu->last_update) > TICK_NSEC)
+			continue;
+		if (j_sg_cpu->util * max > util * j_sg_cpu->max) {
+			util = j_sg_cpu->util;
+			max = j_sg_cpu->max;
+		}
+	}
+
+	return div_u64((u64)(freq + (freq >> 2)) * util, max);
+}
+
+static void sugov_update(struct update_util_data *data, u64 time,
+			 unsigned long util, unsigned long max)
+{
+	struct sugov_cpu *sg_cpu = container_of(data, struct sugov_cpu,
+						update_util);
+	struct sugov_policy *sg_policy = sg_cpu->sg_policy;
+	struct cpufreq_policy *policy = sg_policy->policy;
+	unsigned long flags;
+	unsigned int next_f;
+	int wake = 0;
+
+	spin_lock_irqsave(&sg_policy->update_lock, flags);
+
+	sg_cpu->util = util;
+	sg_cpu->max = max;
+	sg_cpu->last_update = time;
+
+	if (sg_policy->work_in_progress)
+		goto out;
+	if ((s64)(time - sg_policy->last_freq_update_time) <
+	    (s64)sugov_tunables.rate_limit_us * NSEC_PER_USEC)
+		goto out;
+
+	next_f = sugov_next_freq(sg_policy, time);
+	next_f = clamp(next_f, policy->min, policy->max);
+	if (next_f == policy->cur)
+		goto out;
+
+	sg_policy->last_freq_update_time = time;
+	sg_policy->next_freq = next_f;
+	sg_policy->request_time = ktime_get();
+	sg_policy->work_in_progress = 1;
+	wake = 1;
+out:
+	spin_unlock_irqrestore(&sg_policy->update_lock, flags);
+
+	/*
+	 * No runqueue lock is held here.  Waking the thread can call back
+	 * into us, which work_in_progress stops.
+	 */
+	if (wake)
+		wake_up_process(sg_policy->thread);
+}
+
+static void sugov_account_transition(ktime_t request_time)
+{
+	u64 latency = ktime_us_delta(ktime_get(), request_time);
+
+	spin_lock(&sugov_stats_lock);
+	sugov_stats.transitions++;
+	sugov_stats.latency_total_us += latency;
+	if (latency > sugov_stats.latency_max_us)
+		sugov_stats.latency_max_us = latency;
+	spin_unlock(&sugov_stats_lock);
+}
+
+static void sugov_work(struct sugov_policy *sg_policy)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+	unsigned int freq, old_freq;
+	ktime_t request_time;
+	unsigned long flags;
+
+	mutex_lock(&sg_policy->work_lock);
+
+	spin_lock_irqsave(&sg_policy->update_lock, flags);
+	freq = sg_policy->next_freq;
+	request_time = sg_policy->request_time;
+	spin_unlock_irqrestore(&sg_policy->update_lock, flags);
+
+	old_freq = policy->cur;
+	__cpufreq_driver_target(policy, freq, CPUFREQ_RELATION_L);
+	if (policy->cur != old_freq)
+		sugov_account_transition(request_time);
+
+	spin_lock_irqsave(&sg_policy->update_lock, flags);
+	sg_policy->work_in_progress = 0;
+	spin_unlock_irqrestore(&sg_policy->update_lock, flags);
+
+	mutex_unlock(&sg_policy->work_lock);
+}
+
+static int sugov_thread(void *data)
+{
+	struct sugov_policy *sg_policy = data;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (!sg_policy->work_in_progress) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		sugov_work(sg_policy);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/************************** sysfs interface ************************/
+
+static ssize_t show_rate_limit_us(struct kobject *kobj,
+				  struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", sugov_tunables.rate_limit_us);
+}
+
+static ssize_t store_rate_limit_us(struct kobject *a, struct attribute *b,
+				   const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&sugov_mutex);
+	sugov_tunables.rate_limit_us = input;
+	mutex_unlock(&sugov_mutex);
+
+	return count;
+}
+
+static ssize_t show_transitions(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", sugov_stats.transitions);
+}
+
+static ssize_t show_transition_latency_avg_us(struct kobject *kobj,
+					      struct attribute *attr, char *buf)
+{
+	u64 avg = 0;
+
+	spin_lock(&sugov_stats_lock);
+	if (sugov_stats.transitions)
+		avg = div_u64(sugov_stats.latency_total_us,
+			      sugov_stats.transitions);
+	spin_unlock(&sugov_stats_lock);
+
+	return sprintf(buf, "%llu\n", (unsigned long long)avg);
+}
+
+static ssize_t show_transition_latency_max_us(struct kobject *kobj,
+					      struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n",
+		       (unsigned long long)sugov_stats.latency_max_us);
+}
+
+define_one_global_rw(rate_limit_us);
+define_one_global_ro(transitions);
+define_one_global_ro(transition_latency_avg_us);
+define_one_global_ro(transition_latency_max_us);
+
+static struct attribute *sugov_attributes[] = {
+	&rate_limit_us.attr,
+	&transitions.attr,
+	&transition_latency_avg_us.attr,
+	&transition_latency_max_us.attr,
+	NULL
+};
+
+static struct attribute_group sugov_attr_group = {
+	.attrs = sugov_attributes,
+	.name = "schedutil",
+};
+
+/************************** sysfs end ************************/
+
+static struct sugov_policy *sugov_policy_alloc(struct cpufreq_policy *policy)
+{
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	struct sugov_policy *sg_policy;
+
+	sg_policy = kzalloc(sizeof(*sg_policy), GFP_KERNEL);
+	if (!sg_policy)
+		return NULL;
+
+	sg_policy->policy = policy;
+	spin_lock_init(&sg_policy->update_lock);
+	mutex_init(&sg_policy->work_lock);
+
+	sg_policy->thread = kthread_create(sugov_thread, sg_policy,
+					   "sugov/%d", policy->cpu);
+	if (IS_ERR(sg_policy->thread)) {
+		kfree(sg_policy);
+		return NULL;
+	}
+	/* the frequency should follow the load, not wait behind it */
+	sched_setscheduler(sg_policy->thread, SCHED_FIFO, &param);
+	set_cpus_allowed_ptr(sg_policy->thread, policy->cpus);
+	wake_up_process(sg_policy->thread);
+
+	return sg_policy;
+}
+
+static void sugov_policy_free(struct sugov_policy *sg_policy)
+{
+	kthread_stop(sg_policy->thread);
+	mutex_destroy(&sg_policy->work_lock);
+	kfree(sg_policy);
+}
+
+static int cpufreq_governor_schedutil(struct cpufreq_policy *policy,
+				      unsigned int event)
+{
+	struct sugov_policy *sg_policy;
+	unsigned int j;
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu) || !policy->cur)
+			return -EINVAL;
+
+		sg_policy = sugov_policy_alloc(policy);
+		if (!sg_policy)
+			return -ENOMEM;
+
+		mutex_lock(&sugov_mutex);
+		if (!sugov_enable) {
+			unsigned int latency;
+
+			rc = sysfs_create_group(cpufreq_global_kobject,
+						&sugov_attr_group);
+			if (rc) {
+				mutex_unlock(&sugov_mutex);
+				sugov_policy_free(sg_policy);
+				return rc;
+			}
+
+			/* policy latency is in nS. Convert it to uS first */
+			latency = policy->cpuinfo.transition_latency / 1000;
+			sugov_tunables.rate_limit_us =
+				max_t(unsigned int, MIN_RATE_LIMIT_US,
+				      latency * LATENCY_MULTIPLIER);
+		}
+		sugov_enable++;
+		mutex_unlock(&sugov_mutex);
+
+		for_each_cpu(j, policy->cpus) {
+			struct sugov_cpu *j_sg_cpu = &per_cpu(sugov_cpu, j);
+
+			memset(j_sg_cpu, 0, sizeof(*j_sg_cpu));
+			j_sg_cpu->sg_policy = sg_policy;
+			j_sg_cpu->update_util.func = sugov_update;
+			cpufreq_set_update_util_data(j, &j_sg_cpu->update_util);
+		}
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		sg_policy = per_cpu(sugov_cpu, policy->cpu).sg_policy;
+
+		for_each_cpu(j, policy->cpus)
+			cpufreq_set_update_util_data(j, NULL);
+		/* no sugov_update() is running on sg_policy after that */
+		synchronize_sched();
+		sugov_policy_free(sg_policy);
+
+		mutex_lock(&sugov_mutex);
+		sugov_enable--;
+		if (!sugov_enable)
+			sysfs_remove_group(cpufreq_global_kobject,
+					   &sugov_attr_group);
+		mutex_unlock(&sugov_mutex);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		sg_policy = per_cpu(sugov_cpu, policy->cpu).sg_policy;
+
+		mutex_lock(&sg_policy->work_lock);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		mutex_unlock(&sg_policy->work_lock);
+		break;
+	}
+	return 0;
+}
+
+static int __init cpufreq_gov_schedutil_init(void)
+{
+	return cpufreq_register_governor(&cpufreq_gov_schedutil);
+}
+
+static void __exit cpufreq_gov_schedutil_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_schedutil);
+}
+
+MODULE_DESCRIPTION("'cpufreq_schedutil' - A cpufreq governor driven by "
+	"the utilization of the scheduler's runqueues");
+MODULE_LICENSE("GPL");
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL
+fs_initcall(cpufreq_gov_schedutil_init);
+#else
+module_init(cpufreq_gov_schedutil_init);
+#endif
+module_exit(cpufreq_gov_schedutil_exit);
@@ -67,7 +67,8 @@ static int ladder_select_state(struct cpuidle_device *dev)
 	struct ladder_device *ldev = &__get_cpu_var(ladder_devices);
 	struct ladder_device_state *last_state;
 	int last_residency, last_idx = ldev->last_state_idx;
-	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	int latency_req = min(pm_qos_request(PM_QOS_CPU_DMA_LATENCY),
+			      pm_qos_cpu_latency(dev->cpu));
 
 	/* Special case when user has set very strict latency requirement */
 	if (unlikely(latency_req == 0)) {
@@ -25,7 +25,8 @@
 #define RESOLUTION 1024
 #define DECAY 8
 #define MAX_INTERESTING 50000
-#define STDDEV_THRESH 400
+/* stddev, in usecs, below which a set of intervals is always repeating */
+#define STDDEV_MIN 20
 
 
 /*
@@ -74,8 +75,13 @@
  * interrupt mitigation, but also due to fixed transfer rate devices such as
  * mice.
  * For this, we use a different predictor: We track the duration of the last 8
- * intervals and if the stand deviation of these 8 intervals is below a
- * threshold value, we use the average of these intervals as prediction.
+ * intervals and if the stand deviation of these 8 intervals is small compared
+ * to their average, we use the average of these intervals as prediction.
+ * A repeating pattern is often broken by a few unrelated wakeups (a timer,
+ * another device), so the longest intervals are thrown out one by one as
+ * long as at least 6 of the 8 are left, to find a pattern in the others.
+ * The pattern only ever shortens the prediction: a deeper state than the
+ * next timer and the correction factor allow is never chosen for it.
  *
  * Limiting Performance Impact
  * ---------------------------
@@ -192,38 +198,64 @@ static u64 div_round64(u64 dividend, u32 divisor)
 
 /*
  * Try detecting repeating patterns by keeping track of the last 8
- * intervals, and checking if the standard deviation of that set
- * of points is below a threshold. If it is... then use the
- * average of these 8 points as the estimated value.
+ * intervals, and checking if the standard deviation of that set of
+ * points is small compared to their average.  If it is not, retry
+ * without the longest of the points, down to 6 of them.  If a pattern
+ * is found, use the average of its points as the estimated value.
  */
 static void detect_repeating_patterns(struct menu_device *data)
 {
-	int i;
-	uint64_t avg = 0;
-	uint64_t stddev = 0; /* contains the square of the std deviation */
+	int i, divisor;
+	unsigned int max, thresh = UINT_MAX;
+	uint64_t avg, stddev;
 
+again:
 	/* first calculate average and standard deviation of the past */
-	for (i = 0; i < INTERVALS; i++)
-		avg += data->intervals[i];
-	avg = avg / INTERVALS;
+	avg = 0;
+	max = 0;
+	divisor = 0;
+	for (i = 0; i < INTERVALS; i++) {
+		unsigned int value = data->intervals[i];
+
+		if (value <= thresh) {
+			avg += value;
+			divisor++;
+			if (value > max)
+				max = value;
+		}
+	}
+	avg = div_u64(avg, divisor);
 
-	/* if the avg is beyond the known next tick, it's worthless */
-	if (avg > data->expected_us)
-		return;
+	stddev = 0;
+	for (i = 0; i < INTERVALS; i++) {
+		unsigned int value = data->intervals[i];
 
-	for (i = 0; i < INTERVALS; i++)
-		stddev += (data->intervals[i] - avg) *
-			  (data->intervals[i] - avg);
+		if (value <= thresh) {
+			int64_t diff = value - avg;
 
-	stddev = stddev / INTERVALS;
+			stddev += diff * diff;
+		}
+	}
+	stddev = int_sqrt(div_u64(stddev, divisor));
 
 	/*
 	 * now.. if stddev is small.. then assume we have a
 	 * repeating pattern and predict we keep doing this.
+	 * With points thrown out, 3/4 of them must be left.
 	 */
+	if (avg && ((avg > stddev * 6 && divisor * 4 >= INTERVALS * 3) ||
+		    stddev <= STDDEV_MIN)) {
+		/* if the avg is beyond the known next tick, it's worthless */
+		if (avg <= data->expected_us && avg < data->predicted_us)
+			data->predicted_us = avg;
+		return;
+	}
 
-	if (avg && stddev < STDDEV_THRESH)
-		data->predicted_us = avg;
+	/* else drop the longest point, a wakeup outside the pattern */
+	if (divisor * 4 > INTERVALS * 3) {
+		thresh = max - 1;
+		goto again;
+	}
 }
 
 /**
@@ -233,7 +265,8 @@ static void detect_repeating_patterns(struct menu_device *data)
 static int menu_select(struct cpuidle_device *dev)
 {
 	struct menu_device *data = &__get_cpu_var(menu_devices);
-	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	int latency_req = min(pm_qos_request(PM_QOS_CPU_DMA_LATENCY),
+			      pm_qos_cpu_latency(dev->cpu));
 	unsigned int power_usage = -1;
 	int i;
 	int multiplier;
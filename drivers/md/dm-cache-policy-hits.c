@@ -0,0 +1,202 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Hit count cache policy: an origin block is promoted once it missed
+ * the cache promote_threshold times, the least recently used cache
+ * block is evicted for it.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+
+#define DM_MSG_PREFIX "cache hits"
+
+#define HITS_DEFAULT_THRESHOLD	2
+
+/*
+ * The misses of the uncached blocks are counted in a direct mapped
+ * table, twice as large as the cache: a block evicting another from its
+ * slot starts again from zero, which keeps one-off accesses out.
+ */
+struct hits_counter {
+	dm_oblock_t oblock;
+	unsigned int misses;
+};
+
+struct hits_policy {
+	struct list_head lru;		/* mapped cache blocks, coldest first */
+	struct list_head *entries;	/* indexed by cache block */
+
+	struct hits_counter *counters;
+	unsigned int counters_shift;
+
+	unsigned int promote_threshold;
+};
+
+static void hits_hit(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct hits_policy *hp = p->context;
+
+	list_move_tail(&hp->entries[cblock], &hp->lru);
+}
+
+static int hits_miss(struct dm_cache_policy *p, dm_oblock_t oblock, int rw)
+{
+	struct hits_policy *hp = p->context;
+	struct hits_counter *c;
+
+	c = &hp->counters[hash_64(oblock, hp->counters_shift)];
+	if (c->oblock != oblock) {
+		c->oblock = oblock;
+		c->misses = 0;
+	}
+
+	if (++c->misses < hp->promote_threshold)
+		return 0;
+
+	c->misses = 0;
+	return 1;
+}
+
+static void hits_insert(struct dm_cache_policy *p, dm_cblock_t cblock,
+			dm_oblock_t oblock)
+{
+	struct hits_policy *hp = p->context;
+
+	list_add_tail(&hp->entries[cblock], &hp->lru);
+}
+
+static void hits_remove(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct hits_policy *hp = p->context;
+
+	list_del_init(&hp->entries[cblock]);
+}
+
+static int hits_victim(struct dm_cache_policy *p, dm_cblock_t *cblock)
+{
+	struct hits_policy *hp = p->context;
+
+	if (list_empty(&hp->lru))
+		return -ENOSPC;
+
+	*cblock = hp->lru.next - hp->entries;
+	return 0;
+}
+
+static int hits_status(struct dm_cache_policy *p, status_type_t type,
+		       char *result, unsigned int maxlen)
+{
+	struct hits_policy *hp = p->context;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("0 ");
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("1 %u ", hp->promote_threshold);
+		break;
+	}
+
+	return sz;
+}
+
+static void hits_free(struct hits_policy *hp)
+{
+	vfree(hp->entries);
+	vfree(hp->counters);
+	kfree(hp);
+}
+
+static int hits_create(struct dm_cache_policy *p, dm_cblock_t nr_cblocks,
+		       unsigned argc, char **argv)
+{
+	struct hits_policy *hp;
+	unsigned threshold = HITS_DEFAULT_THRESHOLD;
+	dm_cblock_t i;
+	char dummy;
+
+	if (argc > 1)
+		return -EINVAL;
+
+	if (argc && (sscanf(argv[0], "%u%c", &threshold, &dummy) != 1 ||
+		     !threshold))
+		return -EINVAL;
+
+	hp = kzalloc(sizeof(*hp), GFP_KERNEL);
+	if (!hp)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&hp->lru);
+	hp->promote_threshold = threshold;
+	hp->counters_shift = ilog2(roundup_pow_of_two(nr_cblocks)) + 1;
+
+	hp->entries = vmalloc(nr_cblocks * sizeof(*hp->entries));
+	hp->counters = vmalloc(sizeof(*hp->counters) << hp->counters_shift);
+	if (!hp->entries || !hp->counters) {
+		hits_free(hp);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_cblocks; i++)
+		INIT_LIST_HEAD(&hp->entries[i]);
+	for (i = 0; i < (1U << hp->counters_shift); i++) {
+		hp->counters[i].oblock = (dm_oblock_t)-1;
+		hp->counters[i].misses = 0;
+	}
+
+	p->context = hp;
+	return 0;
+}
+
+static void hits_destroy(struct dm_cache_policy *p)
+{
+	hits_free(p->context);
+	p->context = NULL;
+}
+
+static struct dm_cache_policy_type hits_policy_type = {
+	.name = "hits",
+	.module = THIS_MODULE,
+	.table_args = 1,
+	.create = hits_create,
+	.destroy = hits_destroy,
+	.hit = hits_hit,
+	.miss = hits_miss,
+	.insert = hits_insert,
+	.remove = hits_remove,
+	.victim = hits_victim,
+	.status = hits_status,
+};
+
+static int __init dm_cache_hits_init(void)
+{
+	int r = dm_cache_policy_register(&hits_policy_type);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	DMINFO("version 1.0.0 loaded");
+
+	return r;
+}
+
+static void __exit dm_cache_hits_exit(void)
+{
+	int r = dm_cache_policy_unregister(&hits_policy_type);
+
+	if (r < 0)
+		DMERR("unregister failed %d", r);
+}
+
+module_init(dm_cache_hits_init);
+module_exit(dm_cache_hits_exit);
+
+MODULE_DESCRIPTION(DM_NAME " hit count cache policy");
+MODULE_LICENSE("GPL");
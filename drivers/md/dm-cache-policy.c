@@ -0,0 +1,131 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/module.h>
+#include <linux/slab.h>
+
+struct cp_internal {
+	struct dm_cache_policy_type cpt;
+	struct list_head list;
+};
+
+static LIST_HEAD(_cache_policies);
+static DECLARE_RWSEM(_cp_lock);
+
+static struct cp_internal *__find_cache_policy_type(const char *name)
+{
+	struct cp_internal *cpi;
+
+	list_for_each_entry(cpi, &_cache_policies, list) {
+		if (!strcmp(name, cpi->cpt.name))
+			return cpi;
+	}
+
+	return NULL;
+}
+
+static struct cp_internal *get_cache_policy(const char *name)
+{
+	struct cp_internal *cpi;
+
+	down_read(&_cp_lock);
+	cpi = __find_cache_policy_type(name);
+	if (cpi && !try_module_get(cpi->cpt.module))
+		cpi = NULL;
+	up_read(&_cp_lock);
+
+	return cpi;
+}
+
+struct dm_cache_policy_type *dm_cache_policy_get(const char *name)
+{
+	struct cp_internal *cpi;
+
+	if (!name)
+		return NULL;
+
+	cpi = get_cache_policy(name);
+	if (!cpi) {
+		request_module("dm-cache-%s", name);
+		cpi = get_cache_policy(name);
+	}
+
+	return cpi ? &cpi->cpt : NULL;
+}
+
+void dm_cache_policy_put(struct dm_cache_policy_type *cpt)
+{
+	struct cp_internal *cpi;
+
+	if (!cpt)
+		return;
+
+	down_read(&_cp_lock);
+	cpi = __find_cache_policy_type(cpt->name);
+	if (!cpi)
+		goto out;
+
+	module_put(cpi->cpt.module);
+out:
+	up_read(&_cp_lock);
+}
+
+static struct cp_internal *_alloc_cache_policy(struct dm_cache_policy_type *cpt)
+{
+	struct cp_internal *cpi = kzalloc(sizeof(*cpi), GFP_KERNEL);
+
+	if (cpi)
+		cpi->cpt = *cpt;
+
+	return cpi;
+}
+
+int dm_cache_policy_register(struct dm_cache_policy_type *cpt)
+{
+	int r = 0;
+	struct cp_internal *cpi = _alloc_cache_policy(cpt);
+
+	if (!cpi)
+		return -ENOMEM;
+
+	down_write(&_cp_lock);
+
+	if (__find_cache_policy_type(cpt->name)) {
+		kfree(cpi);
+		r = -EEXIST;
+	} else
+		list_add(&cpi->list, &_cache_policies);
+
+	up_write(&_cp_lock);
+
+	return r;
+}
+
+int dm_cache_policy_unregister(struct dm_cache_policy_type *cpt)
+{
+	struct cp_internal *cpi;
+
+	down_write(&_cp_lock);
+
+	cpi = __find_cache_policy_type(cpt->name);
+	if (!cpi) {
+		up_write(&_cp_lock);
+		return -EINVAL;
+	}
+
+	list_del(&cpi->list);
+
+	up_write(&_cp_lock);
+
+	kfree(cpi);
+
+	return 0;
+}
+
+EXPORT_SYMBOL_GPL(dm_cache_policy_register);
+EXPORT_SYMBOL_GPL(dm_cache_policy_unregister);
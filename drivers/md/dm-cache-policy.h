@@ -0,0 +1,91 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#ifndef DM_CACHE_POLICY_H
+#define DM_CACHE_POLICY_H
+
+#include <linux/device-mapper.h>
+
+/*
+ * Blocks of the origin device, and of the cache device holding copies
+ * of some of them.
+ */
+typedef sector_t dm_oblock_t;
+typedef u32 dm_cblock_t;
+
+/*
+ * The policy decides which origin blocks are hot enough to be promoted
+ * to the cache, and which cache block to reuse for them.  The target
+ * keeps the mappings, the policy only sees them go by.
+ *
+ * All the functions but create and destroy are called with the cache
+ * lock held and must not sleep.
+ */
+struct dm_cache_policy_type;
+struct dm_cache_policy {
+	struct dm_cache_policy_type *type;
+	void *context;
+};
+
+struct dm_cache_policy_type {
+	char *name;
+	struct module *module;
+
+	unsigned int table_args;
+
+	/*
+	 * Constructs a policy for a cache of nr_cblocks blocks, takes
+	 * custom arguments
+	 */
+	int (*create) (struct dm_cache_policy *p, dm_cblock_t nr_cblocks,
+		       unsigned argc, char **argv);
+	void (*destroy) (struct dm_cache_policy *p);
+
+	/*
+	 * An io hit the cached cblock.
+	 */
+	void (*hit) (struct dm_cache_policy *p, dm_cblock_t cblock);
+
+	/*
+	 * An io of direction rw missed the cache on oblock.  Returns 1 if
+	 * the block should be promoted.
+	 */
+	int (*miss) (struct dm_cache_policy *p, dm_oblock_t oblock, int rw);
+
+	/*
+	 * cblock now holds oblock, after a promotion or when the mappings
+	 * are loaded; or it was emptied.
+	 */
+	void (*insert) (struct dm_cache_policy *p, dm_cblock_t cblock,
+			dm_oblock_t oblock);
+	void (*remove) (struct dm_cache_policy *p, dm_cblock_t cblock);
+
+	/*
+	 * The mapped block to evict next.  Returns -ENOSPC if there is
+	 * none.  The target may decline it, if the block is in use.
+	 */
+	int (*victim) (struct dm_cache_policy *p, dm_cblock_t *cblock);
+
+	/*
+	 * Table content based on the creation args, or policy status
+	 */
+	int (*status) (struct dm_cache_policy *p, status_type_t type,
+		       char *result, unsigned int maxlen);
+};
+
+/* Register a cache policy */
+int dm_cache_policy_register(struct dm_cache_policy_type *type);
+
+/* Unregister a cache policy */
+int dm_cache_policy_unregister(struct dm_cache_policy_type *type);
+
+/* Returns a registered cache policy type */
+struct dm_cache_policy_type *dm_cache_policy_get(const char *name);
+
+/* Releases a cache policy type */
+void dm_cache_policy_put(struct dm_cache_policy_type *type);
+
+#endif
@@ -0,0 +1,1273 @@
+/*
+ * This file is released under the GPL.
+ *
+ * A target using a fast device as a cache of the hot blocks of a slow
+ * origin device.
+ *
+ * The cache device is split in blocks of block_size sectors, each of
+ * which may hold a copy of an origin block.  A cache policy decides which
+ * origin blocks are promoted to the cache, and which cached block makes
+ * room for them.  In writeback mode the writes to a cached block only go
+ * to the cache, and the block is copied back to the origin later; in
+ * writethrough mode they go to both.  Promotions and writebacks are done
+ * by kcopyd, the bios to a block being migrated wait for it.
+ *
+ * The mappings are kept on a metadata device, updated before a cache
+ * block is reused for another origin block and after it was filled.  The
+ * dirty bits are only written on suspend: after a crash, all the cached
+ * blocks of a writeback cache count as dirty.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mempool.h>
+#include <linux/hash.h>
+#include <linux/workqueue.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include <linux/device-mapper.h>
+
+#include "dm-cache-policy.h"
+
+#define DM_MSG_PREFIX "cache"
+
+/*-----------------------------------------------------------------
+ * On disk metadata: a superblock, then an array with the mapping of
+ * each cache block, in blocks of METADATA_BLOCK_SIZE bytes.
+ *---------------------------------------------------------------*/
+#define CACHE_MAGIC		0x43616368
+#define CACHE_VERSION		1
+
+#define METADATA_BLOCK_SIZE	4096
+#define METADATA_BLOCK_SECTORS	(METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+#define ENTRIES_PER_BLOCK	(METADATA_BLOCK_SIZE / sizeof(__le64))
+
+/* superblock flags */
+#define SB_CLEAN_SHUTDOWN	(1 << 0)
+#define SB_WRITETHROUGH		(1 << 1)
+
+struct disk_super {
+	__le32 magic;
+	__le32 version;
+	__le32 flags;
+	__le32 block_size;
+	__le64 nr_cblocks;
+} __packed;
+
+/* an entry is the origin block, and these */
+#define ENTRY_VALID		(1ULL << 63)
+#define ENTRY_DIRTY		(1ULL << 62)
+#define ENTRY_OBLOCK_MASK	(ENTRY_DIRTY - 1)
+
+/*-----------------------------------------------------------------
+ * In core state
+ *---------------------------------------------------------------*/
+#define MIN_BLOCK_SIZE		8
+#define MAX_BLOCK_SIZE		2048
+#define MIN_IOS			256
+#define MAX_MIGRATIONS		16
+#define COPY_PAGES		256
+#define WRITE_SLOTS_SHIFT	8
+#define DIRTY_SCAN		1024
+#define DEFAULT_DIRTY_THRESHOLD	50
+
+/* cblock flags */
+enum {
+	CB_VALID,		/* holds the data of oblock */
+	CB_DIRTY,		/* newer than the origin */
+	CB_BUSY,		/* being migrated, no io */
+};
+
+struct cblock {
+	struct hlist_node hlist;	/* in the mapping hash, when busy or valid */
+	struct list_head list;		/* in the free list */
+	dm_oblock_t oblock;
+	unsigned long flags;
+	atomic_t inflight;
+};
+
+struct cache {
+	struct dm_target *ti;
+	struct dm_dev *metadata_dev;
+	struct dm_dev *cache_dev;
+	struct dm_dev *origin_dev;
+
+	sector_t block_size;
+	unsigned block_shift;
+	dm_cblock_t nr_cblocks;
+	sector_t origin_sectors;
+	int writethrough;
+
+	/* protects the mappings, the lists and the counters below */
+	spinlock_t lock;
+	struct cblock *cblocks;
+	struct hlist_head *buckets;
+	unsigned hash_shift;
+	struct list_head free;
+	dm_cblock_t nr_free;
+	dm_cblock_t nr_dirty;
+	dm_cblock_t dirty_cursor;
+	unsigned nr_migrations;
+	int quiescing;
+
+	struct list_head deferred;	/* per_bio_data waiting for a block */
+	struct list_head quiesce;	/* migrations waiting for io to drain */
+	struct list_head completed;	/* migrations copied */
+	wait_queue_head_t migration_wait;
+
+	/* uncached writes in flight, hashed by origin block */
+	atomic_t origin_writes[1 << WRITE_SLOTS_SHIFT];
+
+	unsigned dirty_threshold;	/* % of the cache dirty before writeback */
+
+	mempool_t *migration_pool;
+	mempool_t *per_bio_pool;
+	struct bio_set *bs;
+	struct dm_kcopyd_client *copier;
+	struct dm_io_client *io_client;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	void *md_block;			/* metadata io buffer, worker only */
+
+	struct dm_cache_policy policy;
+
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t promotion;
+	atomic_t demotion;
+	atomic_t writeback;
+};
+
+struct dm_cache_migration {
+	struct list_head list;
+	struct cache *cache;
+	dm_cblock_t cblock;
+	dm_oblock_t oblock;
+	unsigned writeback:1;	/* else a promotion */
+	unsigned demote:1;	/* the cblock was taken from another oblock */
+	int err;
+};
+
+struct per_bio_data {
+	struct list_head list;
+	struct cache *cache;
+	struct bio *bio;
+	dm_cblock_t cblock;	/* NO_CBLOCK if to the origin */
+	int wslot;		/* -1 unless an uncached write */
+	unsigned accounted:1;
+	unsigned writethrough:1;
+	unsigned origin_done:1;
+	atomic_t pending;
+	int error;
+};
+
+#define NO_CBLOCK	((dm_cblock_t)-1)
+
+static struct kmem_cache *_migration_cache;
+static struct kmem_cache *_per_bio_cache;
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static inline dm_cblock_t cblock_index(struct cache *cache, struct cblock *cb)
+{
+	return cb - cache->cblocks;
+}
+
+static inline dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return (bio->bi_sector - cache->ti->begin) >> cache->block_shift;
+}
+
+static inline int write_slot(dm_oblock_t oblock)
+{
+	return hash_64(oblock, WRITE_SLOTS_SHIFT);
+}
+
+/*-----------------------------------------------------------------
+ * Mapping hash, under the cache lock
+ *---------------------------------------------------------------*/
+static struct hlist_head *mapping_bucket(struct cache *cache,
+					 dm_oblock_t oblock)
+{
+	return &cache->buckets[hash_64(oblock, cache->hash_shift)];
+}
+
+static struct cblock *lookup_mapping(struct cache *cache, dm_oblock_t oblock)
+{
+	struct hlist_node *node;
+	struct cblock *cb;
+
+	hlist_for_each_entry(cb, node, mapping_bucket(cache, oblock), hlist)
+		if (cb->oblock == oblock)
+			return cb;
+
+	return NULL;
+}
+
+static void insert_mapping(struct cache *cache, struct cblock *cb,
+			   dm_oblock_t oblock)
+{
+	cb->oblock = oblock;
+	hlist_add_head(&cb->hlist, mapping_bucket(cache, oblock));
+}
+
+static void free_cblock(struct cache *cache, struct cblock *cb)
+{
+	cb->flags = 0;
+	list_add(&cb->list, &cache->free);
+	cache->nr_free++;
+}
+
+static int over_dirty_threshold(struct cache *cache)
+{
+	return (u64)cache->nr_dirty * 100 >
+		(u64)cache->nr_cblocks * cache->dirty_threshold;
+}
+
+/*-----------------------------------------------------------------
+ * Metadata io, from the constructor, the worker or on suspend: never
+ * concurrently.
+ *---------------------------------------------------------------*/
+static int metadata_io(struct cache *cache, sector_t block, int rw)
+{
+	struct dm_io_region where = {
+		.bdev = cache->metadata_dev->bdev,
+		.sector = block * METADATA_BLOCK_SECTORS,
+		.count = METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = cache->md_block,
+		.client = cache->io_client,
+		.notify.fn = NULL,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static int write_super(struct cache *cache, unsigned flags)
+{
+	struct disk_super *ds = cache->md_block;
+
+	memset(cache->md_block, 0, METADATA_BLOCK_SIZE);
+	ds->magic = cpu_to_le32(CACHE_MAGIC);
+	ds->version = cpu_to_le32(CACHE_VERSION);
+	ds->flags = cpu_to_le32(flags);
+	ds->block_size = cpu_to_le32(cache->block_size);
+	ds->nr_cblocks = cpu_to_le64(cache->nr_cblocks);
+
+	return metadata_io(cache, 0, WRITE_FLUSH_FUA);
+}
+
+static __le64 encode_entry(struct cblock *cb)
+{
+	u64 entry = 0;
+
+	if (test_bit(CB_VALID, &cb->flags)) {
+		entry = cb->oblock | ENTRY_VALID;
+		if (test_bit(CB_DIRTY, &cb->flags))
+			entry |= ENTRY_DIRTY;
+	}
+
+	return cpu_to_le64(entry);
+}
+
+/*
+ * Write the metadata block holding the entry of cblock, as the in core
+ * state of its cblocks is now.
+ */
+static int write_mapping(struct cache *cache, dm_cblock_t cblock)
+{
+	dm_cblock_t first = cblock - cblock % ENTRIES_PER_BLOCK;
+	__le64 *entries = cache->md_block;
+	dm_cblock_t i;
+
+	memset(cache->md_block, 0, METADATA_BLOCK_SIZE);
+
+	spin_lock(&cache->lock);
+	for (i = first; i < cache->nr_cblocks && i < first + ENTRIES_PER_BLOCK; i++)
+		entries[i - first] = encode_entry(&cache->cblocks[i]);
+	spin_unlock(&cache->lock);
+
+	return metadata_io(cache, 1 + cblock / ENTRIES_PER_BLOCK, WRITE_SYNC);
+}
+
+static int write_all_mappings(struct cache *cache)
+{
+	dm_cblock_t cblock;
+	int r;
+
+	for (cblock = 0; cblock < cache->nr_cblocks; cblock += ENTRIES_PER_BLOCK) {
+		r = write_mapping(cache, cblock);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static int format_metadata(struct cache *cache)
+{
+	int r = write_all_mappings(cache);
+
+	if (r)
+		return r;
+
+	return write_super(cache, SB_CLEAN_SHUTDOWN);
+}
+
+/*
+ * Read the mappings back, after a crash all the cached blocks of a
+ * writeback cache are dirty.
+ */
+static int load_metadata(struct cache *cache, char **error)
+{
+	struct disk_super *ds = cache->md_block;
+	dm_cblock_t cblock, first;
+	__le64 *entries = cache->md_block;
+	u64 entry;
+	unsigned flags;
+	int r, all_dirty;
+
+	r = metadata_io(cache, 0, READ);
+	if (r) {
+		*error = "Couldn't read metadata superblock";
+		return r;
+	}
+
+	if (le32_to_cpu(ds->magic) != CACHE_MAGIC) {
+		r = format_metadata(cache);
+		if (r)
+			*error = "Couldn't format metadata";
+		return r;
+	}
+
+	if (le32_to_cpu(ds->version) != CACHE_VERSION ||
+	    le32_to_cpu(ds->block_size) != cache->block_size ||
+	    le64_to_cpu(ds->nr_cblocks) != cache->nr_cblocks) {
+		*error = "Metadata does not match the cache geometry";
+		return -EINVAL;
+	}
+
+	flags = le32_to_cpu(ds->flags);
+	all_dirty = !(flags & (SB_CLEAN_SHUTDOWN | SB_WRITETHROUGH));
+
+	for (first = 0; first < cache->nr_cblocks; first += ENTRIES_PER_BLOCK) {
+		r = metadata_io(cache, 1 + first / ENTRIES_PER_BLOCK, READ);
+		if (r) {
+			*error = "Couldn't read mappings";
+			return r;
+		}
+
+		for (cblock = first; cblock < cache->nr_cblocks &&
+		     cblock < first + ENTRIES_PER_BLOCK; cblock++) {
+			struct cblock *cb = &cache->cblocks[cblock];
+
+			entry = le64_to_cpu(entries[cblock - first]);
+			if (!(entry & ENTRY_VALID) ||
+			    ((entry & ENTRY_OBLOCK_MASK) << cache->block_shift) >=
+			    cache->origin_sectors)
+				continue;
+
+			list_del(&cb->list);
+			cache->nr_free--;
+			insert_mapping(cache, cb, entry & ENTRY_OBLOCK_MASK);
+			__set_bit(CB_VALID, &cb->flags);
+			if ((entry & ENTRY_DIRTY) || all_dirty) {
+				__set_bit(CB_DIRTY, &cb->flags);
+				cache->nr_dirty++;
+			}
+			cache->policy.type->insert(&cache->policy, cblock,
+						   cb->oblock);
+		}
+	}
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Migrations
+ *---------------------------------------------------------------*/
+
+/*
+ * Start writing back a dirty block, with the cache lock held
+ */
+static void start_writeback(struct cache *cache, struct dm_cache_migration *mg,
+			    struct cblock *cb)
+{
+	__set_bit(CB_BUSY, &cb->flags);
+
+	mg->cache = cache;
+	mg->cblock = cblock_index(cache, cb);
+	mg->oblock = cb->oblock;
+	mg->writeback = 1;
+	mg->demote = 0;
+	mg->err = 0;
+	list_add_tail(&mg->list, &cache->quiesce);
+	cache->nr_migrations++;
+}
+
+/*
+ * Start promoting oblock, with the cache lock held.  Returns 1 if it
+ * was, 0 if not; *mgp is set to NULL if the migration was used, for the
+ * promotion or to write back the victim.
+ */
+static int start_promotion(struct cache *cache,
+			   struct dm_cache_migration **mgp, dm_oblock_t oblock)
+{
+	struct dm_cache_migration *mg = *mgp;
+	dm_cblock_t victim;
+	struct cblock *cb;
+	int demote = 0;
+
+	if (cache->quiescing || cache->nr_migrations >= MAX_MIGRATIONS)
+		return 0;
+
+	if (list_empty(&cache->free)) {
+		if (cache->policy.type->victim(&cache->policy, &victim))
+			return 0;
+
+		cb = &cache->cblocks[victim];
+		if (test_bit(CB_BUSY, &cb->flags) || atomic_read(&cb->inflight))
+			return 0;
+
+		if (test_bit(CB_DIRTY, &cb->flags)) {
+			/* it has to be clean before it can be reused */
+			start_writeback(cache, mg, cb);
+			*mgp = NULL;
+			return 0;
+		}
+
+		hlist_del(&cb->hlist);
+		cache->policy.type->remove(&cache->policy, victim);
+		__clear_bit(CB_VALID, &cb->flags);
+		atomic_inc(&cache->demotion);
+		demote = 1;
+	} else {
+		cb = list_first_entry(&cache->free, struct cblock, list);
+		list_del_init(&cb->list);
+		cache->nr_free--;
+	}
+
+	/* lookups now find it busy, and defer */
+	insert_mapping(cache, cb, oblock);
+	__set_bit(CB_BUSY, &cb->flags);
+
+	mg->cache = cache;
+	mg->cblock = cblock_index(cache, cb);
+	mg->oblock = oblock;
+	mg->writeback = 0;
+	mg->demote = demote;
+	mg->err = 0;
+	list_add_tail(&mg->list, &cache->quiesce);
+	cache->nr_migrations++;
+	*mgp = NULL;
+
+	return 1;
+}
+
+/*
+ * The io started before the migration has completed, with the cache
+ * lock held.
+ */
+static int migration_quiesced(struct cache *cache,
+			      struct dm_cache_migration *mg)
+{
+	if (mg->writeback)
+		return !atomic_read(&cache->cblocks[mg->cblock].inflight);
+
+	return !atomic_read(&cache->origin_writes[write_slot(mg->oblock)]);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct dm_cache_migration *mg = context;
+	struct cache *cache = mg->cache;
+
+	if (read_err || write_err)
+		mg->err = -EIO;
+
+	spin_lock(&cache->lock);
+	list_add_tail(&mg->list, &cache->completed);
+	spin_unlock(&cache->lock);
+
+	wake_worker(cache);
+}
+
+static void issue_copy(struct cache *cache, struct dm_cache_migration *mg)
+{
+	struct dm_io_region o_region, c_region;
+	int r;
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.sector = mg->oblock << cache->block_shift;
+	o_region.count = min(cache->block_size,
+			     cache->origin_sectors - o_region.sector);
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t)mg->cblock << cache->block_shift;
+	c_region.count = o_region.count;
+
+	/* the old mapping of a demoted block goes before its data */
+	if (mg->demote && write_mapping(cache, mg->cblock)) {
+		mg->err = -EIO;
+		copy_complete(0, 0, mg);
+		return;
+	}
+
+	if (mg->writeback)
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region, 0,
+				   copy_complete, mg);
+	else
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region, 0,
+				   copy_complete, mg);
+	if (r < 0) {
+		mg->err = r;
+		copy_complete(0, 0, mg);
+	}
+}
+
+static void complete_migration(struct cache *cache,
+			       struct dm_cache_migration *mg)
+{
+	struct cblock *cb = &cache->cblocks[mg->cblock];
+
+	if (!mg->writeback && !mg->err) {
+		spin_lock(&cache->lock);
+		__set_bit(CB_VALID, &cb->flags);
+		spin_unlock(&cache->lock);
+
+		mg->err = write_mapping(cache, mg->cblock);
+		if (mg->err)
+			DMERR("Couldn't write the mapping of block %u",
+			      mg->cblock);
+	}
+
+	spin_lock(&cache->lock);
+	if (mg->writeback) {
+		if (!mg->err) {
+			__clear_bit(CB_DIRTY, &cb->flags);
+			cache->nr_dirty--;
+			atomic_inc(&cache->writeback);
+		}
+		__clear_bit(CB_BUSY, &cb->flags);
+	} else if (mg->err) {
+		hlist_del(&cb->hlist);
+		free_cblock(cache, cb);
+	} else {
+		__clear_bit(CB_BUSY, &cb->flags);
+		cache->policy.type->insert(&cache->policy, mg->cblock,
+					   mg->oblock);
+		atomic_inc(&cache->promotion);
+	}
+	cache->nr_migrations--;
+	spin_unlock(&cache->lock);
+
+	wake_up(&cache->migration_wait);
+	mempool_free(mg, cache->migration_pool);
+}
+
+/*
+ * Write back dirty blocks while too many of the blocks are, or while any
+ * is in writethrough mode.
+ */
+static void writeback_some(struct cache *cache)
+{
+	struct dm_cache_migration *mg = NULL;
+	unsigned scanned = 0;
+	struct cblock *cb;
+
+	spin_lock(&cache->lock);
+	while (!cache->quiescing && cache->nr_migrations < MAX_MIGRATIONS &&
+	       cache->nr_dirty && scanned++ < DIRTY_SCAN &&
+	       (cache->writethrough || over_dirty_threshold(cache))) {
+		if (++cache->dirty_cursor >= cache->nr_cblocks)
+			cache->dirty_cursor = 0;
+		cb = &cache->cblocks[cache->dirty_cursor];
+
+		if (!test_bit(CB_DIRTY, &cb->flags) ||
+		    test_bit(CB_BUSY, &cb->flags))
+			continue;
+
+		if (!mg)
+			mg = mempool_alloc(cache->migration_pool, GFP_NOWAIT);
+		if (!mg)
+			break;
+
+		start_writeback(cache, mg, cb);
+		mg = NULL;
+	}
+	spin_unlock(&cache->lock);
+
+	if (mg)
+		mempool_free(mg, cache->migration_pool);
+}
+
+/*-----------------------------------------------------------------
+ * Bio processing
+ *---------------------------------------------------------------*/
+/*
+ * A deferred bio is counted once, as a miss if it waited for its
+ * promotion.
+ */
+static void account_bio(struct cache *cache, struct per_bio_data *pb,
+			int rw, int hit)
+{
+	if (pb->accounted)
+		return;
+	pb->accounted = 1;
+
+	if (rw == WRITE)
+		atomic_inc(hit ? &cache->write_hit : &cache->write_miss);
+	else
+		atomic_inc(hit ? &cache->read_hit : &cache->read_miss);
+}
+
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+	bio->bi_sector = bio->bi_sector - cache->ti->begin;
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t offset = (bio->bi_sector - cache->ti->begin) &
+			  (cache->block_size - 1);
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t)cblock << cache->block_shift) + offset;
+}
+
+static void writethrough_endio(struct bio *clone, int error)
+{
+	struct per_bio_data *pb = clone->bi_private;
+
+	if (error)
+		pb->error = error;
+	bio_put(clone);
+
+	if (atomic_dec_and_test(&pb->pending))
+		bio_endio(pb->bio, pb->error);
+}
+
+/*
+ * A writethrough write hit: a clone goes to the cache block, the bio
+ * itself to the origin, and it completes once both are done.
+ */
+static void issue_writethrough(struct cache *cache, struct bio *bio,
+			       struct per_bio_data *pb, struct bio *clone)
+{
+	__bio_clone(clone, bio);
+	remap_to_cache(cache, clone, pb->cblock);
+	clone->bi_end_io = writethrough_endio;
+	clone->bi_private = pb;
+
+	pb->writethrough = 1;
+	atomic_set(&pb->pending, 2);
+	remap_to_origin(cache, bio);
+	generic_make_request(clone);
+}
+
+/*
+ * Returns DM_MAPIO_REMAPPED with the bio remapped, or DM_MAPIO_SUBMITTED
+ * if it waits for a migration.
+ */
+static int process_bio(struct cache *cache, struct per_bio_data *pb)
+{
+	struct bio *bio = pb->bio;
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	struct dm_cache_migration *mg;
+	struct bio *clone = NULL;
+	int rw = bio_data_dir(bio);
+	struct cblock *cb;
+	int wake = 0;
+
+	if (cache->writethrough && rw == WRITE)
+		clone = bio_alloc_bioset(GFP_NOIO, bio->bi_max_vecs, cache->bs);
+	mg = mempool_alloc(cache->migration_pool, GFP_NOWAIT);
+
+	spin_lock(&cache->lock);
+	cb = lookup_mapping(cache, oblock);
+	if (cb) {
+		if (test_bit(CB_BUSY, &cb->flags))
+			goto defer;
+
+		atomic_inc(&cb->inflight);
+		pb->cblock = cblock_index(cache, cb);
+		cache->policy.type->hit(&cache->policy, pb->cblock);
+		if (rw == WRITE && !cache->writethrough &&
+		    !test_bit(CB_DIRTY, &cb->flags)) {
+			__set_bit(CB_DIRTY, &cb->flags);
+			cache->nr_dirty++;
+			wake = over_dirty_threshold(cache);
+		}
+		spin_unlock(&cache->lock);
+
+		account_bio(cache, pb, rw, 1);
+		if (clone) {
+			issue_writethrough(cache, bio, pb, clone);
+			clone = NULL;
+		} else
+			remap_to_cache(cache, bio, pb->cblock);
+		goto out;
+	}
+
+	if (mg && cache->policy.type->miss(&cache->policy, oblock, rw) &&
+	    start_promotion(cache, &mg, oblock)) {
+		account_bio(cache, pb, rw, 0);
+		goto defer;
+	}
+	/* mg went to write back the victim */
+	wake = !mg;
+
+	if (rw == WRITE) {
+		pb->wslot = write_slot(oblock);
+		atomic_inc(&cache->origin_writes[pb->wslot]);
+	}
+	spin_unlock(&cache->lock);
+
+	account_bio(cache, pb, rw, 0);
+	remap_to_origin(cache, bio);
+
+out:
+	if (clone)
+		bio_put(clone);
+	if (mg)
+		mempool_free(mg, cache->migration_pool);
+	if (wake)
+		wake_worker(cache);
+	return DM_MAPIO_REMAPPED;
+
+defer:
+	list_add_tail(&pb->list, &cache->deferred);
+	spin_unlock(&cache->lock);
+
+	if (clone)
+		bio_put(clone);
+	if (mg)
+		mempool_free(mg, cache->migration_pool);
+	wake_worker(cache);
+	return DM_MAPIO_SUBMITTED;
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+	struct dm_cache_migration *mg, *tmp;
+	struct per_bio_data *pb, *pbtmp;
+	LIST_HEAD(quiesced);
+	LIST_HEAD(completed);
+	LIST_HEAD(deferred);
+
+	spin_lock(&cache->lock);
+	list_for_each_entry_safe(mg, tmp, &cache->quiesce, list)
+		if (migration_quiesced(cache, mg))
+			list_move_tail(&mg->list, &quiesced);
+	list_splice_init(&cache->completed, &completed);
+	spin_unlock(&cache->lock);
+
+	list_for_each_entry_safe(mg, tmp, &quiesced, list) {
+		list_del(&mg->list);
+		issue_copy(cache, mg);
+	}
+
+	list_for_each_entry_safe(mg, tmp, &completed, list) {
+		list_del(&mg->list);
+		complete_migration(cache, mg);
+	}
+
+	spin_lock(&cache->lock);
+	list_splice_init(&cache->deferred, &deferred);
+	spin_unlock(&cache->lock);
+
+	list_for_each_entry_safe(pb, pbtmp, &deferred, list) {
+		list_del(&pb->list);
+		if (process_bio(cache, pb) == DM_MAPIO_REMAPPED)
+			generic_make_request(pb->bio);
+	}
+
+	writeback_some(cache);
+}
+
+/*-----------------------------------------------------------------
+ * Target methods
+ *---------------------------------------------------------------*/
+static void destroy(struct cache *cache)
+{
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+
+	if (cache->policy.type) {
+		if (cache->policy.context)
+			cache->policy.type->destroy(&cache->policy);
+		dm_cache_policy_put(cache->policy.type);
+	}
+	if (cache->io_client)
+		dm_io_client_destroy(cache->io_client);
+	if (cache->bs)
+		bioset_free(cache->bs);
+	if (cache->per_bio_pool)
+		mempool_destroy(cache->per_bio_pool);
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+
+	kfree(cache->md_block);
+	vfree(cache->buckets);
+	vfree(cache->cblocks);
+
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+
+	kfree(cache);
+}
+
+static int alloc_cblocks(struct cache *cache)
+{
+	dm_cblock_t i;
+
+	cache->cblocks = vmalloc(cache->nr_cblocks * sizeof(struct cblock));
+	cache->hash_shift = max(ilog2(roundup_pow_of_two(cache->nr_cblocks)) - 2,
+				4);
+	cache->buckets = vmalloc(sizeof(struct hlist_head) << cache->hash_shift);
+	if (!cache->cblocks || !cache->buckets)
+		return -ENOMEM;
+
+	for (i = 0; i < (1U << cache->hash_shift); i++)
+		INIT_HLIST_HEAD(&cache->buckets[i]);
+
+	/* free blocks are taken in order */
+	for (i = cache->nr_cblocks; i--; ) {
+		struct cblock *cb = &cache->cblocks[i];
+
+		INIT_HLIST_NODE(&cb->hlist);
+		atomic_set(&cb->inflight, 0);
+		free_cblock(cache, cb);
+	}
+
+	return 0;
+}
+
+/*
+ * Construct a cache mapping:
+ * <metadata dev> <cache dev> <origin dev> <block size>
+ * <writeback|writethrough> <policy> <#policy args> [<policy arg>]*
+ */
+static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct cache *cache;
+	unsigned block_size, policy_argc, i;
+	sector_t cache_sectors, md_sectors;
+	char dummy;
+	int r;
+
+	if (argc < 7) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+	cache->ti = ti;
+	spin_lock_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->free);
+	INIT_LIST_HEAD(&cache->deferred);
+	INIT_LIST_HEAD(&cache->quiesce);
+	INIT_LIST_HEAD(&cache->completed);
+	init_waitqueue_head(&cache->migration_wait);
+	INIT_WORK(&cache->worker, do_worker);
+	cache->dirty_threshold = DEFAULT_DIRTY_THRESHOLD;
+	for (i = 0; i < ARRAY_SIZE(cache->origin_writes); i++)
+		atomic_set(&cache->origin_writes[i], 0);
+
+	r = -EINVAL;
+	if (sscanf(argv[3], "%u%c", &block_size, &dummy) != 1 ||
+	    block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+	    !is_power_of_2(block_size)) {
+		ti->error = "Invalid block size";
+		goto bad;
+	}
+	cache->block_size = block_size;
+	cache->block_shift = ilog2(block_size);
+
+	if (!strcmp(argv[4], "writethrough"))
+		cache->writethrough = 1;
+	else if (strcmp(argv[4], "writeback")) {
+		ti->error = "Invalid cache mode";
+		goto bad;
+	}
+
+	if (sscanf(argv[6], "%u%c", &policy_argc, &dummy) != 1 ||
+	    policy_argc != argc - 7) {
+		ti->error = "Invalid number of policy arguments";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, argv[0], FMODE_READ | FMODE_WRITE,
+			  &cache->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, argv[1], FMODE_READ | FMODE_WRITE,
+			  &cache->cache_dev);
+	if (r) {
+		ti->error = "Error opening cache device";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, argv[2], dm_table_get_mode(ti->table),
+			  &cache->origin_dev);
+	if (r) {
+		ti->error = "Error opening origin device";
+		goto bad;
+	}
+
+	r = -EINVAL;
+	cache->origin_sectors = i_size_read(cache->origin_dev->bdev->bd_inode) >>
+				SECTOR_SHIFT;
+	if (ti->len > cache->origin_sectors) {
+		ti->error = "Origin device is too small";
+		goto bad;
+	}
+	cache->origin_sectors = ti->len;
+
+	cache_sectors = i_size_read(cache->cache_dev->bdev->bd_inode) >>
+			SECTOR_SHIFT;
+	if ((cache_sectors >> cache->block_shift) > NO_CBLOCK - 1 ||
+	    !(cache_sectors >> cache->block_shift)) {
+		ti->error = "Invalid cache device size";
+		goto bad;
+	}
+	cache->nr_cblocks = cache_sectors >> cache->block_shift;
+
+	md_sectors = i_size_read(cache->metadata_dev->bdev->bd_inode) >>
+		     SECTOR_SHIFT;
+	if (md_sectors < (1 + DIV_ROUND_UP(cache->nr_cblocks, ENTRIES_PER_BLOCK)) *
+	    METADATA_BLOCK_SECTORS) {
+		ti->error = "Metadata device is too small";
+		goto bad;
+	}
+
+	cache->policy.type = dm_cache_policy_get(argv[5]);
+	if (!cache->policy.type) {
+		ti->error = "Unknown cache policy";
+		goto bad;
+	}
+
+	r = cache->policy.type->create(&cache->policy, cache->nr_cblocks,
+				       policy_argc, argv + 7);
+	if (r) {
+		cache->policy.context = NULL;
+		ti->error = "Error creating cache policy";
+		goto bad;
+	}
+
+	r = -ENOMEM;
+	if (alloc_cblocks(cache)) {
+		ti->error = "Cannot allocate cache blocks";
+		goto bad;
+	}
+
+	cache->md_block = kmalloc(METADATA_BLOCK_SIZE, GFP_KERNEL);
+	cache->migration_pool = mempool_create_slab_pool(MIN_IOS,
+							 _migration_cache);
+	cache->per_bio_pool = mempool_create_slab_pool(MIN_IOS, _per_bio_cache);
+	cache->bs = bioset_create(MIN_IOS, 0);
+	cache->io_client = dm_io_client_create(1);
+	if (!cache->md_block || !cache->migration_pool ||
+	    !cache->per_bio_pool || !cache->bs || IS_ERR(cache->io_client)) {
+		if (IS_ERR(cache->io_client))
+			cache->io_client = NULL;
+		ti->error = "Cannot allocate cache memory";
+		goto bad;
+	}
+
+	r = dm_kcopyd_client_create(COPY_PAGES, &cache->copier);
+	if (r) {
+		cache->copier = NULL;
+		ti->error = "Couldn't create kcopyd client";
+		goto bad;
+	}
+
+	cache->wq = create_singlethread_workqueue("kcached");
+	if (!cache->wq) {
+		r = -ENOMEM;
+		ti->error = "Couldn't create kcached workqueue";
+		goto bad;
+	}
+
+	r = load_metadata(cache, &ti->error);
+	if (r)
+		goto bad;
+
+	ti->split_io = cache->block_size;
+	ti->num_flush_requests = 2;
+	ti->private = cache;
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	destroy(ti->private);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+	struct per_bio_data *pb;
+
+	if (bio_empty_barrier(bio)) {
+		bio->bi_bdev = map_context->target_request_nr ?
+			cache->cache_dev->bdev : cache->origin_dev->bdev;
+		map_context->ptr = NULL;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	pb = mempool_alloc(cache->per_bio_pool, GFP_NOIO);
+	pb->cache = cache;
+	pb->bio = bio;
+	pb->cblock = NO_CBLOCK;
+	pb->wslot = -1;
+	pb->accounted = 0;
+	pb->writethrough = 0;
+	pb->origin_done = 0;
+	pb->error = 0;
+	map_context->ptr = pb;
+
+	return process_bio(cache, pb);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct per_bio_data *pb = map_context->ptr;
+	struct cache *cache = ti->private;
+	int wake = 0;
+
+	if (!pb)
+		return error;
+
+	if (pb->writethrough) {
+		if (error)
+			pb->error = error;
+		if (!pb->origin_done) {
+			pb->origin_done = 1;
+			if (!atomic_dec_and_test(&pb->pending))
+				return DM_ENDIO_INCOMPLETE;
+		}
+		error = pb->error;
+	}
+
+	if (pb->cblock != NO_CBLOCK) {
+		struct cblock *cb = &cache->cblocks[pb->cblock];
+
+		wake = atomic_dec_and_test(&cb->inflight) &&
+		       test_bit(CB_BUSY, &cb->flags);
+	}
+	if (pb->wslot >= 0)
+		wake |= atomic_dec_and_test(&cache->origin_writes[pb->wslot]) &&
+			!list_empty_careful(&cache->quiesce);
+	if (wake)
+		wake_worker(cache);
+
+	mempool_free(pb, cache->per_bio_pool);
+	return error;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	spin_lock(&cache->lock);
+	cache->quiescing = 1;
+	spin_unlock(&cache->lock);
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	wait_event(cache->migration_wait, !cache->nr_migrations);
+	flush_workqueue(cache->wq);
+
+	if (write_all_mappings(cache) ||
+	    write_super(cache, SB_CLEAN_SHUTDOWN |
+			(cache->writethrough ? SB_WRITETHROUGH : 0)))
+		DMERR("Couldn't write the metadata on suspend");
+}
+
+static int cache_preresume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	r = write_super(cache, cache->writethrough ? SB_WRITETHROUGH : 0);
+	if (r) {
+		DMERR("Couldn't write the metadata superblock");
+		return r;
+	}
+
+	spin_lock(&cache->lock);
+	cache->quiescing = 0;
+	spin_unlock(&cache->lock);
+
+	wake_worker(cache);
+	return 0;
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned int maxlen)
+{
+	struct cache *cache = ti->private;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%u/%u %u %u %u %u %u %u %u %u ",
+		       cache->nr_cblocks - cache->nr_free, cache->nr_cblocks,
+		       atomic_read(&cache->read_hit),
+		       atomic_read(&cache->read_miss),
+		       atomic_read(&cache->write_hit),
+		       atomic_read(&cache->write_miss),
+		       atomic_read(&cache->promotion),
+		       atomic_read(&cache->demotion),
+		       atomic_read(&cache->writeback),
+		       cache->nr_dirty);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %s %llu %s %s ", cache->metadata_dev->name,
+		       cache->cache_dev->name, cache->origin_dev->name,
+		       (unsigned long long)cache->block_size,
+		       cache->writethrough ? "writethrough" : "writeback",
+		       cache->policy.type->name);
+		break;
+	}
+
+	spin_lock(&cache->lock);
+	sz += cache->policy.type->status(&cache->policy, type, result + sz,
+					 maxlen - sz);
+	spin_unlock(&cache->lock);
+
+	return 0;
+}
+
+/*
+ * "dirty_threshold <percent>": start writing back the dirty blocks once
+ * that much of the cache is.
+ */
+static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache *cache = ti->private;
+	unsigned threshold;
+	char dummy;
+
+	if (argc != 2 || strnicmp(argv[0], "dirty_threshold", 16) ||
+	    sscanf(argv[1], "%u%c", &threshold, &dummy) != 1 ||
+	    threshold > 100) {
+		DMWARN("Unrecognised cache message received.");
+		return -EINVAL;
+	}
+
+	cache->dirty_threshold = threshold;
+	wake_worker(cache);
+	return 0;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	r = fn(ti, cache->cache_dev, 0,
+	       (sector_t)cache->nr_cblocks << cache->block_shift, data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+static struct target_type cache_target = {
+	.name	     = "cache",
+	.version     = {1, 0, 0},
+	.module      = THIS_MODULE,
+	.ctr	     = cache_ctr,
+	.dtr	     = cache_dtr,
+	.map	     = cache_map,
+	.end_io	     = cache_end_io,
+	.presuspend  = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.preresume   = cache_preresume,
+	.status	     = cache_status,
+	.message     = cache_message,
+	.iterate_devices = cache_iterate_devices,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r = -ENOMEM;
+
+	_migration_cache = KMEM_CACHE(dm_cache_migration, 0);
+	if (!_migration_cache)
+		goto bad_migration;
+
+	_per_bio_cache = KMEM_CACHE(per_bio_data, 0);
+	if (!_per_bio_cache)
+		goto bad_per_bio;
+
+	r = dm_register_target(&cache_target);
+	if (r < 0) {
+		DMERR("register failed %d", r);
+		goto bad_register;
+	}
+
+	return 0;
+
+bad_register:
+	kmem_cache_destroy(_per_bio_cache);
+bad_per_bio:
+	kmem_cache_destroy(_migration_cache);
+bad_migration:
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	kmem_cache_destroy(_per_bio_cache);
+	kmem_cache_destroy(_migration_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,306 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Latency oriented path selector: learns how fast each path serves
+ * its ios and chooses the one expected to complete the incoming io
+ * first.
+ */
+
+#include "dm.h"
+#include "dm-path-selector.h"
+
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <asm/atomic.h>
+
+#define DM_MSG_PREFIX	"multipath historical-service-time"
+#define HST_MIN_IO	1
+#define HST_WEIGHT_SHIFT	3	/* Each new sample weighs 1/8 */
+#define HST_VERSION	"0.1.0"
+
+struct selector {
+	struct list_head valid_paths;
+	struct list_head failed_paths;
+};
+
+struct path_info {
+	struct list_head list;
+	struct dm_path *path;
+	unsigned repeat_count;
+	atomic_t in_flight_size;	/* Total size of in-flight I/Os */
+
+	spinlock_t lock;
+	u64 last_finish;		/* When the last io completed */
+	unsigned long service_time;	/* Moving average, ns per sector */
+};
+
+static struct selector *alloc_selector(void)
+{
+	struct selector *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (s) {
+		INIT_LIST_HEAD(&s->valid_paths);
+		INIT_LIST_HEAD(&s->failed_paths);
+	}
+
+	return s;
+}
+
+static int hst_create(struct path_selector *ps, unsigned argc, char **argv)
+{
+	struct selector *s = alloc_selector();
+
+	if (!s)
+		return -ENOMEM;
+
+	ps->context = s;
+	return 0;
+}
+
+static void free_paths(struct list_head *paths)
+{
+	struct path_info *pi, *next;
+
+	list_for_each_entry_safe(pi, next, paths, list) {
+		list_del(&pi->list);
+		kfree(pi);
+	}
+}
+
+static void hst_destroy(struct path_selector *ps)
+{
+	struct selector *s = ps->context;
+
+	free_paths(&s->valid_paths);
+	free_paths(&s->failed_paths);
+	kfree(s);
+	ps->context = NULL;
+}
+
+static int hst_status(struct path_selector *ps, struct dm_path *path,
+		      status_type_t type, char *result, unsigned maxlen)
+{
+	unsigned sz = 0;
+	struct path_info *pi;
+
+	if (!path)
+		DMEMIT("0 ");
+	else {
+		pi = path->pscontext;
+
+		switch (type) {
+		case STATUSTYPE_INFO:
+			DMEMIT("%d %lu ", atomic_read(&pi->in_flight_size),
+			       pi->service_time);
+			break;
+		case STATUSTYPE_TABLE:
+			DMEMIT("%u ", pi->repeat_count);
+			break;
+		}
+	}
+
+	return sz;
+}
+
+static int hst_add_path(struct path_selector *ps, struct dm_path *path,
+			int argc, char **argv, char **error)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi;
+	unsigned repeat_count = HST_MIN_IO;
+
+	/*
+	 * Arguments: [<repeat_count>]
+	 * 	<repeat_count>: The number of I/Os before switching path.
+	 * 			If not given, default (HST_MIN_IO) is used.
+	 */
+	if (argc > 1) {
+		*error = "historical-service-time ps: incorrect number of arguments";
+		return -EINVAL;
+	}
+
+	if (argc && (sscanf(argv[0], "%u", &repeat_count) != 1)) {
+		*error = "historical-service-time ps: invalid repeat count";
+		return -EINVAL;
+	}
+
+	/* allocate the path */
+	pi = kmalloc(sizeof(*pi), GFP_KERNEL);
+	if (!pi) {
+		*error = "historical-service-time ps: Error allocating path context";
+		return -ENOMEM;
+	}
+
+	pi->path = path;
+	pi->repeat_count = repeat_count;
+	atomic_set(&pi->in_flight_size, 0);
+	spin_lock_init(&pi->lock);
+	pi->last_finish = 0;
+	pi->service_time = 0;
+
+	path->pscontext = pi;
+
+	list_add_tail(&pi->list, &s->valid_paths);
+
+	return 0;
+}
+
+static void hst_fail_path(struct path_selector *ps, struct dm_path *path)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = path->pscontext;
+
+	list_move(&pi->list, &s->failed_paths);
+}
+
+static int hst_reinstate_path(struct path_selector *ps, struct dm_path *path)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = path->pscontext;
+	unsigned long flags;
+
+	/* The path may have changed while it was failed: relearn it */
+	spin_lock_irqsave(&pi->lock, flags);
+	pi->service_time = 0;
+	spin_unlock_irqrestore(&pi->lock, flags);
+
+	list_move_tail(&pi->list, &s->valid_paths);
+
+	return 0;
+}
+
+/*
+ * The expected time for the path to complete the incoming io: all
+ * the bytes in flight on it, plus the new ones, at its historical
+ * service time.  A path without history yet costs nothing, so that
+ * it gets sampled.
+ */
+static u64 hst_expected_time(struct path_info *pi, size_t incoming)
+{
+	u64 sectors = ((u64)atomic_read(&pi->in_flight_size) + incoming) >> 9;
+
+	return (sectors + 1) * ACCESS_ONCE(pi->service_time);
+}
+
+static struct dm_path *hst_select_path(struct path_selector *ps,
+				       unsigned *repeat_count, size_t nr_bytes)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = NULL, *best = NULL;
+	u64 time, best_time = 0;
+
+	if (list_empty(&s->valid_paths))
+		return NULL;
+
+	/* Change preferred (first in list) path to evenly balance. */
+	list_move_tail(s->valid_paths.next, &s->valid_paths);
+
+	list_for_each_entry(pi, &s->valid_paths, list) {
+		time = hst_expected_time(pi, nr_bytes);
+		if (!best || time < best_time ||
+		    (time == best_time &&
+		     atomic_read(&pi->in_flight_size) <
+		     atomic_read(&best->in_flight_size))) {
+			best = pi;
+			best_time = time;
+		}
+	}
+
+	if (!best)
+		return NULL;
+
+	*repeat_count = best->repeat_count;
+
+	return best->path;
+}
+
+static int hst_start_io(struct path_selector *ps, struct dm_path *path,
+			size_t nr_bytes)
+{
+	struct path_info *pi = path->pscontext;
+
+	atomic_add(nr_bytes, &pi->in_flight_size);
+
+	return 0;
+}
+
+/*
+ * The service time of an io is measured from when it was started, or
+ * from the previous completion on the path if that is later: the time
+ * spent queued behind other ios is theirs, and already accounted for
+ * by the bytes in flight.
+ */
+static int hst_end_io(struct path_selector *ps, struct dm_path *path,
+		      size_t nr_bytes, u64 start_time)
+{
+	struct path_info *pi = path->pscontext;
+	unsigned long flags, sample;
+	u64 now = ktime_to_ns(ktime_get()), busy;
+
+	atomic_sub(nr_bytes, &pi->in_flight_size);
+
+	spin_lock_irqsave(&pi->lock, flags);
+
+	busy = now - max(start_time, pi->last_finish);
+	pi->last_finish = now;
+
+	/* Ios without data, such as flushes, say nothing of the path speed */
+	if (nr_bytes >= 512 && start_time && (s64)busy > 0) {
+		do_div(busy, (u32)(nr_bytes >> 9));
+		sample = min_t(u64, busy, ULONG_MAX >> HST_WEIGHT_SHIFT);
+
+		if (!pi->service_time)
+			pi->service_time = sample;
+		else
+			pi->service_time = (pi->service_time *
+					    ((1 << HST_WEIGHT_SHIFT) - 1) +
+					    sample) >> HST_WEIGHT_SHIFT;
+	}
+
+	spin_unlock_irqrestore(&pi->lock, flags);
+
+	return 0;
+}
+
+static struct path_selector_type hst_ps = {
+	.name		= "historical-service-time",
+	.module		= THIS_MODULE,
+	.table_args	= 1,
+	.info_args	= 2,
+	.create		= hst_create,
+	.destroy	= hst_destroy,
+	.status		= hst_status,
+	.add_path	= hst_add_path,
+	.fail_path	= hst_fail_path,
+	.reinstate_path	= hst_reinstate_path,
+	.select_path	= hst_select_path,
+	.start_io	= hst_start_io,
+	.end_io		= hst_end_io,
+};
+
+static int __init dm_hst_init(void)
+{
+	int r = dm_register_path_selector(&hst_ps);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	DMINFO("version " HST_VERSION " loaded");
+
+	return r;
+}
+
+static void __exit dm_hst_exit(void)
+{
+	int r = dm_unregister_path_selector(&hst_ps);
+
+	if (r < 0)
+		DMERR("unregister failed %d", r);
+}
+
+module_init(dm_hst_init);
+module_exit(dm_hst_exit);
+
+MODULE_DESCRIPTION(DM_NAME " latency oriented path selector");
+MODULE_LICENSE("GPL");
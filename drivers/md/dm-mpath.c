@@ -12,6 +12,7 @@
 
 #include <linux/ctype.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
 #include <linux/mempool.h>
 #include <linux/module.h>
 #include <linux/pagemap.h>
@@ -104,6 +105,7 @@ struct multipath {
 struct dm_mpath_io {
 	struct pgpath *pgpath;
 	size_t nr_bytes;
+	u64 start_time;
 };
 
 typedef int (*action_fn) (struct pgpath *pgpath);
@@ -382,9 +384,13 @@ static int map_io(struct multipath *m, struct request *clone,
 	mpio->pgpath = pgpath;
 	mpio->nr_bytes = nr_bytes;
 
-	if (r == DM_MAPIO_REMAPPED && pgpath->pg->ps.type->start_io)
+	mpio->start_time = 0;
+
+	if (r == DM_MAPIO_REMAPPED && pgpath->pg->ps.type->start_io) {
+		mpio->start_time = ktime_to_ns(ktime_get());
 		pgpath->pg->ps.type->start_io(&pgpath->pg->ps, &pgpath->path,
 					      nr_bytes);
+	}
 
 	spin_unlock_irqrestore(&m->lock, flags);
 
@@ -1306,7 +1312,8 @@ static int multipath_end_io(struct dm_target *ti, struct request *clone,
 	if (pgpath) {
 		ps = &pgpath->pg->ps;
 		if (ps->type->end_io)
-			ps->type->end_io(ps, &pgpath->path, mpio->nr_bytes);
+			ps->type->end_io(ps, &pgpath->path, mpio->nr_bytes,
+					 mpio->start_time);
 	}
 	mempool_free(mpio, m->mpio_pool);
 
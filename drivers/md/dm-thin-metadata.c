@@ -0,0 +1,1886 @@
+/*
+ * This file is released under the GPL.
+ *
+ * The metadata of a thin provisioning pool.
+ *
+ * It is made of copy on write btrees of 4k blocks: a details tree maps
+ * each thin device id to the root of its mapping tree, which maps the
+ * blocks of the device to data blocks.  Every block of the metadata and
+ * data devices has a reference count.  A snapshot is a new device whose
+ * mapping tree is the origin's root with its count raised, so creating
+ * one is cheap however big the origin is.  Shadowing a node whose count
+ * is above one copies it and raises the counts of everything it points
+ * to, so the cost of a write is the same however many snapshots share
+ * the block.
+ *
+ * Nothing written in the current transaction is reachable from the
+ * superblock on disk and no block freed in it is reused before the
+ * next commit, so the metadata on disk is always the state of the
+ * last commit.  The reference counts are not stored, they are rebuilt
+ * by walking the trees when the pool is opened.
+ */
+
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/crc32c.h>
+#include <linux/rwsem.h>
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+
+#include "dm-thin-metadata.h"
+
+#define DM_MSG_PREFIX "thin metadata"
+
+#define THIN_SUPERBLOCK_MAGIC	27022010
+#define THIN_VERSION		1
+#define SUPERBLOCK_LOCATION	0
+
+#define METADATA_BLOCK_SECTORS	(THIN_METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+#define MAX_METADATA_BLOCKS	(THIN_METADATA_MAX_SECTORS / METADATA_BLOCK_SECTORS)
+
+#define SUPERBLOCK_CSUM_XOR	160774
+#define BTREE_CSUM_XOR		121107
+
+/* clean blocks kept in core */
+#define MAX_CLEAN_BLOCKS	4096
+#define BLOCK_HASH_BITS		10
+
+struct thin_disk_superblock {
+	__le32 csum;
+	__le32 flags;
+	__le64 blocknr;
+
+	__le64 magic;
+	__le32 version;
+	__le32 data_block_size;		/* in sectors */
+
+	__le64 trans_id;
+	__le64 details_root;
+
+	__le64 metadata_nr_blocks;
+	__le64 data_nr_blocks;
+} __packed;
+
+struct disk_device_details {
+	__le64 mapped_blocks;
+	__le64 root;
+} __packed;
+
+/* btree node flags */
+#define INTERNAL_NODE	1
+#define LEAF_NODE	2
+
+struct node_header {
+	__le32 csum;
+	__le32 flags;
+	__le64 blocknr;
+
+	__le32 nr_entries;
+	__le32 max_entries;
+	__le32 value_size;
+	__le32 padding;
+} __packed;
+
+/*
+ * The keys, then max_entries values of value_size bytes.  The values of
+ * an internal node are the __le64 block numbers of its children, each
+ * key being the lowest key under that child.
+ */
+struct btree_node {
+	struct node_header header;
+	__le64 keys[0];
+} __packed;
+
+/*----------------------------------------------------------------*/
+
+/*
+ * In core reference counts.  A block freed in this transaction may
+ * still be used by the metadata on disk, it is only reused after the
+ * next commit.
+ */
+struct space_map {
+	dm_block_t nr_blocks;
+	dm_block_t nr_free;
+	dm_block_t nr_pinned;
+	dm_block_t search;
+	uint32_t *counts;
+	unsigned long *freed;
+};
+
+struct md_block {
+	struct hlist_node hlist;
+	struct list_head list;		/* on the clean or the dirty list */
+	dm_block_t b;
+	unsigned count;
+	int dirty;
+	void *data;
+};
+
+struct dm_thin_device {
+	struct list_head list;
+	struct dm_pool_metadata *pmd;
+	dm_thin_id id;
+
+	int open_count;
+	int changed;
+	uint64_t mapped_blocks;
+	dm_block_t root;
+};
+
+/*
+ * root_lock is held for reading across lookups and for writing across
+ * any change.  lock protects the block cache, which lookups fill.
+ */
+struct dm_pool_metadata {
+	struct block_device *bdev;
+	struct dm_io_client *io_client;
+	struct rw_semaphore root_lock;
+
+	spinlock_t lock;
+	struct hlist_head *buckets;
+	struct list_head clean;
+	struct list_head dirty;
+	unsigned nr_clean;
+
+	struct space_map metadata_sm;
+	struct space_map data_sm;
+
+	sector_t data_block_size;
+	uint64_t trans_id;
+	dm_block_t details_root;
+	int changed;
+
+	/* the devices open, or changed in this transaction */
+	struct list_head thin_devices;
+
+	struct thin_disk_superblock *sb;
+};
+
+struct btree_info {
+	unsigned value_size;
+
+	/* the references held by a leaf value */
+	void (*inc)(struct dm_pool_metadata *pmd, void *value);
+	int (*dec)(struct dm_pool_metadata *pmd, void *value);
+};
+
+static struct btree_info details_info;
+static struct btree_info mapping_info;
+
+/*-----------------------------------------------------------------
+ * Space maps
+ *---------------------------------------------------------------*/
+static int sm_init(struct space_map *sm, dm_block_t nr_blocks)
+{
+	size_t bitmap_size = BITS_TO_LONGS(nr_blocks) * sizeof(long);
+
+	sm->counts = vmalloc(nr_blocks * sizeof(*sm->counts));
+	sm->freed = vmalloc(bitmap_size);
+	if (!sm->counts || !sm->freed) {
+		vfree(sm->counts);
+		vfree(sm->freed);
+		sm->counts = NULL;
+		sm->freed = NULL;
+		return -ENOMEM;
+	}
+
+	memset(sm->counts, 0, nr_blocks * sizeof(*sm->counts));
+	memset(sm->freed, 0, bitmap_size);
+	sm->nr_blocks = nr_blocks;
+	sm->nr_free = nr_blocks;
+	sm->nr_pinned = 0;
+	sm->search = 0;
+
+	return 0;
+}
+
+static void sm_destroy(struct space_map *sm)
+{
+	vfree(sm->counts);
+	vfree(sm->freed);
+}
+
+static int sm_extend(struct space_map *sm, dm_block_t nr_blocks)
+{
+	struct space_map new;
+	int r;
+
+	r = sm_init(&new, nr_blocks);
+	if (r)
+		return r;
+
+	memcpy(new.counts, sm->counts, sm->nr_blocks * sizeof(*sm->counts));
+	memcpy(new.freed, sm->freed,
+	       BITS_TO_LONGS(sm->nr_blocks) * sizeof(long));
+	new.nr_free = sm->nr_free + nr_blocks - sm->nr_blocks;
+	new.nr_pinned = sm->nr_pinned;
+
+	sm_destroy(sm);
+	*sm = new;
+	return 0;
+}
+
+static uint32_t sm_get(struct space_map *sm, dm_block_t b)
+{
+	return sm->counts[b];
+}
+
+static void sm_inc(struct space_map *sm, dm_block_t b)
+{
+	BUG_ON(!sm->counts[b]);
+	sm->counts[b]++;
+}
+
+/*
+ * Returns the new count.
+ */
+static uint32_t sm_dec(struct space_map *sm, dm_block_t b)
+{
+	BUG_ON(!sm->counts[b]);
+	if (!--sm->counts[b]) {
+		__set_bit(b, sm->freed);
+		sm->nr_pinned++;
+	}
+
+	return sm->counts[b];
+}
+
+static int sm_alloc(struct space_map *sm, dm_block_t *result)
+{
+	dm_block_t n, b;
+
+	for (n = sm->nr_free ? sm->nr_blocks : 0; n; n--) {
+		b = sm->search;
+		if (++sm->search == sm->nr_blocks)
+			sm->search = 0;
+
+		if (!sm->counts[b] && !test_bit(b, sm->freed)) {
+			sm->counts[b] = 1;
+			sm->nr_free--;
+			*result = b;
+			return 0;
+		}
+	}
+
+	return -ENOSPC;
+}
+
+static void sm_commit(struct space_map *sm)
+{
+	memset(sm->freed, 0, BITS_TO_LONGS(sm->nr_blocks) * sizeof(long));
+	sm->nr_free += sm->nr_pinned;
+	sm->nr_pinned = 0;
+}
+
+/*
+ * After the counts were rebuilt.
+ */
+static void sm_count_free(struct space_map *sm)
+{
+	dm_block_t b;
+
+	sm->nr_free = 0;
+	for (b = 0; b < sm->nr_blocks; b++)
+		if (!sm->counts[b])
+			sm->nr_free++;
+}
+
+/*-----------------------------------------------------------------
+ * Metadata io and the block cache
+ *---------------------------------------------------------------*/
+static int block_io(struct dm_pool_metadata *pmd, dm_block_t b, void *data,
+		    int rw, io_notify_fn fn, void *context)
+{
+	struct dm_io_region where = {
+		.bdev = pmd->bdev,
+		.sector = b * METADATA_BLOCK_SECTORS,
+		.count = METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = data,
+		.client = pmd->io_client,
+		.notify.fn = fn,
+		.notify.context = context,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static __le32 block_csum(void *data, u32 xor)
+{
+	return cpu_to_le32(crc32c(~(u32)0, data + sizeof(__le32),
+				  THIN_METADATA_BLOCK_SIZE - sizeof(__le32)) ^
+			   xor);
+}
+
+static unsigned calc_max_entries(unsigned value_size)
+{
+	return (THIN_METADATA_BLOCK_SIZE - sizeof(struct node_header)) /
+		(sizeof(__le64) + value_size);
+}
+
+static int check_node(struct btree_node *n, dm_block_t b)
+{
+	struct node_header *h = &n->header;
+	uint32_t flags = le32_to_cpu(h->flags);
+
+	if (h->csum != block_csum(n, BTREE_CSUM_XOR) ||
+	    le64_to_cpu(h->blocknr) != b ||
+	    (flags != INTERNAL_NODE && flags != LEAF_NODE) ||
+	    le32_to_cpu(h->max_entries) !=
+	    calc_max_entries(le32_to_cpu(h->value_size)) ||
+	    le32_to_cpu(h->nr_entries) > le32_to_cpu(h->max_entries)) {
+		DMERR("btree node %llu is corrupt", (unsigned long long)b);
+		return -EILSEQ;
+	}
+
+	return 0;
+}
+
+static struct md_block *alloc_md_block(dm_block_t b)
+{
+	struct md_block *mb = kmalloc(sizeof(*mb), GFP_NOIO);
+
+	if (!mb)
+		return NULL;
+
+	mb->data = kmalloc(THIN_METADATA_BLOCK_SIZE, GFP_NOIO);
+	if (!mb->data) {
+		kfree(mb);
+		return NULL;
+	}
+
+	INIT_HLIST_NODE(&mb->hlist);
+	INIT_LIST_HEAD(&mb->list);
+	mb->b = b;
+	mb->count = 1;
+	mb->dirty = 0;
+
+	return mb;
+}
+
+static void free_md_block(struct md_block *mb)
+{
+	kfree(mb->data);
+	kfree(mb);
+}
+
+static struct md_block *__find_md_block(struct dm_pool_metadata *pmd,
+					dm_block_t b)
+{
+	struct hlist_node *hn;
+	struct md_block *mb;
+
+	hlist_for_each_entry(mb, hn, pmd->buckets + hash_64(b, BLOCK_HASH_BITS),
+			     hlist)
+		if (mb->b == b)
+			return mb;
+
+	return NULL;
+}
+
+static void __insert_md_block(struct dm_pool_metadata *pmd,
+			      struct md_block *mb)
+{
+	hlist_add_head(&mb->hlist,
+		       pmd->buckets + hash_64(mb->b, BLOCK_HASH_BITS));
+	if (mb->dirty)
+		list_add(&mb->list, &pmd->dirty);
+	else {
+		list_add(&mb->list, &pmd->clean);
+		pmd->nr_clean++;
+	}
+}
+
+/*
+ * Moves the least recently used clean blocks nobody holds over the
+ * limit to victims.
+ */
+static void __evict_md_blocks(struct dm_pool_metadata *pmd,
+			      struct list_head *victims)
+{
+	struct md_block *mb, *tmp;
+
+	list_for_each_entry_safe_reverse(mb, tmp, &pmd->clean, list) {
+		if (pmd->nr_clean <= MAX_CLEAN_BLOCKS)
+			break;
+		if (mb->count)
+			continue;
+
+		hlist_del(&mb->hlist);
+		list_move(&mb->list, victims);
+		pmd->nr_clean--;
+	}
+}
+
+static void free_md_blocks(struct list_head *blocks)
+{
+	struct md_block *mb, *tmp;
+
+	list_for_each_entry_safe(mb, tmp, blocks, list)
+		free_md_block(mb);
+}
+
+/*
+ * Gets a btree node, reading it unless can_block is unset, in which
+ * case it fails with -EWOULDBLOCK when the node isn't in core.
+ */
+static int get_node(struct dm_pool_metadata *pmd, dm_block_t b,
+		    int can_block, struct md_block **result)
+{
+	struct md_block *mb, *old;
+	LIST_HEAD(victims);
+	int r;
+
+	spin_lock(&pmd->lock);
+	mb = __find_md_block(pmd, b);
+	if (mb) {
+		mb->count++;
+		if (!mb->dirty)
+			list_move(&mb->list, &pmd->clean);
+	}
+	spin_unlock(&pmd->lock);
+
+	if (mb) {
+		*result = mb;
+		return 0;
+	}
+
+	if (!can_block)
+		return -EWOULDBLOCK;
+
+	if (b >= pmd->metadata_sm.nr_blocks) {
+		DMERR("btree node %llu beyond the metadata device",
+		      (unsigned long long)b);
+		return -EILSEQ;
+	}
+
+	mb = alloc_md_block(b);
+	if (!mb)
+		return -ENOMEM;
+
+	r = block_io(pmd, b, mb->data, READ, NULL, NULL);
+	if (!r)
+		r = check_node(mb->data, b);
+	if (r) {
+		free_md_block(mb);
+		return r;
+	}
+
+	spin_lock(&pmd->lock);
+	old = __find_md_block(pmd, b);
+	if (old)
+		old->count++;
+	else {
+		__insert_md_block(pmd, mb);
+		__evict_md_blocks(pmd, &victims);
+	}
+	spin_unlock(&pmd->lock);
+
+	if (old) {
+		free_md_block(mb);
+		mb = old;
+	}
+	free_md_blocks(&victims);
+
+	*result = mb;
+	return 0;
+}
+
+static void put_node(struct dm_pool_metadata *pmd, struct md_block *mb)
+{
+	spin_lock(&pmd->lock);
+	BUG_ON(!mb->count);
+	mb->count--;
+	spin_unlock(&pmd->lock);
+}
+
+static struct btree_node *to_node(struct md_block *mb)
+{
+	return mb->data;
+}
+
+/*
+ * Allocates a new zeroed metadata block, dirty.  Under root_lock held
+ * for writing.
+ */
+static int new_node(struct dm_pool_metadata *pmd, struct md_block **result)
+{
+	struct md_block *mb;
+	dm_block_t b;
+	int r;
+
+	r = sm_alloc(&pmd->metadata_sm, &b);
+	if (r) {
+		DMERR_LIMIT("metadata device is full");
+		return r;
+	}
+
+	spin_lock(&pmd->lock);
+	mb = __find_md_block(pmd, b);
+	if (mb) {
+		mb->count++;
+		if (!mb->dirty) {
+			mb->dirty = 1;
+			list_move(&mb->list, &pmd->dirty);
+			pmd->nr_clean--;
+		}
+	}
+	spin_unlock(&pmd->lock);
+
+	if (!mb) {
+		mb = alloc_md_block(b);
+		if (!mb) {
+			sm_dec(&pmd->metadata_sm, b);
+			return -ENOMEM;
+		}
+		mb->dirty = 1;
+
+		spin_lock(&pmd->lock);
+		__insert_md_block(pmd, mb);
+		spin_unlock(&pmd->lock);
+	}
+
+	memset(mb->data, 0, THIN_METADATA_BLOCK_SIZE);
+	*result = mb;
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Btrees
+ *---------------------------------------------------------------*/
+static void init_node(struct md_block *mb, uint32_t flags, unsigned value_size)
+{
+	struct node_header *h = &to_node(mb)->header;
+
+	h->flags = cpu_to_le32(flags);
+	h->blocknr = cpu_to_le64(mb->b);
+	h->nr_entries = 0;
+	h->max_entries = cpu_to_le32(calc_max_entries(value_size));
+	h->value_size = cpu_to_le32(value_size);
+}
+
+static unsigned nr_entries(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.nr_entries);
+}
+
+static unsigned max_entries(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.max_entries);
+}
+
+static unsigned value_size(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.value_size);
+}
+
+static int is_leaf(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.flags) == LEAF_NODE;
+}
+
+static uint64_t key_at(struct btree_node *n, unsigned i)
+{
+	return le64_to_cpu(n->keys[i]);
+}
+
+static void *value_ptr(struct btree_node *n, unsigned i)
+{
+	return (char *)(n->keys + max_entries(n)) + i * value_size(n);
+}
+
+static dm_block_t child_at(struct btree_node *n, unsigned i)
+{
+	return le64_to_cpu(*(__le64 *)value_ptr(n, i));
+}
+
+static void set_child(struct btree_node *n, unsigned i, dm_block_t b)
+{
+	*(__le64 *)value_ptr(n, i) = cpu_to_le64(b);
+}
+
+/*
+ * The index of the highest key not above key, -1 if there is none.
+ */
+static int lower_bound(struct btree_node *n, uint64_t key)
+{
+	int lo = -1, hi = nr_entries(n);
+
+	while (hi - lo > 1) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (key_at(n, mid) <= key)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void insert_at(struct btree_node *n, unsigned i, uint64_t key,
+		      void *value)
+{
+	unsigned nr = nr_entries(n), vs = value_size(n);
+
+	BUG_ON(nr >= max_entries(n));
+	memmove(n->keys + i + 1, n->keys + i, (nr - i) * sizeof(__le64));
+	memmove(value_ptr(n, i + 1), value_ptr(n, i), (nr - i) * vs);
+
+	n->keys[i] = cpu_to_le64(key);
+	memcpy(value_ptr(n, i), value, vs);
+	n->header.nr_entries = cpu_to_le32(nr + 1);
+}
+
+static void delete_at(struct btree_node *n, unsigned i)
+{
+	unsigned nr = nr_entries(n), vs = value_size(n);
+
+	memmove(n->keys + i, n->keys + i + 1, (nr - i - 1) * sizeof(__le64));
+	memmove(value_ptr(n, i), value_ptr(n, i + 1), (nr - i - 1) * vs);
+	n->header.nr_entries = cpu_to_le32(nr - 1);
+}
+
+/*
+ * Copies entries [from, from + count) of src to the end of dest.
+ */
+static void copy_entries(struct btree_node *dest, struct btree_node *src,
+			 unsigned from, unsigned count)
+{
+	unsigned nr = nr_entries(dest);
+
+	memcpy(dest->keys + nr, src->keys + from, count * sizeof(__le64));
+	memcpy(value_ptr(dest, nr), value_ptr(src, from),
+	       count * value_size(src));
+	dest->header.nr_entries = cpu_to_le32(nr + count);
+}
+
+/*
+ * The children of a node that is now referenced once more.
+ */
+static void inc_children(struct dm_pool_metadata *pmd,
+			 struct btree_info *info, struct btree_node *n)
+{
+	unsigned i;
+
+	for (i = 0; i < nr_entries(n); i++)
+		if (is_leaf(n))
+			info->inc(pmd, value_ptr(n, i));
+		else
+			sm_inc(&pmd->metadata_sm, child_at(n, i));
+}
+
+/*
+ * Drops a reference to a (sub)tree, releasing it if that was the last.
+ */
+static int dec_tree(struct dm_pool_metadata *pmd, struct btree_info *info,
+		    dm_block_t b)
+{
+	struct md_block *mb;
+	struct btree_node *n;
+	unsigned i;
+	int r;
+
+	if (sm_dec(&pmd->metadata_sm, b))
+		return 0;
+
+	r = get_node(pmd, b, 1, &mb);
+	if (r)
+		return r;
+
+	n = to_node(mb);
+	for (i = 0; !r && i < nr_entries(n); i++)
+		if (is_leaf(n))
+			r = info->dec(pmd, value_ptr(n, i));
+		else
+			r = dec_tree(pmd, info, child_at(n, i));
+
+	put_node(pmd, mb);
+	return r;
+}
+
+/*
+ * Gets a node to modify: the node itself if it was created in this
+ * transaction and is not shared, a copy otherwise.
+ */
+static int shadow_node(struct dm_pool_metadata *pmd, struct btree_info *info,
+		       dm_block_t b, struct md_block **result)
+{
+	struct md_block *old, *mb;
+	int r;
+
+	r = get_node(pmd, b, 1, &old);
+	if (r)
+		return r;
+
+	if (old->dirty && sm_get(&pmd->metadata_sm, b) == 1) {
+		*result = old;
+		return 0;
+	}
+
+	r = new_node(pmd, &mb);
+	if (r) {
+		put_node(pmd, old);
+		return r;
+	}
+
+	memcpy(mb->data, old->data, THIN_METADATA_BLOCK_SIZE);
+	to_node(mb)->header.blocknr = cpu_to_le64(mb->b);
+
+	if (sm_get(&pmd->metadata_sm, b) > 1)
+		inc_children(pmd, info, to_node(mb));
+	sm_dec(&pmd->metadata_sm, b);
+
+	put_node(pmd, old);
+	*result = mb;
+	return 0;
+}
+
+static int new_tree(struct dm_pool_metadata *pmd, struct btree_info *info,
+		    dm_block_t *root)
+{
+	struct md_block *mb;
+	int r;
+
+	r = new_node(pmd, &mb);
+	if (r)
+		return r;
+
+	init_node(mb, LEAF_NODE, info->value_size);
+	*root = mb->b;
+	put_node(pmd, mb);
+
+	return 0;
+}
+
+/*
+ * Sets *shared if any node on the path to key is referenced more than
+ * once.
+ */
+static int btree_lookup(struct dm_pool_metadata *pmd, dm_block_t root,
+			uint64_t key, int can_block, void *value, int *shared)
+{
+	struct md_block *mb;
+	struct btree_node *n;
+	dm_block_t b = root;
+	int i, r;
+
+	*shared = 0;
+	for (;;) {
+		r = get_node(pmd, b, can_block, &mb);
+		if (r)
+			return r;
+
+		if (sm_get(&pmd->metadata_sm, b) > 1)
+			*shared = 1;
+
+		n = to_node(mb);
+		i = lower_bound(n, key);
+		if (i < 0 || (is_leaf(n) && key_at(n, i) != key)) {
+			put_node(pmd, mb);
+			return -ENODATA;
+		}
+
+		if (is_leaf(n))
+			break;
+
+		b = child_at(n, i);
+		put_node(pmd, mb);
+	}
+
+	memcpy(value, value_ptr(n, i), value_size(n));
+	put_node(pmd, mb);
+
+	return 0;
+}
+
+/*
+ * Splits the full root into two new children, the root keeping its
+ * block.
+ */
+static int split_beneath(struct dm_pool_metadata *pmd, struct md_block *mb)
+{
+	struct btree_node *n = to_node(mb), *left, *right;
+	struct md_block *lmb, *rmb;
+	unsigned nr = nr_entries(n), nr_left = nr / 2;
+	uint32_t flags = le32_to_cpu(n->header.flags);
+	int r;
+
+	r = new_node(pmd, &lmb);
+	if (r)
+		return r;
+
+	r = new_node(pmd, &rmb);
+	if (r) {
+		put_node(pmd, lmb);
+		return r;
+	}
+
+	left = to_node(lmb);
+	right = to_node(rmb);
+	init_node(lmb, flags, value_size(n));
+	init_node(rmb, flags, value_size(n));
+	copy_entries(left, n, 0, nr_left);
+	copy_entries(right, n, nr_left, nr - nr_left);
+
+	init_node(mb, INTERNAL_NODE, sizeof(__le64));
+	n->keys[0] = left->keys[0];
+	set_child(n, 0, lmb->b);
+	n->keys[1] = right->keys[0];
+	set_child(n, 1, rmb->b);
+	n->header.nr_entries = cpu_to_le32(2);
+
+	put_node(pmd, lmb);
+	put_node(pmd, rmb);
+	return 0;
+}
+
+/*
+ * Moves the upper half of the full *mb, entry index of parent, to a new
+ * sibling.  *mb becomes the one that key goes to.
+ */
+static int split_sibling(struct dm_pool_metadata *pmd, struct md_block *parent,
+			 unsigned index, struct md_block **mb, uint64_t key)
+{
+	struct btree_node *n = to_node(*mb), *right;
+	struct md_block *rmb;
+	unsigned nr = nr_entries(n), nr_left = nr / 2;
+	__le64 location;
+	int r;
+
+	r = new_node(pmd, &rmb);
+	if (r)
+		return r;
+
+	right = to_node(rmb);
+	init_node(rmb, le32_to_cpu(n->header.flags), value_size(n));
+	copy_entries(right, n, nr_left, nr - nr_left);
+	n->header.nr_entries = cpu_to_le32(nr_left);
+
+	location = cpu_to_le64(rmb->b);
+	insert_at(to_node(parent), index + 1, key_at(right, 0), &location);
+
+	if (key >= key_at(right, 0)) {
+		put_node(pmd, *mb);
+		*mb = rmb;
+	} else
+		put_node(pmd, rmb);
+
+	return 0;
+}
+
+/*
+ * Sets key to value, shadowing the path to it and splitting the full
+ * nodes on the way down.  When key was there, its old value is copied
+ * to old_value and *overwrote set: dropping the references it holds is
+ * the caller's business.
+ */
+static int btree_insert(struct dm_pool_metadata *pmd, struct btree_info *info,
+			dm_block_t *root, uint64_t key, void *value,
+			void *old_value, int *overwrote)
+{
+	struct md_block *parent = NULL, *mb, *child;
+	struct btree_node *n;
+	unsigned index = 0;
+	int i, r;
+
+	r = shadow_node(pmd, info, *root, &mb);
+	if (r)
+		return r;
+	*root = mb->b;
+
+	for (;;) {
+		n = to_node(mb);
+		if (nr_entries(n) == max_entries(n)) {
+			if (parent)
+				r = split_sibling(pmd, parent, index, &mb, key);
+			else
+				r = split_beneath(pmd, mb);
+			if (r)
+				goto out;
+			n = to_node(mb);
+		}
+
+		if (is_leaf(n))
+			break;
+
+		i = lower_bound(n, key);
+		if (i < 0) {
+			i = 0;
+			n->keys[0] = cpu_to_le64(key);
+		}
+
+		r = shadow_node(pmd, info, child_at(n, i), &child);
+		if (r)
+			goto out;
+		set_child(n, i, child->b);
+
+		if (parent)
+			put_node(pmd, parent);
+		parent = mb;
+		index = i;
+		mb = child;
+	}
+
+	i = lower_bound(n, key);
+	if (i >= 0 && key_at(n, i) == key) {
+		memcpy(old_value, value_ptr(n, i), info->value_size);
+		memcpy(value_ptr(n, i), value, info->value_size);
+		*overwrote = 1;
+	} else {
+		insert_at(n, i + 1, key, value);
+		*overwrote = 0;
+	}
+
+out:
+	if (parent)
+		put_node(pmd, parent);
+	put_node(pmd, mb);
+	return r;
+}
+
+/*
+ * Removes key, copying its value to old_value.  The nodes are not
+ * rebalanced.
+ */
+static int btree_remove(struct dm_pool_metadata *pmd, struct btree_info *info,
+			dm_block_t *root, uint64_t key, void *old_value)
+{
+	struct md_block *mb, *child;
+	struct btree_node *n;
+	int i, r;
+
+	r = shadow_node(pmd, info, *root, &mb);
+	if (r)
+		return r;
+	*root = mb->b;
+
+	for (;;) {
+		n = to_node(mb);
+		i = lower_bound(n, key);
+		if (i < 0 || (is_leaf(n) && key_at(n, i) != key)) {
+			r = -ENODATA;
+			break;
+		}
+
+		if (is_leaf(n)) {
+			memcpy(old_value, value_ptr(n, i), info->value_size);
+			delete_at(n, i);
+			break;
+		}
+
+		r = shadow_node(pmd, info, child_at(n, i), &child);
+		if (r)
+			break;
+		set_child(n, i, child->b);
+
+		put_node(pmd, mb);
+		mb = child;
+	}
+
+	put_node(pmd, mb);
+	return r;
+}
+
+static int btree_find_highest_key(struct dm_pool_metadata *pmd,
+				  dm_block_t root, uint64_t *result)
+{
+	struct md_block *mb;
+	struct btree_node *n;
+	dm_block_t b = root;
+	int r;
+
+	for (;;) {
+		r = get_node(pmd, b, 1, &mb);
+		if (r)
+			return r;
+
+		n = to_node(mb);
+		if (!nr_entries(n)) {
+			put_node(pmd, mb);
+			return -ENODATA;
+		}
+
+		if (is_leaf(n))
+			break;
+
+		b = child_at(n, nr_entries(n) - 1);
+		put_node(pmd, mb);
+	}
+
+	*result = key_at(n, nr_entries(n) - 1);
+	put_node(pmd, mb);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------*/
+
+static void mapping_inc(struct dm_pool_metadata *pmd, void *value)
+{
+	sm_inc(&pmd->data_sm, le64_to_cpu(*(__le64 *)value));
+}
+
+static int mapping_dec(struct dm_pool_metadata *pmd, void *value)
+{
+	sm_dec(&pmd->data_sm, le64_to_cpu(*(__le64 *)value));
+	return 0;
+}
+
+static void details_inc(struct dm_pool_metadata *pmd, void *value)
+{
+	struct disk_device_details *dd = value;
+
+	sm_inc(&pmd->metadata_sm, le64_to_cpu(dd->root));
+}
+
+static int details_dec(struct dm_pool_metadata *pmd, void *value)
+{
+	struct disk_device_details *dd = value;
+
+	return dec_tree(pmd, &mapping_info, le64_to_cpu(dd->root));
+}
+
+static struct btree_info mapping_info = {
+	.value_size = sizeof(__le64),
+	.inc = mapping_inc,
+	.dec = mapping_dec,
+};
+
+static struct btree_info details_info = {
+	.value_size = sizeof(struct disk_device_details),
+	.inc = details_inc,
+	.dec = details_dec,
+};
+
+/*-----------------------------------------------------------------
+ * Opening and committing
+ *---------------------------------------------------------------*/
+
+/*
+ * Counts one more reference to a node, and to what it points to the
+ * first time it is reached.
+ */
+static int count_tree(struct dm_pool_metadata *pmd, struct btree_info *info,
+		      dm_block_t b)
+{
+	struct md_block *mb;
+	struct btree_node *n;
+	unsigned i;
+	int r;
+
+	if (b >= pmd->metadata_sm.nr_blocks)
+		return -EILSEQ;
+
+	if (pmd->metadata_sm.counts[b]++)
+		return 0;
+
+	r = get_node(pmd, b, 1, &mb);
+	if (r)
+		return r;
+
+	n = to_node(mb);
+	if (value_size(n) != (is_leaf(n) ? info->value_size : sizeof(__le64))) {
+		DMERR("btree node %llu has the wrong value size",
+		      (unsigned long long)b);
+		r = -EILSEQ;
+	}
+
+	for (i = 0; !r && i < nr_entries(n); i++) {
+		if (!is_leaf(n))
+			r = count_tree(pmd, info, child_at(n, i));
+
+		else if (info == &details_info) {
+			struct disk_device_details *dd = value_ptr(n, i);
+
+			r = count_tree(pmd, &mapping_info,
+				       le64_to_cpu(dd->root));
+		} else {
+			dm_block_t data = child_at(n, i);
+
+			if (data >= pmd->data_sm.nr_blocks) {
+				DMERR("data block %llu beyond the data device",
+				      (unsigned long long)data);
+				r = -EILSEQ;
+			} else
+				pmd->data_sm.counts[data]++;
+		}
+	}
+
+	put_node(pmd, mb);
+	return r;
+}
+
+static int rebuild_space_maps(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	pmd->metadata_sm.counts[SUPERBLOCK_LOCATION] = 1;
+	r = count_tree(pmd, &details_info, pmd->details_root);
+	if (r)
+		return r;
+
+	sm_count_free(&pmd->metadata_sm);
+	sm_count_free(&pmd->data_sm);
+
+	return 0;
+}
+
+static int __write_changed_details(struct dm_pool_metadata *pmd)
+{
+	struct dm_thin_device *td, *tmp;
+	struct disk_device_details dd, old;
+	int overwrote, r;
+
+	list_for_each_entry_safe(td, tmp, &pmd->thin_devices, list) {
+		if (!td->changed)
+			continue;
+
+		dd.mapped_blocks = cpu_to_le64(td->mapped_blocks);
+		dd.root = cpu_to_le64(td->root);
+
+		/* the old root's references were moved to td->root already */
+		r = btree_insert(pmd, &details_info, &pmd->details_root,
+				 td->id, &dd, &old, &overwrote);
+		if (r)
+			return r;
+
+		td->changed = 0;
+		if (!td->open_count) {
+			list_del(&td->list);
+			kfree(td);
+		}
+	}
+
+	return 0;
+}
+
+struct commit_io {
+	atomic_t pending;
+	unsigned long error;
+	struct completion done;
+};
+
+static void block_written(unsigned long error, void *context)
+{
+	struct commit_io *io = context;
+
+	if (error)
+		io->error = error;
+	if (atomic_dec_and_test(&io->pending))
+		complete(&io->done);
+}
+
+static int __write_dirty_blocks(struct dm_pool_metadata *pmd)
+{
+	struct commit_io io;
+	struct md_block *mb;
+	LIST_HEAD(victims);
+	int r = 0;
+
+	atomic_set(&io.pending, 1);
+	io.error = 0;
+	init_completion(&io.done);
+
+	/* nothing changes the dirty list under root_lock held for writing */
+	list_for_each_entry(mb, &pmd->dirty, list) {
+		struct btree_node *n = to_node(mb);
+
+		n->header.csum = block_csum(n, BTREE_CSUM_XOR);
+		atomic_inc(&io.pending);
+		r = block_io(pmd, mb->b, mb->data, WRITE, block_written, &io);
+		if (r) {
+			atomic_dec(&io.pending);
+			break;
+		}
+	}
+
+	block_written(0, &io);
+	wait_for_completion(&io.done);
+	if (r || io.error)
+		return r ? : -EIO;
+
+	spin_lock(&pmd->lock);
+	list_for_each_entry(mb, &pmd->dirty, list) {
+		mb->dirty = 0;
+		pmd->nr_clean++;
+	}
+	list_splice_init(&pmd->dirty, &pmd->clean);
+	__evict_md_blocks(pmd, &victims);
+	spin_unlock(&pmd->lock);
+
+	free_md_blocks(&victims);
+	return 0;
+}
+
+static int __write_superblock(struct dm_pool_metadata *pmd)
+{
+	struct thin_disk_superblock *sb = pmd->sb;
+
+	memset(sb, 0, THIN_METADATA_BLOCK_SIZE);
+	sb->blocknr = cpu_to_le64(SUPERBLOCK_LOCATION);
+	sb->magic = cpu_to_le64(THIN_SUPERBLOCK_MAGIC);
+	sb->version = cpu_to_le32(THIN_VERSION);
+	sb->data_block_size = cpu_to_le32(pmd->data_block_size);
+	sb->trans_id = cpu_to_le64(pmd->trans_id);
+	sb->details_root = cpu_to_le64(pmd->details_root);
+	sb->metadata_nr_blocks = cpu_to_le64(pmd->metadata_sm.nr_blocks);
+	sb->data_nr_blocks = cpu_to_le64(pmd->data_sm.nr_blocks);
+	sb->csum = block_csum(sb, SUPERBLOCK_CSUM_XOR);
+
+	return block_io(pmd, SUPERBLOCK_LOCATION, sb, WRITE_FLUSH_FUA,
+			NULL, NULL);
+}
+
+static int __commit_transaction(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	r = __write_changed_details(pmd);
+	if (r)
+		return r;
+
+	r = __write_dirty_blocks(pmd);
+	if (r)
+		return r;
+
+	r = __write_superblock(pmd);
+	if (r)
+		return r;
+
+	sm_commit(&pmd->metadata_sm);
+	sm_commit(&pmd->data_sm);
+	pmd->changed = 0;
+
+	return 0;
+}
+
+static int superblock_is_zeroed(struct thin_disk_superblock *sb)
+{
+	unsigned long *p = (unsigned long *)sb;
+	unsigned i;
+
+	for (i = 0; i < THIN_METADATA_BLOCK_SIZE / sizeof(*p); i++)
+		if (p[i])
+			return 0;
+
+	return 1;
+}
+
+static int format_metadata(struct dm_pool_metadata *pmd,
+			   dm_block_t nr_data_blocks)
+{
+	dm_block_t nr_blocks;
+	int r;
+
+	nr_blocks = i_size_read(pmd->bdev->bd_inode) >>
+		    (SECTOR_SHIFT + ilog2(METADATA_BLOCK_SECTORS));
+	nr_blocks = min_t(dm_block_t, nr_blocks, MAX_METADATA_BLOCKS);
+	if (nr_blocks < 2) {
+		DMERR("metadata device is too small");
+		return -EINVAL;
+	}
+
+	r = sm_init(&pmd->metadata_sm, nr_blocks);
+	if (!r)
+		r = sm_init(&pmd->data_sm, nr_data_blocks);
+	if (r)
+		return r;
+
+	pmd->metadata_sm.counts[SUPERBLOCK_LOCATION] = 1;
+	pmd->metadata_sm.nr_free--;
+	pmd->trans_id = 0;
+
+	r = new_tree(pmd, &details_info, &pmd->details_root);
+	if (r)
+		return r;
+
+	return __commit_transaction(pmd);
+}
+
+static int open_metadata(struct dm_pool_metadata *pmd)
+{
+	struct thin_disk_superblock *sb = pmd->sb;
+	dm_block_t nr_blocks;
+	int r;
+
+	if (le64_to_cpu(sb->magic) != THIN_SUPERBLOCK_MAGIC ||
+	    sb->csum != block_csum(sb, SUPERBLOCK_CSUM_XOR)) {
+		DMERR("not a valid thin pool metadata superblock");
+		return -EILSEQ;
+	}
+
+	if (le32_to_cpu(sb->version) != THIN_VERSION) {
+		DMERR("unsupported metadata version %u",
+		      le32_to_cpu(sb->version));
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(sb->data_block_size) != pmd->data_block_size) {
+		DMERR("the data block size was %u sectors",
+		      le32_to_cpu(sb->data_block_size));
+		return -EINVAL;
+	}
+
+	nr_blocks = le64_to_cpu(sb->metadata_nr_blocks);
+	if (nr_blocks * METADATA_BLOCK_SECTORS >
+	    i_size_read(pmd->bdev->bd_inode) >> SECTOR_SHIFT) {
+		DMERR("metadata device is smaller than its metadata");
+		return -EINVAL;
+	}
+
+	r = sm_init(&pmd->metadata_sm, nr_blocks);
+	if (!r)
+		r = sm_init(&pmd->data_sm, le64_to_cpu(sb->data_nr_blocks));
+	if (r)
+		return r;
+
+	pmd->trans_id = le64_to_cpu(sb->trans_id);
+	pmd->details_root = le64_to_cpu(sb->details_root);
+
+	return rebuild_space_maps(pmd);
+}
+
+static void destroy_metadata(struct dm_pool_metadata *pmd)
+{
+	struct dm_thin_device *td, *tmp;
+	struct md_block *mb;
+	struct hlist_node *hn, *hnt;
+	unsigned i;
+
+	list_for_each_entry_safe(td, tmp, &pmd->thin_devices, list) {
+		if (td->open_count)
+			DMWARN("thin device %llu still open",
+			       (unsigned long long)td->id);
+		list_del(&td->list);
+		kfree(td);
+	}
+
+	if (pmd->buckets)
+		for (i = 0; i < (1 << BLOCK_HASH_BITS); i++)
+			hlist_for_each_entry_safe(mb, hn, hnt,
+						  pmd->buckets + i, hlist)
+				free_md_block(mb);
+
+	sm_destroy(&pmd->metadata_sm);
+	sm_destroy(&pmd->data_sm);
+
+	if (pmd->io_client)
+		dm_io_client_destroy(pmd->io_client);
+	kfree(pmd->buckets);
+	kfree(pmd->sb);
+	kfree(pmd);
+}
+
+struct dm_pool_metadata *dm_pool_metadata_open(struct block_device *bdev,
+					       sector_t data_block_size,
+					       dm_block_t nr_data_blocks)
+{
+	struct dm_pool_metadata *pmd;
+	unsigned i;
+	int r;
+
+	pmd = kzalloc(sizeof(*pmd), GFP_KERNEL);
+	if (!pmd)
+		return ERR_PTR(-ENOMEM);
+
+	pmd->bdev = bdev;
+	init_rwsem(&pmd->root_lock);
+	spin_lock_init(&pmd->lock);
+	INIT_LIST_HEAD(&pmd->clean);
+	INIT_LIST_HEAD(&pmd->dirty);
+	INIT_LIST_HEAD(&pmd->thin_devices);
+	pmd->data_block_size = data_block_size;
+
+	r = -ENOMEM;
+	pmd->sb = kmalloc(THIN_METADATA_BLOCK_SIZE, GFP_KERNEL);
+	pmd->buckets = kmalloc(sizeof(*pmd->buckets) << BLOCK_HASH_BITS,
+			       GFP_KERNEL);
+	pmd->io_client = dm_io_client_create(1);
+	if (IS_ERR(pmd->io_client)) {
+		r = PTR_ERR(pmd->io_client);
+		pmd->io_client = NULL;
+		goto bad;
+	}
+	if (!pmd->sb || !pmd->buckets)
+		goto bad;
+
+	for (i = 0; i < (1 << BLOCK_HASH_BITS); i++)
+		INIT_HLIST_HEAD(pmd->buckets + i);
+
+	r = block_io(pmd, SUPERBLOCK_LOCATION, pmd->sb, READ, NULL, NULL);
+	if (r) {
+		DMERR("couldn't read the superblock");
+		goto bad;
+	}
+
+	if (superblock_is_zeroed(pmd->sb))
+		r = format_metadata(pmd, nr_data_blocks);
+	else
+		r = open_metadata(pmd);
+	if (r)
+		goto bad;
+
+	return pmd;
+
+bad:
+	destroy_metadata(pmd);
+	return ERR_PTR(r);
+}
+
+int dm_pool_metadata_close(struct dm_pool_metadata *pmd)
+{
+	int r = 0;
+
+	down_write(&pmd->root_lock);
+	if (pmd->changed)
+		r = __commit_transaction(pmd);
+	up_write(&pmd->root_lock);
+
+	if (r)
+		DMWARN("couldn't commit the metadata on close: %d", r);
+
+	destroy_metadata(pmd);
+	return r;
+}
+
+int dm_pool_commit_metadata(struct dm_pool_metadata *pmd)
+{
+	int r = 0;
+
+	down_write(&pmd->root_lock);
+	if (pmd->changed)
+		r = __commit_transaction(pmd);
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_changed_this_transaction(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	down_read(&pmd->root_lock);
+	r = pmd->changed;
+	up_read(&pmd->root_lock);
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * Thin devices
+ *---------------------------------------------------------------*/
+static struct dm_thin_device *__find_device(struct dm_pool_metadata *pmd,
+					    dm_thin_id id)
+{
+	struct dm_thin_device *td;
+
+	list_for_each_entry(td, &pmd->thin_devices, list)
+		if (td->id == id)
+			return td;
+
+	return NULL;
+}
+
+static struct dm_thin_device *__add_device(struct dm_pool_metadata *pmd,
+					   dm_thin_id id, uint64_t mapped_blocks,
+					   dm_block_t root)
+{
+	struct dm_thin_device *td = kmalloc(sizeof(*td), GFP_NOIO);
+
+	if (!td)
+		return NULL;
+
+	td->pmd = pmd;
+	td->id = id;
+	td->open_count = 0;
+	td->changed = 0;
+	td->mapped_blocks = mapped_blocks;
+	td->root = root;
+	list_add(&td->list, &pmd->thin_devices);
+
+	return td;
+}
+
+/*
+ * Finds a device in core, or in the details tree.  Returns -ENODATA if
+ * there is none with that id.
+ */
+static int __get_device(struct dm_pool_metadata *pmd, dm_thin_id id,
+			struct dm_thin_device **result)
+{
+	struct disk_device_details dd;
+	struct dm_thin_device *td;
+	int shared, r;
+
+	td = __find_device(pmd, id);
+	if (!td) {
+		r = btree_lookup(pmd, pmd->details_root, id, 1, &dd, &shared);
+		if (r)
+			return r;
+
+		td = __add_device(pmd, id, le64_to_cpu(dd.mapped_blocks),
+				  le64_to_cpu(dd.root));
+		if (!td)
+			return -ENOMEM;
+	}
+
+	*result = td;
+	return 0;
+}
+
+static void __put_device(struct dm_thin_device *td)
+{
+	if (!td->open_count && !td->changed) {
+		list_del(&td->list);
+		kfree(td);
+	}
+}
+
+static int __device_exists(struct dm_pool_metadata *pmd, dm_thin_id id)
+{
+	struct disk_device_details dd;
+	int shared, r;
+
+	if (__find_device(pmd, id))
+		return -EEXIST;
+
+	r = btree_lookup(pmd, pmd->details_root, id, 1, &dd, &shared);
+	if (r != -ENODATA)
+		return r ? : -EEXIST;
+
+	return 0;
+}
+
+static int __create_device(struct dm_pool_metadata *pmd, dm_thin_id id,
+			   uint64_t mapped_blocks, dm_block_t root)
+{
+	struct dm_thin_device *td;
+
+	td = __add_device(pmd, id, mapped_blocks, root);
+	if (!td)
+		return -ENOMEM;
+
+	td->changed = 1;
+	pmd->changed = 1;
+
+	return 0;
+}
+
+int dm_pool_create_thin(struct dm_pool_metadata *pmd, dm_thin_id dev)
+{
+	dm_block_t root;
+	int r;
+
+	if (dev > THIN_MAX_ID)
+		return -EINVAL;
+
+	down_write(&pmd->root_lock);
+	r = __device_exists(pmd, dev);
+	if (!r)
+		r = new_tree(pmd, &mapping_info, &root);
+	if (!r) {
+		r = __create_device(pmd, dev, 0, root);
+		if (r)
+			dec_tree(pmd, &mapping_info, root);
+	}
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_create_snap(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			dm_thin_id origin)
+{
+	struct dm_thin_device *otd;
+	int r;
+
+	if (dev > THIN_MAX_ID)
+		return -EINVAL;
+
+	down_write(&pmd->root_lock);
+	r = __device_exists(pmd, dev);
+	if (r)
+		goto out;
+
+	r = __get_device(pmd, origin, &otd);
+	if (r)
+		goto out;
+
+	r = __create_device(pmd, dev, otd->mapped_blocks, otd->root);
+	if (!r)
+		sm_inc(&pmd->metadata_sm, otd->root);
+	__put_device(otd);
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+int dm_pool_delete_thin_device(struct dm_pool_metadata *pmd, dm_thin_id dev)
+{
+	struct disk_device_details dd;
+	struct dm_thin_device *td;
+	dm_block_t root;
+	int r;
+
+	down_write(&pmd->root_lock);
+	r = __get_device(pmd, dev, &td);
+	if (r)
+		goto out;
+
+	if (td->open_count) {
+		r = -EBUSY;
+		goto out;
+	}
+	root = td->root;
+
+	r = btree_remove(pmd, &details_info, &pmd->details_root, dev, &dd);
+	if (r == -ENODATA)
+		r = 0;
+	if (r) {
+		__put_device(td);
+		goto out;
+	}
+
+	list_del(&td->list);
+	kfree(td);
+	pmd->changed = 1;
+
+	r = dec_tree(pmd, &mapping_info, root);
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+int dm_pool_set_metadata_transaction_id(struct dm_pool_metadata *pmd,
+					uint64_t current_id,
+					uint64_t new_id)
+{
+	int r = 0;
+
+	down_write(&pmd->root_lock);
+	if (pmd->trans_id != current_id) {
+		DMERR("mismatched transaction id");
+		r = -EINVAL;
+	} else {
+		pmd->trans_id = new_id;
+		pmd->changed = 1;
+	}
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_get_metadata_transaction_id(struct dm_pool_metadata *pmd,
+					uint64_t *result)
+{
+	down_read(&pmd->root_lock);
+	*result = pmd->trans_id;
+	up_read(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_pool_open_thin_device(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			     struct dm_thin_device **td)
+{
+	int r;
+
+	down_write(&pmd->root_lock);
+	r = __get_device(pmd, dev, td);
+	if (!r)
+		(*td)->open_count++;
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_close_thin_device(struct dm_thin_device *td)
+{
+	struct dm_pool_metadata *pmd = td->pmd;
+
+	down_write(&pmd->root_lock);
+	td->open_count--;
+	__put_device(td);
+	up_write(&pmd->root_lock);
+
+	return 0;
+}
+
+dm_thin_id dm_thin_dev_id(struct dm_thin_device *td)
+{
+	return td->id;
+}
+
+int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
+		       int can_block, struct dm_thin_lookup_result *result)
+{
+	struct dm_pool_metadata *pmd = td->pmd;
+	__le64 value;
+	int shared, r;
+
+	if (can_block)
+		down_read(&pmd->root_lock);
+	else if (!down_read_trylock(&pmd->root_lock))
+		return -EWOULDBLOCK;
+
+	r = btree_lookup(pmd, td->root, block, can_block, &value, &shared);
+	if (!r) {
+		result->block = le64_to_cpu(value);
+		result->shared = shared ||
+				 sm_get(&pmd->data_sm, result->block) > 1;
+	}
+	up_read(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
+			 dm_block_t data_block)
+{
+	struct dm_pool_metadata *pmd = td->pmd;
+	__le64 value = cpu_to_le64(data_block), old;
+	int overwrote, r;
+
+	down_write(&pmd->root_lock);
+	r = btree_insert(pmd, &mapping_info, &td->root, block, &value,
+			 &old, &overwrote);
+	if (!r) {
+		if (overwrote)
+			sm_dec(&pmd->data_sm, le64_to_cpu(old));
+		else
+			td->mapped_blocks++;
+		td->changed = 1;
+		pmd->changed = 1;
+	}
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_thin_get_mapped_count(struct dm_thin_device *td, dm_block_t *result)
+{
+	struct dm_pool_metadata *pmd = td->pmd;
+
+	down_read(&pmd->root_lock);
+	*result = td->mapped_blocks;
+	up_read(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_thin_get_highest_mapped_block(struct dm_thin_device *td,
+				     dm_block_t *result)
+{
+	struct dm_pool_metadata *pmd = td->pmd;
+	int r;
+
+	down_read(&pmd->root_lock);
+	r = btree_find_highest_key(pmd, td->root, result);
+	up_read(&pmd->root_lock);
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * Space
+ *---------------------------------------------------------------*/
+int dm_pool_alloc_data_block(struct dm_pool_metadata *pmd, dm_block_t *result)
+{
+	int r;
+
+	down_write(&pmd->root_lock);
+	r = sm_alloc(&pmd->data_sm, result);
+	if (!r)
+		pmd->changed = 1;
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_free_data_block(struct dm_pool_metadata *pmd, dm_block_t b)
+{
+	down_write(&pmd->root_lock);
+	sm_dec(&pmd->data_sm, b);
+	up_write(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_pool_has_pinned_data_blocks(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	down_read(&pmd->root_lock);
+	r = pmd->data_sm.nr_pinned != 0;
+	up_read(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_get_free_block_count(struct dm_pool_metadata *pmd,
+				 dm_block_t *result)
+{
+	down_read(&pmd->root_lock);
+	*result = pmd->data_sm.nr_free;
+	up_read(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_pool_get_free_metadata_block_count(struct dm_pool_metadata *pmd,
+					  dm_block_t *result)
+{
+	down_read(&pmd->root_lock);
+	*result = pmd->metadata_sm.nr_free;
+	up_read(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_pool_get_metadata_dev_size(struct dm_pool_metadata *pmd,
+				  dm_block_t *result)
+{
+	down_read(&pmd->root_lock);
+	*result = pmd->metadata_sm.nr_blocks;
+	up_read(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_pool_get_data_dev_size(struct dm_pool_metadata *pmd,
+			      dm_block_t *result)
+{
+	down_read(&pmd->root_lock);
+	*result = pmd->data_sm.nr_blocks;
+	up_read(&pmd->root_lock);
+
+	return 0;
+}
+
+int dm_pool_resize_data_dev(struct dm_pool_metadata *pmd,
+			    dm_block_t new_size)
+{
+	int r = 0;
+
+	down_write(&pmd->root_lock);
+	if (new_size < pmd->data_sm.nr_blocks) {
+		DMERR("the data device can't shrink");
+		r = -EINVAL;
+	} else if (new_size > pmd->data_sm.nr_blocks) {
+		r = sm_extend(&pmd->data_sm, new_size);
+		if (!r)
+			pmd->changed = 1;
+	}
+	up_write(&pmd->root_lock);
+
+	return r;
+}
@@ -0,0 +1,154 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_THIN_METADATA_H
+#define DM_THIN_METADATA_H
+
+#include <linux/types.h>
+
+#define THIN_METADATA_BLOCK_SIZE 4096
+
+/*
+ * The metadata device holds at most this many blocks, 16GB.
+ */
+#define THIN_METADATA_MAX_SECTORS (4 * 1024 * 1024 * 8)
+
+/*----------------------------------------------------------------*/
+
+typedef uint64_t dm_block_t;
+typedef uint64_t dm_thin_id;
+
+/*
+ * Thin device ids are 24 bits wide.
+ */
+#define THIN_MAX_ID ((1 << 24) - 1)
+
+struct dm_pool_metadata;
+struct dm_thin_device;
+
+/*
+ * Opens the metadata of a pool, formatting it if the superblock is
+ * blank.  Returns an ERR_PTR on failure.
+ */
+struct dm_pool_metadata *dm_pool_metadata_open(struct block_device *bdev,
+					       sector_t data_block_size,
+					       dm_block_t nr_data_blocks);
+
+int dm_pool_metadata_close(struct dm_pool_metadata *pmd);
+
+/*
+ * Creates a new, empty thin device.
+ */
+int dm_pool_create_thin(struct dm_pool_metadata *pmd, dm_thin_id dev);
+
+/*
+ * Creates a snapshot of origin: the new device shares all of the
+ * origin's blocks.  The origin must not be written to meanwhile, so
+ * should be suspended if it is active.
+ */
+int dm_pool_create_snap(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			dm_thin_id origin);
+
+/*
+ * Deletes a device that isn't open, releasing its blocks.
+ */
+int dm_pool_delete_thin_device(struct dm_pool_metadata *pmd,
+			       dm_thin_id dev);
+
+/*
+ * Writes out all the changed metadata, then a new superblock.  The
+ * caller flushes the data device first.
+ */
+int dm_pool_commit_metadata(struct dm_pool_metadata *pmd);
+
+/*
+ * Whether anything changed since the last commit.
+ */
+int dm_pool_changed_this_transaction(struct dm_pool_metadata *pmd);
+
+/*
+ * A transaction id for userland to keep track of its changes, the
+ * pool doesn't use it.
+ */
+int dm_pool_set_metadata_transaction_id(struct dm_pool_metadata *pmd,
+					uint64_t current_id,
+					uint64_t new_id);
+
+int dm_pool_get_metadata_transaction_id(struct dm_pool_metadata *pmd,
+					uint64_t *result);
+
+/*
+ * Actions on a single thin device, which the pool target keeps open
+ * while an active thin target uses it.
+ */
+int dm_pool_open_thin_device(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			     struct dm_thin_device **td);
+
+int dm_pool_close_thin_device(struct dm_thin_device *td);
+
+dm_thin_id dm_thin_dev_id(struct dm_thin_device *td);
+
+struct dm_thin_lookup_result {
+	dm_block_t block;
+	int shared;
+};
+
+/*
+ * Returns:
+ *   -EWOULDBLOCK iff @can_block is set and would block.
+ *   -ENODATA iff that mapping is not present.
+ *   0 success
+ */
+int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
+		       int can_block, struct dm_thin_lookup_result *result);
+
+/*
+ * Maps block to data_block, dropping the device's reference to the
+ * data block it was mapped to before, if any.
+ */
+int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
+			 dm_block_t data_block);
+
+int dm_thin_get_mapped_count(struct dm_thin_device *td, dm_block_t *result);
+
+int dm_thin_get_highest_mapped_block(struct dm_thin_device *td,
+				     dm_block_t *result);
+
+/*
+ * Allocates a data block, which is only kept once mapped by
+ * dm_thin_insert_block().  -ENOSPC if there is none free.
+ */
+int dm_pool_alloc_data_block(struct dm_pool_metadata *pmd, dm_block_t *result);
+
+/*
+ * Releases a data block allocated and never mapped.
+ */
+int dm_pool_free_data_block(struct dm_pool_metadata *pmd, dm_block_t b);
+
+/*
+ * Whether freed blocks are waiting for the next commit to be reused.
+ */
+int dm_pool_has_pinned_data_blocks(struct dm_pool_metadata *pmd);
+
+int dm_pool_get_free_block_count(struct dm_pool_metadata *pmd,
+				 dm_block_t *result);
+
+int dm_pool_get_free_metadata_block_count(struct dm_pool_metadata *pmd,
+					  dm_block_t *result);
+
+int dm_pool_get_metadata_dev_size(struct dm_pool_metadata *pmd,
+				  dm_block_t *result);
+
+int dm_pool_get_data_dev_size(struct dm_pool_metadata *pmd,
+			      dm_block_t *result);
+
+/*
+ * The data device can only grow.
+ */
+int dm_pool_resize_data_dev(struct dm_pool_metadata *pmd,
+			    dm_block_t new_size);
+
+/*----------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,1974 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Thin provisioning: thin devices are carved out of a pool of data
+ * blocks on demand, the first time each block is written.  A snapshot
+ * of a thin device shares its blocks with the origin, the sharing is
+ * only broken on the first write to a shared block, whichever of the
+ * devices it is written through.
+ *
+ * The "thin-pool" target owns the metadata and the data devices and
+ * does the provisioning, in a worker.  The "thin" targets map their
+ * bios to the data device directly when the block is mapped and not
+ * shared, and defer the rest to the pool.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include <linux/device-mapper.h>
+
+#include "dm-thin-metadata.h"
+
+#define DM_MSG_PREFIX "thin"
+
+/*
+ * Tunable constants
+ */
+#define ENDIO_HOOK_POOL_SIZE	10240
+#define MAPPING_POOL_SIZE	1024
+#define CELL_POOL_SIZE		1024
+#define PRISON_HASH_BITS	8
+#define DEFERRED_SET_SIZE	64
+#define COPY_PAGES		256
+#define COMMIT_PERIOD		HZ
+
+/*
+ * The block size of the data device is a power of two between 64k and
+ * 1g, in sectors.
+ */
+#define DATA_DEV_BLOCK_SIZE_MIN_SECTORS (64 * 1024 >> SECTOR_SHIFT)
+#define DATA_DEV_BLOCK_SIZE_MAX_SECTORS (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*-----------------------------------------------------------------
+ * The bio prison: the bios to a block being provisioned, or whose
+ * sharing is being broken, wait in a cell for it to be done.  The
+ * first bio detained is the holder of the cell.
+ *---------------------------------------------------------------*/
+struct cell_key {
+	dm_thin_id dev;
+	dm_block_t block;
+};
+
+struct cell {
+	struct hlist_node list;
+	struct bio_prison *prison;
+	struct cell_key key;
+	struct bio *holder;
+	struct bio_list bios;
+};
+
+struct bio_prison {
+	spinlock_t lock;
+	mempool_t *cell_pool;
+	struct hlist_head cells[1 << PRISON_HASH_BITS];
+};
+
+static struct kmem_cache *_cell_cache;
+
+static struct bio_prison *prison_create(void)
+{
+	struct bio_prison *prison = kmalloc(sizeof(*prison), GFP_KERNEL);
+	unsigned i;
+
+	if (!prison)
+		return NULL;
+
+	spin_lock_init(&prison->lock);
+	prison->cell_pool = mempool_create_slab_pool(CELL_POOL_SIZE,
+						     _cell_cache);
+	if (!prison->cell_pool) {
+		kfree(prison);
+		return NULL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(prison->cells); i++)
+		INIT_HLIST_HEAD(prison->cells + i);
+
+	return prison;
+}
+
+static void prison_destroy(struct bio_prison *prison)
+{
+	mempool_destroy(prison->cell_pool);
+	kfree(prison);
+}
+
+static struct hlist_head *key_bucket(struct bio_prison *prison,
+				     struct cell_key *key)
+{
+	return prison->cells +
+		hash_64(key->block ^ (key->dev << 40), PRISON_HASH_BITS);
+}
+
+static struct cell *__search_bucket(struct hlist_head *bucket,
+				    struct cell_key *key)
+{
+	struct hlist_node *hn;
+	struct cell *cell;
+
+	hlist_for_each_entry(cell, hn, bucket, list)
+		if (cell->key.dev == key->dev && cell->key.block == key->block)
+			return cell;
+
+	return NULL;
+}
+
+/*
+ * Returns 1 if the cell was already held and bio queued in it, 0 if
+ * bio is the holder of a new cell.
+ */
+static int bio_detain(struct bio_prison *prison, struct cell_key *key,
+		      struct bio *bio, struct cell **result)
+{
+	struct hlist_head *bucket = key_bucket(prison, key);
+	struct cell *cell, *new;
+	unsigned long flags;
+	int held = 0;
+
+	/* allocated outside the lock, only the pool worker detains bios */
+	new = mempool_alloc(prison->cell_pool, GFP_NOIO);
+
+	spin_lock_irqsave(&prison->lock, flags);
+	cell = __search_bucket(bucket, key);
+	if (cell) {
+		bio_list_add(&cell->bios, bio);
+		held = 1;
+	} else {
+		cell = new;
+		cell->prison = prison;
+		cell->key = *key;
+		cell->holder = bio;
+		bio_list_init(&cell->bios);
+		hlist_add_head(&cell->list, bucket);
+	}
+	spin_unlock_irqrestore(&prison->lock, flags);
+
+	if (held)
+		mempool_free(new, prison->cell_pool);
+
+	*result = cell;
+	return held;
+}
+
+/*
+ * Frees the cell, adding its holder (if with_holder) and its other bios
+ * to inmates.
+ */
+static void cell_release(struct cell *cell, struct bio_list *inmates,
+			 int with_holder)
+{
+	struct bio_prison *prison = cell->prison;
+	unsigned long flags;
+
+	spin_lock_irqsave(&prison->lock, flags);
+	hlist_del(&cell->list);
+	spin_unlock_irqrestore(&prison->lock, flags);
+
+	if (with_holder)
+		bio_list_add(inmates, cell->holder);
+	bio_list_merge(inmates, &cell->bios);
+
+	mempool_free(cell, prison->cell_pool);
+}
+
+/*
+ * Releases a cell nobody else came to, the common case.
+ */
+static void cell_release_singleton(struct cell *cell, struct bio *bio)
+{
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	cell_release(cell, &bios, 1);
+	BUG_ON(bio_list_pop(&bios) != bio || !bio_list_empty(&bios));
+}
+
+static void cell_error(struct cell *cell)
+{
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+	cell_release(cell, &bios, 1);
+
+	while ((bio = bio_list_pop(&bios)))
+		bio_io_error(bio);
+}
+
+/*-----------------------------------------------------------------
+ * The deferred set: a new mapping breaking the sharing of a block must
+ * wait for the reads to shared blocks that were in flight when it was
+ * scheduled, once mapped the old block might be overwritten by the
+ * device still using it.  The reads are counted in the current entry of
+ * a ring, the mapping is queued on that entry and runs once no read of
+ * it or of an older entry is in flight.
+ *---------------------------------------------------------------*/
+struct deferred_set;
+
+struct deferred_entry {
+	struct deferred_set *ds;
+	unsigned count;
+	struct list_head work_items;
+};
+
+struct deferred_set {
+	spinlock_t lock;
+	unsigned current_entry;
+	unsigned sweeper;
+	struct deferred_entry entries[DEFERRED_SET_SIZE];
+};
+
+static void ds_init(struct deferred_set *ds)
+{
+	unsigned i;
+
+	spin_lock_init(&ds->lock);
+	ds->current_entry = 0;
+	ds->sweeper = 0;
+	for (i = 0; i < DEFERRED_SET_SIZE; i++) {
+		ds->entries[i].ds = ds;
+		ds->entries[i].count = 0;
+		INIT_LIST_HEAD(&ds->entries[i].work_items);
+	}
+}
+
+static struct deferred_entry *ds_inc(struct deferred_set *ds)
+{
+	unsigned long flags;
+	struct deferred_entry *entry;
+
+	spin_lock_irqsave(&ds->lock, flags);
+	entry = ds->entries + ds->current_entry;
+	entry->count++;
+	spin_unlock_irqrestore(&ds->lock, flags);
+
+	return entry;
+}
+
+static unsigned ds_next(unsigned index)
+{
+	return (index + 1) % DEFERRED_SET_SIZE;
+}
+
+static void __sweep(struct deferred_set *ds, struct list_head *head)
+{
+	while (ds->sweeper != ds->current_entry &&
+	       !ds->entries[ds->sweeper].count) {
+		list_splice_init(&ds->entries[ds->sweeper].work_items, head);
+		ds->sweeper = ds_next(ds->sweeper);
+	}
+
+	if (ds->sweeper == ds->current_entry &&
+	    !ds->entries[ds->sweeper].count)
+		list_splice_init(&ds->entries[ds->sweeper].work_items, head);
+}
+
+/*
+ * Moves the work that no longer waits for anything to head.
+ */
+static void ds_dec(struct deferred_entry *entry, struct list_head *head)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&entry->ds->lock, flags);
+	BUG_ON(!entry->count);
+	--entry->count;
+	__sweep(entry->ds, head);
+	spin_unlock_irqrestore(&entry->ds->lock, flags);
+}
+
+/*
+ * Returns 1 if the work was queued, 0 if it doesn't have to wait.
+ */
+static int ds_add_work(struct deferred_set *ds, struct list_head *work)
+{
+	unsigned long flags;
+	unsigned next_entry;
+	int r = 1;
+
+	spin_lock_irqsave(&ds->lock, flags);
+	if (ds->sweeper == ds->current_entry &&
+	    !ds->entries[ds->current_entry].count)
+		r = 0;
+	else {
+		list_add(work, &ds->entries[ds->current_entry].work_items);
+		next_entry = ds_next(ds->current_entry);
+		if (!ds->entries[next_entry].count)
+			ds->current_entry = next_entry;
+	}
+	spin_unlock_irqrestore(&ds->lock, flags);
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * A pool is shared by the pool target and the thin targets using it,
+ * and survives the reloads of the pool device table.
+ *---------------------------------------------------------------*/
+struct new_mapping;
+
+struct pool {
+	struct list_head list;
+	struct dm_target *ti;		/* the pool target bound */
+	struct mapped_device *pool_md;
+	struct block_device *md_dev;
+	struct block_device *data_dev;
+	struct dm_pool_metadata *pmd;
+
+	sector_t sectors_per_block;
+	unsigned block_shift;
+	dm_block_t low_water_blocks;
+	int zero_new_blocks;
+	int low_water_triggered;	/* a dm event was sent */
+	int no_free_space;		/* bios wait for the pool to grow */
+
+	struct bio_prison *prison;
+	struct dm_kcopyd_client *copier;
+	struct dm_io_client *io_client;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+	unsigned long last_commit_jiffies;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_flush_bios;
+	struct list_head prepared_mappings;
+	struct bio_list retry_on_resume_list;
+
+	struct deferred_set shared_read_ds;
+
+	struct new_mapping *next_mapping;
+	mempool_t *mapping_pool;
+	mempool_t *endio_hook_pool;
+
+	unsigned ref_count;
+};
+
+/*
+ * Target context for a pool.
+ */
+struct pool_c {
+	struct dm_target *ti;
+	struct pool *pool;
+	struct dm_dev *data_dev;
+	struct dm_dev *metadata_dev;
+
+	dm_block_t low_water_blocks;
+	int zero_new_blocks;
+};
+
+/*
+ * Target context for a thin device.
+ */
+struct thin_c {
+	struct dm_dev *pool_dev;
+	dm_thin_id dev_id;
+
+	struct pool *pool;
+	struct dm_thin_device *td;
+};
+
+struct endio_hook {
+	struct thin_c *tc;
+	struct deferred_entry *shared_read_entry;
+	struct new_mapping *overwrite_mapping;
+};
+
+/*
+ * A data block being prepared, zeroed or copied, for virt_block.  The
+ * bios to virt_block wait in cell until it is mapped.  The mapping is
+ * inserted once it is both prepared and quiesced, no read to the block
+ * it copies still being in flight.  If bio writes the whole block, it
+ * is the one preparing it.
+ */
+struct new_mapping {
+	struct list_head list;
+
+	int quiesced;
+	int prepared;
+
+	struct thin_c *tc;
+	dm_block_t virt_block;
+	dm_block_t data_block;
+	struct cell *cell;
+	int err;
+
+	struct bio *bio;
+};
+
+static struct kmem_cache *_new_mapping_cache;
+static struct kmem_cache *_endio_hook_cache;
+
+/*
+ * Writes from it zero the whole length of a block.
+ */
+static struct page_list _zero_page_list;
+
+/*
+ * The pools, by pool mapped device.
+ */
+static struct {
+	struct mutex mutex;
+	struct list_head pools;
+} dm_thin_pool_table;
+
+static void pool_table_init(void)
+{
+	mutex_init(&dm_thin_pool_table.mutex);
+	INIT_LIST_HEAD(&dm_thin_pool_table.pools);
+}
+
+static struct pool *__pool_table_lookup(struct mapped_device *md)
+{
+	struct pool *pool;
+
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+
+	list_for_each_entry(pool, &dm_thin_pool_table.pools, list)
+		if (pool->pool_md == md)
+			return pool;
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------
+ * Remapping and the worker
+ *---------------------------------------------------------------*/
+static dm_block_t get_bio_block(struct thin_c *tc, struct bio *bio)
+{
+	return bio->bi_sector >> tc->pool->block_shift;
+}
+
+static void remap(struct thin_c *tc, struct bio *bio, dm_block_t block)
+{
+	struct pool *pool = tc->pool;
+
+	bio->bi_bdev = pool->data_dev;
+	bio->bi_sector = (block << pool->block_shift) +
+			 (bio->bi_sector & (pool->sectors_per_block - 1));
+}
+
+static void remap_and_issue(struct thin_c *tc, struct bio *bio,
+			    dm_block_t block)
+{
+	remap(tc, bio, block);
+	generic_make_request(bio);
+}
+
+static void wake_worker(struct pool *pool)
+{
+	queue_work(pool->wq, &pool->worker);
+}
+
+static void defer_bio(struct pool *pool, struct bio *bio)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_add(&pool->deferred_bios, bio);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+/*
+ * Hands all the bios of a released cell back to the worker.
+ */
+static void cell_defer(struct pool *pool, struct cell *cell, int with_holder)
+{
+	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	cell_release(cell, &bios, with_holder);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&pool->deferred_bios, &bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+/*
+ * Out of data space: the bios wait for the pool to be resumed, most
+ * likely after growing it.
+ */
+static void no_space(struct pool *pool, struct cell *cell)
+{
+	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	cell_release(cell, &bios, 1);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&pool->retry_on_resume_list, &bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/*
+ * The data written before has to be on disk before the metadata
+ * pointing to it.
+ */
+static int commit(struct pool *pool)
+{
+	int r;
+
+	pool->last_commit_jiffies = jiffies;
+	if (!dm_pool_changed_this_transaction(pool->pmd))
+		return 0;
+
+	r = blkdev_issue_flush(pool->data_dev, GFP_NOIO, NULL,
+			       BLKDEV_IFL_WAIT);
+	if (r && r != -EOPNOTSUPP) {
+		DMERR("flushing the data device failed: %d", r);
+		return r;
+	}
+
+	r = dm_pool_commit_metadata(pool->pmd);
+	if (r)
+		DMERR("commit failed: %d", r);
+
+	return r;
+}
+
+static int alloc_data_block(struct pool *pool, dm_block_t *result)
+{
+	dm_block_t free_blocks;
+	unsigned long flags;
+	int r;
+
+	r = dm_pool_get_free_block_count(pool->pmd, &free_blocks);
+	if (r)
+		return r;
+
+	if (free_blocks <= pool->low_water_blocks && !pool->low_water_triggered) {
+		DMWARN("%s: reached low water mark, sending event.",
+		       dm_device_name(pool->pool_md));
+		spin_lock_irqsave(&pool->lock, flags);
+		pool->low_water_triggered = 1;
+		spin_unlock_irqrestore(&pool->lock, flags);
+		if (pool->ti)
+			dm_table_event(pool->ti->table);
+	}
+
+	if (!free_blocks) {
+		if (pool->no_free_space ||
+		    !dm_pool_has_pinned_data_blocks(pool->pmd))
+			goto no_space;
+
+		/* the blocks freed in this transaction come back on commit */
+		r = commit(pool);
+		if (r)
+			return r;
+
+		r = dm_pool_get_free_block_count(pool->pmd, &free_blocks);
+		if (r)
+			return r;
+		if (!free_blocks)
+			goto no_space;
+	}
+
+	return dm_pool_alloc_data_block(pool->pmd, result);
+
+no_space:
+	if (!pool->no_free_space) {
+		DMWARN("%s: no free space available.",
+		       dm_device_name(pool->pool_md));
+		pool->no_free_space = 1;
+	}
+	return -ENOSPC;
+}
+
+/*
+ * The worker can't wait for a mapping, it is the one freeing them: it
+ * reserves the next one before looking at a bio.
+ */
+static int ensure_next_mapping(struct pool *pool)
+{
+	if (pool->next_mapping)
+		return 0;
+
+	pool->next_mapping = mempool_alloc(pool->mapping_pool, GFP_ATOMIC);
+
+	return pool->next_mapping ? 0 : -ENOMEM;
+}
+
+static struct new_mapping *get_next_mapping(struct pool *pool)
+{
+	struct new_mapping *m = pool->next_mapping;
+
+	BUG_ON(!m);
+	pool->next_mapping = NULL;
+
+	INIT_LIST_HEAD(&m->list);
+	m->quiesced = 0;
+	m->prepared = 0;
+	m->err = 0;
+	m->bio = NULL;
+
+	return m;
+}
+
+static void __maybe_add_mapping(struct new_mapping *m)
+{
+	struct pool *pool = m->tc->pool;
+
+	if (m->quiesced && m->prepared)
+		list_add(&m->list, &pool->prepared_mappings);
+}
+
+static void complete_mapping(struct new_mapping *m, int err)
+{
+	struct pool *pool = m->tc->pool;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	m->err = err;
+	m->prepared = 1;
+	__maybe_add_mapping(m);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	complete_mapping(context, read_err || write_err ? -EIO : 0);
+}
+
+static void zero_complete(unsigned long error, void *context)
+{
+	complete_mapping(context, error ? -EIO : 0);
+}
+
+static int io_overwrites_block(struct pool *pool, struct bio *bio)
+{
+	return bio_data_dir(bio) == WRITE &&
+		bio->bi_size == pool->sectors_per_block << SECTOR_SHIFT;
+}
+
+/*
+ * Inserts a prepared mapping and lets the bios waiting for it go.
+ */
+static void process_prepared_mapping(struct new_mapping *m)
+{
+	struct thin_c *tc = m->tc;
+	struct pool *pool = tc->pool;
+	struct bio *bio = m->bio;
+	int r = m->err;
+
+	if (!r) {
+		r = dm_thin_insert_block(tc->td, m->virt_block, m->data_block);
+		if (r)
+			DMERR("dm_thin_insert_block() failed: %d", r);
+	}
+
+	if (r)
+		dm_pool_free_data_block(pool->pmd, m->data_block);
+
+	if (bio) {
+		/* the other bios try again on error */
+		cell_defer(pool, m->cell, 0);
+		bio_endio(bio, r);
+	} else if (r)
+		cell_error(m->cell);
+	else
+		cell_defer(pool, m->cell, 1);
+
+	mempool_free(m, pool->mapping_pool);
+}
+
+static void process_prepared_mappings(struct pool *pool)
+{
+	struct new_mapping *m, *tmp;
+	unsigned long flags;
+	LIST_HEAD(maps);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_splice_init(&pool->prepared_mappings, &maps);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	list_for_each_entry_safe(m, tmp, &maps, list) {
+		list_del(&m->list);
+		process_prepared_mapping(m);
+	}
+}
+
+/*
+ * The bio writing the whole new block prepares it, the mapping is
+ * completed from the end_io method.
+ */
+static void overwrite_block(struct thin_c *tc, struct new_mapping *m,
+			    struct bio *bio)
+{
+	struct endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+	h->overwrite_mapping = m;
+	m->bio = bio;
+	remap_and_issue(tc, bio, m->data_block);
+}
+
+static void schedule_zero(struct thin_c *tc, dm_block_t virt_block,
+			  dm_block_t data_block, struct cell *cell,
+			  struct bio *bio)
+{
+	struct pool *pool = tc->pool;
+	struct new_mapping *m = get_next_mapping(pool);
+	struct dm_io_region to;
+	struct dm_io_request io_req;
+	int r;
+
+	m->tc = tc;
+	m->virt_block = virt_block;
+	m->data_block = data_block;
+	m->cell = cell;
+	m->quiesced = 1;
+
+	if (!pool->zero_new_blocks) {
+		m->prepared = 1;
+		process_prepared_mapping(m);
+		return;
+	}
+
+	if (io_overwrites_block(pool, bio)) {
+		overwrite_block(tc, m, bio);
+		return;
+	}
+
+	to.bdev = pool->data_dev;
+	to.sector = data_block << pool->block_shift;
+	to.count = pool->sectors_per_block;
+
+	io_req.bi_rw = WRITE;
+	io_req.mem.type = DM_IO_PAGE_LIST;
+	io_req.mem.ptr.pl = &_zero_page_list;
+	io_req.mem.offset = 0;
+	io_req.notify.fn = zero_complete;
+	io_req.notify.context = m;
+	io_req.client = pool->io_client;
+
+	r = dm_io(&io_req, 1, &to, NULL);
+	if (r < 0) {
+		DMERR("zeroing a new block failed: %d", r);
+		dm_pool_free_data_block(pool->pmd, data_block);
+		mempool_free(m, pool->mapping_pool);
+		cell_error(cell);
+	}
+}
+
+static void schedule_copy(struct thin_c *tc, dm_block_t virt_block,
+			  dm_block_t data_origin, dm_block_t data_dest,
+			  struct cell *cell, struct bio *bio)
+{
+	struct pool *pool = tc->pool;
+	struct new_mapping *m = get_next_mapping(pool);
+	struct dm_io_region from, to;
+	int r;
+
+	m->tc = tc;
+	m->virt_block = virt_block;
+	m->data_block = data_dest;
+	m->cell = cell;
+	if (!ds_add_work(&pool->shared_read_ds, &m->list))
+		m->quiesced = 1;
+
+	if (io_overwrites_block(pool, bio)) {
+		overwrite_block(tc, m, bio);
+		return;
+	}
+
+	from.bdev = pool->data_dev;
+	from.sector = data_origin << pool->block_shift;
+	from.count = pool->sectors_per_block;
+
+	to.bdev = pool->data_dev;
+	to.sector = data_dest << pool->block_shift;
+	to.count = pool->sectors_per_block;
+
+	r = dm_kcopyd_copy(pool->copier, &from, 1, &to, 0, copy_complete, m);
+	if (r < 0) {
+		DMERR("dm_kcopyd_copy() failed: %d", r);
+		complete_mapping(m, r);
+	}
+}
+
+static void provision_block(struct thin_c *tc, struct bio *bio,
+			    dm_block_t block, struct cell *cell)
+{
+	dm_block_t data_block;
+	int r;
+
+	r = alloc_data_block(tc->pool, &data_block);
+	switch (r) {
+	case 0:
+		schedule_zero(tc, block, data_block, cell, bio);
+		break;
+
+	case -ENOSPC:
+		no_space(tc->pool, cell);
+		break;
+
+	default:
+		DMERR("%s: alloc_data_block() failed: %d", __func__, r);
+		cell_error(cell);
+		break;
+	}
+}
+
+static void break_sharing(struct thin_c *tc, struct bio *bio,
+			  dm_block_t block, dm_block_t data_origin,
+			  struct cell *cell)
+{
+	dm_block_t data_block;
+	int r;
+
+	r = alloc_data_block(tc->pool, &data_block);
+	switch (r) {
+	case 0:
+		schedule_copy(tc, block, data_origin, data_block, cell, bio);
+		break;
+
+	case -ENOSPC:
+		no_space(tc->pool, cell);
+		break;
+
+	default:
+		DMERR("%s: alloc_data_block() failed: %d", __func__, r);
+		cell_error(cell);
+		break;
+	}
+}
+
+static void process_bio(struct thin_c *tc, struct bio *bio)
+{
+	dm_block_t block = get_bio_block(tc, bio);
+	struct dm_thin_lookup_result result;
+	struct cell_key key;
+	struct cell *cell;
+	int r;
+
+	key.dev = tc->dev_id;
+	key.block = block;
+	if (bio_detain(tc->pool->prison, &key, bio, &cell))
+		return;
+
+	r = dm_thin_find_block(tc->td, block, 1, &result);
+	switch (r) {
+	case 0:
+		if (result.shared && bio_data_dir(bio) == WRITE)
+			break_sharing(tc, bio, block, result.block, cell);
+		else {
+			if (result.shared) {
+				struct endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+				h->shared_read_entry =
+					ds_inc(&tc->pool->shared_read_ds);
+			}
+			cell_release_singleton(cell, bio);
+			remap_and_issue(tc, bio, result.block);
+		}
+		break;
+
+	case -ENODATA:
+		if (bio_data_dir(bio) == READ) {
+			cell_release_singleton(cell, bio);
+			zero_fill_bio(bio);
+			bio_endio(bio, 0);
+		} else
+			provision_block(tc, bio, block, cell);
+		break;
+
+	default:
+		DMERR("dm_thin_find_block() failed: %d", r);
+		cell_error(cell);
+		break;
+	}
+}
+
+static void process_deferred_bios(struct pool *pool)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&bios, &pool->deferred_bios);
+	bio_list_init(&pool->deferred_bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		struct endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+		/*
+		 * Out of mappings: try again once the ones in flight are
+		 * done, they wake us.
+		 */
+		if (ensure_next_mapping(pool)) {
+			spin_lock_irqsave(&pool->lock, flags);
+			bio_list_merge_head(&pool->deferred_bios, &bios);
+			bio_list_add_head(&pool->deferred_bios, bio);
+			spin_unlock_irqrestore(&pool->lock, flags);
+			break;
+		}
+
+		process_bio(h->tc, bio);
+	}
+}
+
+/*
+ * The flushes complete once the data written before them and the
+ * metadata mapping it are on disk.  The metadata is also committed
+ * every COMMIT_PERIOD.
+ */
+static void process_deferred_flushes(struct pool *pool)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+	int r;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&bios, &pool->deferred_flush_bios);
+	bio_list_init(&pool->deferred_flush_bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	if (bio_list_empty(&bios) &&
+	    time_before(jiffies, pool->last_commit_jiffies + COMMIT_PERIOD))
+		return;
+
+	r = commit(pool);
+	while ((bio = bio_list_pop(&bios))) {
+		if (r)
+			bio_endio(bio, r);
+		else {
+			bio->bi_bdev = pool->data_dev;
+			generic_make_request(bio);
+		}
+	}
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct pool *pool = container_of(ws, struct pool, worker);
+
+	process_prepared_mappings(pool);
+	process_deferred_bios(pool);
+	process_deferred_flushes(pool);
+}
+
+static void do_waker(struct work_struct *ws)
+{
+	struct pool *pool = container_of(to_delayed_work(ws), struct pool,
+					 waker);
+
+	wake_worker(pool);
+	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
+}
+
+/*-----------------------------------------------------------------
+ * Pools
+ *---------------------------------------------------------------*/
+static void pool_destroy(struct pool *pool)
+{
+	if (dm_pool_metadata_close(pool->pmd) < 0)
+		DMWARN("%s: dm_pool_metadata_close() failed.", __func__);
+
+	if (pool->next_mapping)
+		mempool_free(pool->next_mapping, pool->mapping_pool);
+	mempool_destroy(pool->mapping_pool);
+	mempool_destroy(pool->endio_hook_pool);
+	destroy_workqueue(pool->wq);
+	dm_io_client_destroy(pool->io_client);
+	dm_kcopyd_client_destroy(pool->copier);
+	prison_destroy(pool->prison);
+	kfree(pool);
+}
+
+static struct pool *pool_create(struct mapped_device *pool_md,
+				struct block_device *metadata_dev,
+				unsigned long block_size,
+				dm_block_t nr_data_blocks, char **error)
+{
+	struct dm_pool_metadata *pmd;
+	struct pool *pool;
+	int r;
+
+	pmd = dm_pool_metadata_open(metadata_dev, block_size, nr_data_blocks);
+	if (IS_ERR(pmd)) {
+		*error = "Error opening metadata";
+		return (struct pool *)pmd;
+	}
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool) {
+		*error = "Error allocating memory for pool";
+		r = -ENOMEM;
+		goto bad_pool;
+	}
+
+	pool->pool_md = pool_md;
+	pool->md_dev = metadata_dev;
+	pool->pmd = pmd;
+	pool->sectors_per_block = block_size;
+	pool->block_shift = ffs(block_size) - 1;
+	pool->zero_new_blocks = 1;
+
+	pool->prison = prison_create();
+	if (!pool->prison) {
+		*error = "Error creating pool's bio prison";
+		r = -ENOMEM;
+		goto bad_prison;
+	}
+
+	r = dm_kcopyd_client_create(COPY_PAGES, &pool->copier);
+	if (r) {
+		*error = "Error creating pool's kcopyd client";
+		goto bad_kcopyd_client;
+	}
+
+	pool->io_client = dm_io_client_create(1);
+	if (IS_ERR(pool->io_client)) {
+		*error = "Error creating pool's dm-io client";
+		r = PTR_ERR(pool->io_client);
+		goto bad_io_client;
+	}
+
+	pool->wq = create_singlethread_workqueue("dm-" DM_MSG_PREFIX);
+	if (!pool->wq) {
+		*error = "Error creating pool's workqueue";
+		r = -ENOMEM;
+		goto bad_wq;
+	}
+
+	INIT_WORK(&pool->worker, do_worker);
+	INIT_DELAYED_WORK(&pool->waker, do_waker);
+	spin_lock_init(&pool->lock);
+	bio_list_init(&pool->deferred_bios);
+	bio_list_init(&pool->deferred_flush_bios);
+	INIT_LIST_HEAD(&pool->prepared_mappings);
+	bio_list_init(&pool->retry_on_resume_list);
+	ds_init(&pool->shared_read_ds);
+	pool->last_commit_jiffies = jiffies;
+
+	pool->mapping_pool = mempool_create_slab_pool(MAPPING_POOL_SIZE,
+						      _new_mapping_cache);
+	if (!pool->mapping_pool) {
+		*error = "Error creating pool's mapping mempool";
+		r = -ENOMEM;
+		goto bad_mapping_pool;
+	}
+
+	pool->endio_hook_pool = mempool_create_slab_pool(ENDIO_HOOK_POOL_SIZE,
+							 _endio_hook_cache);
+	if (!pool->endio_hook_pool) {
+		*error = "Error creating pool's endio_hook mempool";
+		r = -ENOMEM;
+		goto bad_endio_hook_pool;
+	}
+
+	pool->ref_count = 1;
+	list_add(&pool->list, &dm_thin_pool_table.pools);
+
+	return pool;
+
+bad_endio_hook_pool:
+	mempool_destroy(pool->mapping_pool);
+bad_mapping_pool:
+	destroy_workqueue(pool->wq);
+bad_wq:
+	dm_io_client_destroy(pool->io_client);
+bad_io_client:
+	dm_kcopyd_client_destroy(pool->copier);
+bad_kcopyd_client:
+	prison_destroy(pool->prison);
+bad_prison:
+	kfree(pool);
+bad_pool:
+	if (dm_pool_metadata_close(pmd))
+		DMWARN("%s: dm_pool_metadata_close() failed.", __func__);
+
+	return ERR_PTR(r);
+}
+
+static void __pool_inc(struct pool *pool)
+{
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+	pool->ref_count++;
+}
+
+static void __pool_dec(struct pool *pool)
+{
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+	BUG_ON(!pool->ref_count);
+	if (!--pool->ref_count) {
+		list_del(&pool->list);
+		pool_destroy(pool);
+	}
+}
+
+static struct pool *__pool_find(struct mapped_device *pool_md,
+				struct block_device *metadata_dev,
+				unsigned long block_size,
+				dm_block_t nr_data_blocks, char **error)
+{
+	struct pool *pool = __pool_table_lookup(pool_md);
+
+	if (!pool)
+		return pool_create(pool_md, metadata_dev, block_size,
+				   nr_data_blocks, error);
+
+	if (pool->md_dev != metadata_dev) {
+		*error = "Metadata device differs from the pool's";
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (pool->sectors_per_block != block_size) {
+		*error = "Block size differs from the pool's";
+		return ERR_PTR(-EINVAL);
+	}
+
+	__pool_inc(pool);
+	return pool;
+}
+
+static void bind_control_target(struct pool *pool, struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+
+	pool->ti = ti;
+	pool->data_dev = pt->data_dev->bdev;
+	pool->low_water_blocks = pt->low_water_blocks;
+	pool->zero_new_blocks = pt->zero_new_blocks;
+}
+
+/*-----------------------------------------------------------------
+ * Pool target methods
+ *---------------------------------------------------------------*/
+static void pool_dtr(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	if (pt->pool->ti == ti)
+		pt->pool->ti = NULL;
+	__pool_dec(pt->pool);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	dm_put_device(ti, pt->metadata_dev);
+	dm_put_device(ti, pt->data_dev);
+	kfree(pt);
+}
+
+static int parse_pool_features(struct dm_target *ti, struct pool_c *pt,
+			       unsigned argc, char **argv)
+{
+	unsigned nr_features;
+	char dummy;
+
+	if (!argc)
+		return 0;
+
+	if (sscanf(argv[0], "%u%c", &nr_features, &dummy) != 1 ||
+	    nr_features != argc - 1) {
+		ti->error = "Invalid number of pool feature arguments";
+		return -EINVAL;
+	}
+
+	for (argv++; nr_features--; argv++) {
+		if (strcasecmp(*argv, "skip_block_zeroing")) {
+			ti->error = "Unrecognised pool feature requested";
+			return -EINVAL;
+		}
+		pt->zero_new_blocks = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * thin-pool <metadata dev> <data dev> <data block size (sectors)>
+ *	     <low water mark (blocks)> [<#feature args> [<arg>]*]
+ *
+ * Optional feature arguments are:
+ *	     skip_block_zeroing: skips the zeroing of newly-provisioned blocks.
+ */
+static int pool_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct pool_c *pt;
+	struct pool *pool;
+	unsigned long block_size;
+	unsigned long long low_water;
+	sector_t data_size;
+	char dummy;
+	int r;
+
+	if (argc < 4) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	pt = kzalloc(sizeof(*pt), GFP_KERNEL);
+	if (!pt) {
+		ti->error = "Error allocating pool context";
+		return -ENOMEM;
+	}
+	pt->ti = ti;
+	pt->zero_new_blocks = 1;
+
+	r = -EINVAL;
+	if (sscanf(argv[2], "%lu%c", &block_size, &dummy) != 1 ||
+	    block_size < DATA_DEV_BLOCK_SIZE_MIN_SECTORS ||
+	    block_size > DATA_DEV_BLOCK_SIZE_MAX_SECTORS ||
+	    !is_power_of_2(block_size)) {
+		ti->error = "Invalid block size";
+		goto bad;
+	}
+
+	if (sscanf(argv[3], "%llu%c", &low_water, &dummy) != 1) {
+		ti->error = "Invalid low water mark";
+		goto bad;
+	}
+	pt->low_water_blocks = low_water;
+
+	r = parse_pool_features(ti, pt, argc - 4, argv + 4);
+	if (r)
+		goto bad;
+
+	r = dm_get_device(ti, argv[0], FMODE_READ | FMODE_WRITE,
+			  &pt->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata block device";
+		goto bad;
+	}
+
+	if (i_size_read(pt->metadata_dev->bdev->bd_inode) >> SECTOR_SHIFT >
+	    THIN_METADATA_MAX_SECTORS)
+		DMWARN("Metadata device %s is larger than %u sectors: excess space will not be used.",
+		       pt->metadata_dev->name, THIN_METADATA_MAX_SECTORS);
+
+	r = dm_get_device(ti, argv[1], FMODE_READ | FMODE_WRITE,
+			  &pt->data_dev);
+	if (r) {
+		ti->error = "Error getting data device";
+		goto bad;
+	}
+
+	data_size = i_size_read(pt->data_dev->bdev->bd_inode) >> SECTOR_SHIFT;
+	if (ti->len > data_size) {
+		ti->error = "Data device is too small";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	pool = __pool_find(dm_table_get_md(ti->table),
+			   pt->metadata_dev->bdev, block_size,
+			   ti->len >> (ffs(block_size) - 1), &ti->error);
+	if (IS_ERR(pool)) {
+		mutex_unlock(&dm_thin_pool_table.mutex);
+		r = PTR_ERR(pool);
+		goto bad;
+	}
+	pt->pool = pool;
+	ti->private = pt;
+
+	/* a new pool serves right away, a reloaded one from resume */
+	if (!pool->ti)
+		bind_control_target(pool, ti);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	ti->num_flush_requests = 1;
+	return 0;
+
+bad:
+	if (pt->data_dev)
+		dm_put_device(ti, pt->data_dev);
+	if (pt->metadata_dev)
+		dm_put_device(ti, pt->metadata_dev);
+	kfree(pt);
+	return r;
+}
+
+/*
+ * The pool device itself maps straight to the data device.
+ */
+static int pool_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct pool_c *pt = ti->private;
+
+	bio->bi_bdev = pt->data_dev->bdev;
+	return DM_MAPIO_REMAPPED;
+}
+
+/*
+ * Grows the pool to the length of the target, and lets the bios that
+ * waited for space go.
+ */
+static int pool_preresume(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	dm_block_t data_size, sb_data_size;
+	unsigned long flags;
+	int r;
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	bind_control_target(pool, ti);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	data_size = ti->len >> pool->block_shift;
+	r = dm_pool_get_data_dev_size(pool->pmd, &sb_data_size);
+	if (r) {
+		DMERR("failed to retrieve data device size");
+		return r;
+	}
+
+	if (data_size < sb_data_size) {
+		DMERR("pool target too small, is %llu blocks (expected %llu)",
+		      (unsigned long long)data_size,
+		      (unsigned long long)sb_data_size);
+		return -EINVAL;
+
+	} else if (data_size > sb_data_size) {
+		r = dm_pool_resize_data_dev(pool->pmd, data_size);
+		if (r) {
+			DMERR("failed to resize data device");
+			return r;
+		}
+
+		r = commit(pool);
+		if (r)
+			return r;
+	}
+
+	spin_lock_irqsave(&pool->lock, flags);
+	pool->low_water_triggered = 0;
+	pool->no_free_space = 0;
+	bio_list_merge(&pool->deferred_bios, &pool->retry_on_resume_list);
+	bio_list_init(&pool->retry_on_resume_list);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
+	wake_worker(pool);
+
+	return 0;
+}
+
+static void pool_postsuspend(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+
+	cancel_delayed_work_sync(&pool->waker);
+	flush_workqueue(pool->wq);
+
+	if (commit(pool))
+		DMERR("%s: couldn't commit metadata.", __func__);
+}
+
+static int check_arg_count(unsigned argc, unsigned args_required)
+{
+	if (argc != args_required) {
+		DMWARN("Message received with %u arguments instead of %u.",
+		       argc, args_required);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int read_dev_id(char *arg, dm_thin_id *dev_id, int warning)
+{
+	unsigned long long id;
+	char dummy;
+
+	if (sscanf(arg, "%llu%c", &id, &dummy) == 1 && id <= THIN_MAX_ID) {
+		*dev_id = id;
+		return 0;
+	}
+
+	if (warning)
+		DMWARN("Message received with invalid device id: %s", arg);
+
+	return -EINVAL;
+}
+
+static int process_create_thin_mesg(unsigned argc, char **argv,
+				    struct pool *pool)
+{
+	dm_thin_id dev_id;
+	int r;
+
+	r = check_arg_count(argc, 2);
+	if (r)
+		return r;
+
+	r = read_dev_id(argv[1], &dev_id, 1);
+	if (r)
+		return r;
+
+	r = dm_pool_create_thin(pool->pmd, dev_id);
+	if (r)
+		DMWARN("Creation of new thinly-provisioned device with id %s failed.",
+		       argv[1]);
+
+	return r;
+}
+
+static int process_create_snap_mesg(unsigned argc, char **argv,
+				    struct pool *pool)
+{
+	dm_thin_id dev_id, origin_dev_id;
+	int r;
+
+	r = check_arg_count(argc, 3);
+	if (r)
+		return r;
+
+	r = read_dev_id(argv[1], &dev_id, 1);
+	if (r)
+		return r;
+
+	r = read_dev_id(argv[2], &origin_dev_id, 1);
+	if (r)
+		return r;
+
+	r = dm_pool_create_snap(pool->pmd, dev_id, origin_dev_id);
+	if (r)
+		DMWARN("Creation of new snapshot %s of device %s failed.",
+		       argv[1], argv[2]);
+
+	return r;
+}
+
+static int process_delete_mesg(unsigned argc, char **argv, struct pool *pool)
+{
+	dm_thin_id dev_id;
+	int r;
+
+	r = check_arg_count(argc, 2);
+	if (r)
+		return r;
+
+	r = read_dev_id(argv[1], &dev_id, 1);
+	if (r)
+		return r;
+
+	r = dm_pool_delete_thin_device(pool->pmd, dev_id);
+	if (r)
+		DMWARN("Deletion of thin device %s failed.", argv[1]);
+
+	return r;
+}
+
+static int process_set_transaction_id_mesg(unsigned argc, char **argv,
+					   struct pool *pool)
+{
+	unsigned long long old_id, new_id;
+	char dummy;
+	int r;
+
+	r = check_arg_count(argc, 3);
+	if (r)
+		return r;
+
+	if (sscanf(argv[1], "%llu%c", &old_id, &dummy) != 1) {
+		DMWARN("set_transaction_id message: Unrecognised id %s.",
+		       argv[1]);
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[2], "%llu%c", &new_id, &dummy) != 1) {
+		DMWARN("set_transaction_id message: Unrecognised new id %s.",
+		       argv[2]);
+		return -EINVAL;
+	}
+
+	r = dm_pool_set_metadata_transaction_id(pool->pmd, old_id, new_id);
+	if (r)
+		DMWARN("Failed to change transaction id from %s to %s.",
+		       argv[1], argv[2]);
+
+	return r;
+}
+
+/*
+ * Messages supported:
+ *   create_thin	<dev_id>
+ *   create_snap	<dev_id> <origin_id>
+ *   delete		<dev_id>
+ *   set_transaction_id <current_trans_id> <new_trans_id>
+ */
+static int pool_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	int r = -EINVAL;
+
+	if (!argc)
+		goto bad;
+
+	if (!strcasecmp(argv[0], "create_thin"))
+		r = process_create_thin_mesg(argc, argv, pool);
+
+	else if (!strcasecmp(argv[0], "create_snap"))
+		r = process_create_snap_mesg(argc, argv, pool);
+
+	else if (!strcasecmp(argv[0], "delete"))
+		r = process_delete_mesg(argc, argv, pool);
+
+	else if (!strcasecmp(argv[0], "set_transaction_id"))
+		r = process_set_transaction_id_mesg(argc, argv, pool);
+
+	else
+		goto bad;
+
+	if (!r) {
+		r = commit(pool);
+		if (r)
+			DMWARN("%s message: commit failed: %d", argv[0], r);
+	}
+
+	return r;
+
+bad:
+	DMWARN("Unrecognised thin pool target message received.");
+	return r;
+}
+
+/*
+ * Status line is:
+ *    <transaction id> <used metadata blocks>/<total metadata blocks>
+ *    <used data blocks>/<total data blocks>
+ */
+static int pool_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	dm_block_t nr_free_blocks_data, nr_free_blocks_metadata;
+	dm_block_t nr_blocks_data, nr_blocks_metadata;
+	uint64_t transaction_id;
+	unsigned sz = 0;
+	int r;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		r = dm_pool_get_metadata_transaction_id(pool->pmd,
+							&transaction_id);
+		if (!r)
+			r = dm_pool_get_free_metadata_block_count(pool->pmd,
+						&nr_free_blocks_metadata);
+		if (!r)
+			r = dm_pool_get_metadata_dev_size(pool->pmd,
+							  &nr_blocks_metadata);
+		if (!r)
+			r = dm_pool_get_free_block_count(pool->pmd,
+							 &nr_free_blocks_data);
+		if (!r)
+			r = dm_pool_get_data_dev_size(pool->pmd,
+						      &nr_blocks_data);
+		if (r)
+			return r;
+
+		DMEMIT("%llu %llu/%llu %llu/%llu",
+		       (unsigned long long)transaction_id,
+		       (unsigned long long)(nr_blocks_metadata -
+					    nr_free_blocks_metadata),
+		       (unsigned long long)nr_blocks_metadata,
+		       (unsigned long long)(nr_blocks_data -
+					    nr_free_blocks_data),
+		       (unsigned long long)nr_blocks_data);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %lu %llu ", pt->metadata_dev->name,
+		       pt->data_dev->name,
+		       (unsigned long)pool->sectors_per_block,
+		       (unsigned long long)pt->low_water_blocks);
+
+		if (pt->zero_new_blocks)
+			DMEMIT("0 ");
+		else
+			DMEMIT("1 skip_block_zeroing ");
+		break;
+	}
+
+	return 0;
+}
+
+static int pool_iterate_devices(struct dm_target *ti,
+				iterate_devices_callout_fn fn, void *data)
+{
+	struct pool_c *pt = ti->private;
+
+	return fn(ti, pt->data_dev, 0, ti->len, data);
+}
+
+static void pool_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+
+	blk_limits_io_min(limits, 0);
+	blk_limits_io_opt(limits, pool->sectors_per_block << SECTOR_SHIFT);
+}
+
+static struct target_type pool_target = {
+	.name = "thin-pool",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = pool_ctr,
+	.dtr = pool_dtr,
+	.map = pool_map,
+	.postsuspend = pool_postsuspend,
+	.preresume = pool_preresume,
+	.message = pool_message,
+	.status = pool_status,
+	.iterate_devices = pool_iterate_devices,
+	.io_hints = pool_io_hints,
+};
+
+/*-----------------------------------------------------------------
+ * Thin target methods
+ *---------------------------------------------------------------*/
+static void thin_dtr(struct dm_target *ti)
+{
+	struct thin_c *tc = ti->private;
+
+	dm_pool_close_thin_device(tc->td);
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	__pool_dec(tc->pool);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	dm_put_device(ti, tc->pool_dev);
+	kfree(tc);
+}
+
+/*
+ * Thin target parameters:
+ *
+ * <pool_dev> <dev_id>
+ *
+ * pool_dev: the path to the pool (eg, /dev/mapper/my_pool)
+ * dev_id: the internal device identifier
+ */
+static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct mapped_device *pool_md;
+	struct thin_c *tc;
+	int r;
+
+	if (argc != 2) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	tc = ti->private = kzalloc(sizeof(*tc), GFP_KERNEL);
+	if (!tc) {
+		ti->error = "Out of memory";
+		return -ENOMEM;
+	}
+
+	r = dm_get_device(ti, argv[0], dm_table_get_mode(ti->table),
+			  &tc->pool_dev);
+	if (r) {
+		ti->error = "Error opening pool device";
+		goto bad_pool_dev;
+	}
+
+	r = read_dev_id(argv[1], &tc->dev_id, 0);
+	if (r) {
+		ti->error = "Invalid device id";
+		goto bad_common;
+	}
+
+	pool_md = dm_get_md(tc->pool_dev->bdev->bd_dev);
+	if (!pool_md) {
+		ti->error = "Couldn't get pool mapped device";
+		r = -EINVAL;
+		goto bad_common;
+	}
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	tc->pool = __pool_table_lookup(pool_md);
+	if (tc->pool)
+		__pool_inc(tc->pool);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+	dm_put(pool_md);
+
+	if (!tc->pool) {
+		ti->error = "Couldn't find pool object";
+		r = -EINVAL;
+		goto bad_common;
+	}
+
+	r = dm_pool_open_thin_device(tc->pool->pmd, tc->dev_id, &tc->td);
+	if (r) {
+		ti->error = "Couldn't open thin internal device";
+		goto bad_thin_open;
+	}
+
+	ti->split_io = tc->pool->sectors_per_block;
+	ti->num_flush_requests = 1;
+
+	return 0;
+
+bad_thin_open:
+	mutex_lock(&dm_thin_pool_table.mutex);
+	__pool_dec(tc->pool);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+bad_common:
+	dm_put_device(ti, tc->pool_dev);
+bad_pool_dev:
+	kfree(tc);
+
+	return r;
+}
+
+static int thin_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	struct dm_thin_lookup_result result;
+	struct endio_hook *h;
+	unsigned long flags;
+	int r;
+
+	if (bio_empty_barrier(bio)) {
+		map_context->ptr = NULL;
+
+		spin_lock_irqsave(&pool->lock, flags);
+		bio_list_add(&pool->deferred_flush_bios, bio);
+		spin_unlock_irqrestore(&pool->lock, flags);
+
+		wake_worker(pool);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	h = mempool_alloc(pool->endio_hook_pool, GFP_NOIO);
+	h->tc = tc;
+	h->shared_read_entry = NULL;
+	h->overwrite_mapping = NULL;
+	map_context->ptr = h;
+
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+
+	/*
+	 * Only the mapped blocks that aren't shared can be remapped here,
+	 * without waiting for the metadata.
+	 */
+	r = dm_thin_find_block(tc->td, get_bio_block(tc, bio), 0, &result);
+	switch (r) {
+	case 0:
+		if (!result.shared) {
+			remap(tc, bio, result.block);
+			return DM_MAPIO_REMAPPED;
+		}
+		/* fall through */
+
+	case -ENODATA:
+	case -EWOULDBLOCK:
+		defer_bio(pool, bio);
+		return DM_MAPIO_SUBMITTED;
+
+	default:
+		map_context->ptr = NULL;
+		mempool_free(h, pool->endio_hook_pool);
+		return r;
+	}
+}
+
+static int thin_endio(struct dm_target *ti, struct bio *bio, int err,
+		      union map_info *map_context)
+{
+	struct endio_hook *h = map_context->ptr;
+	struct new_mapping *m, *tmp;
+	struct pool *pool;
+	unsigned long flags;
+	LIST_HEAD(work);
+
+	if (!h)
+		return err;
+	pool = h->tc->pool;
+
+	/* ended again once the mapping is in */
+	m = h->overwrite_mapping;
+	if (m) {
+		h->overwrite_mapping = NULL;
+		complete_mapping(m, err);
+		return DM_ENDIO_INCOMPLETE;
+	}
+
+	if (h->shared_read_entry) {
+		ds_dec(h->shared_read_entry, &work);
+
+		spin_lock_irqsave(&pool->lock, flags);
+		list_for_each_entry_safe(m, tmp, &work, list) {
+			list_del(&m->list);
+			m->quiesced = 1;
+			__maybe_add_mapping(m);
+		}
+		spin_unlock_irqrestore(&pool->lock, flags);
+
+		if (!list_empty(&work))
+			wake_worker(pool);
+	}
+
+	mempool_free(h, pool->endio_hook_pool);
+	return err;
+}
+
+/*
+ * Status line is:
+ *    <nr mapped sectors> <highest mapped sector>
+ */
+static int thin_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	dm_block_t mapped, highest;
+	unsigned sz = 0;
+	int r;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		r = dm_thin_get_mapped_count(tc->td, &mapped);
+		if (r)
+			return r;
+
+		r = dm_thin_get_highest_mapped_block(tc->td, &highest);
+		if (r == -ENODATA) {
+			DMEMIT("%llu -", (unsigned long long)
+			       (mapped << pool->block_shift));
+			break;
+		}
+		if (r)
+			return r;
+
+		DMEMIT("%llu %llu",
+		       (unsigned long long)(mapped << pool->block_shift),
+		       (unsigned long long)(((highest + 1) << pool->block_shift) - 1));
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %llu", tc->pool_dev->name,
+		       (unsigned long long)tc->dev_id);
+		break;
+	}
+
+	return 0;
+}
+
+static int thin_iterate_devices(struct dm_target *ti,
+				iterate_devices_callout_fn fn, void *data)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	dm_block_t blocks;
+
+	/* the length of the pool, the thin device may be longer */
+	if (!pool->ti)
+		return 0;
+
+	blocks = pool->ti->len >> pool->block_shift;
+	if (blocks)
+		return fn(ti, tc->pool_dev, 0,
+			  pool->sectors_per_block * blocks, data);
+
+	return 0;
+}
+
+static struct target_type thin_target = {
+	.name = "thin",
+	.version = {1, 0, 0},
+	.module	= THIS_MODULE,
+	.ctr = thin_ctr,
+	.dtr = thin_dtr,
+	.map = thin_map,
+	.end_io = thin_endio,
+	.status = thin_status,
+	.iterate_devices = thin_iterate_devices,
+};
+
+/*----------------------------------------------------------------*/
+
+static int __init dm_thin_init(void)
+{
+	int r = -ENOMEM;
+
+	pool_table_init();
+	_zero_page_list.next = &_zero_page_list;
+	_zero_page_list.page = ZERO_PAGE(0);
+
+	_cell_cache = KMEM_CACHE(cell, 0);
+	if (!_cell_cache)
+		goto bad_cell_cache;
+
+	_new_mapping_cache = KMEM_CACHE(new_mapping, 0);
+	if (!_new_mapping_cache)
+		goto bad_new_mapping_cache;
+
+	_endio_hook_cache = KMEM_CACHE(endio_hook, 0);
+	if (!_endio_hook_cache)
+		goto bad_endio_hook_cache;
+
+	r = dm_register_target(&thin_target);
+	if (r)
+		goto bad_thin_target;
+
+	r = dm_register_target(&pool_target);
+	if (r)
+		goto bad_pool_target;
+
+	return 0;
+
+bad_pool_target:
+	dm_unregister_target(&thin_target);
+bad_thin_target:
+	kmem_cache_destroy(_endio_hook_cache);
+bad_endio_hook_cache:
+	kmem_cache_destroy(_new_mapping_cache);
+bad_new_mapping_cache:
+	kmem_cache_destroy(_cell_cache);
+bad_cell_cache:
+	return r;
+}
+
+static void __exit dm_thin_exit(void)
+{
+	dm_unregister_target(&thin_target);
+	dm_unregister_target(&pool_target);
+
+	kmem_cache_destroy(_endio_hook_cache);
+	kmem_cache_destroy(_new_mapping_cache);
+	kmem_cache_destroy(_cell_cache);
+}
+
+module_init(dm_thin_init);
+module_exit(dm_thin_exit);
+
+MODULE_DESCRIPTION(DM_NAME " thin provisioning target");
+MODULE_LICENSE("GPL");
@@ -51,6 +51,12 @@
  */
 #define	NR_RAID1_BIOS 256
 
+/*
+ * How many requests queued on a non-rotational device a seek on a
+ * rotational one is worth, when balancing reads:
+ */
+#define	RAID1_SEEK_COST 16
+
 
 static void unplug_slaves(mddev_t *mddev);
 
@@ -410,7 +416,9 @@ static void raid1_end_write_request(struct bio *bio, int error)
  * There is also a per-disk 'last know head position' sector that is
  * maintained from IRQ contexts, both the normal and the resync IO
  * completion handlers update this position correctly. If there is no
- * perfect sequential match then we pick the disk whose head is closest.
+ * sequential match on a rotational disk then we pick the disk with the
+ * fewest pending requests, a rotational disk counting as RAID1_SEEK_COST
+ * non-rotational ones, and among those the one whose head is closest.
  *
  * If there are 2 mirrors in the same 2 devices, performance degrades
  * because position is mirror, not device based.
@@ -420,10 +428,12 @@ static void raid1_end_write_request(struct bio *bio, int error)
 static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 {
 	const sector_t this_sector = r1_bio->sector;
-	int new_disk = conf->last_used, disk = new_disk;
+	int new_disk = conf->last_used, disk = new_disk, start;
 	int wonly_disk = -1;
 	const int sectors = r1_bio->sectors;
-	sector_t new_distance, current_distance;
+	sector_t head, distance, best_distance;
+	unsigned long cost, best_cost;
+	int nonrot;
 	mdk_rdev_t *rdev;
 
 	rcu_read_lock();
@@ -457,66 +467,57 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 	}
 
 
-	/* make sure the disk is operational */
-	for (rdev = rcu_dereference(conf->mirrors[new_disk].rdev);
-	     r1_bio->bios[new_disk] == IO_BLOCKED ||
-	     !rdev || !test_bit(In_sync, &rdev->flags) ||
-		     test_bit(WriteMostly, &rdev->flags);
-	     rdev = rcu_dereference(conf->mirrors[new_disk].rdev)) {
-
-		if (rdev && test_bit(In_sync, &rdev->flags) &&
-		    r1_bio->bios[new_disk] != IO_BLOCKED)
-			wonly_disk = new_disk;
-
-		if (new_disk <= 0)
-			new_disk = conf->raid_disks;
-		new_disk--;
-		if (new_disk == disk) {
-			new_disk = wonly_disk;
-			break;
-		}
-	}
-
-	if (new_disk < 0)
-		goto rb_out;
-
-	disk = new_disk;
-	/* now disk == new_disk == starting point for search */
-
 	/*
-	 * Don't change to another disk for sequential reads:
+	 * Pick the disk expected to serve the read soonest.  A sequential
+	 * read stays on a rotational disk already at that position, or
+	 * else the cost of a disk is its queue length, scaled by the cost
+	 * of a seek for a rotational one.  Ties between disks go to the
+	 * nearest head.
 	 */
-	if (conf->next_seq_sect == this_sector)
-		goto rb_out;
-	if (this_sector == conf->mirrors[new_disk].head_position)
-		goto rb_out;
-
-	current_distance = abs(this_sector - conf->mirrors[disk].head_position);
-
-	/* Find the disk whose head is closest */
-
+	new_disk = -1;
+	best_cost = ULONG_MAX;
+	best_distance = MaxSector;
+	start = disk = conf->last_used;
 	do {
-		if (disk <= 0)
-			disk = conf->raid_disks;
-		disk--;
-
 		rdev = rcu_dereference(conf->mirrors[disk].rdev);
-
 		if (!rdev || r1_bio->bios[disk] == IO_BLOCKED ||
-		    !test_bit(In_sync, &rdev->flags) ||
-		    test_bit(WriteMostly, &rdev->flags))
-			continue;
+		    !test_bit(In_sync, &rdev->flags))
+			goto next;
+		if (test_bit(WriteMostly, &rdev->flags)) {
+			if (wonly_disk < 0)
+				wonly_disk = disk;
+			goto next;
+		}
+
+		nonrot = blk_queue_nonrot(bdev_get_queue(rdev->bdev));
+		head = conf->mirrors[disk].head_position;
+		distance = this_sector > head ? this_sector - head :
+						head - this_sector;
 
-		if (!atomic_read(&rdev->nr_pending)) {
+		/* Don't change to another disk for sequential reads */
+		if (!nonrot &&
+		    (distance == 0 || (disk == conf->last_used &&
+				       conf->next_seq_sect == this_sector))) {
 			new_disk = disk;
 			break;
 		}
-		new_distance = abs(this_sector - conf->mirrors[disk].head_position);
-		if (new_distance < current_distance) {
-			current_distance = new_distance;
+
+		cost = atomic_read(&rdev->nr_pending) + 1;
+		if (!nonrot)
+			cost *= RAID1_SEEK_COST;
+		if (cost < best_cost ||
+		    (cost == best_cost && distance < best_distance)) {
+			best_cost = cost;
+			best_distance = distance;
 			new_disk = disk;
 		}
-	} while (disk != conf->last_used);
+ next:
+		if (++disk == conf->raid_disks)
+			disk = 0;
+	} while (disk != start);
+
+	if (new_disk < 0)
+		new_disk = wonly_disk;
 
  rb_out:
 
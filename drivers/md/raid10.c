@@ -57,6 +57,12 @@
  */
 #define	NR_RAID10_BIOS 256
 
+/*
+ * How many requests queued on a non-rotational device a seek on a
+ * rotational one is worth, when balancing reads:
+ */
+#define	RAID10_SEEK_COST 16
+
 static void unplug_slaves(mddev_t *mddev);
 
 static void allow_barrier(conf_t *conf);
@@ -482,7 +488,8 @@ static int raid10_mergeable_bvec(struct request_queue *q,
  * There is also a per-disk 'last know head position' sector that is
  * maintained from IRQ contexts, both the normal and the resync IO
  * completion handlers update this position correctly. If there is no
- * perfect sequential match then we pick the disk whose head is closest.
+ * perfect sequential match then we pick the disk expected to serve the
+ * read soonest, from its pending requests and whether it is rotational.
  *
  * If there are 2 mirrors in the same 2 devices, performance degrades
  * because position is mirror, not device based.
@@ -500,6 +507,8 @@ static int read_balance(conf_t *conf, r10bio_t *r10_bio)
 	int disk, slot, nslot;
 	const int sectors = r10_bio->sectors;
 	sector_t new_distance, current_distance;
+	unsigned long cost, best_cost;
+	int nonrot;
 	mdk_rdev_t *rdev;
 
 	raid10_find_phys(conf, r10_bio);
@@ -531,53 +540,54 @@ static int read_balance(conf_t *conf, r10bio_t *r10_bio)
 	}
 
 
-	/* make sure the disk is operational */
+	/*
+	 * Pick the copy expected to be read soonest.  The cost of a
+	 * non-rotational disk is its queue length.  A rotational one costs
+	 * a seek more, and for far > 1 always that, as the lowest address
+	 * is then what matters: taking idle disks would destroy sequential
+	 * read speed.  Ties go to the closest head, or for far > 1 the
+	 * copy closest to the partition beginning.
+	 */
+	disk = -1;
 	slot = 0;
-	disk = r10_bio->devs[slot].devnum;
-	while ((rdev=rcu_dereference(conf->mirrors[disk].rdev)) == NULL ||
-	       r10_bio->devs[slot].bio == IO_BLOCKED ||
-	       !test_bit(In_sync, &rdev->flags)) {
-		slot ++;
-		if (slot == conf->copies) {
-			disk = -1;
-			goto rb_out;
-		}
-		disk = r10_bio->devs[slot].devnum;
-	}
-
-
-	current_distance = abs(r10_bio->devs[slot].addr -
-			       conf->mirrors[disk].head_position);
-
-	/* Find the disk whose head is closest,
-	 * or - for far > 1 - find the closest to partition beginning */
-
-	for (nslot = slot; nslot < conf->copies; nslot++) {
+	best_cost = ULONG_MAX;
+	current_distance = MaxSector;
+	for (nslot = 0; nslot < conf->copies; nslot++) {
 		int ndisk = r10_bio->devs[nslot].devnum;
-
+		sector_t addr = r10_bio->devs[nslot].addr;
+		sector_t head = conf->mirrors[ndisk].head_position;
 
 		if ((rdev=rcu_dereference(conf->mirrors[ndisk].rdev)) == NULL ||
 		    r10_bio->devs[nslot].bio == IO_BLOCKED ||
 		    !test_bit(In_sync, &rdev->flags))
 			continue;
 
-		/* This optimisation is debatable, and completely destroys
-		 * sequential read speed for 'far copies' arrays.  So only
-		 * keep it for 'near' arrays, and review those later.
-		 */
-		if (conf->near_copies > 1 && !atomic_read(&rdev->nr_pending)) {
+		nonrot = blk_queue_nonrot(bdev_get_queue(rdev->bdev));
+
+		/* for far > 1 always use the lowest address */
+		if (conf->far_copies > 1)
+			new_distance = addr;
+		else
+			new_distance = addr > head ? addr - head : head - addr;
+
+		/* Don't change to another disk for sequential reads */
+		if (!nonrot && conf->far_copies == 1 && new_distance == 0) {
 			disk = ndisk;
 			slot = nslot;
 			break;
 		}
 
-		/* for far > 1 always use the lowest address */
-		if (conf->far_copies > 1)
-			new_distance = r10_bio->devs[nslot].addr;
+		if (nonrot)
+			cost = atomic_read(&rdev->nr_pending) + 1;
+		else if (conf->far_copies > 1)
+			cost = RAID10_SEEK_COST;
 		else
-			new_distance = abs(r10_bio->devs[nslot].addr -
-					   conf->mirrors[ndisk].head_position);
-		if (new_distance < current_distance) {
+			cost = (atomic_read(&rdev->nr_pending) + 1) *
+				RAID10_SEEK_COST;
+
+		if (cost < best_cost ||
+		    (cost == best_cost && new_distance < current_distance)) {
+			best_cost = cost;
 			current_distance = new_distance;
 			disk = ndisk;
 			slot = nslot;
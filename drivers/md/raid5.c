@@ -65,11 +65,13 @@
 #define STRIPE_SHIFT		(PAGE_SHIFT - 9)
 #define STRIPE_SECTORS		(STRIPE_SIZE>>9)
 #define	IO_THRESHOLD		1
+#define MAX_STRIPE_BATCH	8
 #define BYPASS_THRESHOLD	1
 #define NR_HASH			(PAGE_SIZE / sizeof(struct hlist_head))
 #define HASH_MASK		(NR_HASH - 1)
 
 #define stripe_hash(conf, sect)	(&((conf)->stripe_hashtbl[((sect) >> STRIPE_SHIFT) & HASH_MASK]))
+#define stripe_hash_locks_hash(sect) (((sect) >> STRIPE_SHIFT) & STRIPE_HASH_LOCKS_MASK)
 
 /* bio's attached to a stripe+device for I/O are linked together in bi_sector
  * order without overlap.  There may be several bio's per stripe+device, and
@@ -86,9 +88,9 @@
  */
 #define RAID5_PARANOIA	1
 #if RAID5_PARANOIA && defined(CONFIG_SMP)
-# define CHECK_DEVLOCK() assert_spin_locked(&conf->device_lock)
+# define CHECK_HASHLOCK(hash) assert_spin_locked(conf->hash_locks + (hash))
 #else
-# define CHECK_DEVLOCK()
+# define CHECK_HASHLOCK(hash)
 #endif
 
 #ifdef DEBUG
@@ -193,50 +195,161 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
-static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
+static inline void lock_all_device_hash_locks_irq(raid5_conf_t *conf)
 {
-	if (atomic_dec_and_test(&sh->count)) {
-		BUG_ON(!list_empty(&sh->lru));
-		BUG_ON(atomic_read(&conf->active_stripes)==0);
-		if (test_bit(STRIPE_HANDLE, &sh->state)) {
-			if (test_bit(STRIPE_DELAYED, &sh->state)) {
-				list_add_tail(&sh->lru, &conf->delayed_list);
-				plugger_set_plug(&conf->plug);
-			} else if (test_bit(STRIPE_BIT_DELAY, &sh->state) &&
-				   sh->bm_seq - conf->seq_write > 0) {
-				list_add_tail(&sh->lru, &conf->bitmap_list);
-				plugger_set_plug(&conf->plug);
-			} else {
-				clear_bit(STRIPE_BIT_DELAY, &sh->state);
-				list_add_tail(&sh->lru, &conf->handle_list);
-			}
-			md_wakeup_thread(conf->mddev->thread);
+	int i;
+
+	local_irq_disable();
+	spin_lock(conf->hash_locks);
+	for (i = 1; i < NR_STRIPE_HASH_LOCKS; i++)
+		spin_lock_nest_lock(conf->hash_locks + i, conf->hash_locks);
+	spin_lock(&conf->device_lock);
+}
+
+static inline void unlock_all_device_hash_locks_irq(raid5_conf_t *conf)
+{
+	int i;
+
+	spin_unlock(&conf->device_lock);
+	for (i = NR_STRIPE_HASH_LOCKS; i; i--)
+		spin_unlock(conf->hash_locks + i - 1);
+	local_irq_enable();
+}
+
+#define cpu_to_group(cpu) cpu_to_node(cpu)
+
+/*
+ * Queue a stripe to the worker group of the node it was submitted from,
+ * and make sure enough of the group's threads are running to handle
+ * what is queued there.  device_lock is held.
+ */
+static void raid5_wakeup_stripe_thread(struct stripe_head *sh)
+{
+	raid5_conf_t *conf = sh->raid_conf;
+	struct r5worker_group *group;
+	int thread_cnt, i, cpu = sh->cpu;
+
+	if (!cpu_online(cpu)) {
+		cpu = cpumask_any(cpu_online_mask);
+		sh->cpu = cpu;
+	}
+
+	group = conf->worker_groups + cpu_to_group(cpu);
+	list_add_tail(&sh->lru, &group->handle_list);
+	group->stripes_cnt++;
+	sh->group = group;
+
+	/* one thread for every MAX_STRIPE_BATCH stripes queued */
+	thread_cnt = group->stripes_cnt / MAX_STRIPE_BATCH + 1;
+	for (i = 0; i < conf->worker_cnt_per_group && thread_cnt; i++) {
+		struct r5worker *worker = group->workers + i;
+
+		if (!worker->working) {
+			worker->working = true;
+			set_bit(R5W_WAKEUP, &worker->flags);
+			wake_up(&worker->wqueue);
+		}
+		thread_cnt--;
+	}
+}
+
+/*
+ * Called with the device_lock held when the stripe's count dropped to
+ * zero.  Stripes going inactive are put on @temp_inactive_list, to be
+ * moved to their inactive_list by release_inactive_stripe_list() once
+ * the device_lock is dropped.
+ */
+static void do_release_stripe(raid5_conf_t *conf, struct stripe_head *sh,
+			      struct list_head *temp_inactive_list)
+{
+	BUG_ON(!list_empty(&sh->lru));
+	BUG_ON(atomic_read(&conf->active_stripes)==0);
+	if (test_bit(STRIPE_HANDLE, &sh->state)) {
+		if (test_bit(STRIPE_DELAYED, &sh->state)) {
+			list_add_tail(&sh->lru, &conf->delayed_list);
+			plugger_set_plug(&conf->plug);
+		} else if (test_bit(STRIPE_BIT_DELAY, &sh->state) &&
+			   sh->bm_seq - conf->seq_write > 0) {
+			list_add_tail(&sh->lru, &conf->bitmap_list);
+			plugger_set_plug(&conf->plug);
 		} else {
-			BUG_ON(stripe_operations_active(sh));
-			if (test_and_clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
-				atomic_dec(&conf->preread_active_stripes);
-				if (atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD)
-					md_wakeup_thread(conf->mddev->thread);
-			}
-			atomic_dec(&conf->active_stripes);
-			if (!test_bit(STRIPE_EXPANDING, &sh->state)) {
-				list_add_tail(&sh->lru, &conf->inactive_list);
-				wake_up(&conf->wait_for_stripe);
-				if (conf->retry_read_aligned)
-					md_wakeup_thread(conf->mddev->thread);
+			clear_bit(STRIPE_BIT_DELAY, &sh->state);
+			if (conf->worker_cnt_per_group) {
+				raid5_wakeup_stripe_thread(sh);
+				return;
 			}
+			list_add_tail(&sh->lru, &conf->handle_list);
 		}
+		md_wakeup_thread(conf->mddev->thread);
+	} else {
+		BUG_ON(stripe_operations_active(sh));
+		if (test_and_clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
+			atomic_dec(&conf->preread_active_stripes);
+			if (atomic_read(&conf->preread_active_stripes) < IO_THRESHOLD)
+				md_wakeup_thread(conf->mddev->thread);
+		}
+		atomic_dec(&conf->active_stripes);
+		if (!test_bit(STRIPE_EXPANDING, &sh->state))
+			list_add_tail(&sh->lru, temp_inactive_list);
 	}
 }
 
+/*
+ * @temp_inactive_list is an array of NR_STRIPE_HASH_LOCKS lists,
+ * one for each hash lock.
+ */
+static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh,
+			     struct list_head *temp_inactive_list)
+{
+	if (atomic_dec_and_test(&sh->count))
+		do_release_stripe(conf, sh,
+				  temp_inactive_list + sh->hash_lock_index);
+}
+
+static void release_inactive_stripe_list(raid5_conf_t *conf,
+					 struct list_head *list, int hash)
+{
+	unsigned long flags;
+
+	if (list_empty_careful(list))
+		return;
+
+	spin_lock_irqsave(conf->hash_locks + hash, flags);
+	if (list_empty(conf->inactive_list + hash) && !list_empty(list))
+		atomic_dec(&conf->empty_inactive_list_nr);
+	list_splice_tail_init(list, conf->inactive_list + hash);
+	spin_unlock_irqrestore(conf->hash_locks + hash, flags);
+
+	wake_up(&conf->wait_for_stripe);
+	if (conf->retry_read_aligned)
+		md_wakeup_thread(conf->mddev->thread);
+}
+
+static void release_inactive_stripe_lists(raid5_conf_t *conf,
+					  struct list_head *temp_inactive_list)
+{
+	int hash;
+
+	for (hash = 0; hash < NR_STRIPE_HASH_LOCKS; hash++)
+		release_inactive_stripe_list(conf, temp_inactive_list + hash,
+					     hash);
+}
+
 static void release_stripe(struct stripe_head *sh)
 {
 	raid5_conf_t *conf = sh->raid_conf;
 	unsigned long flags;
+	LIST_HEAD(list);
+	int hash;
 
-	spin_lock_irqsave(&conf->device_lock, flags);
-	__release_stripe(conf, sh);
-	spin_unlock_irqrestore(&conf->device_lock, flags);
+	local_irq_save(flags);
+	if (atomic_dec_and_lock(&sh->count, &conf->device_lock)) {
+		hash = sh->hash_lock_index;
+		do_release_stripe(conf, sh, &list);
+		spin_unlock(&conf->device_lock);
+		release_inactive_stripe_list(conf, &list, hash);
+	}
+	local_irq_restore(flags);
 }
 
 static inline void remove_hash(struct stripe_head *sh)
@@ -254,25 +367,28 @@ static inline void insert_hash(raid5_conf_t *conf, struct stripe_head *sh)
 	pr_debug("insert_hash(), stripe %llu\n",
 		(unsigned long long)sh->sector);
 
-	CHECK_DEVLOCK();
+	CHECK_HASHLOCK(sh->hash_lock_index);
 	hlist_add_head(&sh->hash, hp);
 }
 
 
 /* find an idle stripe, make sure it is unhashed, and return it. */
-static struct stripe_head *get_free_stripe(raid5_conf_t *conf)
+static struct stripe_head *get_free_stripe(raid5_conf_t *conf, int hash)
 {
 	struct stripe_head *sh = NULL;
 	struct list_head *first;
 
-	CHECK_DEVLOCK();
-	if (list_empty(&conf->inactive_list))
+	CHECK_HASHLOCK(hash);
+	if (list_empty(conf->inactive_list + hash))
 		goto out;
-	first = conf->inactive_list.next;
+	first = conf->inactive_list[hash].next;
 	sh = list_entry(first, struct stripe_head, lru);
 	list_del_init(first);
 	remove_hash(sh);
 	atomic_inc(&conf->active_stripes);
+	BUG_ON(hash != sh->hash_lock_index);
+	if (list_empty(conf->inactive_list + hash))
+		atomic_inc(&conf->empty_inactive_list_nr);
 out:
 	return sh;
 }
@@ -321,7 +437,7 @@ static void init_stripe(struct stripe_head *sh, sector_t sector, int previous)
 	BUG_ON(test_bit(STRIPE_HANDLE, &sh->state));
 	BUG_ON(stripe_operations_active(sh));
 
-	CHECK_DEVLOCK();
+	CHECK_HASHLOCK(sh->hash_lock_index);
 	pr_debug("init_stripe called, stripe %llu\n",
 		(unsigned long long)sh->sector);
 
@@ -357,7 +473,7 @@ static struct stripe_head *__find_stripe(raid5_conf_t *conf, sector_t sector,
 	struct stripe_head *sh;
 	struct hlist_node *hn;
 
-	CHECK_DEVLOCK();
+	CHECK_HASHLOCK(stripe_hash_locks_hash(sector));
 	pr_debug("__find_stripe, sector %llu\n", (unsigned long long)sector);
 	hlist_for_each_entry(sh, hn, stripe_hash(conf, sector), hash)
 		if (sh->sector == sector && sh->generation == generation)
@@ -440,53 +556,63 @@ get_active_stripe(raid5_conf_t *conf, sector_t sector,
 		  int previous, int noblock, int noquiesce)
 {
 	struct stripe_head *sh;
+	int hash = stripe_hash_locks_hash(sector);
 
 	pr_debug("get_stripe, sector %llu\n", (unsigned long long)sector);
 
-	spin_lock_irq(&conf->device_lock);
+	spin_lock_irq(conf->hash_locks + hash);
 
 	do {
 		wait_event_lock_irq(conf->wait_for_stripe,
 				    conf->quiesce == 0 || noquiesce,
-				    conf->device_lock, /* nothing */);
+				    conf->hash_locks[hash], /* nothing */);
 		sh = __find_stripe(conf, sector, conf->generation - previous);
 		if (!sh) {
 			if (!conf->inactive_blocked)
-				sh = get_free_stripe(conf);
+				sh = get_free_stripe(conf, hash);
 			if (noblock && sh == NULL)
 				break;
 			if (!sh) {
 				conf->inactive_blocked = 1;
 				wait_event_lock_irq(conf->wait_for_stripe,
-						    !list_empty(&conf->inactive_list) &&
+						    !list_empty(conf->inactive_list + hash) &&
 						    (atomic_read(&conf->active_stripes)
 						     < (conf->max_nr_stripes *3/4)
 						     || !conf->inactive_blocked),
-						    conf->device_lock,
+						    conf->hash_locks[hash],
 						    md_raid5_unplug_device(conf)
 					);
 				conf->inactive_blocked = 0;
-			} else
-				init_stripe(sh, sector, previous);
-		} else {
-			if (atomic_read(&sh->count)) {
-				BUG_ON(!list_empty(&sh->lru)
-				    && !test_bit(STRIPE_EXPANDING, &sh->state));
 			} else {
+				init_stripe(sh, sector, previous);
+				atomic_inc(&sh->count);
+			}
+		} else if (!atomic_inc_not_zero(&sh->count)) {
+			/* only the device_lock holder can drop the last
+			 * reference, and take the stripe off its list
+			 */
+			spin_lock(&conf->device_lock);
+			if (!atomic_read(&sh->count)) {
 				if (!test_bit(STRIPE_HANDLE, &sh->state))
 					atomic_inc(&conf->active_stripes);
 				if (list_empty(&sh->lru) &&
 				    !test_bit(STRIPE_EXPANDING, &sh->state))
 					BUG();
 				list_del_init(&sh->lru);
+				if (sh->group) {
+					sh->group->stripes_cnt--;
+					sh->group = NULL;
+				}
 			}
+			atomic_inc(&sh->count);
+			spin_unlock(&conf->device_lock);
 		}
 	} while (sh == NULL);
 
 	if (sh)
-		atomic_inc(&sh->count);
+		sh->cpu = smp_processor_id();
 
-	spin_unlock_irq(&conf->device_lock);
+	spin_unlock_irq(conf->hash_locks + hash);
 	return sh;
 }
 
@@ -1305,7 +1431,7 @@ static void raid_run_ops(struct stripe_head *sh, unsigned long ops_request)
 #define raid_run_ops __raid_run_ops
 #endif
 
-static int grow_one_stripe(raid5_conf_t *conf)
+static int grow_one_stripe(raid5_conf_t *conf, int hash)
 {
 	struct stripe_head *sh;
 	sh = kmem_cache_alloc(conf->slab_cache, GFP_KERNEL);
@@ -1313,6 +1439,7 @@ static int grow_one_stripe(raid5_conf_t *conf)
 		return 0;
 	memset(sh, 0, sizeof(*sh) + (conf->pool_size-1)*sizeof(struct r5dev));
 	sh->raid_conf = conf;
+	sh->hash_lock_index = hash;
 	spin_lock_init(&sh->lock);
 	#ifdef CONFIG_MULTICORE_RAID456
 	init_waitqueue_head(&sh->ops.wait_for_ops);
@@ -1335,6 +1462,7 @@ static int grow_stripes(raid5_conf_t *conf, int num)
 {
 	struct kmem_cache *sc;
 	int devs = max(conf->raid_disks, conf->previous_raid_disks);
+	int hash;
 
 	if (conf->mddev->gendisk)
 		sprintf(conf->cache_name[0],
@@ -1352,8 +1480,9 @@ static int grow_stripes(raid5_conf_t *conf, int num)
 		return 1;
 	conf->slab_cache = sc;
 	conf->pool_size = devs;
-	while (num--)
-		if (!grow_one_stripe(conf))
+	/* stripe i of the cache always goes to hash lock i % NR_STRIPE_HASH_LOCKS */
+	for (hash = 0; num--; hash = (hash + 1) % NR_STRIPE_HASH_LOCKS)
+		if (!grow_one_stripe(conf, hash))
 			return 1;
 	return 0;
 }
@@ -1412,6 +1541,7 @@ static int resize_stripes(raid5_conf_t *conf, int newsize)
 	int err;
 	struct kmem_cache *sc;
 	int i;
+	int hash, cnt;
 
 	if (newsize <= conf->pool_size)
 		return 0; /* never bother to shrink */
@@ -1456,21 +1586,33 @@ static int resize_stripes(raid5_conf_t *conf, int newsize)
 	 * OK, we have enough stripes, start collecting inactive
 	 * stripes and copying them over
 	 */
+	hash = 0;
+	cnt = 0;
 	list_for_each_entry(nsh, &newstripes, lru) {
-		spin_lock_irq(&conf->device_lock);
+		spin_lock_irq(conf->hash_locks + hash);
 		wait_event_lock_irq(conf->wait_for_stripe,
-				    !list_empty(&conf->inactive_list),
-				    conf->device_lock,
+				    !list_empty(conf->inactive_list + hash),
+				    conf->hash_locks[hash],
 				    unplug_slaves(conf->mddev)
 			);
-		osh = get_free_stripe(conf);
-		spin_unlock_irq(&conf->device_lock);
+		osh = get_free_stripe(conf, hash);
+		spin_unlock_irq(conf->hash_locks + hash);
 		atomic_set(&nsh->count, 1);
 		for(i=0; i<conf->pool_size; i++)
 			nsh->dev[i].page = osh->dev[i].page;
 		for( ; i<newsize; i++)
 			nsh->dev[i].page = NULL;
+		nsh->hash_lock_index = hash;
 		kmem_cache_free(conf->slab_cache, osh);
+		/* the first max_nr_stripes % NR_STRIPE_HASH_LOCKS hashes
+		 * have one stripe more than the others
+		 */
+		cnt++;
+		if (cnt >= conf->max_nr_stripes / NR_STRIPE_HASH_LOCKS +
+		    !!((conf->max_nr_stripes % NR_STRIPE_HASH_LOCKS) > hash)) {
+			hash++;
+			cnt = 0;
+		}
 	}
 	kmem_cache_destroy(conf->slab_cache);
 
@@ -1529,13 +1671,13 @@ static int resize_stripes(raid5_conf_t *conf, int newsize)
 	return err;
 }
 
-static int drop_one_stripe(raid5_conf_t *conf)
+static int drop_one_stripe(raid5_conf_t *conf, int hash)
 {
 	struct stripe_head *sh;
 
-	spin_lock_irq(&conf->device_lock);
-	sh = get_free_stripe(conf);
-	spin_unlock_irq(&conf->device_lock);
+	spin_lock_irq(conf->hash_locks + hash);
+	sh = get_free_stripe(conf, hash);
+	spin_unlock_irq(conf->hash_locks + hash);
 	if (!sh)
 		return 0;
 	BUG_ON(atomic_read(&sh->count));
@@ -1547,8 +1689,11 @@ static int drop_one_stripe(raid5_conf_t *conf)
 
 static void shrink_stripes(raid5_conf_t *conf)
 {
-	while (drop_one_stripe(conf))
-		;
+	int hash;
+
+	for (hash = 0; hash < NR_STRIPE_HASH_LOCKS; hash++)
+		while (drop_one_stripe(conf, hash))
+			;
 
 	if (conf->slab_cache)
 		kmem_cache_destroy(conf->slab_cache);
@@ -3620,7 +3765,8 @@ static void raid5_activate_delayed(raid5_conf_t *conf)
 		plugger_set_plug(&conf->plug);
 }
 
-static void activate_bit_delay(raid5_conf_t *conf)
+static void activate_bit_delay(raid5_conf_t *conf,
+			       struct list_head *temp_inactive_list)
 {
 	/* device_lock is held */
 	struct list_head head;
@@ -3630,7 +3776,7 @@ static void activate_bit_delay(raid5_conf_t *conf)
 		struct stripe_head *sh = list_entry(head.next, struct stripe_head, lru);
 		list_del_init(&sh->lru);
 		atomic_inc(&sh->count);
-		__release_stripe(conf, sh);
+		__release_stripe(conf, sh, temp_inactive_list);
 	}
 }
 
@@ -3700,7 +3846,7 @@ int md_raid5_congested(mddev_t *mddev, int bits)
 		return 1;
 	if (conf->quiesce)
 		return 1;
-	if (list_empty_careful(&conf->inactive_list))
+	if (atomic_read(&conf->empty_inactive_list_nr))
 		return 1;
 
 	return 0;
@@ -3924,19 +4070,34 @@ static int chunk_aligned_read(mddev_t *mddev, struct bio * raid_bio)
  * stripe with in flight i/o.  The bypass_count will be reset when the
  * head of the hold_list has changed, i.e. the head was promoted to the
  * handle_list.
+ *
+ * With worker groups, a worker only takes the stripes of its @group, and
+ * raid5d (@group NULL) those of any group.
  */
-static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
+static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf,
+						 struct r5worker_group *group)
 {
-	struct stripe_head *sh;
+	struct stripe_head *sh = NULL, *tmp;
+	struct list_head *handle_list = &conf->handle_list;
+	int i;
+
+	if (group)
+		handle_list = &group->handle_list;
+	else
+		for (i = 0; i < conf->group_cnt; i++)
+			if (!list_empty(&conf->worker_groups[i].handle_list)) {
+				handle_list = &conf->worker_groups[i].handle_list;
+				break;
+			}
 
 	pr_debug("%s: handle: %s hold: %s full_writes: %d bypass_count: %d\n",
 		  __func__,
-		  list_empty(&conf->handle_list) ? "empty" : "busy",
+		  list_empty(handle_list) ? "empty" : "busy",
 		  list_empty(&conf->hold_list) ? "empty" : "busy",
 		  atomic_read(&conf->pending_full_writes), conf->bypass_count);
 
-	if (!list_empty(&conf->handle_list)) {
-		sh = list_entry(conf->handle_list.next, typeof(*sh), lru);
+	if (!list_empty(handle_list)) {
+		sh = list_entry(handle_list->next, typeof(*sh), lru);
 
 		if (list_empty(&conf->hold_list))
 			conf->bypass_count = 0;
@@ -3954,14 +4115,25 @@ static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
 		   ((conf->bypass_threshold &&
 		     conf->bypass_count > conf->bypass_threshold) ||
 		    atomic_read(&conf->pending_full_writes) == 0)) {
-		sh = list_entry(conf->hold_list.next,
-				typeof(*sh), lru);
+		list_for_each_entry(tmp, &conf->hold_list, lru) {
+			if (!group || !cpu_online(tmp->cpu) ||
+			    conf->worker_groups + cpu_to_group(tmp->cpu) == group) {
+				sh = tmp;
+				break;
+			}
+		}
+		if (!sh)
+			return NULL;
 		conf->bypass_count -= conf->bypass_threshold;
 		if (conf->bypass_count < 0)
 			conf->bypass_count = 0;
 	} else
 		return NULL;
 
+	if (sh->group) {
+		sh->group->stripes_cnt--;
+		sh->group = NULL;
+	}
 	list_del_init(&sh->lru);
 	atomic_inc(&sh->count);
 	BUG_ON(atomic_read(&sh->count) != 1);
@@ -4512,6 +4684,85 @@ static int  retry_aligned_read(raid5_conf_t *conf, struct bio *raid_bio)
 }
 
 
+/*
+ * Handle up to MAX_STRIPE_BATCH stripes queued for @group (see
+ * __get_priority_stripe).  Called with the device_lock held, which is
+ * dropped while the stripes are handled; returns how many were.
+ */
+static int handle_active_stripes(raid5_conf_t *conf,
+				 struct r5worker_group *group,
+				 struct list_head *temp_inactive_list)
+{
+	struct stripe_head *batch[MAX_STRIPE_BATCH], *sh;
+	int i, batch_size = 0;
+
+	while (batch_size < MAX_STRIPE_BATCH &&
+	       (sh = __get_priority_stripe(conf, group)) != NULL)
+		batch[batch_size++] = sh;
+
+	if (batch_size == 0)
+		return 0;
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < batch_size; i++)
+		handle_stripe(batch[i]);
+
+	cond_resched();
+
+	spin_lock_irq(&conf->device_lock);
+	for (i = 0; i < batch_size; i++)
+		__release_stripe(conf, batch[i], temp_inactive_list);
+	spin_unlock_irq(&conf->device_lock);
+
+	release_inactive_stripe_lists(conf, temp_inactive_list);
+
+	spin_lock_irq(&conf->device_lock);
+	return batch_size;
+}
+
+static void raid5_do_work(struct r5worker *worker)
+{
+	struct r5worker_group *group = worker->group;
+	raid5_conf_t *conf = group->conf;
+	struct list_head temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	int handled = 0, batch_size, i;
+
+	pr_debug("+++ raid5worker active\n");
+
+	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
+		INIT_LIST_HEAD(temp_inactive_list + i);
+
+	spin_lock_irq(&conf->device_lock);
+	while ((batch_size = handle_active_stripes(conf, group,
+						   temp_inactive_list)))
+		handled += batch_size;
+	/* under the device_lock, for raid5_wakeup_stripe_thread() */
+	worker->working = false;
+	spin_unlock_irq(&conf->device_lock);
+
+	pr_debug("%d stripes handled\n", handled);
+
+	async_tx_issue_pending_all();
+	unplug_slaves(conf->mddev);
+
+	pr_debug("--- raid5worker inactive\n");
+}
+
+static int raid5_worker_thread(void *arg)
+{
+	struct r5worker *worker = arg;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(worker->wqueue,
+			test_bit(R5W_WAKEUP, &worker->flags) ||
+			kthread_should_stop());
+		clear_bit(R5W_WAKEUP, &worker->flags);
+
+		raid5_do_work(worker);
+	}
+	return 0;
+}
+
 /*
  * This is our raid5 kernel thread.
  *
@@ -4521,14 +4772,17 @@ static int  retry_aligned_read(raid5_conf_t *conf, struct bio *raid_bio)
  */
 static void raid5d(mddev_t *mddev)
 {
-	struct stripe_head *sh;
 	raid5_conf_t *conf = mddev->private;
-	int handled;
+	struct list_head temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	int handled, batch_size, i;
 
 	pr_debug("+++ raid5d active\n");
 
 	md_check_recovery(mddev);
 
+	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
+		INIT_LIST_HEAD(temp_inactive_list + i);
+
 	handled = 0;
 	spin_lock_irq(&conf->device_lock);
 	while (1) {
@@ -4540,7 +4794,7 @@ static void raid5d(mddev_t *mddev)
 			bitmap_unplug(mddev->bitmap);
 			spin_lock_irq(&conf->device_lock);
 			conf->seq_write = seq;
-			activate_bit_delay(conf);
+			activate_bit_delay(conf, temp_inactive_list);
 		}
 
 		while ((bio = remove_bio_from_retry(conf))) {
@@ -4553,23 +4807,18 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
-		sh = __get_priority_stripe(conf);
-
-		if (!sh)
+		batch_size = handle_active_stripes(conf, NULL,
+						   temp_inactive_list);
+		if (!batch_size)
 			break;
-		spin_unlock_irq(&conf->device_lock);
-		
-		handled++;
-		handle_stripe(sh);
-		release_stripe(sh);
-		cond_resched();
-
-		spin_lock_irq(&conf->device_lock);
+		handled += batch_size;
 	}
 	pr_debug("%d stripes handled\n", handled);
 
 	spin_unlock_irq(&conf->device_lock);
 
+	release_inactive_stripe_lists(conf, temp_inactive_list);
+
 	async_tx_issue_pending_all();
 	unplug_slaves(mddev);
 
@@ -4591,11 +4840,13 @@ raid5_set_cache_size(mddev_t *mddev, int size)
 {
 	raid5_conf_t *conf = mddev->private;
 	int err;
+	int hash;
 
 	if (size <= 16 || size > 32768)
 		return -EINVAL;
 	while (size < conf->max_nr_stripes) {
-		if (drop_one_stripe(conf))
+		hash = (conf->max_nr_stripes - 1) % NR_STRIPE_HASH_LOCKS;
+		if (drop_one_stripe(conf, hash))
 			conf->max_nr_stripes--;
 		else
 			break;
@@ -4604,7 +4855,8 @@ raid5_set_cache_size(mddev_t *mddev, int size)
 	if (err)
 		return err;
 	while (size > conf->max_nr_stripes) {
-		if (grow_one_stripe(conf))
+		hash = conf->max_nr_stripes % NR_STRIPE_HASH_LOCKS;
+		if (grow_one_stripe(conf, hash))
 			conf->max_nr_stripes++;
 		else break;
 	}
@@ -4684,10 +4936,74 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_cnt_per_group);
+	else
+		return 0;
+}
+
+static void free_thread_groups(struct r5worker_group *groups, int group_cnt,
+			       int cnt);
+static int alloc_thread_groups(raid5_conf_t *conf, int cnt, int *group_cnt,
+			       struct r5worker_group **worker_groups);
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	struct r5worker_group *old_groups, *new_groups;
+	int old_group_cnt, old_cnt, group_cnt;
+	unsigned long new;
+	int err;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > nr_cpu_ids)
+		return -EINVAL;
+	if (new == conf->worker_cnt_per_group)
+		return len;
+
+	err = alloc_thread_groups(conf, new, &group_cnt, &new_groups);
+	if (err)
+		return err;
+
+	/* with the array quiesced, no stripe is on any handle list */
+	mddev_suspend(mddev);
+
+	spin_lock_irq(&conf->device_lock);
+	old_groups = conf->worker_groups;
+	old_group_cnt = conf->group_cnt;
+	old_cnt = conf->worker_cnt_per_group;
+	conf->worker_groups = new_groups;
+	conf->group_cnt = group_cnt;
+	conf->worker_cnt_per_group = new;
+	spin_unlock_irq(&conf->device_lock);
+
+	mddev_resume(mddev);
+
+	free_thread_groups(old_groups, old_group_cnt, old_cnt);
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4733,8 +5049,84 @@ static void raid5_free_percpu(raid5_conf_t *conf)
 	free_percpu(conf->percpu);
 }
 
+/*
+ * Set up @cnt worker threads for each NUMA node, preferably running on
+ * that node's cpus.  No groups at all for @cnt 0: raid5d then handles
+ * every stripe.
+ */
+static int alloc_thread_groups(raid5_conf_t *conf, int cnt, int *group_cnt,
+			       struct r5worker_group **worker_groups)
+{
+	struct r5worker_group *groups;
+	struct r5worker *workers;
+	int i, j;
+
+	*group_cnt = 0;
+	*worker_groups = NULL;
+	if (cnt == 0)
+		return 0;
+
+	groups = kzalloc(sizeof(struct r5worker_group) * nr_node_ids,
+			 GFP_KERNEL);
+	workers = kzalloc(sizeof(struct r5worker) * cnt * nr_node_ids,
+			  GFP_KERNEL);
+	if (!groups || !workers) {
+		kfree(groups);
+		kfree(workers);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_node_ids; i++) {
+		struct r5worker_group *group = groups + i;
+
+		INIT_LIST_HEAD(&group->handle_list);
+		group->conf = conf;
+		group->workers = workers + i * cnt;
+
+		for (j = 0; j < cnt; j++) {
+			struct r5worker *worker = group->workers + j;
+			struct task_struct *tsk;
+
+			worker->group = group;
+			init_waitqueue_head(&worker->wqueue);
+			tsk = kthread_create(raid5_worker_thread, worker,
+					     "%s_r5w%d_%d",
+					     mdname(conf->mddev), i, j);
+			if (IS_ERR(tsk)) {
+				free_thread_groups(groups, nr_node_ids, cnt);
+				return PTR_ERR(tsk);
+			}
+			if (nr_cpus_node(i))
+				set_cpus_allowed_ptr(tsk, cpumask_of_node(i));
+			worker->tsk = tsk;
+			wake_up_process(tsk);
+		}
+	}
+
+	*group_cnt = nr_node_ids;
+	*worker_groups = groups;
+	return 0;
+}
+
+static void free_thread_groups(struct r5worker_group *groups, int group_cnt,
+			       int cnt)
+{
+	int i, j;
+
+	if (!groups)
+		return;
+	for (i = 0; i < group_cnt; i++)
+		for (j = 0; j < cnt; j++)
+			if (groups[i].workers[j].tsk)
+				kthread_stop(groups[i].workers[j].tsk);
+	kfree(groups[0].workers);
+	kfree(groups);
+}
+
 static void free_conf(raid5_conf_t *conf)
 {
+	free_thread_groups(conf->worker_groups, conf->group_cnt,
+			   conf->worker_cnt_per_group);
 	shrink_stripes(conf);
 	raid5_free_percpu(conf);
 	kfree(conf->disks);
@@ -4827,6 +5219,7 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 {
 	raid5_conf_t *conf;
 	int raid_disk, memory, max_disks;
+	int i;
 	mdk_rdev_t *rdev;
 	struct disk_info *disk;
 
@@ -4863,13 +5256,17 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	if (conf == NULL)
 		goto abort;
 	spin_lock_init(&conf->device_lock);
+	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
+		spin_lock_init(conf->hash_locks + i);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
 	INIT_LIST_HEAD(&conf->handle_list);
 	INIT_LIST_HEAD(&conf->hold_list);
 	INIT_LIST_HEAD(&conf->delayed_list);
 	INIT_LIST_HEAD(&conf->bitmap_list);
-	INIT_LIST_HEAD(&conf->inactive_list);
+	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
+		INIT_LIST_HEAD(conf->inactive_list + i);
+	atomic_set(&conf->empty_inactive_list_nr, NR_STRIPE_HASH_LOCKS);
 	atomic_set(&conf->active_stripes, 0);
 	atomic_set(&conf->preread_active_stripes, 0);
 	atomic_set(&conf->active_aligned_reads, 0);
@@ -5270,7 +5667,7 @@ static void printall(struct seq_file *seq, raid5_conf_t *conf)
 	struct hlist_node *hn;
 	int i;
 
-	spin_lock_irq(&conf->device_lock);
+	lock_all_device_hash_locks_irq(conf);
 	for (i = 0; i < NR_HASH; i++) {
 		hlist_for_each_entry(sh, hn, &conf->stripe_hashtbl[i], hash) {
 			if (sh->raid_conf != conf)
@@ -5278,7 +5675,7 @@ static void printall(struct seq_file *seq, raid5_conf_t *conf)
 			print_sh(seq, sh);
 		}
 	}
-	spin_unlock_irq(&conf->device_lock);
+	unlock_all_device_hash_locks_irq(conf);
 }
 #endif
 
@@ -5548,7 +5945,8 @@ static int raid5_start_reshape(mddev_t *mddev)
 	}
 
 	atomic_set(&conf->reshape_stripes, 0);
-	spin_lock_irq(&conf->device_lock);
+	/* init_stripe() looks at the geometry under a hash lock */
+	lock_all_device_hash_locks_irq(conf);
 	conf->previous_raid_disks = conf->raid_disks;
 	conf->raid_disks += mddev->delta_disks;
 	conf->prev_chunk_sectors = conf->chunk_sectors;
@@ -5561,7 +5959,7 @@ static int raid5_start_reshape(mddev_t *mddev)
 		conf->reshape_progress = 0;
 	conf->reshape_safe = conf->reshape_progress;
 	conf->generation++;
-	spin_unlock_irq(&conf->device_lock);
+	unlock_all_device_hash_locks_irq(conf);
 
 	/* Add some new drives, as many as will fit.
 	 * We know there are enough to make the newly sized array work.
@@ -5610,10 +6008,10 @@ static int raid5_start_reshape(mddev_t *mddev)
 						"reshape");
 	if (!mddev->sync_thread) {
 		mddev->recovery = 0;
-		spin_lock_irq(&conf->device_lock);
+		lock_all_device_hash_locks_irq(conf);
 		mddev->raid_disks = conf->raid_disks = conf->previous_raid_disks;
 		conf->reshape_progress = MaxSector;
-		spin_unlock_irq(&conf->device_lock);
+		unlock_all_device_hash_locks_irq(conf);
 		return -EAGAIN;
 	}
 	conf->reshape_checkpoint = jiffies;
@@ -5630,10 +6028,10 @@ static void end_reshape(raid5_conf_t *conf)
 
 	if (!test_bit(MD_RECOVERY_INTR, &conf->mddev->recovery)) {
 
-		spin_lock_irq(&conf->device_lock);
+		lock_all_device_hash_locks_irq(conf);
 		conf->previous_raid_disks = conf->raid_disks;
 		conf->reshape_progress = MaxSector;
-		spin_unlock_irq(&conf->device_lock);
+		unlock_all_device_hash_locks_irq(conf);
 		wake_up(&conf->wait_for_overlap);
 
 		/* read-ahead size must cover two whole stripes, which is
@@ -5699,11 +6097,13 @@ static void raid5_quiesce(mddev_t *mddev, int state)
 		break;
 
 	case 1: /* stop all writes */
-		spin_lock_irq(&conf->device_lock);
+		lock_all_device_hash_locks_irq(conf);
 		/* '2' tells resync/reshape to pause so that all
 		 * active stripes can drain
 		 */
 		conf->quiesce = 2;
+		unlock_all_device_hash_locks_irq(conf);
+		spin_lock_irq(&conf->device_lock);
 		wait_event_lock_irq(conf->wait_for_stripe,
 				    atomic_read(&conf->active_stripes) == 0 &&
 				    atomic_read(&conf->active_aligned_reads) == 0,
@@ -5715,11 +6115,11 @@ static void raid5_quiesce(mddev_t *mddev, int state)
 		break;
 
 	case 0: /* re-enable writes */
-		spin_lock_irq(&conf->device_lock);
+		lock_all_device_hash_locks_irq(conf);
 		conf->quiesce = 0;
 		wake_up(&conf->wait_for_stripe);
 		wake_up(&conf->wait_for_overlap);
-		spin_unlock_irq(&conf->device_lock);
+		unlock_all_device_hash_locks_irq(conf);
 		break;
 	}
 }
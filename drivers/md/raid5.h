@@ -94,8 +94,11 @@
  * not hashed must be on the inactive_list, and will normally be at
  * the front.  All stripes start life this way.
  *
- * The inactive_list, handle_list and hash bucket lists are all protected by the
- * device_lock.
+ * The stripe cache is split in NR_STRIPE_HASH_LOCKS parts by sector: each
+ * part has its own inactive_list, and its hash buckets and inactive_list
+ * are protected by the matching hash_lock.  A stripe stays in the same
+ * part (sh->hash_lock_index) for its lifetime.  The handle lists are
+ * protected by the device_lock, which nests inside a hash_lock.
  *  - stripes on the inactive_list never have their stripe_lock held.
  *  - stripes have a reference counter. If count==0, they are on a list.
  *  - If a stripe might need handling, STRIPE_HANDLE is set.
@@ -110,9 +113,9 @@
  *
  * The possible transitions are:
  *  activate an unhashed/inactive stripe (get_active_stripe())
- *     lockdev check-hash unlink-stripe cnt++ clean-stripe hash-stripe unlockdev
+ *     lockhash check-hash unlink-stripe cnt++ clean-stripe hash-stripe unlockhash
  *  activate a hashed, possibly active stripe (get_active_stripe())
- *     lockdev check-hash if(!cnt++)unlink-stripe unlockdev
+ *     lockhash check-hash if(!cnt++)(lockdev unlink-stripe unlockdev) unlockhash
  *  attach a request to an active stripe (add_stripe_bh())
  *     lockdev attach-buffer unlockdev
  *  handle a stripe (handle_stripe())
@@ -121,10 +124,11 @@
  *		change-state ..
  *		record io/ops needed unlockstripe schedule io/ops
  *  release an active stripe (release_stripe())
- *     lockdev if (!--cnt) { if  STRIPE_HANDLE, add to handle_list else add to inactive-list } unlockdev
+ *     lockdev if (!--cnt) { if  STRIPE_HANDLE, add to handle_list else add to temp-list } unlockdev
+ *     lockhash splice temp-list to inactive-list unlockhash
  *
  * The refcount counts each thread that have activated the stripe,
- * plus raid5d if it is handling it, plus one for each active request
+ * plus raid5d or a worker if it is handling it, plus one for each active request
  * on a cached buffer, and plus one if the stripe is undergoing stripe
  * operations.
  *
@@ -201,6 +205,9 @@ struct stripe_head {
 	struct hlist_node	hash;
 	struct list_head	lru;	      /* inactive_list or handle_list */
 	struct raid5_private_data *raid_conf;
+	struct r5worker_group	*group;	      /* handle_list it is on, if any */
+	int			cpu;	      /* cpu which last activated it */
+	int			hash_lock_index;
 	short			generation;	/* increments with every
 						 * reshape */
 	sector_t		sector;		/* sector of this row */
@@ -343,6 +350,36 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/* NOTE NR_STRIPE_HASH_LOCKS must remain below 64.
+ * This is because we sometimes take all the spinlocks
+ * and creating that much locking depth can cause
+ * problems.
+ */
+#define NR_STRIPE_HASH_LOCKS 8
+#define STRIPE_HASH_LOCKS_MASK (NR_STRIPE_HASH_LOCKS - 1)
+
+/*
+ * Stripes needing handling are queued to the worker group of the NUMA
+ * node they were submitted from, and handled by that group's threads
+ * (when group_thread_cnt is set) as well as by raid5d.
+ */
+struct r5worker {
+	struct task_struct	*tsk;
+	struct r5worker_group	*group;
+	unsigned long		flags;
+	wait_queue_head_t	wqueue;
+	bool			working;
+};
+
+#define R5W_WAKEUP	0
+
+struct r5worker_group {
+	struct list_head	handle_list;
+	struct raid5_private_data *conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -372,6 +409,9 @@ struct raid5_private_data {
 
 	struct list_head	handle_list; /* stripes needing handling */
 	struct list_head	hold_list; /* preread ready stripes */
+	struct r5worker_group	*worker_groups;
+	int			group_cnt;
+	int			worker_cnt_per_group;
 	struct list_head	delayed_list; /* stripes that have plugged requests */
 	struct list_head	bitmap_list; /* stripes delaying awaiting bitmap update */
 	struct bio		*retry_read_aligned; /* currently retrying aligned bios   */
@@ -421,7 +461,8 @@ struct raid5_private_data {
 	 * Free stripes pool
 	 */
 	atomic_t		active_stripes;
-	struct list_head	inactive_list;
+	struct list_head	inactive_list[NR_STRIPE_HASH_LOCKS];
+	atomic_t		empty_inactive_list_nr;
 	wait_queue_head_t	wait_for_stripe;
 	wait_queue_head_t	wait_for_overlap;
 	int			inactive_blocked;	/* release of inactive stripes blocked,
@@ -429,6 +470,8 @@ struct raid5_private_data {
 							 */
 	int			pool_size; /* number of disks in stripeheads in pool */
 	spinlock_t		device_lock;
+	/* protect the stripe hash buckets and inactive lists, see above */
+	spinlock_t		hash_locks[NR_STRIPE_HASH_LOCKS];
 	struct disk_info	*disks;
 
 	/* When taking over an array from a different personality, we store
@@ -2380,32 +2380,38 @@ int bond_3ad_get_active_agg_info(struct bonding *bond, struct ad_info *ad_info)
 
 int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 {
-	struct slave *slave, *start_at;
+	struct slave *slave, *start_at, *first;
 	struct bonding *bond = netdev_priv(dev);
+	struct aggregator *active = NULL;
 	int slave_agg_no;
 	int slaves_in_agg;
 	int agg_id;
 	int i;
-	struct ad_info ad_info;
 	int res = 1;
 
-	/* make sure that the slaves list will
-	 * not change during tx
+	/* Under rcu_read_lock(), from bond_start_xmit(): the slaves list
+	 * may change during tx, walk it from a first slave we checked.
 	 */
-	read_lock(&bond->lock);
-
-	if (!BOND_IS_OK(bond)) {
+	first = rcu_dereference(bond->first_slave);
+	if (!BOND_IS_OK(bond) || !first)
 		goto out;
+
+	bond_for_each_slave_from(bond, slave, i, first) {
+		struct aggregator *agg = SLAVE_AD_INFO(slave).port.aggregator;
+
+		if (agg && agg->is_active) {
+			active = agg;
+			break;
+		}
 	}
 
-	if (bond_3ad_get_active_agg_info(bond, &ad_info)) {
-		pr_debug("%s: Error: bond_3ad_get_active_agg_info failed\n",
-			 dev->name);
+	if (!active) {
+		pr_debug("%s: Error: no active aggregator\n", dev->name);
 		goto out;
 	}
 
-	slaves_in_agg = ad_info.ports;
-	agg_id = ad_info.aggregator_id;
+	slaves_in_agg = active->num_of_ports;
+	agg_id = active->aggregator_identifier;
 
 	if (slaves_in_agg == 0) {
 		/*the aggregator is empty*/
@@ -2415,7 +2421,7 @@ int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 
 	slave_agg_no = bond->xmit_hash_policy(skb, slaves_in_agg);
 
-	bond_for_each_slave(bond, slave, i) {
+	bond_for_each_slave_from(bond, slave, i, first) {
 		struct aggregator *agg = SLAVE_AD_INFO(slave).port.aggregator;
 
 		if (agg && (agg->aggregator_identifier == agg_id)) {
@@ -2453,7 +2459,6 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
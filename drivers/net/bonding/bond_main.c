@@ -1150,7 +1150,7 @@ void bond_change_active_slave(struct bonding *bond, struct slave *new_active)
 		if (new_active)
 			bond_set_slave_active_flags(new_active);
 	} else {
-		bond->curr_active_slave = new_active;
+		rcu_assign_pointer(bond->curr_active_slave, new_active);
 	}
 
 	if (bond->params.mode == BOND_MODE_ACTIVEBACKUP) {
@@ -1236,7 +1236,8 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
 		new_slave->next = bond->first_slave;
 		new_slave->prev = bond->first_slave->prev;
 		new_slave->next->prev = new_slave;
-		new_slave->prev->next = new_slave;
+		/* the transmit paths may be walking the list */
+		rcu_assign_pointer(new_slave->prev->next, new_slave);
 	}
 
 	bond->slave_cnt++;
@@ -1249,6 +1250,8 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
  * Nothing is freed on return, structures are just unchained.
  * If any slave pointer in bond was pointing to <slave>,
  * it should be changed by the calling function.
+ * slave->next is left alone: a lockless walker may be standing on
+ * <slave>, and goes on from there to the rest of the list.
  *
  * bond->lock held for writing by caller.
  */
@@ -1268,7 +1271,6 @@ static void bond_detach_slave(struct bonding *bond, struct slave *slave)
 		}
 	}
 
-	slave->next = NULL;
 	slave->prev = NULL;
 	bond->slave_cnt--;
 }
@@ -1753,7 +1755,7 @@ int bond_enslave(struct net_device *bond_dev, struct net_device *slave_dev)
 		 * so we can change it without calling change_active_interface()
 		 */
 		if (!bond->curr_active_slave)
-			bond->curr_active_slave = new_slave;
+			rcu_assign_pointer(bond->curr_active_slave, new_slave);
 
 		break;
 	} /* switch(bond_mode) */
@@ -4229,16 +4231,22 @@ unwind:
 	return res;
 }
 
+/*
+ * The transmit functions run under rcu_read_lock(), from bond_start_xmit(),
+ * without bond->lock: slaves may come and go while they look for one.
+ * They start from a first_slave they checked, and divide by a slave_cnt
+ * they read once.
+ */
 static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = netdev_priv(bond_dev);
 	struct slave *slave, *start_at;
-	int i, slave_no, res = 1;
+	int i, slave_no, slave_cnt, res = 1;
 	struct iphdr *iph = ip_hdr(skb);
 
-	read_lock(&bond->lock);
-
-	if (!BOND_IS_OK(bond))
+	slave_cnt = ACCESS_ONCE(bond->slave_cnt);
+	start_at = rcu_dereference(bond->first_slave);
+	if (!BOND_IS_OK(bond) || !slave_cnt || !start_at)
 		goto out;
 	/*
 	 * Start with the curr_active_slave that joined the bond as the
@@ -4249,11 +4257,7 @@ static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev
 	 */
 	if ((iph->protocol == IPPROTO_IGMP) &&
 	    (skb->protocol == htons(ETH_P_IP))) {
-
-		read_lock(&bond->curr_slave_lock);
-		slave = bond->curr_active_slave;
-		read_unlock(&bond->curr_slave_lock);
-
+		slave = rcu_dereference(bond->curr_active_slave);
 		if (!slave)
 			goto out;
 	} else {
@@ -4262,9 +4266,9 @@ static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev
 		 * that as being rare enough not to justify using an
 		 * atomic op here.
 		 */
-		slave_no = bond->rr_tx_counter++ % bond->slave_cnt;
+		slave_no = bond->rr_tx_counter++ % slave_cnt;
 
-		bond_for_each_slave(bond, slave, i) {
+		bond_for_each_slave_from(bond, slave, i, start_at) {
 			slave_no--;
 			if (slave_no < 0)
 				break;
@@ -4286,7 +4290,6 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4298,26 +4301,23 @@ out:
 static int bond_xmit_activebackup(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = netdev_priv(bond_dev);
+	struct slave *slave;
 	int res = 1;
 
-	read_lock(&bond->lock);
-	read_lock(&bond->curr_slave_lock);
-
 	if (!BOND_IS_OK(bond))
 		goto out;
 
-	if (!bond->curr_active_slave)
+	slave = rcu_dereference(bond->curr_active_slave);
+	if (!slave)
 		goto out;
 
-	res = bond_dev_queue_xmit(bond, skb, bond->curr_active_slave->dev);
+	res = bond_dev_queue_xmit(bond, skb, slave->dev);
 
 out:
 	if (res)
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 
-	read_unlock(&bond->curr_slave_lock);
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4331,17 +4331,18 @@ static int bond_xmit_xor(struct sk_buff *skb, struct net_device *bond_dev)
 	struct bonding *bond = netdev_priv(bond_dev);
 	struct slave *slave, *start_at;
 	int slave_no;
+	int slave_cnt;
 	int i;
 	int res = 1;
 
-	read_lock(&bond->lock);
-
-	if (!BOND_IS_OK(bond))
+	slave_cnt = ACCESS_ONCE(bond->slave_cnt);
+	start_at = rcu_dereference(bond->first_slave);
+	if (!BOND_IS_OK(bond) || !slave_cnt || !start_at)
 		goto out;
 
-	slave_no = bond->xmit_hash_policy(skb, bond->slave_cnt);
+	slave_no = bond->xmit_hash_policy(skb, slave_cnt);
 
-	bond_for_each_slave(bond, slave, i) {
+	bond_for_each_slave_from(bond, slave, i, start_at) {
 		slave_no--;
 		if (slave_no < 0)
 			break;
@@ -4363,7 +4364,6 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4378,15 +4378,10 @@ static int bond_xmit_broadcast(struct sk_buff *skb, struct net_device *bond_dev)
 	int i;
 	int res = 1;
 
-	read_lock(&bond->lock);
-
 	if (!BOND_IS_OK(bond))
 		goto out;
 
-	read_lock(&bond->curr_slave_lock);
-	start_at = bond->curr_active_slave;
-	read_unlock(&bond->curr_slave_lock);
-
+	start_at = rcu_dereference(bond->curr_active_slave);
 	if (!start_at)
 		goto out;
 
@@ -4421,7 +4416,6 @@ out:
 		dev_kfree_skb(skb);
 
 	/* frame sent to all suitable interfaces */
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4452,14 +4446,14 @@ static inline int bond_slave_override(struct bonding *bond,
 	int i, res = 1;
 	struct slave *slave = NULL;
 	struct slave *check_slave;
+	struct slave *first;
 
-	read_lock(&bond->lock);
-
-	if (!BOND_IS_OK(bond) || !skb->queue_mapping)
+	first = rcu_dereference(bond->first_slave);
+	if (!BOND_IS_OK(bond) || !skb->queue_mapping || !first)
 		goto out;
 
 	/* Find out if any slaves have the same mapping as this skb. */
-	bond_for_each_slave(bond, check_slave, i) {
+	bond_for_each_slave_from(bond, check_slave, i, first) {
 		if (check_slave->queue_id == skb->queue_mapping) {
 			slave = check_slave;
 			break;
@@ -4473,7 +4467,6 @@ static inline int bond_slave_override(struct bonding *bond,
 	}
 
 out:
-	read_unlock(&bond->lock);
 	return res;
 }
 
@@ -4488,7 +4481,7 @@ static u16 bond_select_queue(struct net_device *dev, struct sk_buff *skb)
 	return skb->queue_mapping;
 }
 
-static netdev_tx_t bond_start_xmit(struct sk_buff *skb, struct net_device *dev)
+static netdev_tx_t __bond_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct bonding *bond = netdev_priv(dev);
 
@@ -4521,6 +4514,18 @@ static netdev_tx_t bond_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 }
 
+static netdev_tx_t bond_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	netdev_tx_t ret;
+
+	/* holds off the freeing of the slaves, see bond_release() */
+	rcu_read_lock();
+	ret = __bond_start_xmit(skb, dev);
+	rcu_read_unlock();
+
+	return ret;
+}
+
 
 /*
  * set bond mode specific net device operations
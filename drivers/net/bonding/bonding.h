@@ -83,7 +83,7 @@
  * @cnt:	counter for max number of moves
  * @start:	starting point.
  *
- * Caller must hold bond->lock
+ * Caller must hold bond->lock, or rcu_read_lock() with a non NULL @start
  */
 #define bond_for_each_slave_from(bond, pos, cnt, start)	\
 	for (cnt = 0, pos = start;				\
@@ -187,6 +187,11 @@ struct slave {
  *    (It is unnecessary when the write-lock is put with bond->lock.)
  * 3) When we lock with bond->curr_slave_lock, we must lock with bond->lock
  *    beforehand.
+ *
+ * The transmit paths take neither: they walk the slave list and read
+ * curr_active_slave under rcu_read_lock().  A detached slave keeps its
+ * next pointer, and it is freed only after the grace period waited for
+ * by netdev_set_master().
  */
 struct bonding {
 	struct   net_device *dev; /* first - useful for panic debug */
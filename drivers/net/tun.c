@@ -90,16 +90,26 @@ struct tap_filter {
 	unsigned char	addr[FLT_EXACT_COUNT][ETH_ALEN];
 };
 
+struct tun_sock;
+
 struct tun_file {
 	atomic_t count;
 	struct tun_struct *tun;
 	struct net *net;
+	struct tun_sock *tsk;
 };
 
-struct tun_sock;
+/* Most queues a multiqueue device can have, one per attached file */
+#define MAX_TAP_QUEUES	16
+
+/* Bytes copied into the head of a zero-copy packet when it has no headers
+ * length: room for the stack to pull and grow headers without a copy. */
+#define GOODCOPY_LEN	128
 
 struct tun_struct {
-	struct tun_file		*tfile;
+	/* The attached queues, kept packed at the front of the array */
+	struct tun_sock		*queues[MAX_TAP_QUEUES];
+	unsigned int		numqueues;
 	unsigned int 		flags;
 	uid_t			owner;
 	gid_t			group;
@@ -108,8 +118,10 @@ struct tun_struct {
 	struct fasync_struct	*fasync;
 
 	struct tap_filter       txflt;
-	struct socket		socket;
-	struct socket_wq	wq;
+
+	/* Holds the device and its filter, sndbuf and security settings.
+	 * Every queue socket holds a reference on it. */
+	struct sock		*sk;
 
 	int			vnet_hdr_sz;
 
@@ -118,9 +130,19 @@ struct tun_struct {
 #endif
 };
 
+/*
+ * One queue of the device: the packets sent to the device wait on its
+ * receive queue for the attached file to read them.  The socket and its
+ * wait queue live here, rather than in the file, because they must outlast
+ * the file until the packets written through it are freed.
+ */
 struct tun_sock {
 	struct sock		sk;
 	struct tun_struct	*tun;
+	struct tun_file		*tfile;
+	struct socket		socket;
+	struct socket_wq	wq;
+	u16			queue_index;
 };
 
 static inline struct tun_sock *tun_sk(struct sock *sk)
@@ -128,57 +150,86 @@ static inline struct tun_sock *tun_sk(struct sock *sk)
 	return container_of(sk, struct tun_sock, sk);
 }
 
+static struct sock *tun_sk_alloc(struct net *net, struct tun_struct *tun);
+
+static void tun_queue_destruct(struct sock *sk)
+{
+	sock_put(tun_sk(sk)->tun->sk);
+}
+
 static int tun_attach(struct tun_struct *tun, struct file *file)
 {
 	struct tun_file *tfile = file->private_data;
-	int err;
+	unsigned int maxqueues = tun->flags & TUN_TAP_MQ ? MAX_TAP_QUEUES : 1;
+	struct tun_sock *tsk;
+	struct sock *sk;
 
 	ASSERT_RTNL();
 
-	netif_tx_lock_bh(tun->dev);
-
-	err = -EINVAL;
 	if (tfile->tun)
-		goto out;
+		return -EINVAL;
 
-	err = -EBUSY;
-	if (tun->tfile)
-		goto out;
+	if (tun->numqueues >= maxqueues)
+		return -EBUSY;
+
+	sk = tun_sk_alloc(dev_net(tun->dev), tun);
+	if (!sk)
+		return -ENOMEM;
+	sk->sk_sndbuf = tun->sk->sk_sndbuf;
+	sk->sk_destruct = tun_queue_destruct;
+	sock_set_flag(sk, SOCK_ZEROCOPY);
+	tsk = tun_sk(sk);
+	tsk->tfile = tfile;
+	tsk->socket.file = file;
 
-	err = 0;
+	netif_tx_lock_bh(tun->dev);
 	tfile->tun = tun;
-	tun->tfile = tfile;
-	tun->socket.file = file;
+	tfile->tsk = tsk;
+	tsk->queue_index = tun->numqueues;
+	tun->queues[tun->numqueues++] = tsk;
 	netif_carrier_on(tun->dev);
 	dev_hold(tun->dev);
-	sock_hold(tun->socket.sk);
+	sock_hold(tun->sk);
 	atomic_inc(&tfile->count);
-
-out:
 	netif_tx_unlock_bh(tun->dev);
-	return err;
+
+	return 0;
 }
 
-static void __tun_detach(struct tun_struct *tun)
+static void __tun_detach(struct tun_file *tfile)
 {
-	/* Detach from net device */
+	struct tun_struct *tun = tfile->tun;
+	struct tun_sock *tsk = tfile->tsk;
+	u16 index = tsk->queue_index;
+
+	ASSERT_RTNL();
+
+	/* Detach from net device: the last queue takes the freed slot */
 	netif_tx_lock_bh(tun->dev);
-	netif_carrier_off(tun->dev);
-	tun->tfile = NULL;
-	tun->socket.file = NULL;
+	tun->queues[index] = tun->queues[--tun->numqueues];
+	tun->queues[index]->queue_index = index;
+	tun->queues[tun->numqueues] = NULL;
+	if (!tun->numqueues)
+		netif_carrier_off(tun->dev);
+	tsk->socket.file = NULL;
 	netif_tx_unlock_bh(tun->dev);
 
 	/* Drop read queue */
-	skb_queue_purge(&tun->socket.sk->sk_receive_queue);
+	skb_queue_purge(&tsk->sk.sk_receive_queue);
+
+	/* The tx queue of the slot may have been left stopped by the old
+	 * queue; the queues with no room will stop again by themselves. */
+	if (tun->numqueues && netif_running(tun->dev))
+		netif_tx_wake_all_queues(tun->dev);
 
 	/* Drop the extra count on the net device */
 	dev_put(tun->dev);
 }
 
-static void tun_detach(struct tun_struct *tun)
+static void tun_detach(struct tun_file *tfile)
 {
 	rtnl_lock();
-	__tun_detach(tun);
+	__tun_detach(tfile);
 	rtnl_unlock();
 }
 
@@ -192,17 +243,10 @@ static struct tun_struct *__tun_get(struct tun_file *tfile)
 	return tun;
 }
 
-static struct tun_struct *tun_get(struct file *file)
-{
-	return __tun_get(file->private_data);
-}
-
-static void tun_put(struct tun_struct *tun)
+static void tun_put(struct tun_file *tfile)
 {
-	struct tun_file *tfile = tun->tfile;
-
 	if (atomic_dec_and_test(&tfile->count))
-		tun_detach(tfile->tun);
+		tun_detach(tfile);
 }
 
 /* TAP filterting */
@@ -323,14 +367,17 @@ static const struct ethtool_ops tun_ethtool_ops;
 static void tun_net_uninit(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	struct tun_file *tfile = tun->tfile;
+	int i;
 
 	/* Inform the methods they need to stop using the dev.
+	 * Walk backwards: a detach moves the last queue into the freed slot.
 	 */
-	if (tfile) {
-		wake_up_all(&tun->wq.wait);
+	for (i = tun->numqueues - 1; i >= 0; i--) {
+		struct tun_file *tfile = tun->queues[i]->tfile;
+
+		wake_up_all(&tun->queues[i]->wq.wait);
 		if (atomic_dec_and_test(&tfile->count))
-			__tun_detach(tun);
+			__tun_detach(tfile);
 	}
 }
 
@@ -338,33 +385,62 @@ static void tun_free_netdev(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
 
-	sock_put(tun->socket.sk);
+	sock_put(tun->sk);
 }
 
 /* Net device open. */
 static int tun_net_open(struct net_device *dev)
 {
-	netif_start_queue(dev);
+	netif_tx_start_all_queues(dev);
 	return 0;
 }
 
 /* Net device close. */
 static int tun_net_close(struct net_device *dev)
 {
-	netif_stop_queue(dev);
+	netif_tx_stop_all_queues(dev);
 	return 0;
 }
 
+/*
+ * Spread the flows over the attached queues.  A packet forwarded from a
+ * multiqueue NIC keeps its queue, others go by their flow hash.  The
+ * queues may change under us: tun_net_xmit() checks again under the
+ * queue lock.
+ */
+static u16 tun_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	struct tun_struct *tun = netdev_priv(dev);
+	unsigned int numqueues = ACCESS_ONCE(tun->numqueues);
+	u32 txq;
+
+	if (numqueues <= 1)
+		return 0;
+
+	if (skb_rx_queue_recorded(skb)) {
+		txq = skb_get_rx_queue(skb);
+		while (unlikely(txq >= numqueues))
+			txq -= numqueues;
+		return txq;
+	}
+
+	return ((u64)skb_get_rxhash(skb) * numqueues) >> 32;
+}
+
 /* Net device start xmit */
 static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	u16 txq = skb_get_queue_mapping(skb);
+	struct tun_sock *tsk;
 
 	DBG(KERN_INFO "%s: tun_net_xmit %d\n", tun->dev->name, skb->len);
 
-	/* Drop packet if interface is not attached */
-	if (!tun->tfile)
+	/* Drop packet if the queue is not attached.  The queues are only
+	 * changed with all the tx queues frozen. */
+	if (txq >= tun->numqueues)
 		goto drop;
+	tsk = tun->queues[txq];
 
 	/* Drop if the filter does not like it.
 	 * This is a noop if the filter is disabled.
@@ -372,15 +448,15 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	if (!check_filter(&tun->txflt, skb))
 		goto drop;
 
-	if (tun->socket.sk->sk_filter &&
-	    sk_filter(tun->socket.sk, skb))
+	if (tun->sk->sk_filter &&
+	    sk_filter(tun->sk, skb))
 		goto drop;
 
-	if (skb_queue_len(&tun->socket.sk->sk_receive_queue) >= dev->tx_queue_len) {
+	if (skb_queue_len(&tsk->sk.sk_receive_queue) >= dev->tx_queue_len) {
 		if (!(tun->flags & TUN_ONE_QUEUE)) {
 			/* Normal queueing mode. */
 			/* Packet scheduler handles dropping of further packets. */
-			netif_stop_queue(dev);
+			netif_tx_stop_queue(netdev_get_tx_queue(dev, txq));
 
 			/* We won't see all dropped packets individually, so overrun
 			 * error is more appropriate. */
@@ -394,15 +470,17 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* Orphan the skb - required as we might hang on to it
 	 * for indefinite time. */
+	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		goto drop;
 	skb_orphan(skb);
 
 	/* Enqueue packet */
-	skb_queue_tail(&tun->socket.sk->sk_receive_queue, skb);
+	skb_queue_tail(&tsk->sk.sk_receive_queue, skb);
 
 	/* Notify and wake up reader process */
 	if (tun->flags & TUN_FASYNC)
 		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
-	wake_up_interruptible_poll(&tun->wq.wait, POLLIN |
+	wake_up_interruptible_poll(&tsk->wq.wait, POLLIN |
 				   POLLRDNORM | POLLRDBAND);
 	return NETDEV_TX_OK;
 
@@ -438,6 +516,7 @@ static const struct net_device_ops tun_netdev_ops = {
 	.ndo_open		= tun_net_open,
 	.ndo_stop		= tun_net_close,
 	.ndo_start_xmit		= tun_net_xmit,
+	.ndo_select_queue	= tun_select_queue,
 	.ndo_change_mtu		= tun_net_change_mtu,
 };
 
@@ -446,6 +525,7 @@ static const struct net_device_ops tap_netdev_ops = {
 	.ndo_open		= tun_net_open,
 	.ndo_stop		= tun_net_close,
 	.ndo_start_xmit		= tun_net_xmit,
+	.ndo_select_queue	= tun_select_queue,
 	.ndo_change_mtu		= tun_net_change_mtu,
 	.ndo_set_multicast_list	= tun_net_mclist,
 	.ndo_set_mac_address	= eth_mac_addr,
@@ -497,11 +577,11 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 	if (!tun)
 		return POLLERR;
 
-	sk = tun->socket.sk;
+	sk = &tfile->tsk->sk;
 
 	DBG(KERN_INFO "%s: tun_chr_poll\n", tun->dev->name);
 
-	poll_wait(file, &tun->wq.wait, wait);
+	poll_wait(file, &tfile->tsk->wq.wait, wait);
 
 	if (!skb_queue_empty(&sk->sk_receive_queue))
 		mask |= POLLIN | POLLRDNORM;
@@ -514,17 +594,17 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 	if (tun->dev->reg_state != NETREG_REGISTERED)
 		mask = POLLERR;
 
-	tun_put(tun);
+	tun_put(tfile);
 	return mask;
 }
 
 /* prepad is the amount to reserve at front.  len is length after that.
  * linear is a hint as to how much to copy (usually headers). */
-static inline struct sk_buff *tun_alloc_skb(struct tun_struct *tun,
+static inline struct sk_buff *tun_alloc_skb(struct tun_sock *tsk,
 					    size_t prepad, size_t len,
 					    size_t linear, int noblock)
 {
-	struct sock *sk = tun->socket.sk;
+	struct sock *sk = &tsk->sk;
 	struct sk_buff *skb;
 	int err;
 
@@ -547,16 +627,21 @@ static inline struct sk_buff *tun_alloc_skb(struct tun_struct *tun,
 	return skb;
 }
 
-/* Get packet from user space buffer */
+/* Get packet from user space buffer.  msg_control, from a kernel sender,
+ * is a ubuf_info: the payload past the headers is then pinned rather than
+ * copied, and the callback is run once the pages are released. */
 static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
+				       struct tun_sock *tsk, void *msg_control,
 				       const struct iovec *iv, size_t count,
-				       int noblock)
+				       unsigned long nr_segs, int noblock)
 {
 	struct tun_pi pi = { 0, cpu_to_be16(ETH_P_IP) };
 	struct sk_buff *skb;
-	size_t len = count, align = 0;
+	size_t len = count, align = 0, copylen = 0;
 	struct virtio_net_hdr gso = { 0 };
 	int offset = 0;
+	bool zerocopy = false;
+	int err;
 
 	if (!(tun->flags & TUN_NO_PI)) {
 		if ((len -= sizeof(pi)) > count)
@@ -590,17 +675,33 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
 			return -EINVAL;
 	}
 
-	skb = tun_alloc_skb(tun, align, len, gso.hdr_len, noblock);
+	if (msg_control) {
+		/* Copy the headers, and enough for the stack to grow them */
+		copylen = gso.hdr_len ? gso.hdr_len : GOODCOPY_LEN;
+		if (copylen > len)
+			copylen = len;
+		zerocopy = iov_pages(iv, offset + copylen, nr_segs) <=
+			   MAX_SKB_FRAGS;
+	}
+
+	if (zerocopy)
+		skb = tun_alloc_skb(tsk, align, copylen, copylen, noblock);
+	else
+		skb = tun_alloc_skb(tsk, align, len, gso.hdr_len, noblock);
 	if (IS_ERR(skb)) {
 		if (PTR_ERR(skb) != -EAGAIN)
 			tun->dev->stats.rx_dropped++;
 		return PTR_ERR(skb);
 	}
 
-	if (skb_copy_datagram_from_iovec(skb, 0, iv, offset, len)) {
+	if (zerocopy)
+		err = zerocopy_sg_from_iovec(skb, iv, offset, nr_segs);
+	else
+		err = skb_copy_datagram_from_iovec(skb, 0, iv, offset, len);
+	if (err) {
 		tun->dev->stats.rx_dropped++;
 		kfree_skb(skb);
-		return -EFAULT;
+		return err;
 	}
 
 	if (gso.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
@@ -672,11 +773,24 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	/* Only a packet going out gets to tell the sender when it is sent */
+	if (zerocopy) {
+		skb_shinfo(skb)->destructor_arg = msg_control;
+		skb_tx(skb)->dev_zerocopy = 1;
+	}
+
 	netif_rx_ni(skb);
 
 	tun->dev->stats.rx_packets++;
 	tun->dev->stats.rx_bytes += len;
 
+	/* Copied: the sender can have its buffers back now */
+	if (msg_control && !zerocopy) {
+		struct ubuf_info *uarg = msg_control;
+
+		uarg->callback(uarg);
+	}
+
 	return count;
 }
 
@@ -684,7 +798,8 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 			      unsigned long count, loff_t pos)
 {
 	struct file *file = iocb->ki_filp;
-	struct tun_struct *tun = tun_get(file);
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = __tun_get(tfile);
 	ssize_t result;
 
 	if (!tun)
@@ -692,10 +807,10 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 
 	DBG(KERN_INFO "%s: tun_chr_write %ld\n", tun->dev->name, count);
 
-	result = tun_get_user(tun, iv, iov_length(iv, count),
-			      file->f_flags & O_NONBLOCK);
+	result = tun_get_user(tun, tfile->tsk, NULL, iv, iov_length(iv, count),
+			      count, file->f_flags & O_NONBLOCK);
 
-	tun_put(tun);
+	tun_put(tfile);
 	return result;
 }
 
@@ -778,7 +893,7 @@ static __inline__ ssize_t tun_put_user(struct tun_struct *tun,
 	return total;
 }
 
-static ssize_t tun_do_read(struct tun_struct *tun,
+static ssize_t tun_do_read(struct tun_struct *tun, struct tun_sock *tsk,
 			   struct kiocb *iocb, const struct iovec *iv,
 			   ssize_t len, int noblock)
 {
@@ -788,12 +903,12 @@ static ssize_t tun_do_read(struct tun_struct *tun,
 
 	DBG(KERN_INFO "%s: tun_chr_read\n", tun->dev->name);
 
-	add_wait_queue(&tun->wq.wait, &wait);
+	add_wait_queue(&tsk->wq.wait, &wait);
 	while (len) {
 		current->state = TASK_INTERRUPTIBLE;
 
 		/* Read frames from the queue */
-		if (!(skb=skb_dequeue(&tun->socket.sk->sk_receive_queue))) {
+		if (!(skb=skb_dequeue(&tsk->sk.sk_receive_queue))) {
 			if (noblock) {
 				ret = -EAGAIN;
 				break;
@@ -811,7 +926,7 @@ static ssize_t tun_do_read(struct tun_struct *tun,
 			schedule();
 			continue;
 		}
-		netif_wake_queue(tun->dev);
+		netif_wake_subqueue(tun->dev, tsk->queue_index);
 
 		ret = tun_put_user(tun, skb, iv, len);
 		kfree_skb(skb);
@@ -819,7 +934,7 @@ static ssize_t tun_do_read(struct tun_struct *tun,
 	}
 
 	current->state = TASK_RUNNING;
-	remove_wait_queue(&tun->wq.wait, &wait);
+	remove_wait_queue(&tsk->wq.wait, &wait);
 
 	return ret;
 }
@@ -840,10 +955,11 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 		goto out;
 	}
 
-	ret = tun_do_read(tun, iocb, iv, len, file->f_flags & O_NONBLOCK);
+	ret = tun_do_read(tun, tfile->tsk, iocb, iv, len,
+			  file->f_flags & O_NONBLOCK);
 	ret = min_t(ssize_t, ret, len);
 out:
-	tun_put(tun);
+	tun_put(tfile);
 	return ret;
 }
 
@@ -901,8 +1017,9 @@ static void tun_sock_destruct(struct sock *sk)
 static int tun_sendmsg(struct kiocb *iocb, struct socket *sock,
 		       struct msghdr *m, size_t total_len)
 {
-	struct tun_struct *tun = container_of(sock, struct tun_struct, socket);
-	return tun_get_user(tun, m->msg_iov, total_len,
+	struct tun_sock *tsk = container_of(sock, struct tun_sock, socket);
+	return tun_get_user(tsk->tun, tsk, m->msg_control, m->msg_iov,
+			    total_len, m->msg_iovlen,
 			    m->msg_flags & MSG_DONTWAIT);
 }
 
@@ -910,11 +1027,11 @@ static int tun_recvmsg(struct kiocb *iocb, struct socket *sock,
 		       struct msghdr *m, size_t total_len,
 		       int flags)
 {
-	struct tun_struct *tun = container_of(sock, struct tun_struct, socket);
+	struct tun_sock *tsk = container_of(sock, struct tun_sock, socket);
 	int ret;
 	if (flags & ~(MSG_DONTWAIT|MSG_TRUNC))
 		return -EINVAL;
-	ret = tun_do_read(tun, iocb, m->msg_iov, total_len,
+	ret = tun_do_read(tsk->tun, tsk, iocb, m->msg_iov, total_len,
 			  flags & MSG_DONTWAIT);
 	if (ret > total_len) {
 		m->msg_flags |= MSG_TRUNC;
@@ -935,6 +1052,30 @@ static struct proto tun_proto = {
 	.obj_size	= sizeof(struct tun_sock),
 };
 
+/* Allocate the socket of a queue, or the one holding the device */
+static struct sock *tun_sk_alloc(struct net *net, struct tun_struct *tun)
+{
+	struct tun_sock *tsk;
+	struct sock *sk;
+
+	sk = sk_alloc(net, AF_UNSPEC, GFP_KERNEL, &tun_proto);
+	if (!sk)
+		return NULL;
+
+	tsk = tun_sk(sk);
+	tsk->tun = tun;
+	tsk->socket.wq = &tsk->wq;
+	init_waitqueue_head(&tsk->wq.wait);
+	tsk->socket.ops = &tun_socket_ops;
+	sock_init_data(&tsk->socket, sk);
+	sk->sk_write_space = tun_sock_write_space;
+	sk->sk_sndbuf = INT_MAX;
+
+	security_tun_dev_post_create(sk);
+
+	return sk;
+}
+
 static int tun_flags(struct tun_struct *tun)
 {
 	int flags = 0;
@@ -953,6 +1094,9 @@ static int tun_flags(struct tun_struct *tun)
 	if (tun->flags & TUN_VNET_HDR)
 		flags |= IFF_VNET_HDR;
 
+	if (tun->flags & TUN_TAP_MQ)
+		flags |= IFF_MULTI_QUEUE;
+
 	return flags;
 }
 
@@ -1005,7 +1149,10 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		     (tun->group != -1 && !in_egroup_p(tun->group))) &&
 		    !capable(CAP_NET_ADMIN))
 			return -EPERM;
-		err = security_tun_dev_attach(tun->socket.sk);
+		if (!(ifr->ifr_flags & IFF_MULTI_QUEUE) !=
+		    !(tun->flags & TUN_TAP_MQ))
+			return -EINVAL;
+		err = security_tun_dev_attach(tun->sk);
 		if (err < 0)
 			return err;
 
@@ -1016,6 +1163,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	else {
 		char *name;
 		unsigned long flags = 0;
+		unsigned int queues = 1;
 
 		if (!capable(CAP_NET_ADMIN))
 			return -EPERM;
@@ -1035,11 +1183,16 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		} else
 			return -EINVAL;
 
+		if (ifr->ifr_flags & IFF_MULTI_QUEUE) {
+			flags |= TUN_TAP_MQ;
+			queues = MAX_TAP_QUEUES;
+		}
+
 		if (*ifr->ifr_name)
 			name = ifr->ifr_name;
 
-		dev = alloc_netdev(sizeof(struct tun_struct), name,
-				   tun_setup);
+		dev = alloc_netdev_mq(sizeof(struct tun_struct), name,
+				      tun_setup, queues);
 		if (!dev)
 			return -ENOMEM;
 
@@ -1053,20 +1206,10 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		tun->vnet_hdr_sz = sizeof(struct virtio_net_hdr);
 
 		err = -ENOMEM;
-		sk = sk_alloc(net, AF_UNSPEC, GFP_KERNEL, &tun_proto);
+		sk = tun_sk_alloc(net, tun);
 		if (!sk)
 			goto err_free_dev;
-
-		tun->socket.wq = &tun->wq;
-		init_waitqueue_head(&tun->wq.wait);
-		tun->socket.ops = &tun_socket_ops;
-		sock_init_data(&tun->socket, sk);
-		sk->sk_write_space = tun_sock_write_space;
-		sk->sk_sndbuf = INT_MAX;
-
-		tun_sk(sk)->tun = tun;
-
-		security_tun_dev_post_create(sk);
+		tun->sk = sk;
 
 		tun_net_init(dev);
 
@@ -1113,7 +1256,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	 * xoff state.
 	 */
 	if (netif_running(tun->dev))
-		netif_wake_queue(tun->dev);
+		netif_tx_wake_all_queues(tun->dev);
 
 	strcpy(ifr->ifr_name, tun->dev->name);
 	return 0;
@@ -1194,7 +1337,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 	struct ifreq ifr;
 	int sndbuf;
 	int vnet_hdr_sz;
-	int ret;
+	int ret, i;
 
 	if (cmd == TUNSETIFF || _IOC_TYPE(cmd) == 0x89)
 		if (copy_from_user(&ifr, argp, ifreq_len))
@@ -1205,7 +1348,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		 * This is needed because we never checked for invalid flags on
 		 * TUNSETIFF. */
 		return put_user(IFF_TUN | IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE |
-				IFF_VNET_HDR,
+				IFF_VNET_HDR | IFF_MULTI_QUEUE,
 				(unsigned int __user*)argp);
 	}
 
@@ -1325,7 +1468,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		break;
 
 	case TUNGETSNDBUF:
-		sndbuf = tun->socket.sk->sk_sndbuf;
+		sndbuf = tun->sk->sk_sndbuf;
 		if (copy_to_user(argp, &sndbuf, sizeof(sndbuf)))
 			ret = -EFAULT;
 		break;
@@ -1336,7 +1479,9 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 			break;
 		}
 
-		tun->socket.sk->sk_sndbuf = sndbuf;
+		tun->sk->sk_sndbuf = sndbuf;
+		for (i = 0; i < tun->numqueues; i++)
+			tun->queues[i]->sk.sk_sndbuf = sndbuf;
 		break;
 
 	case TUNGETVNETHDRSZ:
@@ -1367,7 +1512,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		if (copy_from_user(&fprog, argp, sizeof(fprog)))
 			break;
 
-		ret = sk_attach_filter(&fprog, tun->socket.sk);
+		ret = sk_attach_filter(&fprog, tun->sk);
 		break;
 
 	case TUNDETACHFILTER:
@@ -1375,7 +1520,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		ret = -EINVAL;
 		if ((tun->flags & TUN_TYPE_MASK) != TUN_TAP_DEV)
 			break;
-		ret = sk_detach_filter(tun->socket.sk);
+		ret = sk_detach_filter(tun->sk);
 		break;
 
 	default:
@@ -1386,7 +1531,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 unlock:
 	rtnl_unlock();
 	if (tun)
-		tun_put(tun);
+		tun_put(tfile);
 	return ret;
 }
 
@@ -1427,7 +1572,8 @@ static long tun_chr_compat_ioctl(struct file *file,
 
 static int tun_chr_fasync(int fd, struct file *file, int on)
 {
-	struct tun_struct *tun = tun_get(file);
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = __tun_get(tfile);
 	int ret;
 
 	if (!tun)
@@ -1447,7 +1593,7 @@ static int tun_chr_fasync(int fd, struct file *file, int on)
 		tun->flags &= ~TUN_FASYNC;
 	ret = 0;
 out:
-	tun_put(tun);
+	tun_put(tfile);
 	return ret;
 }
 
@@ -1462,6 +1608,7 @@ static int tun_chr_open(struct inode *inode, struct file * file)
 		return -ENOMEM;
 	atomic_set(&tfile->count, 0);
 	tfile->tun = NULL;
+	tfile->tsk = NULL;
 	tfile->net = get_net(current->nsproxy->net_ns);
 	file->private_data = tfile;
 	return 0;
@@ -1478,20 +1625,18 @@ static int tun_chr_close(struct inode *inode, struct file *file)
 
 		DBG(KERN_INFO "%s: tun_chr_close\n", dev->name);
 
-		__tun_detach(tun);
+		rtnl_lock();
+		__tun_detach(tfile);
 
-		/* If desirable, unregister the netdevice. */
-		if (!(tun->flags & TUN_PERSIST)) {
-			rtnl_lock();
-			if (dev->reg_state == NETREG_REGISTERED)
-				unregister_netdevice(dev);
-			rtnl_unlock();
-		}
+		/* If desirable, unregister the netdevice with its last queue. */
+		if (!(tun->flags & TUN_PERSIST) && !tun->numqueues &&
+		    dev->reg_state == NETREG_REGISTERED)
+			unregister_netdevice(dev);
+		rtnl_unlock();
 	}
 
-	tun = tfile->tun;
-	if (tun)
-		sock_put(tun->socket.sk);
+	if (tfile->tsk)
+		sock_put(&tfile->tsk->sk);
 
 	put_net(tfile->net);
 	kfree(tfile);
@@ -1640,14 +1785,16 @@ static void tun_cleanup(void)
  * holding a reference to the file for as long as the socket is in use. */
 struct socket *tun_get_socket(struct file *file)
 {
+	struct tun_file *tfile;
 	struct tun_struct *tun;
 	if (file->f_op != &tun_fops)
 		return ERR_PTR(-EINVAL);
-	tun = tun_get(file);
+	tfile = file->private_data;
+	tun = __tun_get(tfile);
 	if (!tun)
 		return ERR_PTR(-EBADFD);
-	tun_put(tun);
-	return &tun->socket;
+	tun_put(tfile);
+	return &tfile->tsk->socket;
 }
 EXPORT_SYMBOL_GPL(tun_get_socket);
 
@@ -619,7 +619,7 @@ void scsi_log_completion(struct scsi_cmnd *cmd, int disposition)
 			if (level > 3)
 				scmd_printk(KERN_INFO, cmd,
 					    "scsi host busy %d failed %d\n",
-					    cmd->device->host->host_busy,
+					    atomic_read(&cmd->device->host->host_busy),
 					    cmd->device->host->host_failed);
 		}
 	}
@@ -632,13 +632,14 @@ void scsi_log_completion(struct scsi_cmnd *cmd, int disposition)
  * @cmd: command to assign serial number to
  *
  * Description: a serial number identifies a request for error recovery
- * and debugging purposes.  Protected by the Host_Lock of host.
+ * and debugging purposes.  Needs no locking.
  */
 static inline void scsi_cmd_get_serial(struct Scsi_Host *host, struct scsi_cmnd *cmd)
 {
-	cmd->serial_number = host->cmd_serial_number++;
+	cmd->serial_number = atomic_long_inc_return(&host->cmd_serial_number);
 	if (cmd->serial_number == 0) 
-		cmd->serial_number = host->cmd_serial_number++;
+		cmd->serial_number =
+			atomic_long_inc_return(&host->cmd_serial_number);
 }
 
 /**
@@ -737,7 +738,6 @@ int scsi_dispatch_cmd(struct scsi_cmnd *cmd)
 		goto out;
 	}
 
-	spin_lock_irqsave(host->host_lock, flags);
 	/*
 	 * AK: unlikely race here: for some reason the timer could
 	 * expire before the serial number is set up below.
@@ -746,6 +746,12 @@ int scsi_dispatch_cmd(struct scsi_cmnd *cmd)
 	 */
 	scsi_cmd_get_serial(host, cmd); 
 
+	/*
+	 * Hosts with lockless set serialize queuecommand themselves:
+	 * don't bounce the host_lock between the cpus submitting to it.
+	 */
+	if (!host->hostt->lockless)
+		spin_lock_irqsave(host->host_lock, flags);
 	if (unlikely(host->shost_state == SHOST_DEL)) {
 		cmd->result = (DID_NO_CONNECT << 16);
 		scsi_done(cmd);
@@ -753,7 +759,8 @@ int scsi_dispatch_cmd(struct scsi_cmnd *cmd)
 		trace_scsi_dispatch_cmd_start(cmd);
 		rtn = host->hostt->queuecommand(cmd, scsi_done);
 	}
-	spin_unlock_irqrestore(host->host_lock, flags);
+	if (!host->hostt->lockless)
+		spin_unlock_irqrestore(host->host_lock, flags);
 	if (rtn) {
 		trace_scsi_dispatch_cmd_error(cmd, rtn);
 		if (rtn != SCSI_MLQUEUE_DEVICE_BUSY &&
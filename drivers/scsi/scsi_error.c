@@ -53,7 +53,12 @@
 /* called with shost->host_lock held */
 void scsi_eh_wakeup(struct Scsi_Host *shost)
 {
-	if (shost->host_busy == shost->host_failed) {
+	/*
+	 * host_busy is decremented without the host_lock, order our
+	 * read after the recovery state change (see scsi_device_unbusy).
+	 */
+	smp_mb();
+	if (atomic_read(&shost->host_busy) == shost->host_failed) {
 		trace_scsi_eh_wakeup(shost);
 		wake_up_process(shost->ehandler);
 		SCSI_LOG_ERROR_RECOVERY(5,
@@ -785,10 +790,14 @@ static int scsi_send_eh_cmnd(struct scsi_cmnd *scmd, unsigned char *cmnd,
 	scsi_eh_prep_cmnd(scmd, &ses, cmnd, cmnd_size, sense_bytes);
 	shost->eh_action = &done;
 
-	spin_lock_irqsave(shost->host_lock, flags);
 	scsi_log_send(scmd);
-	shost->hostt->queuecommand(scmd, scsi_eh_done);
-	spin_unlock_irqrestore(shost->host_lock, flags);
+	if (shost->hostt->lockless)
+		shost->hostt->queuecommand(scmd, scsi_eh_done);
+	else {
+		spin_lock_irqsave(shost->host_lock, flags);
+		shost->hostt->queuecommand(scmd, scsi_eh_done);
+		spin_unlock_irqrestore(shost->host_lock, flags);
+	}
 
 	timeleft = wait_for_completion_timeout(&done, timeout);
 
@@ -1758,7 +1767,7 @@ int scsi_error_handler(void *data)
 	set_current_state(TASK_INTERRUPTIBLE);
 	while (!kthread_should_stop()) {
 		if ((shost->host_failed == 0 && shost->host_eh_scheduled == 0) ||
-		    shost->host_failed != shost->host_busy) {
+		    shost->host_failed != atomic_read(&shost->host_busy)) {
 			SCSI_LOG_ERROR_RECOVERY(1,
 				printk("Error handler scsi_eh_%d sleeping\n",
 					shost->host_no));
@@ -159,6 +159,9 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->call_ctx = NULL;
 	vq->call = NULL;
 	vq->log_ctx = NULL;
+	vq->upend_idx = 0;
+	vq->done_idx = 0;
+	vq->ubufs = NULL;
 }
 
 static int vhost_worker(void *data)
@@ -220,6 +223,8 @@ long vhost_dev_init(struct vhost_dev *dev,
 	for (i = 0; i < dev->nvqs; ++i) {
 		dev->vqs[i].dev = dev;
 		mutex_init(&dev->vqs[i].mutex);
+		dev->vqs[i].zc_heads = NULL;
+		dev->vqs[i].ubuf_info = NULL;
 		vhost_vq_reset(dev, dev->vqs + i);
 		if (dev->vqs[i].handle_kick)
 			vhost_poll_init(&dev->vqs[i].poll,
@@ -237,6 +242,36 @@ long vhost_dev_check_owner(struct vhost_dev *dev)
 }
 
 /* Caller should have device mutex */
+static void vhost_dev_free_zcopy(struct vhost_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nvqs; ++i) {
+		kfree(dev->vqs[i].zc_heads);
+		dev->vqs[i].zc_heads = NULL;
+		kfree(dev->vqs[i].ubuf_info);
+		dev->vqs[i].ubuf_info = NULL;
+	}
+}
+
+/* The rings of zero-copy heads, big enough for any number in flight */
+static long vhost_dev_alloc_zcopy(struct vhost_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nvqs; ++i) {
+		dev->vqs[i].zc_heads = kmalloc(sizeof *dev->vqs[i].zc_heads *
+					       UIO_MAXIOV, GFP_KERNEL);
+		dev->vqs[i].ubuf_info = kmalloc(sizeof *dev->vqs[i].ubuf_info *
+						UIO_MAXIOV, GFP_KERNEL);
+		if (!dev->vqs[i].zc_heads || !dev->vqs[i].ubuf_info) {
+			vhost_dev_free_zcopy(dev);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 static long vhost_dev_set_owner(struct vhost_dev *dev)
 {
 	struct task_struct *worker;
@@ -256,6 +291,10 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	dev->worker = worker;
 	err = cgroup_attach_task_current_cg(worker);
+	if (err)
+		goto err_cgroup;
+
+	err = vhost_dev_alloc_zcopy(dev);
 	if (err)
 		goto err_cgroup;
 	wake_up_process(worker);	/* avoid contributing to loadavg */
@@ -263,6 +302,7 @@ static long vhost_dev_set_owner(struct vhost_dev *dev)
 	return 0;
 err_cgroup:
 	kthread_stop(worker);
+	dev->worker = NULL;
 err_worker:
 	if (dev->mm)
 		mmput(dev->mm);
@@ -293,6 +333,14 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 {
 	int i;
 	for (i = 0; i < dev->nvqs; ++i) {
+		/* Wait for the lower devices to release the zero-copy
+		 * buffers: their callbacks queue work on us. */
+		if (dev->vqs[i].ubufs) {
+			vhost_ubuf_put_and_wait(dev->vqs[i].ubufs);
+			dev->vqs[i].ubufs = NULL;
+			if (dev->vqs[i].handle_kick)
+				vhost_poll_flush(&dev->vqs[i].poll);
+		}
 		if (dev->vqs[i].kick && dev->vqs[i].handle_kick) {
 			vhost_poll_stop(&dev->vqs[i].poll);
 			vhost_poll_flush(&dev->vqs[i].poll);
@@ -309,6 +357,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 			fput(dev->vqs[i].call);
 		vhost_vq_reset(dev, dev->vqs + i);
 	}
+	vhost_dev_free_zcopy(dev);
 	if (dev->log_ctx)
 		eventfd_ctx_put(dev->log_ctx);
 	dev->log_ctx = NULL;
@@ -323,7 +372,10 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 	dev->mm = NULL;
 
 	WARN_ON(!list_empty(&dev->work_list));
-	kthread_stop(dev->worker);
+	if (dev->worker) {
+		kthread_stop(dev->worker);
+		dev->worker = NULL;
+	}
 }
 
 static int log_access_ok(void __user *log_base, u64 addr, unsigned long sz)
@@ -1253,6 +1305,77 @@ void vhost_add_used_and_signal_n(struct vhost_dev *dev,
 	vhost_signal(dev, vq);
 }
 
+/* Use the zero-copy heads the lower devices are done with, in the order
+ * they were sent so the ring stays in order for the guest.
+ * Caller must have virtqueue mutex. */
+int vhost_zerocopy_signal_used(struct vhost_virtqueue *vq)
+{
+	int i, n = 0;
+
+	for (i = vq->done_idx; i != vq->upend_idx; i = (i + 1) % UIO_MAXIOV) {
+		if (vq->zc_heads[i].len != VHOST_DMA_DONE_LEN)
+			break;
+		vq->zc_heads[i].len = VHOST_DMA_IN_PROGRESS;
+		vhost_add_used(vq, vq->zc_heads[i].id, 0);
+		++n;
+	}
+	if (n) {
+		vq->done_idx = i;
+		vhost_signal(vq->dev, vq);
+	}
+	return n;
+}
+
+static void vhost_zerocopy_done(struct kref *kref)
+{
+	struct vhost_ubuf_ref *ubufs = container_of(kref, struct vhost_ubuf_ref,
+						    kref);
+	complete(&ubufs->done);
+}
+
+/* Called by the skb of a zero-copy head, from any context, once the lower
+ * device no longer needs the guest buffers. */
+void vhost_zerocopy_callback(struct ubuf_info *ubuf)
+{
+	struct vhost_ubuf_ref *ubufs = ubuf->ctx;
+	struct vhost_virtqueue *vq = ubufs->vq;
+
+	vq->zc_heads[ubuf->desc].len = VHOST_DMA_DONE_LEN;
+	vhost_poll_queue(&vq->poll);
+	/* Last access: vq may go away once the count drops */
+	kref_put(&ubufs->kref, vhost_zerocopy_done);
+}
+
+struct vhost_ubuf_ref *vhost_ubuf_alloc(struct vhost_virtqueue *vq, bool zcopy)
+{
+	struct vhost_ubuf_ref *ubufs;
+
+	/* No zero copy backend?  Nothing to count. */
+	if (!zcopy)
+		return NULL;
+	ubufs = kmalloc(sizeof *ubufs, GFP_KERNEL);
+	if (!ubufs)
+		return ERR_PTR(-ENOMEM);
+	kref_init(&ubufs->kref);
+	init_completion(&ubufs->done);
+	ubufs->vq = vq;
+	return ubufs;
+}
+
+void vhost_ubuf_put(struct vhost_ubuf_ref *ubufs)
+{
+	kref_put(&ubufs->kref, vhost_zerocopy_done);
+}
+
+/* Drop the backend's reference and wait for the packets in flight.
+ * complete() is done with ubufs by the time wait_for_completion() returns. */
+void vhost_ubuf_put_and_wait(struct vhost_ubuf_ref *ubufs)
+{
+	kref_put(&ubufs->kref, vhost_zerocopy_done);
+	wait_for_completion(&ubufs->done);
+	kfree(ubufs);
+}
+
 /* OK, now we need to know about added descriptors. */
 bool vhost_enable_notify(struct vhost_virtqueue *vq)
 {
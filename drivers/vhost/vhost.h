@@ -11,6 +11,8 @@
 #include <linux/uio.h>
 #include <linux/virtio_config.h>
 #include <linux/virtio_ring.h>
+#include <linux/kref.h>
+#include <linux/completion.h>
 #include <asm/atomic.h>
 
 struct vhost_device;
@@ -55,6 +57,24 @@ struct vhost_log {
 	u64 len;
 };
 
+/* Zero-copy heads whose buffers the lower device still holds */
+#define VHOST_DMA_IN_PROGRESS	0
+/* ... and the ones it is done with, ready to be used */
+#define VHOST_DMA_DONE_LEN	1
+
+struct vhost_virtqueue;
+
+/* One reference per zero-copy packet in flight, plus the backend's own. */
+struct vhost_ubuf_ref {
+	struct kref kref;
+	struct completion done;
+	struct vhost_virtqueue *vq;
+};
+
+struct vhost_ubuf_ref *vhost_ubuf_alloc(struct vhost_virtqueue *, bool zcopy);
+void vhost_ubuf_put(struct vhost_ubuf_ref *);
+void vhost_ubuf_put_and_wait(struct vhost_ubuf_ref *);
+
 /* The virtqueue structure describes a queue attached to a device. */
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
@@ -110,6 +130,17 @@ struct vhost_virtqueue {
 	/* Log write descriptors */
 	void __user *log_base;
 	struct vhost_log log[VHOST_NET_MAX_SG];
+	/* Zero-copy transmit.  The heads sent from done_idx up to upend_idx
+	 * wait in zc_heads for the lower device to release their buffers,
+	 * and are used in that order; ubuf_info[i] is what the skb of
+	 * zc_heads[i] calls back.  Both arrays have UIO_MAXIOV entries. */
+	int upend_idx;
+	int done_idx;
+	struct vring_used_elem *zc_heads;
+	struct ubuf_info *ubuf_info;
+	/* NULL unless the backend does zero copy.
+	 * Protected by virtqueue mutex. */
+	struct vhost_ubuf_ref *ubufs;
 };
 
 struct vhost_dev {
@@ -151,6 +182,8 @@ void vhost_add_used_and_signal(struct vhost_dev *, struct vhost_virtqueue *,
 void vhost_add_used_and_signal_n(struct vhost_dev *, struct vhost_virtqueue *,
 			       struct vring_used_elem *heads, unsigned count);
 void vhost_signal(struct vhost_dev *, struct vhost_virtqueue *);
+void vhost_zerocopy_callback(struct ubuf_info *);
+int vhost_zerocopy_signal_used(struct vhost_virtqueue *);
 void vhost_disable_notify(struct vhost_virtqueue *);
 bool vhost_enable_notify(struct vhost_virtqueue *);
 
@@ -921,6 +921,7 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 	kfree(elf_phdata);
 
 	set_binfmt(&elf_format);
+	exec_prefetch(bprm->file, current->mm);
 
 #ifdef ARCH_HAS_SETUP_ADDITIONAL_PAGES
 	retval = arch_setup_additional_pages(bprm, !!elf_interpreter);
@@ -25,7 +25,6 @@
 
 /* these are bit numbers for test/set bit */
 #define EXTENT_BUFFER_UPTODATE 0
-#define EXTENT_BUFFER_BLOCKING 1
 #define EXTENT_BUFFER_DIRTY 2
 
 /* these are flags for extent_clear_unlock_delalloc */
@@ -125,14 +124,25 @@ struct extent_buffer {
 	struct list_head leak_list;
 	struct rb_node rb_node;
 
-	/* the spinlock is used to protect most operations */
-	spinlock_t lock;
+	/* count of lock holders on the extent buffer */
+	atomic_t write_locks;
+	atomic_t read_locks;
+	atomic_t blocking_writers;
+	atomic_t blocking_readers;
+	atomic_t spinning_readers;
+	atomic_t spinning_writers;
+
+	/* the rwlock is held by spinning lock owners */
+	rwlock_t lock;
 
 	/*
-	 * when we keep the lock held while blocking, waiters go onto
-	 * the wq
+	 * readers and writers wait on write_lock_wq for the blocking
+	 * writers to go away
 	 */
-	wait_queue_head_t lock_wq;
+	wait_queue_head_t write_lock_wq;
+
+	/* writers wait on read_lock_wq for the blocking readers */
+	wait_queue_head_t read_lock_wq;
 };
 
 struct extent_map_tree;
@@ -2912,11 +2912,11 @@ int submit_bh(int rw, struct buffer_head * bh)
 	BUG_ON(buffer_unwritten(bh));
 
 	/*
-	 * Mask in barrier bit for a write (could be either a WRITE or a
-	 * WRITE_SYNC
+	 * Mask in flush and FUA bits for a write (could be either a WRITE
+	 * or a WRITE_SYNC
 	 */
 	if (buffer_ordered(bh) && (rw & WRITE))
-		rw |= WRITE_BARRIER;
+		rw |= WRITE_FLUSH_FUA;
 
 	/*
 	 * Only clear out a write error when rewriting
@@ -20,6 +20,7 @@
 #include <linux/mount.h>
 #include <linux/statfs.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
 #include "internal.h"
 
 static int cachefiles_daemon_add_cache(struct cachefiles_cache *caches);
@@ -238,6 +239,13 @@ static int cachefiles_daemon_add_cache(struct cachefiles_cache *cache)
 	/* check how much space the cache has */
 	cachefiles_has_space(cache, 0, 0);
 	cachefiles_end_secure(cache, saved_cred);
+
+	/* pull the index into memory before the netfs asks for it; this is
+	 * only an optimisation, so failing to start the thread is ignored */
+	cache->primer = kthread_run(cachefiles_prime_index, cache,
+				    "cachefiles_prime");
+	if (IS_ERR(cache->primer))
+		cache->primer = NULL;
 	return 0;
 
 error_add_cache:
@@ -264,6 +272,11 @@ void cachefiles_daemon_unbind(struct cachefiles_cache *cache)
 {
 	_enter("");
 
+	if (cache->primer) {
+		kthread_stop(cache->primer);
+		cache->primer = NULL;
+	}
+
 	if (test_bit(CACHEFILES_READY, &cache->flags)) {
 		printk(KERN_INFO "CacheFiles:"
 		       " File cache on %s unregistering\n",
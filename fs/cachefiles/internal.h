@@ -80,6 +80,7 @@ struct cachefiles_cache {
 	char				*rootdirname;	/* name of cache root directory */
 	char				*secctx;	/* LSM security context */
 	char				*tag;		/* cache binding tag */
+	struct task_struct		*primer;	/* index priming thread */
 };
 
 /*
@@ -165,6 +166,8 @@ extern int cachefiles_cull(struct cachefiles_cache *cache, struct dentry *dir,
 extern int cachefiles_check_in_use(struct cachefiles_cache *cache,
 				   struct dentry *dir, char *filename);
 
+extern int cachefiles_prime_index(void *_cache);
+
 /*
  * proc.c
  */
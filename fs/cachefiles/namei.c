@@ -20,6 +20,7 @@
 #include <linux/namei.h>
 #include <linux/security.h>
 #include <linux/slab.h>
+#include <linux/kthread.h>
 #include "internal.h"
 
 #define CACHEFILES_KEYBUF_SIZE 512
@@ -950,3 +951,157 @@ int cachefiles_check_in_use(struct cachefiles_cache *cache, struct dentry *dir,
 	//_leave(" = 0");
 	return 0;
 }
+
+/*
+ * a directory waiting to be primed, or the name of a subdirectory found in
+ * one
+ */
+struct cachefiles_prime_dir {
+	struct list_head	link;
+	struct dentry		*dentry;
+};
+
+struct cachefiles_prime_name {
+	struct list_head	link;
+	int			len;
+	char			name[];
+};
+
+struct cachefiles_prime_ctx {
+	struct list_head	names;
+	int			found;
+};
+
+/*
+ * note the subdirectories of a directory being primed
+ * - the lookups can't be done here as the directory is locked
+ */
+static int cachefiles_prime_filldir(void *_ctx, const char *name, int nlen,
+				    loff_t offset, u64 ino, unsigned d_type)
+{
+	struct cachefiles_prime_ctx *ctx = _ctx;
+	struct cachefiles_prime_name *pn;
+
+	ctx->found++;
+
+	if (d_type != DT_DIR && d_type != DT_UNKNOWN)
+		return 0;
+	if (name[0] == '.' &&
+	    (nlen == 1 || (nlen == 2 && name[1] == '.')))
+		return 0;
+
+	pn = kmalloc(sizeof(*pn) + nlen, GFP_KERNEL);
+	if (!pn)
+		return -ENOMEM;
+
+	pn->len = nlen;
+	memcpy(pn->name, name, nlen);
+	list_add_tail(&pn->link, &ctx->names);
+	return 0;
+}
+
+/*
+ * read a directory and look up all of its subdirectories, queueing those
+ * that exist for priming in turn
+ */
+static void cachefiles_prime_one(struct cachefiles_cache *cache,
+				 struct dentry *dir, struct list_head *queue)
+{
+	struct cachefiles_prime_ctx ctx;
+	struct cachefiles_prime_name *pn, *tmp;
+	struct cachefiles_prime_dir *pd;
+	struct dentry *next;
+	struct file *file;
+	int ret;
+
+	INIT_LIST_HEAD(&ctx.names);
+
+	/* don't disturb the atimes that culling goes by */
+	file = dentry_open(dget(dir), mntget(cache->mnt),
+			   O_RDONLY | O_DIRECTORY | O_NOATIME,
+			   cache->cache_cred);
+	if (IS_ERR(file))
+		return;
+
+	do {
+		ctx.found = 0;
+		ret = vfs_readdir(file, cachefiles_prime_filldir, &ctx);
+	} while (ret >= 0 && ctx.found && !kthread_should_stop());
+	fput(file);
+
+	list_for_each_entry_safe(pn, tmp, &ctx.names, link) {
+		list_del(&pn->link);
+
+		if (!kthread_should_stop()) {
+			mutex_lock(&dir->d_inode->i_mutex);
+			next = lookup_one_len(pn->name, dir, pn->len);
+			mutex_unlock(&dir->d_inode->i_mutex);
+
+			if (!IS_ERR(next)) {
+				pd = NULL;
+				if (next->d_inode &&
+				    S_ISDIR(next->d_inode->i_mode))
+					pd = kmalloc(sizeof(*pd), GFP_KERNEL);
+				if (pd) {
+					/* depth first to keep the queue short */
+					pd->dentry = next;
+					list_add(&pd->link, queue);
+				} else {
+					dput(next);
+				}
+			}
+			cond_resched();
+		}
+
+		kfree(pn);
+	}
+}
+
+/*
+ * walk the index directories of a newly bound cache in the background, so
+ * that the dentries, inodes and directory blocks are already in memory when
+ * the netfs first looks up its objects, rather than costing a few seeks per
+ * level at that point
+ * - only directories are descended into; data files are left alone
+ */
+int cachefiles_prime_index(void *_cache)
+{
+	struct cachefiles_cache *cache = _cache;
+	struct cachefiles_object *fsdef;
+	struct cachefiles_prime_dir *pd;
+	const struct cred *saved_cred;
+	LIST_HEAD(queue);
+
+	fsdef = container_of(cache->cache.fsdef, struct cachefiles_object,
+			     fscache);
+
+	cachefiles_begin_secure(cache, &saved_cred);
+
+	pd = kmalloc(sizeof(*pd), GFP_KERNEL);
+	if (pd) {
+		pd->dentry = dget(fsdef->dentry);
+		list_add(&pd->link, &queue);
+	}
+
+	while (!list_empty(&queue)) {
+		pd = list_entry(queue.next, struct cachefiles_prime_dir, link);
+		list_del(&pd->link);
+
+		if (!kthread_should_stop())
+			cachefiles_prime_one(cache, pd->dentry, &queue);
+
+		dput(pd->dentry);
+		kfree(pd);
+	}
+
+	cachefiles_end_secure(cache, saved_cred);
+
+	/* wait to be reaped by cachefiles_daemon_unbind() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
@@ -22,6 +22,7 @@
  *      .../mdsmap      - current mdsmap
  *      .../monmap      - current monmap
  *      .../osdc        - active osd requests
+ *      .../osd_latency - per-osd reply latency histograms
  *      .../mdsc        - active mds requests
  *      .../monc        - mon client state
  *      .../dentry_lru  - dump contents of dentry lru
@@ -259,6 +260,32 @@ static int osdc_show(struct seq_file *s, void *pp)
 	return 0;
 }
 
+static int osd_latency_show(struct seq_file *s, void *pp)
+{
+	struct ceph_client *client = s->private;
+	struct ceph_osd_client *osdc = &client->osdc;
+	struct rb_node *p;
+	int i;
+
+	mutex_lock(&osdc->request_mutex);
+	for (p = rb_first(&osdc->osds); p; p = rb_next(p)) {
+		struct ceph_osd *osd = rb_entry(p, struct ceph_osd, o_node);
+		u64 avg = 0;
+
+		if (osd->o_num_replies)
+			avg = div64_u64(osd->o_lat_total_us,
+					osd->o_num_replies);
+
+		seq_printf(s, "osd%d	%llu replies	%llu us avg	",
+			   osd->o_osd, osd->o_num_replies, avg);
+		for (i = 0; i < CEPH_OSD_LAT_BUCKETS; i++)
+			seq_printf(s, " %llu", osd->o_lat_hist[i]);
+		seq_printf(s, "\n");
+	}
+	mutex_unlock(&osdc->request_mutex);
+	return 0;
+}
+
 static int caps_show(struct seq_file *s, void *p)
 {
 	struct ceph_client *client = s->private;
@@ -316,6 +343,7 @@ DEFINE_SHOW_FUNC(osdmap_show)
 DEFINE_SHOW_FUNC(monc_show)
 DEFINE_SHOW_FUNC(mdsc_show)
 DEFINE_SHOW_FUNC(osdc_show)
+DEFINE_SHOW_FUNC(osd_latency_show)
 DEFINE_SHOW_FUNC(dentry_lru_show)
 DEFINE_SHOW_FUNC(caps_show)
 
@@ -392,6 +420,14 @@ int ceph_debugfs_client_init(struct ceph_client *client)
 	if (!client->osdc.debugfs_file)
 		goto out;
 
+	client->osdc.debugfs_latency = debugfs_create_file("osd_latency",
+						      0600,
+						      client->debugfs_dir,
+						      client,
+						      &osd_latency_show_fops);
+	if (!client->osdc.debugfs_latency)
+		goto out;
+
 	client->debugfs_monmap = debugfs_create_file("monmap",
 					0600,
 					client->debugfs_dir,
@@ -460,6 +496,7 @@ void ceph_debugfs_client_cleanup(struct ceph_client *client)
 	debugfs_remove(client->debugfs_osdmap);
 	debugfs_remove(client->debugfs_mdsmap);
 	debugfs_remove(client->debugfs_monmap);
+	debugfs_remove(client->osdc.debugfs_latency);
 	debugfs_remove(client->osdc.debugfs_file);
 	debugfs_remove(client->mdsc.debugfs_file);
 	debugfs_remove(client->monc.debugfs_file);
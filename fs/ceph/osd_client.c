@@ -661,6 +661,7 @@ static int __send_request(struct ceph_osd_client *osdc,
 	reqhead->reassert_version = req->r_reassert_version;
 
 	req->r_stamp = jiffies;
+	req->r_sent_stamp = ktime_get();
 	list_move_tail(&osdc->req_lru, &req->r_req_lru_item);
 
 	ceph_msg_get(req->r_request); /* send consumes a ref */
@@ -784,6 +785,30 @@ static void handle_osds_timeout(struct work_struct *work)
 			      round_jiffies_relative(delay));
 }
 
+/*
+ * account the time from (re)sending the request to its first reply
+ * against the osd it was sent to.  caller holds request_mutex.
+ */
+static void __record_latency(struct ceph_osd_request *req)
+{
+	struct ceph_osd *osd = req->r_osd;
+	s64 us;
+	int bucket = 0;
+
+	if (!osd)
+		return;
+
+	us = ktime_us_delta(ktime_get(), req->r_sent_stamp);
+	if (us < 0)
+		us = 0;
+	if (us > 1)
+		bucket = min_t(int, ilog2(us), CEPH_OSD_LAT_BUCKETS - 1);
+
+	osd->o_num_replies++;
+	osd->o_lat_total_us += us;
+	osd->o_lat_hist[bucket]++;
+}
+
 /*
  * handle osd op reply.  either call the callback if it is specified,
  * or do the completion to wake up the waiting thread.
@@ -842,6 +867,7 @@ static void handle_reply(struct ceph_osd_client *osdc, struct ceph_msg *msg,
 		/* in case this is a write and we need to replay, */
 		req->r_reassert_version = rhead->reassert_version;
 
+		__record_latency(req);
 		req->r_got_reply = 1;
 	} else if ((flags & CEPH_OSD_FLAG_ONDISK) == 0) {
 		dout("handle_reply tid %llu dup ack\n", tid);
@@ -3,6 +3,7 @@
 
 #include <linux/completion.h>
 #include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/mempool.h>
 #include <linux/rbtree.h>
 
@@ -22,6 +23,12 @@ struct ceph_authorizer;
 typedef void (*ceph_osdc_callback_t)(struct ceph_osd_request *,
 				     struct ceph_msg *);
 
+/*
+ * reply latency histogram buckets: bucket i counts replies that took
+ * [2^i, 2^(i+1)) microseconds, the last one everything slower
+ */
+#define CEPH_OSD_LAT_BUCKETS 24
+
 /* a given osd we're communicating with */
 struct ceph_osd {
 	atomic_t o_ref;
@@ -38,6 +45,11 @@ struct ceph_osd {
 	unsigned long lru_ttl;
 	int o_marked_for_keepalive;
 	struct list_head o_keepalive_item;
+
+	/* reply latency stats, protected by osdc->request_mutex */
+	u64 o_num_replies;
+	u64 o_lat_total_us;
+	u64 o_lat_hist[CEPH_OSD_LAT_BUCKETS];
 };
 
 /* an in-flight request */
@@ -72,6 +84,7 @@ struct ceph_osd_request {
 	char              r_oid[40];          /* object name */
 	int               r_oid_len;
 	unsigned long     r_stamp;            /* send OR check time */
+	ktime_t           r_sent_stamp;       /* last send, for latency */
 	bool              r_resend;           /* msg send failed, needs retry */
 
 	struct ceph_file_layout r_file_layout;
@@ -102,6 +115,7 @@ struct ceph_osd_client {
 	struct delayed_work    osds_timeout_work;
 #ifdef CONFIG_DEBUG_FS
 	struct dentry 	       *debugfs_file;
+	struct dentry 	       *debugfs_latency;
 #endif
 
 	mempool_t              *req_mempool;
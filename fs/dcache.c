@@ -33,16 +33,31 @@
 #include <linux/bootmem.h>
 #include <linux/fs_struct.h>
 #include <linux/hardirq.h>
+#include <linux/rculist_bl.h>
 #include "internal.h"
 
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
+/*
+ * Maximum number of unused negative dentries kept on each superblock's
+ * LRU. Zero means no limit.
+ */
+int sysctl_negative_dentry_limit __read_mostly;
+
  __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lock);
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(dcache_lock);
 
+/*
+ * Hash chain membership (d_hash and DCACHE_UNHASHED) is protected by the
+ * bit lock in the low bit of each dentry_hashtable bucket (or of
+ * sb->s_anon for disconnected roots), nested inside dentry->d_lock.
+ * Adding and removing a dentry from its chain therefore no longer needs
+ * dcache_lock; the lockless __d_lookup() walk relies on RCU as before.
+ */
+
 static struct kmem_cache *dentry_cache __read_mostly;
 
 #define DNAME_INLINE_LEN (sizeof(struct dentry)-offsetof(struct dentry,d_iname))
@@ -60,13 +75,46 @@ static struct kmem_cache *dentry_cache __read_mostly;
 
 static unsigned int d_hash_mask __read_mostly;
 static unsigned int d_hash_shift __read_mostly;
-static struct hlist_head *dentry_hashtable __read_mostly;
+static struct hlist_bl_head *dentry_hashtable __read_mostly;
 
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+/*
+ * Number of __d_lookup() calls that could not be satisfied by the
+ * lockless hash walk and fell back to taking d_lock on the candidates.
+ */
+static DEFINE_PER_CPU(unsigned long, nr_lookup_fallback);
+
+unsigned long sysctl_nr_lookup_fallback;
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+static unsigned long get_nr_lookup_fallback(void)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(nr_lookup_fallback, cpu);
+	return sum;
+}
+
+int proc_nr_lookup_fallback(ctl_table *table, int write,
+			    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	sysctl_nr_lookup_fallback = get_nr_lookup_fallback();
+	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
+}
+#else
+int proc_nr_lookup_fallback(ctl_table *table, int write,
+			    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	return -ENOSYS;
+}
+#endif
+
 static void __d_free(struct dentry *dentry)
 {
 	WARN_ON(!list_empty(&dentry->d_alias));
@@ -90,12 +138,30 @@ static void d_free(struct dentry *dentry)
 	if (dentry->d_op && dentry->d_op->d_release)
 		dentry->d_op->d_release(dentry);
 	/* if dentry was never inserted into hash, immediate free is OK */
-	if (hlist_unhashed(&dentry->d_hash))
+	if (hlist_bl_unhashed(&dentry->d_hash))
 		__d_free(dentry);
 	else
 		call_rcu(&dentry->d_u.d_rcu, d_callback);
 }
 
+/*
+ * Negative dentries on the LRU are counted separately so that they can be
+ * capped per superblock. A dentry that gains or loses its inode while it
+ * is (lazily) still on the LRU must adjust the count, see dentry_iput()
+ * and __d_instantiate().
+ */
+static inline void dentry_lru_neg_inc(struct dentry *dentry)
+{
+	dentry->d_sb->s_nr_dentry_negative++;
+	dentry_stat.nr_negative++;
+}
+
+static inline void dentry_lru_neg_dec(struct dentry *dentry)
+{
+	dentry->d_sb->s_nr_dentry_negative--;
+	dentry_stat.nr_negative--;
+}
+
 /*
  * Release the dentry's inode, using the filesystem
  * d_iput() operation if defined.
@@ -107,6 +173,8 @@ static void dentry_iput(struct dentry * dentry)
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
 		dentry->d_inode = NULL;
+		if (!list_empty(&dentry->d_lru))
+			dentry_lru_neg_inc(dentry);
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
@@ -130,6 +198,8 @@ static void dentry_lru_add(struct dentry *dentry)
 	list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
 	dentry->d_sb->s_nr_dentry_unused++;
 	dentry_stat.nr_unused++;
+	if (!dentry->d_inode)
+		dentry_lru_neg_inc(dentry);
 }
 
 static void dentry_lru_add_tail(struct dentry *dentry)
@@ -137,6 +207,8 @@ static void dentry_lru_add_tail(struct dentry *dentry)
 	list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
 	dentry->d_sb->s_nr_dentry_unused++;
 	dentry_stat.nr_unused++;
+	if (!dentry->d_inode)
+		dentry_lru_neg_inc(dentry);
 }
 
 static void dentry_lru_del(struct dentry *dentry)
@@ -145,6 +217,8 @@ static void dentry_lru_del(struct dentry *dentry)
 		list_del(&dentry->d_lru);
 		dentry->d_sb->s_nr_dentry_unused--;
 		dentry_stat.nr_unused--;
+		if (!dentry->d_inode)
+			dentry_lru_neg_dec(dentry);
 	}
 }
 
@@ -154,9 +228,23 @@ static void dentry_lru_del_init(struct dentry *dentry)
 		list_del_init(&dentry->d_lru);
 		dentry->d_sb->s_nr_dentry_unused--;
 		dentry_stat.nr_unused--;
+		if (!dentry->d_inode)
+			dentry_lru_neg_dec(dentry);
 	}
 }
 
+/*
+ * Should an unused negative dentry be dropped instead of being cached?
+ * Must be called with dcache_lock held.
+ */
+static inline int dentry_negative_over_limit(struct dentry *dentry)
+{
+	int limit = sysctl_negative_dentry_limit;
+
+	return limit && !dentry->d_inode &&
+		dentry->d_sb->s_nr_dentry_negative >= limit;
+}
+
 /**
  * d_kill - kill dentry and return parent
  * @dentry: dentry to kill
@@ -240,6 +328,9 @@ repeat:
 	/* Unreachable? Get rid of it */
  	if (d_unhashed(dentry))
 		goto kill_it;
+	/* Too many cached negatives on this sb? Don't keep another one */
+	if (list_empty(&dentry->d_lru) && dentry_negative_over_limit(dentry))
+		goto unhash_it;
   	if (list_empty(&dentry->d_lru)) {
   		dentry->d_flags |= DCACHE_REFERENCED;
 		dentry_lru_add(dentry);
@@ -482,10 +573,13 @@ restart:
 			/*
 			 * If we are honouring the DCACHE_REFERENCED flag and
 			 * the dentry has this flag set, don't free it. Clear
-			 * the flag and put it back on the LRU.
+			 * the flag and put it back on the LRU. Negative
+			 * dentries get no second chance: they are cheap to
+			 * recreate and are reclaimed before positive ones.
 			 */
 			if ((flags & DCACHE_REFERENCED)
-				&& (dentry->d_flags & DCACHE_REFERENCED)) {
+				&& (dentry->d_flags & DCACHE_REFERENCED)
+				&& dentry->d_inode) {
 				dentry->d_flags &= ~DCACHE_REFERENCED;
 				list_move(&dentry->d_lru, &referenced);
 				spin_unlock(&dentry->d_lock);
@@ -742,8 +836,9 @@ void shrink_dcache_for_umount(struct super_block *sb)
 	atomic_dec(&dentry->d_count);
 	shrink_dcache_for_umount_subtree(dentry);
 
-	while (!hlist_empty(&sb->s_anon)) {
-		dentry = hlist_entry(sb->s_anon.first, struct dentry, d_hash);
+	while (!hlist_bl_empty(&sb->s_anon)) {
+		dentry = hlist_bl_entry(hlist_bl_first(&sb->s_anon),
+					struct dentry, d_hash);
 		shrink_dcache_for_umount_subtree(dentry);
 	}
 }
@@ -950,6 +1045,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
+	seqcount_init(&dentry->d_seq);
 	spin_lock_init(&dentry->d_lock);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
@@ -957,7 +1053,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	dentry->d_op = NULL;
 	dentry->d_fsdata = NULL;
 	dentry->d_mounted = 0;
-	INIT_HLIST_NODE(&dentry->d_hash);
+	INIT_HLIST_BL_NODE(&dentry->d_hash);
 	INIT_LIST_HEAD(&dentry->d_lru);
 	INIT_LIST_HEAD(&dentry->d_subdirs);
 	INIT_LIST_HEAD(&dentry->d_alias);
@@ -993,8 +1089,11 @@ EXPORT_SYMBOL(d_alloc_name);
 /* the caller must hold dcache_lock */
 static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 {
-	if (inode)
+	if (inode) {
 		list_add(&dentry->d_alias, &inode->i_dentry);
+		if (!dentry->d_inode && !list_empty(&dentry->d_lru))
+			dentry_lru_neg_dec(dentry);
+	}
 	dentry->d_inode = inode;
 	fsnotify_d_instantiate(dentry, inode);
 }
@@ -1121,7 +1220,7 @@ struct dentry * d_alloc_root(struct inode * root_inode)
 }
 EXPORT_SYMBOL(d_alloc_root);
 
-static inline struct hlist_head *d_hash(struct dentry *parent,
+static inline struct hlist_bl_head *d_hash(struct dentry *parent,
 					unsigned long hash)
 {
 	hash += ((unsigned long) parent ^ GOLDEN_RATIO_PRIME) / L1_CACHE_BYTES;
@@ -1182,9 +1281,11 @@ struct dentry *d_obtain_alias(struct inode *inode)
 	tmp->d_sb = inode->i_sb;
 	tmp->d_inode = inode;
 	tmp->d_flags |= DCACHE_DISCONNECTED;
-	tmp->d_flags &= ~DCACHE_UNHASHED;
 	list_add(&tmp->d_alias, &inode->i_dentry);
-	hlist_add_head(&tmp->d_hash, &inode->i_sb->s_anon);
+	hlist_bl_lock(&tmp->d_sb->s_anon);
+	tmp->d_flags &= ~DCACHE_UNHASHED;
+	hlist_bl_add_head(&tmp->d_hash, &tmp->d_sb->s_anon);
+	hlist_bl_unlock(&tmp->d_sb->s_anon);
 	spin_unlock(&tmp->d_lock);
 
 	spin_unlock(&dcache_lock);
@@ -1340,7 +1441,9 @@ EXPORT_SYMBOL(d_add_ci);
  *
  * __d_lookup is dcache_lock free. The hash list is protected using RCU.
  * Memory barriers are used while updating and doing lockless traversal. 
- * To avoid races with d_move while rename is happening, d_lock is used.
+ * Races with d_move while rename is happening are detected with the
+ * per-dentry d_seq seqcount; only when that fails, or the parent has its
+ * own ->d_compare(), or the dentry is unused, is d_lock taken instead.
  *
  * Overflows in memcmp(), while d_move, are avoided by keeping the length
  * and name pointer in one structure pointed by d_qstr.
@@ -1372,19 +1475,20 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 }
 EXPORT_SYMBOL(d_lookup);
 
-struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
+static struct dentry *__d_lookup_locked(struct dentry *parent,
+					struct qstr *name)
 {
 	unsigned int len = name->len;
 	unsigned int hash = name->hash;
 	const unsigned char *str = name->name;
-	struct hlist_head *head = d_hash(parent,hash);
+	struct hlist_bl_head *head = d_hash(parent,hash);
 	struct dentry *found = NULL;
-	struct hlist_node *node;
+	struct hlist_bl_node *node;
 	struct dentry *dentry;
 
 	rcu_read_lock();
 	
-	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+	hlist_bl_for_each_entry_rcu(dentry, node, head, d_hash) {
 		struct qstr *qstr;
 
 		if (dentry->d_name.hash != hash)
@@ -1433,6 +1537,94 @@ next:
  	return found;
 }
 
+/*
+ * __d_lookup_rcu - lockless search of the dentry hash chain
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seqp: returns the d_seq value the match was validated against
+ *
+ * Must be called under rcu_read_lock().  No reference is taken on the
+ * returned dentry and no d_lock is acquired: the name and parent are
+ * compared optimistically and validated against the dentry's d_seq
+ * afterwards, so a concurrent d_move() is detected rather than excluded.
+ * Parents with a ->d_compare() method are not handled here because the
+ * filesystem comparison may not cope with a name changing underneath it.
+ */
+static struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+				     unsigned *seqp)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_bl_head *head = d_hash(parent, hash);
+	struct hlist_bl_node *node;
+	struct dentry *dentry;
+
+	hlist_bl_for_each_entry_rcu(dentry, node, head, d_hash) {
+		const unsigned char *tname;
+		unsigned int tlen;
+		unsigned seq;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+seqretry:
+		seq = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		/*
+		 * The name may be switched by d_move() while we look at it;
+		 * snapshot the length and pointer and let the d_seq check
+		 * below throw away whatever we compared against.
+		 */
+		tlen = ACCESS_ONCE(dentry->d_name.len);
+		tname = ACCESS_ONCE(dentry->d_name.name);
+		if (read_seqcount_retry(&dentry->d_seq, seq))
+			goto seqretry;
+		if (tlen != len || memcmp(tname, str, len))
+			continue;
+		if (read_seqcount_retry(&dentry->d_seq, seq))
+			goto seqretry;
+		*seqp = seq;
+		return dentry;
+	}
+	return NULL;
+}
+
+struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
+{
+	struct dentry *dentry;
+	unsigned seq;
+
+	if (unlikely(parent->d_op && parent->d_op->d_compare))
+		goto fallback;
+
+	rcu_read_lock();
+	dentry = __d_lookup_rcu(parent, name, &seq);
+	if (!dentry) {
+		rcu_read_unlock();
+		return NULL;
+	}
+	/*
+	 * A dentry nobody holds may be on its way out through
+	 * prune_one_dentry() or dput(), which only serialize against us
+	 * via d_lock: leave those cold entries to the locked walk.
+	 */
+	if (!atomic_inc_not_zero(&dentry->d_count)) {
+		rcu_read_unlock();
+		goto fallback;
+	}
+	rcu_read_unlock();
+	if (likely(!read_seqcount_retry(&dentry->d_seq, seq) &&
+		   !d_unhashed(dentry)))
+		return dentry;
+	dput(dentry);
+fallback:
+	this_cpu_inc(nr_lookup_fallback);
+	return __d_lookup_locked(parent, name);
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1471,8 +1663,9 @@ out:
  
 int d_validate(struct dentry *dentry, struct dentry *dparent)
 {
-	struct hlist_head *base;
-	struct hlist_node *lhp;
+	struct hlist_bl_head *base;
+	struct hlist_bl_node *lhp;
+	struct dentry *d;
 
 	/* Check whether the ptr might be valid at all.. */
 	if (!kmem_ptr_validate(dentry_cache, dentry))
@@ -1483,16 +1676,16 @@ int d_validate(struct dentry *dentry, struct dentry *dparent)
 
 	spin_lock(&dcache_lock);
 	base = d_hash(dparent, dentry->d_name.hash);
-	hlist_for_each(lhp,base) { 
-		/* hlist_for_each_entry_rcu() not required for d_hash list
-		 * as it is parsed under dcache_lock
-		 */
-		if (dentry == hlist_entry(lhp, struct dentry, d_hash)) {
+	hlist_bl_lock(base);
+	hlist_bl_for_each_entry(d, lhp, base, d_hash) {
+		if (dentry == d) {
+			hlist_bl_unlock(base);
 			__dget_locked(dentry);
 			spin_unlock(&dcache_lock);
 			return 1;
 		}
 	}
+	hlist_bl_unlock(base);
 	spin_unlock(&dcache_lock);
 out:
 	return 0;
@@ -1546,12 +1739,38 @@ void d_delete(struct dentry * dentry)
 }
 EXPORT_SYMBOL(d_delete);
 
-static void __d_rehash(struct dentry * entry, struct hlist_head *list)
+static void __d_rehash(struct dentry * entry, struct hlist_bl_head *b)
+{
+	hlist_bl_lock(b);
+	entry->d_flags &= ~DCACHE_UNHASHED;
+	hlist_bl_add_head_rcu(&entry->d_hash, b);
+	hlist_bl_unlock(b);
+}
+
+/**
+ * __d_drop - unhash a dentry
+ * @dentry: dentry to drop
+ *
+ * Caller must hold dentry->d_lock.  See d_drop() for details.
+ */
+void __d_drop(struct dentry *dentry)
 {
+	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
+		struct hlist_bl_head *b;
 
- 	entry->d_flags &= ~DCACHE_UNHASHED;
- 	hlist_add_head_rcu(&entry->d_hash, list);
+		/* disconnected roots live on the superblock's s_anon list */
+		if (unlikely(IS_ROOT(dentry)))
+			b = &dentry->d_sb->s_anon;
+		else
+			b = d_hash(dentry->d_parent, dentry->d_name.hash);
+
+		hlist_bl_lock(b);
+		dentry->d_flags |= DCACHE_UNHASHED;
+		hlist_bl_del_rcu(&dentry->d_hash);
+		hlist_bl_unlock(b);
+	}
 }
+EXPORT_SYMBOL(__d_drop);
 
 static void _d_rehash(struct dentry * entry)
 {
@@ -1567,11 +1786,9 @@ static void _d_rehash(struct dentry * entry)
  
 void d_rehash(struct dentry * entry)
 {
-	spin_lock(&dcache_lock);
 	spin_lock(&entry->d_lock);
 	_d_rehash(entry);
 	spin_unlock(&entry->d_lock);
-	spin_unlock(&dcache_lock);
 }
 EXPORT_SYMBOL(d_rehash);
 
@@ -1649,8 +1866,6 @@ static void switch_names(struct dentry *dentry, struct dentry *target)
  */
 static void d_move_locked(struct dentry * dentry, struct dentry * target)
 {
-	struct hlist_head *list;
-
 	if (!dentry->d_inode)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
@@ -1666,15 +1881,13 @@ static void d_move_locked(struct dentry * dentry, struct dentry * target)
 		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
 	}
 
-	/* Move the dentry to the target hash queue, if on different bucket */
-	if (d_unhashed(dentry))
-		goto already_unhashed;
-
-	hlist_del_rcu(&dentry->d_hash);
-
-already_unhashed:
-	list = d_hash(target->d_parent, target->d_name.hash);
-	__d_rehash(dentry, list);
+	/*
+	 * Move the dentry to the target hash queue.  The two bucket locks
+	 * are taken one after the other, so a lockless lookup may briefly
+	 * miss the dentry; d_lookup() catches that through rename_lock.
+	 */
+	__d_drop(dentry);
+	__d_rehash(dentry, d_hash(target->d_parent, target->d_name.hash));
 
 	/* Unhash the target: dput() will then get rid of it */
 	__d_drop(target);
@@ -1682,6 +1895,9 @@ already_unhashed:
 	list_del(&dentry->d_u.d_child);
 	list_del(&target->d_u.d_child);
 
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
+
 	/* Switch the names.. */
 	switch_names(dentry, target);
 	swap(dentry->d_name.hash, target->d_name.hash);
@@ -1699,6 +1915,10 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -1793,6 +2013,9 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 {
 	struct dentry *dparent, *aparent;
 
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&anon->d_seq);
+
 	switch_names(dentry, anon);
 	swap(dentry->d_name.hash, anon->d_name.hash);
 
@@ -1813,6 +2036,9 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 	else
 		INIT_LIST_HEAD(&anon->d_u.d_child);
 
+	write_seqcount_end(&anon->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+
 	anon->d_flags &= ~DCACHE_DISCONNECTED;
 }
 
@@ -1849,8 +2075,9 @@ struct dentry *d_materialise_unique(struct dentry *dentry, struct inode *inode)
 			 * into our tree? */
 			if (IS_ROOT(alias)) {
 				spin_lock(&alias->d_lock);
-				__d_materialise_dentry(dentry, alias);
+				/* unhash from s_anon while it is still a root */
 				__d_drop(alias);
+				__d_materialise_dentry(dentry, alias);
 				goto found;
 			}
 			/* Nope, but we must(!) avoid directory aliasing */
@@ -1925,7 +2152,7 @@ static int prepend_path(const struct path *path, struct path *root,
 	bool slash = false;
 	int error = 0;
 
-	spin_lock(&vfsmount_lock);
+	br_read_lock(vfsmount_lock);
 	while (dentry != root->dentry || vfsmnt != root->mnt) {
 		struct dentry * parent;
 
@@ -1954,7 +2181,7 @@ out:
 	if (!error && !slash)
 		error = prepend(buffer, buflen, "/", 1);
 
-	spin_unlock(&vfsmount_lock);
+	br_read_unlock(vfsmount_lock);
 	return error;
 
 global_root:
@@ -2292,11 +2519,11 @@ int path_is_under(struct path *path1, struct path *path2)
 	struct vfsmount *mnt = path1->mnt;
 	struct dentry *dentry = path1->dentry;
 	int res;
-	spin_lock(&vfsmount_lock);
+	br_read_lock(vfsmount_lock);
 	if (mnt != path2->mnt) {
 		for (;;) {
 			if (mnt->mnt_parent == mnt) {
-				spin_unlock(&vfsmount_lock);
+				br_read_unlock(vfsmount_lock);
 				return 0;
 			}
 			if (mnt->mnt_parent == path2->mnt)
@@ -2306,7 +2533,7 @@ int path_is_under(struct path *path1, struct path *path2)
 		dentry = mnt->mnt_mountpoint;
 	}
 	res = is_subdir(dentry, path2->dentry);
-	spin_unlock(&vfsmount_lock);
+	br_read_unlock(vfsmount_lock);
 	return res;
 }
 EXPORT_SYMBOL(path_is_under);
@@ -2392,7 +2619,7 @@ static void __init dcache_init_early(void)
 
 	dentry_hashtable =
 		alloc_large_system_hash("Dentry cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					dhash_entries,
 					13,
 					HASH_EARLY,
@@ -2401,7 +2628,7 @@ static void __init dcache_init_early(void)
 					0);
 
 	for (loop = 0; loop < (1 << d_hash_shift); loop++)
-		INIT_HLIST_HEAD(&dentry_hashtable[loop]);
+		INIT_HLIST_BL_HEAD(&dentry_hashtable[loop]);
 }
 
 static void __init dcache_init(void)
@@ -2414,7 +2641,7 @@ static void __init dcache_init(void)
 	 * of the dcache. 
 	 */
 	dentry_cache = KMEM_CACHE(dentry,
-		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
+		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD|SLAB_ACCOUNT);
 	
 	register_shrinker(&dcache_shrinker);
 
@@ -2424,7 +2651,7 @@ static void __init dcache_init(void)
 
 	dentry_hashtable =
 		alloc_large_system_hash("Dentry cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					dhash_entries,
 					13,
 					0,
@@ -2433,7 +2660,7 @@ static void __init dcache_init(void)
 					0);
 
 	for (loop = 0; loop < (1 << d_hash_shift); loop++)
-		INIT_HLIST_HEAD(&dentry_hashtable[loop]);
+		INIT_HLIST_BL_HEAD(&dentry_hashtable[loop]);
 }
 
 /* SLAB cache for __getname() consumers */
@@ -0,0 +1,332 @@
+/*
+ * fs/exec_prefetch.c
+ *
+ * Prefetch profiles for executables.
+ *
+ * When the last user of an mm goes away, the pages of its executable
+ * that were mapped in it are recorded in a per-file bitmap.  The next
+ * exec of the same file starts asynchronous readahead of those pages,
+ * in as few and as large requests as the bitmap allows, instead of
+ * leaving them to one major fault and one small readahead each.
+ *
+ * Profiles live in memory only, are dropped when the file changes, and
+ * at most EXEC_PREFETCH_MAX_PROFILES of them are kept, least recently
+ * used first out.  /sys/kernel/mm/exec_prefetch/ has the switch and the
+ * statistics.
+ */
+
+#include <linux/binfmts.h>
+#include <linux/bitmap.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/kobject.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
+
+#define EXEC_PREFETCH_MAX_PROFILES	64
+#define EXEC_PREFETCH_MAX_PAGES		(1UL << 16)
+#define EXEC_PREFETCH_HASH_BITS		6
+
+struct exec_prefetch_profile {
+	struct hlist_node hash;
+	struct list_head lru;
+
+	/* the file the profile was recorded for */
+	dev_t dev;
+	unsigned long ino;
+	struct timespec mtime;
+	loff_t size;
+
+	unsigned long nr_pages;
+	unsigned long pages[0];
+};
+
+static DEFINE_MUTEX(exec_prefetch_mutex);
+static struct hlist_head exec_prefetch_hash[1 << EXEC_PREFETCH_HASH_BITS];
+static LIST_HEAD(exec_prefetch_lru);
+static unsigned int exec_prefetch_enabled __read_mostly;
+
+/* statistics, under exec_prefetch_mutex */
+static unsigned long exec_prefetch_nr_profiles;
+static unsigned long exec_prefetch_pages_prefetched;
+static unsigned long exec_prefetch_faults_saved;
+
+static struct hlist_head *profile_bucket(struct inode *inode)
+{
+	return &exec_prefetch_hash[hash_long(inode->i_ino ^ inode->i_sb->s_dev,
+					     EXEC_PREFETCH_HASH_BITS)];
+}
+
+static bool profile_matches(struct exec_prefetch_profile *p,
+			    struct inode *inode)
+{
+	return p->dev == inode->i_sb->s_dev && p->ino == inode->i_ino;
+}
+
+static bool profile_current(struct exec_prefetch_profile *p,
+			    struct inode *inode)
+{
+	return timespec_equal(&p->mtime, &inode->i_mtime) &&
+	       p->size == i_size_read(inode);
+}
+
+static struct exec_prefetch_profile *profile_lookup(struct inode *inode)
+{
+	struct exec_prefetch_profile *p;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(p, node, profile_bucket(inode), hash)
+		if (profile_matches(p, inode))
+			return p;
+	return NULL;
+}
+
+static void profile_free(struct exec_prefetch_profile *p)
+{
+	hlist_del(&p->hash);
+	list_del(&p->lru);
+	exec_prefetch_nr_profiles--;
+	kfree(p);
+}
+
+static void profile_free_all(void)
+{
+	while (!list_empty(&exec_prefetch_lru))
+		profile_free(list_first_entry(&exec_prefetch_lru,
+				struct exec_prefetch_profile, lru));
+}
+
+struct record_walk {
+	struct vm_area_struct *vma;
+	struct exec_prefetch_profile *profile;
+};
+
+static int record_pte(pte_t *pte, unsigned long addr, unsigned long end,
+		      struct mm_walk *walk)
+{
+	struct record_walk *rw = walk->private;
+	unsigned long index;
+
+	if (!pte_present(*pte))
+		return 0;
+
+	index = rw->vma->vm_pgoff + ((addr - rw->vma->vm_start) >> PAGE_SHIFT);
+	if (index < rw->profile->nr_pages)
+		__set_bit(index, rw->profile->pages);
+	return 0;
+}
+
+/*
+ * exec_prefetch_record - record the pages of the executable used by mm
+ *
+ * Called when the last user of mm is gone, before its mappings are torn
+ * down.  Every page of the executable that is mapped somewhere in mm was
+ * faulted in by it, and goes into the profile of the file.
+ */
+void exec_prefetch_record(struct mm_struct *mm)
+{
+	struct exec_prefetch_profile *new, *old;
+	struct record_walk rw;
+	struct mm_walk walk = {
+		.pte_entry	= record_pte,
+		.mm		= mm,
+		.private	= &rw,
+	};
+	struct vm_area_struct *vma;
+	struct inode *inode;
+	unsigned long nr_pages, i, saved;
+
+	if (!exec_prefetch_enabled || !mm->exe_file)
+		return;
+
+	inode = mm->exe_file->f_path.dentry->d_inode;
+	nr_pages = min_t(unsigned long, EXEC_PREFETCH_MAX_PAGES,
+			 DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE));
+	if (!nr_pages)
+		return;
+
+	new = kzalloc(sizeof(*new) + BITS_TO_LONGS(nr_pages) * sizeof(long),
+		      GFP_KERNEL);
+	if (!new)
+		return;
+	new->dev = inode->i_sb->s_dev;
+	new->ino = inode->i_ino;
+	new->mtime = inode->i_mtime;
+	new->size = i_size_read(inode);
+	new->nr_pages = nr_pages;
+
+	rw.profile = new;
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (!vma->vm_file ||
+		    vma->vm_file->f_mapping != mm->exe_file->f_mapping)
+			continue;
+		rw.vma = vma;
+		walk_page_range(vma->vm_start, vma->vm_end, &walk);
+	}
+	up_read(&mm->mmap_sem);
+
+	if (bitmap_empty(new->pages, nr_pages)) {
+		kfree(new);
+		return;
+	}
+
+	mutex_lock(&exec_prefetch_mutex);
+	old = profile_lookup(inode);
+	if (old && !profile_current(old, inode)) {
+		profile_free(old);
+		old = NULL;
+	}
+
+	if (old) {
+		/* pages the prefetch brought in, that were then used */
+		if (test_bit(MMF_EXEC_PREFETCHED, &mm->flags)) {
+			saved = 0;
+			for (i = 0; i < BITS_TO_LONGS(nr_pages); i++)
+				saved += hweight_long(old->pages[i] &
+						      new->pages[i]);
+			exec_prefetch_faults_saved += saved;
+		}
+		bitmap_or(old->pages, old->pages, new->pages, nr_pages);
+		list_move(&old->lru, &exec_prefetch_lru);
+		kfree(new);
+	} else {
+		hlist_add_head(&new->hash, profile_bucket(inode));
+		list_add(&new->lru, &exec_prefetch_lru);
+		if (++exec_prefetch_nr_profiles > EXEC_PREFETCH_MAX_PROFILES)
+			profile_free(list_entry(exec_prefetch_lru.prev,
+					struct exec_prefetch_profile, lru));
+	}
+	mutex_unlock(&exec_prefetch_mutex);
+}
+
+/*
+ * exec_prefetch - start readahead of the recorded pages of file
+ * @file: the executable being loaded
+ * @mm: the new mm it is loaded into
+ *
+ * Only starts the i/o, the pages are picked up by the faults.
+ */
+void exec_prefetch(struct file *file, struct mm_struct *mm)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct exec_prefetch_profile *p;
+	unsigned long *pages;
+	unsigned long nr_pages, start, end, nr = 0;
+
+	if (!exec_prefetch_enabled)
+		return;
+
+	mutex_lock(&exec_prefetch_mutex);
+	p = profile_lookup(inode);
+	if (!p || !profile_current(p, inode)) {
+		mutex_unlock(&exec_prefetch_mutex);
+		return;
+	}
+	list_move(&p->lru, &exec_prefetch_lru);
+	nr_pages = p->nr_pages;
+	pages = kmemdup(p->pages, BITS_TO_LONGS(nr_pages) * sizeof(long),
+			GFP_KERNEL);
+	mutex_unlock(&exec_prefetch_mutex);
+	if (!pages)
+		return;
+
+	/* The readahead can block on the request queue, so not under the mutex */
+	start = find_first_bit(pages, nr_pages);
+	while (start < nr_pages) {
+		end = find_next_zero_bit(pages, nr_pages, start);
+		if (force_page_cache_readahead(file->f_mapping, file, start,
+					       end - start) < 0)
+			break;
+		nr += end - start;
+		start = find_next_bit(pages, nr_pages, end);
+	}
+	kfree(pages);
+
+	set_bit(MMF_EXEC_PREFETCHED, &mm->flags);
+
+	mutex_lock(&exec_prefetch_mutex);
+	exec_prefetch_pages_prefetched += nr;
+	mutex_unlock(&exec_prefetch_mutex);
+}
+
+#define EXEC_PREFETCH_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define EXEC_PREFETCH_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t enabled_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sprintf(buf, "%u\n", exec_prefetch_enabled);
+}
+
+static ssize_t enabled_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long enabled;
+
+	if (strict_strtoul(buf, 10, &enabled) || enabled > 1)
+		return -EINVAL;
+
+	mutex_lock(&exec_prefetch_mutex);
+	exec_prefetch_enabled = enabled;
+	/* switching off drops what was recorded */
+	if (!enabled)
+		profile_free_all();
+	mutex_unlock(&exec_prefetch_mutex);
+
+	return count;
+}
+EXEC_PREFETCH_ATTR(enabled);
+
+static ssize_t profiles_show(struct kobject *kobj, struct kobj_attribute *attr,
+			     char *buf)
+{
+	return sprintf(buf, "%lu\n", exec_prefetch_nr_profiles);
+}
+EXEC_PREFETCH_ATTR_RO(profiles);
+
+static ssize_t pages_prefetched_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", exec_prefetch_pages_prefetched);
+}
+EXEC_PREFETCH_ATTR_RO(pages_prefetched);
+
+static ssize_t faults_saved_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", exec_prefetch_faults_saved);
+}
+EXEC_PREFETCH_ATTR_RO(faults_saved);
+
+static struct attribute *exec_prefetch_attrs[] = {
+	&enabled_attr.attr,
+	&profiles_attr.attr,
+	&pages_prefetched_attr.attr,
+	&faults_saved_attr.attr,
+	NULL,
+};
+
+static struct attribute_group exec_prefetch_attr_group = {
+	.attrs = exec_prefetch_attrs,
+	.name = "exec_prefetch",
+};
+
+static int __init exec_prefetch_init(void)
+{
+	int err;
+
+	err = sysfs_create_group(mm_kobj, &exec_prefetch_attr_group);
+	if (err)
+		printk(KERN_ERR "exec_prefetch: register sysfs failed\n");
+	return err;
+}
+module_init(exec_prefetch_init);
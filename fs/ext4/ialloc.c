@@ -1039,6 +1039,10 @@ got:
 		}
 	}
 
+	if (EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_INLINE_DATA) &&
+	    (S_ISDIR(mode) || S_ISREG(mode)) && ei->i_extra_isize)
+		ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
 	err = ext4_mark_inode_dirty(handle, inode);
 	if (err) {
 		ext4_std_error(sb, err);
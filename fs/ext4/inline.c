@@ -0,0 +1,1047 @@
+/*
+ *  linux/fs/ext4/inline.c
+ *
+ * Inline data: the contents of small files and directories kept in the
+ * inode, so that they need neither a data block nor a read of one.
+ *
+ * The first EXT4_MIN_INLINE_DATA_SIZE bytes are kept in i_block, and
+ * the rest in the value of the "system.data" extended attribute, which
+ * stays in the inode body and exists, empty maybe, for as long as the
+ * inode has the EXT4_INODE_INLINE_DATA flag.  The raw inode is the only
+ * copy of the data: it is read and changed under xattr_sem, journaled
+ * like the rest of the inode, and ext4_do_update_inode() leaves its
+ * i_block alone.  Bytes past i_size are kept zero.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/fiemap.h>
+#include <linux/slab.h>
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "xattr.h"
+
+/* Where readdir puts ".." and the first entry, as in a directory block */
+#define EXT4_INLINE_DOTDOT_OFFSET	EXT4_DIR_REC_LEN(1)
+#define EXT4_INLINE_EXTRA_OFFSET	(EXT4_DIR_REC_LEN(1) + \
+					 EXT4_DIR_REC_LEN(2) - \
+					 EXT4_INLINE_DOTDOT_SIZE)
+
+/*
+ * Look system.data up in the inode body, whose buffer the caller has
+ * put in is->iloc.  It may be missing only if there is no inline data.
+ */
+static int ext4_find_inline_xattr(struct inode *inode,
+				  struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+	};
+	struct ext4_xattr_entry *entry;
+	int error;
+
+	error = ext4_xattr_ibody_find(inode, &i, is);
+	if (error)
+		return error;
+	if (is->s.not_found) {
+		if (!ext4_has_inline_data(inode))
+			return 0;
+		EXT4_ERROR_INODE(inode, "inline data attribute missing");
+		return -EIO;
+	}
+	entry = is->s.here;
+	if (entry->e_value_block ||
+	    le16_to_cpu(entry->e_value_offs) +
+	    le32_to_cpu(entry->e_value_size) > is->s.end - is->s.base) {
+		EXT4_ERROR_INODE(inode, "bad inline data attribute");
+		return -EIO;
+	}
+	return 0;
+}
+
+static unsigned int ext4_inline_xattr_size(struct ext4_xattr_ibody_find *is)
+{
+	if (is->s.not_found)
+		return 0;
+	return le32_to_cpu(is->s.here->e_value_size);
+}
+
+static void *ext4_inline_xattr_value(struct ext4_xattr_ibody_find *is)
+{
+	return is->s.base + le16_to_cpu(is->s.here->e_value_offs);
+}
+
+/*
+ * The most inline data the inode can hold: i_block, and what the other
+ * attributes leave of the inode body for the value of system.data.
+ */
+static unsigned int ext4_get_max_inline_size(struct inode *inode,
+					     struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_xattr_entry *entry;
+	size_t min_offs, free;
+	size_t name_len = EXT4_XATTR_LEN(strlen(EXT4_XATTR_SYSTEM_DATA));
+
+	if (!EXT4_I(inode)->i_extra_isize)
+		return 0;
+
+	min_offs = is->s.end - is->s.base;
+	entry = is->s.first;
+	if (ext4_test_inode_state(inode, EXT4_STATE_XATTR)) {
+		for (; !IS_LAST_ENTRY(entry); entry = EXT4_XATTR_NEXT(entry)) {
+			if (!entry->e_value_block && entry->e_value_size) {
+				size_t offs = le16_to_cpu(entry->e_value_offs);
+				if (offs < min_offs)
+					min_offs = offs;
+			}
+		}
+	}
+	free = min_offs - ((void *)entry - is->s.base) - sizeof(__u32);
+
+	if (!is->s.not_found) {
+		size_t size = le32_to_cpu(is->s.here->e_value_size);
+
+		free += EXT4_XATTR_SIZE(size) + name_len;
+	}
+	if (free < name_len)
+		return 0;
+	return EXT4_MIN_INLINE_DATA_SIZE +
+		((free - name_len) & ~EXT4_XATTR_ROUND);
+}
+
+static int ext4_set_inline_xattr(handle_t *handle, struct inode *inode,
+				 struct ext4_xattr_ibody_find *is,
+				 const void *value, size_t len)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = value,
+		.value_len = len,
+	};
+
+	return ext4_xattr_ibody_set(handle, inode, &i, is);
+}
+
+/*
+ * Resize system.data for len bytes of inline data, keeping what fits
+ * of the old value and zeroing the rest.
+ */
+static int ext4_update_inline_xattr(handle_t *handle, struct inode *inode,
+				    struct ext4_xattr_ibody_find *is,
+				    unsigned int len)
+{
+	unsigned int old_size = ext4_inline_xattr_size(is);
+	unsigned int size = 0;
+	void *value;
+	int error;
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE)
+		size = len - EXT4_MIN_INLINE_DATA_SIZE;
+	if (size == old_size)
+		return 0;
+
+	/* kzalloc(0) is not NULL, which sets an empty value */
+	value = kzalloc(size, GFP_NOFS);
+	if (!value)
+		return -ENOMEM;
+	memcpy(value, ext4_inline_xattr_value(is), min(size, old_size));
+	error = ext4_set_inline_xattr(handle, inode, is, value, size);
+	kfree(value);
+	return error;
+}
+
+/*
+ * Copy up to len bytes of inline data to buffer, returning how many.
+ * The caller holds xattr_sem.
+ */
+static int ext4_read_inline_data_nolock(struct inode *inode,
+					struct ext4_xattr_ibody_find *is,
+					void *buffer, unsigned int len)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(&is->iloc);
+	unsigned int cp_len;
+
+	cp_len = min_t(unsigned int, len, EXT4_MIN_INLINE_DATA_SIZE);
+	memcpy(buffer, (void *)raw_inode->i_block, cp_len);
+	if (len <= EXT4_MIN_INLINE_DATA_SIZE)
+		return cp_len;
+
+	len = min_t(unsigned int, len - EXT4_MIN_INLINE_DATA_SIZE,
+		  ext4_inline_xattr_size(is));
+	memcpy(buffer + cp_len, ext4_inline_xattr_value(is), len);
+	return cp_len + len;
+}
+
+/*
+ * Copy len bytes at pos into the inline data, which has room for them.
+ * The caller holds xattr_sem and write access to the inode buffer.
+ */
+static void ext4_write_inline_data(struct inode *inode,
+				   struct ext4_xattr_ibody_find *is,
+				   void *buffer, loff_t pos, unsigned int len)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(&is->iloc);
+	unsigned int cp_len;
+
+	BUG_ON(pos + len > EXT4_MIN_INLINE_DATA_SIZE +
+	       ext4_inline_xattr_size(is));
+
+	if (pos < EXT4_MIN_INLINE_DATA_SIZE) {
+		cp_len = min_t(unsigned int, len,
+			       EXT4_MIN_INLINE_DATA_SIZE - pos);
+		memcpy((void *)raw_inode->i_block + pos, buffer, cp_len);
+		buffer += cp_len;
+		pos += cp_len;
+		len -= cp_len;
+	}
+	if (len)
+		memcpy(ext4_inline_xattr_value(is) +
+		       pos - EXT4_MIN_INLINE_DATA_SIZE, buffer, len);
+}
+
+/*
+ * Give an empty inode room for len bytes of inline data.  It has no
+ * blocks, so all there is to drop of its block map is an empty extent
+ * header.  The caller holds xattr_sem and write access to the inode
+ * buffer.
+ */
+static int ext4_create_inline_data(handle_t *handle, struct inode *inode,
+				   struct ext4_xattr_ibody_find *is,
+				   unsigned int len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	unsigned int size = 0;
+	void *value;
+	int error;
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE)
+		size = len - EXT4_MIN_INLINE_DATA_SIZE;
+	value = kzalloc(size, GFP_NOFS);
+	if (!value)
+		return -ENOMEM;
+	error = ext4_set_inline_xattr(handle, inode, is, value, size);
+	kfree(value);
+	if (error)
+		return error;
+
+	/* ext4_do_update_inode() may copy i_data until the flag is set */
+	memset(ei->i_data, 0, sizeof(ei->i_data));
+	ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+	memset(ext4_raw_inode(&is->iloc)->i_block, 0,
+	       EXT4_MIN_INLINE_DATA_SIZE);
+	return 0;
+}
+
+/*
+ * Read the inline data into a page cache page, zeroing the rest of it.
+ * The caller holds xattr_sem.
+ */
+static void ext4_read_inline_page(struct inode *inode,
+				  struct ext4_xattr_ibody_find *is,
+				  struct page *page)
+{
+	unsigned int len;
+	void *kaddr;
+
+	BUG_ON(page->index);
+	len = min_t(loff_t, i_size_read(inode), PAGE_CACHE_SIZE);
+	kaddr = kmap_atomic(page, KM_USER0);
+	len = ext4_read_inline_data_nolock(inode, is, kaddr, len);
+	memset(kaddr + len, 0, PAGE_CACHE_SIZE - len);
+	flush_dcache_page(page);
+	kunmap_atomic(kaddr, KM_USER0);
+	SetPageUptodate(page);
+}
+
+int ext4_read_inline_data(struct inode *inode, void *buffer, unsigned int len)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int ret;
+
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		return ret;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (ext4_has_inline_data(inode)) {
+		ret = ext4_find_inline_xattr(inode, &is);
+		if (!ret)
+			ret = ext4_read_inline_data_nolock(inode, &is,
+							   buffer, len);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(is.iloc.bh);
+	return ret;
+}
+
+/*
+ * Drop the inline data of an inode, which goes back to an empty block
+ * map: the caller has a copy of the data if it wants one.
+ */
+int ext4_destroy_inline_data(handle_t *handle, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int error;
+
+	error = ext4_get_inode_loc(inode, &is.iloc);
+	if (error)
+		return error;
+	error = ext4_journal_get_write_access(handle, is.iloc.bh);
+	if (error)
+		goto out;
+
+	/*
+	 * ext4_map_blocks() callers must not see the block map until it
+	 * is one, and i_data_sem comes before xattr_sem.
+	 */
+	down_write(&ei->i_data_sem);
+	down_write(&ei->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_write(&ei->xattr_sem);
+		up_write(&ei->i_data_sem);
+		goto out;
+	}
+	error = ext4_find_inline_xattr(inode, &is);
+	if (!error)
+		error = ext4_set_inline_xattr(handle, inode, &is, NULL, 0);
+	if (error) {
+		up_write(&ei->xattr_sem);
+		up_write(&ei->i_data_sem);
+		goto out;
+	}
+	memset(ei->i_data, 0, sizeof(ei->i_data));
+	ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	up_write(&ei->xattr_sem);
+
+	/* Marking the inode dirty may need xattr_sem, to expand it */
+	if (EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+				      EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+		ext4_ext_tree_init(handle, inode);
+	}
+	up_write(&ei->i_data_sem);
+
+	return ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+out:
+	brelse(is.iloc.bh);
+	return error;
+}
+
+/*
+ * Returns -EAGAIN, without unlocking the page, if the inode has no
+ * inline data (anymore).
+ */
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int ret = 0;
+
+	if (!page->index) {
+		ret = ext4_get_inode_loc(inode, &is.iloc);
+		if (ret) {
+			unlock_page(page);
+			return ret;
+		}
+	}
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		brelse(is.iloc.bh);
+		return -EAGAIN;
+	}
+	if (!page->index) {
+		ret = ext4_find_inline_xattr(inode, &is);
+		if (!ret)
+			ext4_read_inline_page(inode, &is, page);
+	} else if (!PageUptodate(page)) {
+		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		SetPageUptodate(page);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(is.iloc.bh);
+
+	if (ret)
+		SetPageError(page);
+	unlock_page(page);
+	return ret;
+}
+
+/*
+ * Move the inline data of a file to a block, written through page 0,
+ * when the file outgrows the inode or is about to be mapped writable.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	unsigned int len = 0;
+	handle_t *handle;
+	struct page *page;
+	int ret, ret2;
+
+	handle = ext4_journal_start(inode, ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = grab_cache_page_write_begin(inode->i_mapping, 0,
+					   AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		goto out_page;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (ext4_has_inline_data(inode)) {
+		ret = ext4_find_inline_xattr(inode, &is);
+		if (!ret && !PageUptodate(page))
+			ext4_read_inline_page(inode, &is, page);
+		len = i_size_read(inode);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(is.iloc.bh);
+	if (ret || !ext4_has_inline_data(inode))
+		goto out_page;
+
+	/* Nobody changes the inline data without the page lock */
+	ret = ext4_destroy_inline_data(handle, inode);
+	if (!ret && len)
+		ret = ext4_write_converted_page(handle, inode, page, len);
+	if (!ret)
+		ret = ext4_mark_inode_dirty(handle, inode);
+out_page:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ret2 = ext4_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+	return ret;
+}
+
+/*
+ * Set up a write that ends within what the inode can hold to go to the
+ * inline data.  Returns 1 with page 0 locked and uptodate in *pagep and
+ * a handle running for ext4_write_inline_data_end(), or 0 when the write
+ * is for blocks, any inline data having been moved to one first.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode, loff_t pos,
+				  unsigned len, unsigned flags,
+				  struct page **pagep)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	handle_t *handle;
+	struct page *page;
+	int ret, fits = 0;
+
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		return ret;
+	down_read(&ei->xattr_sem);
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (!ret)
+		fits = pos + len <= ext4_get_max_inline_size(inode, &is) &&
+			(ext4_has_inline_data(inode) || !inode->i_size);
+	up_read(&ei->xattr_sem);
+	brelse(is.iloc.bh);
+	if (ret)
+		return ret;
+
+	if (!fits) {
+		if (ext4_has_inline_data(inode))
+			return ext4_convert_inline_data(inode);
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		return 0;
+	}
+
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = grab_cache_page_write_begin(mapping, 0, flags | AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	is.s.not_found = -ENODATA;
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		goto out_page;
+	ret = ext4_journal_get_write_access(handle, is.iloc.bh);
+	if (ret)
+		goto out_brelse;
+
+	down_write(&ei->xattr_sem);
+	/* A page fault may have moved the data to a block meanwhile */
+	if (!ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA))
+		goto out_up;
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret)
+		goto out_up;
+	if (pos + len > ext4_get_max_inline_size(inode, &is))
+		goto out_up;
+	if (!ext4_has_inline_data(inode)) {
+		if (inode->i_size)
+			goto out_up;
+		ret = ext4_create_inline_data(handle, inode, &is, pos + len);
+	} else if (pos + len > EXT4_MIN_INLINE_DATA_SIZE +
+		   ext4_inline_xattr_size(&is))
+		ret = ext4_update_inline_xattr(handle, inode, &is, pos + len);
+	if (ret)
+		goto out_up;
+	if (!PageUptodate(page))
+		ext4_read_inline_page(inode, &is, page);
+	up_write(&ei->xattr_sem);
+
+	ret = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	if (ret)
+		goto out_page;
+	*pagep = page;
+	return 1;
+
+out_up:
+	up_write(&ei->xattr_sem);
+out_brelse:
+	brelse(is.iloc.bh);
+out_page:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ext4_journal_stop(handle);
+	return ret;
+}
+
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *kaddr;
+	int ret, ret2;
+
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		goto out;
+	ret = ext4_journal_get_write_access(handle, is.iloc.bh);
+	if (ret) {
+		brelse(is.iloc.bh);
+		goto out;
+	}
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (!ret && copied) {
+		kaddr = kmap_atomic(page, KM_USER0);
+		ext4_write_inline_data(inode, &is, kaddr + pos, pos, copied);
+		kunmap_atomic(kaddr, KM_USER0);
+	}
+	up_write(&EXT4_I(inode)->xattr_sem);
+
+	if (!ret && pos + copied > inode->i_size) {
+		i_size_write(inode, pos + copied);
+		ext4_update_i_disksize(inode, pos + copied);
+	}
+	if (!ret)
+		ret = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	else
+		brelse(is.iloc.bh);
+out:
+	unlock_page(page);
+	page_cache_release(page);
+	ret2 = ext4_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+	return ret ? ret : copied;
+}
+
+/*
+ * Cut the inline data down to i_size.  Sizes beyond what the inode
+ * holds have been converted to blocks by ext4_setattr() already.
+ */
+void ext4_inline_data_truncate(struct inode *inode, int *has_inline_data)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_inode *raw_inode;
+	handle_t *handle;
+	loff_t size;
+	int err;
+
+	/* The inode buffer, and the orphan list */
+	handle = ext4_journal_start(inode, 3);
+	if (IS_ERR(handle))
+		return;
+
+	err = ext4_get_inode_loc(inode, &is.iloc);
+	if (err)
+		goto out_stop;
+	err = ext4_journal_get_write_access(handle, is.iloc.bh);
+	if (err)
+		goto out_brelse;
+
+	down_write(&ei->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline_data = 0;
+		up_write(&ei->xattr_sem);
+		goto out_brelse;
+	}
+	err = ext4_find_inline_xattr(inode, &is);
+	size = inode->i_size;
+	if (!err && size < EXT4_MIN_INLINE_DATA_SIZE +
+	    ext4_inline_xattr_size(&is)) {
+		raw_inode = ext4_raw_inode(&is.iloc);
+		if (size < EXT4_MIN_INLINE_DATA_SIZE)
+			memset((void *)raw_inode->i_block + size, 0,
+			       EXT4_MIN_INLINE_DATA_SIZE - size);
+		err = ext4_update_inline_xattr(handle, inode, &is, size);
+	}
+	up_write(&ei->xattr_sem);
+	if (err)
+		goto out_brelse;
+
+	ei->i_disksize = inode->i_size;
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	goto out_orphan;
+
+out_brelse:
+	brelse(is.iloc.bh);
+out_orphan:
+	/* As in ext4_truncate(), for ext4_setattr()'s orphan */
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+out_stop:
+	ext4_journal_stop(handle);
+}
+
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo,
+			    int *has_inline_data)
+{
+	__u64 physical, length;
+	__u32 flags = FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED |
+		FIEMAP_EXTENT_LAST;
+	struct ext4_iloc iloc;
+	int error;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += (char *)ext4_raw_inode(&iloc) - iloc.bh->b_data;
+	physical += offsetof(struct ext4_inode, i_block);
+	length = i_size_read(inode);
+	if (length)
+		error = fiemap_fill_next_extent(fieinfo, 0, physical,
+						length, flags);
+out:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+	return error < 0 ? error : 0;
+}
+
+/*
+ * An inline directory has two chains of entries: the first in i_block,
+ * after the inode number of the parent, and the second in system.data.
+ */
+static void *ext4_inline_dir_chain(struct ext4_xattr_ibody_find *is, int i,
+				   int *size)
+{
+	if (!i) {
+		*size = EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE;
+		return (void *)ext4_raw_inode(&is->iloc)->i_block +
+			EXT4_INLINE_DOTDOT_SIZE;
+	}
+	*size = ext4_inline_xattr_size(is);
+	return ext4_inline_xattr_value(is);
+}
+
+/*
+ * Start a new directory inline, with the inode number of its parent for
+ * ".." and one empty entry.  Returns -ENOSPC if the inode has no room.
+ */
+int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			       struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_dir_entry_2 *de;
+	struct ext4_inode *raw_inode;
+	int err;
+
+	err = ext4_get_inode_loc(inode, &is.iloc);
+	if (err)
+		return err;
+	err = ext4_journal_get_write_access(handle, is.iloc.bh);
+	if (err)
+		goto out;
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	err = ext4_find_inline_xattr(inode, &is);
+	if (!err && ext4_get_max_inline_size(inode, &is) <
+	    EXT4_MIN_INLINE_DATA_SIZE)
+		err = -ENOSPC;
+	if (!err)
+		err = ext4_create_inline_data(handle, inode, &is,
+					      EXT4_MIN_INLINE_DATA_SIZE);
+	if (err) {
+		up_write(&EXT4_I(inode)->xattr_sem);
+		goto out;
+	}
+	raw_inode = ext4_raw_inode(&is.iloc);
+	raw_inode->i_block[0] = cpu_to_le32(parent->i_ino);
+	de = (struct ext4_dir_entry_2 *)((void *)raw_inode->i_block +
+					 EXT4_INLINE_DOTDOT_SIZE);
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_MIN_INLINE_DATA_SIZE -
+					   EXT4_INLINE_DOTDOT_SIZE,
+					   inode->i_sb->s_blocksize);
+	inode->i_size = EXT4_MIN_INLINE_DATA_SIZE;
+	EXT4_I(inode)->i_disksize = inode->i_size;
+	up_write(&EXT4_I(inode)->xattr_sem);
+
+	return ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+out:
+	brelse(is.iloc.bh);
+	return err;
+}
+
+/*
+ * Positions are those the entries get in the directory block when it
+ * is converted: "." at 0, ".." after it and then the two chains, so
+ * that a readdir going on across the conversion loses nothing.
+ */
+int ext4_read_inline_dir(struct file *filp, void *dirent, filldir_t filldir,
+			 int *has_inline_data)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	struct ext4_dir_entry_2 *de;
+	unsigned int offset, rlen;
+	int size, chain_start, chain_size;
+	void *dir_buf;
+	int ret = 0;
+
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline_data = 0;
+		return 0;
+	}
+
+	/* filldir() may fault, so it is not called under xattr_sem */
+	dir_buf = kmalloc(inode->i_size, GFP_NOFS);
+	if (!dir_buf)
+		return -ENOMEM;
+	size = ext4_read_inline_data(inode, dir_buf, inode->i_size);
+	if (size < 0) {
+		ret = size;
+		goto out;
+	}
+
+	if (filp->f_pos == 0) {
+		if (filldir(dirent, ".", 1, 0, inode->i_ino, DT_DIR) < 0)
+			goto out;
+		filp->f_pos = EXT4_INLINE_DOTDOT_OFFSET;
+	}
+	if (filp->f_pos <= EXT4_INLINE_DOTDOT_OFFSET) {
+		if (filldir(dirent, "..", 2, EXT4_INLINE_DOTDOT_OFFSET,
+			    le32_to_cpu(*(__le32 *)dir_buf), DT_DIR) < 0)
+			goto out;
+		filp->f_pos = EXT4_INLINE_EXTRA_OFFSET +
+			EXT4_INLINE_DOTDOT_SIZE;
+	}
+	offset = max_t(loff_t, filp->f_pos - EXT4_INLINE_EXTRA_OFFSET,
+		       EXT4_INLINE_DOTDOT_SIZE);
+
+	/* As in ext4_readdir, find the entry we were at */
+	if (filp->f_version != inode->i_version) {
+		unsigned int i = EXT4_INLINE_DOTDOT_SIZE;
+
+		while (i < size && i < offset) {
+			de = (struct ext4_dir_entry_2 *)(dir_buf + i);
+			rlen = ext4_rec_len_from_disk(de->rec_len,
+						      sb->s_blocksize);
+			if (rlen < EXT4_DIR_REC_LEN(1))
+				break;
+			i += rlen;
+		}
+		offset = i;
+		filp->f_version = inode->i_version;
+	}
+
+	while (offset < size) {
+		if (offset < EXT4_MIN_INLINE_DATA_SIZE) {
+			chain_start = EXT4_INLINE_DOTDOT_SIZE;
+			chain_size = EXT4_MIN_INLINE_DATA_SIZE - chain_start;
+		} else {
+			chain_start = EXT4_MIN_INLINE_DATA_SIZE;
+			chain_size = size - chain_start;
+		}
+		de = (struct ext4_dir_entry_2 *)(dir_buf + offset);
+		if (!ext4_check_dir_entry_buf(inode, de, NULL,
+					      dir_buf + chain_start,
+					      chain_size, offset)) {
+			/* Skip what is left of the directory */
+			filp->f_pos = EXT4_INLINE_EXTRA_OFFSET + size;
+			break;
+		}
+		offset += ext4_rec_len_from_disk(de->rec_len,
+						 sb->s_blocksize);
+		if (le32_to_cpu(de->inode)) {
+			if (filldir(dirent, de->name, de->name_len,
+				    filp->f_pos, le32_to_cpu(de->inode),
+				    get_dtype(sb, de->file_type)) < 0)
+				break;
+		}
+		filp->f_pos = EXT4_INLINE_EXTRA_OFFSET + offset;
+	}
+out:
+	kfree(dir_buf);
+	return ret;
+}
+
+struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					   const struct qstr *d_name,
+					   struct ext4_dir_entry_2 **res_dir,
+					   int *has_inline_data)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *chain;
+	int i, size, ret;
+
+	if (ext4_get_inode_loc(dir, &is.iloc))
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+	if (ext4_find_inline_xattr(dir, &is))
+		goto out;
+	for (i = 0; i < 2; i++) {
+		chain = ext4_inline_dir_chain(&is, i, &size);
+		ret = ext4_search_dir(is.iloc.bh, chain, size, dir, d_name,
+				      0, res_dir);
+		if (ret < 0)
+			break;
+		if (ret == 1) {
+			up_read(&EXT4_I(dir)->xattr_sem);
+			return is.iloc.bh;
+		}
+	}
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(is.iloc.bh);
+	return NULL;
+}
+
+/*
+ * Add the entry for dentry to its inline parent directory, making more
+ * room in system.data if need be.  Returns -ENOSPC if the inode has none.
+ */
+int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			      struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_dir_entry_2 *de;
+	int i, size, new_size, err;
+	void *chain;
+
+	err = ext4_get_inode_loc(dir, &is.iloc);
+	if (err)
+		return err;
+	BUFFER_TRACE(is.iloc.bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, is.iloc.bh);
+	if (err)
+		goto out;
+
+	down_write(&EXT4_I(dir)->xattr_sem);
+	err = ext4_find_inline_xattr(dir, &is);
+	for (i = 0; !err && i < 2; i++) {
+		chain = ext4_inline_dir_chain(&is, i, &size);
+		err = ext4_find_dest_de(dir, is.iloc.bh, chain, size,
+					name, namelen, &de);
+		if (err != -ENOSPC)
+			break;
+	}
+	if (err == -ENOSPC) {
+		/* Grow the second chain by an empty entry for the name */
+		new_size = size + EXT4_DIR_REC_LEN(namelen);
+		if (EXT4_MIN_INLINE_DATA_SIZE + new_size >
+		    ext4_get_max_inline_size(dir, &is))
+			goto out_up;
+		err = ext4_update_inline_xattr(handle, dir, &is,
+				EXT4_MIN_INLINE_DATA_SIZE + new_size);
+		if (err)
+			goto out_up;
+		chain = ext4_inline_dir_chain(&is, 1, &size);
+		de = (struct ext4_dir_entry_2 *)(chain + size -
+						 EXT4_DIR_REC_LEN(namelen));
+		de->inode = 0;
+		de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(namelen),
+						   blocksize);
+		dir->i_size = EXT4_MIN_INLINE_DATA_SIZE + size;
+		EXT4_I(dir)->i_disksize = dir->i_size;
+	}
+	if (err)
+		goto out_up;
+
+	ext4_insert_dentry(dir, inode, de, blocksize, name, namelen);
+	up_write(&EXT4_I(dir)->xattr_sem);
+
+	dir->i_mtime = dir->i_ctime = ext4_current_time(dir);
+	dir->i_version++;
+	return ext4_mark_iloc_dirty(handle, dir, &is.iloc);
+
+out_up:
+	up_write(&EXT4_I(dir)->xattr_sem);
+out:
+	brelse(is.iloc.bh);
+	return err;
+}
+
+int ext4_delete_inline_entry(handle_t *handle, struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh, int *has_inline_data)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *chain;
+	int size, err;
+
+	err = ext4_get_inode_loc(dir, &is.iloc);
+	if (err)
+		return err;
+
+	down_write(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+	err = ext4_find_inline_xattr(dir, &is);
+	if (err)
+		goto out;
+	chain = ext4_inline_dir_chain(&is, 0, &size);
+	if ((void *)de_del >= chain + size)
+		chain = ext4_inline_dir_chain(&is, 1, &size);
+	err = ext4_generic_delete_entry(handle, dir, de_del, is.iloc.bh,
+					chain, size);
+out:
+	up_write(&EXT4_I(dir)->xattr_sem);
+	brelse(is.iloc.bh);
+	return err;
+}
+
+/*
+ * Returns 1 if the inline directory has no entries but "." and "..",
+ * and, like empty_dir(), if they are corrupted.
+ */
+int empty_inline_dir(struct inode *dir, int *has_inline_data)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_dir_entry_2 *de;
+	unsigned int offset;
+	int i, size, ret = 1;
+	void *chain;
+
+	if (ext4_get_inode_loc(dir, &is.iloc))
+		return 1;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+	if (ext4_find_inline_xattr(dir, &is))
+		goto out;
+	for (i = 0; ret && i < 2; i++) {
+		chain = ext4_inline_dir_chain(&is, i, &size);
+		for (offset = 0; offset < size; ) {
+			de = (struct ext4_dir_entry_2 *)(chain + offset);
+			if (!ext4_check_dir_entry_buf(dir, de, is.iloc.bh,
+						      chain, size, offset))
+				break;
+			if (le32_to_cpu(de->inode)) {
+				ret = 0;
+				break;
+			}
+			offset += ext4_rec_len_from_disk(de->rec_len,
+							 dir->i_sb->s_blocksize);
+		}
+	}
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(is.iloc.bh);
+	return ret;
+}
+
+/* ".." of an inline directory is the first word of i_block */
+struct buffer_head *ext4_get_inline_dotdot(struct inode *dir,
+					   __le32 **parent, int *retval,
+					   int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+
+	*retval = ext4_get_inode_loc(dir, &iloc);
+	if (*retval)
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		up_read(&EXT4_I(dir)->xattr_sem);
+		brelse(iloc.bh);
+		return NULL;
+	}
+	*parent = &ext4_raw_inode(&iloc)->i_block[0];
+	up_read(&EXT4_I(dir)->xattr_sem);
+	return iloc.bh;
+}
@@ -1290,6 +1290,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	 */
 	map->m_flags &= ~EXT4_MAP_UNWRITTEN;
 
+	/* Once the file has a block, its data stays in blocks */
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
 	/*
 	 * New blocks allocate and/or writing to uninitialized extent
 	 * will possibly result in updating i_data, so we take
@@ -1587,6 +1590,17 @@ static int ext4_write_begin(struct file *file, struct address_space *mapping,
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			goto out;
+		if (ret == 1) {
+			ret = 0;
+			goto out;
+		}
+	}
+
 retry:
 	handle = ext4_journal_start(inode, needed_blocks);
 	if (IS_ERR(handle)) {
@@ -1659,6 +1673,37 @@ static int write_end_fn(handle_t *handle, struct buffer_head *bh)
 	return ext4_handle_dirty_metadata(handle, NULL, bh);
 }
 
+/*
+ * Write the first len bytes of page 0, which holds what was the inline
+ * data of the inode, to a newly allocated block.
+ */
+int ext4_write_converted_page(handle_t *handle, struct inode *inode,
+			      struct page *page, unsigned len)
+{
+	int ret;
+
+	ret = __block_write_begin(page, 0, len, ext4_get_block);
+	if (ret)
+		return ret;
+
+	if (ext4_should_journal_data(inode)) {
+		ret = walk_page_buffers(handle, page_buffers(page), 0, len,
+					NULL, do_journal_get_write_access);
+		if (!ret)
+			ret = walk_page_buffers(handle, page_buffers(page),
+						0, len, NULL, write_end_fn);
+		ext4_set_inode_state(inode, EXT4_STATE_JDATA);
+		return ret;
+	}
+
+	if (ext4_should_order_data(inode)) {
+		ret = ext4_jbd2_file_inode(handle, inode);
+		if (ret)
+			return ret;
+	}
+	return block_commit_write(page, 0, len);
+}
+
 static int ext4_generic_write_end(struct file *file,
 				  struct address_space *mapping,
 				  loff_t pos, unsigned len, unsigned copied,
@@ -1722,6 +1767,10 @@ static int ext4_ordered_write_end(struct file *file,
 	int ret = 0, ret2;
 
 	trace_ext4_ordered_write_end(inode, pos, len, copied);
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	ret = ext4_jbd2_file_inode(handle, inode);
 
 	if (ret == 0) {
@@ -1766,6 +1815,10 @@ static int ext4_writeback_write_end(struct file *file,
 	int ret = 0, ret2;
 
 	trace_ext4_writeback_write_end(inode, pos, len, copied);
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	ret2 = ext4_generic_write_end(file, mapping, pos, len, copied,
 							page, fsdata);
 	copied = ret2;
@@ -1810,6 +1863,10 @@ static int ext4_journalled_write_end(struct file *file,
 	loff_t new_i_size;
 
 	trace_ext4_journalled_write_end(inode, pos, len, copied);
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
@@ -1982,6 +2039,130 @@ static void ext4_da_page_release_reservation(struct page *page,
  * Delayed allocation stuff
  */
 
+/* A bio built by mpage_da_submit_io() out of whole pages */
+struct mpage_da_bio {
+	struct bio *bio;
+	sector_t next_block;		/* disk block following the bio */
+	int write_op;
+};
+
+static void ext4_da_end_bio(struct bio *bio, int err)
+{
+	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
+	struct bio_vec *bvec = bio->bi_io_vec + bio->bi_vcnt - 1;
+
+	do {
+		struct page *page = bvec->bv_page;
+
+		if (--bvec >= bio->bi_io_vec)
+			prefetchw(&bvec->bv_page->flags);
+
+		if (!uptodate) {
+			SetPageError(page);
+			if (page->mapping)
+				set_bit(AS_EIO, &page->mapping->flags);
+		}
+		end_page_writeback(page);
+	} while (bvec >= bio->bi_io_vec);
+	bio_put(bio);
+}
+
+static void ext4_da_submit_bio(struct mpage_da_bio *io)
+{
+	if (io->bio) {
+		submit_bio(io->write_op, io->bio);
+		io->bio = NULL;
+	}
+}
+
+/*
+ * Can the page be written as a whole, without its buffer heads: all
+ * its blocks below @len mapped, uptodate, contiguous on disk, and
+ * needing no conversion at I/O completion?  If so, return its first
+ * block in @pblock.
+ */
+static int ext4_da_page_is_contiguous(struct page *page, unsigned int len,
+				      sector_t *pblock)
+{
+	struct buffer_head *head, *bh;
+	unsigned int off = 0;
+	sector_t next = 0;
+
+	if (!page_has_buffers(page))
+		return 0;
+
+	bh = head = page_buffers(page);
+	do {
+		if (off >= len)
+			break;
+		if (!buffer_mapped(bh) || buffer_delay(bh) ||
+		    buffer_unwritten(bh) || buffer_uninit(bh) ||
+		    !buffer_uptodate(bh))
+			return 0;
+		if (off == 0)
+			*pblock = bh->b_blocknr;
+		else if (bh->b_blocknr != next)
+			return 0;
+		next = bh->b_blocknr + 1;
+		off += bh->b_size;
+	} while ((bh = bh->b_this_page) != head);
+
+	return 1;
+}
+
+/*
+ * Put a page checked by ext4_da_page_is_contiguous() into the bio,
+ * starting a new one if it doesn't follow on disk.  The buffers are
+ * cleaned but not locked: the page lock and writeback bit cover them,
+ * as in mpage_writepage().
+ */
+static void ext4_da_bio_add_page(struct mpage_da_bio *io, struct page *page,
+				 unsigned int len, sector_t pblock)
+{
+	struct inode *inode = page->mapping->host;
+	struct block_device *bdev = inode->i_sb->s_bdev;
+	unsigned int size = ALIGN(len, 1 << inode->i_blkbits);
+	struct buffer_head *head, *bh;
+	unsigned int off = 0;
+
+	/* as block_write_full_page(), don't write what is past i_size */
+	if (len < PAGE_CACHE_SIZE)
+		zero_user_segment(page, len, PAGE_CACHE_SIZE);
+
+	bh = head = page_buffers(page);
+	do {
+		if (off < len && buffer_new(bh)) {
+			clear_buffer_new(bh);
+			unmap_underlying_metadata(bh->b_bdev, bh->b_blocknr);
+		}
+		if (off >= len)
+			set_buffer_uptodate(bh);
+		clear_buffer_dirty(bh);
+		off += bh->b_size;
+	} while ((bh = bh->b_this_page) != head);
+
+	BUG_ON(PageWriteback(page));
+	set_page_writeback(page);
+
+	if (io->bio && pblock != io->next_block)
+		ext4_da_submit_bio(io);
+retry:
+	if (!io->bio) {
+		io->bio = bio_alloc(GFP_NOFS,
+				    min(bio_get_nr_vecs(bdev), BIO_MAX_PAGES));
+		io->bio->bi_sector = pblock << (inode->i_blkbits - 9);
+		io->bio->bi_bdev = bdev;
+		io->bio->bi_end_io = ext4_da_end_bio;
+	}
+	if (bio_add_page(io->bio, page, size, 0) < size) {
+		ext4_da_submit_bio(io);
+		goto retry;
+	}
+	io->next_block = pblock + (size >> inode->i_blkbits);
+
+	unlock_page(page);
+}
+
 /*
  * mpage_da_submit_io - walks through extent of pages and try to write
  * them with writepage() call back
@@ -1993,6 +2174,11 @@ static void ext4_da_page_release_reservation(struct page *page,
  * By the time mpage_da_submit_io() is called we expect all blocks
  * to be allocated. this may be wrong if allocation failed.
  *
+ * Pages whose blocks are all mapped and contiguous, which is the usual
+ * case once an extent has been allocated, are put straight into bios
+ * as large as the device takes.  The others go through writepage() and
+ * their buffer heads.
+ *
  * As pages are already locked by write_cache_pages(), we can't use it
  */
 static int mpage_da_submit_io(struct mpage_da_data *mpd)
@@ -2003,6 +2189,13 @@ static int mpage_da_submit_io(struct mpage_da_data *mpd)
 	int ret = 0, err, nr_pages, i;
 	struct inode *inode = mpd->inode;
 	struct address_space *mapping = inode->i_mapping;
+	loff_t size = i_size_read(inode);
+	struct mpage_da_bio io = {
+		.write_op = mpd->wbc->sync_mode == WB_SYNC_ALL ?
+				WRITE_SYNC_PLUG : WRITE,
+	};
+	unsigned int len;
+	sector_t pblock;
 
 	BUG_ON(mpd->next_page <= mpd->first_page);
 	/*
@@ -2030,6 +2223,19 @@ static int mpage_da_submit_io(struct mpage_da_data *mpd)
 			BUG_ON(!PageLocked(page));
 			BUG_ON(PageWriteback(page));
 
+			if (page->index == size >> PAGE_CACHE_SHIFT)
+				len = size & ~PAGE_CACHE_MASK;
+			else if (page->index < size >> PAGE_CACHE_SHIFT)
+				len = PAGE_CACHE_SIZE;
+			else
+				len = 0;
+			if (len &&
+			    ext4_da_page_is_contiguous(page, len, &pblock)) {
+				ext4_da_bio_add_page(&io, page, len, pblock);
+				mpd->pages_written++;
+				continue;
+			}
+
 			pages_skipped = mpd->wbc->pages_skipped;
 			err = mapping->a_ops->writepage(page, mpd->wbc);
 			if (!err && (pages_skipped == mpd->wbc->pages_skipped))
@@ -2048,6 +2254,7 @@ static int mpage_da_submit_io(struct mpage_da_data *mpd)
 		}
 		pagevec_release(&pvec);
 	}
+	ext4_da_submit_bio(&io);
 	return ret;
 }
 
@@ -2547,6 +2754,7 @@ static int ext4_da_get_block_prep(struct inode *inode, sector_t iblock,
 	if (ret < 0)
 		return ret;
 	if (ret == 0) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
 		if (buffer_delay(bh))
 			return 0; /* Not sure this could or should happen */
 		/*
@@ -2947,6 +3155,7 @@ static int ext4_da_writepages(struct address_space *mapping,
 	long desired_nr_to_write, nr_to_writebump = 0;
 	loff_t range_start = wbc->range_start;
 	struct ext4_sb_info *sbi = EXT4_SB(mapping->host->i_sb);
+	struct blk_plug plug;
 
 	trace_ext4_da_writepages(inode, wbc);
 
@@ -3020,6 +3229,7 @@ static int ext4_da_writepages(struct address_space *mapping,
 
 	pages_skipped = wbc->pages_skipped;
 
+	blk_start_plug(&plug);
 retry:
 	while (!ret && wbc->nr_to_write > 0) {
 
@@ -3039,6 +3249,7 @@ retry:
 			ext4_msg(inode->i_sb, KERN_CRIT, "%s: jbd2_start: "
 			       "%ld pages, ino %lu; err %d", __func__,
 				wbc->nr_to_write, inode->i_ino, ret);
+			blk_finish_plug(&plug);
 			goto out_writepages;
 		}
 
@@ -3108,6 +3319,7 @@ retry:
 		wbc->range_end  = mapping->writeback_index - 1;
 		goto retry;
 	}
+	blk_finish_plug(&plug);
 	if (pages_skipped != wbc->pages_skipped)
 		ext4_msg(inode->i_sb, KERN_CRIT,
 			 "This should not happen leaving %s "
@@ -3184,6 +3396,15 @@ static int ext4_da_write_begin(struct file *file, struct address_space *mapping,
 	}
 	*fsdata = (void *)0;
 	trace_ext4_da_write_begin(inode, pos, len, flags);
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			return ret;
+		if (ret == 1)
+			return 0;
+	}
 retry:
 	/*
 	 * With delayed allocation, we don't log the i_disksize update
@@ -3276,6 +3497,10 @@ static int ext4_da_write_end(struct file *file,
 	}
 
 	trace_ext4_da_write_end(inode, pos, len, copied);
+	if (ext4_has_inline_data(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	start = pos & (PAGE_CACHE_SIZE - 1);
 	end = start + copied - 1;
 
@@ -3402,6 +3627,10 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* Inline data has no block to map */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) &&
 			test_opt(inode->i_sb, DELALLOC)) {
 		/*
@@ -3447,6 +3676,14 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 
 static int ext4_readpage(struct file *file, struct page *page)
 {
+	struct inode *inode = page->mapping->host;
+
+	if (ext4_has_inline_data(inode)) {
+		int ret = ext4_readpage_inline(inode, page);
+
+		if (ret != -EAGAIN)
+			return ret;
+	}
 	return mpage_readpage(page, ext4_get_block);
 }
 
@@ -3454,6 +3691,10 @@ static int
 ext4_readpages(struct file *file, struct address_space *mapping,
 		struct list_head *pages, unsigned nr_pages)
 {
+	/* There is nothing to read ahead of inline data */
+	if (ext4_has_inline_data(mapping->host))
+		return 0;
+
 	return mpage_readpages(mapping, pages, nr_pages, ext4_get_block);
 }
 
@@ -4038,6 +4279,10 @@ static ssize_t ext4_direct_IO(int rw, struct kiocb *iocb,
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
 
+	/* Let the VFS fall back to buffered I/O for inline data */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
 		return ext4_ext_direct_IO(rw, iocb, iov, offset, nr_segs);
 
@@ -4658,6 +4903,14 @@ void ext4_truncate(struct inode *inode)
 	if (inode->i_size == 0 && !test_opt(inode->i_sb, NO_AUTO_DA_ALLOC))
 		ext4_set_inode_state(inode, EXT4_STATE_DA_ALLOC_CLOSE);
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		ext4_inline_data_truncate(inode, &has_inline_data);
+		if (has_inline_data)
+			return;
+	}
+
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		ext4_ext_truncate(inode);
 		return;
@@ -5147,6 +5400,15 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 				 ei->i_file_acl);
 		ret = -EIO;
 		goto bad_inode;
+	} else if (ext4_has_inline_data(inode)) {
+		/* i_block holds data, which ext4_find_inline_xattr() checks */
+		if (!EXT4_HAS_INCOMPAT_FEATURE(sb,
+				EXT4_FEATURE_INCOMPAT_INLINE_DATA)) {
+			EXT4_ERROR_INODE(inode, "inline data without feature");
+			ret = -EIO;
+		} else
+			ext4_set_inode_state(inode,
+					     EXT4_STATE_MAY_INLINE_DATA);
 	} else if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 		    (S_ISLNK(inode->i_mode) &&
@@ -5340,9 +5602,11 @@ static int ext4_do_update_inode(handle_t *handle,
 				cpu_to_le32(new_encode_dev(inode->i_rdev));
 			raw_inode->i_block[2] = 0;
 		}
-	} else
+	} else if (!ext4_has_inline_data(inode)) {
+		/* Inline data is kept in the raw inode only */
 		for (block = 0; block < EXT4_N_BLOCKS; block++)
 			raw_inode->i_block[block] = ei->i_data[block];
+	}
 
 	raw_inode->i_disk_version = cpu_to_le32(inode->i_version);
 	if (ei->i_extra_isize) {
@@ -5499,6 +5763,15 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 		ext4_journal_stop(handle);
 	}
 
+	/* Growing past i_block, inline data goes to a block first */
+	if ((attr->ia_valid & ATTR_SIZE) && ext4_has_inline_data(inode) &&
+	    attr->ia_size > EXT4_MIN_INLINE_DATA_SIZE &&
+	    attr->ia_size > inode->i_size) {
+		error = ext4_convert_inline_data(inode);
+		if (error)
+			goto err_out;
+	}
+
 	if (attr->ia_valid & ATTR_SIZE) {
 		if (!(ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))) {
 			struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
@@ -5832,9 +6105,11 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 
 	might_sleep();
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
+	/* Expanding would move system.data, which entries may point into */
 	if (ext4_handle_valid(handle) &&
 	    EXT4_I(inode)->i_extra_isize < sbi->s_want_extra_isize &&
-	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND)) {
+	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND) &&
+	    !ext4_has_inline_data(inode)) {
 		/*
 		 * We need extra buffer credits since we may write into EA block
 		 * with this same handle. If journal_extend fails, then it will
@@ -6002,6 +6277,13 @@ int ext4_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
 	 * get i_mutex because we are already holding mmap_sem.
 	 */
 	down_read(&inode->i_alloc_sem);
+	/* Pages of inline data cannot be written back as they are */
+	if (ext4_has_inline_data(inode)) {
+		ret = ext4_convert_inline_data(inode);
+		if (ret)
+			goto out_unlock;
+		ret = -EINVAL;
+	}
 	size = i_size_read(inode);
 	if (page->mapping != mapping || size <= page_offset(page)
 	    || !PageUptodate(page)) {
@@ -138,11 +138,16 @@
  * /sys/fs/ext4/<partition>/mb_min_to_scan
  * /sys/fs/ext4/<partition>/mb_max_to_scan
  * /sys/fs/ext4/<partition>/mb_order2_req
+ * /sys/fs/ext4/<partition>/mb_optimize_scan
  *
  * The regular allocator uses buddy scan only if the request len is power of
  * 2 blocks and the order of allocation is >= sbi->s_mb_order2_reqs. The
  * value of s_mb_order2_reqs can be tuned via
- * /sys/fs/ext4/<partition>/mb_order2_req.  If the request len is equal to
+ * /sys/fs/ext4/<partition>/mb_order2_req.  Initialized groups are kept on
+ * lists by the order of their largest free extent, so that such a request
+ * can go straight to a group which has a large enough extent: see
+ * ext4_mb_find_by_order, which mb_optimize_scan turns off.  If the request
+ * len is equal to
  * stripe size (sbi->s_stripe), we try to search for contiguous block in
  * stripe size. This should result in better allocation on RAID setups. If
  * not, we search in the specific group using bitmap for best extents. The
@@ -661,23 +666,41 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the list of that order.  Called with the
+ * group locked.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	int i;
 	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
+	int old = grp->bb_largest_free_order;
+	int new = -1; /* uninit */
 
 	bits = sb->s_blocksize_bits + 1;
 	for (i = bits; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new = i;
 			break;
 		}
 	}
+
+	if (new == old)
+		return;
+
+	if (old >= 0) {
+		write_lock(&sbi->s_mb_order_locks[old]);
+		list_del_init(&grp->bb_order_node);
+		write_unlock(&sbi->s_mb_order_locks[old]);
+	}
+	grp->bb_largest_free_order = new;
+	if (new >= 0) {
+		write_lock(&sbi->s_mb_order_locks[new]);
+		list_add_tail(&grp->bb_order_node,
+			      &sbi->s_mb_order_groups[new]);
+		write_unlock(&sbi->s_mb_order_locks[new]);
+	}
 }
 
 static noinline_for_stack
@@ -1514,10 +1537,12 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	e4b->alloc_semp = NULL;
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_stream_goal *goal;
+
+		goal = per_cpu_ptr(sbi->s_mb_stream_goals, get_cpu());
+		goal->sg_group = ac->ac_f_ex.fe_group;
+		goal->sg_start = ac->ac_f_ex.fe_start;
+		put_cpu();
 	}
 }
 
@@ -1993,6 +2018,103 @@ void ext4_mb_put_buddy_cache_lock(struct super_block *sb,
 
 }
 
+/*
+ * Scan a group which passed ext4_mb_good_group, checking it again once
+ * it is locked.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr,
+			      struct ext4_buddy *e4b)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int err;
+
+	err = ext4_mb_load_buddy(sb, group, e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, cr)) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(e4b);
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, e4b);
+	else
+		ext4_mb_complex_scan_group(ac, e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(e4b);
+
+	return 0;
+}
+
+/*
+ * For a 2^N request, any group on the list of order N or above has a
+ * free extent large enough, so take the first one of those that is not
+ * busy rather than checking all groups from the goal on.  A group is
+ * tried once per order: if we lost it to a racing allocation, or the
+ * lists have nothing yet because the groups were not initialized, the
+ * linear cr 0 scan still follows.
+ */
+static int ext4_mb_find_by_order(struct ext4_allocation_context *ac,
+				 ext4_group_t ngroups, struct ext4_buddy *e4b)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	ext4_group_t group = 0;
+	int order, found, err;
+
+	for (order = ac->ac_2order; order <= sb->s_blocksize_bits + 1;
+	     order++) {
+		found = 0;
+		read_lock(&sbi->s_mb_order_locks[order]);
+		list_for_each_entry(grp, &sbi->s_mb_order_groups[order],
+				    bb_order_node) {
+			/* ext4_mb_good_group would init it, which may sleep */
+			if (grp->bb_group >= ngroups ||
+			    EXT4_MB_GRP_NEED_INIT(grp))
+				continue;
+			if (spin_is_locked(ext4_group_lock_ptr(sb,
+							       grp->bb_group)))
+				continue;
+			if (ext4_mb_good_group(ac, grp->bb_group, 0)) {
+				group = grp->bb_group;
+				found = 1;
+				break;
+			}
+		}
+		read_unlock(&sbi->s_mb_order_locks[order]);
+
+		if (!found)
+			continue;
+
+		err = ext4_mb_scan_group(ac, group, 0, e4b);
+		if (err)
+			return err;
+		if (ac->ac_status != AC_STATUS_CONTINUE) {
+			if (sbi->s_mb_stats)
+				atomic_inc(&sbi->s_bal_order_hits);
+			break;
+		}
+	}
+
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2040,13 +2162,16 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
+	/* if stream allocation is enabled, use the goal of this cpu */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_stream_goal *goal;
+
+		goal = per_cpu_ptr(sbi->s_mb_stream_goals, get_cpu());
+		if (goal->sg_group < ngroups) {
+			ac->ac_g_ex.fe_group = goal->sg_group;
+			ac->ac_g_ex.fe_start = goal->sg_start;
+		}
+		put_cpu();
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2058,6 +2183,15 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (cr == 0 && sbi->s_mb_optimize_scan) {
+			err = ext4_mb_find_by_order(ac, ngroups, &e4b);
+			if (err)
+				goto out;
+			if (ac->ac_status != AC_STATUS_CONTINUE)
+				break;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2072,34 +2206,10 @@ repeat:
 			if (!ext4_mb_good_group(ac, group, cr))
 				continue;
 
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr, &e4b);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2233,6 +2343,62 @@ static const struct file_operations ext4_mb_seq_groups_fops = {
 	.release	= seq_release,
 };
 
+/* The counters are only kept while /sys/fs/ext4/<disk>/mb_stats is set */
+static int ext4_mb_seq_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int i;
+
+	seq_printf(seq, "mballoc: %s\n",
+		   sbi->s_mb_stats ? "enabled" : "disabled");
+	seq_printf(seq, "\treqs: %u\n", atomic_read(&sbi->s_bal_reqs));
+	seq_printf(seq, "\tsuccess: %u\n", atomic_read(&sbi->s_bal_success));
+	seq_printf(seq, "\tblocks: %u\n", atomic_read(&sbi->s_bal_allocated));
+	seq_printf(seq, "\textents_scanned: %u\n",
+		   atomic_read(&sbi->s_bal_ex_scanned));
+	seq_printf(seq, "\tgoal_hits: %u\n", atomic_read(&sbi->s_bal_goals));
+	seq_printf(seq, "\t2^n_hits: %u\n", atomic_read(&sbi->s_bal_2orders));
+	seq_printf(seq, "\torder_list_hits: %u\n",
+		   atomic_read(&sbi->s_bal_order_hits));
+	seq_printf(seq, "\tbreaks: %u\n", atomic_read(&sbi->s_bal_breaks));
+	seq_printf(seq, "\tlost: %u\n", atomic_read(&sbi->s_mb_lost_chunks));
+	seq_printf(seq, "\tbuddies_generated: %lu\n",
+		   sbi->s_mb_buddies_generated);
+	seq_printf(seq, "\tbuddies_time_used: %llu\n",
+		   sbi->s_mb_generation_time);
+	seq_printf(seq, "\tpreallocated: %u\n",
+		   atomic_read(&sbi->s_mb_preallocated));
+	seq_printf(seq, "\tdiscarded: %u\n",
+		   atomic_read(&sbi->s_mb_discarded));
+
+	/* bucket i counts the allocations which scanned [2^(i-1), 2^i) groups */
+	seq_printf(seq, "groups_scanned:\n");
+	seq_printf(seq, "\t0: %u\n",
+		   atomic_read(&sbi->s_bal_groups_scanned[0]));
+	for (i = 1; i < EXT4_MB_SCANNED_BUCKETS - 1; i++)
+		seq_printf(seq, "\t%u-%u: %u\n", 1U << (i - 1),
+			   (1U << i) - 1,
+			   atomic_read(&sbi->s_bal_groups_scanned[i]));
+	seq_printf(seq, "\t%u+: %u\n", 1U << (i - 1),
+		   atomic_read(&sbi->s_bal_groups_scanned[i]));
+
+	return 0;
+}
+
+static int ext4_mb_seq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ext4_mb_seq_stats_show, PDE(inode)->data);
+}
+
+static const struct file_operations ext4_mb_seq_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_mb_seq_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 
 /* Create and initialize ext4_group_info data for the given group. */
 int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
@@ -2296,6 +2462,8 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_order_node);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2453,13 +2621,42 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
 	sbi->s_mb_group_prealloc = MB_DEFAULT_GROUP_PREALLOC;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 
+	i = sb->s_blocksize_bits + 2;
+	sbi->s_mb_order_groups = kmalloc(i * sizeof(struct list_head),
+					 GFP_KERNEL);
+	sbi->s_mb_order_locks = kmalloc(i * sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_stream_goals = alloc_percpu(struct ext4_stream_goal);
 	sbi->s_locality_groups = alloc_percpu(struct ext4_locality_group);
-	if (sbi->s_locality_groups == NULL) {
+	if (sbi->s_mb_order_groups == NULL || sbi->s_mb_order_locks == NULL ||
+	    sbi->s_mb_stream_goals == NULL || sbi->s_locality_groups == NULL) {
+		free_percpu(sbi->s_locality_groups);
+		free_percpu(sbi->s_mb_stream_goals);
+		kfree(sbi->s_mb_order_locks);
+		kfree(sbi->s_mb_order_groups);
 		kfree(sbi->s_mb_offsets);
 		kfree(sbi->s_mb_maxs);
 		return -ENOMEM;
 	}
+	while (i-- > 0) {
+		INIT_LIST_HEAD(&sbi->s_mb_order_groups[i]);
+		rwlock_init(&sbi->s_mb_order_locks[i]);
+	}
+
+	/*
+	 * Until they have allocated something, start the stream
+	 * allocations of each cpu in a different part of the filesystem.
+	 */
+	j = 0;
+	for_each_possible_cpu(i) {
+		struct ext4_stream_goal *goal;
+		goal = per_cpu_ptr(sbi->s_mb_stream_goals, i);
+		goal->sg_group = div_u64((u64)ext4_get_groups_count(sb) * j++,
+					 num_possible_cpus());
+		goal->sg_start = 0;
+	}
+
 	for_each_possible_cpu(i) {
 		struct ext4_locality_group *lg;
 		lg = per_cpu_ptr(sbi->s_locality_groups, i);
@@ -2469,9 +2666,15 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
 				 &ext4_mb_seq_groups_fops, sb);
+		proc_create_data("mb_stats", S_IRUGO, sbi->s_proc,
+				 &ext4_mb_seq_stats_fops, sb);
+	}
+
+	/* without it, discards are issued one at a time */
+	sbi->s_discard_queue = blk_alloc_discard_queue(sb->s_bdev, GFP_KERNEL);
 
 	if (sbi->s_journal)
 		sbi->s_journal->j_commit_callback = release_blocks_on_commit;
@@ -2551,8 +2754,15 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
-	if (sbi->s_proc)
+	free_percpu(sbi->s_mb_stream_goals);
+	kfree(sbi->s_mb_order_locks);
+	kfree(sbi->s_mb_order_groups);
+	if (sbi->s_proc) {
+		remove_proc_entry("mb_stats", sbi->s_proc);
 		remove_proc_entry("mb_groups", sbi->s_proc);
+	}
+	if (sbi->s_discard_queue)
+		blk_free_discard_queue(sbi->s_discard_queue);
 
 	return 0;
 }
@@ -2573,9 +2783,40 @@ static inline void ext4_issue_discard(struct super_block *sb,
 	}
 }
 
+/*
+ * Queue the discard of blocks which stay in use until ext4_flush_discards()
+ */
+static void ext4_queue_discard(struct super_block *sb,
+		ext4_group_t block_group, ext4_grpblk_t block, int count)
+{
+	struct blk_discard_queue *dq = EXT4_SB(sb)->s_discard_queue;
+	int shift = sb->s_blocksize_bits - 9;
+	ext4_fsblk_t discard_block;
+
+	if (!dq) {
+		ext4_issue_discard(sb, block_group, block, count);
+		return;
+	}
+
+	discard_block = block + ext4_group_first_block_no(sb, block_group);
+	trace_ext4_discard_blocks(sb,
+			(unsigned long long) discard_block, count);
+	blk_discard_queue_add(dq, (sector_t)discard_block << shift,
+			      (sector_t)count << shift, GFP_NOFS);
+}
+
+static int ext4_flush_discards(struct super_block *sb)
+{
+	struct blk_discard_queue *dq = EXT4_SB(sb)->s_discard_queue;
+
+	return dq ? blk_discard_queue_flush(dq) : 0;
+}
+
 /*
  * This function is called by the jbd2 layer once the commit has finished,
  * so we know we can free the blocks that were released with that commit.
+ * Their discards are all issued first and waited for together, the
+ * blocks being reusable only once they are put in the buddy.
  */
 static void release_blocks_on_commit(journal_t *journal, transaction_t *txn)
 {
@@ -2586,16 +2827,23 @@ static void release_blocks_on_commit(journal_t *journal, transaction_t *txn)
 	struct ext4_free_data *entry;
 	struct list_head *l, *ltmp;
 
+	if (test_opt(sb, DISCARD)) {
+		list_for_each_entry(entry, &txn->t_private_list, list)
+			ext4_queue_discard(sb, entry->group,
+					entry->start_blk, entry->count);
+
+		if (ext4_flush_discards(sb) == -EOPNOTSUPP) {
+			ext4_warning(sb, "discard not supported, disabling");
+			clear_opt(EXT4_SB(sb)->s_mount_opt, DISCARD);
+		}
+	}
+
 	list_for_each_safe(l, ltmp, &txn->t_private_list) {
 		entry = list_entry(l, struct ext4_free_data, list);
 
 		mb_debug(1, "gonna free %u blocks in group %u (0x%p):",
 			 entry->count, entry->group, entry);
 
-		if (test_opt(sb, DISCARD))
-			ext4_issue_discard(sb, entry->group,
-					entry->start_blk, entry->count);
-
 		err = ext4_mb_load_buddy(sb, entry->group, &e4b);
 		/* we expect to find existing buddy because it's pinned */
 		BUG_ON(err != 0);
@@ -3037,6 +3285,9 @@ static void ext4_mb_collect_stats(struct ext4_allocation_context *ac)
 			atomic_inc(&sbi->s_bal_goals);
 		if (ac->ac_found > sbi->s_mb_max_to_scan)
 			atomic_inc(&sbi->s_bal_breaks);
+		atomic_inc(&sbi->s_bal_groups_scanned[min_t(int,
+				fls(ac->ac_groups_scanned),
+				EXT4_MB_SCANNED_BUCKETS - 1)]);
 	}
 
 	if (ac->ac_op == EXT4_MB_HISTORY_ALLOC)
@@ -4689,3 +4940,132 @@ error_return:
 		kmem_cache_free(ext4_ac_cachep, ac);
 	return;
 }
+
+#define EXT4_TRIM_BATCH		32
+
+/*
+ * Discard the free extents of at least minblocks blocks of the group,
+ * from start to max.  A batch of them is marked used in the buddy, so
+ * that they can't be allocated while the group is unlocked for their
+ * discards, issued together, then they are freed again.  Returns the
+ * number of blocks trimmed.
+ */
+static ext4_grpblk_t
+ext4_trim_all_free(struct super_block *sb, struct ext4_buddy *e4b,
+		   ext4_grpblk_t start, ext4_grpblk_t max,
+		   ext4_grpblk_t minblocks, int *errp)
+{
+	struct {
+		ext4_grpblk_t start;
+		ext4_grpblk_t count;
+	} batch[EXT4_TRIM_BATCH];
+	ext4_group_t group = e4b->bd_group;
+	void *bitmap = e4b->bd_bitmap;
+	struct ext4_free_extent ex;
+	ext4_grpblk_t next, count = 0;
+	int i, nr, err = 0;
+
+	ext4_lock_group(sb, group);
+	start = mb_find_next_zero_bit(bitmap, max, start);
+	while (start < max && !err) {
+		for (nr = 0; start < max && nr < EXT4_TRIM_BATCH; ) {
+			next = mb_find_next_bit(bitmap, max, start);
+			if (next - start >= minblocks) {
+				ex.fe_group = group;
+				ex.fe_start = start;
+				ex.fe_len = next - start;
+				mb_mark_used(e4b, &ex);
+				batch[nr].start = start;
+				batch[nr].count = next - start;
+				nr++;
+			}
+			start = mb_find_next_zero_bit(bitmap, max, next);
+		}
+		ext4_unlock_group(sb, group);
+
+		for (i = 0; i < nr; i++)
+			ext4_queue_discard(sb, group, batch[i].start,
+					   batch[i].count);
+		err = ext4_flush_discards(sb);
+		if (!err && fatal_signal_pending(current))
+			err = -ERESTARTSYS;
+		cond_resched();
+
+		ext4_lock_group(sb, group);
+		for (i = 0; i < nr; i++) {
+			mb_free_blocks(NULL, e4b, batch[i].start, batch[i].count);
+			count += batch[i].count;
+		}
+	}
+	ext4_unlock_group(sb, group);
+
+	*errp = err;
+	return count;
+}
+
+/**
+ * ext4_trim_fs() -- trim ioctl handle function
+ * @sb:			superblock for filesystem
+ * @range:		fstrim_range, the area to trim and the minimum extent
+ *
+ * Discards the free extents of the area, group by group.  range->len is
+ * set to the number of bytes trimmed.
+ */
+int ext4_trim_fs(struct super_block *sb, struct fstrim_range *range)
+{
+	struct request_queue *q = bdev_get_queue(sb->s_bdev);
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+	struct ext4_group_info *grp;
+	ext4_group_t first_group, last_group, group;
+	ext4_grpblk_t first_block, last_block, end;
+	ext4_fsblk_t start, len, minlen, trimmed = 0;
+	struct ext4_buddy e4b;
+	int ret = 0;
+
+	if (!blk_queue_discard(q))
+		return -EOPNOTSUPP;
+
+	start = range->start >> sb->s_blocksize_bits;
+	len = range->len >> sb->s_blocksize_bits;
+	minlen = max_t(u64, range->minlen >> sb->s_blocksize_bits, 1);
+
+	if (minlen > EXT4_BLOCKS_PER_GROUP(sb))
+		return -EINVAL;
+	start = max_t(ext4_fsblk_t, start,
+		      le32_to_cpu(es->s_first_data_block));
+	if (start >= ext4_blocks_count(es))
+		goto out;
+	if (len > ext4_blocks_count(es) - start)
+		len = ext4_blocks_count(es) - start;
+	if (!len)
+		goto out;
+
+	ext4_get_group_no_and_offset(sb, start, &first_group, &first_block);
+	ext4_get_group_no_and_offset(sb, start + len - 1, &last_group,
+				     &last_block);
+
+	for (group = first_group; group <= last_group; group++) {
+		ret = ext4_mb_load_buddy(sb, group, &e4b);
+		if (ret) {
+			ext4_error(sb, "Error in loading buddy "
+				   "information for %u", group);
+			break;
+		}
+
+		end = group == last_group ? last_block + 1 :
+			EXT4_BLOCKS_PER_GROUP(sb);
+		grp = e4b.bd_info;
+		if (grp->bb_free >= minlen)
+			trimmed += ext4_trim_all_free(sb, &e4b, first_block,
+						      end, minlen, &ret);
+		ext4_mb_unload_buddy(&e4b);
+		if (ret)
+			break;
+
+		first_block = 0;
+	}
+
+out:
+	range->len = trimmed << sb->s_blocksize_bits;
+	return ret;
+}
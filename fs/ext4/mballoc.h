@@ -89,6 +89,12 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_ORDER2_REQS		2
 
+/*
+ * whether 2^N requests look for a group on the lists of orders,
+ * rather than scanning the groups from the goal on
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
 /*
  * default group prealloc size 512 blocks
  */
@@ -162,6 +168,16 @@ struct ext4_locality_group {
 	spinlock_t		lg_prealloc_lock;
 };
 
+/*
+ * Where the last stream allocation on a cpu ended.  Per cpu, so that
+ * streaming writers on different cpus neither share a lock nor pile
+ * up in the same group.
+ */
+struct ext4_stream_goal {
+	ext4_group_t		sg_group;
+	ext4_grpblk_t		sg_start;
+};
+
 struct ext4_allocation_context {
 	struct inode *ac_inode;
 	struct super_block *ac_sb;
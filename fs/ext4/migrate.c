@@ -478,6 +478,10 @@ int ext4_ext_migrate(struct inode *inode)
 	    (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
 		return -EINVAL;
 
+	/* Inline data has no blocks to map */
+	if (ext4_has_inline_data(inode))
+		return -EINVAL;
+
 	if (S_ISLNK(inode->i_mode) && inode->i_blocks == 0)
 		/*
 		 * don't migrate fast symlink
@@ -797,13 +797,12 @@ static inline int ext4_match (int len, const char * const name,
 }
 
 /*
+ * Search the entries in search_buf, which lies in bh, for d_name.
  * Returns 0 if not found, -1 on failure, and 1 on success
  */
-static inline int search_dirblock(struct buffer_head *bh,
-				  struct inode *dir,
-				  const struct qstr *d_name,
-				  unsigned int offset,
-				  struct ext4_dir_entry_2 ** res_dir)
+int ext4_search_dir(struct buffer_head *bh, char *search_buf, int buf_size,
+		    struct inode *dir, const struct qstr *d_name,
+		    unsigned int offset, struct ext4_dir_entry_2 **res_dir)
 {
 	struct ext4_dir_entry_2 * de;
 	char * dlimit;
@@ -811,8 +810,8 @@ static inline int search_dirblock(struct buffer_head *bh,
 	const char *name = d_name->name;
 	int namelen = d_name->len;
 
-	de = (struct ext4_dir_entry_2 *) bh->b_data;
-	dlimit = bh->b_data + dir->i_sb->s_blocksize;
+	de = (struct ext4_dir_entry_2 *) search_buf;
+	dlimit = search_buf + buf_size;
 	while ((char *) de < dlimit) {
 		/* this code is executed quadratically often */
 		/* do minimal checking `by hand' */
@@ -820,7 +819,8 @@ static inline int search_dirblock(struct buffer_head *bh,
 		if ((char *) de + namelen <= dlimit &&
 		    ext4_match (namelen, name, de)) {
 			/* found a match - just to be sure, do a full check */
-			if (!ext4_check_dir_entry(dir, de, bh, offset))
+			if (!ext4_check_dir_entry_buf(dir, de, bh, search_buf,
+						      buf_size, offset))
 				return -1;
 			*res_dir = de;
 			return 1;
@@ -836,6 +836,16 @@ static inline int search_dirblock(struct buffer_head *bh,
 	return 0;
 }
 
+static inline int search_dirblock(struct buffer_head *bh,
+				  struct inode *dir,
+				  const struct qstr *d_name,
+				  unsigned int offset,
+				  struct ext4_dir_entry_2 ** res_dir)
+{
+	return ext4_search_dir(bh, bh->b_data, dir->i_sb->s_blocksize, dir,
+			       d_name, offset, res_dir);
+}
+
 
 /*
  *	ext4_find_entry()
@@ -870,6 +880,14 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 	namelen = d_name->len;
 	if (namelen > EXT4_NAME_LEN)
 		return NULL;
+	if (ext4_has_inline_data(dir)) {
+		int has_inline_data = 1;
+
+		ret = ext4_find_inline_entry(dir, d_name, res_dir,
+					     &has_inline_data);
+		if (has_inline_data)
+			return ret;
+	}
 	if (is_dx(dir)) {
 		bh = ext4_dx_find_entry(dir, d_name, res_dir, &err);
 		/*
@@ -1059,21 +1077,45 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, stru
 	return d_splice_alias(inode, dentry);
 }
 
+#define PARENT_INO(buffer, size) \
+	(ext4_next_entry((struct ext4_dir_entry_2 *)(buffer), size)->inode)
+
+/*
+ * Returns the buffer holding the ".." of a directory, with *parent
+ * pointing at its inode number: that of the second entry of the first
+ * block, or the head of the inline data.
+ */
+static struct buffer_head *ext4_get_dotdot(handle_t *handle,
+					   struct inode *inode,
+					   __le32 **parent, int *retval)
+{
+	struct buffer_head *bh;
+
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		bh = ext4_get_inline_dotdot(inode, parent, retval,
+					    &has_inline_data);
+		if (has_inline_data)
+			return bh;
+	}
+	bh = ext4_bread(handle, inode, 0, 0, retval);
+	if (bh)
+		*parent = &PARENT_INO(bh->b_data, inode->i_sb->s_blocksize);
+	return bh;
+}
 
 struct dentry *ext4_get_parent(struct dentry *child)
 {
 	__u32 ino;
-	static const struct qstr dotdot = {
-		.name = "..",
-		.len = 2,
-	};
-	struct ext4_dir_entry_2 * de;
+	__le32 *parent;
 	struct buffer_head *bh;
+	int err;
 
-	bh = ext4_find_entry(child->d_inode, &dotdot, &de);
+	bh = ext4_get_dotdot(NULL, child->d_inode, &parent, &err);
 	if (!bh)
-		return ERR_PTR(-ENOENT);
-	ino = le32_to_cpu(de->inode);
+		return ERR_PTR(err ? err : -ENOENT);
+	ino = le32_to_cpu(*parent);
 	brelse(bh);
 
 	if (!ext4_valid_inum(child->d_inode->i_sb, ino)) {
@@ -1252,6 +1294,70 @@ errout:
 	return NULL;
 }
 
+/*
+ * Find room for an entry called name in the entries of buf, which lies
+ * in bh.  Returns -ENOSPC if there is none, and -EIO and -EEXIST if the
+ * entries are corrupted or the name exists already.
+ */
+int ext4_find_dest_de(struct inode *dir, struct buffer_head *bh,
+		      char *buf, int buf_size, const char *name, int namelen,
+		      struct ext4_dir_entry_2 **dest_de)
+{
+	struct ext4_dir_entry_2 *de;
+	unsigned short	reclen = EXT4_DIR_REC_LEN(namelen);
+	unsigned int	offset = 0;
+	int		nlen, rlen;
+	char		*top;
+
+	de = (struct ext4_dir_entry_2 *)buf;
+	top = buf + buf_size - reclen;
+	while ((char *) de <= top) {
+		if (!ext4_check_dir_entry_buf(dir, de, bh, buf, buf_size,
+					      offset))
+			return -EIO;
+		if (ext4_match(namelen, name, de))
+			return -EEXIST;
+		nlen = EXT4_DIR_REC_LEN(de->name_len);
+		rlen = ext4_rec_len_from_disk(de->rec_len, buf_size);
+		if ((de->inode? rlen - nlen: rlen) >= reclen)
+			break;
+		de = (struct ext4_dir_entry_2 *)((char *)de + rlen);
+		offset += rlen;
+	}
+	if ((char *) de > top)
+		return -ENOSPC;
+	*dest_de = de;
+	return 0;
+}
+
+/*
+ * Fill in an entry for inode at de, found by ext4_find_dest_de() in a
+ * buffer of buf_size bytes, splitting it first if it is in use.
+ */
+void ext4_insert_dentry(struct inode *dir, struct inode *inode,
+			struct ext4_dir_entry_2 *de, int buf_size,
+			const char *name, int namelen)
+{
+	int nlen, rlen;
+
+	nlen = EXT4_DIR_REC_LEN(de->name_len);
+	rlen = ext4_rec_len_from_disk(de->rec_len, buf_size);
+	if (de->inode) {
+		struct ext4_dir_entry_2 *de1 = (struct ext4_dir_entry_2 *)((char *)de + nlen);
+		de1->rec_len = ext4_rec_len_to_disk(rlen - nlen, buf_size);
+		de->rec_len = ext4_rec_len_to_disk(nlen, buf_size);
+		de = de1;
+	}
+	de->file_type = EXT4_FT_UNKNOWN;
+	if (inode) {
+		de->inode = cpu_to_le32(inode->i_ino);
+		ext4_set_de_type(dir->i_sb, de, inode->i_mode);
+	} else
+		de->inode = 0;
+	de->name_len = namelen;
+	memcpy(de->name, name, namelen);
+}
+
 /*
  * Add a new entry into a directory (leaf) block.  If de is non-NULL,
  * it points to a directory entry which is guaranteed to be large
@@ -1267,30 +1373,14 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	struct inode	*dir = dentry->d_parent->d_inode;
 	const char	*name = dentry->d_name.name;
 	int		namelen = dentry->d_name.len;
-	unsigned int	offset = 0;
 	unsigned int	blocksize = dir->i_sb->s_blocksize;
-	unsigned short	reclen;
-	int		nlen, rlen, err;
-	char		*top;
+	int		err;
 
-	reclen = EXT4_DIR_REC_LEN(namelen);
 	if (!de) {
-		de = (struct ext4_dir_entry_2 *)bh->b_data;
-		top = bh->b_data + blocksize - reclen;
-		while ((char *) de <= top) {
-			if (!ext4_check_dir_entry(dir, de, bh, offset))
-				return -EIO;
-			if (ext4_match(namelen, name, de))
-				return -EEXIST;
-			nlen = EXT4_DIR_REC_LEN(de->name_len);
-			rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
-			if ((de->inode? rlen - nlen: rlen) >= reclen)
-				break;
-			de = (struct ext4_dir_entry_2 *)((char *)de + rlen);
-			offset += rlen;
-		}
-		if ((char *) de > top)
-			return -ENOSPC;
+		err = ext4_find_dest_de(dir, bh, bh->b_data, blocksize,
+					name, namelen, &de);
+		if (err)
+			return err;
 	}
 	BUFFER_TRACE(bh, "get_write_access");
 	err = ext4_journal_get_write_access(handle, bh);
@@ -1300,22 +1390,7 @@ static int add_dirent_to_buf(handle_t *handle, struct dentry *dentry,
 	}
 
 	/* By now the buffer is marked for journaling */
-	nlen = EXT4_DIR_REC_LEN(de->name_len);
-	rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
-	if (de->inode) {
-		struct ext4_dir_entry_2 *de1 = (struct ext4_dir_entry_2 *)((char *)de + nlen);
-		de1->rec_len = ext4_rec_len_to_disk(rlen - nlen, blocksize);
-		de->rec_len = ext4_rec_len_to_disk(nlen, blocksize);
-		de = de1;
-	}
-	de->file_type = EXT4_FT_UNKNOWN;
-	if (inode) {
-		de->inode = cpu_to_le32(inode->i_ino);
-		ext4_set_de_type(dir->i_sb, de, inode->i_mode);
-	} else
-		de->inode = 0;
-	de->name_len = namelen;
-	memcpy(de->name, name, namelen);
+	ext4_insert_dentry(dir, inode, de, blocksize, name, namelen);
 	/*
 	 * XXX shouldn't update any times until successful
 	 * completion of syscall, but too many callers depend
@@ -1431,6 +1506,97 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 	return retval;
 }
 
+/*
+ * Fill in "." and ".." at the start of a new directory block, ".."
+ * covering the rest of it, and return "..".
+ */
+static struct ext4_dir_entry_2 *ext4_init_dot_dotdot(struct inode *inode,
+						     struct ext4_dir_entry_2 *de,
+						     unsigned int blocksize,
+						     unsigned int parent_ino)
+{
+	de->inode = cpu_to_le32(inode->i_ino);
+	de->name_len = 1;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(de->name_len),
+					   blocksize);
+	strcpy(de->name, ".");
+	ext4_set_de_type(inode->i_sb, de, S_IFDIR);
+	de = ext4_next_entry(de, blocksize);
+	de->inode = cpu_to_le32(parent_ino);
+	de->rec_len = ext4_rec_len_to_disk(blocksize - EXT4_DIR_REC_LEN(1),
+					   blocksize);
+	de->name_len = 2;
+	strcpy(de->name, "..");
+	ext4_set_de_type(inode->i_sb, de, S_IFDIR);
+	return de;
+}
+
+/*
+ * Move the entries of an inline directory that has run out of room to
+ * a directory block, after "." and "..".
+ */
+static int ext4_convert_inline_dir(handle_t *handle, struct inode *dir)
+{
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	unsigned int offset, rlen;
+	ext4_lblk_t block;
+	int size, err;
+	char *buf;
+
+	buf = kmalloc(EXT4_INODE_SIZE(dir->i_sb), GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+	size = ext4_read_inline_data(dir, buf, EXT4_INODE_SIZE(dir->i_sb));
+	err = size;
+	if (size < 0)
+		goto out;
+	err = -EIO;
+	if (size < EXT4_MIN_INLINE_DATA_SIZE)
+		goto out;
+	err = ext4_destroy_inline_data(handle, dir);
+	if (err)
+		goto out;
+
+	dir->i_size = 0;
+	bh = ext4_append(handle, dir, &block, &err);
+	if (!bh)
+		goto out;
+	de = ext4_init_dot_dotdot(dir, (struct ext4_dir_entry_2 *)bh->b_data,
+				  blocksize, le32_to_cpu(*(__le32 *)buf));
+	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(2), blocksize);
+	offset = EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2);
+	memcpy(bh->b_data + offset, buf + EXT4_INLINE_DOTDOT_SIZE,
+	       size - EXT4_INLINE_DOTDOT_SIZE);
+	size += offset - EXT4_INLINE_DOTDOT_SIZE;
+
+	/* The last entry now takes up the rest of the block */
+	err = -EIO;
+	do {
+		de = (struct ext4_dir_entry_2 *)(bh->b_data + offset);
+		if (!ext4_check_dir_entry(dir, de, bh, offset))
+			goto out_brelse;
+		rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
+		offset += rlen;
+	} while (offset < size);
+	if (offset != size) {
+		EXT4_ERROR_INODE(dir, "bad inline directory entries");
+		goto out_brelse;
+	}
+	de->rec_len = ext4_rec_len_to_disk(rlen + blocksize - size, blocksize);
+	dir->i_version++;
+	BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+	err = ext4_handle_dirty_metadata(handle, dir, bh);
+	if (!err)
+		err = ext4_mark_inode_dirty(handle, dir);
+out_brelse:
+	brelse(bh);
+out:
+	kfree(buf);
+	return err;
+}
+
 /*
  *	ext4_add_entry()
  *
@@ -1457,6 +1623,14 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	blocksize = sb->s_blocksize;
 	if (!dentry->d_name.len)
 		return -EINVAL;
+	if (ext4_has_inline_data(dir)) {
+		retval = ext4_try_add_inline_entry(handle, dentry, inode);
+		if (retval != -ENOSPC)
+			return retval;
+		retval = ext4_convert_inline_dir(handle, dir);
+		if (retval)
+			return retval;
+	}
 	if (is_dx(dir)) {
 		retval = ext4_dx_add_entry(handle, dentry, inode);
 		if (!retval || (retval != ERR_BAD_DX_DIR))
@@ -1629,13 +1803,14 @@ cleanup:
 }
 
 /*
- * ext4_delete_entry deletes a directory entry by merging it with the
- * previous entry
+ * ext4_generic_delete_entry deletes a directory entry of entry_buf,
+ * which lies in bh, by merging it with the previous entry
  */
-static int ext4_delete_entry(handle_t *handle,
-			     struct inode *dir,
-			     struct ext4_dir_entry_2 *de_del,
-			     struct buffer_head *bh)
+int ext4_generic_delete_entry(handle_t *handle,
+			      struct inode *dir,
+			      struct ext4_dir_entry_2 *de_del,
+			      struct buffer_head *bh,
+			      void *entry_buf, int buf_size)
 {
 	struct ext4_dir_entry_2 *de, *pde;
 	unsigned int blocksize = dir->i_sb->s_blocksize;
@@ -1643,9 +1818,10 @@ static int ext4_delete_entry(handle_t *handle,
 
 	i = 0;
 	pde = NULL;
-	de = (struct ext4_dir_entry_2 *) bh->b_data;
-	while (i < bh->b_size) {
-		if (!ext4_check_dir_entry(dir, de, bh, i))
+	de = (struct ext4_dir_entry_2 *) entry_buf;
+	while (i < buf_size) {
+		if (!ext4_check_dir_entry_buf(dir, de, bh, entry_buf,
+					      buf_size, i))
 			return -EIO;
 		if (de == de_del)  {
 			BUFFER_TRACE(bh, "get_write_access");
@@ -1671,6 +1847,24 @@ static int ext4_delete_entry(handle_t *handle,
 	return -ENOENT;
 }
 
+static int ext4_delete_entry(handle_t *handle,
+			     struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh)
+{
+	if (ext4_has_inline_data(dir)) {
+		int has_inline_data = 1;
+		int err;
+
+		err = ext4_delete_inline_entry(handle, dir, de_del, bh,
+					       &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+	return ext4_generic_delete_entry(handle, dir, de_del, bh, bh->b_data,
+					 dir->i_sb->s_blocksize);
+}
+
 /*
  * DIR_NLINK feature is set if 1) nlinks > EXT4_LINK_MAX or 2) nlinks == 2,
  * since this indicates that nlinks count was previously 1.
@@ -1794,13 +1988,41 @@ retry:
 	return err;
 }
 
+/*
+ * Give a new directory its "." and "..", in the inode if it may have
+ * inline data and there is room for it, or else in a first block.
+ */
+static int ext4_init_new_dir(handle_t *handle, struct inode *dir,
+			     struct inode *inode)
+{
+	struct buffer_head *dir_block;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	int err;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA)) {
+		err = ext4_try_create_inline_dir(handle, dir, inode);
+		if (err != -ENOSPC)
+			return err;
+	}
+
+	inode->i_size = EXT4_I(inode)->i_disksize = inode->i_sb->s_blocksize;
+	dir_block = ext4_bread(handle, inode, 0, 1, &err);
+	if (!dir_block)
+		return err;
+	BUFFER_TRACE(dir_block, "get_write_access");
+	ext4_journal_get_write_access(handle, dir_block);
+	ext4_init_dot_dotdot(inode, (struct ext4_dir_entry_2 *)dir_block->b_data,
+			     blocksize, dir->i_ino);
+	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_metadata");
+	ext4_handle_dirty_metadata(handle, dir, dir_block);
+	brelse(dir_block);
+	return 0;
+}
+
 static int ext4_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 {
 	handle_t *handle;
 	struct inode *inode;
-	struct buffer_head *dir_block;
-	struct ext4_dir_entry_2 *de;
-	unsigned int blocksize = dir->i_sb->s_blocksize;
 	int err, retries = 0;
 
 	if (EXT4_DIR_LINK_MAX(dir))
@@ -1826,30 +2048,10 @@ retry:
 
 	inode->i_op = &ext4_dir_inode_operations;
 	inode->i_fop = &ext4_dir_operations;
-	inode->i_size = EXT4_I(inode)->i_disksize = inode->i_sb->s_blocksize;
-	dir_block = ext4_bread(handle, inode, 0, 1, &err);
-	if (!dir_block)
+	err = ext4_init_new_dir(handle, dir, inode);
+	if (err)
 		goto out_clear_inode;
-	BUFFER_TRACE(dir_block, "get_write_access");
-	ext4_journal_get_write_access(handle, dir_block);
-	de = (struct ext4_dir_entry_2 *) dir_block->b_data;
-	de->inode = cpu_to_le32(inode->i_ino);
-	de->name_len = 1;
-	de->rec_len = ext4_rec_len_to_disk(EXT4_DIR_REC_LEN(de->name_len),
-					   blocksize);
-	strcpy(de->name, ".");
-	ext4_set_de_type(dir->i_sb, de, S_IFDIR);
-	de = ext4_next_entry(de, blocksize);
-	de->inode = cpu_to_le32(dir->i_ino);
-	de->rec_len = ext4_rec_len_to_disk(blocksize - EXT4_DIR_REC_LEN(1),
-					   blocksize);
-	de->name_len = 2;
-	strcpy(de->name, "..");
-	ext4_set_de_type(dir->i_sb, de, S_IFDIR);
 	inode->i_nlink = 2;
-	BUFFER_TRACE(dir_block, "call ext4_handle_dirty_metadata");
-	ext4_handle_dirty_metadata(handle, dir, dir_block);
-	brelse(dir_block);
 	ext4_mark_inode_dirty(handle, inode);
 	err = ext4_add_entry(handle, dentry, inode);
 	if (err) {
@@ -1883,6 +2085,14 @@ static int empty_dir(struct inode *inode)
 	struct super_block *sb;
 	int err = 0;
 
+	if (ext4_has_inline_data(inode)) {
+		int has_inline_data = 1;
+
+		err = empty_inline_dir(inode, &has_inline_data);
+		if (has_inline_data)
+			return err;
+	}
+
 	sb = inode->i_sb;
 	if (inode->i_size < EXT4_DIR_REC_LEN(1) + EXT4_DIR_REC_LEN(2) ||
 	    !(bh = ext4_bread(NULL, inode, 0, 0, &err))) {
@@ -1945,6 +2155,84 @@ static int empty_dir(struct inode *inode)
 	return 1;
 }
 
+/*
+ * Take a free slot of the orphan file.  Each cpu starts looking in a
+ * block of its own, and a slot is claimed by cmpxchg once the entry
+ * count of its block has been decremented, so adding orphans in
+ * parallel takes no lock and the superblock is not touched.
+ */
+static int ext4_orphan_file_add(handle_t *handle, struct inode *inode)
+{
+	struct ext4_orphan_info *oi = &EXT4_SB(inode->i_sb)->s_orphan_info;
+	int inodes_per_ob = ext4_inodes_per_orphan_block(inode->i_sb);
+	struct buffer_head *bh;
+	__le32 *bdata;
+	int i, j, start;
+	int err;
+
+	start = i = (raw_smp_processor_id() * 13) % oi->of_blocks;
+	while (!atomic_add_unless(&oi->of_binfo[i].ob_free_entries, -1, 0)) {
+		if (++i == oi->of_blocks)
+			i = 0;
+		if (i == start)
+			return -ENOSPC;
+	}
+	bh = oi->of_binfo[i].ob_bh;
+
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (err) {
+		atomic_inc(&oi->of_binfo[i].ob_free_entries);
+		return err;
+	}
+
+	/* The entry count guarantees there is a zero slot left for us */
+	bdata = (__le32 *)bh->b_data;
+	j = 0;
+	do {
+		while (ACCESS_ONCE(bdata[j]))
+			if (++j == inodes_per_ob)
+				j = 0;
+	} while (cmpxchg(&bdata[j], 0, cpu_to_le32(inode->i_ino)) != 0);
+
+	EXT4_I(inode)->i_orphan_idx = i * inodes_per_ob + j;
+	ext4_set_inode_state(inode, EXT4_STATE_ORPHAN_FILE);
+
+	return ext4_handle_dirty_metadata(handle, NULL, bh);
+}
+
+static int ext4_orphan_file_del(handle_t *handle, struct inode *inode)
+{
+	struct ext4_orphan_info *oi = &EXT4_SB(inode->i_sb)->s_orphan_info;
+	int inodes_per_ob = ext4_inodes_per_orphan_block(inode->i_sb);
+	struct buffer_head *bh;
+	int i, j;
+	int err = 0;
+
+	ext4_clear_inode_state(inode, EXT4_STATE_ORPHAN_FILE);
+
+	/* See ext4_orphan_del(): no handle on error paths */
+	if (!handle)
+		return 0;
+
+	i = EXT4_I(inode)->i_orphan_idx / inodes_per_ob;
+	j = EXT4_I(inode)->i_orphan_idx % inodes_per_ob;
+	if (i >= oi->of_blocks)
+		return 0;
+	bh = oi->of_binfo[i].ob_bh;
+
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (err)
+		goto out;
+	((__le32 *)bh->b_data)[j] = 0;
+	atomic_inc(&oi->of_binfo[i].ob_free_entries);
+	err = ext4_handle_dirty_metadata(handle, NULL, bh);
+out:
+	ext4_std_error(inode->i_sb, err);
+	return err;
+}
+
 /* ext4_orphan_add() links an unlinked or truncated inode into a list of
  * such inodes, starting at the superblock, in case we crash before the
  * file is closed/deleted, or in case the inode truncate spans multiple
@@ -1952,6 +2240,9 @@ static int empty_dir(struct inode *inode)
  *
  * At filesystem recovery time, we walk this list deleting unlinked
  * inodes and truncating linked inodes in ext4_orphan_cleanup().
+ *
+ * If the filesystem has an orphan file, the inode goes into a slot of it
+ * instead, unless the orphan file is full.
  */
 int ext4_orphan_add(handle_t *handle, struct inode *inode)
 {
@@ -1962,6 +2253,19 @@ int ext4_orphan_add(handle_t *handle, struct inode *inode)
 	if (!ext4_handle_valid(handle))
 		return 0;
 
+	if (ext4_test_inode_state(inode, EXT4_STATE_ORPHAN_FILE))
+		return 0;
+	if (EXT4_SB(sb)->s_orphan_info.of_blocks &&
+	    list_empty(&EXT4_I(inode)->i_orphan)) {
+		err = ext4_orphan_file_add(handle, inode);
+		/* if the orphan file is full, use the list */
+		if (err != -ENOSPC) {
+			ext4_std_error(sb, err);
+			return err;
+		}
+		err = 0;
+	}
+
 	mutex_lock(&EXT4_SB(sb)->s_orphan_lock);
 	if (!list_empty(&EXT4_I(inode)->i_orphan))
 		goto out_unlock;
@@ -2044,6 +2348,9 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 	if (handle && !ext4_handle_valid(handle))
 		return 0;
 
+	if (ext4_test_inode_state(inode, EXT4_STATE_ORPHAN_FILE))
+		return ext4_orphan_file_del(handle, inode);
+
 	mutex_lock(&EXT4_SB(inode->i_sb)->s_orphan_lock);
 	if (list_empty(&ei->i_orphan))
 		goto out;
@@ -2328,9 +2635,6 @@ retry:
 	return err;
 }
 
-#define PARENT_INO(buffer, size) \
-	(ext4_next_entry((struct ext4_dir_entry_2 *)(buffer), size)->inode)
-
 /*
  * Anybody can rename anything with this: the permission checks are left to the
  * higher-level routines.
@@ -2342,7 +2646,8 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	struct inode *old_inode, *new_inode;
 	struct buffer_head *old_bh, *new_bh, *dir_bh;
 	struct ext4_dir_entry_2 *old_de, *new_de;
-	int retval, force_da_alloc = 0;
+	__le32 *parent = NULL;
+	int retval, force_da_alloc = 0, force_reread = 0;
 
 	dquot_initialize(old_dir);
 	dquot_initialize(new_dir);
@@ -2389,11 +2694,10 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 				goto end_rename;
 		}
 		retval = -EIO;
-		dir_bh = ext4_bread(handle, old_inode, 0, 0, &retval);
+		dir_bh = ext4_get_dotdot(handle, old_inode, &parent, &retval);
 		if (!dir_bh)
 			goto end_rename;
-		if (le32_to_cpu(PARENT_INO(dir_bh->b_data,
-				old_dir->i_sb->s_blocksize)) != old_dir->i_ino)
+		if (le32_to_cpu(*parent) != old_dir->i_ino)
 			goto end_rename;
 		retval = -EMLINK;
 		if (!new_inode && new_dir != old_dir &&
@@ -2401,6 +2705,12 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 			goto end_rename;
 	}
 	if (!new_bh) {
+		/*
+		 * Adding to an inline directory moves its entries around,
+		 * or out of the inode altogether.
+		 */
+		force_reread = new_dir == old_dir &&
+			       ext4_has_inline_data(new_dir);
 		retval = ext4_add_entry(handle, new_dentry, old_inode);
 		if (retval)
 			goto end_rename;
@@ -2431,7 +2741,8 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	/*
 	 * ok, that's it
 	 */
-	if (le32_to_cpu(old_de->inode) != old_inode->i_ino ||
+	if (force_reread ||
+	    le32_to_cpu(old_de->inode) != old_inode->i_ino ||
 	    old_de->name_len != old_dentry->d_name.len ||
 	    strncmp(old_de->name, old_dentry->d_name.name, old_de->name_len) ||
 	    (retval = ext4_delete_entry(handle, old_dir,
@@ -2465,8 +2776,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (dir_bh) {
 		BUFFER_TRACE(dir_bh, "get_write_access");
 		ext4_journal_get_write_access(handle, dir_bh);
-		PARENT_INO(dir_bh->b_data, new_dir->i_sb->s_blocksize) =
-						cpu_to_le32(new_dir->i_ino);
+		*parent = cpu_to_le32(new_dir->i_ino);
 		BUFFER_TRACE(dir_bh, "call ext4_handle_dirty_metadata");
 		ext4_handle_dirty_metadata(handle, old_dir, dir_bh);
 		ext4_dec_count(handle, old_dir);
@@ -696,6 +696,111 @@ static void dump_orphan_list(struct super_block *sb, struct ext4_sb_info *sbi)
 	}
 }
 
+/*
+ * Read in the whole orphan file and count its free slots.  Its blocks
+ * stay referenced until unmount, so that adding an orphan never has to
+ * read one.
+ */
+static int ext4_orphan_file_init(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_orphan_info *oi = &sbi->s_orphan_info;
+	int inodes_per_ob = ext4_inodes_per_orphan_block(sb);
+	struct ext4_orphan_block_tail *ot;
+	struct inode *inode;
+	__le32 *bdata;
+	int i, j, nr_blocks, free;
+	int err = 0;
+
+	if (!EXT4_HAS_COMPAT_FEATURE(sb, EXT4_FEATURE_COMPAT_ORPHAN_FILE))
+		return 0;
+
+	inode = ext4_iget(sb, le32_to_cpu(sbi->s_es->s_orphan_file_inum));
+	if (IS_ERR(inode)) {
+		ext4_msg(sb, KERN_ERR, "get orphan inode failed");
+		return PTR_ERR(inode);
+	}
+	if (inode->i_size & (sb->s_blocksize - 1)) {
+		ext4_msg(sb, KERN_ERR, "orphan file size %lld is not "
+			 "a multiple of the block size", inode->i_size);
+		err = -EINVAL;
+		goto out_put;
+	}
+	nr_blocks = inode->i_size >> sb->s_blocksize_bits;
+	if (!nr_blocks)
+		goto out_put;
+
+	oi->of_binfo = kcalloc(nr_blocks, sizeof(struct ext4_orphan_block),
+			       GFP_KERNEL);
+	if (!oi->of_binfo) {
+		err = -ENOMEM;
+		goto out_put;
+	}
+	for (i = 0; i < nr_blocks; i++) {
+		struct buffer_head *bh = ext4_bread(NULL, inode, i, 0, &err);
+
+		if (!bh) {
+			ext4_msg(sb, KERN_ERR, "can't read orphan file "
+				 "block %d", i);
+			if (!err)
+				err = -EIO;
+			goto out_free;
+		}
+		oi->of_binfo[i].ob_bh = bh;
+		ot = (struct ext4_orphan_block_tail *)(bh->b_data +
+			sb->s_blocksize - sizeof(struct ext4_orphan_block_tail));
+		if (le32_to_cpu(ot->ob_magic) != EXT4_ORPHAN_BLOCK_MAGIC) {
+			ext4_msg(sb, KERN_ERR, "orphan file block %d has "
+				 "bad magic", i);
+			err = -EINVAL;
+			goto out_free;
+		}
+		bdata = (__le32 *)bh->b_data;
+		free = 0;
+		for (j = 0; j < inodes_per_ob; j++)
+			if (bdata[j] == 0)
+				free++;
+		atomic_set(&oi->of_binfo[i].ob_free_entries, free);
+	}
+	oi->of_blocks = nr_blocks;
+	iput(inode);
+	return 0;
+
+out_free:
+	for (i = 0; i < nr_blocks; i++)
+		brelse(oi->of_binfo[i].ob_bh);
+	kfree(oi->of_binfo);
+	oi->of_binfo = NULL;
+out_put:
+	iput(inode);
+	return err;
+}
+
+static void ext4_orphan_file_release(struct super_block *sb)
+{
+	struct ext4_orphan_info *oi = &EXT4_SB(sb)->s_orphan_info;
+	int i;
+
+	for (i = 0; i < oi->of_blocks; i++)
+		brelse(oi->of_binfo[i].ob_bh);
+	kfree(oi->of_binfo);
+	oi->of_binfo = NULL;
+	oi->of_blocks = 0;
+}
+
+static int ext4_orphan_file_empty(struct super_block *sb)
+{
+	struct ext4_orphan_info *oi = &EXT4_SB(sb)->s_orphan_info;
+	int inodes_per_ob = ext4_inodes_per_orphan_block(sb);
+	int i;
+
+	for (i = 0; i < oi->of_blocks; i++)
+		if (atomic_read(&oi->of_binfo[i].ob_free_entries) !=
+		    inodes_per_ob)
+			return 0;
+	return 1;
+}
+
 static void ext4_put_super(struct super_block *sb)
 {
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
@@ -726,9 +831,13 @@ static void ext4_put_super(struct super_block *sb)
 
 	if (!(sb->s_flags & MS_RDONLY)) {
 		EXT4_CLEAR_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_RECOVER);
+		if (ext4_orphan_file_empty(sb))
+			EXT4_CLEAR_RO_COMPAT_FEATURE(sb,
+				EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT);
 		es->s_state = cpu_to_le16(sbi->s_mount_state);
 		ext4_commit_super(sb, 1);
 	}
+	ext4_orphan_file_release(sb);
 	if (sbi->s_proc) {
 		remove_proc_entry(sb->s_id, ext4_proc_root);
 	}
@@ -1165,6 +1274,7 @@ static const struct super_operations ext4_sops = {
 	.sync_fs	= ext4_sync_fs,
 	.freeze_fs	= ext4_freeze,
 	.unfreeze_fs	= ext4_unfreeze,
+	.trim_fs	= ext4_trim_fs,
 	.statfs		= ext4_statfs,
 	.remount_fs	= ext4_remount,
 	.show_options	= ext4_show_options,
@@ -1183,6 +1293,7 @@ static const struct super_operations ext4_nojournal_sops = {
 	.evict_inode	= ext4_evict_inode,
 	.write_super	= ext4_write_super,
 	.put_super	= ext4_put_super,
+	.trim_fs	= ext4_trim_fs,
 	.statfs		= ext4_statfs,
 	.remount_fs	= ext4_remount,
 	.show_options	= ext4_show_options,
@@ -1838,6 +1949,10 @@ static int ext4_setup_super(struct super_block *sb, struct ext4_super_block *es,
 	ext4_update_dynamic_rev(sb);
 	if (sbi->s_journal)
 		EXT4_SET_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_RECOVER);
+	/* Older kernels must not mount it writable and ignore orphans */
+	if (sbi->s_journal && sbi->s_orphan_info.of_blocks)
+		EXT4_SET_RO_COMPAT_FEATURE(sb,
+				EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT);
 
 	ext4_commit_super(sb, 1);
 	if (test_opt(sb, DEBUG))
@@ -2026,16 +2141,44 @@ static int ext4_check_descriptors(struct super_block *sb)
  * ext4_free_inode().  The only reason we would point at a wrong inode is if
  * e2fsck was run on this filesystem, and it must have already done the orphan
  * inode cleanup for us, so we can safely abort without any further action.
+ *
+ * The inodes in the orphan file, if any, are handled the same way.
  */
+static void ext4_process_orphan(struct inode *inode,
+				int *nr_truncates, int *nr_orphans)
+{
+	struct super_block *sb = inode->i_sb;
+
+	dquot_initialize(inode);
+	if (inode->i_nlink) {
+		ext4_msg(sb, KERN_DEBUG,
+			"%s: truncating inode %lu to %lld bytes",
+			__func__, inode->i_ino, inode->i_size);
+		jbd_debug(2, "truncating inode %lu to %lld bytes\n",
+			  inode->i_ino, inode->i_size);
+		ext4_truncate(inode);
+		(*nr_truncates)++;
+	} else {
+		ext4_msg(sb, KERN_DEBUG,
+			"%s: deleting unreferenced inode %lu",
+			__func__, inode->i_ino);
+		jbd_debug(2, "deleting unreferenced inode %lu\n",
+			  inode->i_ino);
+		(*nr_orphans)++;
+	}
+	iput(inode);  /* The delete magic happens here! */
+}
+
 static void ext4_orphan_cleanup(struct super_block *sb,
 				struct ext4_super_block *es)
 {
+	struct ext4_orphan_info *oi = &EXT4_SB(sb)->s_orphan_info;
+	int inodes_per_ob = ext4_inodes_per_orphan_block(sb);
 	unsigned int s_flags = sb->s_flags;
 	int nr_orphans = 0, nr_truncates = 0;
-#ifdef CONFIG_QUOTA
-	int i;
-#endif
-	if (!es->s_last_orphan) {
+	int i, j;
+
+	if (!es->s_last_orphan && ext4_orphan_file_empty(sb)) {
 		jbd_debug(4, "no orphan inodes to clean up\n");
 		return;
 	}
@@ -2084,24 +2227,24 @@ static void ext4_orphan_cleanup(struct super_block *sb,
 		}
 
 		list_add(&EXT4_I(inode)->i_orphan, &EXT4_SB(sb)->s_orphan);
-		dquot_initialize(inode);
-		if (inode->i_nlink) {
-			ext4_msg(sb, KERN_DEBUG,
-				"%s: truncating inode %lu to %lld bytes",
-				__func__, inode->i_ino, inode->i_size);
-			jbd_debug(2, "truncating inode %lu to %lld bytes\n",
-				  inode->i_ino, inode->i_size);
-			ext4_truncate(inode);
-			nr_truncates++;
-		} else {
-			ext4_msg(sb, KERN_DEBUG,
-				"%s: deleting unreferenced inode %lu",
-				__func__, inode->i_ino);
-			jbd_debug(2, "deleting unreferenced inode %lu\n",
-				  inode->i_ino);
-			nr_orphans++;
+		ext4_process_orphan(inode, &nr_truncates, &nr_orphans);
+	}
+
+	for (i = 0; i < oi->of_blocks; i++) {
+		__le32 *bdata = (__le32 *)oi->of_binfo[i].ob_bh->b_data;
+
+		for (j = 0; j < inodes_per_ob; j++) {
+			struct inode *inode;
+
+			if (!bdata[j])
+				continue;
+			inode = ext4_orphan_get(sb, le32_to_cpu(bdata[j]));
+			if (IS_ERR(inode))
+				continue;
+			EXT4_I(inode)->i_orphan_idx = i * inodes_per_ob + j;
+			ext4_set_inode_state(inode, EXT4_STATE_ORPHAN_FILE);
+			ext4_process_orphan(inode, &nr_truncates, &nr_orphans);
 		}
-		iput(inode);  /* The delete magic happens here! */
 	}
 
 #define PLURAL(x) (x), ((x) == 1) ? "" : "s"
@@ -2394,6 +2537,7 @@ EXT4_RW_ATTR_SBI_UI(mb_min_to_scan, s_mb_min_to_scan);
 EXT4_RW_ATTR_SBI_UI(mb_order2_req, s_mb_order2_reqs);
 EXT4_RW_ATTR_SBI_UI(mb_stream_req, s_mb_stream_request);
 EXT4_RW_ATTR_SBI_UI(mb_group_prealloc, s_mb_group_prealloc);
+EXT4_RW_ATTR_SBI_UI(mb_optimize_scan, s_mb_optimize_scan);
 EXT4_RW_ATTR_SBI_UI(max_writeback_mb_bump, s_max_writeback_mb_bump);
 
 static struct attribute *ext4_attrs[] = {
@@ -2408,6 +2552,7 @@ static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(mb_order2_req),
 	ATTR_LIST(mb_stream_req),
 	ATTR_LIST(mb_group_prealloc),
+	ATTR_LIST(mb_optimize_scan),
 	ATTR_LIST(max_writeback_mb_bump),
 	NULL,
 };
@@ -3049,6 +3194,12 @@ no_journal:
 	 * so we can safely mount the rest of the filesystem now.
 	 */
 
+	err = ext4_orphan_file_init(sb);
+	if (err) {
+		ret = err;
+		goto failed_mount4;
+	}
+
 	root = ext4_iget(sb, EXT4_ROOT_INO);
 	if (IS_ERR(root)) {
 		ext4_msg(sb, KERN_ERR, "get root inode failed");
@@ -3177,6 +3328,7 @@ cantfind_ext4:
 
 failed_mount4:
 	ext4_msg(sb, KERN_ERR, "mount failed");
+	ext4_orphan_file_release(sb);
 	destroy_workqueue(EXT4_SB(sb)->dio_unwritten_wq);
 failed_mount_wq:
 	ext4_release_system_zone(sb);
@@ -3790,6 +3942,10 @@ static int ext4_remount(struct super_block *sb, int *flags, char *data)
 			    (sbi->s_mount_state & EXT4_VALID_FS))
 				es->s_state = cpu_to_le16(sbi->s_mount_state);
 
+			if (ext4_orphan_file_empty(sb))
+				EXT4_CLEAR_RO_COMPAT_FEATURE(sb,
+					EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT);
+
 			if (sbi->s_journal)
 				ext4_mark_recovery_complete(sb, es);
 		} else {
@@ -3821,7 +3977,7 @@ static int ext4_remount(struct super_block *sb, int *flags, char *data)
 			 * around from a previously readonly bdev mount,
 			 * require a full umount/remount for now.
 			 */
-			if (es->s_last_orphan) {
+			if (es->s_last_orphan || !ext4_orphan_file_empty(sb)) {
 				ext4_msg(sb, KERN_WARNING, "Couldn't "
 				       "remount RDWR because of unprocessed "
 				       "orphan inode list.  Please "
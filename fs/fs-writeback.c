@@ -442,6 +442,22 @@ static bool pin_sb_for_writeback(struct super_block *sb)
 	return false;
 }
 
+/*
+ * The maximum number of pages to writeout in a single bdi flush/kupdate
+ * operation.  We do this so we don't hold I_SYNC against an inode for
+ * enormous amounts of time, which would block a userspace task which has
+ * been forced to throttle against that inode.  Also, the code reevaluates
+ * the dirty each time it has written this many pages.
+ */
+#define MAX_WRITEBACK_PAGES     1024
+
+/*
+ * The most a single inode may write out of the above in one go before the
+ * next inode on b_io gets its turn, so that a few large files being written
+ * do not hold up all the small ones behind them.
+ */
+#define WRITEBACK_INODE_SLICE	(MAX_WRITEBACK_PAGES / 4)
+
 /*
  * Write a portion of b_io inodes which belong to @sb.
  *
@@ -456,7 +472,7 @@ static int writeback_sb_inodes(struct super_block *sb, struct bdi_writeback *wb,
 		struct writeback_control *wbc, bool only_this_sb)
 {
 	while (!list_empty(&wb->b_io)) {
-		long pages_skipped;
+		long pages_skipped, budget, slice;
 		struct inode *inode = list_entry(wb->b_io.prev,
 						 struct inode, i_list);
 
@@ -493,7 +509,20 @@ static int writeback_sb_inodes(struct super_block *sb, struct bdi_writeback *wb,
 		BUG_ON(inode->i_state & I_FREEING);
 		__iget(inode);
 		pages_skipped = wbc->pages_skipped;
+
+		/*
+		 * An inode that uses up its slice is requeued on b_more_io
+		 * by writeback_single_inode(), behind the rest of b_io.
+		 */
+		budget = wbc->nr_to_write;
+		slice = budget;
+		if (wbc->sync_mode == WB_SYNC_NONE)
+			slice = min_t(long, budget, WRITEBACK_INODE_SLICE);
+		wbc->nr_to_write = slice;
 		writeback_single_inode(inode, wbc);
+		trace_writeback_single_inode(inode, wbc, slice);
+		wbc->nr_to_write = budget - (slice - wbc->nr_to_write);
+
 		if (wbc->pages_skipped != pages_skipped) {
 			/*
 			 * writeback is not making progress due to locked
@@ -558,15 +587,6 @@ static void __writeback_inodes_sb(struct super_block *sb,
 	spin_unlock(&inode_lock);
 }
 
-/*
- * The maximum number of pages to writeout in a single bdi flush/kupdate
- * operation.  We do this so we don't hold I_SYNC against an inode for
- * enormous amounts of time, which would block a userspace task which has
- * been forced to throttle against that inode.  Also, the code reevaluates
- * the dirty each time it has written this many pages.
- */
-#define MAX_WRITEBACK_PAGES     1024
-
 static inline bool over_bground_thresh(void)
 {
 	unsigned long background_thresh, dirty_thresh;
@@ -678,6 +698,101 @@ static long wb_writeback(struct bdi_writeback *wb,
 	return wrote;
 }
 
+/*
+ * Split opportunistic writeback between this thread and its helpers.  They
+ * all pull inodes off the same b_io list, and an inode being written by one
+ * of them has I_SYNC set and is requeued by the others, so each inode is
+ * still written by one thread at a time.  Data integrity writeback has to
+ * wait on I_SYNC inodes anyway and is left to the main thread.
+ */
+static long wb_writeback_split(struct bdi_writeback *wb,
+			       struct wb_writeback_work *work)
+{
+	struct wb_writeback_work share[BDI_MAX_FLUSHERS - 1];
+	unsigned int i, nr = wb->nr_helpers;
+	long chunk, wrote;
+
+	if (!nr || work->sync_mode != WB_SYNC_NONE)
+		return wb_writeback(wb, work);
+
+	chunk = work->nr_pages / (nr + 1);
+	if (chunk < MAX_WRITEBACK_PAGES)
+		return wb_writeback(wb, work);
+
+	atomic_set(&wb->helpers_busy, nr);
+	for (i = 0; i < nr; i++) {
+		share[i] = *work;
+		share[i].nr_pages = chunk;
+		share[i].done = NULL;
+		wb->helper[i].work = &share[i];
+		wake_up_process(wb->helper[i].task);
+	}
+
+	work->nr_pages -= chunk * nr;
+	wrote = wb_writeback(wb, work);
+
+	wait_event(wb->helpers_wait, !atomic_read(&wb->helpers_busy));
+	for (i = 0; i < nr; i++)
+		wrote += chunk - share[i].nr_pages;
+
+	return wrote;
+}
+
+static int bdi_writeback_helper(void *data)
+{
+	struct bdi_flusher_helper *helper = data;
+	struct bdi_writeback *wb = helper->wb;
+	struct wb_writeback_work *work;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_user_nice(current, 0);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		work = helper->work;
+		if (!work) {
+			if (kthread_should_stop())
+				break;
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		helper->work = NULL;
+		wb_writeback(wb, work);
+		if (atomic_dec_and_test(&wb->helpers_busy))
+			wake_up(&wb->helpers_wait);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/*
+ * Start or stop helper threads until there are @nr of them.  Only called by
+ * the bdi thread itself between work items, so the helpers are all idle.
+ */
+static void wb_set_helpers(struct bdi_writeback *wb, unsigned int nr)
+{
+	struct bdi_flusher_helper *helper;
+	struct task_struct *task;
+
+	while (wb->nr_helpers < nr) {
+		helper = &wb->helper[wb->nr_helpers];
+		helper->wb = wb;
+		helper->work = NULL;
+		task = kthread_run(bdi_writeback_helper, helper, "flush-%s:%u",
+				   dev_name(wb->bdi->dev), wb->nr_helpers + 1);
+		if (IS_ERR(task))
+			break;
+		helper->task = task;
+		wb->nr_helpers++;
+	}
+
+	while (wb->nr_helpers > nr)
+		kthread_stop(wb->helper[--wb->nr_helpers].task);
+}
+
 /*
  * Return the next wb_writeback_work struct that hasn't been processed yet.
  */
@@ -715,7 +830,7 @@ static long wb_check_old_data_flush(struct bdi_writeback *wb)
 	wb->last_old_flush = jiffies;
 	nr_pages = global_page_state(NR_FILE_DIRTY) +
 			global_page_state(NR_UNSTABLE_NFS) +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+			get_nr_dirty_inodes();
 
 	if (nr_pages) {
 		struct wb_writeback_work work = {
@@ -751,7 +866,7 @@ long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 
 		trace_writeback_exec(bdi, work);
 
-		wrote += wb_writeback(wb, work);
+		wrote += wb_writeback_split(wb, work);
 
 		/*
 		 * Notify the caller of completion if this is a synchronous
@@ -800,6 +915,8 @@ int bdi_writeback_thread(void *data)
 		 */
 		del_timer(&wb->wakeup_timer);
 
+		wb_set_helpers(wb, clamp_val(ACCESS_ONCE(bdi->nr_flushers),
+					     1, BDI_MAX_FLUSHERS) - 1);
 		pages_written = wb_do_writeback(wb, 0);
 
 		trace_writeback_pages_written(pages_written);
@@ -830,6 +947,7 @@ int bdi_writeback_thread(void *data)
 	/* Flush any work that raced with us exiting */
 	if (!list_empty(&bdi->work_list))
 		wb_do_writeback(wb, 1);
+	wb_set_helpers(wb, 0);
 
 	trace_writeback_thread_stop(bdi);
 	return 0;
@@ -1083,7 +1201,7 @@ void writeback_inodes_sb(struct super_block *sb)
 	WARN_ON(!rwsem_is_locked(&sb->s_umount));
 
 	work.nr_pages = nr_dirty + nr_unstable +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+			get_nr_dirty_inodes();
 
 	bdi_queue_work(sb->s_bdi, &work);
 	wait_for_completion(&done);
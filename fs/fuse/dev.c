@@ -227,6 +227,15 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/*
+ * Unique IDs are handed out sequentially, so the low bits spread the
+ * requests evenly over the buckets
+ */
+static struct list_head *fuse_processing_head(struct fuse_conn *fc, u64 unique)
+{
+	return &fc->processing[unique & (FUSE_PQ_HASH_SIZE - 1)];
+}
+
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
 	fc->reqctr++;
@@ -1037,7 +1046,8 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list,
+			       fuse_processing_head(fc, req->in.h.unique));
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1467,17 +1477,26 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 	}
 }
 
-/* Look up request on processing list by unique ID */
+/*
+ * Look up request on processing list by unique ID.  Replies to
+ * interrupts carry the unique ID of the interrupt, which the request
+ * is not hashed by, so those fall back to searching all buckets.
+ */
 static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
 {
-	struct list_head *entry;
+	struct fuse_req *req;
+	int i;
 
-	list_for_each(entry, &fc->processing) {
-		struct fuse_req *req;
-		req = list_entry(entry, struct fuse_req, list);
-		if (req->in.h.unique == unique || req->intr_unique == unique)
+	list_for_each_entry(req, fuse_processing_head(fc, unique), list) {
+		if (req->in.h.unique == unique)
 			return req;
 	}
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++) {
+		list_for_each_entry(req, &fc->processing[i], list) {
+			if (req->intr_unique == unique)
+				return req;
+		}
+	}
 	return NULL;
 }
 
@@ -1732,6 +1751,16 @@ __acquires(&fc->lock)
 	}
 }
 
+static void end_processing_requests(struct fuse_conn *fc)
+__releases(&fc->lock)
+__acquires(&fc->lock)
+{
+	int i;
+
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		end_requests(fc, &fc->processing[i]);
+}
+
 /*
  * Abort requests under I/O
  *
@@ -1796,7 +1825,7 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		fc->blocked = 0;
 		end_io_requests(fc);
 		end_requests(fc, &fc->pending);
-		end_requests(fc, &fc->processing);
+		end_processing_requests(fc);
 		wake_up_all(&fc->waitq);
 		wake_up_all(&fc->blocked_waitq);
 		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
@@ -1809,11 +1838,14 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_conn *fc = fuse_get_conn(file);
 	if (fc) {
-		spin_lock(&fc->lock);
-		fc->connected = 0;
-		end_requests(fc, &fc->pending);
-		end_requests(fc, &fc->processing);
-		spin_unlock(&fc->lock);
+		/* Clones keep the connection alive until the last one goes */
+		if (atomic_dec_and_test(&fc->dev_count)) {
+			spin_lock(&fc->lock);
+			fc->connected = 0;
+			end_requests(fc, &fc->pending);
+			end_processing_requests(fc);
+			spin_unlock(&fc->lock);
+		}
 		fuse_conn_put(fc);
 	}
 
@@ -1821,6 +1853,54 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 }
 EXPORT_SYMBOL_GPL(fuse_dev_release);
 
+/*
+ * Attach a freshly opened device file to the connection of an existing
+ * one, so that a multi-threaded daemon can give each thread its own
+ * file to read requests from and write replies to.
+ */
+static int fuse_dev_clone(struct file *file, int oldfd)
+{
+	struct file *old;
+	struct fuse_conn *fc;
+	int err;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	err = -EINVAL;
+	if (old->f_op != &fuse_dev_operations)
+		goto out;
+
+	mutex_lock(&fuse_mutex);
+	fc = fuse_get_conn(old);
+	if (fc && !file->private_data) {
+		atomic_inc(&fc->dev_count);
+		file->private_data = fuse_conn_get(fc);
+		err = 0;
+	}
+	mutex_unlock(&fuse_mutex);
+ out:
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	__u32 oldfd;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(oldfd, (__u32 __user *)arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, oldfd);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
 	struct fuse_conn *fc = fuse_get_conn(file);
@@ -1843,6 +1923,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
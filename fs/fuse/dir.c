@@ -1277,8 +1277,23 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	if (err)
 		return err;
 
-	if ((attr->ia_valid & ATTR_OPEN) && fc->atomic_o_trunc)
+	if ((attr->ia_valid & ATTR_OPEN) && fc->atomic_o_trunc) {
+		/*
+		 * The server already truncated the file on open, but with
+		 * the writeback cache the size is ours to maintain.
+		 */
+		if (fc->writeback_cache && S_ISREG(inode->i_mode)) {
+			fuse_set_nowrite(inode);
+			spin_lock(&fc->lock);
+			oldsize = inode->i_size;
+			get_fuse_inode(inode)->attr_version = ++fc->attr_version;
+			i_size_write(inode, attr->ia_size);
+			__fuse_release_nowrite(inode);
+			spin_unlock(&fc->lock);
+			truncate_pagecache(inode, oldsize, attr->ia_size);
+		}
 		return 0;
+	}
 
 	if (attr->ia_valid & ATTR_SIZE)
 		is_truncate = true;
@@ -1333,7 +1348,9 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	fuse_change_attributes_common(inode, &outarg.attr,
 				      attr_timeout(&outarg));
 	oldsize = inode->i_size;
-	i_size_write(inode, outarg.attr.size);
+	/* With the writeback cache only a truncate changes the size */
+	if (is_truncate || !fc->writeback_cache || !S_ISREG(inode->i_mode))
+		i_size_write(inode, outarg.attr.size);
 
 	if (is_truncate) {
 		/* NOTE: this may release/reacquire fc->lock */
@@ -1345,8 +1362,8 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	 * Only call invalidate_inode_pages2() after removing
 	 * FUSE_NOWRITE, otherwise fuse_launder_page() would deadlock.
 	 */
-	if (S_ISREG(inode->i_mode) && oldsize != outarg.attr.size) {
-		truncate_pagecache(inode, oldsize, outarg.attr.size);
+	if (S_ISREG(inode->i_mode) && oldsize != inode->i_size) {
+		truncate_pagecache(inode, oldsize, inode->i_size);
 		invalidate_inode_pages2(inode->i_mapping);
 	}
 
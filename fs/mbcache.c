@@ -24,6 +24,20 @@
  * Invalid cache entries will be freed when the last handle to the cache
  * entry is released. Entries that cannot be freed immediately are put
  * back on the lru list.
+ *
+ * Locking: each hash bucket has its own spinlock for its chain, and each
+ * cache its own lru list and lru lock. The use counts of an entry, and
+ * whether it is hashed, are protected by one of a small set of hashed
+ * entry locks. The lock order is
+ *
+ *	block hash bucket lock
+ *	  index hash bucket lock
+ *	    entry lock
+ *	      lru lock
+ *
+ * The shrinkers walk the lru lists against this order, and therefore
+ * only trylock the other locks and skip entries that are contended. The
+ * global mb_cache_spinlock only protects the list of caches.
  */
 
 #include <linux/kernel.h>
@@ -35,6 +49,10 @@
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/blockgroup_lock.h>
 #include <linux/mbcache.h>
 
 
@@ -76,26 +94,41 @@ EXPORT_SYMBOL(mb_cache_entry_find_first);
 EXPORT_SYMBOL(mb_cache_entry_find_next);
 #endif
 
+struct mb_cache_bucket {
+	spinlock_t			b_lock;
+	struct list_head		b_list;
+};
+
+struct mb_cache_stats {
+	unsigned long			s_lookups;
+	unsigned long			s_hits;
+};
+
 struct mb_cache {
 	struct list_head		c_cache_list;
 	const char			*c_name;
 	atomic_t			c_entry_count;
 	int				c_bucket_bits;
 	struct kmem_cache		*c_entry_cache;
-	struct list_head		*c_block_hash;
-	struct list_head		*c_index_hash;
+	struct mb_cache_bucket		*c_block_hash;
+	struct mb_cache_bucket		*c_index_hash;
+	spinlock_t			c_lru_lock;
+	struct list_head		c_lru_list;
+	struct mb_cache_stats __percpu	*c_stats;
 };
 
 
 /*
- * Global data: list of all mbcache's, lru list, and a spinlock for
- * accessing cache data structures on SMP machines. The lru list is
- * global across all mbcaches.
+ * Global data: list of all mbcache's and a spinlock protecting it, and
+ * the hashed locks protecting the state of cache entries.
  */
 
 static LIST_HEAD(mb_cache_list);
-static LIST_HEAD(mb_cache_lru_list);
 static DEFINE_SPINLOCK(mb_cache_spinlock);
+static struct blockgroup_lock mb_cache_entry_locks = {
+	.locks = { [0 ... NR_BG_LOCKS - 1] = {
+		.lock = __SPIN_LOCK_UNLOCKED(mb_cache_entry_locks) } }
+};
 
 /*
  * What the mbcache registers as to get shrunk dynamically.
@@ -108,6 +141,36 @@ static struct shrinker mb_cache_shrinker = {
 	.seeks = DEFAULT_SEEKS,
 };
 
+/* bgl_lock_ptr() masks the hash down to the number of locks */
+static inline spinlock_t *
+mb_cache_entry_lock(struct mb_cache_entry *ce)
+{
+	return bgl_lock_ptr(&mb_cache_entry_locks, hash_ptr(ce, 16));
+}
+
+static inline struct mb_cache_bucket *
+mb_cache_block_bucket(struct mb_cache *cache, struct block_device *bdev,
+		      sector_t block)
+{
+	return &cache->c_block_hash[hash_long((unsigned long)bdev +
+					      (block & 0xffffffff),
+					      cache->c_bucket_bits)];
+}
+
+static inline struct mb_cache_bucket *
+mb_cache_index_bucket(struct mb_cache *cache, unsigned int key)
+{
+	return &cache->c_index_hash[hash_long(key, cache->c_bucket_bits)];
+}
+
+static inline void
+mb_cache_stat_lookup(struct mb_cache *cache, int hit)
+{
+	this_cpu_inc(cache->c_stats->s_lookups);
+	if (hit)
+		this_cpu_inc(cache->c_stats->s_hits);
+}
+
 static inline int
 __mb_cache_entry_is_hashed(struct mb_cache_entry *ce)
 {
@@ -115,6 +178,7 @@ __mb_cache_entry_is_hashed(struct mb_cache_entry *ce)
 }
 
 
+/* Called with both bucket locks and the entry lock held. */
 static void
 __mb_cache_entry_unhash(struct mb_cache_entry *ce)
 {
@@ -125,6 +189,51 @@ __mb_cache_entry_unhash(struct mb_cache_entry *ce)
 }
 
 
+/*
+ * Unhashes an unused entry found on the lru list, with the lru lock
+ * held. Returns 0 without doing anything if any of the locks is
+ * contended.
+ */
+static int
+__mb_cache_entry_try_unhash(struct mb_cache_entry *ce)
+{
+	struct mb_cache_bucket *block_bucket = ce->e_block_hash_p;
+	struct mb_cache_bucket *index_bucket = ce->e_index_hash_p;
+	spinlock_t *lock = mb_cache_entry_lock(ce);
+	int ret = 0;
+
+	if (!spin_trylock(&block_bucket->b_lock))
+		return 0;
+	if (!spin_trylock(&index_bucket->b_lock))
+		goto out_block;
+	if (!spin_trylock(lock))
+		goto out_index;
+	mb_assert(!(ce->e_used || ce->e_queued));
+	__mb_cache_entry_unhash(ce);
+	spin_unlock(lock);
+	ret = 1;
+out_index:
+	spin_unlock(&index_bucket->b_lock);
+out_block:
+	spin_unlock(&block_bucket->b_lock);
+	return ret;
+}
+
+
+/* Called with the entry lock held. */
+static inline void
+__mb_cache_entry_unlru(struct mb_cache_entry *ce)
+{
+	struct mb_cache *cache = ce->e_cache;
+
+	if (!list_empty(&ce->e_lru_list)) {
+		spin_lock(&cache->c_lru_lock);
+		list_del_init(&ce->e_lru_list);
+		spin_unlock(&cache->c_lru_lock);
+	}
+}
+
+
 static void
 __mb_cache_entry_forget(struct mb_cache_entry *ce, gfp_t gfp_mask)
 {
@@ -138,8 +247,10 @@ __mb_cache_entry_forget(struct mb_cache_entry *ce, gfp_t gfp_mask)
 
 static void
 __mb_cache_entry_release_unlock(struct mb_cache_entry *ce)
-	__releases(mb_cache_spinlock)
+	__releases(mb_cache_entry_lock(ce))
 {
+	struct mb_cache *cache = ce->e_cache;
+
 	/* Wake up all processes queuing for this cache entry. */
 	if (ce->e_queued)
 		wake_up_all(&mb_cache_queue);
@@ -150,16 +261,56 @@ __mb_cache_entry_release_unlock(struct mb_cache_entry *ce)
 		if (!__mb_cache_entry_is_hashed(ce))
 			goto forget;
 		mb_assert(list_empty(&ce->e_lru_list));
-		list_add_tail(&ce->e_lru_list, &mb_cache_lru_list);
+		spin_lock(&cache->c_lru_lock);
+		list_add_tail(&ce->e_lru_list, &cache->c_lru_list);
+		spin_unlock(&cache->c_lru_lock);
 	}
-	spin_unlock(&mb_cache_spinlock);
+	spin_unlock(mb_cache_entry_lock(ce));
 	return;
 forget:
-	spin_unlock(&mb_cache_spinlock);
+	spin_unlock(mb_cache_entry_lock(ce));
 	__mb_cache_entry_forget(ce, GFP_KERNEL);
 }
 
 
+/*
+ * __mb_cache_shrink()
+ *
+ * Frees the unused entries on the lru list of a cache, or only those of
+ * one device. Entries whose locks are contended are skipped; returns the
+ * number of such entries, so that callers which must empty the cache can
+ * retry.
+ *
+ * @cache: the cache to shrink
+ * @bdev: device whose entries to free, or NULL for any device
+ * @nr_to_scan: if not NULL, number of entries to scan, updated on return
+ */
+static int
+__mb_cache_shrink(struct mb_cache *cache, struct block_device *bdev,
+		  int *nr_to_scan)
+{
+	LIST_HEAD(free_list);
+	struct mb_cache_entry *ce, *tmp;
+	int skipped = 0;
+
+	spin_lock(&cache->c_lru_lock);
+	list_for_each_entry_safe(ce, tmp, &cache->c_lru_list, e_lru_list) {
+		if (nr_to_scan && (*nr_to_scan)-- <= 0)
+			break;
+		if (bdev && ce->e_bdev != bdev)
+			continue;
+		if (__mb_cache_entry_try_unhash(ce))
+			list_move_tail(&ce->e_lru_list, &free_list);
+		else
+			skipped++;
+	}
+	spin_unlock(&cache->c_lru_lock);
+	list_for_each_entry_safe(ce, tmp, &free_list, e_lru_list)
+		__mb_cache_entry_forget(ce, GFP_KERNEL);
+	return skipped;
+}
+
+
 /*
  * mb_cache_shrink_fn()  memory pressure callback
  *
@@ -175,29 +326,19 @@ forget:
 static int
 mb_cache_shrink_fn(struct shrinker *shrink, int nr_to_scan, gfp_t gfp_mask)
 {
-	LIST_HEAD(free_list);
 	struct mb_cache *cache;
-	struct mb_cache_entry *entry, *tmp;
 	int count = 0;
 
 	mb_debug("trying to free %d entries", nr_to_scan);
 	spin_lock(&mb_cache_spinlock);
-	while (nr_to_scan-- && !list_empty(&mb_cache_lru_list)) {
-		struct mb_cache_entry *ce =
-			list_entry(mb_cache_lru_list.next,
-				   struct mb_cache_entry, e_lru_list);
-		list_move_tail(&ce->e_lru_list, &free_list);
-		__mb_cache_entry_unhash(ce);
-	}
 	list_for_each_entry(cache, &mb_cache_list, c_cache_list) {
+		if (nr_to_scan > 0)
+			__mb_cache_shrink(cache, NULL, &nr_to_scan);
 		mb_debug("cache %s (%d)", cache->c_name,
 			  atomic_read(&cache->c_entry_count));
 		count += atomic_read(&cache->c_entry_count);
 	}
 	spin_unlock(&mb_cache_spinlock);
-	list_for_each_entry_safe(entry, tmp, &free_list, e_lru_list) {
-		__mb_cache_entry_forget(entry, gfp_mask);
-	}
 	return (count / 100) * sysctl_vfs_cache_pressure;
 }
 
@@ -225,33 +366,45 @@ mb_cache_create(const char *name, int bucket_bits)
 	cache->c_name = name;
 	atomic_set(&cache->c_entry_count, 0);
 	cache->c_bucket_bits = bucket_bits;
-	cache->c_block_hash = kmalloc(bucket_count * sizeof(struct list_head),
-	                              GFP_KERNEL);
+	spin_lock_init(&cache->c_lru_lock);
+	INIT_LIST_HEAD(&cache->c_lru_list);
+	cache->c_index_hash = NULL;
+	cache->c_stats = NULL;
+	cache->c_block_hash = kmalloc(bucket_count *
+				      sizeof(struct mb_cache_bucket),
+				      GFP_KERNEL);
 	if (!cache->c_block_hash)
 		goto fail;
-	for (n=0; n<bucket_count; n++)
-		INIT_LIST_HEAD(&cache->c_block_hash[n]);
-	cache->c_index_hash = kmalloc(bucket_count * sizeof(struct list_head),
+	for (n=0; n<bucket_count; n++) {
+		spin_lock_init(&cache->c_block_hash[n].b_lock);
+		INIT_LIST_HEAD(&cache->c_block_hash[n].b_list);
+	}
+	cache->c_index_hash = kmalloc(bucket_count *
+				      sizeof(struct mb_cache_bucket),
 				      GFP_KERNEL);
 	if (!cache->c_index_hash)
 		goto fail;
-	for (n=0; n<bucket_count; n++)
-		INIT_LIST_HEAD(&cache->c_index_hash[n]);
+	for (n=0; n<bucket_count; n++) {
+		spin_lock_init(&cache->c_index_hash[n].b_lock);
+		INIT_LIST_HEAD(&cache->c_index_hash[n].b_list);
+	}
+	cache->c_stats = alloc_percpu(struct mb_cache_stats);
+	if (!cache->c_stats)
+		goto fail;
 	cache->c_entry_cache = kmem_cache_create(name,
 		sizeof(struct mb_cache_entry), 0,
 		SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD, NULL);
 	if (!cache->c_entry_cache)
-		goto fail2;
+		goto fail;
 
 	spin_lock(&mb_cache_spinlock);
 	list_add(&cache->c_cache_list, &mb_cache_list);
 	spin_unlock(&mb_cache_spinlock);
 	return cache;
 
-fail2:
-	kfree(cache->c_index_hash);
-
 fail:
+	free_percpu(cache->c_stats);
+	kfree(cache->c_index_hash);
 	kfree(cache->c_block_hash);
 	kfree(cache);
 	return NULL;
@@ -270,23 +423,14 @@ fail:
 void
 mb_cache_shrink(struct block_device *bdev)
 {
-	LIST_HEAD(free_list);
-	struct list_head *l, *ltmp;
+	struct mb_cache *cache;
 
 	spin_lock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &mb_cache_lru_list) {
-		struct mb_cache_entry *ce =
-			list_entry(l, struct mb_cache_entry, e_lru_list);
-		if (ce->e_bdev == bdev) {
-			list_move_tail(&ce->e_lru_list, &free_list);
-			__mb_cache_entry_unhash(ce);
-		}
+	list_for_each_entry(cache, &mb_cache_list, c_cache_list) {
+		while (__mb_cache_shrink(cache, bdev, NULL))
+			cpu_relax();
 	}
 	spin_unlock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &free_list) {
-		__mb_cache_entry_forget(list_entry(l, struct mb_cache_entry,
-						   e_lru_list), GFP_KERNEL);
-	}
 }
 
 
@@ -300,25 +444,12 @@ mb_cache_shrink(struct block_device *bdev)
 void
 mb_cache_destroy(struct mb_cache *cache)
 {
-	LIST_HEAD(free_list);
-	struct list_head *l, *ltmp;
-
 	spin_lock(&mb_cache_spinlock);
-	list_for_each_safe(l, ltmp, &mb_cache_lru_list) {
-		struct mb_cache_entry *ce =
-			list_entry(l, struct mb_cache_entry, e_lru_list);
-		if (ce->e_cache == cache) {
-			list_move_tail(&ce->e_lru_list, &free_list);
-			__mb_cache_entry_unhash(ce);
-		}
-	}
 	list_del(&cache->c_cache_list);
 	spin_unlock(&mb_cache_spinlock);
 
-	list_for_each_safe(l, ltmp, &free_list) {
-		__mb_cache_entry_forget(list_entry(l, struct mb_cache_entry,
-						   e_lru_list), GFP_KERNEL);
-	}
+	while (__mb_cache_shrink(cache, NULL, NULL))
+		cpu_relax();
 
 	if (atomic_read(&cache->c_entry_count) > 0) {
 		mb_error("cache %s: %d orphaned entries",
@@ -328,6 +459,7 @@ mb_cache_destroy(struct mb_cache *cache)
 
 	kmem_cache_destroy(cache->c_entry_cache);
 
+	free_percpu(cache->c_stats);
 	kfree(cache->c_index_hash);
 	kfree(cache->c_block_hash);
 	kfree(cache);
@@ -352,6 +484,8 @@ mb_cache_entry_alloc(struct mb_cache *cache, gfp_t gfp_flags)
 		atomic_inc(&cache->c_entry_count);
 		INIT_LIST_HEAD(&ce->e_lru_list);
 		INIT_LIST_HEAD(&ce->e_block_list);
+		ce->e_block_hash_p = NULL;
+		ce->e_index_hash_p = NULL;
 		ce->e_cache = cache;
 		ce->e_used = 1 + MB_CACHE_WRITER;
 		ce->e_queued = 0;
@@ -379,29 +513,34 @@ mb_cache_entry_insert(struct mb_cache_entry *ce, struct block_device *bdev,
 		      sector_t block, unsigned int key)
 {
 	struct mb_cache *cache = ce->e_cache;
-	unsigned int bucket;
+	struct mb_cache_bucket *block_bucket, *index_bucket;
 	struct list_head *l;
 	int error = -EBUSY;
 
-	bucket = hash_long((unsigned long)bdev + (block & 0xffffffff), 
-			   cache->c_bucket_bits);
-	spin_lock(&mb_cache_spinlock);
-	list_for_each_prev(l, &cache->c_block_hash[bucket]) {
+	mb_assert(!__mb_cache_entry_is_hashed(ce));
+	block_bucket = mb_cache_block_bucket(cache, bdev, block);
+	index_bucket = mb_cache_index_bucket(cache, key);
+	spin_lock(&block_bucket->b_lock);
+	list_for_each_prev(l, &block_bucket->b_list) {
 		struct mb_cache_entry *ce =
 			list_entry(l, struct mb_cache_entry, e_block_list);
 		if (ce->e_bdev == bdev && ce->e_block == block)
 			goto out;
 	}
-	__mb_cache_entry_unhash(ce);
 	ce->e_bdev = bdev;
 	ce->e_block = block;
-	list_add(&ce->e_block_list, &cache->c_block_hash[bucket]);
+	ce->e_block_hash_p = block_bucket;
 	ce->e_index.o_key = key;
-	bucket = hash_long(key, cache->c_bucket_bits);
-	list_add(&ce->e_index.o_list, &cache->c_index_hash[bucket]);
+	ce->e_index_hash_p = index_bucket;
+	spin_lock(&index_bucket->b_lock);
+	spin_lock(mb_cache_entry_lock(ce));
+	list_add(&ce->e_block_list, &block_bucket->b_list);
+	list_add(&ce->e_index.o_list, &index_bucket->b_list);
+	spin_unlock(mb_cache_entry_lock(ce));
+	spin_unlock(&index_bucket->b_lock);
 	error = 0;
 out:
-	spin_unlock(&mb_cache_spinlock);
+	spin_unlock(&block_bucket->b_lock);
 	return error;
 }
 
@@ -416,7 +555,7 @@ out:
 void
 mb_cache_entry_release(struct mb_cache_entry *ce)
 {
-	spin_lock(&mb_cache_spinlock);
+	spin_lock(mb_cache_entry_lock(ce));
 	__mb_cache_entry_release_unlock(ce);
 }
 
@@ -430,9 +569,20 @@ mb_cache_entry_release(struct mb_cache_entry *ce)
 void
 mb_cache_entry_free(struct mb_cache_entry *ce)
 {
-	spin_lock(&mb_cache_spinlock);
+	struct mb_cache_bucket *block_bucket = ce->e_block_hash_p;
+	struct mb_cache_bucket *index_bucket = ce->e_index_hash_p;
+
+	if (block_bucket) {
+		spin_lock(&block_bucket->b_lock);
+		spin_lock(&index_bucket->b_lock);
+	}
+	spin_lock(mb_cache_entry_lock(ce));
 	mb_assert(list_empty(&ce->e_lru_list));
 	__mb_cache_entry_unhash(ce);
+	if (block_bucket) {
+		spin_unlock(&index_bucket->b_lock);
+		spin_unlock(&block_bucket->b_lock);
+	}
 	__mb_cache_entry_release_unlock(ce);
 }
 
@@ -449,28 +599,30 @@ struct mb_cache_entry *
 mb_cache_entry_get(struct mb_cache *cache, struct block_device *bdev,
 		   sector_t block)
 {
-	unsigned int bucket;
+	struct mb_cache_bucket *bucket;
 	struct list_head *l;
 	struct mb_cache_entry *ce;
 
-	bucket = hash_long((unsigned long)bdev + (block & 0xffffffff),
-			   cache->c_bucket_bits);
-	spin_lock(&mb_cache_spinlock);
-	list_for_each(l, &cache->c_block_hash[bucket]) {
+	bucket = mb_cache_block_bucket(cache, bdev, block);
+	spin_lock(&bucket->b_lock);
+	list_for_each(l, &bucket->b_list) {
 		ce = list_entry(l, struct mb_cache_entry, e_block_list);
 		if (ce->e_bdev == bdev && ce->e_block == block) {
+			spinlock_t *lock = mb_cache_entry_lock(ce);
 			DEFINE_WAIT(wait);
 
-			if (!list_empty(&ce->e_lru_list))
-				list_del_init(&ce->e_lru_list);
+			/* The entry lock keeps the entry from being freed. */
+			spin_lock(lock);
+			spin_unlock(&bucket->b_lock);
+			__mb_cache_entry_unlru(ce);
 
 			while (ce->e_used > 0) {
 				ce->e_queued++;
 				prepare_to_wait(&mb_cache_queue, &wait,
 						TASK_UNINTERRUPTIBLE);
-				spin_unlock(&mb_cache_spinlock);
+				spin_unlock(lock);
 				schedule();
-				spin_lock(&mb_cache_spinlock);
+				spin_lock(lock);
 				ce->e_queued--;
 			}
 			finish_wait(&mb_cache_queue, &wait);
@@ -478,32 +630,39 @@ mb_cache_entry_get(struct mb_cache *cache, struct block_device *bdev,
 
 			if (!__mb_cache_entry_is_hashed(ce)) {
 				__mb_cache_entry_release_unlock(ce);
+				mb_cache_stat_lookup(cache, 0);
 				return NULL;
 			}
-			goto cleanup;
+			spin_unlock(lock);
+			mb_cache_stat_lookup(cache, 1);
+			return ce;
 		}
 	}
-	ce = NULL;
-
-cleanup:
-	spin_unlock(&mb_cache_spinlock);
-	return ce;
+	spin_unlock(&bucket->b_lock);
+	mb_cache_stat_lookup(cache, 0);
+	return NULL;
 }
 
 #if !defined(MB_CACHE_INDEXES_COUNT) || (MB_CACHE_INDEXES_COUNT > 0)
 
+/* Called with the index bucket lock held, which it releases. */
 static struct mb_cache_entry *
-__mb_cache_entry_find(struct list_head *l, struct list_head *head,
+__mb_cache_entry_find(struct list_head *l, struct mb_cache_bucket *bucket,
 		      struct block_device *bdev, unsigned int key)
+	__releases(bucket->b_lock)
 {
+	struct list_head *head = &bucket->b_list;
+
 	while (l != head) {
 		struct mb_cache_entry *ce =
 			list_entry(l, struct mb_cache_entry, e_index.o_list);
 		if (ce->e_bdev == bdev && ce->e_index.o_key == key) {
+			spinlock_t *lock = mb_cache_entry_lock(ce);
 			DEFINE_WAIT(wait);
 
-			if (!list_empty(&ce->e_lru_list))
-				list_del_init(&ce->e_lru_list);
+			spin_lock(lock);
+			spin_unlock(&bucket->b_lock);
+			__mb_cache_entry_unlru(ce);
 
 			/* Incrementing before holding the lock gives readers
 			   priority over writers. */
@@ -512,22 +671,23 @@ __mb_cache_entry_find(struct list_head *l, struct list_head *head,
 				ce->e_queued++;
 				prepare_to_wait(&mb_cache_queue, &wait,
 						TASK_UNINTERRUPTIBLE);
-				spin_unlock(&mb_cache_spinlock);
+				spin_unlock(lock);
 				schedule();
-				spin_lock(&mb_cache_spinlock);
+				spin_lock(lock);
 				ce->e_queued--;
 			}
 			finish_wait(&mb_cache_queue, &wait);
 
 			if (!__mb_cache_entry_is_hashed(ce)) {
 				__mb_cache_entry_release_unlock(ce);
-				spin_lock(&mb_cache_spinlock);
 				return ERR_PTR(-EAGAIN);
 			}
+			spin_unlock(lock);
 			return ce;
 		}
 		l = l->next;
 	}
+	spin_unlock(&bucket->b_lock);
 	return NULL;
 }
 
@@ -548,14 +708,14 @@ struct mb_cache_entry *
 mb_cache_entry_find_first(struct mb_cache *cache, struct block_device *bdev,
 			  unsigned int key)
 {
-	unsigned int bucket = hash_long(key, cache->c_bucket_bits);
+	struct mb_cache_bucket *bucket = mb_cache_index_bucket(cache, key);
 	struct list_head *l;
 	struct mb_cache_entry *ce;
 
-	spin_lock(&mb_cache_spinlock);
-	l = cache->c_index_hash[bucket].next;
-	ce = __mb_cache_entry_find(l, &cache->c_index_hash[bucket], bdev, key);
-	spin_unlock(&mb_cache_spinlock);
+	spin_lock(&bucket->b_lock);
+	l = bucket->b_list.next;
+	ce = __mb_cache_entry_find(l, bucket, bdev, key);
+	mb_cache_stat_lookup(cache, ce && !IS_ERR(ce));
 	return ce;
 }
 
@@ -582,28 +742,73 @@ struct mb_cache_entry *
 mb_cache_entry_find_next(struct mb_cache_entry *prev,
 			 struct block_device *bdev, unsigned int key)
 {
-	struct mb_cache *cache = prev->e_cache;
-	unsigned int bucket = hash_long(key, cache->c_bucket_bits);
+	struct mb_cache_bucket *bucket = prev->e_index_hash_p;
 	struct list_head *l;
 	struct mb_cache_entry *ce;
 
-	spin_lock(&mb_cache_spinlock);
+	spin_lock(&bucket->b_lock);
 	l = prev->e_index.o_list.next;
-	ce = __mb_cache_entry_find(l, &cache->c_index_hash[bucket], bdev, key);
-	__mb_cache_entry_release_unlock(prev);
+	ce = __mb_cache_entry_find(l, bucket, bdev, key);
+	mb_cache_entry_release(prev);
 	return ce;
 }
 
 #endif  /* !defined(MB_CACHE_INDEXES_COUNT) || (MB_CACHE_INDEXES_COUNT > 0) */
 
+#ifdef CONFIG_PROC_FS
+static int mb_cache_stats_show(struct seq_file *m, void *v)
+{
+	struct mb_cache *cache;
+
+	seq_printf(m, "%-16s %10s %12s %12s\n",
+		   "cache", "entries", "lookups", "hits");
+	spin_lock(&mb_cache_spinlock);
+	list_for_each_entry(cache, &mb_cache_list, c_cache_list) {
+		unsigned long lookups = 0, hits = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			struct mb_cache_stats *stats =
+				per_cpu_ptr(cache->c_stats, cpu);
+
+			lookups += stats->s_lookups;
+			hits += stats->s_hits;
+		}
+		seq_printf(m, "%-16s %10d %12lu %12lu\n", cache->c_name,
+			   atomic_read(&cache->c_entry_count), lookups, hits);
+	}
+	spin_unlock(&mb_cache_spinlock);
+	return 0;
+}
+
+static int mb_cache_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mb_cache_stats_show, NULL);
+}
+
+static const struct file_operations mb_cache_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mb_cache_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
 static int __init init_mbcache(void)
 {
 	register_shrinker(&mb_cache_shrinker);
+#ifdef CONFIG_PROC_FS
+	proc_create("fs/mbcache", 0, NULL, &mb_cache_stats_fops);
+#endif
 	return 0;
 }
 
 static void __exit exit_mbcache(void)
 {
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("fs/mbcache", NULL);
+#endif
 	unregister_shrinker(&mb_cache_shrinker);
 }
 
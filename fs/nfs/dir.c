@@ -21,6 +21,7 @@
 #include <linux/errno.h>
 #include <linux/stat.h>
 #include <linux/fcntl.h>
+#include <linux/file.h>
 #include <linux/string.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
@@ -519,6 +520,131 @@ int uncached_readdir(nfs_readdir_descriptor_t *desc, void *dirent,
 	goto out;
 }
 
+#define NFS_READDIR_RA_PAGES	8	/* pages read ahead of the reader */
+
+struct nfs_readdir_ra {
+	struct work_struct	work;
+	struct file		*file;
+	unsigned long		page_index;
+	int			plus;
+};
+
+/*
+ * Read the directory ahead of the reader, so that the READDIR round
+ * trips overlap with userland consuming the entries it already has.
+ * Each reply holds the cookie the next request needs, so the pages are
+ * still fetched in order, just off the getdents() path.
+ *
+ * With READDIRPLUS we prime the dentries and attributes of the new
+ * entries while they are fresh: once the reader finds the pages in
+ * the cache their attributes are no longer trusted.
+ */
+static void nfs_readdir_readahead(struct work_struct *work)
+{
+	struct nfs_readdir_ra *ra = container_of(work, struct nfs_readdir_ra, work);
+	struct file	*file = ra->file;
+	struct dentry	*parent = file->f_path.dentry;
+	struct inode	*inode = parent->d_inode;
+	nfs_readdir_descriptor_t my_desc,
+			*desc = &my_desc;
+	struct nfs_entry my_entry;
+	struct dentry	*dentry;
+	struct page	*page;
+	unsigned long	index;
+	u64		dir_cookie = 0;
+	int		status;
+
+	memset(desc, 0, sizeof(*desc));
+	desc->file = file;
+	desc->dir_cookie = &dir_cookie;
+	desc->decode = NFS_PROTO(inode)->decode_dirent;
+	desc->plus = ra->plus;
+
+	my_entry.cookie = my_entry.prev_cookie = 0;
+	my_entry.eof = 0;
+	my_entry.fh = nfs_alloc_fhandle();
+	my_entry.fattr = nfs_alloc_fattr();
+	if (my_entry.fh == NULL || my_entry.fattr == NULL)
+		goto out_free;
+	desc->entry = &my_entry;
+
+	nfs_block_sillyrename(parent);
+
+	for (index = ra->page_index;
+	     index < ra->page_index + NFS_READDIR_RA_PAGES; index++) {
+		/*
+		 * Take i_mutex one page at a time, so that the reader can
+		 * consume each page as soon as we have it.
+		 */
+		mutex_lock(&inode->i_mutex);
+		if (NFS_I(inode)->cache_validity & NFS_INO_INVALID_DATA) {
+			mutex_unlock(&inode->i_mutex);
+			break;
+		}
+		desc->timestamp_valid = 0;
+		if (index == ra->page_index) {
+			/* The reader's page: only walked for its last cookie */
+			page = find_get_page(inode->i_mapping, index);
+			if (page != NULL && !PageUptodate(page)) {
+				page_cache_release(page);
+				page = NULL;
+			}
+		} else {
+			page = read_cache_page(inode->i_mapping, index,
+					       (filler_t *)nfs_readdir_filler, desc);
+			if (IS_ERR(page))
+				page = NULL;
+		}
+		if (page == NULL) {
+			mutex_unlock(&inode->i_mutex);
+			break;
+		}
+
+		desc->page = page;
+		desc->ptr = kmap(page);
+		while ((status = dir_decode(desc)) == 0) {
+			if (!desc->timestamp_valid || !desc->plus)
+				continue;
+			dentry = nfs_readdir_lookup(desc);
+			if (dentry != NULL)
+				dput(dentry);
+		}
+		dir_page_release(desc);
+		mutex_unlock(&inode->i_mutex);
+		if (status != -EAGAIN)
+			break;
+	}
+
+	nfs_unblock_sillyrename(parent);
+out_free:
+	nfs_free_fattr(my_entry.fattr);
+	nfs_free_fhandle(my_entry.fh);
+	clear_bit(NFS_INO_READDIR_AHEAD, &NFS_I(inode)->flags);
+	fput(file);
+	kfree(ra);
+}
+
+static void nfs_readdir_start_readahead(nfs_readdir_descriptor_t *desc)
+{
+	struct inode	*inode = desc->file->f_path.dentry->d_inode;
+	struct nfs_readdir_ra *ra;
+
+	if (test_and_set_bit(NFS_INO_READDIR_AHEAD, &NFS_I(inode)->flags))
+		return;
+
+	ra = kmalloc(sizeof(*ra), GFP_KERNEL);
+	if (ra == NULL) {
+		clear_bit(NFS_INO_READDIR_AHEAD, &NFS_I(inode)->flags);
+		return;
+	}
+	INIT_WORK(&ra->work, nfs_readdir_readahead);
+	get_file(desc->file);
+	ra->file = desc->file;
+	ra->page_index = desc->page_index;
+	ra->plus = desc->plus;
+	queue_work(nfs_readdir_workqueue, &ra->work);
+}
+
 /* The file offset position represents the dirent entry number.  A
    last cookie cache takes care of the common case of reading the
    whole directory.
@@ -594,6 +720,9 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 			break;
 		}
 	}
+	/* The user buffer is full: fetch what the next call will want */
+	if (res == 0 && !desc->entry->eof)
+		nfs_readdir_start_readahead(desc);
 out:
 	nfs_unblock_sillyrename(dentry);
 	if (res > 0)
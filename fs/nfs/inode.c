@@ -1485,9 +1485,11 @@ static void nfs_destroy_inodecache(void)
 }
 
 struct workqueue_struct *nfsiod_workqueue;
+struct workqueue_struct *nfs_readdir_workqueue;
 
 /*
- * start up the nfsiod workqueue
+ * start up the nfsiod workqueues.  Directory readahead issues synchronous
+ * RPCs, so it gets its own queue instead of holding up nfsiod.
  */
 static int nfsiod_start(void)
 {
@@ -1497,6 +1499,13 @@ static int nfsiod_start(void)
 	if (wq == NULL)
 		return -ENOMEM;
 	nfsiod_workqueue = wq;
+	wq = create_workqueue("nfsreaddir");
+	if (wq == NULL) {
+		destroy_workqueue(nfsiod_workqueue);
+		nfsiod_workqueue = NULL;
+		return -ENOMEM;
+	}
+	nfs_readdir_workqueue = wq;
 	return 0;
 }
 
@@ -1507,6 +1516,11 @@ static void nfsiod_stop(void)
 {
 	struct workqueue_struct *wq;
 
+	wq = nfs_readdir_workqueue;
+	if (wq != NULL) {
+		nfs_readdir_workqueue = NULL;
+		destroy_workqueue(wq);
+	}
 	wq = nfsiod_workqueue;
 	if (wq == NULL)
 		return;
@@ -74,6 +74,7 @@ struct nfs_parsed_mount_data {
 	int			namlen;
 	unsigned int		options;
 	unsigned int		bsize;
+	unsigned int		nconnect;
 	unsigned int		auth_flavor_len;
 	rpc_authflavor_t	auth_flavors[1];
 	char			*client_address;
@@ -210,6 +211,7 @@ extern int nfs_access_cache_shrinker(struct shrinker *shrink,
 
 /* inode.c */
 extern struct workqueue_struct *nfsiod_workqueue;
+extern struct workqueue_struct *nfs_readdir_workqueue;
 extern struct inode *nfs_alloc_inode(struct super_block *sb);
 extern void nfs_destroy_inode(struct inode *);
 extern int nfs_write_inode(struct inode *, struct writeback_control *);
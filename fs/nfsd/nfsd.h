@@ -67,6 +67,7 @@ void nfsd_reset_versions(void);
 int nfsd_create_serv(void);
 
 extern int nfsd_max_blksize;
+extern int nfsd_max_threads;
 
 static inline int nfsd_v4client(struct svc_rqst *rq)
 {
@@ -170,6 +170,102 @@ int nfsd_minorversion(u32 minorversion, enum vers_op change)
  */
 #define	NFSD_MAXSERVS		8192
 
+/*
+ * Threads started on demand, see write_maxthreads(), go away again
+ * after idling this long.
+ */
+#define	NFSD_SPARE_IDLE		(30*HZ)
+
+/*
+ * nfsd_max_threads caps on-demand growth; nfsd_wanted_threads is what
+ * the admin last asked for, so that a server being stopped is not
+ * grown again behind its back.  Both are protected by nfsd_mutex.
+ */
+int nfsd_max_threads;
+static int nfsd_wanted_threads;
+
+static void nfsd_grow_pools(struct work_struct *work)
+{
+	struct svc_pool *pool;
+	int starved, i;
+
+	mutex_lock(&nfsd_mutex);
+	if (nfsd_serv == NULL || nfsd_wanted_threads == 0)
+		goto out;
+
+	svc_get(nfsd_serv);
+	for (i = 0; i < nfsd_serv->sv_nrpools; i++) {
+		/* The -1 is for our reference */
+		if (nfsd_serv->sv_nrthreads - 1 >=
+		    min(nfsd_max_threads, NFSD_MAXSERVS))
+			break;
+
+		pool = &nfsd_serv->sv_pools[i];
+		spin_lock_bh(&pool->sp_lock);
+		starved = !list_empty(&pool->sp_sockets);
+		spin_unlock_bh(&pool->sp_lock);
+		if (!starved)
+			continue;
+
+		if (svc_set_num_threads(nfsd_serv, pool,
+					pool->sp_nrthreads + 1))
+			continue;
+		spin_lock_bh(&pool->sp_lock);
+		pool->sp_nrspare++;
+		spin_unlock_bh(&pool->sp_lock);
+	}
+	svc_destroy(nfsd_serv);
+out:
+	mutex_unlock(&nfsd_mutex);
+}
+
+static DECLARE_WORK(nfsd_grow_work, nfsd_grow_pools);
+
+/*
+ * Called by svc_xprt_enqueue() with softirqs off when a request has to
+ * wait for a thread.  One more thread is started per starved pool and
+ * run of the work, further requests queueing will ask for another.
+ */
+static void nfsd_pool_starved(struct svc_pool *pool)
+{
+	if (nfsd_max_threads)
+		schedule_work(&nfsd_grow_work);
+}
+
+/*
+ * An idle thread retires in the place of an on-demand one: which one
+ * of them goes doesn't matter.
+ */
+static bool nfsd_retire_spare(struct svc_pool *pool)
+{
+	bool retire = false;
+
+	spin_lock_bh(&pool->sp_lock);
+	if (pool->sp_nrspare) {
+		pool->sp_nrspare--;
+		retire = true;
+	}
+	spin_unlock_bh(&pool->sp_lock);
+	return retire;
+}
+
+/*
+ * The admin sets the baseline: threads started on demand before are
+ * from then on counted as part of it.
+ */
+static void nfsd_reset_spares(void)
+{
+	struct svc_pool *pool;
+	int i;
+
+	for (i = 0; i < nfsd_serv->sv_nrpools; i++) {
+		pool = &nfsd_serv->sv_pools[i];
+		spin_lock_bh(&pool->sp_lock);
+		pool->sp_nrspare = 0;
+		spin_unlock_bh(&pool->sp_lock);
+	}
+}
+
 int nfsd_nrthreads(void)
 {
 	int rv = 0;
@@ -334,6 +430,7 @@ int nfsd_create_serv(void)
 				      nfsd_last_thread, nfsd, THIS_MODULE);
 	if (nfsd_serv == NULL)
 		return -ENOMEM;
+	nfsd_serv->sv_starved = nfsd_pool_starved;
 
 	set_max_drc();
 	do_gettimeofday(&nfssvc_boot);		/* record boot time */
@@ -401,6 +498,11 @@ int nfsd_set_nrthreads(int n, int *nthreads)
 	if (nthreads[0] == 0)
 		nthreads[0] = 1;
 
+	nfsd_wanted_threads = 0;
+	for (i = 0; i < n; i++)
+		nfsd_wanted_threads += nthreads[i];
+	nfsd_reset_spares();
+
 	/* apply the new numbers */
 	svc_get(nfsd_serv);
 	for (i = 0; i < n; i++) {
@@ -431,6 +533,7 @@ nfsd_svc(unsigned short port, int nrservs)
 		nrservs = 0;
 	if (nrservs > NFSD_MAXSERVS)
 		nrservs = NFSD_MAXSERVS;
+	nfsd_wanted_threads = nrservs;
 	error = 0;
 	if (nrservs == 0 && nfsd_serv == NULL)
 		goto out;
@@ -438,6 +541,7 @@ nfsd_svc(unsigned short port, int nrservs)
 	error = nfsd_create_serv();
 	if (error)
 		goto out;
+	nfsd_reset_spares();
 
 	nfsd_up_before = nfsd_up;
 
@@ -470,6 +574,9 @@ static int
 nfsd(void *vrqstp)
 {
 	struct svc_rqst *rqstp = (struct svc_rqst *) vrqstp;
+	struct svc_pool *pool = rqstp->rq_pool;
+	unsigned long idle;
+	long timeout;
 	int err, preverr = 0;
 
 	/* Lock module and set up kernel thread */
@@ -513,8 +620,15 @@ nfsd(void *vrqstp)
 		 * Find a socket with data available and call its
 		 * recvfrom routine.
 		 */
-		while ((err = svc_recv(rqstp, 60*60*HZ)) == -EAGAIN)
-			;
+		idle = jiffies;
+		timeout = pool->sp_nrspare ? NFSD_SPARE_IDLE : 60*60*HZ;
+		err = svc_recv(rqstp, timeout);
+		if (err == -EAGAIN) {
+			if (time_after_eq(jiffies, idle + timeout) &&
+			    nfsd_retire_spare(pool))
+				break;
+			continue;
+		}
 		if (err == -EINTR)
 			break;
 		else if (err < 0) {
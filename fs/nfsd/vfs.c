@@ -1037,7 +1037,13 @@ nfsd_vfs_write(struct svc_rqst *rqstp, struct svc_fh *fhp, struct file *file,
 		spin_unlock(&file->f_lock);
 	}
 
-	/* Write the data. */
+	/*
+	 * Write the data.  Unlike reads, which splice page cache pages
+	 * straight into the reply, this copies out of rq_pages: handing
+	 * those pages to the page cache instead would skip ->write_begin
+	 * and ->write_end, which is where the filesystem allocates blocks,
+	 * attaches buffers and journals the write.
+	 */
 	oldfs = get_fs(); set_fs(KERNEL_DS);
 	host_err = vfs_writev(file, (struct iovec __user *)vec, vlen, &offset);
 	set_fs(oldfs);
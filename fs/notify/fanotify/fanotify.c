@@ -30,18 +30,23 @@ static bool should_merge(struct fsnotify_event *old, struct fsnotify_event *new)
 	return false;
 }
 
-/* and the list better be locked by something too! */
-static struct fsnotify_event *fanotify_merge(struct list_head *list,
+/*
+ * only events for the same inode can merge, so just search those; the newest
+ * are first in the hash chain.  notification_mutex is held by the caller.
+ */
+static struct fsnotify_event *fanotify_merge(struct fsnotify_group *group,
 					     struct fsnotify_event *event)
 {
 	struct fsnotify_event_holder *test_holder;
 	struct fsnotify_event *test_event = NULL;
 	struct fsnotify_event *new_event;
+	struct hlist_node *pos;
 
-	pr_debug("%s: list=%p event=%p\n", __func__, list, event);
-
+	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
 
-	list_for_each_entry_reverse(test_holder, list, event_list) {
+	hlist_for_each_entry(test_holder, pos,
+			     fsnotify_notify_hash(group, event->to_tell),
+			     hash_node) {
 		if (should_merge(test_holder->event, event)) {
 			test_event = test_holder->event;
 			break;
@@ -77,6 +77,7 @@ void fsnotify_put_group(struct fsnotify_group *group)
 struct fsnotify_group *fsnotify_alloc_group(const struct fsnotify_ops *ops)
 {
 	struct fsnotify_group *group;
+	int i;
 
 	group = kzalloc(sizeof(struct fsnotify_group), GFP_KERNEL);
 	if (!group)
@@ -92,6 +93,8 @@ struct fsnotify_group *fsnotify_alloc_group(const struct fsnotify_ops *ops)
 
 	mutex_init(&group->notification_mutex);
 	INIT_LIST_HEAD(&group->notification_list);
+	for (i = 0; i < FSNOTIFY_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&group->notification_hash[i]);
 	init_waitqueue_head(&group->notification_waitq);
 	group->max_events = UINT_MAX;
 
@@ -68,9 +68,14 @@ static bool event_compare(struct fsnotify_event *old, struct fsnotify_event *new
 	return false;
 }
 
-static struct fsnotify_event *inotify_merge(struct list_head *list,
+/*
+ * inotify only merges with the last queued event: merging with an older one
+ * would reorder events as seen by userspace
+ */
+static struct fsnotify_event *inotify_merge(struct fsnotify_group *group,
 					    struct fsnotify_event *event)
 {
+	struct list_head *list = &group->notification_list;
 	struct fsnotify_event_holder *last_holder;
 	struct fsnotify_event *last_event;
 
@@ -32,6 +32,7 @@
  */
 
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
@@ -132,6 +133,19 @@ struct fsnotify_event_private_data *fsnotify_remove_priv_from_event(struct fsnot
 	return priv;
 }
 
+/*
+ * Events queued on a group are also hashed by the inode they are about, so
+ * that a group can find the pending events it may merge a new one with
+ * without walking the whole queue.
+ */
+struct hlist_head *fsnotify_notify_hash(struct fsnotify_group *group,
+					struct inode *to_tell)
+{
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+
+	return &group->notification_hash[hash_ptr(to_tell, FSNOTIFY_HASH_BITS)];
+}
+
 /*
  * Add an event to the group notification queue.  The group can later pull this
  * event off the queue to deal with.  If the event is successfully added to the
@@ -139,12 +153,13 @@ struct fsnotify_event_private_data *fsnotify_remove_priv_from_event(struct fsnot
  */
 struct fsnotify_event *fsnotify_add_notify_event(struct fsnotify_group *group, struct fsnotify_event *event,
 						 struct fsnotify_event_private_data *priv,
-						 struct fsnotify_event *(*merge)(struct list_head *,
+						 struct fsnotify_event *(*merge)(struct fsnotify_group *,
 										 struct fsnotify_event *))
 {
 	struct fsnotify_event *return_event = NULL;
 	struct fsnotify_event_holder *holder = NULL;
 	struct list_head *list = &group->notification_list;
+	bool was_empty;
 
 	pr_debug("%s: group=%p event=%p priv=%p\n", __func__, group, event, priv);
 
@@ -182,7 +197,7 @@ alloc_holder:
 	if (!list_empty(list) && merge) {
 		struct fsnotify_event *tmp;
 
-		tmp = merge(list, event);
+		tmp = merge(group, event);
 		if (tmp) {
 			mutex_unlock(&group->notification_mutex);
 
@@ -218,13 +233,23 @@ alloc_holder:
 	holder->event = event;
 
 	fsnotify_get_event(event);
+	was_empty = list_empty(list);
 	list_add_tail(&holder->event_list, list);
+	hlist_add_head(&holder->hash_node,
+		       fsnotify_notify_hash(group, event->to_tell));
 	if (priv)
 		list_add_tail(&priv->event_list, &event->private_data_list);
 	spin_unlock(&event->lock);
 	mutex_unlock(&group->notification_mutex);
 
-	wake_up(&group->notification_waitq);
+	/*
+	 * Readers only sleep on an empty queue, and drain what they find once
+	 * woken, so only the event that makes the queue non-empty needs to
+	 * wake them.  This saves a wakeup per event when events arrive in
+	 * bulk.
+	 */
+	if (was_empty)
+		wake_up(&group->notification_waitq);
 	return return_event;
 }
 
@@ -249,6 +274,7 @@ struct fsnotify_event *fsnotify_remove_notify_event(struct fsnotify_group *group
 	spin_lock(&event->lock);
 	holder->event = NULL;
 	list_del_init(&holder->event_list);
+	hlist_del_init(&holder->hash_node);
 	spin_unlock(&event->lock);
 
 	/* event == holder means we are referenced through the in event holder */
@@ -304,6 +330,7 @@ void fsnotify_flush_notify(struct fsnotify_group *group)
 static void initialize_event(struct fsnotify_event *event)
 {
 	INIT_LIST_HEAD(&event->holder.event_list);
+	INIT_HLIST_NODE(&event->holder.hash_node);
 	atomic_set(&event->refcnt, 1);
 
 	spin_lock_init(&event->lock);
@@ -340,6 +367,8 @@ int fsnotify_replace_event(struct fsnotify_event_holder *old_holder,
 
 	new_holder->event = new_event;
 	list_replace_init(&old_holder->event_list, &new_holder->event_list);
+	hlist_add_before(&new_holder->hash_node, &old_holder->hash_node);
+	hlist_del_init(&old_holder->hash_node);
 
 	spin_unlock(&new_event->lock);
 	spin_unlock(&old_event->lock);
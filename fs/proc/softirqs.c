@@ -4,7 +4,8 @@
 #include <linux/seq_file.h>
 
 /*
- * /proc/softirqs  ... display the number of softirqs
+ * /proc/softirqs  ... display the number of softirqs, then the
+ * time spent in them in microseconds
  */
 static int show_softirqs(struct seq_file *p, void *v)
 {
@@ -21,6 +22,16 @@ static int show_softirqs(struct seq_file *p, void *v)
 			seq_printf(p, " %10u", kstat_softirqs_cpu(i, j));
 		seq_printf(p, "\n");
 	}
+
+	seq_printf(p, "\n");
+	for (i = 0; i < NR_SOFTIRQS; i++) {
+		seq_printf(p, "%8s:", softirq_to_name[i]);
+		for_each_possible_cpu(j)
+			seq_printf(p, " %10llu", (unsigned long long)
+				   div_u64(kstat_softirq_time_cpu(i, j),
+					   NSEC_PER_USEC));
+		seq_printf(p, " us\n");
+	}
 	return 0;
 }
 
@@ -59,6 +59,12 @@ void task_mem(struct seq_file *m, struct mm_struct *mm)
 		mm->stack_vm << (PAGE_SHIFT-10), text, lib,
 		(PTRS_PER_PTE*sizeof(pte_t)*mm->nr_ptes) >> 10,
 		swap << (PAGE_SHIFT-10));
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+	seq_printf(m,
+		"NumaLocal:\t%8lu\n"
+		"NumaRemote:\t%8lu\n",
+		mm->numa_samples_local, mm->numa_samples_remote);
+#endif
 }
 
 unsigned long task_vsize(struct mm_struct *mm)
@@ -108,7 +114,7 @@ static void *m_start(struct seq_file *m, loff_t *pos)
 
 	/*
 	 * We remember last_addr rather than next_addr to hit with
-	 * mmap_cache most of the time. We have zero last_addr at
+	 * vmacache most of the time. We have zero last_addr at
 	 * the beginning and also after lseek. We will have -1 last_addr
 	 * after the end of the vmas.
 	 */
@@ -76,6 +76,7 @@
 #include <linux/buffer_head.h>
 #include <linux/capability.h>
 #include <linux/quotaops.h>
+#include <linux/percpu.h>
 #include <linux/writeback.h> /* for inode_lock, oddly enough.. */
 
 #include <asm/uaccess.h>
@@ -93,6 +94,12 @@
  * The spinlock ordering is hence: dq_data_lock > dq_list_lock > i_lock,
  *   dq_list_lock > dq_state_lock
  *
+ * Space changes of dirty dquots which are far from their limits are cached
+ * per cpu, under the lock of that cpu's dquot_pcpu_cache, and only folded
+ * into dq_dqb under dq_data_lock in batches.  So the cache locks rank above
+ * dq_data_lock, and anybody reading the space usage of a dquot must call
+ * dquot_sync_cached() before taking dq_data_lock.
+ *
  * Note that some things (eg. sb pointer, type, id) doesn't change during
  * the life of the dquot structure and so needn't to be protected by a lock
  *
@@ -394,6 +401,219 @@ void mark_info_dirty(struct super_block *sb, int type)
 }
 EXPORT_SYMBOL(mark_info_dirty);
 
+/*
+ * Per-cpu caches of space changes.  Each cpu keeps the pending changes of
+ * the last few dquots it touched and folds them into dq_dqb once they add up
+ * to DQUOT_PCPU_BATCH bytes, or when the slot is needed for another dquot.
+ * Only dquots which are already dirty are cached, so the fs only learns
+ * about the change when the dquot is written back, and dquot_commit()
+ * syncs the caches before it writes.  Filesystems that write dquots from
+ * ->mark_dirty never leave them dirty and are not affected.
+ */
+#define DQUOT_PCPU_SLOTS	4
+#define DQUOT_PCPU_BATCH	(256 << 10)
+
+struct dquot_pcpu_slot {
+	struct dquot *dquot;
+	qsize_t space;		/* pending change of dqb_curspace */
+	qsize_t rsv;		/* pending change of dqb_rsvspace */
+};
+
+struct dquot_pcpu_cache {
+	spinlock_t lock;
+	unsigned int next;	/* next slot to evict */
+	struct dquot_pcpu_slot slot[DQUOT_PCPU_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct dquot_pcpu_cache, dquot_pcpu_cache);
+
+/*
+ * How far the space usage read from dq_dqb without dq_data_lock can be from
+ * the real one: the changes cached on each cpu, plus one change in flight on
+ * each cpu.  Set up in dquot_init().
+ */
+static qsize_t dquot_pcpu_slack __read_mostly;
+
+static inline qsize_t dquot_abs(qsize_t val)
+{
+	return val < 0 ? -val : val;
+}
+
+/* Fold the changes cached in @slot into its dquot.  Needs the cache lock. */
+static void dquot_pcpu_drain(struct dquot_pcpu_slot *slot)
+{
+	if (!slot->space && !slot->rsv)
+		return;
+	spin_lock(&dq_data_lock);
+	slot->dquot->dq_dqb.dqb_curspace += slot->space;
+	slot->dquot->dq_dqb.dqb_rsvspace += slot->rsv;
+	spin_unlock(&dq_data_lock);
+	slot->space = slot->rsv = 0;
+}
+
+static void dquot_pcpu_add(struct dquot_pcpu_cache *cache,
+			   struct dquot *dquot, qsize_t space, qsize_t rsv)
+{
+	struct dquot_pcpu_slot *slot = NULL;
+	int i;
+
+	for (i = 0; i < DQUOT_PCPU_SLOTS; i++) {
+		if (cache->slot[i].dquot == dquot) {
+			slot = &cache->slot[i];
+			goto found;
+		}
+		if (!slot && !cache->slot[i].dquot)
+			slot = &cache->slot[i];
+	}
+	if (!slot) {
+		slot = &cache->slot[cache->next++ % DQUOT_PCPU_SLOTS];
+		dquot_pcpu_drain(slot);
+	}
+	slot->dquot = dquot;
+	if (!test_bit(DQ_PCPU_B, &dquot->dq_flags))
+		set_bit(DQ_PCPU_B, &dquot->dq_flags);
+found:
+	slot->space += space;
+	slot->rsv += rsv;
+	if (dquot_abs(slot->space) + dquot_abs(slot->rsv) >= DQUOT_PCPU_BATCH)
+		dquot_pcpu_drain(slot);
+}
+
+/*
+ * Fold the changes of @dquot cached on all cpus into dq_dqb.  Must not be
+ * called under dq_data_lock.
+ */
+static void dquot_sync_cached(struct dquot *dquot)
+{
+	struct dquot_pcpu_cache *cache;
+	struct dquot_pcpu_slot *slot;
+	qsize_t space = 0, rsv = 0;
+	int cpu, i;
+
+	if (!test_bit(DQ_PCPU_B, &dquot->dq_flags))
+		return;
+	clear_bit(DQ_PCPU_B, &dquot->dq_flags);
+	smp_mb__after_clear_bit();
+
+	for_each_possible_cpu(cpu) {
+		cache = &per_cpu(dquot_pcpu_cache, cpu);
+		spin_lock(&cache->lock);
+		for (i = 0; i < DQUOT_PCPU_SLOTS; i++) {
+			slot = &cache->slot[i];
+			if (slot->dquot != dquot)
+				continue;
+			space += slot->space;
+			rsv += slot->rsv;
+			slot->dquot = NULL;
+			slot->space = slot->rsv = 0;
+		}
+		spin_unlock(&cache->lock);
+	}
+
+	if (space || rsv) {
+		spin_lock(&dq_data_lock);
+		dquot->dq_dqb.dqb_curspace += space;
+		dquot->dq_dqb.dqb_rsvspace += rsv;
+		spin_unlock(&dq_data_lock);
+	}
+}
+
+static void dquot_sync_cached_all(struct dquot * const *dquot)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (dquot[cnt])
+			dquot_sync_cached(dquot[cnt]);
+}
+
+/*
+ * Can the change of @space to dqb_curspace and @rsv to dqb_rsvspace be done
+ * without looking at the exact usage?  That is, it can neither hit a limit
+ * nor issue a warning nor have to clamp the usage, whatever the cached
+ * changes are.
+ */
+static bool dquot_change_is_safe(struct dquot *dquot, qsize_t space,
+				 qsize_t rsv)
+{
+	struct mem_dqblk *dm = &dquot->dq_dqb;
+	qsize_t slack = dquot_pcpu_slack;
+	qsize_t cur = ACCESS_ONCE(dm->dqb_curspace);
+	qsize_t res = ACCESS_ONCE(dm->dqb_rsvspace);
+	qsize_t soft = ACCESS_ONCE(dm->dqb_bsoftlimit);
+	qsize_t hard = ACCESS_ONCE(dm->dqb_bhardlimit);
+	int fake = test_bit(DQ_FAKE_B, &dquot->dq_flags);
+
+	if (!dquot_dirty(dquot) || test_bit(DQ_BLKS_B, &dquot->dq_flags) ||
+	    ACCESS_ONCE(dm->dqb_btime))
+		return false;
+
+	if (space + rsv > 0 && !fake &&
+	    sb_has_quota_limits_enabled(dquot->dq_sb, dquot->dq_type)) {
+		qsize_t tspace = cur + res + 2 * slack + space + rsv;
+
+		if ((hard && tspace > hard) || (soft && tspace > soft))
+			return false;
+	}
+
+	if (space + rsv < 0 && !fake) {
+		/* See info_bdq_free() */
+		if (soft ? (cur + slack > soft) :
+		    (cur - slack + space + rsv <= 0 ||
+		     (hard && cur + slack >= hard)))
+			return false;
+	}
+
+	if (rsv < 0 && res - slack < -rsv)
+		return false;
+	if (space < 0 && cur - slack < -space &&
+	    !(sb_dqopt(dquot->dq_sb)->flags & DQUOT_NEGATIVE_USAGE))
+		return false;
+
+	return true;
+}
+
+/*
+ * Account a space change of the inode's dquots in this cpu's cache if that
+ * is safe for all of them.  Returns false if the caller has to do it the
+ * exact way under dq_data_lock.  Needs dqptr_sem.
+ */
+static bool dquot_cache_space(struct dquot * const *dquot, qsize_t space,
+			      qsize_t rsv)
+{
+	struct dquot_pcpu_cache *cache;
+	int cnt;
+
+	/* The unlocked reads of 64-bit usage could tear */
+	if (BITS_PER_LONG < 64)
+		return false;
+	if (dquot_abs(space) + dquot_abs(rsv) >= DQUOT_PCPU_BATCH)
+		return false;
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (dquot[cnt] && !dquot_change_is_safe(dquot[cnt], space, rsv))
+			return false;
+
+	cache = &get_cpu_var(dquot_pcpu_cache);
+	spin_lock(&cache->lock);
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (dquot[cnt])
+			dquot_pcpu_add(cache, dquot[cnt], space, rsv);
+	spin_unlock(&cache->lock);
+	put_cpu_var(dquot_pcpu_cache);
+
+	/*
+	 * If the dquot got written meanwhile, it might have been before our
+	 * change was cached: dirty it again.  Pairs with the barrier in
+	 * clear_dquot_dirty().
+	 */
+	smp_mb();
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (dquot[cnt] && !dquot_dirty(dquot[cnt]))
+			mark_dquot_dirty(dquot[cnt]);
+
+	return true;
+}
+
 /*
  *	Read dquot from disk and alloc space for it
  */
@@ -448,6 +668,7 @@ int dquot_commit(struct dquot *dquot)
 		goto out_sem;
 	}
 	spin_unlock(&dq_list_lock);
+	dquot_sync_cached(dquot);
 	/* Inactive dquot can be only if there was error during read/init
 	 * => we have better not writing it */
 	if (test_bit(DQ_ACTIVE_B, &dquot->dq_flags)) {
@@ -477,6 +698,7 @@ int dquot_release(struct dquot *dquot)
 	/* Check whether we are not racing with some other dqget() */
 	if (atomic_read(&dquot->dq_count) > 1)
 		goto out_dqlock;
+	dquot_sync_cached(dquot);
 	mutex_lock(&dqopt->dqio_mutex);
 	if (dqopt->ops[dquot->dq_type]->release_dqblk) {
 		ret = dqopt->ops[dquot->dq_type]->release_dqblk(dquot);
@@ -1548,9 +1770,16 @@ int __dquot_alloc_space(struct inode *inode, qsize_t number, int flags)
 	}
 
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_cache_space(inode->i_dquot, reserve ? 0 : number,
+			      reserve ? number : 0)) {
+		inode_incr_space(inode, number, reserve);
+		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+		goto out;
+	}
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
 		warntype[cnt] = QUOTA_NL_NOWARN;
 
+	dquot_sync_cached_all(inode->i_dquot);
 	spin_lock(&dq_data_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (!inode->i_dquot[cnt])
@@ -1637,6 +1866,12 @@ int dquot_claim_space_nodirty(struct inode *inode, qsize_t number)
 	}
 
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_cache_space(inode->i_dquot, number, -number)) {
+		inode_claim_rsv_space(inode, number);
+		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+		return 0;
+	}
+	dquot_sync_cached_all(inode->i_dquot);
 	spin_lock(&dq_data_lock);
 	/* Claim reserved quotas to allocated quotas */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
@@ -1670,6 +1905,13 @@ void __dquot_free_space(struct inode *inode, qsize_t number, int flags)
 	}
 
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_cache_space(inode->i_dquot, reserve ? 0 : -number,
+			      reserve ? -number : 0)) {
+		inode_decr_space(inode, number, reserve);
+		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+		return;
+	}
+	dquot_sync_cached_all(inode->i_dquot);
 	spin_lock(&dq_data_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (!inode->i_dquot[cnt])
@@ -1751,6 +1993,8 @@ int __dquot_transfer(struct inode *inode, struct dquot **transfer_to)
 		up_write(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		return 0;
 	}
+	dquot_sync_cached_all(inode->i_dquot);
+	dquot_sync_cached_all(transfer_to);
 	spin_lock(&dq_data_lock);
 	cur_space = inode_get_bytes(inode);
 	rsv_space = inode_get_rsv_space(inode);
@@ -2308,6 +2552,7 @@ static void do_get_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 			FS_USER_QUOTA : FS_GROUP_QUOTA;
 	di->d_id = dquot->dq_id;
 
+	dquot_sync_cached(dquot);
 	spin_lock(&dq_data_lock);
 	di->d_blk_hardlimit = stoqb(dm->dqb_bhardlimit);
 	di->d_blk_softlimit = stoqb(dm->dqb_bsoftlimit);
@@ -2360,6 +2605,7 @@ static int do_set_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 	     (di->d_ino_hardlimit > dqi->dqi_maxilimit)))
 		return -ERANGE;
 
+	dquot_sync_cached(dquot);
 	spin_lock(&dq_data_lock);
 	if (di->d_fieldmask & FS_DQ_BCOUNT) {
 		dm->dqb_curspace = di->d_bcount - dm->dqb_rsvspace;
@@ -2620,6 +2866,10 @@ static int __init dquot_init(void)
 
 	register_sysctl_table(sys_table);
 
+	for_each_possible_cpu(i)
+		spin_lock_init(&per_cpu(dquot_pcpu_cache, i).lock);
+	dquot_pcpu_slack = 2 * (qsize_t)num_possible_cpus() * DQUOT_PCPU_BATCH;
+
 	dquot_cachep = kmem_cache_create("dquot",
 			sizeof(struct dquot), sizeof(unsigned long) * 4,
 			(SLAB_HWCACHE_ALIGN|SLAB_RECLAIM_ACCOUNT|
@@ -684,7 +684,7 @@ static int submit_barrier_buffer(struct buffer_head *bh)
 	clear_buffer_dirty(bh);
 	if (!buffer_uptodate(bh))
 		BUG();
-	return submit_bh(WRITE_BARRIER, bh);
+	return submit_bh(WRITE_FLUSH_FUA, bh);
 }
 
 static void check_barrier_completion(struct super_block *s,
@@ -22,7 +22,10 @@
  */
 
 #include <linux/types.h>
-#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
 #include <linux/buffer_head.h>
 
 #include "squashfs_fs.h"
@@ -72,3 +75,145 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 
 	return decompressor[i];
 }
+
+
+/*
+ * Each filesystem keeps a pool of decompressor streams, so that blocks
+ * can be decompressed in parallel.  The pool starts with one stream and
+ * grows on demand up to two streams per online cpu; readers wait for a
+ * stream to be returned when the pool is exhausted, or when allocating
+ * another stream fails.
+ */
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_stream_pool {
+	spinlock_t		lock;
+	struct list_head	free;
+	int			total;
+	int			max;
+	wait_queue_head_t	wait;
+};
+
+
+static struct squashfs_stream *squashfs_stream_alloc(
+	struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (s == NULL)
+		return NULL;
+
+	s->stream = squashfs_decompressor_init(msblk);
+	if (s->stream == NULL) {
+		kfree(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+
+void *squashfs_decompressor_create(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool;
+	struct squashfs_stream *s;
+
+	pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->free);
+	init_waitqueue_head(&pool->wait);
+	pool->max = 2 * num_online_cpus();
+
+	/* The first stream is allocated at mount, so there is always one */
+	s = squashfs_stream_alloc(msblk);
+	if (s == NULL) {
+		kfree(pool);
+		return NULL;
+	}
+	list_add(&s->list, &pool->free);
+	pool->total = 1;
+
+	return pool;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct squashfs_stream *s, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(s, next, &pool->free, list) {
+		squashfs_decompressor_free(msblk, s->stream);
+		kfree(s);
+	}
+	kfree(pool);
+	msblk->stream = NULL;
+}
+
+
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream_pool *pool)
+{
+	struct squashfs_stream *s;
+
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->free)) {
+			s = list_entry(pool->free.next, struct squashfs_stream,
+				list);
+			list_del(&s->list);
+			spin_unlock(&pool->lock);
+			return s;
+		}
+
+		if (pool->total < pool->max) {
+			pool->total++;
+			spin_unlock(&pool->lock);
+
+			s = squashfs_stream_alloc(msblk);
+			if (s)
+				return s;
+
+			spin_lock(&pool->lock);
+			pool->total--;
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty(&pool->free));
+	}
+}
+
+
+static void put_stream(struct squashfs_stream_pool *pool,
+	struct squashfs_stream *s)
+{
+	spin_lock(&pool->lock);
+	list_add(&s->list, &pool->free);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct squashfs_stream *s = get_stream(msblk, pool);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, s->stream, buffer, bh, b,
+		offset, length, srclength, pages);
+	put_stream(pool, s);
+
+	return res;
+}
@@ -92,13 +92,33 @@ static void sync_filesystems(int wait)
 }
 
 /*
- * sync everything.  Start out by waking pdflush, because that writes back
- * all queues in parallel.
+ * The non-waiting half of __sync_filesystem() without the inode
+ * writeback: the flusher threads have already been asked to write out
+ * everything, and writeback_inodes_sb() would wait for each bdi in turn.
+ */
+static void start_sync_one_sb(struct super_block *sb, void *arg)
+{
+	if (sb->s_flags & MS_RDONLY)
+		return;
+	if (!sb->s_bdi || sb->s_bdi == &noop_backing_dev_info)
+		return;
+
+	if (sb->s_qcop && sb->s_qcop->quota_sync)
+		sb->s_qcop->quota_sync(sb, -1, 0);
+	if (sb->s_op->sync_fs)
+		sb->s_op->sync_fs(sb, 0);
+	__sync_blockdev(sb->s_bdev, 0);
+}
+
+/*
+ * sync everything.  Start out by waking the flusher threads, because that
+ * writes back all queues in parallel, and only then wait on each
+ * filesystem in turn.
  */
 SYSCALL_DEFINE0(sync)
 {
 	wakeup_flusher_threads(0);
-	sync_filesystems(0);
+	iterate_supers(start_sync_one_sb, NULL);
 	sync_filesystems(1);
 	if (unlikely(laptop_mode))
 		laptop_sync_completion();
@@ -128,6 +148,29 @@ void emergency_sync(void)
 	}
 }
 
+/*
+ * sync a single super
+ */
+SYSCALL_DEFINE1(syncfs, int, fd)
+{
+	struct file *file;
+	struct super_block *sb;
+	int ret;
+	int fput_needed;
+
+	file = fget_light(fd, &fput_needed);
+	if (!file)
+		return -EBADF;
+	sb = file->f_dentry->d_sb;
+
+	down_read(&sb->s_umount);
+	ret = sync_filesystem(sb);
+	up_read(&sb->s_umount);
+
+	fput_light(file, fput_needed);
+	return ret;
+}
+
 /**
  * vfs_fsync_range - helper to sync a range of data & metadata to disk
  * @file:		file to sync
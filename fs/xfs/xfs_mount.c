@@ -445,6 +445,8 @@ xfs_initialize_perag(
 		pag->pag_mount = mp;
 		rwlock_init(&pag->pag_ici_lock);
 		INIT_RADIX_TREE(&pag->pag_ici_root, GFP_ATOMIC);
+		spin_lock_init(&pag->pag_buf_lock);
+		pag->pag_buf_tree = RB_ROOT;
 
 		if (radix_tree_preload(GFP_NOFS))
 			goto out_unwind;
@@ -1420,6 +1422,9 @@ xfs_mountfs(
  out_log_dealloc:
 	xfs_log_unmount(mp);
  out_free_perag:
+	/* cached buffers hold perag references, so drop them first */
+	xfs_binval(mp->m_ddev_targp);
+	xfs_wait_buftarg(mp->m_ddev_targp);
 	xfs_free_perag(mp);
  out_remove_uuid:
 	xfs_uuid_unmount(mp);
@@ -642,9 +642,15 @@ __SYSCALL(__NR_recvmmsg, sys_recvmmsg)
 __SYSCALL(__NR_wait4, sys_wait4)
 #define __NR_prlimit64 261
 __SYSCALL(__NR_prlimit64, sys_prlimit64)
+#define __NR_sendmmsg 262
+__SYSCALL(__NR_sendmmsg, sys_sendmmsg)
+#define __NR_syncfs 263
+__SYSCALL(__NR_syncfs, sys_syncfs)
+#define __NR_mq_timedreceive_batch 264
+__SYSCALL(__NR_mq_timedreceive_batch, sys_mq_timedreceive_batch)
 
 #undef __NR_syscalls
-#define __NR_syscalls 262
+#define __NR_syscalls 265
 
 /*
  * All syscalls below here should go away really,
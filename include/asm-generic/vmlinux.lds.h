@@ -146,6 +146,12 @@
 #define TRACE_SYSCALLS()
 #endif
 
+/* sorted by key at boot, hence writable */
+#define JUMP_TABLE()	. = ALIGN(8);					\
+			VMLINUX_SYMBOL(__start___jump_table) = .;	\
+			*(__jump_table)					\
+			VMLINUX_SYMBOL(__stop___jump_table) = .;
+
 /* .data section */
 #define DATA_DATA							\
 	*(.data)							\
@@ -160,6 +166,7 @@
 	VMLINUX_SYMBOL(__start___tracepoints) = .;			\
 	*(__tracepoints)						\
 	VMLINUX_SYMBOL(__stop___tracepoints) = .;			\
+	JUMP_TABLE()							\
 	/* implement dynamic printk debug */				\
 	. = ALIGN(8);							\
 	VMLINUX_SYMBOL(__start___verbose) = .;                          \
@@ -588,26 +595,30 @@
 		*(.init.setup)						\
 		VMLINUX_SYMBOL(__setup_end) = .;
 
+#define INIT_CALLS_LEVEL(level)						\
+	VMLINUX_SYMBOL(__initcall##level##_start) = .;			\
+	*(.initcall##level##.init)					\
+	*(.initcall##level##s.init)
+
+/* init/main.c runs the asynchronous device initcalls, 6a, on their own */
 #define INITCALLS							\
 	*(.initcallearly.init)						\
 	VMLINUX_SYMBOL(__early_initcall_end) = .;			\
-  	*(.initcall0.init)						\
-  	*(.initcall0s.init)						\
-  	*(.initcall1.init)						\
-  	*(.initcall1s.init)						\
-  	*(.initcall2.init)						\
-  	*(.initcall2s.init)						\
-  	*(.initcall3.init)						\
-  	*(.initcall3s.init)						\
-  	*(.initcall4.init)						\
-  	*(.initcall4s.init)						\
-  	*(.initcall5.init)						\
-  	*(.initcall5s.init)						\
+	INIT_CALLS_LEVEL(0)						\
+	INIT_CALLS_LEVEL(1)						\
+	INIT_CALLS_LEVEL(2)						\
+	INIT_CALLS_LEVEL(3)						\
+	INIT_CALLS_LEVEL(4)						\
+	INIT_CALLS_LEVEL(5)						\
+	VMLINUX_SYMBOL(__initcallrootfs_start) = .;			\
 	*(.initcallrootfs.init)						\
-  	*(.initcall6.init)						\
-  	*(.initcall6s.init)						\
-  	*(.initcall7.init)						\
-  	*(.initcall7s.init)
+	VMLINUX_SYMBOL(__initcall6_start) = .;				\
+	*(.initcall6.init)						\
+	VMLINUX_SYMBOL(__initcall6a_start) = .;				\
+	*(.initcall6a.init)						\
+	VMLINUX_SYMBOL(__initcall6s_start) = .;				\
+	*(.initcall6s.init)						\
+	INIT_CALLS_LEVEL(7)
 
 #define INIT_CALLS							\
 		VMLINUX_SYMBOL(__initcall_start) = .;			\
@@ -21,6 +21,7 @@
 struct page;
 struct device;
 struct dentry;
+struct wb_writeback_work;
 
 /*
  * Bits in backing_dev_info.state
@@ -40,11 +41,32 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_READAHEAD_HIT,
+	BDI_READAHEAD_MISS,
+	BDI_WRITTEN,
 	NR_BDI_STAT_ITEMS
 };
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/* Initial write bandwidth estimate: 100 MB/s, in pages per second */
+#define INIT_BW		(100 << (20 - PAGE_SHIFT))
+
+/* Upper bound for backing_dev_info.nr_flushers */
+#define BDI_MAX_FLUSHERS	8
+
+struct bdi_writeback;
+
+/*
+ * An extra flusher thread.  It shares the inode lists of its bdi_writeback
+ * and only runs the share of a work item handed to it by the main thread.
+ */
+struct bdi_flusher_helper {
+	struct bdi_writeback *wb;
+	struct task_struct *task;
+	struct wb_writeback_work *work;	/* share of the current work item */
+};
+
 struct bdi_writeback {
 	struct backing_dev_info *bdi;	/* our parent bdi */
 	unsigned int nr;
@@ -57,6 +79,11 @@ struct bdi_writeback {
 	struct list_head b_dirty;	/* dirty inodes */
 	struct list_head b_io;		/* parked for writeback */
 	struct list_head b_more_io;	/* parked for more writeback */
+
+	unsigned int nr_helpers;	/* extra flusher threads running */
+	struct bdi_flusher_helper helper[BDI_MAX_FLUSHERS - 1];
+	atomic_t helpers_busy;		/* helpers still writing their share */
+	wait_queue_head_t helpers_wait;
 };
 
 struct backing_dev_info {
@@ -76,9 +103,15 @@ struct backing_dev_info {
 	struct prop_local_percpu completions;
 	int dirty_exceeded;
 
+	unsigned long bw_time_stamp;	/* last write bandwidth update */
+	unsigned long written_stamp;	/* BDI_WRITTEN at bw_time_stamp */
+	unsigned long write_bandwidth;	/* estimated pages per second */
+
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
 
+	unsigned int nr_flushers;	/* flusher threads, including wb.task */
+
 	struct bdi_writeback wb;  /* default writeback info for this bdi */
 	spinlock_t wb_lock;	  /* protects work_list */
 
@@ -133,5 +133,18 @@ extern void do_coredump(long signr, int exit_code, struct pt_regs *regs);
 extern void set_binfmt(struct linux_binfmt *new);
 extern void free_bprm(struct linux_binprm *);
 
+#ifdef CONFIG_EXEC_PREFETCH
+extern void exec_prefetch(struct file *file, struct mm_struct *mm);
+extern void exec_prefetch_record(struct mm_struct *mm);
+#else
+static inline void exec_prefetch(struct file *file, struct mm_struct *mm)
+{
+}
+
+static inline void exec_prefetch_record(struct mm_struct *mm)
+{
+}
+#endif
+
 #endif /* __KERNEL__ */
 #endif /* _LINUX_BINFMTS_H */
@@ -43,6 +43,9 @@ extern void __blk_iopoll_complete(struct blk_iopoll *);
 extern void blk_iopoll_enable(struct blk_iopoll *);
 extern void blk_iopoll_disable(struct blk_iopoll *);
 
+struct request_queue;
+extern void blk_queue_iopoll(struct request_queue *, struct blk_iopoll *);
+
 extern int blk_iopoll_enabled;
 
 #endif
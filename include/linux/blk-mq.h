@@ -0,0 +1,154 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+/*
+ * Multi-queue block layer interface.
+ *
+ * A queue set up by blk_mq_init_queue() has one software queue per cpu,
+ * where the submitters queue their requests, and a number of hardware
+ * queues provided by the driver, each serving a set of cpus.  Requests
+ * are pre-allocated per hardware queue and tagged by their index, there
+ * is no elevator and no queue_lock on the I/O path.
+ */
+
+#include <linux/blkdev.h>
+
+struct blk_mq_ctx;
+struct blk_mq_tags;
+
+struct blk_mq_hw_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	dispatch;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+	cpumask_var_t		cpumask;
+
+	unsigned long		flags;		/* BLK_MQ_F_* flags */
+
+	struct request_queue	*queue;
+	void			*driver_data;
+
+	/* the software queues mapped here, and those having requests */
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;
+
+	struct blk_mq_tags	*tags;
+
+	unsigned long		queued;
+	unsigned long		run;
+	unsigned long		dispatched;
+
+	unsigned int		queue_num;
+	unsigned int		queue_depth;
+	int			numa_node;
+};
+
+struct blk_mq_ops;
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* requests per hardware queue */
+	unsigned int		cmd_size;	/* per-request driver data */
+	unsigned int		timeout;
+	int			numa_node;
+	unsigned int		flags;		/* BLK_MQ_F_* */
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *,
+					     const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+typedef enum blk_eh_timer_return (mq_timeout_fn)(struct request *);
+
+struct blk_mq_ops {
+	/*
+	 * Queue request on the hardware: may be called concurrently for
+	 * the same hardware queue, from the cpus it serves.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Map a cpu to a hardware queue, blk_mq_map_queue() by default
+	 */
+	map_queue_fn		*map_queue;
+
+	/*
+	 * A request handed to ->queue_rq() has timed out
+	 */
+	mq_timeout_fn		*timeout;
+
+	/*
+	 * Called when a request completed through blk_mq_complete_request(),
+	 * on the cpu which submitted it.
+	 */
+	softirq_done_fn		*complete;
+
+	/*
+	 * Called once per hardware queue on setup and teardown, with the
+	 * driver_data passed to blk_mq_init_queue().
+	 */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue, driver restarts the queue */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end request with error */
+
+	BLK_MQ_F_SHOULD_MERGE	= 1 << 0,
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 4096,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int);
+
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp);
+void blk_mq_free_request(struct request *rq);
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async);
+
+void blk_mq_end_io(struct request *rq, int error);
+void blk_mq_complete_request(struct request *rq);
+void blk_mq_requeue_request(struct request *rq);
+
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+void blk_mq_run_queues(struct request_queue *q, bool async);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_stop_hw_queues(struct request_queue *q);
+void blk_mq_start_stopped_hw_queues(struct request_queue *q);
+
+/*
+ * Driver command data is allocated right after the request
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return pdu - sizeof(struct request);
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#define hctx_for_each_ctx(hctx, ctx, i)					\
+	for ((i) = 0; (i) < (hctx)->nr_ctx &&				\
+	     ({ ctx = (hctx)->ctxs[(i)]; 1; }); (i)++)
+
+#endif
@@ -28,6 +28,31 @@ struct request_queue;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
+struct blk_mq_ops;
+struct blk_iopoll;
+
+/*
+ * Per-cpu statistics of the softirq completions, counted on the cpu
+ * the device signalled the completion on, except the latency accounted
+ * on the cpu running the completion.
+ */
+struct blk_comp_stats {
+	unsigned long		local;		/* completed on this cpu */
+	unsigned long		remote;		/* sent to the submitting cpu */
+	unsigned long		ipis;		/* IPIs sent for those */
+	u64			latency_ns;	/* total time to completion */
+};
+
+/*
+ * Time from issue to completion of the requests of a polled queue, a
+ * moving average over the last few
+ */
+struct blk_poll_stat {
+	u64			mean_ns;
+	unsigned long		nr;		/* samples so far */
+};
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 struct request;
 struct sg_io_hdr;
 
@@ -81,6 +106,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -114,8 +140,16 @@ struct request {
 	void *elevator_private2;
 	void *elevator_private3;
 
+	/* sequencing of REQ_FLUSH/REQ_FUA requests, see blk-flush.c */
+	struct {
+		unsigned int		seq;
+		struct list_head	list;
+	} flush;
+
 	struct gendisk *rq_disk;
 	unsigned long start_time;
+	u64 complete_time_ns;	/* when blk_complete_request() was called */
+	u64 issue_time_ns;	/* handed to the driver, on polled queues */
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
@@ -275,12 +309,34 @@ struct request_queue
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	/*
+	 * Multi-queue: per-cpu software queues and the hardware queues
+	 * they map to, see blk_mq_init_queue()
+	 */
+	struct blk_mq_ops	*mq_ops;
+	unsigned int		*mq_map;
+	struct blk_mq_ctx __percpu	*queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
 	/*
 	 * Dispatch queue sorting
 	 */
 	sector_t		end_sector;
 	struct request		*boundary_rq;
 
+	struct blk_comp_stats __percpu *comp_stats;
+
+	/*
+	 * Polled completions, see blk_poll(): the driver's iopoll handler,
+	 * the hybrid sleep (-1 none, 0 adaptive, otherwise in ns) and the
+	 * mean completion times it adapts to, for READ and WRITE
+	 */
+	struct blk_iopoll	*poll_iop;
+	int			poll_nsec;
+	spinlock_t		poll_lock;
+	struct blk_poll_stat	poll_stat[2];
+
 	/*
 	 * Auto-unplugging state
 	 */
@@ -355,18 +411,26 @@ struct request_queue
 	struct blk_trace	*blk_trace;
 #endif
 	/*
-	 * reserved for flush operations
+	 * for flush operations
 	 */
-	unsigned int		ordered, next_ordered, ordseq;
-	int			orderr, ordcolor;
-	struct request		pre_flush_rq, bar_rq, post_flush_rq;
-	struct request		*orig_bar_rq;
+	unsigned int		flush_flags;
+	unsigned int		flush_pending_idx:1;
+	unsigned int		flush_running_idx:1;
+	unsigned long		flush_pending_since;
+	struct list_head	flush_queue[2];
+	struct list_head	flush_data_in_flight;
+	struct request		flush_rq;
 
 	struct mutex		sysfs_lock;
 
 #if defined(CONFIG_BLK_DEV_BSG)
 	struct bsg_class_device bsg_dev;
 #endif
+
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	/* Throttle data */
+	struct throtl_data	*td;
+#endif
 };
 
 #define QUEUE_FLAG_CLUSTER	0	/* cluster several segments into 1 */
@@ -390,6 +454,8 @@ struct request_queue
 #define QUEUE_FLAG_NOXMERGES   17	/* No extended merges */
 #define QUEUE_FLAG_ADD_RANDOM  18	/* Contributes to random pool */
 #define QUEUE_FLAG_SECDISCARD  19	/* supports SECDISCARD */
+#define QUEUE_FLAG_SAME_FORCE  20	/* force complete on the exact CPU */
+#define QUEUE_FLAG_POLL        21	/* sync IO polls for completions */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_CLUSTER) |		\
@@ -464,7 +530,9 @@ static inline void queue_flag_clear(unsigned int flag, struct request_queue *q)
 
 enum {
 	/*
-	 * Hardbarrier is supported with one of the following methods.
+	 * Hardbarrier is supported with one of the following methods,
+	 * blk_queue_ordered() only keeps whether the queue flushes and
+	 * does FUA writes out of them, see blk_queue_flush().
 	 *
 	 * NONE		: hardbarrier unsupported
 	 * DRAIN	: ordering by draining is enough
@@ -500,16 +568,6 @@ enum {
 	QUEUE_ORDERED_TAG_FUA		= QUEUE_ORDERED_TAG |
 					  QUEUE_ORDERED_DO_PREFLUSH |
 					  QUEUE_ORDERED_DO_FUA,
-
-	/*
-	 * Ordered operation sequence
-	 */
-	QUEUE_ORDSEQ_STARTED	= 0x01,	/* flushing in progress */
-	QUEUE_ORDSEQ_DRAIN	= 0x02,	/* waiting for the queue to be drained */
-	QUEUE_ORDSEQ_PREFLUSH	= 0x04,	/* pre-flushing in progress */
-	QUEUE_ORDSEQ_BAR	= 0x08,	/* original barrier req in progress */
-	QUEUE_ORDSEQ_POSTFLUSH	= 0x10,	/* post-flushing in progress */
-	QUEUE_ORDSEQ_DONE	= 0x20,
 };
 
 #define blk_queue_plugged(q)	test_bit(QUEUE_FLAG_PLUGGED, &(q)->queue_flags)
@@ -519,9 +577,11 @@ enum {
 #define blk_queue_noxmerges(q)	\
 	test_bit(QUEUE_FLAG_NOXMERGES, &(q)->queue_flags)
 #define blk_queue_nonrot(q)	test_bit(QUEUE_FLAG_NONROT, &(q)->queue_flags)
+#define blk_queue_poll(q)	test_bit(QUEUE_FLAG_POLL, &(q)->queue_flags)
 #define blk_queue_io_stat(q)	test_bit(QUEUE_FLAG_IO_STAT, &(q)->queue_flags)
 #define blk_queue_add_random(q)	test_bit(QUEUE_FLAG_ADD_RANDOM, &(q)->queue_flags)
-#define blk_queue_flushing(q)	((q)->ordseq)
+#define blk_queue_flushing(q)	\
+	((q)->flush_pending_idx != (q)->flush_running_idx)
 #define blk_queue_stackable(q)	\
 	test_bit(QUEUE_FLAG_STACKABLE, &(q)->queue_flags)
 #define blk_queue_discard(q)	test_bit(QUEUE_FLAG_DISCARD, &(q)->queue_flags)
@@ -592,7 +652,8 @@ static inline void blk_clear_queue_full(struct request_queue *q, int sync)
  * it already be started by driver.
  */
 #define RQ_NOMERGE_FLAGS	\
-	(REQ_NOMERGE | REQ_STARTED | REQ_HARDBARRIER | REQ_SOFTBARRIER)
+	(REQ_NOMERGE | REQ_STARTED | REQ_HARDBARRIER | REQ_SOFTBARRIER | \
+	 REQ_FLUSH | REQ_FUA)
 #define rq_mergeable(rq)	\
 	(!((rq)->cmd_flags & RQ_NOMERGE_FLAGS) && \
 	 (((rq)->cmd_flags & REQ_DISCARD) || \
@@ -751,6 +812,7 @@ extern int blk_execute_rq(struct request_queue *, struct gendisk *,
 extern void blk_execute_rq_nowait(struct request_queue *, struct gendisk *,
 				  struct request *, int, rq_end_io_fn *);
 extern void blk_unplug(struct request_queue *q);
+extern bool blk_poll(struct request_queue *q, int rw, bool *slept);
 
 static inline struct request_queue *bdev_get_queue(struct block_device *bdev)
 {
@@ -882,11 +944,8 @@ extern void blk_queue_softirq_done(struct request_queue *, softirq_done_fn *);
 extern void blk_queue_rq_timed_out(struct request_queue *, rq_timed_out_fn *);
 extern void blk_queue_rq_timeout(struct request_queue *, unsigned int);
 extern struct backing_dev_info *blk_get_backing_dev_info(struct block_device *bdev);
+extern void blk_queue_flush(struct request_queue *q, unsigned int flush);
 extern int blk_queue_ordered(struct request_queue *, unsigned);
-extern bool blk_do_ordered(struct request_queue *, struct request **);
-extern unsigned blk_ordered_cur_seq(struct request_queue *);
-extern unsigned blk_ordered_req_seq(struct request *);
-extern bool blk_ordered_complete_seq(struct request_queue *, unsigned, int);
 
 extern int blk_rq_map_sg(struct request_queue *, struct request *, struct scatterlist *);
 extern void blk_dump_rq_flags(struct request *, char *);
@@ -898,6 +957,46 @@ struct request_queue *blk_alloc_queue(gfp_t);
 struct request_queue *blk_alloc_queue_node(gfp_t, int);
 extern void blk_put_queue(struct request_queue *);
 
+/*
+ * Per-task plugging: blk_start_plug() and blk_finish_plug() around a
+ * batch of submit_bio() calls keep the requests on the caller's stack,
+ * see blk_start_plug().
+ */
+struct blk_plug {
+	unsigned long magic;
+	struct list_head list;		/* requests */
+	unsigned int should_sort;	/* list is not in queue, sector order */
+	unsigned int count;
+};
+#define BLK_MAX_REQUEST_COUNT	16
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *, bool);
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, false);
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, true);
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	return plug && !list_empty(&plug->list);
+}
+
 /*
  * tag stuff
  */
@@ -942,6 +1041,36 @@ static inline int sb_issue_discard(struct super_block *sb,
 				   BLKDEV_IFL_WAIT | BLKDEV_IFL_BARRIER);
 }
 
+/*
+ * Discard ranges queued by a filesystem, merged with their neighbours and
+ * issued together: either all at once by blk_discard_queue_flush(), or in
+ * the background after blk_discard_queue_kick(), at most max_sectors
+ * every delay jiffies.  The caller must not reuse the ranges before they
+ * are flushed.
+ */
+struct blk_discard_queue {
+	struct block_device	*bdev;
+	spinlock_t		lock;
+	struct rb_root		ranges;
+	unsigned int		nr_ranges;
+
+	struct delayed_work	work;
+	unsigned long		delay;
+	sector_t		max_sectors;	/* per run, 0 for no limit */
+
+	atomic_t		inflight;
+	wait_queue_head_t	wait;
+	unsigned long		flags;		/* BIO_EOPNOTSUPP, BIO_UPTODATE */
+};
+
+extern struct blk_discard_queue *blk_alloc_discard_queue(struct block_device *,
+							 gfp_t);
+extern void blk_free_discard_queue(struct blk_discard_queue *);
+extern int blk_discard_queue_add(struct blk_discard_queue *, sector_t sector,
+				 sector_t nr_sects, gfp_t gfp_mask);
+extern void blk_discard_queue_kick(struct blk_discard_queue *);
+extern int blk_discard_queue_flush(struct blk_discard_queue *);
+
 extern int blk_verify_command(unsigned char *cmd, fmode_t has_write_perm);
 
 enum blk_default_limits {
@@ -1127,6 +1256,9 @@ static inline void put_dev_sector(Sector p)
 
 struct work_struct;
 int kblockd_schedule_work(struct request_queue *q, struct work_struct *work);
+int kblockd_schedule_delayed_work(struct request_queue *q,
+				  struct delayed_work *dwork,
+				  unsigned long delay);
 
 #ifdef CONFIG_BLK_CGROUP
 /*
@@ -1277,6 +1409,30 @@ static inline long nr_blockdev_pages(void)
 	return 0;
 }
 
+struct blk_plug {
+};
+
+static inline void blk_start_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_finish_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_flush_plug(struct task_struct *task)
+{
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *task)
+{
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	return false;
+}
+
 #endif /* CONFIG_BLOCK */
 
 #endif
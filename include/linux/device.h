@@ -65,6 +65,8 @@ struct bus_type {
 
 	const struct dev_pm_ops *pm;
 
+	bool async_probe;	/* probe devices from async threads */
+
 	struct bus_type_private *p;
 };
 
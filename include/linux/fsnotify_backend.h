@@ -64,6 +64,10 @@
 
 #define FS_MOVE			(FS_MOVED_FROM | FS_MOVED_TO)
 
+/* buckets for looking up queued events of a group by inode */
+#define FSNOTIFY_HASH_BITS	7
+#define FSNOTIFY_HASH_SIZE	(1 << FSNOTIFY_HASH_BITS)
+
 #define ALL_FSNOTIFY_EVENTS (FS_ACCESS | FS_MODIFY | FS_ATTRIB | \
 			     FS_CLOSE_WRITE | FS_CLOSE_NOWRITE | FS_OPEN | \
 			     FS_MOVED_FROM | FS_MOVED_TO | FS_CREATE | \
@@ -129,6 +133,7 @@ struct fsnotify_group {
 	wait_queue_head_t notification_waitq;	/* read() on the notification file blocks on this waitq */
 	unsigned int q_len;			/* events on the queue */
 	unsigned int max_events;		/* maximum events allowed on the list */
+	struct hlist_head notification_hash[FSNOTIFY_HASH_SIZE]; /* queued holders by ->to_tell */
 
 	/* stores all fastpath marks assoc with this group so they can be cleaned on unregister */
 	spinlock_t mark_lock;		/* protect marks_list */
@@ -176,6 +181,7 @@ struct fsnotify_group {
 struct fsnotify_event_holder {
 	struct fsnotify_event *event;
 	struct list_head event_list;
+	struct hlist_node hash_node;	/* in group->notification_hash */
 };
 
 /*
@@ -360,8 +366,11 @@ extern struct fsnotify_event_private_data *fsnotify_remove_priv_from_event(struc
 extern struct fsnotify_event *fsnotify_add_notify_event(struct fsnotify_group *group,
 							struct fsnotify_event *event,
 							struct fsnotify_event_private_data *priv,
-							struct fsnotify_event *(*merge)(struct list_head *,
+							struct fsnotify_event *(*merge)(struct fsnotify_group *,
 											struct fsnotify_event *));
+/* the bucket of group->notification_hash holding queued events for to_tell */
+extern struct hlist_head *fsnotify_notify_hash(struct fsnotify_group *group,
+					       struct inode *to_tell);
 /* true if the group notification queue is empty */
 extern bool fsnotify_notify_queue_is_empty(struct fsnotify_group *group);
 /* return, but do not dequeue the first event on the notification queue */
@@ -372,6 +372,7 @@ extern ktime_t hrtimer_get_remaining(const struct hrtimer *timer);
 extern int hrtimer_get_res(const clockid_t which_clock, struct timespec *tp);
 
 extern ktime_t hrtimer_get_next_event(void);
+extern int hrtimer_coalesce_idle(int target, int *saved);
 
 /*
  * A timer is active, when it is enqueued into the rbtree or the callback
@@ -16,6 +16,7 @@
 #include <linux/bitops.h>
 #include <linux/init.h>
 #include <linux/rcupdate.h>
+#include <linux/preempt.h>
 
 #if BITS_PER_LONG == 32
 # define IDR_BITS 5
@@ -94,6 +95,11 @@ struct idr {
  * lock-free access; and that the items are freed by RCU (or only freed after
  * having been deleted from the idr tree *and* a synchronize_rcu() grace
  * period).
+ *
+ * idr_get_new*() take their layers from a free list which idr_pre_get()
+ * fills under idp->lock.  idr_alloc() instead allocates them itself, or
+ * takes them from a per cpu buffer filled by idr_preload() when it may
+ * not sleep under the caller's lock, and touches no idp->lock.
  */
 
 /*
@@ -104,6 +110,8 @@ void *idr_find(struct idr *idp, int id);
 int idr_pre_get(struct idr *idp, gfp_t gfp_mask);
 int idr_get_new(struct idr *idp, void *ptr, int *id);
 int idr_get_new_above(struct idr *idp, void *ptr, int starting_id, int *id);
+void idr_preload(gfp_t gfp_mask);
+int idr_alloc(struct idr *idp, void *ptr, int start, int end, gfp_t gfp_mask);
 int idr_for_each(struct idr *idp,
 		 int (*fn)(int id, void *p, void *data), void *data);
 void *idr_get_next(struct idr *idp, int *nextid);
@@ -113,6 +121,14 @@ void idr_remove_all(struct idr *idp);
 void idr_destroy(struct idr *idp);
 void idr_init(struct idr *idp);
 
+/**
+ * idr_preload_end - end preload section started with idr_preload()
+ */
+static inline void idr_preload_end(void)
+{
+	preempt_enable();
+}
+
 
 /*
  * IDA - IDR based id allocator, use when translation from id to
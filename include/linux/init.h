@@ -202,6 +202,14 @@ extern int initcall_debug;
 #define late_initcall(fn)		__define_initcall("7",fn,7)
 #define late_initcall_sync(fn)		__define_initcall("7s",fn,7s)
 
+/*
+ * An asynchronous device initcall runs in parallel with the rest of the
+ * device level.  All of them are done before device_initcall_sync() and
+ * the later levels start, so it is for probing slow hardware nothing
+ * else in the device level depends on.
+ */
+#define device_initcall_async(fn)	__define_initcall("6a",fn,6a)
+
 #define __initcall(fn) device_initcall(fn)
 
 #define __exitcall(fn) \
@@ -280,6 +288,7 @@ void __init parse_early_options(char *cmdline);
 #define subsys_initcall(fn)		module_init(fn)
 #define fs_initcall(fn)			module_init(fn)
 #define device_initcall(fn)		module_init(fn)
+#define device_initcall_async(fn)	module_init(fn)
 #define late_initcall(fn)		module_init(fn)
 
 #define security_initcall(fn)		module_init(fn)
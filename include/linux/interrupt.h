@@ -54,6 +54,7 @@
  *                Used by threaded interrupts which need to keep the
  *                irq line disabled until the threaded handler has been run.
  * IRQF_NO_SUSPEND - Do not disable this IRQ during suspend
+ * IRQF_NO_THREAD - Interrupt cannot be threaded, even with "threadirqs"
  *
  */
 #define IRQF_DISABLED		0x00000020
@@ -66,6 +67,7 @@
 #define IRQF_IRQPOLL		0x00001000
 #define IRQF_ONESHOT		0x00002000
 #define IRQF_NO_SUSPEND		0x00004000
+#define IRQF_NO_THREAD		0x00008000
 
 #define IRQF_TIMER		(__IRQF_TIMER | IRQF_NO_SUSPEND)
 
@@ -75,12 +77,14 @@
  * IRQTF_DIED      - handler thread died
  * IRQTF_WARNED    - warning "IRQ_WAKE_THREAD w/o thread_fn" has been printed
  * IRQTF_AFFINITY  - irq thread is requested to adjust affinity
+ * IRQTF_FORCED_THREAD  - irq action is force threaded
  */
 enum {
 	IRQTF_RUNTHREAD,
 	IRQTF_DIED,
 	IRQTF_WARNED,
 	IRQTF_AFFINITY,
+	IRQTF_FORCED_THREAD,
 };
 
 /*
@@ -143,6 +147,7 @@ request_any_context_irq(unsigned int irq, irq_handler_t handler,
 			unsigned long flags, const char *name, void *dev_id);
 
 extern void exit_irq_thread(void);
+extern bool force_irqthreads;
 #else
 
 extern int __must_check
@@ -171,6 +176,7 @@ request_any_context_irq(unsigned int irq, irq_handler_t handler,
 }
 
 static inline void exit_irq_thread(void) { }
+#define force_irqthreads	(0)
 #endif
 
 extern void free_irq(unsigned int, void *);
@@ -0,0 +1,91 @@
+#ifndef _LINUX_JUMP_LABEL_H
+#define _LINUX_JUMP_LABEL_H
+
+/*
+ * Jump labels: branches on rarely changed keys, patched into the code.
+ *
+ *	JUMP_LABEL(&key, label);
+ *
+ * compiles to a 5 byte nop which jump_label_enable(&key) turns into a
+ * jump to label, and jump_label_disable(&key) back into the nop.  The key
+ * is only an address naming the sites, its value is never read, so the
+ * users keep their own state.  jump_label_inc()/jump_label_dec() enable
+ * an atomic_t key while it is non zero.
+ *
+ * Without compiler or architecture support, JUMP_LABEL() tests the key:
+ * the key must then hold the state, as an int or an atomic_t.
+ */
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+
+#if defined(CC_HAVE_ASM_GOTO) && defined(CONFIG_HAVE_ARCH_JUMP_LABEL)
+# include <asm/jump_label.h>
+# define HAVE_JUMP_LABEL
+#endif
+
+#include <asm/atomic.h>
+
+struct module;
+
+enum jump_label_type {
+	JUMP_LABEL_ENABLE,
+	JUMP_LABEL_DISABLE
+};
+
+#ifdef HAVE_JUMP_LABEL
+
+extern struct jump_entry __start___jump_table[];
+extern struct jump_entry __stop___jump_table[];
+
+extern void arch_jump_label_transform(struct jump_entry *entries, int nr,
+				      enum jump_label_type type);
+extern void arch_jump_label_text_poke_early(struct jump_entry *entry,
+					    enum jump_label_type type);
+extern void jump_label_update(unsigned long key, enum jump_label_type type);
+extern void jump_label_apply_nops(struct module *mod);
+extern int jump_label_text_reserved(void *start, void *end);
+extern void jump_label_inc(atomic_t *key);
+extern void jump_label_dec(atomic_t *key);
+
+#define jump_label_enable(key) \
+	jump_label_update((unsigned long)key, JUMP_LABEL_ENABLE)
+
+#define jump_label_disable(key) \
+	jump_label_update((unsigned long)key, JUMP_LABEL_DISABLE)
+
+#else /* !HAVE_JUMP_LABEL */
+
+#define JUMP_LABEL(key, label)						\
+do {									\
+	if (unlikely(__builtin_choose_expr(				\
+	      __builtin_types_compatible_p(typeof(key), atomic_t *),	\
+	      atomic_read((atomic_t *)(key)), *(key))))			\
+		goto label;						\
+} while (0)
+
+#define jump_label_enable(key) do { } while (0)
+#define jump_label_disable(key) do { } while (0)
+
+static inline void jump_label_apply_nops(struct module *mod)
+{
+}
+
+static inline int jump_label_text_reserved(void *start, void *end)
+{
+	return 0;
+}
+
+static inline void jump_label_inc(atomic_t *key)
+{
+	atomic_inc(key);
+}
+
+static inline void jump_label_dec(atomic_t *key)
+{
+	atomic_dec(key);
+}
+
+#endif /* HAVE_JUMP_LABEL */
+
+#endif /* _LINUX_JUMP_LABEL_H */
@@ -34,6 +34,7 @@ struct kernel_stat {
        unsigned int irqs[NR_IRQS];
 #endif
 	unsigned int softirqs[NR_SOFTIRQS];
+	u64 softirq_time[NR_SOFTIRQS];	/* ns spent in each handler */
 };
 
 DECLARE_PER_CPU(struct kernel_stat, kstat);
@@ -80,6 +81,16 @@ static inline unsigned int kstat_softirqs_cpu(unsigned int irq, int cpu)
        return kstat_cpu(cpu).softirqs[irq];
 }
 
+static inline void kstat_add_softirq_time_this_cpu(unsigned int irq, u64 ns)
+{
+	kstat_this_cpu.softirq_time[irq] += ns;
+}
+
+static inline u64 kstat_softirq_time_cpu(unsigned int irq, int cpu)
+{
+	return kstat_cpu(cpu).softirq_time[irq];
+}
+
 /*
  * Number of interrupts per specific IRQ source, since bootup
  */
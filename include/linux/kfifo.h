@@ -48,6 +48,8 @@
  *  For multiple writer and one reader there is only a need to lock the writer.
  * And vice versa for only one writer and multiple reader there is only a need
  * to lock the reader.
+ *  The kfifo_mpmc variant at the end of this file needs no locking at all,
+ * for any number of writers and readers.
  */
 
 #include <linux/kernel.h>
@@ -841,4 +843,200 @@ extern unsigned int __kfifo_out_peek_r(struct __kfifo *fifo,
 
 extern unsigned int __kfifo_max_r(unsigned int len, size_t recsize);
 
+
+/*
+ * Multi-producer multi-consumer fifo
+ *
+ * The fifos above need a lock around the writers as soon as there is
+ * more than one, and around the readers likewise.  A kfifo_mpmc is a
+ * bounded ring of fixed size elements which any number of writers and
+ * readers may use concurrently without locking, from any context: every
+ * slot carries a sequence number telling whether it is free for the
+ * writer of the current lap or filled for its reader, and writers
+ * (readers) claim their slot by advancing the in (out) index with
+ * cmpxchg.  A writer or reader preempted between claiming a slot and
+ * publishing it holds back the readers (writers) of that slot only,
+ * until it is done.
+ *
+ * There is no record or dma flavour, and element sizes are fixed.
+ */
+#include <asm/atomic.h>
+#include <linux/cache.h>
+
+struct __kfifo_mpmc {
+	atomic_t	in;
+	unsigned int	mask;
+	unsigned int	esize;
+	unsigned int	*seq;
+	void		*data;
+	/* keep the readers off the cacheline of the writers */
+	atomic_t	out ____cacheline_aligned_in_smp;
+};
+
+#define __STRUCT_KFIFO_MPMC_COMMON(datatype) \
+	union { \
+		struct __kfifo_mpmc	kfifo; \
+		datatype		*type; \
+		const datatype		*ptr_const; \
+	}
+
+#define __STRUCT_KFIFO_MPMC(type, size) \
+{ \
+	__STRUCT_KFIFO_MPMC_COMMON(type); \
+	unsigned int	seq[((size < 2) || (size & (size - 1))) ? -1 : size]; \
+	type		buf[size]; \
+}
+
+#define __STRUCT_KFIFO_MPMC_PTR(type) \
+{ \
+	__STRUCT_KFIFO_MPMC_COMMON(type); \
+	unsigned int	seq[0]; \
+	type		buf[0]; \
+}
+
+#define	__is_kfifo_mpmc_ptr(fifo) \
+	(sizeof(*fifo) == sizeof(struct __kfifo_mpmc))
+
+/**
+ * DECLARE_KFIFO_MPMC_PTR - macro to declare a multi-producer fifo pointer
+ * @fifo: name of the declared fifo
+ * @type: type of the fifo elements
+ */
+#define DECLARE_KFIFO_MPMC_PTR(fifo, type) \
+	struct __STRUCT_KFIFO_MPMC_PTR(type) fifo
+
+/**
+ * DECLARE_KFIFO_MPMC - macro to declare a multi-producer fifo object
+ * @fifo: name of the declared fifo
+ * @type: type of the fifo elements
+ * @size: the number of elements in the fifo, this must be a power of 2
+ */
+#define DECLARE_KFIFO_MPMC(fifo, type, size) \
+	struct __STRUCT_KFIFO_MPMC(type, size) fifo
+
+/**
+ * INIT_KFIFO_MPMC - Initialize a fifo declared by DECLARE_KFIFO_MPMC
+ * @fifo: name of the declared fifo datatype
+ *
+ * The slots have to be numbered before use, so unlike DECLARE_KFIFO
+ * fifos, these can't be defined already initialized.
+ */
+#define INIT_KFIFO_MPMC(fifo) \
+(void)({ \
+	typeof(&(fifo)) __tmp = &(fifo); \
+	__kfifo_mpmc_init(&__tmp->kfifo, \
+		__is_kfifo_mpmc_ptr(__tmp) ? NULL : __tmp->buf, __tmp->seq, \
+		__is_kfifo_mpmc_ptr(__tmp) ? 0 : ARRAY_SIZE(__tmp->buf), \
+		sizeof(*__tmp->buf)); \
+})
+
+/**
+ * kfifo_mpmc_alloc - dynamically allocates a new multi-producer fifo
+ * @fifo: pointer to the fifo
+ * @size: the number of elements in the fifo, this must be a power of 2
+ * @gfp_mask: get_free_pages mask, passed to kmalloc()
+ *
+ * The fifo must have been declared with DECLARE_KFIFO_MPMC_PTR.
+ * The number of elements will be rounded up to a power of 2.
+ *
+ * Return 0 if no error, otherwise an error code.
+ */
+#define kfifo_mpmc_alloc(fifo, size, gfp_mask) \
+__kfifo_must_check_helper( \
+({ \
+	typeof(fifo + 1) __tmp = (fifo); \
+	__is_kfifo_mpmc_ptr(__tmp) ? \
+	__kfifo_mpmc_alloc(&__tmp->kfifo, size, sizeof(*__tmp->type), \
+		gfp_mask) : \
+	-EINVAL; \
+}) \
+)
+
+/**
+ * kfifo_mpmc_free - frees a fifo allocated with kfifo_mpmc_alloc
+ * @fifo: the fifo to be freed
+ */
+#define kfifo_mpmc_free(fifo) \
+({ \
+	typeof(fifo + 1) __tmp = (fifo); \
+	if (__is_kfifo_mpmc_ptr(__tmp)) \
+		__kfifo_mpmc_free(&__tmp->kfifo); \
+})
+
+/**
+ * kfifo_mpmc_size - returns the size of the fifo in elements
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_mpmc_size(fifo)	((fifo)->kfifo.mask + 1)
+
+/**
+ * kfifo_mpmc_len - returns the number of used elements in the fifo
+ * @fifo: address of the fifo to be used
+ *
+ * Only a snapshot while there are writers or readers, which includes
+ * the elements being written and read.
+ */
+#define kfifo_mpmc_len(fifo) \
+({ \
+	typeof(fifo + 1) __tmpl = (fifo); \
+	__kfifo_mpmc_len(&__tmpl->kfifo); \
+})
+
+/**
+ * kfifo_mpmc_put - put data into a multi-producer fifo
+ * @fifo: address of the fifo to be used
+ * @val: the data to be added
+ *
+ * This macro copies the given value into the fifo.
+ * It returns 0 if the fifo was full. Otherwise it returns 1.
+ *
+ * No locking is needed, whatever the number of writers and readers.
+ */
+#define	kfifo_mpmc_put(fifo, val) \
+({ \
+	typeof(fifo + 1) __tmp = (fifo); \
+	typeof(val + 1) __val = (val); \
+	if (0) { \
+		typeof(__tmp->ptr_const) __dummy __attribute__ ((unused)); \
+		__dummy = (typeof(__val))NULL; \
+	} \
+	__kfifo_mpmc_in(&__tmp->kfifo, __val); \
+})
+
+/**
+ * kfifo_mpmc_get - get data from a multi-producer fifo
+ * @fifo: address of the fifo to be used
+ * @val: the var where to store the data to be removed
+ *
+ * This macro reads the oldest element of the fifo into @val.
+ * It returns 0 if the fifo was empty. Otherwise it returns 1.
+ *
+ * No locking is needed, whatever the number of writers and readers.
+ */
+#define	kfifo_mpmc_get(fifo, val) \
+__kfifo_must_check_helper( \
+({ \
+	typeof(fifo + 1) __tmp = (fifo); \
+	typeof(val + 1) __val = (val); \
+	if (0) \
+		__val = (typeof(__tmp->type))0; \
+	__kfifo_mpmc_out(&__tmp->kfifo, __val); \
+}) \
+)
+
+extern int __kfifo_mpmc_alloc(struct __kfifo_mpmc *fifo, unsigned int size,
+	size_t esize, gfp_t gfp_mask);
+
+extern void __kfifo_mpmc_free(struct __kfifo_mpmc *fifo);
+
+extern void __kfifo_mpmc_init(struct __kfifo_mpmc *fifo, void *buffer,
+	unsigned int *seq, unsigned int size, size_t esize);
+
+extern unsigned int __kfifo_mpmc_in(struct __kfifo_mpmc *fifo,
+	const void *val);
+
+extern unsigned int __kfifo_mpmc_out(struct __kfifo_mpmc *fifo, void *val);
+
+extern unsigned int __kfifo_mpmc_len(struct __kfifo_mpmc *fifo);
+
 #endif
@@ -79,6 +79,9 @@ struct kprobe {
 	/*count the number of times this probe was temporarily disarmed */
 	unsigned long nmissed;
 
+	/* count the number of times this probe's handlers were run */
+	unsigned long nhit;
+
 	/* location of the probe point */
 	kprobe_opcode_t *addr;
 
@@ -259,6 +262,7 @@ extern void show_registers(struct pt_regs *regs);
 extern kprobe_opcode_t *get_insn_slot(void);
 extern void free_insn_slot(kprobe_opcode_t *slot, int dirty);
 extern void kprobes_inc_nmissed_count(struct kprobe *p);
+extern void kprobes_inc_nhit_count(struct kprobe *p);
 
 #ifdef CONFIG_OPTPROBES
 /*
@@ -275,7 +279,7 @@ extern int arch_prepared_optinsn(struct arch_optimized_insn *optinsn);
 extern int arch_check_optimized_kprobe(struct optimized_kprobe *op);
 extern int arch_prepare_optimized_kprobe(struct optimized_kprobe *op);
 extern void arch_remove_optimized_kprobe(struct optimized_kprobe *op);
-extern int  arch_optimize_kprobe(struct optimized_kprobe *op);
+extern void arch_optimize_kprobes(struct list_head *oplist);
 extern void arch_unoptimize_kprobe(struct optimized_kprobe *op);
 extern kprobe_opcode_t *get_optinsn_slot(void);
 extern void free_optinsn_slot(kprobe_opcode_t *slot, int dirty);
@@ -161,6 +161,7 @@ struct kvm_pit_config {
 #define KVM_EXIT_NMI              16
 #define KVM_EXIT_INTERNAL_ERROR   17
 #define KVM_EXIT_OSI              18
+#define KVM_EXIT_DIRTY_RING_FULL  19
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 #define KVM_INTERNAL_ERROR_EMULATION 1
@@ -322,6 +323,19 @@ struct kvm_dirty_log {
 	};
 };
 
+/*
+ * for KVM_ENABLE_DIRTY_LOG_RING, the entries of the ring returned by
+ * mmap(vcpu_fd, offset=KVM_DIRTY_LOG_PAGE_OFFSET * PAGE_SIZE)
+ */
+#define KVM_DIRTY_GFN_F_DIRTY	(1 << 0)	/* set by kvm */
+#define KVM_DIRTY_GFN_F_RESET	(1 << 1)	/* set by userspace */
+
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot;
+	__u64 offset;	/* in pages, from the start of the slot */
+};
+
 /* for KVM_SET_SIGNAL_MASK */
 struct kvm_signal_mask {
 	__u32 len;
@@ -530,6 +544,7 @@ struct kvm_enable_cap {
 #ifdef __KVM_HAVE_XCRS
 #define KVM_CAP_XCRS 56
 #endif
+#define KVM_CAP_DIRTY_LOG_RING 57
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -627,6 +642,8 @@ struct kvm_clock_data {
 					struct kvm_userspace_memory_region)
 #define KVM_SET_TSS_ADDR          _IO(KVMIO,   0x47)
 #define KVM_SET_IDENTITY_MAP_ADDR _IOW(KVMIO,  0x48, __u64)
+#define KVM_ENABLE_DIRTY_LOG_RING _IO(KVMIO,   0x49)
+#define KVM_RESET_DIRTY_RINGS     _IO(KVMIO,   0x4a)
 /* Device model IOC */
 #define KVM_CREATE_IRQCHIP        _IO(KVMIO,   0x60)
 #define KVM_IRQ_LINE              _IOW(KVMIO,  0x61, struct kvm_irq_level)
@@ -126,6 +126,7 @@ struct lock_class_stats {
 	struct lock_time		read_holdtime;
 	struct lock_time		write_holdtime;
 	unsigned long			bounces[nr_bounce_types];
+	unsigned long			sleeps[2];	/* write, read */
 };
 
 struct lock_class_stats lock_stats(struct lock_class *class);
@@ -387,6 +388,7 @@ struct lock_class_key { };
 
 extern void lock_contended(struct lockdep_map *lock, unsigned long ip);
 extern void lock_acquired(struct lockdep_map *lock, unsigned long ip);
+extern void lock_slept(struct lockdep_map *lock);
 
 #define LOCK_CONTENDED(_lock, try, lock)			\
 do {								\
@@ -401,6 +403,7 @@ do {								\
 
 #define lock_contended(lockdep_map, ip) do {} while (0)
 #define lock_acquired(lockdep_map, ip) do {} while (0)
+#define lock_slept(lockdep_map) do {} while (0)
 
 #define LOCK_CONTENDED(_lock, try, lock) \
 	lock(_lock)
@@ -27,6 +27,7 @@ enum {
 };
 
 struct loop_func_table;
+struct loop_extent;
 
 struct loop_device {
 	int		lo_number;
@@ -55,6 +56,15 @@ struct loop_device {
 
 	gfp_t		old_gfp_mask;
 
+	/* LO_FLAGS_DIRECT_IO: where the backing file lies on disk */
+	struct loop_extent	*lo_extents;
+	unsigned		lo_nr_extents;
+	struct block_device	*lo_extent_bdev;
+	struct bio_set		*lo_bio_set;
+	mempool_t		*lo_dio_pool;
+	atomic_t		lo_dio_pending;
+	wait_queue_head_t	lo_dio_wait;
+
 	spinlock_t		lo_lock;
 	struct bio_list		lo_bio_list;
 	int			lo_state;
@@ -76,6 +86,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
 	LO_FLAGS_AUTOCLEAR	= 4,
+	LO_FLAGS_DIRECT_IO	= 8,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
@@ -160,5 +171,6 @@ int loop_unregister_transfer(int number);
 #define LOOP_GET_STATUS64	0x4C05
 #define LOOP_CHANGE_FD		0x4C06
 #define LOOP_SET_CAPACITY	0x4C07
+#define LOOP_SET_DIRECT_IO	0x4C08
 
 #endif
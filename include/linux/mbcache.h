@@ -4,6 +4,8 @@
   (C) 2001 by Andreas Gruenbacher, <a.gruenbacher@computer.org>
 */
 
+struct mb_cache_bucket;
+
 struct mb_cache_entry {
 	struct list_head		e_lru_list;
 	struct mb_cache			*e_cache;
@@ -12,10 +14,12 @@ struct mb_cache_entry {
 	struct block_device		*e_bdev;
 	sector_t			e_block;
 	struct list_head		e_block_list;
+	struct mb_cache_bucket		*e_block_hash_p;
 	struct {
 		struct list_head	o_list;
 		unsigned int		o_key;
 	} e_index;
+	struct mb_cache_bucket		*e_index_hash_p;
 };
 
 /* Functions on caches */
@@ -126,6 +126,19 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask);
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem);
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/* Number of SLAB_ACCOUNT caches whose usage is reported individually */
+#define MEM_CGROUP_KMEM_CACHES	32
+
+struct kmem_cache;
+extern int mem_cgroup_register_kmem_cache(struct kmem_cache *s);
+extern void mem_cgroup_unregister_kmem_cache(int id);
+extern int mem_cgroup_charge_slab(int id, size_t size,
+				  struct mem_cgroup **memp);
+extern void mem_cgroup_uncharge_slab(struct mem_cgroup *mem, int id,
+				     size_t size);
+#endif
+
 #else /* CONFIG_CGROUP_MEM_RES_CTLR */
 struct mem_cgroup;
 
@@ -233,6 +233,22 @@ extern int mpol_to_str(char *buffer, int maxlen, struct mempolicy *pol,
 			int no_context);
 #endif
 
+#ifdef CONFIG_MIGRATION
+extern int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_period_ms;
+extern unsigned int sysctl_numa_balancing_scan_size_mb;
+extern void mm_init_numa(struct mm_struct *mm);
+extern void task_tick_numa(struct task_struct *p);
+#else
+static inline void mm_init_numa(struct mm_struct *mm)
+{
+}
+
+static inline void task_tick_numa(struct task_struct *p)
+{
+}
+#endif
+
 /* Check if a vma is migratable */
 static inline int vma_migratable(struct vm_area_struct *vma)
 {
@@ -254,6 +270,14 @@ static inline int vma_migratable(struct vm_area_struct *vma)
 
 struct mempolicy {};
 
+static inline void mm_init_numa(struct mm_struct *mm)
+{
+}
+
+static inline void task_tick_numa(struct task_struct *p)
+{
+}
+
 static inline int mpol_equal(struct mempolicy *a, struct mempolicy *b)
 {
 	return 1;
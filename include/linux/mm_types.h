@@ -9,9 +9,11 @@
 #include <linux/prio_tree.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/page-debug-flags.h>
+#include <linux/workqueue.h>
 #include <asm/page.h>
 #include <asm/mmu.h>
 
@@ -219,10 +221,20 @@ struct mm_rss_stat {
 };
 #endif /* !USE_SPLIT_PTLOCKS */
 
+/* Why a TLB flush was done, for the tlb_flush tracepoint */
+enum tlb_flush_reason {
+	TLB_REMOTE_SHOOTDOWN,
+	TLB_LOCAL_SHOOTDOWN,
+	TLB_LOCAL_MM_SHOOTDOWN,
+	TLB_REMOTE_SEND_IPI,
+	TLB_LAZY_SKIPPED,
+	NR_TLB_FLUSH_REASONS,
+};
+
 struct mm_struct {
 	struct vm_area_struct * mmap;		/* list of VMAs */
 	struct rb_root mm_rb;
-	struct vm_area_struct * mmap_cache;	/* last find_vma result */
+	u32 vmacache_seqnum;			/* per-thread vmacache */
 #ifdef CONFIG_MMU
 	unsigned long (*get_unmapped_area) (struct file *filp,
 				unsigned long addr, unsigned long len,
@@ -238,6 +250,9 @@ struct mm_struct {
 	atomic_t mm_count;			/* How many references to "struct mm_struct" (users count as 1) */
 	int map_count;				/* number of VMAs */
 	struct rw_semaphore mmap_sem;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t mm_seq;			/* VMA changes, for faults without mmap_sem */
+#endif
 	spinlock_t page_table_lock;		/* Protects page tables and some counters */
 
 	struct list_head mmlist;		/* List of maybe swapped mm's.	These are globally strung
@@ -310,6 +325,20 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+	/* Automatic NUMA placement, see task_tick_numa() */
+	struct work_struct numa_work;
+	unsigned long numa_next_scan;	/* jiffies of the next scan */
+	unsigned long numa_scan_offset;	/* where the next scan starts */
+	int numa_scan_nid;		/* node to pull pages toward */
+	unsigned long numa_samples_local;	/* accessed pages found local */
+	unsigned long numa_samples_remote;	/* ... and found remote */
+#endif
+#ifdef CONFIG_FUTEX
+	/* Hash for FUTEX_PRIVATE_FLAG futexes, see futex_hash_allocate() */
+	struct futex_hash_bucket *futex_hash;
+	unsigned int futex_hash_mask;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
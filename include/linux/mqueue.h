@@ -18,6 +18,8 @@
 #ifndef _LINUX_MQUEUE_H
 #define _LINUX_MQUEUE_H
 
+#include <linux/types.h>
+
 #define MQ_PRIO_MAX 	32768
 /* per-uid limit of kernel memory used by mqueue, in bytes */
 #define MQ_BYTES_MAX	819200
@@ -30,6 +32,17 @@ struct mq_attr {
 	long	__reserved[4];	/* ignored for input, zeroed for output */
 };
 
+/*
+ * One message of mq_timedreceive_batch().  The fields are 64 bits wide,
+ * so 32 bit and 64 bit tasks share the layout.
+ */
+struct mq_mmsg {
+	__u64	msg_ptr;	/* buffer for the message		*/
+	__u64	msg_len;	/* size of the buffer, message length on return */
+	__u32	msg_prio;	/* message priority on return		*/
+	__u32	__reserved;
+};
+
 /*
  * SIGEV_THREAD implementation:
  * SIGEV_THREAD must be implemented in user space. If SIGEV_THREAD is passed
@@ -46,21 +46,21 @@ enum {
 #define NBD_READ_ONLY 0x0001
 #define NBD_WRITE_NOCHK 0x0002
 
+/* sockets a device can be given with NBD_SET_SOCK */
+#define NBD_MAX_CONNECTIONS 16
+
 struct request;
+struct nbd_sock;
 
 struct nbd_device {
 	int flags;
 	int harderror;		/* Code of hard error			*/
-	struct socket * sock;
-	struct file * file; 	/* If == NULL, device is not ready, yet	*/
+	int num_connections;	/* If == 0, device is not ready, yet	*/
+	struct nbd_sock *socks[NBD_MAX_CONNECTIONS];
 	int magic;
 
-	spinlock_t queue_lock;
-	struct list_head queue_head;	/* Requests waiting result */
-	struct request *active_req;
-	wait_queue_head_t active_wq;
-	struct list_head waiting_queue;	/* Requests to be sent */
-	wait_queue_head_t waiting_wq;
+	int tag_starved;	/* a sender found no free tag */
+	wait_queue_head_t waiting_wq;	/* senders wait for requests */
 
 	struct mutex tx_lock;
 	struct gendisk *disk;
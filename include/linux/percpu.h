@@ -630,4 +630,33 @@ do {									\
 # define irqsafe_cpu_xor(pcp, val) __pcpu_size_call(irqsafe_cpu_xor_, (val))
 #endif
 
+/*
+ * cmpxchg_double replaces two adjacent scalars at once.  The first
+ * two parameters are per cpu variables that must be adjacent and the
+ * first one must be aligned to twice its size, so that an arch can use
+ * a double word cmpxchg instruction.  Returns true if the old values
+ * matched and both variables were replaced.
+ */
+#define irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2,	\
+					   nval1, nval2)		\
+({									\
+	int __ret = 0;							\
+	unsigned long __flags;						\
+	local_irq_save(__flags);					\
+	if (*__this_cpu_ptr(&(pcp1)) == (oval1) &&			\
+	    *__this_cpu_ptr(&(pcp2)) == (oval2)) {			\
+		*__this_cpu_ptr(&(pcp1)) = (nval1);			\
+		*__this_cpu_ptr(&(pcp2)) = (nval2);			\
+		__ret = 1;						\
+	}								\
+	local_irq_restore(__flags);					\
+	__ret;								\
+})
+
+#ifndef irqsafe_cpu_cmpxchg_double
+# define irqsafe_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+	irqsafe_generic_cpu_cmpxchg_double((pcp1), (pcp2), (oval1), (oval2), \
+					   (nval1), (nval2))
+#endif
+
 #endif /* __LINUX_PERCPU_H */
@@ -215,8 +215,10 @@ struct perf_event_attr {
 				 */
 				precise_ip     :  2, /* skid constraint       */
 				mmap_data      :  1, /* non-exec mmap data    */
+				aggregate      :  1, /* count samples by key  */
+				aggr_key       :  2, /* enum perf_aggr_key    */
 
-				__reserved_1   : 46;
+				__reserved_1   : 43;
 
 	union {
 		__u32		wakeup_events;	  /* wakeup every n events */
@@ -226,6 +228,60 @@ struct perf_event_attr {
 	__u32			bp_type;
 	__u64			bp_addr;
 	__u64			bp_len;
+
+	__u32			aggr_entries;	 /* slots, 0 for the default */
+	__u16			aggr_raw_offset; /* PERF_AGGR_KEY_RAW field ... */
+	__u16			aggr_raw_size;	 /* ... and its size: 1,2,4,8 */
+};
+
+/*
+ * In-kernel aggregation:
+ *
+ * With attr.aggregate set, samples are not written to the mmap buffer:
+ * they are counted in a hash table of the event instead, by the key
+ * attr.aggr_key selects from the sample, which must then have the
+ * corresponding PERF_SAMPLE_ bit set:
+ *
+ *   PERF_AGGR_KEY_IP		the sample ip
+ *   PERF_AGGR_KEY_CALLCHAIN	the first PERF_AGGR_MAX_DEPTH entries of
+ *				the callchain
+ *   PERF_AGGR_KEY_RAW		a field of the raw sample of a tracepoint,
+ *				read as an unsigned native-endian integer
+ *
+ * PERF_EVENT_IOC_AGGR_READ copies the keys counted so far, as struct
+ * perf_aggr_record followed by nr callchain entries, and can take those
+ * counts off the table at the same time.  Samples which found the table
+ * full are accounted as dropped.
+ */
+enum perf_aggr_key {
+	PERF_AGGR_KEY_IP		= 0,
+	PERF_AGGR_KEY_CALLCHAIN		= 1,
+	PERF_AGGR_KEY_RAW		= 2,
+
+	PERF_AGGR_KEY_MAX,		/* non-ABI */
+};
+
+#define PERF_AGGR_MAX_DEPTH		16
+#define PERF_AGGR_DEF_ENTRIES		4096
+#define PERF_AGGR_MAX_ENTRIES		(1U << 20)
+
+struct perf_aggr_record {
+	__u64	key;	/* ip, raw field or hash of the callchain */
+	__u64	count;	/* samples */
+	__u64	period;	/* sum of their periods */
+	__u64	nr;	/* callchain entries following */
+};
+
+enum perf_aggr_read_flags {
+	PERF_AGGR_READ_RESET		= 1U << 0, /* take the counts read off */
+};
+
+struct perf_aggr_read {
+	__u64	buf;		/* user buffer for the records */
+	__u64	size;		/* its size in bytes */
+	__u32	flags;		/* enum perf_aggr_read_flags */
+	__u32	nr;		/* out: records copied */
+	__u64	dropped;	/* out: samples dropped, table full */
 };
 
 /*
@@ -238,6 +294,7 @@ struct perf_event_attr {
 #define PERF_EVENT_IOC_PERIOD		_IOW('$', 4, __u64)
 #define PERF_EVENT_IOC_SET_OUTPUT	_IO ('$', 5)
 #define PERF_EVENT_IOC_SET_FILTER	_IOW('$', 6, char *)
+#define PERF_EVENT_IOC_AGGR_READ	_IOWR('$', 7, struct perf_aggr_read)
 
 enum perf_event_ioc_flags {
 	PERF_IOC_FLAG_GROUP		= 1U << 0,
@@ -486,6 +543,7 @@ struct perf_guest_info_callbacks {
 #include <linux/workqueue.h>
 #include <linux/ftrace.h>
 #include <linux/cpu.h>
+#include <linux/jump_label.h>
 #include <asm/atomic.h>
 #include <asm/local.h>
 
@@ -551,6 +609,7 @@ struct hw_perf_event {
 };
 
 struct perf_event;
+struct perf_aggr;
 
 /*
  * Common implementation detail of pmu::{start,commit,cancel}_txn
@@ -755,6 +814,9 @@ struct perf_event {
 
 	perf_overflow_handler_t		overflow_handler;
 
+	/* attr.aggregate: table of the top parent, shared by children */
+	struct perf_aggr		*aggr;
+
 #ifdef CONFIG_EVENT_TRACING
 	struct ftrace_event_call	*tp_event;
 	struct event_filter		*filter;
@@ -954,18 +1016,24 @@ static inline void perf_fetch_caller_regs(struct pt_regs *regs)
 	perf_arch_fetch_caller_regs(regs, CALLER_ADDR0);
 }
 
-static inline void
+/*
+ * Always inlined, with a constant event_id: the enabled count is a jump
+ * label key, which has to be a constant address.
+ */
+static __always_inline void
 perf_sw_event(u32 event_id, u64 nr, int nmi, struct pt_regs *regs, u64 addr)
 {
-	if (atomic_read(&perf_swevent_enabled[event_id])) {
-		struct pt_regs hot_regs;
-
-		if (!regs) {
-			perf_fetch_caller_regs(&hot_regs);
-			regs = &hot_regs;
-		}
-		__perf_sw_event(event_id, nr, nmi, regs, addr);
+	struct pt_regs hot_regs;
+
+	JUMP_LABEL(&perf_swevent_enabled[event_id], have_event);
+	return;
+
+have_event:
+	if (!regs) {
+		perf_fetch_caller_regs(&hot_regs);
+		regs = &hot_regs;
 	}
+	__perf_sw_event(event_id, nr, nmi, regs, addr);
 }
 
 extern void perf_event_mmap(struct vm_area_struct *vma);
@@ -7,6 +7,9 @@
 #include <linux/plist.h>
 #include <linux/notifier.h>
 #include <linux/miscdevice.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/list.h>
 
 #define PM_QOS_RESERVED 0
 #define PM_QOS_CPU_DMA_LATENCY 1
@@ -31,4 +34,27 @@ int pm_qos_add_notifier(int pm_qos_class, struct notifier_block *notifier);
 int pm_qos_remove_notifier(int pm_qos_class, struct notifier_block *notifier);
 int pm_qos_request_active(struct pm_qos_request_list *req);
 
+/*
+ * A cpu_dma_latency request for some cpus only, e.g. those a device
+ * interrupts.  With an irq, the cpus follow its affinity.
+ */
+struct pm_qos_cpu_request {
+	struct plist_node __percpu *nodes;
+	cpumask_var_t cpus;
+	s32 value;
+	int irq;
+	struct list_head irq_list;
+};
+
+int pm_qos_add_cpu_request(struct pm_qos_cpu_request *req,
+			   const struct cpumask *cpus, s32 value);
+int pm_qos_add_irq_request(struct pm_qos_cpu_request *req, unsigned int irq,
+			   s32 value);
+void pm_qos_update_cpu_request(struct pm_qos_cpu_request *req,
+			       const struct cpumask *cpus, s32 new_value);
+void pm_qos_remove_cpu_request(struct pm_qos_cpu_request *req);
+s32 pm_qos_cpu_latency(int cpu);
+void pm_qos_irq_affinity_changed(unsigned int irq,
+				 const struct cpumask *cpus);
+
 #endif
@@ -25,6 +25,12 @@ extern struct ctl_table epoll_table[]; /* for sysctl */
 
 #define DEFAULT_POLLMASK (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM)
 
+/*
+ * In the key, asks ->poll() to busy poll the device queues once; in the
+ * returned mask, tells that it can (see net/busy_poll.h).
+ */
+#define POLL_BUSY_LOOP	0x8000
+
 struct poll_table_struct;
 
 /* 
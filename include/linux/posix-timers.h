@@ -64,6 +64,7 @@ struct k_itimer {
 			unsigned long expires;
 		} mmtimer;
 	} it;
+	struct rcu_head it_rcu;		/* to free it after lookups */
 };
 
 struct k_clock {
@@ -280,6 +280,9 @@ static inline void dqstats_dec(unsigned int type)
 				 * quotactl. They are set under dq_data_lock\
 				 * and the quota format handling dquot can\
 				 * clear them when it sees fit. */
+#define DQ_PCPU_B	(DQ_LASTSET_B + 6)
+				/* Space changes may be cached on some cpus,
+				 * see dquot_sync_cached() */
 
 struct dquot {
 	struct hlist_node dq_hash;	/* Hash list in memory */
@@ -102,6 +102,15 @@ static inline void prandom32_seed(struct rnd_state *state, u64 seed)
 	state->s3 = __seed(i, 15);
 }
 
+/*
+ * Cheap LCG step (Numerical Recipes constants), for spreading a hash
+ * over several picks where the quality of prandom32() is not needed.
+ */
+static inline u32 next_pseudo_random32(u32 seed)
+{
+	return seed * 1664525 + 1013904223;
+}
+
 #endif /* __KERNEL___ */
 
 #endif /* _LINUX_RANDOM_H */
@@ -152,6 +152,37 @@ static inline bool res_counter_soft_limit_check_locked(struct res_counter *cnt)
  * Returns 0 if usage is less than or equal to soft limit
  * The difference between usage and soft limit, otherwise.
  */
+#if BITS_PER_LONG == 64
+/*
+ * 64bit loads are atomic, so the checks below need not take the counter
+ * lock: the answer may be stale by the time it is used anyway.  This keeps
+ * them from bouncing the lock of every level of a hierarchy.
+ */
+static inline unsigned long long
+res_counter_soft_limit_excess(struct res_counter *cnt)
+{
+	unsigned long long usage = ACCESS_ONCE(cnt->usage);
+	unsigned long long soft_limit = ACCESS_ONCE(cnt->soft_limit);
+
+	if (usage <= soft_limit)
+		return 0;
+	return usage - soft_limit;
+}
+
+/*
+ * Helper function to detect if the cgroup is within it's limit or
+ * not. It's currently called from cgroup_rss_prepare()
+ */
+static inline bool res_counter_check_under_limit(struct res_counter *cnt)
+{
+	return ACCESS_ONCE(cnt->usage) < ACCESS_ONCE(cnt->limit);
+}
+
+static inline bool res_counter_check_under_soft_limit(struct res_counter *cnt)
+{
+	return ACCESS_ONCE(cnt->usage) < ACCESS_ONCE(cnt->soft_limit);
+}
+#else
 static inline unsigned long long
 res_counter_soft_limit_excess(struct res_counter *cnt)
 {
@@ -192,6 +223,7 @@ static inline bool res_counter_check_under_soft_limit(struct res_counter *cnt)
 	spin_unlock_irqrestore(&cnt->lock, flags);
 	return ret;
 }
+#endif
 
 static inline void res_counter_reset_max(struct res_counter *cnt)
 {
@@ -94,6 +94,7 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct splice_pipe_desc;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -170,6 +171,7 @@ struct skb_shared_hwtstamps {
  * @in_progress:	device driver is going to provide
  *			hardware time stamp
  * @prevent_sk_orphan:	make sk reference available on driver level
+ * @dev_zerocopy:	frags are user pages, &ubuf_info in destructor_arg
  * @flags:		all shared_tx flags
  *
  * These flags are attached to packets as part of the
@@ -180,11 +182,24 @@ union skb_shared_tx {
 		__u8	hardware:1,
 			software:1,
 			in_progress:1,
-			prevent_sk_orphan:1;
+			prevent_sk_orphan:1,
+			dev_zerocopy:1;
 	};
 	__u8 flags;
 };
 
+/*
+ * The callback tells the owner of the user pages an skb points to that
+ * the skb is done with them: the lower device has sent it, or the pages
+ * were copied.  It is called once, when the last reference to the data
+ * is dropped.  desc is for the owner to find its buffer back.
+ */
+struct ubuf_info {
+	void		(*callback)(struct ubuf_info *);
+	void		*ctx;
+	unsigned long	desc;
+};
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -245,6 +260,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* The TCP segments are carried in GRE, outer headers included. */
+	SKB_GSO_GRE = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -303,6 +321,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@nf_bridge: Saved data about a bridged frame - see br_netfilter.c
  *	@skb_iif: ifindex of device we arrived on
  *	@rxhash: the packet hash computed on receive
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@queue_mapping: Queue mapping for multiqueue devices
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
@@ -379,6 +398,9 @@ struct sk_buff {
 #endif
 
 	__u32			rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
 
 	kmemcheck_bitfield_begin(flags2);
 	__u16			queue_mapping:16;
@@ -493,6 +515,7 @@ static inline struct rtable *skb_rtable(const struct sk_buff *skb)
 extern void kfree_skb(struct sk_buff *skb);
 extern void consume_skb(struct sk_buff *skb);
 extern void	       __kfree_skb(struct sk_buff *skb);
+extern void	       __kfree_skb_list(struct sk_buff *skb);
 extern struct sk_buff *__alloc_skb(unsigned int size,
 				   gfp_t priority, int fclone, int node);
 static inline struct sk_buff *alloc_skb(unsigned int size,
@@ -583,6 +606,24 @@ static inline union skb_shared_tx *skb_tx(struct sk_buff *skb)
 	return &skb_shinfo(skb)->tx_flags;
 }
 
+extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
+
+/**
+ *	skb_orphan_frags - make a local copy of the user pages of an skb
+ *	@skb: buffer to orphan frags from
+ *	@gfp_mask: allocation mask for the replacement pages
+ *
+ *	Called before an skb whose frags are pinned user pages is held for
+ *	an unbounded time, shared or handed to a local reader.  Returns 0,
+ *	or -ENOMEM with the skb left untouched.
+ */
+static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_tx(skb)->dev_zerocopy))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1823,6 +1864,9 @@ extern int	       skb_copy_datagram_from_iovec(struct sk_buff *skb,
 						    const struct iovec *from,
 						    int from_offset,
 						    int len);
+extern int	       zerocopy_sg_from_iovec(struct sk_buff *skb,
+					      const struct iovec *from,
+					      int offset, size_t count);
 extern int	       skb_copy_datagram_const_iovec(const struct sk_buff *from,
 						     int offset,
 						     const struct iovec *to,
@@ -1847,6 +1891,15 @@ extern int             skb_splice_bits(struct sk_buff *skb,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
 						unsigned int flags);
+extern int             skb_splice_bits_sk(struct sk_buff *skb,
+						struct sock *sk,
+						unsigned int offset,
+						struct pipe_inode_info *pipe,
+						unsigned int len,
+						unsigned int flags,
+						ssize_t (*splice_cb)(struct sock *,
+							struct pipe_inode_info *,
+							struct splice_pipe_desc *));
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
@@ -2165,6 +2218,15 @@ static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
 extern u16 skb_tx_hash(const struct net_device *dev,
 		       const struct sk_buff *skb);
 
+extern __u32 __skb_get_rxhash(struct sk_buff *skb);
+static inline __u32 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		skb->rxhash = __skb_get_rxhash(skb);
+
+	return skb->rxhash;
+}
+
 #ifdef CONFIG_XFRM
 static inline struct sec_path *skb_sec_path(struct sk_buff *skb)
 {
@@ -105,6 +105,7 @@ enum {
 #define TCP_COOKIE_TRANSACTIONS	15	/* TCP Cookie Transactions */
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
+#define TCP_FASTOPEN		23	/* Enable Fast Open on listeners */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
@@ -236,6 +237,17 @@ struct tcp_sack_block {
 	u32	end_seq;
 };
 
+/* TCP Fast Open */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* A cookie of zero length requests one, a negative length means none. */
+struct tcp_fastopen_cookie {
+	s8	len;
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
 struct tcp_options_received {
 /*	PAWS/RTTM data	*/
 	long	ts_recent_stamp;/* Time we stored ts_recent (for aging) */
@@ -281,6 +293,7 @@ struct tcp_request_sock {
 #endif
 	u32				rcv_isn;
 	u32				snt_isn;
+	u32				rcv_nxt; /* the ack # by SYN-ACK */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -345,7 +358,8 @@ struct tcp_sock {
 	u8	nonagle     : 4,/* Disable Nagle algorithm?             */
 		thin_lto    : 1,/* Use linear timeouts for thin streams */
 		thin_dupack : 1,/* Fast retransmit on first dupack      */
-		unused      : 2;
+		syn_fastopen : 1,/* SYN includes Fast Open option      */
+		syn_data    : 1;/* SYN includes data                    */
 
 /* RTT measurement */
 	u32	srtt;		/* smoothed round trip time << 3	*/
@@ -459,6 +473,26 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+/* TCP Fast Open */
+	struct tcp_fastopen_request *fastopen_req; /* active open in progress */
+	/* In a passively opened child still in SYN_RECV, the request used to
+	 * retransmit the SYN-ACK; its ->sk holds the listener.
+	 */
+	struct request_sock	*fastopen_rsk;
+	/* In a listener, its children still in SYN_RECV, and their limit */
+	atomic_t		fastopen_qlen;
+	int			fastopen_max_qlen;
+
+	/* TCP Small Queues */
+	unsigned long		tsq_flags;
+	struct list_head	tsq_node;	/* in the per-cpu tsq_tasklet */
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,	/* over tcp_limit_output_bytes below the stack */
+	TSQ_QUEUED,	/* in a tsq_tasklet list */
+	TSQ_OWNED,	/* tcp_tasklet_func() found the socket owned by user */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
@@ -68,6 +68,9 @@ void init_timer_key(struct timer_list *timer,
 void init_timer_deferrable_key(struct timer_list *timer,
 			       const char *name,
 			       struct lock_class_key *key);
+void init_timer_coarse_key(struct timer_list *timer,
+			   const char *name,
+			   struct lock_class_key *key);
 
 #ifdef CONFIG_LOCKDEP
 #define init_timer(timer)						\
@@ -82,6 +85,12 @@ void init_timer_deferrable_key(struct timer_list *timer,
 		init_timer_deferrable_key((timer), #timer, &__key);	\
 	} while (0)
 
+#define init_timer_coarse(timer)					\
+	do {								\
+		static struct lock_class_key __key;			\
+		init_timer_coarse_key((timer), #timer, &__key);		\
+	} while (0)
+
 #define init_timer_on_stack(timer)					\
 	do {								\
 		static struct lock_class_key __key;			\
@@ -94,6 +103,13 @@ void init_timer_deferrable_key(struct timer_list *timer,
 		setup_timer_key((timer), #timer, &__key, (fn), (data));\
 	} while (0)
 
+#define setup_timer_coarse(timer, fn, data)				\
+	do {								\
+		static struct lock_class_key __key;			\
+		setup_timer_coarse_key((timer), #timer, &__key,		\
+				       (fn), (data));			\
+	} while (0)
+
 #define setup_timer_on_stack(timer, fn, data)				\
 	do {								\
 		static struct lock_class_key __key;			\
@@ -112,10 +128,14 @@ void init_timer_deferrable_key(struct timer_list *timer,
 	init_timer_key((timer), NULL, NULL)
 #define init_timer_deferrable(timer)\
 	init_timer_deferrable_key((timer), NULL, NULL)
+#define init_timer_coarse(timer)\
+	init_timer_coarse_key((timer), NULL, NULL)
 #define init_timer_on_stack(timer)\
 	init_timer_on_stack_key((timer), NULL, NULL)
 #define setup_timer(timer, fn, data)\
 	setup_timer_key((timer), NULL, NULL, (fn), (data))
+#define setup_timer_coarse(timer, fn, data)\
+	setup_timer_coarse_key((timer), NULL, NULL, (fn), (data))
 #define setup_timer_on_stack(timer, fn, data)\
 	setup_timer_on_stack_key((timer), NULL, NULL, (fn), (data))
 #define setup_deferrable_timer_on_stack(timer, fn, data)\
@@ -148,6 +168,17 @@ static inline void setup_timer_key(struct timer_list * timer,
 	init_timer_key(timer, name, key);
 }
 
+static inline void setup_timer_coarse_key(struct timer_list *timer,
+				const char *name,
+				struct lock_class_key *key,
+				void (*function)(unsigned long),
+				unsigned long data)
+{
+	timer->function = function;
+	timer->data = data;
+	init_timer_coarse_key(timer, name, key);
+}
+
 static inline void setup_timer_on_stack_key(struct timer_list *timer,
 					const char *name,
 					struct lock_class_key *key,
@@ -203,6 +234,8 @@ extern void set_timer_slack(struct timer_list *time, int slack_hz);
  */
 extern unsigned long get_next_timer_interrupt(unsigned long now);
 
+extern int timer_coalesce_idle(int target, int *saved);
+
 /*
  * Timer-statistics info:
  */
@@ -211,6 +244,12 @@ extern unsigned long get_next_timer_interrupt(unsigned long now);
 extern int timer_stats_active;
 
 #define TIMER_STATS_FLAG_DEFERRABLE	0x1
+#define TIMER_STATS_FLAG_SITE		0x2
+
+/* Events accounted per timer setup site */
+#define TIMER_STATS_SITE_ARM		0
+#define TIMER_STATS_SITE_CANCEL		1
+#define TIMER_STATS_SITE_EXPIRE		2
 
 extern void init_timer_stats(void);
 
@@ -218,6 +257,8 @@ extern void timer_stats_update_stats(void *timer, pid_t pid, void *startf,
 				     void *timerf, char *comm,
 				     unsigned int timer_flag);
 
+extern void timer_stats_update_site(void *startf, void *timerf, int event);
+
 extern void __timer_stats_timer_set_start_info(struct timer_list *timer,
 					       void *addr);
 
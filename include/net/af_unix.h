@@ -9,7 +9,8 @@
 extern void unix_inflight(struct file *fp);
 extern void unix_notinflight(struct file *fp);
 extern void unix_gc(void);
-extern void wait_for_unix_gc(void);
+struct scm_fp_list;
+extern void wait_for_unix_gc(struct scm_fp_list *fpl);
 
 #define UNIX_HASH_SIZE	256
 
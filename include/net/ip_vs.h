@@ -19,6 +19,9 @@
 #include <asm/atomic.h>                 /* for struct atomic_t */
 #include <linux/compiler.h>
 #include <linux/timer.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
 
 #include <net/checksum.h>
 #include <linux/netfilter.h>		/* for union nf_inet_addr */
@@ -276,9 +279,20 @@ struct ip_vs_estimator {
 	u32			outbps;
 };
 
+/*
+ *	The packet path counts on the local cpu only; the counters in
+ *	ustats are summed from these under the lock, by ip_vs_sum_stats().
+ */
+struct ip_vs_cpu_stats {
+	struct ip_vs_stats_user	ustats;		/* only the counters */
+	struct u64_stats_sync	syncp;
+};
+
 struct ip_vs_stats {
 	struct ip_vs_stats_user	ustats;         /* statistics */
 	struct ip_vs_estimator	est;		/* estimator */
+	struct ip_vs_cpu_stats __percpu *cpustats;	/* the counters */
+	struct ip_vs_stats_user	ustats0;	/* counters when zeroed */
 
 	spinlock_t              lock;           /* spin lock */
 };
@@ -359,7 +373,7 @@ extern struct ip_vs_protocol * ip_vs_proto_get(unsigned short proto);
  *	IP_VS structure allocated for each dynamically scheduled connection
  */
 struct ip_vs_conn {
-	struct list_head        c_list;         /* hashed list heads */
+	struct hlist_node	c_list;         /* hashed list heads */
 
 	/* Protocol, addresses and port numbers */
 	u16                      af;		/* address family */
@@ -405,6 +419,8 @@ struct ip_vs_conn {
 	void                    *app_data;      /* Application private data */
 	struct ip_vs_seq        in_seq;         /* incoming seq. struct */
 	struct ip_vs_seq        out_seq;        /* outgoing seq. struct */
+
+	struct rcu_head		rcu_head;	/* lookups are lockless */
 };
 
 
@@ -846,6 +862,8 @@ extern void ip_vs_estimator_cleanup(void);
 extern void ip_vs_new_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_kill_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_zero_estimator(struct ip_vs_stats *stats);
+extern void ip_vs_sum_stats(struct ip_vs_stats *stats);
+extern void ip_vs_zero_sum_stats(struct ip_vs_stats *stats);
 
 /*
  *	Various IPVS packet transmitters (from ip_vs_xmit.c)
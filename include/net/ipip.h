@@ -49,7 +49,8 @@ struct ip_tunnel_prl_entry {
 	int err;							\
 	int pkt_len = skb->len - skb_transport_offset(skb);		\
 									\
-	skb->ip_summed = CHECKSUM_NONE;					\
+	if (!skb_is_gso(skb))						\
+		skb->ip_summed = CHECKSUM_NONE;				\
 	ip_select_ident(iph, &rt->dst, NULL);				\
 									\
 	err = ip_local_out(skb);					\
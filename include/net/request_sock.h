@@ -112,14 +112,16 @@ struct listen_sock {
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
  *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
+ * %syn_wait_lock protects the SYN table and its counters.  SYNs for TCP
+ * listeners are hashed without the listener lock (see tcp_v4_rcv()), so
+ * every change to the table is made with it held in write mode.  Removals
+ * are still made with the main sock lock held as well, hence the readers
+ * holding it need not grab this lock in read mode: they may only miss the
+ * requests being inserted at the head of the chains.  The others, the
+ * proc interface and unlocked SYNs, grab it in read mode.
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * The listen_sock is freed after a grace period once yanked, for the
+ * unlocked SYNs to read it under rcu_read_lock().
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
@@ -155,6 +157,9 @@ static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
 				      struct request_sock **prev_req)
 {
 	write_lock(&queue->syn_wait_lock);
+	/* Unlocked SYNs may have hashed requests in front of us meanwhile */
+	while (*prev_req != req)
+		prev_req = &(*prev_req)->dl_next;
 	*prev_req = req->dl_next;
 	write_unlock(&queue->syn_wait_lock);
 }
@@ -206,52 +211,74 @@ static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 				      struct request_sock *req)
 {
 	struct listen_sock *lopt = queue->listen_opt;
+	int qlen;
 
+	write_lock(&queue->syn_wait_lock);
 	if (req->retrans == 0)
 		--lopt->qlen_young;
+	qlen = --lopt->qlen;
+	write_unlock(&queue->syn_wait_lock);
 
-	return --lopt->qlen;
-}
-
-static inline int reqsk_queue_added(struct request_sock_queue *queue)
-{
-	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
-
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	return qlen;
 }
 
+/*
+ * The three below may be called by unlocked SYNs, which can find the
+ * listen_sock yanked under them.
+ */
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	const struct listen_sock *lopt = ACCESS_ONCE(queue->listen_opt);
+
+	return lopt != NULL ? lopt->qlen : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	const struct listen_sock *lopt = ACCESS_ONCE(queue->listen_opt);
+
+	return lopt != NULL ? lopt->qlen_young : 0;
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	const struct listen_sock *lopt = ACCESS_ONCE(queue->listen_opt);
+
+	return lopt != NULL ? lopt->qlen >> lopt->max_qlen_log : 0;
 }
 
-static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
-					u32 hash, struct request_sock *req,
-					unsigned long timeout)
+/* Returns the previous queue length.  Called with syn_wait_lock held. */
+static inline int __reqsk_queue_hash_req(struct listen_sock *lopt,
+					 u32 hash, struct request_sock *req,
+					 unsigned long timeout)
 {
-	struct listen_sock *lopt = queue->listen_opt;
+	const int prev_qlen = lopt->qlen;
 
 	req->expires = jiffies + timeout;
 	req->retrans = 0;
 	req->sk = NULL;
 	req->dl_next = lopt->syn_table[hash];
+	/* Paired with the chain walks of the main sock lock holders */
+	smp_wmb();
+	lopt->syn_table[hash] = req;
+
+	lopt->qlen_young++;
+	lopt->qlen++;
+	return prev_qlen;
+}
+
+static inline int reqsk_queue_hash_req(struct request_sock_queue *queue,
+				       u32 hash, struct request_sock *req,
+				       unsigned long timeout)
+{
+	int prev_qlen;
 
 	write_lock(&queue->syn_wait_lock);
-	lopt->syn_table[hash] = req;
+	prev_qlen = __reqsk_queue_hash_req(queue->listen_opt, hash, req,
+					   timeout);
 	write_unlock(&queue->syn_wait_lock);
+
+	return prev_qlen;
 }
 
 #endif /* _REQUEST_SOCK_H */
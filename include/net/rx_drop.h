@@ -0,0 +1,49 @@
+#ifndef _NET_RX_DROP_H
+#define _NET_RX_DROP_H
+
+/*
+ * Early drop of unwanted IPv4 packets, checked when a driver hands them
+ * to the stack, before RPS and the protocol handlers.
+ */
+
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/rcupdate.h>
+
+#ifdef CONFIG_NET_RX_DROP
+extern bool __rx_drop_match(const struct rx_drop_table *t,
+			    struct sk_buff *skb);
+extern ssize_t rx_drop_show(const struct net_device *dev, char *buf);
+extern ssize_t rx_drop_count_show(const struct net_device *dev, char *buf);
+extern int rx_drop_change(struct net_device *dev, const char *buf,
+			  size_t len);
+extern void rx_drop_flush(struct net_device *dev);
+
+/* Is skb to be dropped right away?  Counts the drop if so. */
+static inline bool rx_drop_match(struct sk_buff *skb)
+{
+	const struct rx_drop_table *t;
+	bool drop = false;
+
+	if (likely(!skb->dev->rx_drop))
+		return false;
+
+	rcu_read_lock();
+	t = rcu_dereference(skb->dev->rx_drop);
+	if (t)
+		drop = __rx_drop_match(t, skb);
+	rcu_read_unlock();
+	return drop;
+}
+#else
+static inline bool rx_drop_match(struct sk_buff *skb)
+{
+	return false;
+}
+
+static inline void rx_drop_flush(struct net_device *dev)
+{
+}
+#endif
+
+#endif /* _NET_RX_DROP_H */
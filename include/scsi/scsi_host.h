@@ -7,6 +7,7 @@
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
 #include <scsi/scsi.h>
+#include <asm/atomic.h>
 
 struct request_queue;
 struct block_device;
@@ -125,6 +126,9 @@ struct scsi_host_template {
 	 * I/O pressure in the system if there are no other outstanding
 	 * commands.
 	 *
+	 * It is called with the host_lock held and interrupts disabled,
+	 * unless the template sets lockless.
+	 *
 	 * STATUS: REQUIRED
 	 */
 	int (* queuecommand)(struct scsi_cmnd *,
@@ -460,6 +464,13 @@ struct scsi_host_template {
 	 */
 	unsigned ordered_tag:1;
 
+	/*
+	 * True if queuecommand does its own locking: it is then called
+	 * without the host_lock, possibly with interrupts enabled and
+	 * concurrently on several cpus.
+	 */
+	unsigned lockless:1;
+
 	/*
 	 * Countdown for host blocking with no commands outstanding.
 	 */
@@ -554,12 +565,13 @@ struct Scsi_Host {
 	 */
 	struct blk_queue_tag	*bqt;
 
+	atomic_t host_busy;		   /* commands actually active on low-level */
+
 	/*
 	 * The following two fields are protected with host_lock;
 	 * however, eh routines can safely access during eh processing
 	 * without acquiring the lock.
 	 */
-	unsigned int host_busy;		   /* commands actually active on low-level */
 	unsigned int host_failed;	   /* commands that failed. */
 	unsigned int host_eh_scheduled;    /* EH scheduled without command */
     
@@ -603,9 +615,8 @@ struct Scsi_Host {
 	unsigned long dma_boundary;
 	/* 
 	 * Used to assign serial numbers to the cmds.
-	 * Protected by the host lock.
 	 */
-	unsigned long cmd_serial_number;
+	atomic_long_t cmd_serial_number;
 	
 	unsigned active_mode:2;
 	unsigned unchecked_isa_dma:1;
@@ -274,6 +274,37 @@ TRACE_EVENT(sched_process_fork,
 		__entry->child_comm, __entry->child_pid)
 );
 
+/*
+ * Tracepoint for the copy of the address space in fork, with its
+ * duration: this is the part of fork that grows with the process.
+ */
+TRACE_EVENT(sched_process_fork_mm,
+
+	TP_PROTO(struct task_struct *parent, struct mm_struct *mm, u64 delta),
+
+	TP_ARGS(parent, mm, delta),
+
+	TP_STRUCT__entry(
+		__array(	char,		comm,	TASK_COMM_LEN	)
+		__field(	pid_t,		pid			)
+		__field(	unsigned long,	vm			)
+		__field(	unsigned long,	rss			)
+		__field(	u64,		delta			)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->comm, parent->comm, TASK_COMM_LEN);
+		__entry->pid	= parent->pid;
+		__entry->vm	= mm->total_vm;
+		__entry->rss	= get_mm_rss(mm);
+		__entry->delta	= delta;
+	),
+
+	TP_printk("comm=%s pid=%d vm=%lu rss=%lu delta=%Lu [ns]",
+		__entry->comm, __entry->pid, __entry->vm, __entry->rss,
+		(unsigned long long)__entry->delta)
+);
+
 /*
  * XXX the below sched_stat tracepoints only apply to SCHED_OTHER/BATCH/IDLE
  *     adding sched_stat support to SCHED_FIFO/RR would be welcome.
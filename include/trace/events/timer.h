@@ -319,6 +319,42 @@ TRACE_EVENT(itimer_expire,
 		  (int) __entry->pid, (unsigned long long)__entry->now)
 );
 
+/**
+ * timer_coalesce - called when an idle cpu hands timers to a busy one
+ * @cpu:	the idle cpu
+ * @target:	the busy cpu the timers went to
+ * @nr_timers:	timer wheel timers moved
+ * @nr_hrtimers: hrtimers moved
+ * @saved:	wakeups of @cpu the move saved
+ */
+TRACE_EVENT(timer_coalesce,
+
+	TP_PROTO(int cpu, int target, int nr_timers, int nr_hrtimers,
+		 int saved),
+
+	TP_ARGS(cpu, target, nr_timers, nr_hrtimers, saved),
+
+	TP_STRUCT__entry(
+		__field( int,	cpu		)
+		__field( int,	target		)
+		__field( int,	nr_timers	)
+		__field( int,	nr_hrtimers	)
+		__field( int,	saved		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->target		= target;
+		__entry->nr_timers	= nr_timers;
+		__entry->nr_hrtimers	= nr_hrtimers;
+		__entry->saved		= saved;
+	),
+
+	TP_printk("cpu=%d target=%d timers=%d hrtimers=%d wakeups_saved=%d",
+		  __entry->cpu, __entry->target, __entry->nr_timers,
+		  __entry->nr_hrtimers, __entry->saved)
+);
+
 #endif /*  _TRACE_TIMER_H */
 
 /* This part must be outside protection */
@@ -153,6 +153,41 @@ DEFINE_WBC_EVENT(wbc_balance_dirty_written);
 DEFINE_WBC_EVENT(wbc_balance_dirty_wait);
 DEFINE_WBC_EVENT(wbc_writepage);
 
+TRACE_EVENT(writeback_single_inode,
+	TP_PROTO(struct inode *inode, struct writeback_control *wbc,
+		 long nr_to_write),
+	TP_ARGS(inode, wbc, nr_to_write),
+	TP_STRUCT__entry(
+		__array(char, name, 32)
+		__field(unsigned long, ino)
+		__field(unsigned long, state)
+		__field(unsigned int, age)
+		__field(unsigned long, index)
+		__field(long, nr_to_write)
+		__field(long, wrote)
+	),
+	TP_fast_assign(
+		strncpy(__entry->name,
+			dev_name(inode->i_mapping->backing_dev_info->dev), 32);
+		__entry->ino		= inode->i_ino;
+		__entry->state		= inode->i_state;
+		__entry->age		= jiffies_to_msecs(jiffies -
+							   inode->dirtied_when);
+		__entry->index		= inode->i_mapping->writeback_index;
+		__entry->nr_to_write	= nr_to_write;
+		__entry->wrote		= nr_to_write - wbc->nr_to_write;
+	),
+	TP_printk("bdi %s: ino=%lu state=0x%lx age=%u index=%lu "
+		  "to_write=%ld wrote=%ld",
+		  __entry->name,
+		  __entry->ino,
+		  __entry->state,
+		  __entry->age,
+		  __entry->index,
+		  __entry->nr_to_write,
+		  __entry->wrote)
+);
+
 #endif /* _TRACE_WRITEBACK_H */
 
 /* This part must be outside protection */
@@ -719,8 +719,6 @@ static void __init do_ctors(void)
 int initcall_debug;
 core_param(initcall_debug, initcall_debug, bool, 0644);
 
-static char msgbuf[64];
-
 static int __init_or_module do_one_initcall_debug(initcall_t fn)
 {
 	ktime_t calltime, delta, rettime;
@@ -742,6 +740,7 @@ static int __init_or_module do_one_initcall_debug(initcall_t fn)
 int __init_or_module do_one_initcall(initcall_t fn)
 {
 	int count = preempt_count();
+	char msgbuf[64];
 	int ret;
 
 	if (initcall_debug)
@@ -771,13 +770,143 @@ int __init_or_module do_one_initcall(initcall_t fn)
 
 
 extern initcall_t __initcall_start[], __initcall_end[], __early_initcall_end[];
+extern initcall_t __initcall0_start[], __initcall1_start[];
+extern initcall_t __initcall2_start[], __initcall3_start[];
+extern initcall_t __initcall4_start[], __initcall5_start[];
+extern initcall_t __initcallrootfs_start[], __initcall6_start[];
+extern initcall_t __initcall6a_start[], __initcall6s_start[];
+extern initcall_t __initcall7_start[];
+
+static initcall_t *initcall_levels[] __initdata = {
+	__initcall0_start,
+	__initcall1_start,
+	__initcall2_start,
+	__initcall3_start,
+	__initcall4_start,
+	__initcall5_start,
+	__initcallrootfs_start,
+	__initcall6_start,
+	__initcall7_start,
+	__initcall_end,
+};
+
+static char *initcall_level_names[] __initdata = {
+	"pure",
+	"core",
+	"postcore",
+	"arch",
+	"subsys",
+	"fs",
+	"rootfs",
+	"device",
+	"late",
+};
+
+/*
+ * With initcall_debug, the time of each level and of the longest call in
+ * it.  The levels run one after another, so the sum of the longest chain
+ * of calls of each level is the critical path of the boot.
+ */
+struct initcall_stat {
+	initcall_t longest;
+	s64 longest_us;
+	s64 total_us;
+};
+
+static DEFINE_SPINLOCK(initcall_stat_lock);
+static struct initcall_stat initcall_async_stat __initdata;
+static LIST_HEAD(initcall_domain);
+
+static s64 __init initcall_timed(initcall_t fn, struct initcall_stat *stat)
+{
+	ktime_t calltime;
+	s64 us;
+
+	if (!initcall_debug) {
+		do_one_initcall(fn);
+		return 0;
+	}
+
+	calltime = ktime_get();
+	do_one_initcall(fn);
+	us = ktime_to_us(ktime_sub(ktime_get(), calltime));
+
+	spin_lock(&initcall_stat_lock);
+	stat->total_us += us;
+	if (us > stat->longest_us) {
+		stat->longest = fn;
+		stat->longest_us = us;
+	}
+	spin_unlock(&initcall_stat_lock);
+
+	return us;
+}
+
+static void __init do_async_initcall(void *data, async_cookie_t cookie)
+{
+	initcall_t *fn = data;
+
+	initcall_timed(*fn, &initcall_async_stat);
+}
+
+static void __init do_initcall_level(int level, s64 *critical_us,
+				     s64 *sum_us)
+{
+	struct initcall_stat stat = { NULL, 0, 0 };
+	initcall_t *fn, *end = initcall_levels[level + 1];
+	ktime_t calltime = ktime_get();
+	s64 chain_us = 0;
+
+	/*
+	 * The asynchronous device initcalls are started first, so that they
+	 * overlap as much of the synchronous ones as they can.
+	 */
+	if (initcall_levels[level] == __initcall6_start) {
+		for (fn = __initcall6a_start; fn < __initcall6s_start; fn++)
+			async_schedule_domain(do_async_initcall, fn,
+					      &initcall_domain);
+		for (fn = __initcall6_start; fn < __initcall6a_start; fn++)
+			chain_us += initcall_timed(*fn, &stat);
+		async_synchronize_full_domain(&initcall_domain);
+		chain_us = max(chain_us, initcall_async_stat.longest_us);
+		fn = __initcall6s_start;
+	} else
+		fn = initcall_levels[level];
+
+	for (; fn < end; fn++)
+		chain_us += initcall_timed(*fn, &stat);
+
+	if (!initcall_debug)
+		return;
+
+	*sum_us += stat.total_us + initcall_async_stat.total_us;
+	*critical_us += chain_us;
+	printk(KERN_DEBUG "initcall level %s took %lld usecs",
+	       initcall_level_names[level],
+	       ktime_to_us(ktime_sub(ktime_get(), calltime)));
+	if (stat.longest)
+		printk(KERN_CONT ", longest %pF %lld usecs", stat.longest,
+		       stat.longest_us);
+	if (initcall_async_stat.longest)
+		printk(KERN_CONT ", longest async %pF %lld usecs",
+		       initcall_async_stat.longest,
+		       initcall_async_stat.longest_us);
+	printk(KERN_CONT "\n");
+	memset(&initcall_async_stat, 0, sizeof(initcall_async_stat));
+}
 
 static void __init do_initcalls(void)
 {
-	initcall_t *fn;
+	s64 critical_us = 0, sum_us = 0;
+	int level;
 
-	for (fn = __early_initcall_end; fn < __initcall_end; fn++)
-		do_one_initcall(*fn);
+	for (level = 0; level < ARRAY_SIZE(initcall_levels) - 1; level++)
+		do_initcall_level(level, &critical_us, &sum_us);
+
+	if (initcall_debug)
+		printk(KERN_DEBUG "initcalls: critical path %lld usecs, "
+		       "%lld usecs run one after another\n",
+		       critical_us, sum_us);
 
 	/* Make sure there is no pending stuff from the initcall sequence */
 	flush_scheduled_work();
@@ -102,6 +102,17 @@ asmlinkage ssize_t compat_sys_mq_timedreceive(mqd_t mqdes,
 			u_msg_prio, u_ts);
 }
 
+asmlinkage long compat_sys_mq_timedreceive_batch(mqd_t mqdes,
+			struct mq_mmsg __user *u_msgs, unsigned int vlen,
+			const struct compat_timespec __user *u_abs_timeout)
+{
+	struct timespec __user *u_ts;
+	if (compat_prepare_timeout(&u_ts, u_abs_timeout))
+		return -EFAULT;
+
+	return sys_mq_timedreceive_batch(mqdes, u_msgs, vlen, u_ts);
+}
+
 asmlinkage long compat_sys_mq_notify(mqd_t mqdes,
 			const struct compat_sigevent __user *u_notification)
 {
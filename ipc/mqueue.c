@@ -48,6 +48,9 @@
 #define STATE_PENDING	1
 #define STATE_READY	2
 
+/* messages mq_timedreceive_batch() takes under one lock */
+#define MQ_RECV_BATCH	16
+
 struct ext_wait_queue {		/* queue of sleeping tasks */
 	struct task_struct *task;
 	struct list_head list;
@@ -1014,6 +1017,151 @@ out:
 	return ret;
 }
 
+static int store_mmsg(struct mq_mmsg __user *u_mmsg, struct msg_msg *msg_ptr)
+{
+	struct mq_mmsg mmsg;
+
+	if (copy_from_user(&mmsg, u_mmsg, sizeof(mmsg)) ||
+	    store_msg((void __user *)(unsigned long)mmsg.msg_ptr, msg_ptr,
+		      msg_ptr->m_ts))
+		return -EFAULT;
+
+	mmsg.msg_len = msg_ptr->m_ts;
+	mmsg.msg_prio = msg_ptr->m_type;
+	if (copy_to_user(u_mmsg, &mmsg, sizeof(mmsg)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * mq_timedreceive_batch() - receive up to vlen messages at once
+ *
+ * Waits like mq_timedreceive() for the first message, then takes what
+ * else is queued, MQ_RECV_BATCH messages per queue lock round trip, so
+ * that a busy queue costs one syscall and a few lock acquisitions rather
+ * than one of each per message.  Returns the number of messages received.
+ */
+SYSCALL_DEFINE4(mq_timedreceive_batch, mqd_t, mqdes,
+		struct mq_mmsg __user *, u_msgs, unsigned int, vlen,
+		const struct timespec __user *, u_abs_timeout)
+{
+	long ret;
+	struct msg_msg *msgs[MQ_RECV_BATCH];
+	struct mq_mmsg mmsg;
+	struct file *filp;
+	struct inode *inode;
+	struct mqueue_inode_info *info;
+	struct ext_wait_queue wait;
+	ktime_t expires, *timeout = NULL;
+	struct timespec ts;
+	unsigned int i, n = 0, done = 0;
+	bool queued;
+
+	if (u_abs_timeout) {
+		int res = prepare_timeout(u_abs_timeout, &expires, &ts);
+		if (res)
+			return res;
+		timeout = &expires;
+	}
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	audit_mq_sendrecv(mqdes, 0, 0, timeout ? &ts : NULL);
+
+	filp = fget(mqdes);
+	if (unlikely(!filp)) {
+		ret = -EBADF;
+		goto out;
+	}
+
+	inode = filp->f_path.dentry->d_inode;
+	if (unlikely(filp->f_op != &mqueue_file_operations)) {
+		ret = -EBADF;
+		goto out_fput;
+	}
+	info = MQUEUE_I(inode);
+	audit_inode(NULL, filp->f_path.dentry);
+
+	if (unlikely(!(filp->f_mode & FMODE_READ))) {
+		ret = -EBADF;
+		goto out_fput;
+	}
+
+	/* checks that every buffer is big enough, before taking anything */
+	for (i = 0; i < vlen; i++) {
+		if (copy_from_user(&mmsg, &u_msgs[i], sizeof(mmsg))) {
+			ret = -EFAULT;
+			goto out_fput;
+		}
+		if (unlikely(mmsg.msg_len < info->attr.mq_msgsize)) {
+			ret = -EMSGSIZE;
+			goto out_fput;
+		}
+	}
+
+	ret = 0;
+	if (!vlen)
+		goto out_fput;
+
+	spin_lock(&info->lock);
+	if (info->attr.mq_curmsgs == 0) {
+		if (filp->f_flags & O_NONBLOCK) {
+			spin_unlock(&info->lock);
+			ret = -EAGAIN;
+			goto out_fput;
+		}
+		wait.task = current;
+		wait.state = STATE_NONE;
+		ret = wq_sleep(info, RECV, timeout, &wait);
+		if (ret < 0)
+			goto out_fput;
+		msgs[n++] = wait.msg;
+		spin_lock(&info->lock);
+	}
+
+	for (;;) {
+		queued = false;
+		while (n < MQ_RECV_BATCH && done + n < vlen &&
+		       info->attr.mq_curmsgs) {
+			msgs[n++] = msg_get(info);
+			queued = true;
+
+			/* There is now free space in queue. */
+			pipelined_receive(info);
+		}
+		if (queued)
+			inode->i_atime = inode->i_mtime = inode->i_ctime =
+					CURRENT_TIME;
+		spin_unlock(&info->lock);
+
+		for (i = 0; i < n; i++) {
+			if (!ret && store_mmsg(&u_msgs[done], msgs[i]))
+				ret = -EFAULT;
+			if (!ret)
+				done++;
+			free_msg(msgs[i]);
+		}
+		n = 0;
+		if (ret || done == vlen)
+			break;
+
+		spin_lock(&info->lock);
+		if (info->attr.mq_curmsgs == 0) {
+			spin_unlock(&info->lock);
+			break;
+		}
+	}
+
+	/* As for recvmmsg(), a fault only counts if nothing was received */
+	if (done)
+		ret = done;
+out_fput:
+	fput(filp);
+out:
+	return ret;
+}
+
 /*
  * Notes: the case when user wants us to deregister (with NULL as pointer)
  * and he isn't currently owner of notification, will be silently discarded.
@@ -126,6 +126,14 @@ static int	   audit_freelist_count;
 static LIST_HEAD(audit_freelist);
 
 static struct sk_buff_head audit_skb_queue;
+/*
+ * audit_log_end() queues records on one of audit_nr_queues queues, one per
+ * possible cpu, picked by the task.  The records of one task stay in order
+ * however it migrates, and kauditd moves them to audit_skb_queue in
+ * batches.  Without them everything goes straight to audit_skb_queue.
+ */
+static struct sk_buff_head *audit_queues;
+static unsigned int audit_nr_queues;
 /* queue of skbs to send to auditd when/if it comes back */
 static struct sk_buff_head audit_skb_hold_queue;
 static struct task_struct *kauditd_task;
@@ -409,6 +417,47 @@ static void kauditd_send_skb(struct sk_buff *skb)
 		consume_skb(skb);
 }
 
+static struct sk_buff_head *audit_queue(void)
+{
+	if (!audit_nr_queues)
+		return &audit_skb_queue;
+	if (in_interrupt())
+		return &audit_queues[raw_smp_processor_id() % audit_nr_queues];
+	return &audit_queues[current->pid % audit_nr_queues];
+}
+
+/* The number of records waiting for kauditd */
+static unsigned int audit_backlog(void)
+{
+	unsigned int i, backlog = skb_queue_len(&audit_skb_queue);
+
+	for (i = 0; i < audit_nr_queues; i++)
+		backlog += skb_queue_len(&audit_queues[i]);
+	return backlog;
+}
+
+/* Move what audit_log_end() queued to audit_skb_queue, one queue at a time */
+static void kauditd_collect(void)
+{
+	struct sk_buff_head *queue, batch;
+	unsigned long flags;
+	unsigned int i;
+
+	__skb_queue_head_init(&batch);
+	for (i = 0; i < audit_nr_queues; i++) {
+		queue = &audit_queues[i];
+		if (!skb_queue_len(queue))
+			continue;
+		spin_lock_irqsave(&queue->lock, flags);
+		skb_queue_splice_tail_init(queue, &batch);
+		spin_unlock_irqrestore(&queue->lock, flags);
+	}
+
+	spin_lock_irqsave(&audit_skb_queue.lock, flags);
+	skb_queue_splice_tail(&batch, &audit_skb_queue);
+	spin_unlock_irqrestore(&audit_skb_queue.lock, flags);
+}
+
 static int kauditd_thread(void *dummy)
 {
 	struct sk_buff *skb;
@@ -438,6 +487,8 @@ static int kauditd_thread(void *dummy)
 			}
 		}
 
+		if (!skb_queue_len(&audit_skb_queue))
+			kauditd_collect();
 		skb = skb_dequeue(&audit_skb_queue);
 		wake_up(&audit_backlog_wait);
 		if (skb) {
@@ -450,7 +501,7 @@ static int kauditd_thread(void *dummy)
 			set_current_state(TASK_INTERRUPTIBLE);
 			add_wait_queue(&kauditd_wait, &wait);
 
-			if (!skb_queue_len(&audit_skb_queue)) {
+			if (!audit_backlog()) {
 				try_to_freeze();
 				schedule();
 			}
@@ -692,7 +743,7 @@ static int audit_receive_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
 		status_set.rate_limit	 = audit_rate_limit;
 		status_set.backlog_limit = audit_backlog_limit;
 		status_set.lost		 = atomic_read(&audit_lost);
-		status_set.backlog	 = skb_queue_len(&audit_skb_queue);
+		status_set.backlog	 = audit_backlog();
 		audit_send_reply(NETLINK_CB(skb).pid, seq, AUDIT_GET, 0, 0,
 				 &status_set, sizeof(status_set));
 		break;
@@ -978,6 +1029,13 @@ static int __init audit_init(void)
 
 	skb_queue_head_init(&audit_skb_queue);
 	skb_queue_head_init(&audit_skb_hold_queue);
+	audit_queues = kcalloc(num_possible_cpus(), sizeof(*audit_queues),
+			       GFP_KERNEL);
+	if (audit_queues) {
+		for (i = 0; i < num_possible_cpus(); i++)
+			skb_queue_head_init(&audit_queues[i]);
+		audit_nr_queues = num_possible_cpus();
+	}
 	audit_initialized = AUDIT_INITIALIZED;
 	audit_enabled = audit_default;
 	audit_ever_enabled |= !!audit_default;
@@ -1163,7 +1221,7 @@ struct audit_buffer *audit_log_start(struct audit_context *ctx, gfp_t gfp_mask,
 				entries over the normal backlog limit */
 
 	while (audit_backlog_limit
-	       && skb_queue_len(&audit_skb_queue) > audit_backlog_limit + reserve) {
+	       && audit_backlog() > audit_backlog_limit + reserve) {
 		if (gfp_mask & __GFP_WAIT && audit_backlog_wait_time
 		    && time_before(jiffies, timeout_start + audit_backlog_wait_time)) {
 
@@ -1173,7 +1231,7 @@ struct audit_buffer *audit_log_start(struct audit_context *ctx, gfp_t gfp_mask,
 			add_wait_queue(&audit_backlog_wait, &wait);
 
 			if (audit_backlog_limit &&
-			    skb_queue_len(&audit_skb_queue) > audit_backlog_limit)
+			    audit_backlog() > audit_backlog_limit)
 				schedule_timeout(timeout_start + audit_backlog_wait_time - jiffies);
 
 			__set_current_state(TASK_RUNNING);
@@ -1184,7 +1242,7 @@ struct audit_buffer *audit_log_start(struct audit_context *ctx, gfp_t gfp_mask,
 			printk(KERN_WARNING
 			       "audit: audit_backlog=%d > "
 			       "audit_backlog_limit=%d\n",
-			       skb_queue_len(&audit_skb_queue),
+			       audit_backlog(),
 			       audit_backlog_limit);
 		audit_log_lost("backlog limit exceeded");
 		audit_backlog_wait_time = audit_backlog_wait_overflow;
@@ -1470,8 +1528,11 @@ void audit_log_end(struct audit_buffer *ab)
 		nlh->nlmsg_len = ab->skb->len - NLMSG_SPACE(0);
 
 		if (audit_pid) {
-			skb_queue_tail(&audit_skb_queue, ab->skb);
-			wake_up_interruptible(&kauditd_wait);
+			skb_queue_tail(audit_queue(), ab->skb);
+			/* kauditd takes what piled up while it was busy */
+			smp_mb();
+			if (waitqueue_active(&kauditd_wait))
+				wake_up_interruptible(&kauditd_wait);
 		} else {
 			audit_printk_skb(ab->skb);
 		}
@@ -102,6 +102,14 @@ extern int selinux_audit_rule_update(void);
 extern struct mutex audit_filter_mutex;
 extern void audit_free_rule_rcu(struct rcu_head *);
 extern struct list_head audit_filter_list[];
+extern u32 audit_syscall_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+
+/* Can any rule of the filter list match the syscall? */
+static inline int audit_syscall_masked(int listnr, int major)
+{
+	return ACCESS_ONCE(audit_syscall_mask[listnr][AUDIT_WORD(major)]) &
+	       AUDIT_BIT(major);
+}
 
 extern struct audit_entry *audit_dupe_rule(struct audit_krule *old);
 
@@ -65,8 +65,42 @@ static struct list_head audit_rules_list[AUDIT_NR_FILTERS] = {
 	LIST_HEAD_INIT(audit_rules_list[5]),
 };
 
+/*
+ * The union of the syscall masks of the rules in each filter list, so
+ * that a syscall no rule is for is rejected without walking the list or
+ * the inode hash.  Bits are set before a rule goes in and cleared after
+ * the last rule for them is gone, so a lockless reader can only see a bit
+ * set too long, never cleared too soon.  Under audit_filter_mutex.
+ */
+u32 audit_syscall_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+
 DEFINE_MUTEX(audit_filter_mutex);
 
+static void audit_syscall_mask_add(struct audit_krule *rule)
+{
+	int i;
+
+	for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+		audit_syscall_mask[rule->listnr][i] |= rule->mask[i];
+	/* the mask goes out before the rule does */
+	smp_wmb();
+}
+
+static void audit_syscall_mask_rebuild(int listnr)
+{
+	u32 mask[AUDIT_BITMASK_SIZE];
+	struct audit_krule *rule;
+	int i;
+
+	memset(mask, 0, sizeof(mask));
+	list_for_each_entry(rule, &audit_rules_list[listnr], list)
+		for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+			mask[i] |= rule->mask[i];
+
+	for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+		audit_syscall_mask[listnr][i] = mask[i];
+}
+
 static inline void audit_free_rule(struct audit_entry *e)
 {
 	int i;
@@ -911,6 +945,7 @@ static inline int audit_add_rule(struct audit_entry *entry)
 			entry->rule.prio = --prio_low;
 	}
 
+	audit_syscall_mask_add(&entry->rule);
 	if (entry->rule.flags & AUDIT_FILTER_PREPEND) {
 		list_add(&entry->rule.list,
 			 &audit_rules_list[entry->rule.listnr]);
@@ -971,6 +1006,7 @@ static inline int audit_del_rule(struct audit_entry *entry)
 
 	list_del_rcu(&e->list);
 	list_del(&e->rule.list);
+	audit_syscall_mask_rebuild(e->rule.listnr);
 	call_rcu(&e->rcu, audit_free_rule_rcu);
 
 #ifdef CONFIG_AUDITSYSCALL
@@ -685,14 +685,18 @@ static enum audit_state audit_filter_task(struct task_struct *tsk, char **key)
  */
 static enum audit_state audit_filter_syscall(struct task_struct *tsk,
 					     struct audit_context *ctx,
-					     struct list_head *list)
+					     int listnr)
 {
+	struct list_head *list = &audit_filter_list[listnr];
 	struct audit_entry *e;
 	enum audit_state state;
 
 	if (audit_pid && tsk->tgid == audit_pid)
 		return AUDIT_DISABLED;
 
+	if (!audit_syscall_masked(listnr, ctx->major))
+		return AUDIT_BUILD_CONTEXT;
+
 	rcu_read_lock();
 	if (!list_empty(list)) {
 		int word = AUDIT_WORD(ctx->major);
@@ -726,6 +730,10 @@ void audit_filter_inodes(struct task_struct *tsk, struct audit_context *ctx)
 	if (audit_pid && tsk->tgid == audit_pid)
 		return;
 
+	/* watch rules are all on the exit list */
+	if (!audit_syscall_masked(AUDIT_FILTER_EXIT, ctx->major))
+		return;
+
 	rcu_read_lock();
 	for (i = 0; i < ctx->name_count; i++) {
 		int word = AUDIT_WORD(ctx->major);
@@ -778,7 +786,7 @@ static inline struct audit_context *audit_get_context(struct task_struct *tsk,
 		context->return_code  = return_code;
 
 	if (context->in_syscall && !context->dummy) {
-		audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_EXIT]);
+		audit_filter_syscall(tsk, context, AUDIT_FILTER_EXIT);
 		audit_filter_inodes(tsk, context);
 	}
 
@@ -1631,7 +1639,7 @@ void audit_syscall_entry(int arch, int major,
 	context->dummy = !audit_n_rules;
 	if (!context->dummy && state == AUDIT_BUILD_CONTEXT) {
 		context->prio = 0;
-		state = audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_ENTRY]);
+		state = audit_filter_syscall(tsk, context, AUDIT_FILTER_ENTRY);
 	}
 	if (likely(state == AUDIT_DISABLED))
 		return;
@@ -59,6 +59,8 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +68,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Priority Inheritance state:
  */
@@ -130,9 +130,16 @@ struct futex_q {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
-};
+} ____cacheline_aligned_in_smp;
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global hash is sized at boot by the number of possible CPUs.  The
+ * FUTEX_PRIVATE_FLAG futexes of a threaded process have a hash of their
+ * own on top, see futex_hash_allocate().
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashmask __read_mostly;
+static unsigned int futex_private_hashsize __read_mostly;
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -142,7 +149,57 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct mm_struct *mm = key->private.mm;
+
+		if (mm && mm->futex_hash)
+			return &mm->futex_hash[hash & mm->futex_hash_mask];
+	}
+	return &futex_queues[hash & futex_hashmask];
+}
+
+static void futex_hash_bucket_init(struct futex_hash_bucket *hb)
+{
+	plist_head_init(&hb->chain, &hb->lock);
+	spin_lock_init(&hb->lock);
+}
+
+/**
+ * futex_hash_allocate - give a process's private futexes their own hash
+ * @mm: the mm of a task about to create its first thread
+ *
+ * Called from copy_mm() for CLONE_THREAD.  While the forking task is the
+ * only user of @mm, nobody can be queued on one of its private futexes in
+ * the global hash, so switching over now cannot lose a wakeup.  If the mm
+ * has other users, or there is no memory, it stays on the global hash: the
+ * private hash is an optimization only.
+ */
+void futex_hash_allocate(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *hb;
+	unsigned int i;
+
+	if (mm->futex_hash || !futex_private_hashsize ||
+	    atomic_read(&mm->mm_users) != 1)
+		return;
+
+	hb = kmalloc(futex_private_hashsize * sizeof(*hb),
+		     GFP_KERNEL | __GFP_NOWARN);
+	if (!hb)
+		return;
+
+	for (i = 0; i < futex_private_hashsize; i++)
+		futex_hash_bucket_init(&hb[i]);
+
+	mm->futex_hash_mask = futex_private_hashsize - 1;
+	mm->futex_hash = hb;
+}
+
+/* Called from __mmdrop(): no task can be queued on the mm's futexes */
+void futex_hash_free(struct mm_struct *mm)
+{
+	kfree(mm->futex_hash);
 }
 
 /*
@@ -2637,8 +2694,9 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
+	unsigned long i, hashsize;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2654,10 +2712,21 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	hashsize = 16;
+#else
+	hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+	futex_private_hashsize = clamp_t(unsigned int,
+			roundup_pow_of_two(4 * num_possible_cpus()), 16, 512);
+#endif
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       hashsize, 0, 0, &futex_shift,
+					       NULL, hashsize);
+	hashsize = 1UL << futex_shift;
+	futex_hashmask = hashsize - 1;
+
+	for (i = 0; i < hashsize; i++)
+		futex_hash_bucket_init(&futex_queues[i]);
 
 	return 0;
 }
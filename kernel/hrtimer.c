@@ -1491,6 +1491,95 @@ void hrtimer_init_sleeper(struct hrtimer_sleeper *sl, struct task_struct *task)
 }
 EXPORT_SYMBOL_GPL(hrtimer_init_sleeper);
 
+#if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ)
+
+/* Timers looked at per clock base, from the first to expire on */
+#define HRTIMER_COALESCE_MAX	8
+
+/*
+ * Task wakeups can be done from any cpu; with slack, the task did not
+ * ask to be woken exactly then either.
+ */
+static int hrtimer_coalescable(struct hrtimer *timer,
+			       struct hrtimer_clock_base *new_base)
+{
+	return timer->function == hrtimer_wakeup &&
+	       hrtimer_get_softexpires_tv64(timer) <
+			hrtimer_get_expires_tv64(timer) &&
+	       !hrtimer_callback_running(timer) &&
+	       !hrtimer_check_target(timer, new_base);
+}
+
+/**
+ * hrtimer_coalesce_idle - hand the sleep timeouts of this idle cpu over
+ * @target: a busy cpu, from get_nohz_timer_target()
+ * @saved: incremented by the wakeups of this cpu the move saves
+ *
+ * Called with interrupts disabled by an idle cpu about to stop its tick.
+ * The timeouts with slack of sleeping tasks, among the first
+ * HRTIMER_COALESCE_MAX timers of each clock base, are moved to @target
+ * if it needs no reprogramming for them: they then expire from the
+ * interrupts it takes anyway, while this cpu stays idle.  Returns the
+ * number of timers moved.
+ */
+int hrtimer_coalesce_idle(int target, int *saved)
+{
+	struct hrtimer_cpu_base *cpu_base = &__get_cpu_var(hrtimer_bases);
+	struct hrtimer_cpu_base *new_cpu_base = &per_cpu(hrtimer_bases, target);
+	struct hrtimer_clock_base *old_base, *new_base;
+	struct hrtimer *timer;
+	struct rb_node *node, *next;
+	s64 wakeup;
+	int i, n, moved = 0;
+
+	raw_spin_lock(&cpu_base->lock);
+	/* the other order than migrate_hrtimers(), so only try */
+	if (!raw_spin_trylock(&new_cpu_base->lock)) {
+		raw_spin_unlock(&cpu_base->lock);
+		return 0;
+	}
+
+	for (i = 0; i < HRTIMER_MAX_CLOCK_BASES; i++) {
+		old_base = &cpu_base->clock_base[i];
+		new_base = &new_cpu_base->clock_base[i];
+		wakeup = LLONG_MIN;
+
+		node = old_base->first;
+		for (n = 0; node && n < HRTIMER_COALESCE_MAX; n++, node = next) {
+			next = rb_next(node);
+			timer = rb_entry(node, struct hrtimer, node);
+			if (!hrtimer_coalescable(timer, new_base))
+				continue;
+
+			/*
+			 * Here, the interrupt at the expiry of a timer also
+			 * runs the next ones whose range has begun by then.
+			 */
+			if (hrtimer_get_softexpires_tv64(timer) > wakeup) {
+				wakeup = hrtimer_get_expires_tv64(timer);
+				(*saved)++;
+			}
+
+			debug_deactivate(timer);
+			/* not INACTIVE, see migrate_hrtimer_list() */
+			__remove_hrtimer(timer, old_base, HRTIMER_STATE_MIGRATE, 0);
+			timer->base = new_base;
+			enqueue_hrtimer(timer, new_base);
+			timer->state &= ~HRTIMER_STATE_MIGRATE;
+			moved++;
+		}
+	}
+
+	if (moved && hrtimer_hres_active())
+		hrtimer_force_reprogram(cpu_base, 1);
+
+	raw_spin_unlock(&new_cpu_base->lock);
+	raw_spin_unlock(&cpu_base->lock);
+	return moved;
+}
+
+#endif /* CONFIG_SMP && CONFIG_NO_HZ */
+
 static int __sched do_nanosleep(struct hrtimer_sleeper *t, enum hrtimer_mode mode)
 {
 	hrtimer_init_sleeper(t, current);
@@ -1676,7 +1765,7 @@ static void migrate_hrtimers(int scpu)
 	new_base = &__get_cpu_var(hrtimer_bases);
 	/*
 	 * The caller is globally serialized and nobody else
-	 * takes two locks at once, deadlock is not possible.
+	 * waits for two locks at once, deadlock is not possible.
 	 */
 	raw_spin_lock(&new_base->lock);
 	raw_spin_lock_nested(&old_base->lock, SINGLE_DEPTH_NESTING);
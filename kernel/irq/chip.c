@@ -545,6 +545,13 @@ handle_fasteoi_irq(unsigned int irq, struct irq_desc *desc)
 
 	desc->status |= IRQ_INPROGRESS;
 	desc->status &= ~IRQ_PENDING;
+	/*
+	 * A forced threaded handler has not quieted the device when we
+	 * eoi: keep the line masked until its thread has run, as the
+	 * level flow does for every oneshot interrupt.
+	 */
+	if (desc->status & IRQ_FORCED_THREAD)
+		mask_irq(desc, irq);
 	raw_spin_unlock(&desc->lock);
 
 	action_ret = handle_IRQ_event(irq, action);
@@ -14,9 +14,38 @@
 #include <linux/interrupt.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/pm_qos_params.h>
 
 #include "internals.h"
 
+/*
+ * "threadirqs" runs all the handlers which do not object to it in
+ * their irq thread, and the softirqs they raise along with them: out of
+ * hardirq context, they no longer preempt whatever runs on the cpu for
+ * as long as they like, and are scheduled at their thread's priority.
+ */
+__read_mostly bool force_irqthreads;
+
+static int __init setup_forced_irqthreads(char *arg)
+{
+	force_irqthreads = true;
+	return 0;
+}
+early_param("threadirqs", setup_forced_irqthreads);
+
+/* SCHED_FIFO priority of the irq threads, "irqthread_prio=" */
+static int irq_thread_prio __read_mostly = MAX_USER_RT_PRIO/2;
+
+static int __init setup_irq_thread_prio(char *arg)
+{
+	int prio;
+
+	if (get_option(&arg, &prio) && prio > 0 && prio < MAX_USER_RT_PRIO)
+		irq_thread_prio = prio;
+	return 0;
+}
+early_param("irqthread_prio", setup_irq_thread_prio);
+
 /**
  *	synchronize_irq - wait for pending IRQ handlers (on other CPUs)
  *	@irq: interrupt number to wait for
@@ -135,6 +164,8 @@ int irq_set_affinity(unsigned int irq, const struct cpumask *cpumask)
 #endif
 	desc->status |= IRQ_AFFINITY_SET;
 	raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+	pm_qos_irq_affinity_changed(irq, cpumask);
 	return 0;
 }
 
@@ -567,12 +598,27 @@ static inline void
 irq_thread_check_affinity(struct irq_desc *desc, struct irqaction *action) { }
 #endif
 
+/*
+ * A forced threaded handler was written for hardirq context: keep
+ * softirqs off while it runs, which also gets those it raised processed
+ * right here, on the cpu of the thread, when they are turned back on.
+ */
+static void irq_thread_fn(struct irq_desc *desc, struct irqaction *action)
+{
+	if (test_bit(IRQTF_FORCED_THREAD, &action->thread_flags)) {
+		local_bh_disable();
+		action->thread_fn(action->irq, action->dev_id);
+		local_bh_enable();
+	} else
+		action->thread_fn(action->irq, action->dev_id);
+}
+
 /*
  * Interrupt handler thread
  */
 static int irq_thread(void *data)
 {
-	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO/2, };
+	struct sched_param param = { .sched_priority = irq_thread_prio, };
 	struct irqaction *action = data;
 	struct irq_desc *desc = irq_to_desc(action->irq);
 	int wake, oneshot = desc->status & IRQ_ONESHOT;
@@ -600,7 +646,7 @@ static int irq_thread(void *data)
 		} else {
 			raw_spin_unlock_irq(&desc->lock);
 
-			action->thread_fn(action->irq, action->dev_id);
+			irq_thread_fn(desc, action);
 
 			if (oneshot)
 				irq_finalize_oneshot(action->irq, desc);
@@ -641,6 +687,29 @@ void exit_irq_thread(void)
 	set_bit(IRQTF_DIED, &tsk->irqaction->flags);
 }
 
+/*
+ * With "threadirqs", turn a plain hardirq handler into the thread
+ * function of a oneshot threaded one.  Shared lines are left alone: a
+ * oneshot interrupt cannot be shared, and neither can per cpu and timer
+ * interrupts, or those which ask not to be, be threaded.
+ */
+static void irq_setup_forced_threading(struct irqaction *new)
+{
+	if (!force_irqthreads)
+		return;
+	if (new->flags & (IRQF_NO_THREAD | IRQF_PERCPU | __IRQF_TIMER |
+			  IRQF_ONESHOT | IRQF_SHARED))
+		return;
+
+	new->flags |= IRQF_ONESHOT;
+
+	if (!new->thread_fn) {
+		set_bit(IRQTF_FORCED_THREAD, &new->thread_flags);
+		new->thread_fn = new->handler;
+		new->handler = irq_default_primary_handler;
+	}
+}
+
 /*
  * Internal function to register an irqaction - typically used to
  * allocate special interrupts that are part of the architecture.
@@ -694,7 +763,8 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 		 * dummy function which warns when called.
 		 */
 		new->handler = irq_nested_primary_handler;
-	}
+	} else
+		irq_setup_forced_threading(new);
 
 	/*
 	 * Create a handler thread when a thread function is supplied
@@ -715,6 +785,11 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 		 */
 		get_task_struct(t);
 		new->thread = t;
+		/*
+		 * Start out on the cpus of the interrupt, where the
+		 * hardirq handler and the softirqs it raises run too.
+		 */
+		set_bit(IRQTF_AFFINITY, &new->thread_flags);
 	}
 
 	/*
@@ -771,10 +846,13 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 #endif
 
 		desc->status &= ~(IRQ_AUTODETECT | IRQ_WAITING | IRQ_ONESHOT |
-				  IRQ_INPROGRESS | IRQ_SPURIOUS_DISABLED);
+				  IRQ_FORCED_THREAD | IRQ_INPROGRESS |
+				  IRQ_SPURIOUS_DISABLED);
 
 		if (new->flags & IRQF_ONESHOT)
 			desc->status |= IRQ_ONESHOT;
+		if (test_bit(IRQTF_FORCED_THREAD, &new->thread_flags))
+			desc->status |= IRQ_FORCED_THREAD;
 
 		if (!(desc->status & IRQ_NOAUTOEN)) {
 			desc->depth = 0;
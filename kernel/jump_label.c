@@ -0,0 +1,364 @@
+/*
+ * kernel/jump_label.c
+ *
+ * Keeping track of the jump label sites, see include/linux/jump_label.h.
+ *
+ * The __jump_table entries of the kernel and of each module are sorted
+ * by key, and each run of entries of one key is hung off the hash entry
+ * of that key, with the state last set for it, which is applied to the
+ * sites of modules loaded later.
+ */
+#include <linux/jump_label.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/init.h>
+
+#ifdef HAVE_JUMP_LABEL
+
+#define JUMP_LABEL_HASH_BITS 6
+#define JUMP_LABEL_TABLE_SIZE (1 << JUMP_LABEL_HASH_BITS)
+static struct hlist_head jump_label_table[JUMP_LABEL_TABLE_SIZE];
+
+/* protects the hash table, and serializes the patching */
+static DEFINE_MUTEX(jump_label_mutex);
+
+struct jump_label_entry {
+	struct hlist_node hlist;
+	jump_label_t key;
+	int enabled;
+	/* the jump_label_ranges of key */
+	struct list_head ranges;
+};
+
+/* A run of entries of one key, in the table of mod (NULL: the kernel's) */
+struct jump_label_range {
+	struct list_head list;
+	struct jump_entry *entries;
+	int nr_entries;
+	struct module *mod;
+};
+
+static int jump_label_cmp(const void *a, const void *b)
+{
+	const struct jump_entry *jea = a;
+	const struct jump_entry *jeb = b;
+
+	if (jea->key < jeb->key)
+		return -1;
+	if (jea->key > jeb->key)
+		return 1;
+	return 0;
+}
+
+static void sort_jump_label_entries(struct jump_entry *start,
+				    struct jump_entry *stop)
+{
+	sort(start, stop - start, sizeof(struct jump_entry),
+	     jump_label_cmp, NULL);
+}
+
+static struct hlist_head *jump_label_bucket(jump_label_t key)
+{
+	u32 hash = jhash(&key, sizeof(key), 0);
+
+	return &jump_label_table[hash & (JUMP_LABEL_TABLE_SIZE - 1)];
+}
+
+static struct jump_label_entry *get_jump_label_entry(jump_label_t key)
+{
+	struct jump_label_entry *e;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(e, node, jump_label_bucket(key), hlist)
+		if (e->key == key)
+			return e;
+	return NULL;
+}
+
+static struct jump_label_entry *add_jump_label_entry(jump_label_t key)
+{
+	struct jump_label_entry *e;
+
+	e = get_jump_label_entry(key);
+	if (e)
+		return e;
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return NULL;
+	e->key = key;
+	INIT_LIST_HEAD(&e->ranges);
+	hlist_add_head(&e->hlist, jump_label_bucket(key));
+	return e;
+}
+
+static void free_jump_label_entry(struct jump_label_entry *e)
+{
+	hlist_del(&e->hlist);
+	kfree(e);
+}
+
+/*
+ * Hang each run of same key entries of the sorted table start..stop off
+ * its key, and patch the runs of enabled keys; early, before the other
+ * cpus and stop_machine() are up, every site is patched.  Returns the
+ * entry of the first key that could not be added.
+ */
+static struct jump_entry *__init_or_module
+add_jump_label_ranges(struct jump_entry *start, struct jump_entry *stop,
+		      struct module *mod, bool early)
+{
+	struct jump_label_entry *e;
+	struct jump_label_range *r;
+	struct jump_entry *iter, *run;
+
+	for (run = start; run < stop; run = iter) {
+		for (iter = run; iter < stop && iter->key == run->key; iter++)
+			;
+
+		r = kmalloc(sizeof(*r), GFP_KERNEL);
+		e = r ? add_jump_label_entry(run->key) : NULL;
+		if (!e) {
+			kfree(r);
+			return run;
+		}
+		r->entries = run;
+		r->nr_entries = iter - run;
+		r->mod = mod;
+		list_add(&r->list, &e->ranges);
+
+		if (early) {
+			for (iter = run; iter < run + r->nr_entries; iter++)
+				arch_jump_label_text_poke_early(iter,
+					e->enabled ? JUMP_LABEL_ENABLE :
+						     JUMP_LABEL_DISABLE);
+		} else if (e->enabled)
+			arch_jump_label_transform(r->entries, r->nr_entries,
+						  JUMP_LABEL_ENABLE);
+	}
+	return stop;
+}
+
+/*
+ * Runs before the other cpus are brought up, for the early patching of
+ * the sites into nops.
+ */
+static int __init jump_label_init(void)
+{
+	mutex_lock(&jump_label_mutex);
+	sort_jump_label_entries(__start___jump_table, __stop___jump_table);
+	if (add_jump_label_ranges(__start___jump_table, __stop___jump_table,
+				  NULL, true) != __stop___jump_table)
+		printk(KERN_ERR "jump label: out of memory, "
+		       "some of the kernel's sites can not be enabled\n");
+	mutex_unlock(&jump_label_mutex);
+	return 0;
+}
+early_initcall(jump_label_init);
+
+/* Called with jump_label_mutex held */
+static void __jump_label_update(jump_label_t key, enum jump_label_type type)
+{
+	struct jump_label_entry *e;
+	struct jump_label_range *r;
+	int enabled = type == JUMP_LABEL_ENABLE;
+
+	/*
+	 * a key without sites yet still has a state, for the modules, and
+	 * for the kernel's own sites until jump_label_init() adds them
+	 */
+	e = enabled ? add_jump_label_entry(key) : get_jump_label_entry(key);
+	if (!e || e->enabled == enabled)
+		return;
+
+	e->enabled = enabled;
+	list_for_each_entry(r, &e->ranges, list)
+		arch_jump_label_transform(r->entries, r->nr_entries, type);
+
+	if (!enabled && list_empty(&e->ranges))
+		free_jump_label_entry(e);
+}
+
+/**
+ * jump_label_update - enable or disable the sites of a key
+ * @key: the key, as given to JUMP_LABEL()
+ * @type: JUMP_LABEL_ENABLE or JUMP_LABEL_DISABLE
+ *
+ * Might sleep: the sites are patched with stop_machine().
+ */
+void jump_label_update(unsigned long key, enum jump_label_type type)
+{
+	mutex_lock(&jump_label_mutex);
+	__jump_label_update(key, type);
+	mutex_unlock(&jump_label_mutex);
+}
+EXPORT_SYMBOL_GPL(jump_label_update);
+
+/**
+ * jump_label_inc - enable the sites of an atomic_t key on 0 -> 1
+ * @key: the key, as given to JUMP_LABEL()
+ */
+void jump_label_inc(atomic_t *key)
+{
+	if (atomic_inc_not_zero(key))
+		return;
+
+	mutex_lock(&jump_label_mutex);
+	if (atomic_add_return(1, key) == 1)
+		__jump_label_update((unsigned long)key, JUMP_LABEL_ENABLE);
+	mutex_unlock(&jump_label_mutex);
+}
+EXPORT_SYMBOL_GPL(jump_label_inc);
+
+/**
+ * jump_label_dec - disable the sites of an atomic_t key on 1 -> 0
+ * @key: the key, as given to JUMP_LABEL()
+ */
+void jump_label_dec(atomic_t *key)
+{
+	if (atomic_add_unless(key, -1, 1))
+		return;
+
+	mutex_lock(&jump_label_mutex);
+	if (atomic_dec_and_test(key))
+		__jump_label_update((unsigned long)key, JUMP_LABEL_DISABLE);
+	mutex_unlock(&jump_label_mutex);
+}
+EXPORT_SYMBOL_GPL(jump_label_dec);
+
+static int __jump_label_text_reserved(struct jump_entry *iter_start,
+		struct jump_entry *iter_stop, void *start, void *end)
+{
+	struct jump_entry *iter;
+
+	for (iter = iter_start; iter < iter_stop; iter++)
+		if (iter->code <= (unsigned long)end &&
+		    iter->code + JUMP_LABEL_NOP_SIZE > (unsigned long)start)
+			return 1;
+	return 0;
+}
+
+/**
+ * jump_label_text_reserved - check if addr range is reserved
+ * @start: start text addr
+ * @end: end text addr
+ *
+ * Checks if the text addr located between @start and @end overlaps with
+ * any jump label patch site, which others (kprobes) must not modify.
+ * Only the table of the code containing @start is looked at: the sites
+ * in the text of the kernel or of a module are in its own table.
+ */
+int jump_label_text_reserved(void *start, void *end)
+{
+	struct module *mod;
+	int ret;
+
+	if (core_kernel_text((unsigned long)start))
+		return __jump_label_text_reserved(__start___jump_table,
+				__stop___jump_table, start, end);
+
+	ret = 0;
+	preempt_disable();
+	mod = __module_text_address((unsigned long)start);
+	if (mod)
+		ret = __jump_label_text_reserved(mod->jump_entries,
+				mod->jump_entries + mod->num_jump_entries,
+				start, end);
+	preempt_enable();
+	return ret;
+}
+
+#ifdef CONFIG_MODULES
+
+/**
+ * jump_label_apply_nops - sort the table of a module, nop its sites
+ * @mod: the module, not yet live
+ */
+void jump_label_apply_nops(struct module *mod)
+{
+	struct jump_entry *iter;
+
+	if (!mod->num_jump_entries)
+		return;
+
+	sort_jump_label_entries(mod->jump_entries,
+				mod->jump_entries + mod->num_jump_entries);
+	for (iter = mod->jump_entries;
+	     iter < mod->jump_entries + mod->num_jump_entries; iter++)
+		arch_jump_label_text_poke_early(iter, JUMP_LABEL_DISABLE);
+}
+
+static void remove_jump_label_module(struct module *mod)
+{
+	struct jump_label_entry *e;
+	struct jump_label_range *r, *tmp;
+	struct hlist_node *node, *node_next;
+	int i;
+
+	for (i = 0; i < JUMP_LABEL_TABLE_SIZE; i++) {
+		hlist_for_each_entry_safe(e, node, node_next,
+					  &jump_label_table[i], hlist) {
+			list_for_each_entry_safe(r, tmp, &e->ranges, list) {
+				if (r->mod == mod) {
+					list_del(&r->list);
+					kfree(r);
+				}
+			}
+			/* and forget the state of keys that go with mod */
+			if (list_empty(&e->ranges) &&
+			    (!e->enabled ||
+			     within_module_core(e->key, mod)))
+				free_jump_label_entry(e);
+		}
+	}
+}
+
+static void add_jump_label_module(struct module *mod)
+{
+	struct jump_entry *stop = mod->jump_entries + mod->num_jump_entries;
+
+	if (add_jump_label_ranges(mod->jump_entries, stop, mod, false) != stop)
+		printk(KERN_WARNING "jump label: out of memory, some sites "
+		       "of %s can not be enabled\n", mod->name);
+}
+
+static int jump_label_module_notify(struct notifier_block *self,
+				    unsigned long val, void *data)
+{
+	struct module *mod = data;
+
+	switch (val) {
+	case MODULE_STATE_COMING:
+		if (!mod->num_jump_entries)
+			break;
+		mutex_lock(&jump_label_mutex);
+		add_jump_label_module(mod);
+		mutex_unlock(&jump_label_mutex);
+		break;
+	case MODULE_STATE_GOING:
+		mutex_lock(&jump_label_mutex);
+		remove_jump_label_module(mod);
+		mutex_unlock(&jump_label_mutex);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block jump_label_module_nb = {
+	.notifier_call = jump_label_module_notify,
+	.priority = 0,
+};
+
+static __init int init_jump_label_module(void)
+{
+	return register_module_notifier(&jump_label_module_nb);
+}
+early_initcall(init_jump_label_module);
+
+#endif /* CONFIG_MODULES */
+
+#endif /* HAVE_JUMP_LABEL */
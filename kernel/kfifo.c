@@ -599,3 +599,140 @@ void __kfifo_dma_out_finish_r(struct __kfifo *fifo, size_t recsize)
 	fifo->out += len + recsize;
 }
 EXPORT_SYMBOL(__kfifo_dma_out_finish_r);
+
+/*
+ * Multi-producer multi-consumer fifo.
+ *
+ * The slot of index i holds seq[i & mask] == i while it is free for the
+ * writer claiming index i, and i + 1 once that writer is done and the
+ * slot is ready for its reader, who then sets it to i + size, freeing
+ * it for the writer of the next lap.  Indices and sequence numbers wrap
+ * and are compared through their signed difference.
+ */
+void __kfifo_mpmc_init(struct __kfifo_mpmc *fifo, void *buffer,
+		unsigned int *seq, unsigned int size, size_t esize)
+{
+	unsigned int i;
+
+	atomic_set(&fifo->in, 0);
+	atomic_set(&fifo->out, 0);
+	fifo->esize = esize;
+	fifo->data = buffer;
+	fifo->seq = seq;
+	fifo->mask = size ? size - 1 : 0;
+
+	for (i = 0; i < size; i++)
+		seq[i] = i;
+}
+EXPORT_SYMBOL(__kfifo_mpmc_init);
+
+int __kfifo_mpmc_alloc(struct __kfifo_mpmc *fifo, unsigned int size,
+		size_t esize, gfp_t gfp_mask)
+{
+	void *data;
+	unsigned int *seq;
+
+	if (size < 2 || size > (1U << 31)) {
+		__kfifo_mpmc_init(fifo, NULL, NULL, 0, esize);
+		return -EINVAL;
+	}
+	size = roundup_pow_of_two(size);
+
+	data = kmalloc(size * esize, gfp_mask);
+	seq = kmalloc(size * sizeof(*seq), gfp_mask);
+	if (!data || !seq) {
+		kfree(data);
+		kfree(seq);
+		__kfifo_mpmc_init(fifo, NULL, NULL, 0, esize);
+		return -ENOMEM;
+	}
+	__kfifo_mpmc_init(fifo, data, seq, size, esize);
+
+	return 0;
+}
+EXPORT_SYMBOL(__kfifo_mpmc_alloc);
+
+void __kfifo_mpmc_free(struct __kfifo_mpmc *fifo)
+{
+	kfree(fifo->data);
+	kfree(fifo->seq);
+	__kfifo_mpmc_init(fifo, NULL, NULL, 0, 0);
+}
+EXPORT_SYMBOL(__kfifo_mpmc_free);
+
+unsigned int __kfifo_mpmc_in(struct __kfifo_mpmc *fifo, const void *val)
+{
+	unsigned int pos, old, idx;
+	int diff;
+
+	if (unlikely(!fifo->data))
+		return 0;
+
+	pos = atomic_read(&fifo->in);
+	for (;;) {
+		idx = pos & fifo->mask;
+		diff = (int)(ACCESS_ONCE(fifo->seq[idx]) - pos);
+		if (diff < 0)
+			return 0;	/* full: last lap's reader isn't done */
+		if (diff == 0) {
+			/* a successful cmpxchg orders the writes below */
+			old = atomic_cmpxchg(&fifo->in, pos, pos + 1);
+			if (old == pos)
+				break;
+			pos = old;
+		} else
+			pos = atomic_read(&fifo->in);
+	}
+
+	memcpy(fifo->data + idx * fifo->esize, val, fifo->esize);
+	/* make sure the element is there before the reader sees the slot */
+	smp_wmb();
+	fifo->seq[idx] = pos + 1;
+
+	return 1;
+}
+EXPORT_SYMBOL(__kfifo_mpmc_in);
+
+unsigned int __kfifo_mpmc_out(struct __kfifo_mpmc *fifo, void *val)
+{
+	unsigned int pos, old, idx;
+	int diff;
+
+	if (unlikely(!fifo->data))
+		return 0;
+
+	pos = atomic_read(&fifo->out);
+	for (;;) {
+		idx = pos & fifo->mask;
+		diff = (int)(ACCESS_ONCE(fifo->seq[idx]) - (pos + 1));
+		if (diff < 0)
+			return 0;	/* empty: the writer isn't done */
+		if (diff == 0) {
+			/* a successful cmpxchg orders the reads below */
+			old = atomic_cmpxchg(&fifo->out, pos, pos + 1);
+			if (old == pos)
+				break;
+			pos = old;
+		} else
+			pos = atomic_read(&fifo->out);
+	}
+
+	memcpy(val, fifo->data + idx * fifo->esize, fifo->esize);
+	/* make sure the element is read before the next writer gets it */
+	smp_mb();
+	fifo->seq[idx] = pos + fifo->mask + 1;
+
+	return 1;
+}
+EXPORT_SYMBOL(__kfifo_mpmc_out);
+
+unsigned int __kfifo_mpmc_len(struct __kfifo_mpmc *fifo)
+{
+	unsigned int out = atomic_read(&fifo->out);
+	unsigned int in = atomic_read(&fifo->in);
+
+	if ((int)(in - out) < 0)
+		return 0;
+	return min(in - out, fifo->mask + 1);
+}
+EXPORT_SYMBOL(__kfifo_mpmc_len);
@@ -46,6 +46,7 @@
 #include <linux/kdebug.h>
 #include <linux/memory.h>
 #include <linux/ftrace.h>
+#include <linux/jump_label.h>
 #include <linux/cpu.h>
 
 #include <asm-generic/sections.h>
@@ -428,8 +429,6 @@ static DECLARE_DELAYED_WORK(optimizing_work, kprobe_optimizer);
 /* Kprobe jump optimizer */
 static __kprobes void kprobe_optimizer(struct work_struct *work)
 {
-	struct optimized_kprobe *op, *tmp;
-
 	/* Lock modules while optimizing kprobes */
 	mutex_lock(&module_mutex);
 	mutex_lock(&kprobe_mutex);
@@ -457,12 +456,8 @@ static __kprobes void kprobe_optimizer(struct work_struct *work)
 	 */
 	get_online_cpus();
 	mutex_lock(&text_mutex);
-	list_for_each_entry_safe(op, tmp, &optimizing_list, list) {
-		WARN_ON(kprobe_disabled(&op->kp));
-		if (arch_optimize_kprobe(op) < 0)
-			op->kp.flags &= ~KPROBE_FLAG_OPTIMIZED;
-		list_del_init(&op->list);
-	}
+	/* All of the queued probes are patched in as few stop_machine()s */
+	arch_optimize_kprobes(&optimizing_list);
 	mutex_unlock(&text_mutex);
 	put_online_cpus();
 end:
@@ -812,6 +807,22 @@ void __kprobes kprobes_inc_nmissed_count(struct kprobe *p)
 	return;
 }
 
+/*
+ * Called by the arch code each time the probe at p is hit and its handlers
+ * are run; all the probes sharing the address are hit together.
+ */
+void __kprobes kprobes_inc_nhit_count(struct kprobe *p)
+{
+	struct kprobe *kp;
+
+	if (!kprobe_aggrprobe(p)) {
+		p->nhit++;
+	} else {
+		list_for_each_entry_rcu(kp, &p->list, list)
+			kp->nhit++;
+	}
+}
+
 void __kprobes recycle_rp_inst(struct kretprobe_instance *ri,
 				struct hlist_head *head)
 {
@@ -1141,7 +1152,8 @@ int __kprobes register_kprobe(struct kprobe *p)
 	preempt_disable();
 	if (!kernel_text_address((unsigned long) p->addr) ||
 	    in_kprobes_functions((unsigned long) p->addr) ||
-	    ftrace_text_reserved(p->addr, p->addr)) {
+	    ftrace_text_reserved(p->addr, p->addr) ||
+	    jump_label_text_reserved(p->addr, p->addr)) {
 		preempt_enable();
 		return -EINVAL;
 	}
@@ -1871,6 +1883,63 @@ static const struct file_operations debugfs_kprobes_operations = {
 	.release        = seq_release,
 };
 
+static void __kprobes report_probe_profile(struct seq_file *pi,
+		struct kprobe *p, const char *sym, int offset)
+{
+	if (sym)
+		seq_printf(pi, "%p  %s+0x%x  %lu %lu\n",
+			p->addr, sym, offset, p->nhit, p->nmissed);
+	else
+		seq_printf(pi, "%p  %p  %lu %lu\n",
+			p->addr, p->addr, p->nhit, p->nmissed);
+}
+
+/* One line per probe: address, symbol, hits and misses */
+static int __kprobes show_kprobe_profile(struct seq_file *pi, void *v)
+{
+	struct hlist_head *head;
+	struct hlist_node *node;
+	struct kprobe *p, *kp;
+	const char *sym = NULL;
+	unsigned int i = *(loff_t *) v;
+	unsigned long offset = 0;
+	char *modname, namebuf[128];
+
+	head = &kprobe_table[i];
+	preempt_disable();
+	hlist_for_each_entry_rcu(p, node, head, hlist) {
+		sym = kallsyms_lookup((unsigned long)p->addr, NULL,
+					&offset, &modname, namebuf);
+		if (kprobe_aggrprobe(p)) {
+			list_for_each_entry_rcu(kp, &p->list, list)
+				report_probe_profile(pi, kp, sym, offset);
+		} else
+			report_probe_profile(pi, p, sym, offset);
+	}
+	preempt_enable();
+	return 0;
+}
+
+static const struct seq_operations kprobes_profile_seq_ops = {
+	.start = kprobe_seq_start,
+	.next  = kprobe_seq_next,
+	.stop  = kprobe_seq_stop,
+	.show  = show_kprobe_profile
+};
+
+static int __kprobes kprobes_profile_open(struct inode *inode,
+					  struct file *filp)
+{
+	return seq_open(filp, &kprobes_profile_seq_ops);
+}
+
+static const struct file_operations debugfs_kprobes_profile_operations = {
+	.open           = kprobes_profile_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = seq_release,
+};
+
 static void __kprobes arm_all_kprobes(void)
 {
 	struct hlist_head *head;
@@ -2017,6 +2086,13 @@ static int __kprobes debugfs_kprobe_init(void)
 		return -ENOMEM;
 	}
 
+	file = debugfs_create_file("profile", 0444, dir, NULL,
+				&debugfs_kprobes_profile_operations);
+	if (!file) {
+		debugfs_remove(dir);
+		return -ENOMEM;
+	}
+
 	return 0;
 }
 
@@ -216,6 +216,9 @@ struct lock_class_stats lock_stats(struct lock_class *class)
 
 		for (i = 0; i < ARRAY_SIZE(stats.bounces); i++)
 			stats.bounces[i] += pcs->bounces[i];
+
+		for (i = 0; i < ARRAY_SIZE(stats.sleeps); i++)
+			stats.sleeps[i] += pcs->sleeps[i];
 	}
 
 	return stats;
@@ -3407,6 +3410,38 @@ found_it:
 	lock->ip = ip;
 }
 
+/*
+ * A contended sleeping lock had to sleep: the difference with the
+ * contentions is the number of times it was gotten by spinning.
+ */
+static void __lock_slept(struct lockdep_map *lock)
+{
+	struct task_struct *curr = current;
+	struct held_lock *hlock, *prev_hlock;
+	struct lock_class_stats *stats;
+	int i;
+
+	prev_hlock = NULL;
+	for (i = curr->lockdep_depth - 1; i >= 0; i--) {
+		hlock = curr->held_locks + i;
+		if (prev_hlock && prev_hlock->irq_context != hlock->irq_context)
+			break;
+		if (match_held_lock(hlock, lock))
+			goto found_it;
+		prev_hlock = hlock;
+	}
+	/* The _non_owner() variants are not tracked */
+	return;
+
+found_it:
+	if (hlock->instance != lock)
+		return;
+
+	stats = get_lock_stats(hlock_class(hlock));
+	stats->sleeps[!!hlock->read]++;
+	put_lock_stats(stats);
+}
+
 void lock_contended(struct lockdep_map *lock, unsigned long ip)
 {
 	unsigned long flags;
@@ -3445,6 +3480,25 @@ void lock_acquired(struct lockdep_map *lock, unsigned long ip)
 	raw_local_irq_restore(flags);
 }
 EXPORT_SYMBOL_GPL(lock_acquired);
+
+void lock_slept(struct lockdep_map *lock)
+{
+	unsigned long flags;
+
+	if (unlikely(!lock_stat))
+		return;
+
+	if (unlikely(current->lockdep_recursion))
+		return;
+
+	raw_local_irq_save(flags);
+	check_flags(flags);
+	current->lockdep_recursion = 1;
+	__lock_slept(lock);
+	current->lockdep_recursion = 0;
+	raw_local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(lock_slept);
 #endif
 
 /*
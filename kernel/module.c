@@ -2308,6 +2308,11 @@ static void find_module_sections(struct module *mod, struct load_info *info)
 					sizeof(*mod->tracepoints),
 					&mod->num_tracepoints);
 #endif
+#ifdef HAVE_JUMP_LABEL
+	mod->jump_entries = section_objs(info, "__jump_table",
+					 sizeof(*mod->jump_entries),
+					 &mod->num_jump_entries);
+#endif
 #ifdef CONFIG_EVENT_TRACING
 	mod->trace_events = section_objs(info, "_ftrace_events",
 					 sizeof(*mod->trace_events),
@@ -2591,6 +2596,9 @@ static struct module *load_module(void __user *umod,
 	if (err < 0)
 		goto free_modinfo;
 
+	/* The jump label sites, relocated now, are nops until enabled */
+	jump_label_apply_nops(mod);
+
 	flush_module_icache(mod);
 
 	/* Now copy in args */
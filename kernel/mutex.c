@@ -24,6 +24,12 @@
 #include <linux/interrupt.h>
 #include <linux/debug_locks.h>
 
+/* Without lockdep, the contention tracepoints are ours to define */
+#ifndef CONFIG_LOCKDEP
+# define CREATE_TRACE_POINTS
+#endif
+#include <trace/events/lock.h>
+
 /*
  * In the DEBUG case we are using the "NULL fastpath" for mutexes,
  * which forces all calls into the slowpath:
@@ -167,6 +173,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 	 * We can't do this for DEBUG_MUTEXES because that relies on wait_lock
 	 * to serialize everything.
 	 */
+	trace_contention_begin(lock, LCB_F_MUTEX | LCB_F_SPIN);
 
 	for (;;) {
 		struct thread_info *owner;
@@ -188,6 +195,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 
 		if (atomic_cmpxchg(&lock->count, 1, 0) == 1) {
 			lock_acquired(&lock->dep_map, ip);
+			trace_contention_end(lock, 0);
 			mutex_set_owner(lock);
 			preempt_enable();
 			return 0;
@@ -224,6 +232,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 		goto done;
 
 	lock_contended(&lock->dep_map, ip);
+	trace_contention_begin(lock, LCB_F_MUTEX);
 
 	for (;;) {
 		/*
@@ -247,6 +256,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 					    task_thread_info(task));
 			mutex_release(&lock->dep_map, 1, ip);
 			spin_unlock_mutex(&lock->wait_lock, flags);
+			trace_contention_end(lock, -EINTR);
 
 			debug_mutex_free_waiter(&waiter);
 			preempt_enable();
@@ -264,6 +274,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 
 done:
 	lock_acquired(&lock->dep_map, ip);
+	trace_contention_end(lock, 0);
 	/* got the lock - rejoice! */
 	mutex_remove_waiter(lock, &waiter, current_thread_info());
 	mutex_set_owner(lock);
@@ -17,6 +17,7 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/hash.h>
+#include <linux/jhash.h>
 #include <linux/sysfs.h>
 #include <linux/dcache.h>
 #include <linux/percpu.h>
@@ -34,6 +35,7 @@
 #include <linux/hw_breakpoint.h>
 
 #include <asm/irq_regs.h>
+#include <asm/unaligned.h>
 
 /*
  * Each CPU has a list of per CPU events:
@@ -1882,6 +1884,9 @@ static void free_event_rcu(struct rcu_head *head)
 
 static void perf_pending_sync(struct perf_event *event);
 static void perf_buffer_put(struct perf_buffer *buffer);
+static void perf_aggr_free(struct perf_event *event);
+static int perf_event_aggr_read(struct perf_event *event,
+				struct perf_aggr_read __user *uread);
 
 static void free_event(struct perf_event *event)
 {
@@ -1905,6 +1910,8 @@ static void free_event(struct perf_event *event)
 	if (event->destroy)
 		event->destroy(event);
 
+	perf_aggr_free(event);
+
 	put_ctx(event->ctx);
 	call_rcu(&event->rcu_head, free_event_rcu);
 }
@@ -2284,6 +2291,9 @@ static long perf_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case PERF_EVENT_IOC_SET_FILTER:
 		return perf_event_set_filter(event, (void __user *)arg);
 
+	case PERF_EVENT_IOC_AGGR_READ:
+		return perf_event_aggr_read(event, (void __user *)arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -3451,6 +3461,258 @@ static void perf_event_output(struct perf_event *event, int nmi,
 	perf_output_end(&handle);
 }
 
+/*
+ * In-kernel aggregation of samples, for attr.aggregate events
+ *
+ * Samples come in from NMI context on any cpu, so the table is an open
+ * addressed hash whose slots are claimed with cmpxchg on their key and
+ * whose counts are atomic.  Key 0 marks free slots and is counted in a
+ * slot of its own.  Slots are never freed: reading with a reset takes
+ * the counts read off, and slots at zero are skipped.
+ */
+struct perf_aggr_slot {
+	atomic64_t		key;
+	atomic64_t		count;
+	atomic64_t		period;
+	u64			nr;
+	u64			ip[0];		/* PERF_AGGR_KEY_CALLCHAIN */
+};
+
+struct perf_aggr {
+	unsigned int		nr_slots;
+	unsigned int		slot_size;
+	atomic64_t		dropped;
+	void			*slots;
+	struct perf_aggr_slot	zero;		/* key 0 */
+};
+
+/* how far a sample probes for its key before it is dropped */
+#define PERF_AGGR_PROBES	16
+
+static inline struct perf_aggr_slot *
+perf_aggr_slot(struct perf_aggr *aggr, unsigned int idx)
+{
+	return aggr->slots + idx * aggr->slot_size;
+}
+
+static int perf_aggr_alloc(struct perf_event *event)
+{
+	struct perf_event_attr *attr = &event->attr;
+	unsigned int nr_slots = attr->aggr_entries ?: PERF_AGGR_DEF_ENTRIES;
+	struct perf_aggr *aggr;
+	size_t size;
+
+	aggr = kzalloc(sizeof(*aggr), GFP_KERNEL);
+	if (!aggr)
+		return -ENOMEM;
+
+	aggr->nr_slots = roundup_pow_of_two(nr_slots);
+	aggr->slot_size = sizeof(struct perf_aggr_slot);
+	if (attr->aggr_key == PERF_AGGR_KEY_CALLCHAIN)
+		aggr->slot_size += PERF_AGGR_MAX_DEPTH * sizeof(u64);
+
+	size = (size_t)aggr->nr_slots * aggr->slot_size;
+	aggr->slots = vmalloc(size);
+	if (!aggr->slots) {
+		kfree(aggr);
+		return -ENOMEM;
+	}
+	memset(aggr->slots, 0, size);
+
+	event->aggr = aggr;
+	return 0;
+}
+
+static void perf_aggr_free(struct perf_event *event)
+{
+	struct perf_aggr *aggr = event->aggr;
+
+	/* children use the table of their parent */
+	if (!aggr || event->parent)
+		return;
+
+	vfree(aggr->slots);
+	kfree(aggr);
+}
+
+static u64 perf_aggr_raw_key(struct perf_event *event,
+			     struct perf_sample_data *data)
+{
+	unsigned int offset = event->attr.aggr_raw_offset;
+	unsigned int size = event->attr.aggr_raw_size;
+	void *field;
+
+	if (!data->raw || offset + size > data->raw->size)
+		return 0;
+
+	field = data->raw->data + offset;
+	switch (size) {
+	case 1:
+		return *(u8 *)field;
+	case 2:
+		return get_unaligned((u16 *)field);
+	case 4:
+		return get_unaligned((u32 *)field);
+	default:
+		return get_unaligned((u64 *)field);
+	}
+}
+
+static void perf_event_aggregate(struct perf_event *event,
+				 struct perf_sample_data *data,
+				 struct pt_regs *regs)
+{
+	struct perf_aggr *aggr = event->aggr;
+	struct perf_callchain_entry *callchain = NULL;
+	struct perf_aggr_slot *slot;
+	unsigned int idx, i, nr = 0;
+	u64 key, old;
+
+	switch (event->attr.aggr_key) {
+	case PERF_AGGR_KEY_IP:
+		key = perf_instruction_pointer(regs);
+		break;
+
+	case PERF_AGGR_KEY_CALLCHAIN:
+		callchain = perf_callchain(regs);
+		if (!callchain || !callchain->nr) {
+			key = 0;
+			break;
+		}
+		nr = min_t(u64, callchain->nr, PERF_AGGR_MAX_DEPTH);
+		key = jhash2((u32 *)callchain->ip, nr * 2, 0) |
+		      (u64)jhash2((u32 *)callchain->ip, nr * 2, 1) << 32;
+		break;
+
+	default:
+		key = perf_aggr_raw_key(event, data);
+		break;
+	}
+
+	if (!key) {
+		slot = &aggr->zero;
+		goto found;
+	}
+
+	idx = hash_64(key, ilog2(aggr->nr_slots));
+	for (i = 0; i < PERF_AGGR_PROBES; i++) {
+		slot = perf_aggr_slot(aggr, idx);
+		old = atomic64_read(&slot->key);
+		if (old == key)
+			goto found;
+		if (!old) {
+			old = atomic64_cmpxchg(&slot->key, 0, key);
+			if (!old) {
+				/* ours: readers only look at nr entries */
+				if (callchain)
+					memcpy(slot->ip, callchain->ip,
+					       nr * sizeof(u64));
+				smp_wmb();
+				slot->nr = nr;
+				goto found;
+			}
+			if (old == key)
+				goto found;
+		}
+		idx = (idx + 1) & (aggr->nr_slots - 1);
+	}
+	atomic64_inc(&aggr->dropped);
+	return;
+
+found:
+	atomic64_inc(&slot->count);
+	atomic64_add(data->period, &slot->period);
+}
+
+static int perf_aggr_copy_slot(struct perf_aggr_slot *slot, u64 key,
+			       void __user **buf, u64 *left, u32 flags)
+{
+	struct perf_aggr_record rec;
+	size_t size;
+
+	rec.count = atomic64_read(&slot->count);
+	if (!rec.count)
+		return 0;
+
+	rec.key = key;
+	rec.period = atomic64_read(&slot->period);
+	rec.nr = slot->nr;
+	smp_rmb();
+
+	size = sizeof(rec) + rec.nr * sizeof(u64);
+	if (size > *left)
+		return -ENOSPC;
+
+	if (copy_to_user(*buf, &rec, sizeof(rec)) ||
+	    copy_to_user(*buf + sizeof(rec), slot->ip, rec.nr * sizeof(u64)))
+		return -EFAULT;
+
+	/* samples counted meanwhile stay for the next read */
+	if (flags & PERF_AGGR_READ_RESET) {
+		atomic64_sub(rec.count, &slot->count);
+		atomic64_sub(rec.period, &slot->period);
+	}
+
+	*buf += size;
+	*left -= size;
+	return 1;
+}
+
+static int perf_event_aggr_read(struct perf_event *event,
+				struct perf_aggr_read __user *uread)
+{
+	struct perf_aggr *aggr = event->aggr;
+	struct perf_aggr_read read;
+	void __user *buf;
+	unsigned int idx;
+	u64 left, key;
+	int ret;
+
+	if (!aggr)
+		return -EINVAL;
+
+	if (copy_from_user(&read, uread, sizeof(read)))
+		return -EFAULT;
+
+	if (read.flags & ~PERF_AGGR_READ_RESET)
+		return -EINVAL;
+
+	buf = (void __user *)(unsigned long)read.buf;
+	left = read.size;
+	read.nr = 0;
+
+	ret = perf_aggr_copy_slot(&aggr->zero, 0, &buf, &left, read.flags);
+	if (ret > 0)
+		read.nr++;
+
+	for (idx = 0; idx < aggr->nr_slots && ret >= 0; idx++) {
+		struct perf_aggr_slot *slot = perf_aggr_slot(aggr, idx);
+
+		key = atomic64_read(&slot->key);
+		if (!key)
+			continue;
+
+		ret = perf_aggr_copy_slot(slot, key, &buf, &left, read.flags);
+		if (ret > 0)
+			read.nr++;
+		cond_resched();
+	}
+
+	/* a short buffer leaves the rest for the next read */
+	if (ret == -EFAULT)
+		return ret;
+
+	if (read.flags & PERF_AGGR_READ_RESET)
+		read.dropped = atomic64_xchg(&aggr->dropped, 0);
+	else
+		read.dropped = atomic64_read(&aggr->dropped);
+
+	if (copy_to_user(uread, &read, sizeof(read)))
+		return -EFAULT;
+
+	return 0;
+}
+
 /*
  * read event_id
  */
@@ -3996,6 +4258,8 @@ static int __perf_event_overflow(struct perf_event *event, int nmi,
 
 	if (event->overflow_handler)
 		event->overflow_handler(event, nmi, data, regs);
+	else if (event->aggr)
+		perf_event_aggregate(event, data, regs);
 	else
 		perf_event_output(event, nmi, data, regs);
 
@@ -4750,7 +5014,7 @@ static void sw_perf_event_destroy(struct perf_event *event)
 
 	WARN_ON(event->parent);
 
-	atomic_dec(&perf_swevent_enabled[event_id]);
+	jump_label_dec(&perf_swevent_enabled[event_id]);
 	swevent_hlist_put(event);
 }
 
@@ -4796,7 +5060,7 @@ static const struct pmu *sw_perf_event_init(struct perf_event *event)
 			if (err)
 				return ERR_PTR(err);
 
-			atomic_inc(&perf_swevent_enabled[event_id]);
+			jump_label_inc(&perf_swevent_enabled[event_id]);
 			event->destroy = sw_perf_event_destroy;
 		}
 		pmu = &perf_ops_generic;
@@ -4921,6 +5185,21 @@ done:
 
 	event->pmu = pmu;
 
+	if (attr->aggregate) {
+		if (parent_event)
+			event->aggr = parent_event->aggr;
+		else
+			err = perf_aggr_alloc(event);
+		if (err) {
+			if (event->destroy)
+				event->destroy(event);
+			if (event->ns)
+				put_pid_ns(event->ns);
+			kfree(event);
+			return ERR_PTR(err);
+		}
+	}
+
 	if (!event->parent) {
 		atomic_inc(&nr_events);
 		if (event->attr.mmap || event->attr.mmap_data)
@@ -4999,6 +5278,25 @@ static int perf_copy_attr(struct perf_event_attr __user *uattr,
 	if (attr->__reserved_1)
 		return -EINVAL;
 
+	if (attr->aggregate) {
+		static const u64 key_sample[PERF_AGGR_KEY_MAX] = {
+			[PERF_AGGR_KEY_IP]		= PERF_SAMPLE_IP,
+			[PERF_AGGR_KEY_CALLCHAIN]	= PERF_SAMPLE_CALLCHAIN,
+			[PERF_AGGR_KEY_RAW]		= PERF_SAMPLE_RAW,
+		};
+
+		if (attr->aggr_key >= PERF_AGGR_KEY_MAX ||
+		    !(attr->sample_type & key_sample[attr->aggr_key]) ||
+		    !attr->sample_period ||
+		    attr->aggr_entries > PERF_AGGR_MAX_ENTRIES)
+			return -EINVAL;
+
+		if (attr->aggr_key == PERF_AGGR_KEY_RAW &&
+		    (!is_power_of_2(attr->aggr_raw_size) ||
+		     attr->aggr_raw_size > sizeof(u64)))
+			return -EINVAL;
+	}
+
 	if (attr->sample_type & ~(PERF_SAMPLE_MAX-1))
 		return -EINVAL;
 
@@ -40,6 +40,7 @@
 #include <linux/string.h>
 #include <linux/platform_device.h>
 #include <linux/init.h>
+#include <linux/irq.h>
 
 #include <linux/uaccess.h>
 
@@ -106,6 +107,16 @@ static ssize_t pm_qos_power_write(struct file *filp, const char __user *buf,
 static int pm_qos_power_open(struct inode *inode, struct file *filp);
 static int pm_qos_power_release(struct inode *inode, struct file *filp);
 
+/*
+ * Per cpu cpu_dma_latency requests: each pm_qos_cpu_request has a node in
+ * the list of every cpu of its mask, and pm_qos_cpu_target caches the
+ * smallest value of each list, for the idle governors to read it lockless.
+ */
+static DEFINE_PER_CPU(struct plist_head, pm_qos_cpu_requests);
+static DEFINE_PER_CPU(s32, pm_qos_cpu_target) = 2000 * USEC_PER_SEC;
+/* the pm_qos_cpu_requests following an irq */
+static LIST_HEAD(pm_qos_irq_requests);
+
 static const struct file_operations pm_qos_power_fops = {
 	.write = pm_qos_power_write,
 	.open = pm_qos_power_open,
@@ -304,6 +315,178 @@ void pm_qos_remove_request(struct pm_qos_request_list *pm_qos_req)
 }
 EXPORT_SYMBOL_GPL(pm_qos_remove_request);
 
+/* pm_qos_lock held */
+static void pm_qos_set_cpu_request(struct pm_qos_cpu_request *req,
+				   const struct cpumask *cpus, s32 value)
+{
+	struct plist_head *head;
+	struct plist_node *node;
+	int cpu;
+
+	for_each_cpu(cpu, req->cpus) {
+		head = &per_cpu(pm_qos_cpu_requests, cpu);
+		plist_del(per_cpu_ptr(req->nodes, cpu), head);
+	}
+	if (cpus)
+		cpumask_and(req->cpus, cpus, cpu_possible_mask);
+	if (value == PM_QOS_DEFAULT_VALUE)
+		value = cpu_dma_pm_qos.default_value;
+	req->value = value;
+
+	/* the cpus that left the mask need updating too */
+	for_each_possible_cpu(cpu) {
+		head = &per_cpu(pm_qos_cpu_requests, cpu);
+		if (cpumask_test_cpu(cpu, req->cpus)) {
+			node = per_cpu_ptr(req->nodes, cpu);
+			plist_node_init(node, value);
+			plist_add(node, head);
+		}
+		per_cpu(pm_qos_cpu_target, cpu) = plist_head_empty(head) ?
+			cpu_dma_pm_qos.default_value : plist_first(head)->prio;
+	}
+}
+
+/**
+ * pm_qos_add_cpu_request - inserts a cpu_dma_latency request for some cpus
+ * @req: the request, to be passed to the update and remove calls
+ * @cpus: the cpus the request applies to
+ * @value: the latency, in usecs
+ *
+ * Unlike pm_qos_add_request(PM_QOS_CPU_DMA_LATENCY), which applies to all
+ * the cpus, this only limits the idle states of @cpus.  The notifiers of
+ * cpu_dma_latency are not called, the idle governors use the new value
+ * from the next time the cpus go idle.
+ */
+int pm_qos_add_cpu_request(struct pm_qos_cpu_request *req,
+			   const struct cpumask *cpus, s32 value)
+{
+	unsigned long flags;
+
+	req->nodes = alloc_percpu(struct plist_node);
+	if (!req->nodes)
+		return -ENOMEM;
+	if (!zalloc_cpumask_var(&req->cpus, GFP_KERNEL)) {
+		free_percpu(req->nodes);
+		return -ENOMEM;
+	}
+	req->irq = -1;
+	INIT_LIST_HEAD(&req->irq_list);
+
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	pm_qos_set_cpu_request(req, cpus, value);
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(pm_qos_add_cpu_request);
+
+/**
+ * pm_qos_add_irq_request - inserts a cpu_dma_latency request for an irq
+ * @req: the request, to be passed to the update and remove calls
+ * @irq: the interrupt of the device
+ * @value: the latency, in usecs
+ *
+ * Like pm_qos_add_cpu_request(), for the cpus in the affinity of @irq,
+ * following its changes.
+ */
+int pm_qos_add_irq_request(struct pm_qos_cpu_request *req, unsigned int irq,
+			   s32 value)
+{
+#ifdef CONFIG_GENERIC_HARDIRQS
+	struct irq_desc *desc = irq_to_desc(irq);
+	unsigned long flags;
+	int ret;
+
+	if (!desc)
+		return -EINVAL;
+
+	ret = pm_qos_add_cpu_request(req, cpu_none_mask, value);
+	if (ret)
+		return ret;
+
+	/* under the lock, so a concurrent affinity change is not lost */
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	req->irq = irq;
+	list_add(&req->irq_list, &pm_qos_irq_requests);
+	pm_qos_set_cpu_request(req, desc->affinity, req->value);
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+EXPORT_SYMBOL_GPL(pm_qos_add_irq_request);
+
+/**
+ * pm_qos_update_cpu_request - modifies an existing per cpu request
+ * @req: the request
+ * @cpus: the new cpus, NULL to keep them
+ * @new_value: the new latency, in usecs
+ */
+void pm_qos_update_cpu_request(struct pm_qos_cpu_request *req,
+			       const struct cpumask *cpus, s32 new_value)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	pm_qos_set_cpu_request(req, cpus, new_value);
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+}
+EXPORT_SYMBOL_GPL(pm_qos_update_cpu_request);
+
+/**
+ * pm_qos_remove_cpu_request - removes a per cpu request
+ * @req: the request
+ */
+void pm_qos_remove_cpu_request(struct pm_qos_cpu_request *req)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	list_del(&req->irq_list);
+	pm_qos_set_cpu_request(req, cpu_none_mask, PM_QOS_DEFAULT_VALUE);
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+
+	free_cpumask_var(req->cpus);
+	free_percpu(req->nodes);
+	memset(req, 0, sizeof(*req));
+}
+EXPORT_SYMBOL_GPL(pm_qos_remove_cpu_request);
+
+/**
+ * pm_qos_cpu_latency - the per cpu cpu_dma_latency target of a cpu
+ * @cpu: the cpu
+ *
+ * Only the per cpu requests are accounted, the system wide target is
+ * pm_qos_request(PM_QOS_CPU_DMA_LATENCY).  Lockless, for the idle path.
+ */
+s32 pm_qos_cpu_latency(int cpu)
+{
+	return ACCESS_ONCE(per_cpu(pm_qos_cpu_target, cpu));
+}
+EXPORT_SYMBOL_GPL(pm_qos_cpu_latency);
+
+/**
+ * pm_qos_irq_affinity_changed - move the requests of an irq
+ * @irq: the interrupt
+ * @cpus: its new affinity
+ *
+ * Called by irq_set_affinity().
+ */
+void pm_qos_irq_affinity_changed(unsigned int irq, const struct cpumask *cpus)
+{
+	struct pm_qos_cpu_request *req;
+	unsigned long flags;
+
+	if (list_empty(&pm_qos_irq_requests))
+		return;
+
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	list_for_each_entry(req, &pm_qos_irq_requests, irq_list)
+		if (req->irq == irq)
+			pm_qos_set_cpu_request(req, cpus, req->value);
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+}
+
 /**
  * pm_qos_add_notifier - sets notification entry for changes to target value
  * @pm_qos_class: identifies which qos target changes should be notified.
@@ -401,6 +584,17 @@ static ssize_t pm_qos_power_write(struct file *filp, const char __user *buf,
 }
 
 
+static int __init pm_qos_cpu_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		plist_head_init(&per_cpu(pm_qos_cpu_requests, cpu),
+				&pm_qos_lock);
+	return 0;
+}
+early_initcall(pm_qos_cpu_init);
+
 static int __init pm_qos_power_init(void)
 {
 	int ret = 0;
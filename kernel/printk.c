@@ -39,6 +39,7 @@
 #include <linux/syslog.h>
 #include <linux/cpu.h>
 #include <linux/notifier.h>
+#include <linux/kthread.h>
 
 #include <asm/uaccess.h>
 
@@ -117,6 +118,12 @@ static unsigned log_start;	/* Index into log_buf: next char to be read by syslog
 static unsigned con_start;	/* Index into log_buf: next char to be sent to consoles */
 static unsigned log_end;	/* Index into log_buf: most-recently-written-char + 1 */
 
+/* Work left to the next tick of the cpu, where it is safe to wake tasks */
+#define PRINTK_PENDING_WAKEUP	0x01	/* klogd */
+#define PRINTK_PENDING_OUTPUT	0x02	/* the printk thread */
+
+static DEFINE_PER_CPU(int, printk_pending);
+
 /*
  *	Array of consoles built from command line options (console=)
  */
@@ -689,13 +696,298 @@ static inline void printk_delay(void)
 	}
 }
 
+/*
+ * Copy a message into log_buf.  If the caller didn't provide appropriate
+ * log level tags, we insert them here.  Returns the number of characters
+ * stored.  Called with logbuf_lock held.
+ */
+static int log_store(const char *p, int len, unsigned long long ts)
+{
+	int current_log_level = default_message_loglevel;
+	const char *end = p + len;
+	int printed_len = 0;
+
+	/* Do we have a loglevel in the string? */
+	if (len >= 3 && p[0] == '<' && p[2] == '>') {
+		switch (p[1]) {
+		case '0' ... '7': /* loglevel */
+			current_log_level = p[1] - '0';
+		/* Fallthrough - make sure we're on a new line */
+		case 'd': /* KERN_DEFAULT */
+			if (!new_text_line) {
+				emit_log_char('\n');
+				new_text_line = 1;
+			}
+		/* Fallthrough - skip the loglevel */
+		case 'c': /* KERN_CONT */
+			p += 3;
+			break;
+		}
+	}
+
+	for ( ; p < end; p++) {
+		if (new_text_line) {
+			/* Always output the token */
+			emit_log_char('<');
+			emit_log_char(current_log_level + '0');
+			emit_log_char('>');
+			printed_len += 3;
+			new_text_line = 0;
+
+			if (printk_time) {
+				/* Follow the token with the time */
+				char tbuf[50], *tp;
+				unsigned tlen;
+				unsigned long long t = ts;
+				unsigned long nanosec_rem;
+
+				nanosec_rem = do_div(t, 1000000000);
+				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
+						(unsigned long) t,
+						nanosec_rem / 1000);
+
+				for (tp = tbuf; tp < tbuf + tlen; tp++)
+					emit_log_char(*tp);
+				printed_len += tlen;
+			}
+		}
+
+		emit_log_char(*p);
+		printed_len++;
+		if (*p == '\n')
+			new_text_line = 1;
+	}
+
+	return printed_len;
+}
+
+/*
+ * Deferred printk.
+ *
+ * Once the printk thread is up, printk() doesn't take logbuf_lock or
+ * the console semaphore.  It formats the message into a buffer of its
+ * cpu, appends it as a record to the ring of its cpu, which only that
+ * cpu writes, and leaves the rest to the printk thread: that moves the
+ * records of all cpus into log_buf in timestamp order and prints them,
+ * so a printk caller never waits on another cpu or on a slow console.
+ *
+ * Printing is synchronous as before during an oops, when the system
+ * goes down, when the ring of the cpu is full, and for a printk from
+ * NMI that interrupted one on the same cpu.  Such a printk first moves
+ * the records that are pending in all rings into log_buf, so the order
+ * of log_buf is kept.  printk.deferred=0 switches the deferral off.
+ */
+#define PRINTK_RING_SIZE	(16 << 10)
+#define PRINTK_RING_MASK	(PRINTK_RING_SIZE - 1)
+#define PRINTK_RECORD_ALIGN	16
+#define PRINTK_RECORD_WRAP	0xffff	/* the rest of the ring is unused */
+
+struct printk_record {
+	u64 ts_nsec;
+	u16 size;		/* of the whole record, aligned */
+	u16 text_len;
+	/* the formatted text follows */
+};
+
+struct printk_ring {
+	char *buf;
+	unsigned head;		/* written by its cpu only */
+	unsigned tail;		/* written under logbuf_lock only */
+	int busy;		/* its cpu is adding a record */
+	char text[1024];	/* format buffer of the cpu */
+};
+
+static DEFINE_PER_CPU(struct printk_ring, printk_rings);
+static int printk_deferred = 1;
+module_param_named(deferred, printk_deferred, bool, S_IRUGO | S_IWUSR);
+static int printk_rings_ready;
+
+static struct printk_record *printk_ring_record(struct printk_ring *ring,
+						unsigned pos)
+{
+	return (struct printk_record *)(ring->buf + (pos & PRINTK_RING_MASK));
+}
+
+/*
+ * Append a record to the ring of this cpu, with interrupts disabled.
+ * Returns false if it doesn't fit.
+ */
+static bool printk_ring_store(struct printk_ring *ring, int len,
+			      unsigned long long ts)
+{
+	unsigned size = ALIGN(sizeof(struct printk_record) + len,
+			      PRINTK_RECORD_ALIGN);
+	unsigned head = ring->head;
+	unsigned to_end = PRINTK_RING_SIZE - (head & PRINTK_RING_MASK);
+	unsigned need = size + (to_end < size ? to_end : 0);
+	struct printk_record *rec;
+
+	if (need > PRINTK_RING_SIZE - (head - ACCESS_ONCE(ring->tail)))
+		return false;
+	/* don't write over a record before the drain is done reading it */
+	smp_mb();
+
+	if (to_end < size) {
+		rec = printk_ring_record(ring, head);
+		rec->text_len = PRINTK_RECORD_WRAP;
+		head += to_end;
+	}
+
+	rec = printk_ring_record(ring, head);
+	rec->ts_nsec = ts;
+	rec->size = size;
+	rec->text_len = len;
+	memcpy(rec + 1, ring->text, len);
+
+	/* the drain must see the record before the new head */
+	smp_wmb();
+	ring->head = head + size;
+	return true;
+}
+
+static bool printk_rings_pending(void)
+{
+	struct printk_ring *ring;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ring = &per_cpu(printk_rings, cpu);
+		if (ring->tail != ACCESS_ONCE(ring->head))
+			return true;
+	}
+	return false;
+}
+
+/* The oldest record of the ring, or NULL.  Called with logbuf_lock held. */
+static struct printk_record *printk_ring_peek(struct printk_ring *ring)
+{
+	struct printk_record *rec;
+
+	while (ring->tail != ACCESS_ONCE(ring->head)) {
+		smp_rmb();
+		rec = printk_ring_record(ring, ring->tail);
+		if (rec->text_len != PRINTK_RECORD_WRAP)
+			return rec;
+		ring->tail += PRINTK_RING_SIZE -
+			      (ring->tail & PRINTK_RING_MASK);
+	}
+	return NULL;
+}
+
+/*
+ * Move the records of all rings into log_buf, oldest first.  Called with
+ * logbuf_lock held.  Returns whether there were any.
+ */
+static bool printk_rings_drain(void)
+{
+	struct printk_record *rec, *oldest;
+	struct printk_ring *ring, *oldest_ring;
+	bool drained = false;
+	int cpu;
+
+	if (!printk_rings_ready)
+		return false;
+
+	for (;;) {
+		oldest = NULL;
+		for_each_possible_cpu(cpu) {
+			ring = &per_cpu(printk_rings, cpu);
+			rec = printk_ring_peek(ring);
+			if (rec && (!oldest || rec->ts_nsec < oldest->ts_nsec)) {
+				oldest = rec;
+				oldest_ring = ring;
+			}
+		}
+		if (!oldest)
+			return drained;
+
+		log_store((char *)(oldest + 1), oldest->text_len,
+			  oldest->ts_nsec);
+		/* done reading the record before the writer may reuse it */
+		smp_mb();
+		oldest_ring->tail += oldest->size;
+		drained = true;
+	}
+}
+
+static struct task_struct *printk_task;
+
+static int printk_thread(void *unused)
+{
+	unsigned long flags;
+	bool drained;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!printk_rings_pending())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		spin_lock_irqsave(&logbuf_lock, flags);
+		drained = printk_rings_drain();
+		spin_unlock_irqrestore(&logbuf_lock, flags);
+
+		if (drained) {
+			acquire_console_sem();
+			release_console_sem();
+		}
+	}
+	return 0;
+}
+
+static void printk_wake_thread(void)
+{
+	if (printk_task)
+		wake_up_process(printk_task);
+}
+
+static int __init printk_deferred_init(void)
+{
+	struct task_struct *task;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		char *buf = kmalloc_node(PRINTK_RING_SIZE, GFP_KERNEL,
+					 cpu_to_node(cpu));
+
+		if (!buf)
+			goto free;
+		per_cpu(printk_rings, cpu).buf = buf;
+	}
+
+	task = kthread_run(printk_thread, NULL, "kprintkd");
+	if (IS_ERR(task))
+		goto free;
+	printk_task = task;
+
+	smp_wmb();
+	printk_rings_ready = 1;
+	return 0;
+
+free:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(printk_rings, cpu).buf);
+		per_cpu(printk_rings, cpu).buf = NULL;
+	}
+	return -ENOMEM;
+}
+core_initcall(printk_deferred_init);
+
+static bool printk_can_defer(struct printk_ring *ring)
+{
+	return printk_rings_ready && printk_deferred && !oops_in_progress &&
+	       (system_state == SYSTEM_BOOTING ||
+		system_state == SYSTEM_RUNNING) && !ring->busy;
+}
+
 asmlinkage int vprintk(const char *fmt, va_list args)
 {
 	int printed_len = 0;
-	int current_log_level = default_message_loglevel;
+	struct printk_ring *ring;
+	const char *text = NULL;
+	unsigned long long ts;
 	unsigned long flags;
-	int this_cpu;
-	char *p;
+	int this_cpu, len;
 
 	boot_delay_msec();
 	printk_delay();
@@ -704,6 +996,21 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	/* This stops the holder of console_sem just where we want him */
 	raw_local_irq_save(flags);
 	this_cpu = smp_processor_id();
+	ring = &per_cpu(printk_rings, this_cpu);
+
+	if (printk_can_defer(ring)) {
+		ring->busy = 1;
+		ts = cpu_clock(this_cpu);
+		len = vscnprintf(ring->text, sizeof(ring->text), fmt, args);
+		if (printk_ring_store(ring, len, ts)) {
+			ring->busy = 0;
+			__raw_get_cpu_var(printk_pending) |= PRINTK_PENDING_OUTPUT;
+			printed_len = len;
+			goto out_restore_irqs;
+		}
+		/* The ring is full, print it synchronously */
+		text = ring->text;
+	}
 
 	/*
 	 * Ouch, printk recursed into itself!
@@ -718,7 +1025,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 		 */
 		if (!oops_in_progress) {
 			recursion_bug = 1;
-			goto out_restore_irqs;
+			goto out_clear_busy;
 		}
 		zap_locks();
 	}
@@ -727,78 +1034,23 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	spin_lock(&logbuf_lock);
 	printk_cpu = this_cpu;
 
+	/* Whatever was deferred goes first */
+	printk_rings_drain();
+
 	if (recursion_bug) {
 		recursion_bug = 0;
-		strcpy(printk_buf, recursion_bug_msg);
-		printed_len = strlen(recursion_bug_msg);
-	}
-	/* Emit the output into the temporary buffer */
-	printed_len += vscnprintf(printk_buf + printed_len,
-				  sizeof(printk_buf) - printed_len, fmt, args);
-
-
-	p = printk_buf;
-
-	/* Do we have a loglevel in the string? */
-	if (p[0] == '<') {
-		unsigned char c = p[1];
-		if (c && p[2] == '>') {
-			switch (c) {
-			case '0' ... '7': /* loglevel */
-				current_log_level = c - '0';
-			/* Fallthrough - make sure we're on a new line */
-			case 'd': /* KERN_DEFAULT */
-				if (!new_text_line) {
-					emit_log_char('\n');
-					new_text_line = 1;
-				}
-			/* Fallthrough - skip the loglevel */
-			case 'c': /* KERN_CONT */
-				p += 3;
-				break;
-			}
-		}
+		printed_len += log_store(recursion_bug_msg,
+					 strlen(recursion_bug_msg),
+					 cpu_clock(printk_cpu));
 	}
 
-	/*
-	 * Copy the output into log_buf.  If the caller didn't provide
-	 * appropriate log level tags, we insert them here
-	 */
-	for ( ; *p; p++) {
-		if (new_text_line) {
-			/* Always output the token */
-			emit_log_char('<');
-			emit_log_char(current_log_level + '0');
-			emit_log_char('>');
-			printed_len += 3;
-			new_text_line = 0;
-
-			if (printk_time) {
-				/* Follow the token with the time */
-				char tbuf[50], *tp;
-				unsigned tlen;
-				unsigned long long t;
-				unsigned long nanosec_rem;
-
-				t = cpu_clock(printk_cpu);
-				nanosec_rem = do_div(t, 1000000000);
-				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
-						(unsigned long) t,
-						nanosec_rem / 1000);
-
-				for (tp = tbuf; tp < tbuf + tlen; tp++)
-					emit_log_char(*tp);
-				printed_len += tlen;
-			}
-
-			if (!*p)
-				break;
-		}
-
-		emit_log_char(*p);
-		if (*p == '\n')
-			new_text_line = 1;
+	if (!text) {
+		/* Emit the output into the temporary buffer */
+		ts = cpu_clock(printk_cpu);
+		len = vscnprintf(printk_buf, sizeof(printk_buf), fmt, args);
+		text = printk_buf;
 	}
+	printed_len += log_store(text, len, ts);
 
 	/*
 	 * Try to acquire and then immediately release the
@@ -814,6 +1066,9 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 		release_console_sem();
 
 	lockdep_on();
+out_clear_busy:
+	if (text == ring->text)
+		ring->busy = 0;
 out_restore_irqs:
 	raw_local_irq_restore(flags);
 
@@ -829,6 +1084,10 @@ static void call_console_drivers(unsigned start, unsigned end)
 {
 }
 
+static void printk_wake_thread(void)
+{
+}
+
 #endif
 
 static int __add_preferred_console(char *name, int idx, char *options,
@@ -1050,13 +1309,16 @@ int is_console_locked(void)
 	return console_locked;
 }
 
-static DEFINE_PER_CPU(int, printk_pending);
-
 void printk_tick(void)
 {
-	if (__get_cpu_var(printk_pending)) {
+	int pending = __get_cpu_var(printk_pending);
+
+	if (pending) {
 		__get_cpu_var(printk_pending) = 0;
-		wake_up_interruptible(&log_wait);
+		if (pending & PRINTK_PENDING_OUTPUT)
+			printk_wake_thread();
+		if (pending & PRINTK_PENDING_WAKEUP)
+			wake_up_interruptible(&log_wait);
 	}
 }
 
@@ -1068,7 +1330,7 @@ int printk_needs_cpu(int cpu)
 void wake_up_klogd(void)
 {
 	if (waitqueue_active(&log_wait))
-		__raw_get_cpu_var(printk_pending) = 1;
+		__raw_get_cpu_var(printk_pending) |= PRINTK_PENDING_WAKEUP;
 }
 
 /**
@@ -1545,6 +1807,7 @@ void kmsg_dump(enum kmsg_dump_reason reason)
 	   there's not a lot we can do about that. The new messages
 	   will overwrite the start of what we dump. */
 	spin_lock_irqsave(&logbuf_lock, flags);
+	printk_rings_drain();
 	end = log_end & LOG_BUF_MASK;
 	chars = logged_chars;
 	spin_unlock_irqrestore(&logbuf_lock, flags);
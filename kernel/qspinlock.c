@@ -0,0 +1,280 @@
+/*
+ * Queued spinlock slowpath
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * A ticket lock makes all its waiters spin on the lock cacheline, which
+ * bounces between them on every release.  Here, the waiters queue up
+ * MCS style (Mellor-Crummey and Scott, "Algorithms for Scalable
+ * Synchronization on Shared-Memory Multiprocessors"): each spins on a
+ * node of its own, which its predecessor writes once to hand the head
+ * of the queue over.
+ *
+ * An MCS lock is a pointer to the last node of the queue, and its
+ * unlock needs the node of the owner.  To keep the 4 byte lock word
+ * and the spin_unlock() interface, the word holds a locked byte and
+ * the tail of the queue encoded as (cpu, nesting index): every cpu
+ * has one node per context that can take spinlocks (task, softirq,
+ * hardirq, nmi), and only the waiter at the head of the queue spins on
+ * the lock word itself, waiting for the owner to clear the locked byte.
+ *
+ * A single waiter does not queue: it sets the pending bit and spins on
+ * the lock word, sparing the uncontended-but-for-one case the cache
+ * misses on a node.
+ *
+ * The transitions below are noted (queue tail, pending bit, locked byte),
+ * with '*' any value, 'n' our own tail and 'p' a previous one.
+ */
+#include <linux/smp.h>
+#include <linux/bug.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/hardirq.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <trace/events/lock.h>
+
+struct mcs_spinlock {
+	struct mcs_spinlock *next;
+	int locked;	/* 1 once we are at the head of the queue */
+	int count;	/* nesting level, in the first node of a cpu */
+};
+
+/* Task, softirq, hardirq and nmi contexts */
+#define MAX_NODES	4
+
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct mcs_spinlock, mcs_nodes[MAX_NODES]);
+
+/*
+ * The tail cpu is offset by one, so that a zero tail means no queue.
+ */
+static inline u32 encode_tail(int cpu, int idx)
+{
+	u32 tail;
+
+	tail  = (cpu + 1) << _Q_TAIL_CPU_OFFSET;
+	tail |= idx << _Q_TAIL_IDX_OFFSET;
+
+	return tail;
+}
+
+static inline struct mcs_spinlock *decode_tail(u32 tail)
+{
+	int cpu = (tail >> _Q_TAIL_CPU_OFFSET) - 1;
+	int idx = (tail &  _Q_TAIL_IDX_MASK) >> _Q_TAIL_IDX_OFFSET;
+
+	return per_cpu_ptr(&mcs_nodes[idx], cpu);
+}
+
+#define _Q_LOCKED_PENDING_MASK (_Q_LOCKED_MASK | _Q_PENDING_MASK)
+
+/*
+ * *,1,0 -> *,0,1: the pending waiter takes the lock. Nobody else can
+ * change the locked and pending bits meanwhile.
+ */
+static inline void clear_pending_set_locked(struct qspinlock *lock)
+{
+	atomic_add(-_Q_PENDING_VAL + _Q_LOCKED_VAL, &lock->val);
+}
+
+/*
+ * *,0,0 -> *,0,1: the head of the queue takes the lock.
+ */
+static inline void set_locked(struct qspinlock *lock)
+{
+	atomic_add(_Q_LOCKED_VAL, &lock->val);
+}
+
+/*
+ * p,*,* -> n,*,*: publish our node as the tail of the queue, returning
+ * the previous lock word.
+ */
+static inline u32 xchg_tail(struct qspinlock *lock, u32 tail)
+{
+	u32 old, new, val = atomic_read(&lock->val);
+
+	for (;;) {
+		new = (val & _Q_LOCKED_PENDING_MASK) | tail;
+		old = atomic_cmpxchg(&lock->val, val, new);
+		if (old == val)
+			break;
+		val = old;
+	}
+	return old;
+}
+
+/**
+ * queued_spin_lock_slowpath - acquire the queued spinlock
+ * @lock: Pointer to queued spinlock structure
+ * @val: Current value of the queued spinlock 32-bit word
+ */
+void __lockfunc queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
+{
+	struct mcs_spinlock *prev, *next, *node;
+	u32 new, old, tail;
+	int idx;
+
+	BUILD_BUG_ON(CONFIG_NR_CPUS >= (1U << _Q_TAIL_CPU_BITS));
+
+	/*
+	 * Wait for an in-progress pending->locked hand-over: it is
+	 * quicker than queueing.
+	 */
+	if (val == _Q_PENDING_VAL) {
+		while ((val = atomic_read(&lock->val)) == _Q_PENDING_VAL)
+			cpu_relax();
+	}
+
+	/*
+	 * trylock || pending
+	 *
+	 * 0,0,0 -> 0,0,1 ; trylock
+	 * 0,0,1 -> 0,1,1 ; pending
+	 */
+	for (;;) {
+		/* If we observe any contention, queue. */
+		if (val & ~_Q_LOCKED_MASK)
+			goto queue;
+
+		new = _Q_LOCKED_VAL;
+		if (val == new)
+			new |= _Q_PENDING_VAL;
+
+		old = atomic_cmpxchg(&lock->val, val, new);
+		if (old == val)
+			break;
+
+		val = old;
+	}
+
+	/* We won the trylock */
+	if (new == _Q_LOCKED_VAL)
+		return;
+
+	/*
+	 * We are pending: wait for the owner to go away.
+	 *
+	 * *,1,1 -> *,1,0
+	 */
+	while ((val = atomic_read(&lock->val)) & _Q_LOCKED_MASK)
+		cpu_relax();
+	smp_rmb();
+
+	/*
+	 * Take ownership and clear the pending bit.
+	 *
+	 * *,1,0 -> *,0,1
+	 */
+	clear_pending_set_locked(lock);
+	return;
+
+	/*
+	 * End of pending bit optimistic spinning and beginning of MCS
+	 * queuing.
+	 */
+queue:
+	node = this_cpu_ptr(&mcs_nodes[0]);
+	idx = node->count++;
+	tail = encode_tail(smp_processor_id(), idx);
+
+	/*
+	 * Out of nodes, which takes more nested spinlock slowpaths than
+	 * there are contexts: just spin on the lock word then.
+	 */
+	if (unlikely(idx >= MAX_NODES)) {
+		while (!queued_spin_trylock(lock))
+			cpu_relax();
+		goto release;
+	}
+
+	node += idx;
+	node->locked = 0;
+	node->next = NULL;
+
+	/*
+	 * We touched a (possibly) cold cacheline in the per-cpu queue
+	 * node; attempt the trylock once more in the hope someone let go
+	 * while we weren't watching.
+	 */
+	if (queued_spin_trylock(lock))
+		goto release;
+
+	trace_contention_begin(lock, LCB_F_SPIN);
+
+	/*
+	 * We have already touched the queueing cacheline; don't bother
+	 * with pending stuff.
+	 *
+	 * p,*,* -> n,*,*
+	 */
+	old = xchg_tail(lock, tail);
+
+	/*
+	 * If there was a previous node, link it and wait until reaching
+	 * the head of the waitqueue.
+	 */
+	if (old & _Q_TAIL_MASK) {
+		prev = decode_tail(old);
+		ACCESS_ONCE(prev->next) = node;
+
+		while (!ACCESS_ONCE(node->locked))
+			cpu_relax();
+		smp_rmb();
+	}
+
+	/*
+	 * We are at the head of the wait queue: wait for the owner and
+	 * the pending waiter to go away.
+	 *
+	 * *,x,y -> *,0,0
+	 */
+	while ((val = atomic_read(&lock->val)) & _Q_LOCKED_PENDING_MASK)
+		cpu_relax();
+	smp_rmb();
+
+	/*
+	 * Claim the lock:
+	 *
+	 * n,0,0 -> 0,0,1 : lock, uncontended
+	 * *,0,0 -> *,0,1 : lock, contended
+	 *
+	 * If the queue head is the only one in the queue (lock value ==
+	 * tail), clear the tail code and grab the lock.  Otherwise, we
+	 * only need to grab the lock.
+	 */
+	for (;;) {
+		if (val != tail) {
+			set_locked(lock);
+			break;
+		}
+		old = atomic_cmpxchg(&lock->val, val, _Q_LOCKED_VAL);
+		if (old == val) {
+			/* No contention */
+			trace_contention_end(lock, 0);
+			goto release;
+		}
+
+		val = old;
+	}
+	trace_contention_end(lock, 0);
+
+	/*
+	 * Contended path; wait for next to link itself, then hand it the
+	 * head of the queue.
+	 */
+	while (!(next = ACCESS_ONCE(node->next)))
+		cpu_relax();
+
+	smp_wmb();
+	ACCESS_ONCE(next->locked) = 1;
+
+release:
+	/*
+	 * Release the node
+	 */
+	this_cpu_dec(mcs_nodes[0].count);
+}
+EXPORT_SYMBOL(queued_spin_lock_slowpath);
@@ -47,6 +47,9 @@
 #include <linux/mutex.h>
 #include <linux/time.h>
 #include <linux/kernel_stat.h>
+#include <linux/stop_machine.h>
+#include <linux/delay.h>
+#include <linux/tick.h>
 
 #include "rcutree.h"
 
@@ -236,8 +239,13 @@ static int rcu_implicit_offline_qs(struct rcu_data *rdp)
 	if (rdp->preemptable)
 		return 0;
 
-	/* The CPU is online, so send it a reschedule IPI. */
-	if (rdp->cpu != smp_processor_id())
+	/*
+	 * The CPU is online, so send it a reschedule IPI.  One which
+	 * stopped its tick while running a task must actually schedule.
+	 */
+	if (tick_nohz_full_stopped(rdp->cpu))
+		tick_nohz_full_kick_cpu(rdp->cpu);
+	else if (rdp->cpu != smp_processor_id())
 		smp_send_reschedule(rdp->cpu);
 	else
 		set_need_resched();
@@ -740,6 +748,7 @@ rcu_start_gp(struct rcu_state *rsp, unsigned long flags)
 
 	/* Advance to a new grace period and initialize state. */
 	rsp->gpnum++;
+	rsp->gp_start_time = ktime_get();
 	WARN_ON_ONCE(rsp->signaled == RCU_GP_INIT);
 	rsp->signaled = RCU_GP_INIT; /* Hold off force_quiescent_state. */
 	rsp->jiffies_force_qs = jiffies + RCU_JIFFIES_TILL_FORCE_QS;
@@ -805,10 +814,25 @@ rcu_start_gp(struct rcu_state *rsp, unsigned long flags)
  * if one is needed.  Note that the caller must hold rnp->lock, as
  * required by rcu_start_gp(), which will release it.
  */
+/*
+ * Account the latency of a grace period that started at @start, in the
+ * log2(usecs) buckets of @hist.
+ */
+static void rcu_lat_hist_add(unsigned long *hist, ktime_t start)
+{
+	u64 usecs = ktime_to_us(ktime_sub(ktime_get(), start));
+	int i = fls64(usecs);
+
+	if (i >= RCU_LAT_HIST_SIZE)
+		i = RCU_LAT_HIST_SIZE - 1;
+	hist[i]++;
+}
+
 static void rcu_report_qs_rsp(struct rcu_state *rsp, unsigned long flags)
 	__releases(rcu_get_root(rsp)->lock)
 {
 	WARN_ON_ONCE(!rcu_gp_in_progress(rsp));
+	rcu_lat_hist_add(rsp->gp_lat_hist, rsp->gp_start_time);
 	rsp->completed = rsp->gpnum;
 	rsp->signaled = RCU_GP_IDLE;
 	rcu_start_gp(rsp, flags);  /* releases root node's rnp->lock. */
@@ -1107,8 +1131,10 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 			rdp->nxttail[count] = &rdp->nxtlist;
 	local_irq_restore(flags);
 
-	/* Invoke callbacks. */
+	/* Invoke callbacks, unless a kthread does it for this CPU. */
 	count = 0;
+	if (rcu_nocb_adopt_cbs(rdp, list, tail, &count))
+		list = NULL;
 	while (list) {
 		next = list->next;
 		prefetch(next);
@@ -1693,6 +1719,138 @@ void rcu_barrier_sched(void)
 }
 EXPORT_SYMBOL_GPL(rcu_barrier_sched);
 
+#ifdef CONFIG_SMP
+
+static atomic_t synchronize_sched_expedited_count = ATOMIC_INIT(0);
+
+static int synchronize_sched_expedited_cpu_stop(void *data)
+{
+	/*
+	 * There must be a full memory barrier on each affected CPU
+	 * between the time that try_stop_cpus() is called and the
+	 * time that it returns.
+	 *
+	 * In the current initial implementation of cpu_stop, the
+	 * above condition is already met when the control reaches
+	 * this point and the following smp_mb() is not strictly
+	 * necessary.  Do smp_mb() anyway for documentation and
+	 * robustness against future implementation changes.
+	 */
+	smp_mb(); /* See above block comment. */
+	return 0;
+}
+
+/*
+ * Is the specified CPU in dynticks-idle mode right now?  If so, it
+ * cannot be in an RCU-sched read-side critical section that started
+ * before the caller's update, and entering any later one implies a
+ * full memory barrier, so there is no need to stop it.
+ */
+static int rcu_sched_exp_cpu_idle(struct rcu_data *rdp)
+{
+#ifdef CONFIG_NO_HZ
+	int snap = ACCESS_ONCE(rdp->dynticks->dynticks);
+	int snap_nmi = ACCESS_ONCE(rdp->dynticks->dynticks_nmi);
+
+	smp_mb(); /* Order sampling of snap with caller's later accesses. */
+	return ((snap & 0x1) == 0) && ((snap_nmi & 0x1) == 0);
+#else /* #ifdef CONFIG_NO_HZ */
+	return 0;
+#endif /* #else #ifdef CONFIG_NO_HZ */
+}
+
+/*
+ * Walk the leaves of the rcu_node tree, setting in @mask the online
+ * CPUs that might be in an RCU-sched read-side critical section and so
+ * must be stopped. The current CPU is not: it runs us, and if we have
+ * been migrated since, it has context-switched.  Returns the number of
+ * online CPUs that need not be stopped.  Called with CPU hotplug held.
+ */
+static int rcu_sched_exp_select_cpus(struct cpumask *mask)
+{
+	struct rcu_state *rsp = &rcu_sched_state;
+	int cpu, self = raw_smp_processor_id();
+	struct rcu_node *rnp;
+	int nidle = 0;
+
+	cpumask_clear(mask);
+	rcu_for_each_leaf_node(rsp, rnp) {
+		if (!ACCESS_ONCE(rnp->qsmaskinit))
+			continue; /* No CPU of this leaf ever came online. */
+		for (cpu = rnp->grplo; cpu <= rnp->grphi; cpu++) {
+			if (!cpu_online(cpu))
+				continue;
+			if (cpu == self || rcu_sched_exp_cpu_idle(rsp->rda[cpu]))
+				nidle++;
+			else
+				cpumask_set_cpu(cpu, mask);
+		}
+	}
+	return nidle;
+}
+
+/*
+ * Wait for an rcu-sched grace period to elapse, but use "big hammer"
+ * approach to force grace period to end quickly.  This stops, through
+ * try_stop_cpus(), each CPU that is not already known to be quiescent
+ * (dynticks-idle) and that consumes significant time on them, so it is
+ * still not recommended for any sort of common-case code.
+ *
+ * Note that it is illegal to call this function while holding any
+ * lock that is acquired by a CPU-hotplug notifier.  Failing to
+ * observe this restriction will result in deadlock.
+ */
+void synchronize_sched_expedited(void)
+{
+	struct rcu_state *rsp = &rcu_sched_state;
+	const struct cpumask *cpus = cpu_online_mask;
+	int snap, nidle = 0, trycount = 0;
+	ktime_t start = ktime_get();
+	cpumask_var_t mask;
+	bool have_mask;
+
+	/* Without a mask, fall back to stopping every online CPU. */
+	have_mask = alloc_cpumask_var(&mask, GFP_KERNEL);
+	if (have_mask)
+		cpus = mask;
+
+	smp_mb();  /* ensure prior mod happens before capturing snap. */
+	snap = atomic_read(&synchronize_sched_expedited_count) + 1;
+	get_online_cpus();
+	if (have_mask)
+		nidle = rcu_sched_exp_select_cpus(mask);
+	while (!cpumask_empty(cpus) &&
+	       try_stop_cpus(cpus, synchronize_sched_expedited_cpu_stop,
+			     NULL) == -EAGAIN) {
+		put_online_cpus();
+		if (trycount++ < 10)
+			udelay(trycount * num_online_cpus());
+		else {
+			synchronize_sched();
+			goto out;
+		}
+		if (atomic_read(&synchronize_sched_expedited_count) - snap > 0) {
+			smp_mb(); /* ensure test happens before caller kfree */
+			goto out;
+		}
+		get_online_cpus();
+		if (have_mask)
+			nidle = rcu_sched_exp_select_cpus(mask);
+	}
+	rsp->n_exp_cpus_forced += cpumask_weight(cpus);
+	rsp->n_exp_cpus_idle += nidle;
+	atomic_inc(&synchronize_sched_expedited_count);
+	smp_mb__after_atomic_inc(); /* ensure post-GP actions seen after GP. */
+	put_online_cpus();
+	rcu_lat_hist_add(rsp->exp_lat_hist, start);
+out:
+	if (have_mask)
+		free_cpumask_var(mask);
+}
+EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
+
+#endif /* #ifdef CONFIG_SMP */
+
 /*
  * Do boot-time initialization of a CPU's per-CPU RCU data.
  */
@@ -1714,6 +1872,7 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 #ifdef CONFIG_NO_HZ
 	rdp->dynticks = &per_cpu(rcu_dynticks, cpu);
 #endif /* #ifdef CONFIG_NO_HZ */
+	rcu_boot_init_nocb_percpu_data(rdp);
 	rdp->cpu = cpu;
 	raw_spin_unlock_irqrestore(&rnp->lock, flags);
 }
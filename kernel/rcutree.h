@@ -27,6 +27,7 @@
 #include <linux/threads.h>
 #include <linux/cpumask.h>
 #include <linux/seqlock.h>
+#include <linux/ktime.h>
 
 /*
  * Define shape of hierarchy based on NR_CPUS and CONFIG_RCU_FANOUT.
@@ -231,6 +232,16 @@ struct rcu_data {
 	unsigned long n_rp_need_fqs;
 	unsigned long n_rp_need_nothing;
 
+#ifdef CONFIG_RCU_NOCB_CPU
+	/* 6) callback offloading. */
+	struct rcu_head *nocb_head;	/* CBs waiting for the kthread. */
+	struct rcu_head **nocb_tail;
+	raw_spinlock_t nocb_lock;	/* Guards the above two. */
+	wait_queue_head_t nocb_wq;	/* For the kthread to sleep on. */
+	struct task_struct *nocb_kthread;
+					/* Invokes this CPU's callbacks. */
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+
 	int cpu;
 };
 
@@ -265,6 +276,9 @@ struct rcu_data {
 
 #endif /* #ifdef CONFIG_RCU_CPU_STALL_DETECTOR */
 
+/* Grace-period latency histograms: bucket i counts [2^(i-1), 2^i) usecs. */
+#define RCU_LAT_HIST_SIZE	24
+
 #define ULONG_CMP_GE(a, b)	(ULONG_MAX / 2 >= (a) - (b))
 #define ULONG_CMP_LT(a, b)	(ULONG_MAX / 2 < (a) - (b))
 
@@ -327,6 +341,15 @@ struct rcu_state {
 	unsigned long jiffies_stall;		/* Time at which to check */
 						/*  for CPU stalls. */
 #endif /* #ifdef CONFIG_RCU_CPU_STALL_DETECTOR */
+	ktime_t gp_start_time;			/* Time at which GP started. */
+	unsigned long gp_lat_hist[RCU_LAT_HIST_SIZE];
+						/* Normal GP latencies. */
+	unsigned long exp_lat_hist[RCU_LAT_HIST_SIZE];
+						/* Expedited GP latencies. */
+	unsigned long n_exp_cpus_forced;	/* CPUs stopped for expedited */
+						/*  GPs. */
+	unsigned long n_exp_cpus_idle;		/* CPUs found quiescent */
+						/*  instead. */
 	char *name;				/* Name of structure. */
 };
 
@@ -385,5 +408,8 @@ static void __cpuinit rcu_preempt_init_percpu_data(int cpu);
 static void rcu_preempt_send_cbs_to_orphanage(void);
 static void __init __rcu_init_preempt(void);
 static void rcu_needs_cpu_flush(void);
+static bool rcu_nocb_adopt_cbs(struct rcu_data *rdp, struct rcu_head *list,
+			       struct rcu_head **tail, int *count);
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp);
 
 #endif /* #ifndef RCU_TREE_NONCORE */
@@ -25,6 +25,13 @@
  */
 
 #include <linux/delay.h>
+#include <linux/kthread.h>
+
+#ifdef CONFIG_RCU_NOCB_CPU
+static cpumask_var_t rcu_nocb_mask; /* CPUs whose callbacks are offloaded. */
+static bool have_rcu_nocb_mask;	    /* Was rcu_nocb_mask allocated? */
+static char __initdata nocb_buf[NR_CPUS * 5];
+#endif /* #ifdef CONFIG_RCU_NOCB_CPU */
 
 /*
  * Check the RCU kernel configuration parameters and print informative
@@ -47,6 +54,13 @@ static void __init rcu_bootup_announce_oddness(void)
 	printk(KERN_INFO
 	       "\tRCU dyntick-idle grace-period acceleration is enabled.\n");
 #endif
+#ifdef CONFIG_RCU_NOCB_CPU
+	if (have_rcu_nocb_mask) {
+		cpulist_scnprintf(nocb_buf, sizeof(nocb_buf), rcu_nocb_mask);
+		printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n",
+		       nocb_buf);
+	}
+#endif
 #ifdef CONFIG_PROVE_RCU
 	printk(KERN_INFO "\tRCU lockdep checking is enabled.\n");
 #endif
@@ -1120,3 +1134,159 @@ static void rcu_needs_cpu_flush(void)
 }
 
 #endif /* #else #if !defined(CONFIG_RCU_FAST_NO_HZ) */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback invocation from the CPUs listed in rcu_nocbs= to
+ * per-CPU kthreads, one per RCU flavor, named rcuo<flavor>/<cpu>.  Grace
+ * periods are still tracked as usual on those CPUs, but the callbacks
+ * that are ready to invoke are handed to the kthread, which runs
+ * wherever and at whatever priority userspace wants it to; by default
+ * it avoids the offloaded CPUs.
+ */
+
+/* Parse the boot-time rcu_nocbs= CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/*
+ * Called from rcu_do_batch() with the ready callbacks, from @list to
+ * @tail, already unlinked from the CPU's list: if the CPU has a
+ * kthread, queue them for it, counting them in @count, and return
+ * true.  Otherwise the caller invokes them itself.
+ */
+static bool rcu_nocb_adopt_cbs(struct rcu_data *rdp, struct rcu_head *list,
+			       struct rcu_head **tail, int *count)
+{
+	struct rcu_head *rhp;
+	unsigned long flags;
+
+	if (!rdp->nocb_kthread)
+		return false;
+
+	for (rhp = list; rhp; rhp = rhp->next)
+		(*count)++;
+
+	raw_spin_lock_irqsave(&rdp->nocb_lock, flags);
+	*rdp->nocb_tail = list;
+	rdp->nocb_tail = tail;
+	raw_spin_unlock_irqrestore(&rdp->nocb_lock, flags);
+	wake_up(&rdp->nocb_wq);
+	return true;
+}
+
+/*
+ * Per-CPU, per-flavor callback-invocation kthread.  Callbacks expect to
+ * run with bottom halves disabled, as they would from RCU_SOFTIRQ.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_data *rdp = arg;
+	struct rcu_head *list, *next;
+	unsigned long flags;
+
+	for (;;) {
+		wait_event_interruptible(rdp->nocb_wq,
+					 ACCESS_ONCE(rdp->nocb_head) != NULL);
+
+		raw_spin_lock_irqsave(&rdp->nocb_lock, flags);
+		list = rdp->nocb_head;
+		rdp->nocb_head = NULL;
+		rdp->nocb_tail = &rdp->nocb_head;
+		raw_spin_unlock_irqrestore(&rdp->nocb_lock, flags);
+
+		while (list) {
+			next = list->next;
+			prefetch(next);
+			local_bh_disable();
+			debug_rcu_head_unqueue(list);
+			list->func(list);
+			local_bh_enable();
+			list = next;
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+	rdp->nocb_head = NULL;
+	rdp->nocb_tail = &rdp->nocb_head;
+	raw_spin_lock_init(&rdp->nocb_lock);
+	init_waitqueue_head(&rdp->nocb_wq);
+	rdp->nocb_kthread = NULL;
+}
+
+/* Create the kthreads of one RCU flavor for the offloaded CPUs. */
+static void __init rcu_spawn_nocb_kthreads_rsp(struct rcu_state *rsp,
+					       char abbr,
+					       const struct cpumask *hk)
+{
+	struct task_struct *t;
+	struct rcu_data *rdp;
+	int cpu;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = rsp->rda[cpu];
+		t = kthread_create(rcu_nocb_kthread, rdp, "rcuo%c/%d",
+				   abbr, cpu);
+		if (IS_ERR(t)) {
+			printk(KERN_ERR "RCU: cannot offload CPU %d: %ld\n",
+			       cpu, PTR_ERR(t));
+			continue;
+		}
+		if (!cpumask_empty(hk))
+			set_cpus_allowed_ptr(t, hk);
+		wake_up_process(t);
+		/* From now on, rcu_do_batch() hands callbacks over. */
+		smp_mb();
+		rdp->nocb_kthread = t;
+	}
+}
+
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	cpumask_var_t hk;
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+	if (cpumask_empty(rcu_nocb_mask))
+		return 0;
+
+	if (!alloc_cpumask_var(&hk, GFP_KERNEL))
+		return -ENOMEM;
+	cpumask_andnot(hk, cpu_possible_mask, rcu_nocb_mask);
+
+	rcu_spawn_nocb_kthreads_rsp(&rcu_sched_state, 's', hk);
+	rcu_spawn_nocb_kthreads_rsp(&rcu_bh_state, 'b', hk);
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	rcu_spawn_nocb_kthreads_rsp(&rcu_preempt_state, 'p', hk);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+
+	free_cpumask_var(hk);
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool rcu_nocb_adopt_cbs(struct rcu_data *rdp, struct rcu_head *list,
+			       struct rcu_head **tail, int *count)
+{
+	return false;
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
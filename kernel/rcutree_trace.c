@@ -294,6 +294,46 @@ static const struct file_operations rcu_pending_fops = {
 	.release = single_release,
 };
 
+static void print_rcu_gp_lat(struct seq_file *m, struct rcu_state *rsp)
+{
+	int i;
+
+	seq_printf(m, "%s: expedited cpus forced=%lu idle=%lu\n",
+		   rsp->name, rsp->n_exp_cpus_forced, rsp->n_exp_cpus_idle);
+	seq_puts(m, "      usecs          gp   expedited\n");
+	for (i = 0; i < RCU_LAT_HIST_SIZE; i++) {
+		if (i < RCU_LAT_HIST_SIZE - 1)
+			seq_printf(m, "  < %8lu", 1UL << i);
+		else
+			seq_printf(m, " >= %8lu", 1UL << (i - 1));
+		seq_printf(m, " %11lu %11lu\n",
+			   rsp->gp_lat_hist[i], rsp->exp_lat_hist[i]);
+	}
+}
+
+static int show_rcu_gp_lat(struct seq_file *m, void *unused)
+{
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	print_rcu_gp_lat(m, &rcu_preempt_state);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	print_rcu_gp_lat(m, &rcu_sched_state);
+	print_rcu_gp_lat(m, &rcu_bh_state);
+	return 0;
+}
+
+static int rcu_gp_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, show_rcu_gp_lat, NULL);
+}
+
+static const struct file_operations rcu_gp_lat_fops = {
+	.owner = THIS_MODULE,
+	.open = rcu_gp_lat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static struct dentry *rcudir;
 
 static int __init rcuclassic_trace_init(void)
@@ -327,6 +367,11 @@ static int __init rcuclassic_trace_init(void)
 						NULL, &rcu_pending_fops);
 	if (!retval)
 		goto free_out;
+
+	retval = debugfs_create_file("rcu_gp_lat", 0444, rcudir,
+						NULL, &rcu_gp_lat_fops);
+	if (!retval)
+		goto free_out;
 	return 0;
 free_out:
 	debugfs_remove_recursive(rcudir);
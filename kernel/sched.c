@@ -78,6 +78,7 @@
 
 #include "sched_cpupri.h"
 #include "workqueue_sched.h"
+#include "sched_autogroup.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -243,6 +244,27 @@ struct cfs_rq;
 
 static LIST_HEAD(task_groups);
 
+/* CFS bandwidth control: the quota of a task group, see sched_fair.c */
+struct cfs_bandwidth {
+#ifdef CONFIG_CFS_BANDWIDTH
+	/* nests inside the rq lock: */
+	raw_spinlock_t		lock;
+	ktime_t			period;
+	u64			quota;		/* runtime per period */
+	u64			runtime;	/* left in the global pool */
+	unsigned int		period_gen;	/* bumped on each refill */
+	int			idle;		/* no runtime taken this period */
+	int			timer_active;
+	struct hrtimer		period_timer;
+	struct list_head	throttled_cfs_rq;
+
+	/* statistics, for cpu.stat */
+	int			nr_periods;
+	int			nr_throttled;
+	u64			throttled_time;
+#endif
+};
+
 /* task group related information */
 struct task_group {
 	struct cgroup_subsys_state css;
@@ -253,6 +275,13 @@ struct task_group {
 	/* runqueue "owned" by this group on each cpu */
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
+
+#ifdef CONFIG_SMP
+	/* sum of the tg_load_contrib of the group's cfs_rqs */
+	atomic_long_t load_avg ____cacheline_aligned;
+#endif
+
+	struct cfs_bandwidth cfs_bandwidth;
 #endif
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -268,6 +297,10 @@ struct task_group {
 	struct task_group *parent;
 	struct list_head siblings;
 	struct list_head children;
+
+#ifdef CONFIG_SCHED_AUTOGROUP
+	struct autogroup *autogroup;
+#endif
 };
 
 #define root_task_group init_task_group
@@ -279,13 +312,6 @@ static DEFINE_SPINLOCK(task_group_lock);
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 
-#ifdef CONFIG_SMP
-static int root_task_group_empty(void)
-{
-	return list_empty(&root_task_group.children);
-}
-#endif
-
 # define INIT_TASK_GROUP_LOAD	NICE_0_LOAD
 
 /*
@@ -360,14 +386,20 @@ struct cfs_rq {
 	unsigned long h_load;
 
 	/*
-	 * this cpu's part of tg->shares
+	 * Sum of the load_avg_contrib of the queued entities, and the part
+	 * of it last added to tg->load_avg.
 	 */
-	unsigned long shares;
+	unsigned long runnable_load_avg;
+	unsigned long tg_load_contrib;
+#endif
+#ifdef CONFIG_CFS_BANDWIDTH
+	int runtime_enabled;		/* the group has a quota */
+	s64 runtime_remaining;		/* of the slice taken from the pool */
+	unsigned int runtime_gen;	/* period the slice was taken in */
 
-	/*
-	 * load.weight at the time we set shares
-	 */
-	unsigned long rq_weight;
+	u64 throttled_timestamp;
+	int throttled;
+	struct list_head throttled_list;
 #endif
 #endif
 };
@@ -475,6 +507,9 @@ struct rq {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	/* list of leaf cfs_rq on this cpu: */
 	struct list_head leaf_cfs_rq_list;
+#ifdef CONFIG_SMP
+	unsigned long h_load_throttle;	/* jiffy of the last update_h_load() */
+#endif
 #endif
 #ifdef CONFIG_RT_GROUP_SCHED
 	struct list_head leaf_rt_rq_list;
@@ -518,12 +553,21 @@ struct rq {
 	u64 age_stamp;
 	u64 idle_stamp;
 	u64 avg_idle;
+
+	/* Worst cost of a newidle balance over all our domains, in ns */
+	u64 max_idle_balance_cost;
 #endif
 
 	/* calc_load related fields */
 	unsigned long calc_load_update;
 	long calc_load_active;
 
+#ifdef CONFIG_CPU_FREQ
+	/* for rq_util(): time not spent idle, halved every SCHED_UTIL_PERIOD */
+	u64 util_busy;
+	u64 util_stamp;
+#endif
+
 #ifdef CONFIG_SCHED_HRTICK
 #ifdef CONFIG_SMP
 	int hrtick_csd_pending;
@@ -612,11 +656,14 @@ static inline int cpu_of(struct rq *rq)
  */
 static inline struct task_group *task_group(struct task_struct *p)
 {
+	struct task_group *tg;
 	struct cgroup_subsys_state *css;
 
 	css = task_subsys_state_check(p, cpu_cgroup_subsys_id,
 			lockdep_is_held(&task_rq(p)->lock));
-	return container_of(css, struct task_group, css);
+	tg = container_of(css, struct task_group, css);
+
+	return autogroup_task_group(p, tg);
 }
 
 /* Change a task's cfs_rq and parent entity if it moves across CPUs/groups */
@@ -643,11 +690,165 @@ static inline struct task_group *task_group(struct task_struct *p)
 
 #endif /* CONFIG_CGROUP_SCHED */
 
+#ifdef CONFIG_CPU_FREQ
+/*
+ * The utilization handed to the cpufreq governors is the share of the
+ * last few SCHED_UTIL_PERIOD a runqueue spent on something else than its
+ * idle task, kept like rt_avg, only on the time scale of frequency
+ * changes rather than of load balancing.
+ */
+#define SCHED_UTIL_PERIOD	(8 * NSEC_PER_MSEC)
+
+static DEFINE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+/**
+ * cpufreq_set_update_util_data - set the scheduler callback of a cpu
+ * @cpu: the cpu
+ * @data: with the callback, or %NULL to remove it
+ *
+ * The callback is called on @cpu from its tick and from the wakeups of
+ * tasks onto it, with preemption disabled and no runqueue lock held,
+ * with the utilization of the runqueue.  Once removed, the callback
+ * may still be running until synchronize_sched() returns.
+ */
+void cpufreq_set_update_util_data(int cpu, struct update_util_data *data)
+{
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), data);
+}
+EXPORT_SYMBOL_GPL(cpufreq_set_update_util_data);
+
+/* Called with rq->lock held, from update_rq_clock() */
+static inline void update_rq_util(struct rq *rq, u64 clock)
+{
+	s64 delta = clock - rq->clock;
+
+	if (delta > 0 && rq->curr != rq->idle)
+		rq->util_busy += delta;
+
+	if (likely((s64)(clock - rq->util_stamp) <= SCHED_UTIL_PERIOD))
+		return;
+
+	/* after so long, nothing is left of what came before */
+	if ((s64)(clock - rq->util_stamp) > 32 * SCHED_UTIL_PERIOD) {
+		rq->util_busy = rq->curr != rq->idle ? SCHED_UTIL_PERIOD : 0;
+		rq->util_stamp = clock;
+		return;
+	}
+
+	while ((s64)(clock - rq->util_stamp) > SCHED_UTIL_PERIOD) {
+		/* see sched_avg_update() */
+		asm("" : "+rm" (rq->util_stamp));
+		rq->util_stamp += SCHED_UTIL_PERIOD;
+		rq->util_busy /= 2;
+	}
+}
+
+/*
+ * The utilization of rq, out of SCHED_LOAD_SCALE.  Realtime tasks get
+ * all of it: they can not wait for the average to catch up.  Called
+ * with rq->lock held, after update_rq_clock().
+ */
+static unsigned long rq_util(struct rq *rq)
+{
+	u64 total, util;
+
+	if (rq->rt.rt_nr_running)
+		return SCHED_LOAD_SCALE;
+
+	total = SCHED_UTIL_PERIOD + (rq->clock - rq->util_stamp);
+	util = div_u64(rq->util_busy << SCHED_LOAD_SHIFT, (u32)total);
+	return min_t(u64, util, SCHED_LOAD_SCALE);
+}
+
+static void cpufreq_update_util(u64 time, unsigned long util)
+{
+	struct update_util_data *data;
+
+	data = rcu_dereference_sched(__get_cpu_var(cpufreq_update_util_data));
+	if (data)
+		data->func(data, time, util, SCHED_LOAD_SCALE);
+}
+#else
+static inline void update_rq_util(struct rq *rq, u64 clock) { }
+static inline unsigned long rq_util(struct rq *rq) { return 0; }
+static inline void cpufreq_update_util(u64 time, unsigned long util) { }
+#endif /* CONFIG_CPU_FREQ */
+
 inline void update_rq_clock(struct rq *rq)
 {
-	if (!rq->skip_clock_update)
-		rq->clock = sched_clock_cpu(cpu_of(rq));
+	u64 clock;
+
+	if (rq->skip_clock_update)
+		return;
+
+	clock = sched_clock_cpu(cpu_of(rq));
+	update_rq_util(rq, clock);
+	rq->clock = clock;
+}
+
+#ifdef CONFIG_SMP
+/*
+ * The highest domain of a cpu that shares its last level cache, and the
+ * first cpu of that domain's span, which names the cache.  Both are set
+ * up along with the domains, in update_top_cache_domain().
+ */
+static DEFINE_PER_CPU(struct sched_domain *, sd_llc);
+static DEFINE_PER_CPU(int, sd_llc_id);
+
+/*
+ * Set while the cache may have a fully idle core, one whose SMT siblings
+ * are all idle.  Only the entry of the sd_llc_id cpu is used, as a hint
+ * shared by the whole cache: set as a core goes idle, cleared by the
+ * wakeup that looked for an idle core and did not find one.
+ */
+static DEFINE_PER_CPU_SHARED_ALIGNED(int, sd_llc_idle_cores);
+
+static inline int cpus_share_cache(int this_cpu, int that_cpu)
+{
+	return per_cpu(sd_llc_id, this_cpu) == per_cpu(sd_llc_id, that_cpu);
+}
+
+static inline int test_idle_cores(int cpu)
+{
+	return ACCESS_ONCE(per_cpu(sd_llc_idle_cores, per_cpu(sd_llc_id, cpu)));
+}
+
+static inline void set_idle_cores(int cpu, int val)
+{
+	int *idle_cores = &per_cpu(sd_llc_idle_cores, per_cpu(sd_llc_id, cpu));
+
+	/* don't bounce the line around when nothing changes */
+	if (ACCESS_ONCE(*idle_cores) != val)
+		*idle_cores = val;
+}
+
+/*
+ * Called as the cpu picks its idle task: if the siblings are idle already,
+ * the whole core now is.
+ */
+static void update_idle_core(struct rq *rq)
+{
+	int core = cpu_of(rq);
+	int cpu;
+
+	if (test_idle_cores(core))
+		return;
+
+	for_each_cpu(cpu, topology_thread_cpumask(core)) {
+		if (cpu == core)
+			continue;
+
+		if (!idle_cpu(cpu))
+			return;
+	}
+
+	set_idle_cores(core, 1);
+}
+#else
+static inline void update_idle_core(struct rq *rq)
+{
 }
+#endif /* CONFIG_SMP */
 
 /*
  * Tunables that become constants when CONFIG_SCHED_DEBUG is off:
@@ -792,20 +993,6 @@ late_initcall(sched_init_debug);
  */
 const_debug unsigned int sysctl_sched_nr_migrate = 32;
 
-/*
- * ratelimit for updating the group shares.
- * default: 0.25ms
- */
-unsigned int sysctl_sched_shares_ratelimit = 250000;
-unsigned int normalized_sysctl_sched_shares_ratelimit = 250000;
-
-/*
- * Inject some fuzzyness into changing the per-cpu group shares
- * this avoids remote rq-locks at the expense of fairness.
- * default: 4
- */
-unsigned int sysctl_sched_shares_thresh = 4;
-
 /*
  * period over which we average the RT time consumption, measured
  * in ms.
@@ -1210,7 +1397,7 @@ int get_nohz_timer_target(void)
 
 	for_each_domain(cpu, sd) {
 		for_each_cpu(i, sched_domain_span(sd))
-			if (!idle_cpu(i))
+			if (!idle_cpu(i) && !tick_nohz_full_cpu(i))
 				return i;
 	}
 	return cpu;
@@ -1539,101 +1726,6 @@ static unsigned long cpu_avg_load_per_task(int cpu)
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 
-static __read_mostly unsigned long __percpu *update_shares_data;
-
-static void __set_se_shares(struct sched_entity *se, unsigned long shares);
-
-/*
- * Calculate and set the cpu's group shares.
- */
-static void update_group_shares_cpu(struct task_group *tg, int cpu,
-				    unsigned long sd_shares,
-				    unsigned long sd_rq_weight,
-				    unsigned long *usd_rq_weight)
-{
-	unsigned long shares, rq_weight;
-	int boost = 0;
-
-	rq_weight = usd_rq_weight[cpu];
-	if (!rq_weight) {
-		boost = 1;
-		rq_weight = NICE_0_LOAD;
-	}
-
-	/*
-	 *             \Sum_j shares_j * rq_weight_i
-	 * shares_i =  -----------------------------
-	 *                  \Sum_j rq_weight_j
-	 */
-	shares = (sd_shares * rq_weight) / sd_rq_weight;
-	shares = clamp_t(unsigned long, shares, MIN_SHARES, MAX_SHARES);
-
-	if (abs(shares - tg->se[cpu]->load.weight) >
-			sysctl_sched_shares_thresh) {
-		struct rq *rq = cpu_rq(cpu);
-		unsigned long flags;
-
-		raw_spin_lock_irqsave(&rq->lock, flags);
-		tg->cfs_rq[cpu]->rq_weight = boost ? 0 : rq_weight;
-		tg->cfs_rq[cpu]->shares = boost ? 0 : shares;
-		__set_se_shares(tg->se[cpu], shares);
-		raw_spin_unlock_irqrestore(&rq->lock, flags);
-	}
-}
-
-/*
- * Re-compute the task group their per cpu shares over the given domain.
- * This needs to be done in a bottom-up fashion because the rq weight of a
- * parent group depends on the shares of its child groups.
- */
-static int tg_shares_up(struct task_group *tg, void *data)
-{
-	unsigned long weight, rq_weight = 0, sum_weight = 0, shares = 0;
-	unsigned long *usd_rq_weight;
-	struct sched_domain *sd = data;
-	unsigned long flags;
-	int i;
-
-	if (!tg->se[0])
-		return 0;
-
-	local_irq_save(flags);
-	usd_rq_weight = per_cpu_ptr(update_shares_data, smp_processor_id());
-
-	for_each_cpu(i, sched_domain_span(sd)) {
-		weight = tg->cfs_rq[i]->load.weight;
-		usd_rq_weight[i] = weight;
-
-		rq_weight += weight;
-		/*
-		 * If there are currently no tasks on the cpu pretend there
-		 * is one of average load so that when a new task gets to
-		 * run here it will not get delayed by group starvation.
-		 */
-		if (!weight)
-			weight = NICE_0_LOAD;
-
-		sum_weight += weight;
-		shares += tg->cfs_rq[i]->shares;
-	}
-
-	if (!rq_weight)
-		rq_weight = sum_weight;
-
-	if ((!shares && rq_weight) || shares > tg->shares)
-		shares = tg->shares;
-
-	if (!sd->parent || !(sd->parent->flags & SD_LOAD_BALANCE))
-		shares = tg->shares;
-
-	for_each_cpu(i, sched_domain_span(sd))
-		update_group_shares_cpu(tg, i, shares, rq_weight, usd_rq_weight);
-
-	local_irq_restore(flags);
-
-	return 0;
-}
-
 /*
  * Compute the cpu's hierarchical load factor for each task group.
  * This needs to be done in a top-down fashion because the load of a child
@@ -1648,7 +1740,7 @@ static int tg_load_down(struct task_group *tg, void *data)
 		load = cpu_rq(cpu)->load.weight;
 	} else {
 		load = tg->parent->cfs_rq[cpu]->h_load;
-		load *= tg->cfs_rq[cpu]->shares;
+		load *= tg->se[cpu]->load.weight;
 		load /= tg->parent->cfs_rq[cpu]->load.weight + 1;
 	}
 
@@ -1657,34 +1749,20 @@ static int tg_load_down(struct task_group *tg, void *data)
 	return 0;
 }
 
-static void update_shares(struct sched_domain *sd)
+/* Called with the rq lock held: once a jiffy is often enough */
+static void update_h_load(long cpu)
 {
-	s64 elapsed;
-	u64 now;
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long now = jiffies;
 
-	if (root_task_group_empty())
+	if (rq->h_load_throttle == now)
 		return;
 
-	now = local_clock();
-	elapsed = now - sd->last_update;
-
-	if (elapsed >= (s64)(u64)sysctl_sched_shares_ratelimit) {
-		sd->last_update = now;
-		walk_tg_tree(tg_nop, tg_shares_up, sd);
-	}
-}
+	rq->h_load_throttle = now;
 
-static void update_h_load(long cpu)
-{
 	walk_tg_tree(tg_load_down, tg_nop, (void *)cpu);
 }
 
-#else
-
-static inline void update_shares(struct sched_domain *sd)
-{
-}
-
 #endif
 
 #ifdef CONFIG_PREEMPT
@@ -1804,15 +1882,39 @@ static void double_rq_unlock(struct rq *rq1, struct rq *rq2)
 		__release(rq2->lock);
 }
 
-#endif
+#else /* CONFIG_SMP */
 
-#ifdef CONFIG_FAIR_GROUP_SCHED
-static void cfs_rq_set_shares(struct cfs_rq *cfs_rq, unsigned long shares)
+/*
+ * double_rq_lock - safely lock two runqueues
+ *
+ * Note this does not disable interrupts like task_rq_lock,
+ * you need to do so manually before calling.
+ */
+static void double_rq_lock(struct rq *rq1, struct rq *rq2)
+	__acquires(rq1->lock)
+	__acquires(rq2->lock)
 {
-#ifdef CONFIG_SMP
-	cfs_rq->shares = shares;
-#endif
+	BUG_ON(!irqs_disabled());
+	BUG_ON(rq1 != rq2);
+	raw_spin_lock(&rq1->lock);
+	__acquire(rq2->lock);	/* Fake it out ;) */
+}
+
+/*
+ * double_rq_unlock - safely unlock two runqueues
+ *
+ * Note this does not restore interrupts like task_rq_unlock,
+ * you need to do so manually after calling.
+ */
+static void double_rq_unlock(struct rq *rq1, struct rq *rq2)
+	__releases(rq1->lock)
+	__releases(rq2->lock)
+{
+	BUG_ON(rq1 != rq2);
+	raw_spin_unlock(&rq1->lock);
+	__release(rq2->lock);
 }
+
 #endif
 
 static void calc_load_account_idle(struct rq *this_rq);
@@ -1845,6 +1947,12 @@ static const struct sched_class rt_sched_class;
 static void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
+
+#ifdef CONFIG_NO_HZ_FULL
+	/* the lone task got company: its cpu needs the tick back */
+	if (rq->nr_running == 2 && tick_nohz_full_stopped(cpu_of(rq)))
+		resched_task(rq->curr);
+#endif
 }
 
 static void dec_nr_running(struct rq *rq)
@@ -1916,10 +2024,55 @@ static void deactivate_task(struct rq *rq, struct task_struct *p, int flags)
 #include "sched_idletask.c"
 #include "sched_fair.c"
 #include "sched_rt.c"
+#include "sched_autogroup.c"
 #ifdef CONFIG_SCHED_DEBUG
 # include "sched_debug.c"
 #endif
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Called from the tick of a nohz_full cpu: a lone task has nobody to be
+ * preempted by, so the scheduler does not need the tick.
+ */
+bool sched_can_stop_tick(void)
+{
+	struct rq *rq = this_rq();
+
+	if (rq->nr_running != 1 || rq->curr == rq->idle)
+		return false;
+
+#ifdef CONFIG_CFS_BANDWIDTH
+	/* runtime against a quota is charged from the tick */
+	if (rq->curr->sched_class == &fair_sched_class) {
+		struct sched_entity *se = &rq->curr->se;
+
+		for_each_sched_entity(se) {
+			if (cfs_rq_of(se)->runtime_enabled)
+				return false;
+		}
+	}
+#endif
+
+	return true;
+}
+
+/*
+ * Bring a nohz_full cpu which stopped its tick through schedule(), which
+ * restarts the tick, so that it notices a new timer or RCU's need for a
+ * quiescent state.
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	if (!tick_nohz_full_stopped(cpu))
+		return;
+
+	if (cpu == smp_processor_id())
+		set_need_resched();
+	else
+		resched_cpu(cpu);
+}
+#endif /* CONFIG_NO_HZ_FULL */
+
 /*
  * __normal_prio - return the priority that is based on the static prio
  */
@@ -2294,6 +2447,8 @@ static inline void ttwu_activate(struct task_struct *p, struct rq *rq,
 		schedstat_inc(p, se.statistics.nr_wakeups_local);
 	else
 		schedstat_inc(p, se.statistics.nr_wakeups_remote);
+	if (rq->curr != rq->idle)
+		schedstat_inc(p, se.statistics.nr_wakeups_busy);
 
 	activate_task(rq, p, en_flags);
 }
@@ -2311,7 +2466,7 @@ static inline void ttwu_post_activation(struct task_struct *p, struct rq *rq,
 
 	if (unlikely(rq->idle_stamp)) {
 		u64 delta = rq->clock - rq->idle_stamp;
-		u64 max = 2*sysctl_sched_migration_cost;
+		u64 max = 2*rq->max_idle_balance_cost;
 
 		if (delta > max)
 			rq->avg_idle = max;
@@ -2343,9 +2498,11 @@ static inline void ttwu_post_activation(struct task_struct *p, struct rq *rq,
 static int try_to_wake_up(struct task_struct *p, unsigned int state,
 			  int wake_flags)
 {
-	int cpu, orig_cpu, this_cpu, success = 0;
+	int cpu, orig_cpu, this_cpu, success = 0, local = 0;
 	unsigned long flags;
 	unsigned long en_flags = ENQUEUE_WAKEUP;
+	unsigned long util = 0;
+	u64 now = 0;
 	struct rq *rq;
 
 	this_cpu = get_cpu();
@@ -2421,10 +2578,17 @@ out_activate:
 	ttwu_activate(p, rq, wake_flags & WF_SYNC, orig_cpu != cpu,
 		      cpu == this_cpu, en_flags);
 	success = 1;
+	if (cpu == this_cpu) {
+		local = 1;
+		now = rq->clock;
+		util = rq_util(rq);
+	}
 out_running:
 	ttwu_post_activation(p, rq, wake_flags, success);
 out:
 	task_rq_unlock(rq, &flags);
+	if (local)
+		cpufreq_update_util(now, util);
 	put_cpu();
 
 	return success;
@@ -2500,6 +2664,16 @@ static void __sched_fork(struct task_struct *p)
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
 
+#if defined(CONFIG_SMP) && defined(CONFIG_FAIR_GROUP_SCHED)
+	/*
+	 * Count a new task as runnable for one full period, so that it
+	 * weighs in from its first enqueue; its clock starts there.
+	 */
+	p->se.avg.runnable_avg_sum = p->se.avg.runnable_avg_period = 1024;
+	p->se.avg.last_runnable_update = 0;
+	p->se.avg.load_avg_contrib = 0;
+#endif
+
 	INIT_LIST_HEAD(&p->rt.run_list);
 	p->se.on_rq = 0;
 	INIT_LIST_HEAD(&p->se.group_node);
@@ -3569,6 +3743,8 @@ void scheduler_tick(void)
 	int cpu = smp_processor_id();
 	struct rq *rq = cpu_rq(cpu);
 	struct task_struct *curr = rq->curr;
+	unsigned long util;
+	u64 now;
 
 	sched_clock_tick();
 
@@ -3576,8 +3752,12 @@ void scheduler_tick(void)
 	update_rq_clock(rq);
 	update_cpu_load_active(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
+	now = rq->clock;
+	util = rq_util(rq);
 	raw_spin_unlock(&rq->lock);
 
+	cpufreq_update_util(now, util);
+
 	perf_event_task_tick(curr);
 
 #ifdef CONFIG_SMP
@@ -3733,6 +3913,19 @@ pick_next_task(struct rq *rq)
 /*
  * schedule() is the main scheduler function.
  */
+/*
+ * Going to sleep with I/O held back on a plug: submit it, we might be
+ * waiting for it.  Not on preemption, the plug may be half updated.
+ */
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+
+	if (blk_needs_flush_plug(tsk))
+		blk_schedule_flush_plug(tsk);
+}
+
 asmlinkage void __sched schedule(void)
 {
 	struct task_struct *prev, *next;
@@ -3740,6 +3933,8 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
+
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -3810,6 +4005,7 @@ need_resched_nonpreemptible:
 		raw_spin_unlock_irq(&rq->lock);
 
 	post_schedule(rq);
+	tick_nohz_full_check();
 
 	if (unlikely(reacquire_kernel_lock(prev)))
 		goto need_resched_nonpreemptible;
@@ -3881,6 +4077,49 @@ int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner)
 }
 #endif
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Same as mutex_spin_on_owner(), for the write owner of an rwsem:
+ * returns 0 if the owner went to sleep or we need to reschedule, 1 if
+ * the owner changed.
+ */
+int rwsem_spin_on_owner(struct rw_semaphore *sem, struct task_struct *owner)
+{
+	unsigned int cpu;
+	struct rq *rq;
+
+	if (!sched_feat(OWNER_SPIN))
+		return 0;
+
+#ifdef CONFIG_DEBUG_PAGEALLOC
+	if (probe_kernel_address(&task_thread_info(owner)->cpu, cpu))
+		return 0;
+#else
+	cpu = task_thread_info(owner)->cpu;
+#endif
+
+	if (cpu >= nr_cpumask_bits)
+		return 0;
+
+	if (!cpu_online(cpu))
+		return 0;
+
+	rq = cpu_rq(cpu);
+
+	for (;;) {
+		if (ACCESS_ONCE(sem->owner) != owner)
+			break;
+
+		if (rq->curr != owner || need_resched())
+			return 0;
+
+		cpu_relax();
+	}
+
+	return 1;
+}
+#endif
+
 #ifdef CONFIG_PREEMPT
 /*
  * this is the entry point to schedule() from in-kernel preemption
@@ -4357,6 +4596,8 @@ void rt_mutex_setprio(struct task_struct *p, int prio)
 		p->sched_class = &rt_sched_class;
 	else
 		p->sched_class = &fair_sched_class;
+	/* autogroup: only fair tasks live outside the root group */
+	set_task_rq(p, task_cpu(p));
 
 	p->prio = prio;
 
@@ -4540,6 +4781,8 @@ __setscheduler(struct rq *rq, struct task_struct *p, int policy, int prio)
 		p->sched_class = &rt_sched_class;
 	else
 		p->sched_class = &fair_sched_class;
+	/* autogroup: only fair tasks live outside the root group */
+	set_task_rq(p, task_cpu(p));
 	set_load_weight(p);
 }
 
@@ -4651,10 +4894,12 @@ recheck:
 	if (user) {
 		/*
 		 * Do not allow realtime tasks into groups that have no runtime
-		 * assigned.
+		 * assigned.  An autogroup task leaves its group as it becomes
+		 * realtime, so the autogroup's own runtime does not matter.
 		 */
 		if (rt_bandwidth_enabled() && rt_policy(policy) &&
-				task_group(p)->rt_bandwidth.rt_runtime == 0) {
+				task_group(p)->rt_bandwidth.rt_runtime == 0 &&
+				!task_group_is_autogroup(task_group(p))) {
 			__task_rq_unlock(rq);
 			raw_spin_unlock_irqrestore(&p->pi_lock, flags);
 			return -EPERM;
@@ -5105,6 +5350,67 @@ void __sched yield(void)
 }
 EXPORT_SYMBOL(yield);
 
+/**
+ * yield_to - yield the current processor to another thread in
+ * your thread group, or accelerate that thread toward the
+ * processor it's on.
+ * @p: target task
+ * @preempt: whether task preemption is allowed or not
+ *
+ * It's the caller's job to ensure that the target task struct
+ * can't go away on us before we can do any checks.
+ *
+ * Returns true if we indeed boosted the target task.
+ */
+bool __sched yield_to(struct task_struct *p, bool preempt)
+{
+	struct task_struct *curr = current;
+	struct rq *rq, *p_rq;
+	unsigned long flags;
+	bool yielded = 0;
+
+	local_irq_save(flags);
+	rq = this_rq();
+
+again:
+	p_rq = task_rq(p);
+	double_rq_lock(rq, p_rq);
+	if (task_rq(p) != p_rq) {
+		double_rq_unlock(rq, p_rq);
+		goto again;
+	}
+
+	if (!curr->sched_class->yield_to_task)
+		goto out;
+
+	if (curr->sched_class != p->sched_class)
+		goto out;
+
+	if (task_running(p_rq, p) || p->state)
+		goto out;
+
+	yielded = curr->sched_class->yield_to_task(rq, p, preempt);
+	if (yielded) {
+		schedstat_inc(rq, yld_count);
+		/*
+		 * Make p's CPU reschedule; pick_next_entity takes care of
+		 * fairness.
+		 */
+		if (preempt && rq != p_rq)
+			resched_task(p_rq->curr);
+	}
+
+out:
+	double_rq_unlock(rq, p_rq);
+	local_irq_restore(flags);
+
+	if (yielded)
+		schedule();
+
+	return yielded;
+}
+EXPORT_SYMBOL_GPL(yield_to);
+
 /*
  * This task is about to go to sleep on IO. Increment rq->nr_iowait so
  * that process accounting knows that this is a task in IO wait state.
@@ -5392,7 +5698,6 @@ static void update_sysctl(void)
 	SET_SYSCTL(sched_min_granularity);
 	SET_SYSCTL(sched_latency);
 	SET_SYSCTL(sched_wakeup_granularity);
-	SET_SYSCTL(sched_shares_ratelimit);
 #undef SET_SYSCTL
 }
 
@@ -6298,6 +6603,28 @@ static struct root_domain *alloc_rootdomain(void)
 	return rd;
 }
 
+/*
+ * Cache the highest domain sharing the last level cache with the cpu,
+ * for select_idle_sibling() and the idle core hint.
+ */
+static void update_top_cache_domain(int cpu)
+{
+	struct sched_domain *sd, *llc = NULL;
+	int id = cpu;
+
+	for (sd = cpu_rq(cpu)->sd; sd; sd = sd->parent) {
+		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+			break;
+		llc = sd;
+	}
+
+	if (llc)
+		id = cpumask_first(sched_domain_span(llc));
+
+	rcu_assign_pointer(per_cpu(sd_llc, cpu), llc);
+	per_cpu(sd_llc_id, cpu) = id;
+}
+
 /*
  * Attach the domain 'sd' to 'cpu' as its base domain. Callers must
  * hold the hotplug lock.
@@ -6335,6 +6662,8 @@ cpu_attach_domain(struct sched_domain *sd, struct root_domain *rd, int cpu)
 
 	rq_attach_root(rq, rd);
 	rcu_assign_pointer(rq->sd, sd);
+
+	update_top_cache_domain(cpu);
 }
 
 /* cpus with isolated domains */
@@ -6827,6 +7156,7 @@ static noinline void sd_init_##type(struct sched_domain *sd)	\
 	memset(sd, 0, sizeof(*sd));				\
 	*sd = SD_##type##_INIT;					\
 	sd->level = SD_LV_##type;				\
+	sd->next_decay_max_lb_cost = jiffies;			\
 	SD_INIT_NAME(sd, type);					\
 }
 
@@ -7583,6 +7913,7 @@ static void init_cfs_rq(struct cfs_rq *cfs_rq, struct rq *rq)
 	cfs_rq->rq = rq;
 #endif
 	cfs_rq->min_vruntime = (u64)(-(1LL << 20));
+	init_cfs_rq_runtime(cfs_rq);
 }
 
 static void init_rt_rq(struct rt_rq *rt_rq, struct rq *rq)
@@ -7732,16 +8063,16 @@ void __init sched_init(void)
 			global_rt_period(), global_rt_runtime());
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	init_cfs_bandwidth(&init_task_group.cfs_bandwidth);
+#endif
+
 #ifdef CONFIG_CGROUP_SCHED
 	list_add(&init_task_group.list, &task_groups);
 	INIT_LIST_HEAD(&init_task_group.children);
-
+	autogroup_init(&init_task);
 #endif /* CONFIG_CGROUP_SCHED */
 
-#if defined CONFIG_FAIR_GROUP_SCHED && defined CONFIG_SMP
-	update_shares_data = __alloc_percpu(nr_cpu_ids * sizeof(unsigned long),
-					    __alignof__(unsigned long));
-#endif
 	for_each_possible_cpu(i) {
 		struct rq *rq;
 
@@ -7804,6 +8135,7 @@ void __init sched_init(void)
 		rq->online = 0;
 		rq->idle_stamp = 0;
 		rq->avg_idle = 2*sysctl_sched_migration_cost;
+		rq->max_idle_balance_cost = sysctl_sched_migration_cost;
 		rq_attach_root(rq, &def_root_domain);
 #ifdef CONFIG_NO_HZ
 		rq->nohz_balance_kick = 0;
@@ -8018,6 +8350,8 @@ static void free_fair_sched_group(struct task_group *tg)
 {
 	int i;
 
+	destroy_cfs_bandwidth(&tg->cfs_bandwidth);
+
 	for_each_possible_cpu(i) {
 		if (tg->cfs_rq)
 			kfree(tg->cfs_rq[i]);
@@ -8046,6 +8380,8 @@ int alloc_fair_sched_group(struct task_group *tg, struct task_group *parent)
 
 	tg->shares = NICE_0_LOAD;
 
+	init_cfs_bandwidth(&tg->cfs_bandwidth);
+
 	for_each_possible_cpu(i) {
 		rq = cpu_rq(i);
 
@@ -8195,6 +8531,7 @@ static void free_sched_group(struct task_group *tg)
 {
 	free_fair_sched_group(tg);
 	free_rt_sched_group(tg);
+	autogroup_free(tg);
 	kfree(tg);
 }
 
@@ -8300,33 +8637,6 @@ void sched_move_task(struct task_struct *tsk)
 #endif /* CONFIG_CGROUP_SCHED */
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
-static void __set_se_shares(struct sched_entity *se, unsigned long shares)
-{
-	struct cfs_rq *cfs_rq = se->cfs_rq;
-	int on_rq;
-
-	on_rq = se->on_rq;
-	if (on_rq)
-		dequeue_entity(cfs_rq, se, 0);
-
-	se->load.weight = shares;
-	se->load.inv_weight = 0;
-
-	if (on_rq)
-		enqueue_entity(cfs_rq, se, 0);
-}
-
-static void set_se_shares(struct sched_entity *se, unsigned long shares)
-{
-	struct cfs_rq *cfs_rq = se->cfs_rq;
-	struct rq *rq = cfs_rq->rq;
-	unsigned long flags;
-
-	raw_spin_lock_irqsave(&rq->lock, flags);
-	__set_se_shares(se, shares);
-	raw_spin_unlock_irqrestore(&rq->lock, flags);
-}
-
 static DEFINE_MUTEX(shares_mutex);
 
 int sched_group_set_shares(struct task_group *tg, unsigned long shares)
@@ -8349,37 +8659,19 @@ int sched_group_set_shares(struct task_group *tg, unsigned long shares)
 	if (tg->shares == shares)
 		goto done;
 
-	spin_lock_irqsave(&task_group_lock, flags);
-	for_each_possible_cpu(i)
-		unregister_fair_sched_group(tg, i);
-	list_del_rcu(&tg->siblings);
-	spin_unlock_irqrestore(&task_group_lock, flags);
-
-	/* wait for any ongoing reference to this group to finish */
-	synchronize_sched();
-
-	/*
-	 * Now we are free to modify the group's share on each cpu
-	 * w/o tripping rebalance_share or load_balance_fair.
-	 */
 	tg->shares = shares;
 	for_each_possible_cpu(i) {
-		/*
-		 * force a rebalance
-		 */
-		cfs_rq_set_shares(tg->cfs_rq[i], 0);
-		set_se_shares(tg->se[i], shares);
+		struct rq *rq = cpu_rq(i);
+		struct sched_entity *se;
+
+		se = tg->se[i];
+		/* Propagate contribution to hierarchy */
+		raw_spin_lock_irqsave(&rq->lock, flags);
+		for_each_sched_entity(se)
+			update_cfs_shares(group_cfs_rq(se));
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
 	}
 
-	/*
-	 * Enable load balance activity on this group, by inserting it back on
-	 * each cpu's rq->leaf_cfs_rq_list.
-	 */
-	spin_lock_irqsave(&task_group_lock, flags);
-	for_each_possible_cpu(i)
-		register_fair_sched_group(tg, i);
-	list_add_rcu(&tg->siblings, &tg->parent->children);
-	spin_unlock_irqrestore(&task_group_lock, flags);
 done:
 	mutex_unlock(&shares_mutex);
 	return 0;
@@ -8391,6 +8683,100 @@ unsigned long sched_group_shares(struct task_group *tg)
 }
 #endif
 
+#ifdef CONFIG_CFS_BANDWIDTH
+static DEFINE_MUTEX(cfs_constraints_mutex);
+
+static const u64 max_cfs_quota_period = 1 * NSEC_PER_SEC; /* 1s */
+static const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
+
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+{
+	struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
+	int i, runtime_enabled = quota != RUNTIME_INF;
+
+	/* The root group always runs unconstrained */
+	if (tg == &root_task_group)
+		return -EINVAL;
+
+	/*
+	 * Too short a period or quota costs more in timer interrupts and
+	 * pool refills than it is worth, too long a period makes the
+	 * throttled stretches noticeable.
+	 */
+	if (period < min_cfs_quota_period || period > max_cfs_quota_period)
+		return -EINVAL;
+	if (runtime_enabled && quota < min_cfs_quota_period)
+		return -EINVAL;
+
+	mutex_lock(&cfs_constraints_mutex);
+	raw_spin_lock_irq(&cfs_b->lock);
+	cfs_b->period = ns_to_ktime(period);
+	cfs_b->quota = quota;
+	cfs_b->runtime = quota;
+	cfs_b->period_gen++;
+	raw_spin_unlock_irq(&cfs_b->lock);
+
+	for_each_possible_cpu(i) {
+		struct cfs_rq *cfs_rq = tg->cfs_rq[i];
+		struct rq *rq = rq_of(cfs_rq);
+
+		raw_spin_lock_irq(&rq->lock);
+		cfs_rq->runtime_enabled = runtime_enabled;
+		cfs_rq->runtime_remaining = 0;
+		if (cfs_rq_throttled(cfs_rq))
+			unthrottle_cfs_rq(cfs_rq);
+		raw_spin_unlock_irq(&rq->lock);
+	}
+	mutex_unlock(&cfs_constraints_mutex);
+
+	return 0;
+}
+
+static int tg_set_cfs_quota(struct task_group *tg, s64 cfs_quota_us)
+{
+	u64 quota, period;
+
+	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	if (cfs_quota_us < 0)
+		quota = RUNTIME_INF;
+	else if (cfs_quota_us > div_u64(max_cfs_quota_period, NSEC_PER_USEC) *
+				num_possible_cpus())
+		return -EINVAL;
+	else
+		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
+
+	return tg_set_cfs_bandwidth(tg, period, quota);
+}
+
+static s64 tg_get_cfs_quota(struct task_group *tg)
+{
+	u64 quota_us = tg->cfs_bandwidth.quota;
+
+	if (quota_us == RUNTIME_INF)
+		return -1;
+
+	do_div(quota_us, NSEC_PER_USEC);
+	return quota_us;
+}
+
+static int tg_set_cfs_period(struct task_group *tg, u64 cfs_period_us)
+{
+	if (cfs_period_us > div_u64(max_cfs_quota_period, NSEC_PER_USEC))
+		return -EINVAL;
+
+	return tg_set_cfs_bandwidth(tg, cfs_period_us * NSEC_PER_USEC,
+				    tg->cfs_bandwidth.quota);
+}
+
+static u64 tg_get_cfs_period(struct task_group *tg)
+{
+	u64 cfs_period_us = ktime_to_ns(tg->cfs_bandwidth.period);
+
+	do_div(cfs_period_us, NSEC_PER_USEC);
+	return cfs_period_us;
+}
+#endif /* CONFIG_CFS_BANDWIDTH */
+
 #ifdef CONFIG_RT_GROUP_SCHED
 /*
  * Ensure that the real time constraints are schedulable.
@@ -8764,6 +9150,42 @@ static u64 cpu_shares_read_u64(struct cgroup *cgrp, struct cftype *cft)
 }
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
+#ifdef CONFIG_CFS_BANDWIDTH
+static s64 cpu_cfs_quota_read_s64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_quota(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_quota_write_s64(struct cgroup *cgrp, struct cftype *cftype,
+				   s64 cfs_quota_us)
+{
+	return tg_set_cfs_quota(cgroup_tg(cgrp), cfs_quota_us);
+}
+
+static u64 cpu_cfs_period_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_period(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_period_write_u64(struct cgroup *cgrp, struct cftype *cftype,
+				    u64 cfs_period_us)
+{
+	return tg_set_cfs_period(cgroup_tg(cgrp), cfs_period_us);
+}
+
+static int cpu_stats_show(struct cgroup *cgrp, struct cftype *cft,
+			  struct cgroup_map_cb *cb)
+{
+	struct cfs_bandwidth *cfs_b = &cgroup_tg(cgrp)->cfs_bandwidth;
+
+	cb->fill(cb, "nr_periods", cfs_b->nr_periods);
+	cb->fill(cb, "nr_throttled", cfs_b->nr_throttled);
+	cb->fill(cb, "throttled_time", cfs_b->throttled_time);
+
+	return 0;
+}
+#endif /* CONFIG_CFS_BANDWIDTH */
+
 #ifdef CONFIG_RT_GROUP_SCHED
 static int cpu_rt_runtime_write(struct cgroup *cgrp, struct cftype *cft,
 				s64 val)
@@ -8796,6 +9218,22 @@ static struct cftype cpu_files[] = {
 		.write_u64 = cpu_shares_write_u64,
 	},
 #endif
+#ifdef CONFIG_CFS_BANDWIDTH
+	{
+		.name = "cfs_quota_us",
+		.read_s64 = cpu_cfs_quota_read_s64,
+		.write_s64 = cpu_cfs_quota_write_s64,
+	},
+	{
+		.name = "cfs_period_us",
+		.read_u64 = cpu_cfs_period_read_u64,
+		.write_u64 = cpu_cfs_period_write_u64,
+	},
+	{
+		.name = "stat",
+		.read_map = cpu_stats_show,
+	},
+#endif
 #ifdef CONFIG_RT_GROUP_SCHED
 	{
 		.name = "rt_runtime_us",
@@ -9107,70 +9545,11 @@ struct cgroup_subsys cpuacct_subsys = {
 
 #ifndef CONFIG_SMP
 
+/* The SMP version lives with the rest of RCU, in kernel/rcutree.c. */
 void synchronize_sched_expedited(void)
 {
 	barrier();
 }
 EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
 
-#else /* #ifndef CONFIG_SMP */
-
-static atomic_t synchronize_sched_expedited_count = ATOMIC_INIT(0);
-
-static int synchronize_sched_expedited_cpu_stop(void *data)
-{
-	/*
-	 * There must be a full memory barrier on each affected CPU
-	 * between the time that try_stop_cpus() is called and the
-	 * time that it returns.
-	 *
-	 * In the current initial implementation of cpu_stop, the
-	 * above condition is already met when the control reaches
-	 * this point and the following smp_mb() is not strictly
-	 * necessary.  Do smp_mb() anyway for documentation and
-	 * robustness against future implementation changes.
-	 */
-	smp_mb(); /* See above comment block. */
-	return 0;
-}
-
-/*
- * Wait for an rcu-sched grace period to elapse, but use "big hammer"
- * approach to force grace period to end quickly.  This consumes
- * significant time on all CPUs, and is thus not recommended for
- * any sort of common-case code.
- *
- * Note that it is illegal to call this function while holding any
- * lock that is acquired by a CPU-hotplug notifier.  Failing to
- * observe this restriction will result in deadlock.
- */
-void synchronize_sched_expedited(void)
-{
-	int snap, trycount = 0;
-
-	smp_mb();  /* ensure prior mod happens before capturing snap. */
-	snap = atomic_read(&synchronize_sched_expedited_count) + 1;
-	get_online_cpus();
-	while (try_stop_cpus(cpu_online_mask,
-			     synchronize_sched_expedited_cpu_stop,
-			     NULL) == -EAGAIN) {
-		put_online_cpus();
-		if (trycount++ < 10)
-			udelay(trycount * num_online_cpus());
-		else {
-			synchronize_sched();
-			return;
-		}
-		if (atomic_read(&synchronize_sched_expedited_count) - snap > 0) {
-			smp_mb(); /* ensure test happens before caller kfree */
-			return;
-		}
-		get_online_cpus();
-	}
-	atomic_inc(&synchronize_sched_expedited_count);
-	smp_mb__after_atomic_inc(); /* ensure post-GP actions seen after GP. */
-	put_online_cpus();
-}
-EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
-
-#endif /* #else #ifndef CONFIG_SMP */
+#endif /* #ifndef CONFIG_SMP */
@@ -178,21 +178,27 @@ void local_bh_enable_ip(unsigned long ip)
 EXPORT_SYMBOL(local_bh_enable_ip);
 
 /*
- * We restart softirq processing MAX_SOFTIRQ_RESTART times,
- * and we fall back to softirqd after that.
+ * We restart softirq processing for at most softirq_budget_us
+ * (kernel.softirq_budget_us), and not after MAX_SOFTIRQ_RESTART
+ * rounds or once a task needs the cpu, and we fall back to softirqd
+ * after that.
  *
- * This number has been established via experimentation.
  * The two things to balance is latency against fairness -
  * we want to handle softirqs as soon as possible, but they
- * should not be able to lock up the box.
+ * should not be able to lock up the box.  A count of rounds
+ * bounds neither: a round of network rx can take from microseconds
+ * to milliseconds.
  */
 #define MAX_SOFTIRQ_RESTART 10
 
+int softirq_budget_us __read_mostly = 2000;
+
 asmlinkage void __do_softirq(void)
 {
 	struct softirq_action *h;
 	__u32 pending;
 	int max_restart = MAX_SOFTIRQ_RESTART;
+	u64 start, now, budget;
 	int cpu;
 
 	pending = local_softirq_pending();
@@ -202,6 +208,8 @@ asmlinkage void __do_softirq(void)
 	lockdep_softirq_enter();
 
 	cpu = smp_processor_id();
+	budget = (u64)softirq_budget_us * NSEC_PER_USEC;
+	start = now = sched_clock();
 restart:
 	/* Reset the pending bitmask before enabling irqs */
 	set_softirq_pending(0);
@@ -213,11 +221,16 @@ restart:
 	do {
 		if (pending & 1) {
 			int prev_count = preempt_count();
+			u64 then = now;
+
 			kstat_incr_softirqs_this_cpu(h - softirq_vec);
 
 			trace_softirq_entry(h, softirq_vec);
 			h->action(h);
 			trace_softirq_exit(h, softirq_vec);
+			now = sched_clock();
+			kstat_add_softirq_time_this_cpu(h - softirq_vec,
+							now - then);
 			if (unlikely(prev_count != preempt_count())) {
 				printk(KERN_ERR "huh, entered softirq %td %s %p"
 				       "with preempt_count %08x,"
@@ -236,11 +249,12 @@ restart:
 	local_irq_disable();
 
 	pending = local_softirq_pending();
-	if (pending && --max_restart)
-		goto restart;
+	if (pending) {
+		if (now - start < budget && !need_resched() && --max_restart)
+			goto restart;
 
-	if (pending)
 		wakeup_softirqd();
+	}
 
 	lockdep_softirq_exit();
 
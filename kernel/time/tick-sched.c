@@ -24,6 +24,8 @@
 
 #include <asm/irq_regs.h>
 
+#include <trace/events/timer.h>
+
 #include "tick-internal.h"
 
 /*
@@ -248,6 +250,33 @@ u64 get_cpu_iowait_time_us(int cpu, u64 *last_update_time)
 }
 EXPORT_SYMBOL_GPL(get_cpu_iowait_time_us);
 
+#ifdef CONFIG_SMP
+/*
+ * Tasks which went to sleep on this cpu with a timeout left the timer
+ * here.  Hand those with slack to a busy cpu, which is awake anyway,
+ * instead of letting each of them take this cpu out of idle.
+ */
+static void tick_nohz_coalesce_timers(int cpu)
+{
+	int target, nr_timers, nr_hrtimers, saved = 0;
+
+	if (!get_sysctl_timer_migration())
+		return;
+
+	target = get_nohz_timer_target();
+	if (target == cpu)
+		return;
+
+	nr_timers = timer_coalesce_idle(target, &saved);
+	nr_hrtimers = hrtimer_coalesce_idle(target, &saved);
+	if (nr_timers || nr_hrtimers)
+		trace_timer_coalesce(cpu, target, nr_timers, nr_hrtimers,
+				     saved);
+}
+#else
+static inline void tick_nohz_coalesce_timers(int cpu) { }
+#endif
+
 /**
  * tick_nohz_stop_sched_tick - stop the idle tick from the idle task
  *
@@ -315,6 +344,9 @@ void tick_nohz_stop_sched_tick(int inidle)
 		goto end;
 	}
 
+	if (inidle && cpu_online(cpu))
+		tick_nohz_coalesce_timers(cpu);
+
 	ts->idle_calls++;
 	/* Read jiffies and the time when jiffies were updated last */
 	do {
@@ -340,6 +372,13 @@ void tick_nohz_stop_sched_tick(int inidle)
 	if (!ts->tick_stopped && delta_jiffies == 1)
 		goto out;
 
+	/*
+	 * nohz_full cpus never take the do_timer() duty, so whoever has
+	 * it must keep it, and its tick, to keep jiffies going for them.
+	 */
+	if (tick_nohz_full_enabled() && cpu == tick_do_timer_cpu)
+		goto out;
+
 	/* Schedule the tick, if we are at least one jiffie off */
 	if ((long)delta_jiffies >= 1) {
 
@@ -553,6 +592,126 @@ void tick_nohz_restart_sched_tick(void)
 	local_irq_enable();
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+cpumask_var_t tick_nohz_full_mask;
+bool tick_nohz_full_running;
+
+/*
+ * nohz_full=<cpu-list>: cpus which may stop their tick while they run
+ * a single task. The boot cpu is kept out, for timekeeping.
+ */
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu = smp_processor_id();
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		printk(KERN_WARNING "NOHZ: Incorrect nohz_full cpumask\n");
+		cpumask_clear(tick_nohz_full_mask);
+		return 1;
+	}
+
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		printk(KERN_WARNING "NOHZ: Clearing %d from nohz_full range "
+		       "for timekeeping\n", cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+	tick_nohz_full_running = !cpumask_empty(tick_nohz_full_mask);
+
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+bool tick_nohz_full_stopped(int cpu)
+{
+	return per_cpu(tick_cpu_sched, cpu).full_stopped;
+}
+
+/* The cpu timers of a task are sampled from the tick */
+static bool tick_nohz_full_cpu_timers(struct task_struct *p)
+{
+	if (!cputime_eq(p->cputime_expires.utime, cputime_zero) ||
+	    !cputime_eq(p->cputime_expires.stime, cputime_zero) ||
+	    p->cputime_expires.sum_exec_runtime)
+		return true;
+
+	return p->signal->cputimer.running;
+}
+
+/*
+ * Called from the tick on a nohz_full cpu. When it runs a single task
+ * and nothing else wants the tick, push the next one out to the next
+ * timer wheel event, but no further than a second: the residual tick
+ * keeps the scheduler statistics and RCU going. Returns 1 when the
+ * tick timer has been moved.
+ */
+static int tick_nohz_full_stop_tick(struct tick_sched *ts)
+{
+	unsigned long seq, last_jiffies, delta_jiffies;
+	int cpu = smp_processor_id();
+	ktime_t last_update;
+
+	if (!tick_nohz_full_cpu(cpu) || cpu == tick_do_timer_cpu)
+		goto keep;
+
+	if (!sched_can_stop_tick() || tick_nohz_full_cpu_timers(current))
+		goto keep;
+
+	if (rcu_needs_cpu(cpu) || printk_needs_cpu(cpu) ||
+	    arch_needs_cpu(cpu))
+		goto keep;
+
+	do {
+		seq = read_seqbegin(&xtime_lock);
+		last_update = last_jiffies_update;
+		last_jiffies = jiffies;
+	} while (read_seqretry(&xtime_lock, seq));
+
+	delta_jiffies = get_next_timer_interrupt(last_jiffies) - last_jiffies;
+	if ((long)delta_jiffies <= 1)
+		goto keep;
+	if (delta_jiffies > HZ)
+		delta_jiffies = HZ;
+
+	if (!ts->full_stopped) {
+		/* where tick_nohz_full_check() resumes the tick from */
+		ts->idle_tick = hrtimer_get_expires(&ts->sched_timer);
+		ts->full_stopped = 1;
+	}
+	hrtimer_set_expires(&ts->sched_timer,
+			    ktime_add_ns(last_update,
+					 tick_period.tv64 * delta_jiffies));
+	return 1;
+
+keep:
+	ts->full_stopped = 0;
+	return 0;
+}
+
+/**
+ * tick_nohz_full_check - restart a tick pushed out by nohz_full
+ *
+ * Called from schedule(): whatever made us schedule, a new task, a
+ * timer or RCU, may need the tick, so take it back. The next tick
+ * stops it again if it can.
+ */
+void tick_nohz_full_check(void)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+	unsigned long flags;
+
+	if (likely(!ts->full_stopped))
+		return;
+
+	local_irq_save(flags);
+	if (ts->full_stopped) {
+		ts->full_stopped = 0;
+		tick_nohz_restart(ts, ktime_get());
+	}
+	local_irq_restore(flags);
+}
+#endif /* CONFIG_NO_HZ_FULL */
+
 static int tick_nohz_reprogram(struct tick_sched *ts, ktime_t now)
 {
 	hrtimer_forward(&ts->sched_timer, now, tick_period);
@@ -578,7 +737,8 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
@@ -733,7 +893,8 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -760,6 +921,11 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 		}
 		update_process_times(user_mode(regs));
 		profile_tick(CPU_PROFILING);
+
+#ifdef CONFIG_NO_HZ_FULL
+		if (tick_nohz_full_stop_tick(ts))
+			return HRTIMER_RESTART;
+#endif
 	}
 
 	hrtimer_forward(timer, now, tick_period);
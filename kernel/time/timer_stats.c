@@ -31,6 +31,9 @@
  * Display the information collected so far:
  * # cat /proc/timer_stats
  *
+ * Besides the expiry events, the timer_list setup sites get how often
+ * their timers were armed and cancelled (or re-armed) before expiring.
+ *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
  * published by the Free Software Foundation.
@@ -70,6 +73,13 @@ struct entry {
 	unsigned long		count;
 	unsigned int		timer_flag;
 
+	/*
+	 * Setup site entries (TIMER_STATS_FLAG_SITE, no timer nor pid)
+	 * also count arm and cancel events:
+	 */
+	unsigned long		armed;
+	unsigned long		cancelled;
+
 	/*
 	 * We save the command-line string to preserve
 	 * this information past task exit:
@@ -204,6 +214,8 @@ static struct entry *tstat_lookup(struct entry *entry, char *comm)
 	if (curr) {
 		*curr = *entry;
 		curr->count = 0;
+		curr->armed = 0;
+		curr->cancelled = 0;
 		curr->next = NULL;
 		memcpy(curr->comm, comm, TASK_COMM_LEN);
 
@@ -267,6 +279,55 @@ void timer_stats_update_stats(void *timer, pid_t pid, void *startf,
 	raw_spin_unlock_irqrestore(lock, flags);
 }
 
+/**
+ * timer_stats_update_site - Update the statistics of a timer setup site.
+ * @startf:	pointer to the function which did the timer setup
+ * @timerf:	pointer to the timer callback function of the timer
+ * @event:	TIMER_STATS_SITE_ARM, _CANCEL or _EXPIRE
+ */
+void timer_stats_update_site(void *startf, void *timerf, int event)
+{
+	raw_spinlock_t *lock;
+	struct entry *entry, input;
+	unsigned long flags;
+
+	if (likely(!timer_stats_active))
+		return;
+
+	lock = &per_cpu(tstats_lookup_lock, raw_smp_processor_id());
+
+	input.timer = NULL;
+	input.start_func = startf;
+	input.expire_func = timerf;
+	input.pid = 0;
+	input.timer_flag = TIMER_STATS_FLAG_SITE;
+
+	raw_spin_lock_irqsave(lock, flags);
+	if (!timer_stats_active)
+		goto out_unlock;
+
+	entry = tstat_lookup(&input, "");
+	if (unlikely(!entry)) {
+		atomic_inc(&overflow_count);
+		goto out_unlock;
+	}
+
+	switch (event) {
+	case TIMER_STATS_SITE_ARM:
+		entry->armed++;
+		break;
+	case TIMER_STATS_SITE_CANCEL:
+		entry->cancelled++;
+		break;
+	case TIMER_STATS_SITE_EXPIRE:
+		entry->count++;
+		break;
+	}
+
+ out_unlock:
+	raw_spin_unlock_irqrestore(lock, flags);
+}
+
 static void print_name_offset(struct seq_file *m, unsigned long addr)
 {
 	char symname[KSYM_NAME_LEN];
@@ -306,6 +367,8 @@ static int tstats_show(struct seq_file *m, void *v)
 
 	for (i = 0; i < nr_entries; i++) {
 		entry = entries + i;
+		if (entry->timer_flag & TIMER_STATS_FLAG_SITE)
+			continue;
  		if (entry->timer_flag & TIMER_STATS_FLAG_DEFERRABLE) {
 			seq_printf(m, "%4luD, %5d %-16s ",
 				entry->count, entry->pid, entry->comm);
@@ -333,6 +396,22 @@ static int tstats_show(struct seq_file *m, void *v)
 	else
 		seq_printf(m, "%ld total events\n", events);
 
+	seq_puts(m, "Per callsite: armed, cancelled, expired\n");
+	for (i = 0; i < nr_entries; i++) {
+		entry = entries + i;
+		if (!(entry->timer_flag & TIMER_STATS_FLAG_SITE))
+			continue;
+
+		seq_printf(m, " %8lu, %8lu (%3lu%%), %8lu ", entry->armed,
+			   entry->cancelled, entry->armed ?
+			   entry->cancelled * 100 / entry->armed : 0,
+			   entry->count);
+		print_name_offset(m, (unsigned long)entry->start_func);
+		seq_puts(m, " (");
+		print_name_offset(m, (unsigned long)entry->expire_func);
+		seq_puts(m, ")\n");
+	}
+
 	mutex_unlock(&show_mutex);
 
 	return 0;
@@ -38,6 +38,7 @@
 #include <linux/tick.h>
 #include <linux/kallsyms.h>
 #include <linux/perf_event.h>
+#include <linux/mempolicy.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 
@@ -72,6 +73,32 @@ struct tvec_root {
 	struct list_head vec[TVR_SIZE];
 };
 
+/*
+ * Coarse, non-cascading wheel, for timeouts which are nearly always
+ * cancelled or re-armed before they expire (see init_timer_coarse()).
+ * It has TVC_DEPTH levels of TVC_SIZE buckets, level n holding timers
+ * with a granularity of 2^(n * TVC_CLK_SHIFT) jiffies.  A timer is put
+ * once in the level whose range covers its timeout, its expiry rounded
+ * up to the level's granularity, and runs straight from that bucket: it
+ * is never moved again, at the price of running up to 1/2^TVC_CLK_SHIFT
+ * of its timeout late.  Timeouts beyond the last level go to the
+ * cascading wheel.
+ */
+#define TVC_BITS TVN_BITS
+#define TVC_SIZE (1 << TVC_BITS)
+#define TVC_MASK (TVC_SIZE - 1)
+#define TVC_CLK_SHIFT 3
+#define TVC_CLK_MASK ((1UL << TVC_CLK_SHIFT) - 1)
+#define TVC_DEPTH 8
+#define TVC_SHIFT(n) ((n) * TVC_CLK_SHIFT)
+#define TVC_GRAN(n) (1UL << TVC_SHIFT(n))
+/* The shortest timeout which goes to level n, n > 0 */
+#define TVC_START(n) ((TVC_SIZE - 1UL) << TVC_SHIFT((n) - 1))
+
+struct tvec_coarse {
+	struct list_head vec[TVC_DEPTH * TVC_SIZE];
+};
+
 struct tvec_base {
 	spinlock_t lock;
 	struct timer_list *running_timer;
@@ -82,6 +109,7 @@ struct tvec_base {
 	struct tvec tv3;
 	struct tvec tv4;
 	struct tvec tv5;
+	struct tvec_coarse tvc;
 } ____cacheline_aligned;
 
 struct tvec_base boot_tvec_bases;
@@ -89,9 +117,10 @@ EXPORT_SYMBOL(boot_tvec_bases);
 static DEFINE_PER_CPU(struct tvec_base *, tvec_bases) = &boot_tvec_bases;
 
 /*
- * Note that all tvec_bases are 2 byte aligned and lower bit of
- * base in timer_list is guaranteed to be zero. Use the LSB to
- * indicate whether the timer is deferrable.
+ * Note that all tvec_bases are 4 byte aligned and the lower two bits of
+ * base in timer_list are guaranteed to be zero. Use the LSB to
+ * indicate whether the timer is deferrable, the next one whether it
+ * goes to the coarse wheel.
  *
  * A deferrable timer will work normally when the system is busy, but
  * will not cause a CPU to come out of idle just to service it; instead,
@@ -99,16 +128,23 @@ static DEFINE_PER_CPU(struct tvec_base *, tvec_bases) = &boot_tvec_bases;
  * subsequent non-deferrable timer.
  */
 #define TBASE_DEFERRABLE_FLAG		(0x1)
+#define TBASE_COARSE_FLAG		(0x2)
+#define TBASE_FLAG_MASK			(TBASE_DEFERRABLE_FLAG | TBASE_COARSE_FLAG)
 
-/* Functions below help us manage 'deferrable' flag */
+/* Functions below help us manage 'deferrable' and 'coarse' flags */
 static inline unsigned int tbase_get_deferrable(struct tvec_base *base)
 {
 	return ((unsigned int)(unsigned long)base & TBASE_DEFERRABLE_FLAG);
 }
 
+static inline unsigned int tbase_get_coarse(struct tvec_base *base)
+{
+	return ((unsigned int)(unsigned long)base & TBASE_COARSE_FLAG);
+}
+
 static inline struct tvec_base *tbase_get_base(struct tvec_base *base)
 {
-	return ((struct tvec_base *)((unsigned long)base & ~TBASE_DEFERRABLE_FLAG));
+	return ((struct tvec_base *)((unsigned long)base & ~TBASE_FLAG_MASK));
 }
 
 static inline void timer_set_deferrable(struct timer_list *timer)
@@ -117,11 +153,17 @@ static inline void timer_set_deferrable(struct timer_list *timer)
 				       TBASE_DEFERRABLE_FLAG));
 }
 
+static inline void timer_set_coarse(struct timer_list *timer)
+{
+	timer->base = ((struct tvec_base *)((unsigned long)(timer->base) |
+				       TBASE_COARSE_FLAG));
+}
+
 static inline void
 timer_set_base(struct timer_list *timer, struct tvec_base *new_base)
 {
 	timer->base = (struct tvec_base *)((unsigned long)(new_base) |
-				      tbase_get_deferrable(timer->base));
+			((unsigned long)(timer->base) & TBASE_FLAG_MASK));
 }
 
 static unsigned long round_jiffies_common(unsigned long j, int cpu,
@@ -352,12 +394,45 @@ static inline void set_running_timer(struct tvec_base *base,
 #endif
 }
 
+/*
+ * Queue a coarse timer, returning 0 if its timeout is beyond the range
+ * of the coarse wheel.
+ */
+static int internal_add_coarse_timer(struct tvec_base *base,
+				     struct timer_list *timer)
+{
+	unsigned long expires = timer->expires;
+	unsigned long delta = expires - base->timer_jiffies;
+	int lvl;
+
+	if ((long)delta < 0) {
+		/* In the past: run with the next jiffy to be processed */
+		expires = base->timer_jiffies;
+		lvl = 0;
+	} else {
+		for (lvl = 0; lvl < TVC_DEPTH; lvl++)
+			if (delta < TVC_START(lvl + 1))
+				break;
+		if (lvl == TVC_DEPTH)
+			return 0;
+	}
+
+	expires = (expires + TVC_GRAN(lvl) - 1) >> TVC_SHIFT(lvl);
+	list_add_tail(&timer->entry,
+		      base->tvc.vec + lvl * TVC_SIZE + (expires & TVC_MASK));
+	return 1;
+}
+
 static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
 {
 	unsigned long expires = timer->expires;
 	unsigned long idx = expires - base->timer_jiffies;
 	struct list_head *vec;
 
+	if (tbase_get_coarse(timer->base) &&
+	    internal_add_coarse_timer(base, timer))
+		return;
+
 	if (idx < TVR_SIZE) {
 		int i = expires & TVR_MASK;
 		vec = base->tv1.vec + i;
@@ -416,10 +491,21 @@ static void timer_stats_account_timer(struct timer_list *timer)
 
 	timer_stats_update_stats(timer, timer->start_pid, timer->start_site,
 				 timer->function, timer->start_comm, flag);
+	timer_stats_update_site(timer->start_site, timer->function,
+				TIMER_STATS_SITE_EXPIRE);
+}
+
+static void timer_stats_account_site(struct timer_list *timer, int event)
+{
+	if (likely(!timer->start_site))
+		return;
+
+	timer_stats_update_site(timer->start_site, timer->function, event);
 }
 
 #else
 static void timer_stats_account_timer(struct timer_list *timer) {}
+static void timer_stats_account_site(struct timer_list *timer, int event) {}
 #endif
 
 #ifdef CONFIG_DEBUG_OBJECTS_TIMERS
@@ -624,6 +710,26 @@ void init_timer_deferrable_key(struct timer_list *timer,
 }
 EXPORT_SYMBOL(init_timer_deferrable_key);
 
+/**
+ * init_timer_coarse_key - initialize a timer for the coarse wheel
+ * @timer: the timer to be initialized
+ * @name: name of the timer
+ * @key: lockdep class key of the fake lock used for tracking timer
+ *       sync lock dependencies
+ *
+ * Like init_timer_key(), for a timeout which is nearly always cancelled
+ * or re-armed before it expires: the timer never cascades, but may run
+ * up to an eighth of its timeout late.
+ */
+void init_timer_coarse_key(struct timer_list *timer,
+			   const char *name,
+			   struct lock_class_key *key)
+{
+	init_timer_key(timer, name, key);
+	timer_set_coarse(timer);
+}
+EXPORT_SYMBOL(init_timer_coarse_key);
+
 static inline void detach_timer(struct timer_list *timer,
 				int clear_pending)
 {
@@ -683,6 +789,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 	base = lock_timer_base(timer, &flags);
 
 	if (timer_pending(timer)) {
+		timer_stats_account_site(timer, TIMER_STATS_SITE_CANCEL);
 		detach_timer(timer, 0);
 		if (timer->expires == base->next_timer &&
 		    !tbase_get_deferrable(timer->base))
@@ -692,6 +799,7 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 		if (pending_only)
 			goto out_unlock;
 	}
+	timer_stats_account_site(timer, TIMER_STATS_SITE_ARM);
 
 	debug_activate(timer, expires);
 
@@ -727,6 +835,10 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 		base->next_timer = timer->expires;
 	internal_add_timer(base, timer);
 
+	/* a cpu which pushed its tick out must see the new timer */
+	if (base == new_base && !tbase_get_deferrable(timer->base))
+		tick_nohz_full_kick_cpu(cpu);
+
 out_unlock:
 	spin_unlock_irqrestore(&base->lock, flags);
 
@@ -898,6 +1010,7 @@ void add_timer_on(struct timer_list *timer, int cpu)
 	 * the timer wheel.
 	 */
 	wake_up_idle_cpu(cpu);
+	tick_nohz_full_kick_cpu(cpu);
 	spin_unlock_irqrestore(&base->lock, flags);
 }
 EXPORT_SYMBOL_GPL(add_timer_on);
@@ -919,10 +1032,10 @@ int del_timer(struct timer_list *timer)
 	unsigned long flags;
 	int ret = 0;
 
-	timer_stats_timer_clear_start_info(timer);
 	if (timer_pending(timer)) {
 		base = lock_timer_base(timer, &flags);
 		if (timer_pending(timer)) {
+			timer_stats_account_site(timer, TIMER_STATS_SITE_CANCEL);
 			detach_timer(timer, 1);
 			if (timer->expires == base->next_timer &&
 			    !tbase_get_deferrable(timer->base))
@@ -931,6 +1044,7 @@ int del_timer(struct timer_list *timer)
 		}
 		spin_unlock_irqrestore(&base->lock, flags);
 	}
+	timer_stats_timer_clear_start_info(timer);
 
 	return ret;
 }
@@ -957,15 +1071,16 @@ int try_to_del_timer_sync(struct timer_list *timer)
 	if (base->running_timer == timer)
 		goto out;
 
-	timer_stats_timer_clear_start_info(timer);
 	ret = 0;
 	if (timer_pending(timer)) {
+		timer_stats_account_site(timer, TIMER_STATS_SITE_CANCEL);
 		detach_timer(timer, 1);
 		if (timer->expires == base->next_timer &&
 		    !tbase_get_deferrable(timer->base))
 			base->next_timer = base->timer_jiffies;
 		ret = 1;
 	}
+	timer_stats_timer_clear_start_info(timer);
 out:
 	spin_unlock_irqrestore(&base->lock, flags);
 
@@ -1074,6 +1189,25 @@ static void call_timer_fn(struct timer_list *timer, void (*fn)(unsigned long),
 
 #define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
 
+/*
+ * Move the coarse wheel buckets due at jiffy @clk to @head: the level 0
+ * one, and each coarser level's for which @clk is a multiple of its
+ * granularity.
+ */
+static void coarse_collect(struct tvec_base *base, unsigned long clk,
+			   struct list_head *head)
+{
+	struct list_head *vec = base->tvc.vec;
+	int lvl;
+
+	for (lvl = 0; lvl < TVC_DEPTH; lvl++, vec += TVC_SIZE) {
+		list_splice_tail_init(vec + (clk & TVC_MASK), head);
+		if (clk & TVC_CLK_MASK)
+			break;
+		clk >>= TVC_CLK_SHIFT;
+	}
+}
+
 /**
  * __run_timers - run all expired timers (if any) on this CPU.
  * @base: the timer vector to be processed.
@@ -1101,6 +1235,7 @@ static inline void __run_timers(struct tvec_base *base)
 			cascade(base, &base->tv5, INDEX(3));
 		++base->timer_jiffies;
 		list_replace_init(base->tv1.vec + index, &work_list);
+		coarse_collect(base, base->timer_jiffies - 1, &work_list);
 		while (!list_empty(head)) {
 			void (*fn)(unsigned long);
 			unsigned long data;
@@ -1199,6 +1334,42 @@ cascade:
 	return expires;
 }
 
+/*
+ * Find the first coarse wheel bucket, on any level, holding a timer
+ * that expires before @expires: all the timers of a bucket run
+ * together.
+ */
+static unsigned long __next_coarse_timer_interrupt(struct tvec_base *base,
+						   unsigned long expires)
+{
+	struct list_head *vec = base->tvc.vec;
+	struct timer_list *nte;
+	int lvl, i;
+
+	for (lvl = 0; lvl < TVC_DEPTH; lvl++, vec += TVC_SIZE) {
+		/* The first bucket of this level still to be run */
+		unsigned long first = (base->timer_jiffies + TVC_GRAN(lvl) - 1)
+					>> TVC_SHIFT(lvl);
+
+		for (i = 0; i < TVC_SIZE; i++) {
+			unsigned long when = (first + i) << TVC_SHIFT(lvl);
+
+			if (time_after_eq(when, expires))
+				break;
+			list_for_each_entry(nte, vec + ((first + i) & TVC_MASK),
+					    entry) {
+				if (!tbase_get_deferrable(nte->base)) {
+					expires = when;
+					goto next_level;
+				}
+			}
+		}
+next_level:
+		;
+	}
+	return expires;
+}
+
 /*
  * Check, if the next hrtimer event is before the next timer wheel
  * event:
@@ -1253,8 +1424,11 @@ unsigned long get_next_timer_interrupt(unsigned long now)
 	unsigned long expires;
 
 	spin_lock(&base->lock);
-	if (time_before_eq(base->next_timer, base->timer_jiffies))
+	if (time_before_eq(base->next_timer, base->timer_jiffies)) {
 		base->next_timer = __next_timer_interrupt(base);
+		base->next_timer = __next_coarse_timer_interrupt(base,
+							base->next_timer);
+	}
 	expires = base->next_timer;
 	spin_unlock(&base->lock);
 
@@ -1263,6 +1437,63 @@ unsigned long get_next_timer_interrupt(unsigned long now)
 
 	return cmp_next_hrtimer_event(now, expires);
 }
+
+#ifdef CONFIG_SMP
+static void process_timeout(unsigned long __data);
+
+/**
+ * timer_coalesce_idle - hand the sleep timeouts of this idle cpu over
+ * @target: a busy cpu, from get_nohz_timer_target()
+ * @saved: incremented by the wakeups of this cpu the move saves
+ *
+ * The timer wheel side of hrtimer_coalesce_idle(): the schedule_timeout()
+ * timers due within TVR_SIZE jiffies which were not denied their slack
+ * with set_timer_slack() go to @target, whose tick runs them.  Every
+ * jiffy left without a timer here is a wakeup saved.  Called with
+ * interrupts disabled; returns the number of timers moved.
+ */
+int timer_coalesce_idle(int target, int *saved)
+{
+	struct tvec_base *base = __get_cpu_var(tvec_bases);
+	struct tvec_base *new_base = per_cpu(tvec_bases, target);
+	struct timer_list *timer, *tmp;
+	struct list_head *head;
+	int i, n, moved = 0;
+
+	spin_lock(&base->lock);
+	/* the other order than migrate_timers(), so only try */
+	if (!spin_trylock(&new_base->lock)) {
+		spin_unlock(&base->lock);
+		return 0;
+	}
+
+	for (i = 0; i < TVR_SIZE; i++) {
+		head = base->tv1.vec + i;
+		n = 0;
+		list_for_each_entry_safe(timer, tmp, head, entry) {
+			if (timer->function != process_timeout ||
+			    !timer->slack || tbase_get_deferrable(timer->base))
+				continue;
+
+			if (timer->expires == base->next_timer)
+				base->next_timer = base->timer_jiffies;
+			detach_timer(timer, 0);
+			timer_set_base(timer, new_base);
+			if (time_before(timer->expires, new_base->next_timer))
+				new_base->next_timer = timer->expires;
+			internal_add_timer(new_base, timer);
+			n++;
+		}
+		if (n && list_empty(head))
+			(*saved)++;
+		moved += n;
+	}
+
+	spin_unlock(&new_base->lock);
+	spin_unlock(&base->lock);
+	return moved;
+}
+#endif /* CONFIG_SMP */
 #endif
 
 /*
@@ -1281,6 +1512,7 @@ void update_process_times(int user_tick)
 	printk_tick();
 	perf_event_do_pending();
 	scheduler_tick();
+	task_tick_numa(p);
 	run_posix_cpu_timers(p);
 }
 
@@ -1607,8 +1839,8 @@ static int __cpuinit init_timers_cpu(int cpu)
 			if (!base)
 				return -ENOMEM;
 
-			/* Make sure that tvec_base is 2 byte aligned */
-			if (tbase_get_deferrable(base)) {
+			/* Make sure that tvec_base is 4 byte aligned */
+			if ((unsigned long)base & TBASE_FLAG_MASK) {
 				WARN_ON(1);
 				kfree(base);
 				return -ENOMEM;
@@ -1639,6 +1871,8 @@ static int __cpuinit init_timers_cpu(int cpu)
 	}
 	for (j = 0; j < TVR_SIZE; j++)
 		INIT_LIST_HEAD(base->tv1.vec + j);
+	for (j = 0; j < TVC_DEPTH * TVC_SIZE; j++)
+		INIT_LIST_HEAD(base->tvc.vec + j);
 
 	base->timer_jiffies = jiffies;
 	base->next_timer = base->timer_jiffies;
@@ -1672,7 +1906,7 @@ static void __cpuinit migrate_timers(int cpu)
 	new_base = get_cpu_var(tvec_bases);
 	/*
 	 * The caller is globally serialized and nobody else
-	 * takes two locks at once, deadlock is not possible.
+	 * waits for two locks at once, deadlock is not possible.
 	 */
 	spin_lock_irq(&new_base->lock);
 	spin_lock_nested(&old_base->lock, SINGLE_DEPTH_NESTING);
@@ -1687,6 +1921,8 @@ static void __cpuinit migrate_timers(int cpu)
 		migrate_timer_list(new_base, old_base->tv4.vec + i);
 		migrate_timer_list(new_base, old_base->tv5.vec + i);
 	}
+	for (i = 0; i < TVC_DEPTH * TVC_SIZE; i++)
+		migrate_timer_list(new_base, old_base->tvc.vec + i);
 
 	spin_unlock(&old_base->lock);
 	spin_unlock_irq(&new_base->lock);
@@ -482,8 +482,16 @@ struct ring_buffer {
 	struct notifier_block		cpu_notify;
 #endif
 	u64				(*clock)(void);
+
+	/* read pages given back, see ring_buffer_free_read_page() */
+	spinlock_t			read_pages_lock;
+	struct list_head		read_pages;
+	unsigned			nr_read_pages;
 };
 
+/* read pages kept for reuse, at most */
+#define RB_READ_PAGES_CACHED		64
+
 struct ring_buffer_iter {
 	struct ring_buffer_per_cpu	*cpu_buffer;
 	unsigned long			head;
@@ -1118,6 +1126,8 @@ struct ring_buffer *__ring_buffer_alloc(unsigned long size, unsigned flags,
 	buffer->flags = flags;
 	buffer->clock = trace_clock_local;
 	buffer->reader_lock_key = key;
+	spin_lock_init(&buffer->read_pages_lock);
+	INIT_LIST_HEAD(&buffer->read_pages);
 
 	/* need at least two pages */
 	if (buffer->pages < 2)
@@ -1184,6 +1194,7 @@ EXPORT_SYMBOL_GPL(__ring_buffer_alloc);
 void
 ring_buffer_free(struct ring_buffer *buffer)
 {
+	struct page *page, *tmp;
 	int cpu;
 
 	get_online_cpus();
@@ -1200,6 +1211,9 @@ ring_buffer_free(struct ring_buffer *buffer)
 	kfree(buffer->buffers);
 	free_cpumask_var(buffer->cpumask);
 
+	list_for_each_entry_safe(page, tmp, &buffer->read_pages, lru)
+		__free_page(page);
+
 	kfree(buffer);
 }
 EXPORT_SYMBOL_GPL(ring_buffer_free);
@@ -3701,13 +3715,24 @@ EXPORT_SYMBOL_GPL(ring_buffer_swap_cpu);
 void *ring_buffer_alloc_read_page(struct ring_buffer *buffer)
 {
 	struct buffer_data_page *bpage;
-	unsigned long addr;
+	struct page *page = NULL;
+	unsigned long flags;
 
-	addr = __get_free_page(GFP_KERNEL);
-	if (!addr)
-		return NULL;
+	spin_lock_irqsave(&buffer->read_pages_lock, flags);
+	if (!list_empty(&buffer->read_pages)) {
+		page = list_first_entry(&buffer->read_pages, struct page, lru);
+		list_del(&page->lru);
+		buffer->nr_read_pages--;
+	}
+	spin_unlock_irqrestore(&buffer->read_pages_lock, flags);
 
-	bpage = (void *)addr;
+	if (!page) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page)
+			return NULL;
+	}
+
+	bpage = page_address(page);
 
 	rb_init_page(bpage);
 
@@ -3721,10 +3746,29 @@ EXPORT_SYMBOL_GPL(ring_buffer_alloc_read_page);
  * @data: the page to free
  *
  * Free a page allocated from ring_buffer_alloc_read_page.
+ *
+ * The page is kept for the next ring_buffer_alloc_read_page() unless
+ * someone else still holds a reference to it, as the network stack does
+ * for a page spliced to a socket until it is transmitted: the page is
+ * then freed by the last put_page().
  */
 void ring_buffer_free_read_page(struct ring_buffer *buffer, void *data)
 {
-	free_page((unsigned long)data);
+	struct page *page = virt_to_page(data);
+	unsigned long flags;
+
+	if (page_count(page) == 1) {
+		spin_lock_irqsave(&buffer->read_pages_lock, flags);
+		if (buffer->nr_read_pages < RB_READ_PAGES_CACHED) {
+			list_add(&page->lru, &buffer->read_pages);
+			buffer->nr_read_pages++;
+			page = NULL;
+		}
+		spin_unlock_irqrestore(&buffer->read_pages_lock, flags);
+		if (!page)
+			return;
+	}
+	put_page(page);
 }
 EXPORT_SYMBOL_GPL(ring_buffer_free_read_page);
 
@@ -31,6 +31,7 @@ static struct ring_buffer *buffer;
 static struct task_struct *producer;
 static struct task_struct *consumer;
 static unsigned long read;
+static unsigned long read_pages;
 
 static int disable_reader;
 module_param(disable_reader, uint, 0644);
@@ -169,6 +170,7 @@ static enum event_status read_page(int cpu)
 
 	if (ret < 0)
 		return EVENT_DROPPED;
+	read_pages++;
 	return EVENT_FOUND;
 }
 
@@ -178,6 +180,7 @@ static void ring_buffer_consumer(void)
 	read_events ^= 1;
 
 	read = 0;
+	read_pages = 0;
 	while (!reader_finish && !kill_test) {
 		int found;
 
@@ -315,9 +318,12 @@ static void ring_buffer_producer(void)
 	trace_printk("Overruns: %lld\n", overruns);
 	if (disable_reader)
 		trace_printk("Read:     (reader disabled)\n");
-	else
+	else {
 		trace_printk("Read:     %ld  (by %s)\n", read,
 			read_events ? "events" : "pages");
+		if (!read_events)
+			trace_printk("Pages:    %ld\n", read_pages);
+	}
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
@@ -332,6 +338,11 @@ static void ring_buffer_producer(void)
 
 	trace_printk("Entries per millisec: %ld\n", hit);
 
+	/* what the reader kept up with while the writer was running */
+	if (!disable_reader && time)
+		trace_printk("Read per millisec:    %ld\n",
+			     read / (long)time);
+
 	if (hit) {
 		/* Calculate the average time in nanosecs */
 		avg = NSEC_PER_MSEC / hit;
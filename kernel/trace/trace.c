@@ -3788,6 +3788,7 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		len &= PAGE_MASK;
 	}
 
+ again:
 	trace_access_lock(info->cpu);
 	entries = ring_buffer_entries_cpu(info->tr->buffer, info->cpu);
 
@@ -3841,12 +3842,21 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 
 	/* did we read anything? */
 	if (!spd.nr_pages) {
-		if (flags & SPLICE_F_NONBLOCK)
+		if ((file->f_flags & O_NONBLOCK) || (flags & SPLICE_F_NONBLOCK)) {
 			ret = -EAGAIN;
-		else
-			ret = 0;
-		/* TODO: block */
-		goto out;
+			goto out;
+		}
+		/*
+		 * Wait for a page to fill up, so that a reader splicing
+		 * to a socket or a file in a loop doesn't see an end of
+		 * file.  Writers don't wake us up (see poll_wait_pipe()).
+		 */
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			goto out;
+		}
+		schedule_timeout_interruptible(HZ / 10);
+		goto again;
 	}
 
 	ret = splice_to_pipe(pipe, &spd);
@@ -238,12 +238,24 @@ int trace_graph_entry(struct ftrace_graph_ent *trace)
 	return ret;
 }
 
+/*
+ * With tracing_thresh set, only the calls lasting at least that long
+ * are traced.  Nothing is written on entry, there is no telling yet:
+ * the return event, which carries the call time and the duration, is
+ * only written for calls over the threshold (see print_graph_return()
+ * for how it shows).  The threshold is read on each call, so it can be
+ * set or changed with the tracer running.
+ */
 int trace_graph_thresh_entry(struct ftrace_graph_ent *trace)
 {
-	if (tracing_thresh)
-		return 1;
-	else
+	if (!tracing_thresh)
 		return trace_graph_entry(trace);
+
+	/* hook the return of the same functions trace_graph_entry() would */
+	if (!ftrace_trace_task(current))
+		return 0;
+
+	return trace->depth || ftrace_graph_addr(trace->func);
 }
 
 void __trace_graph_return(struct trace_array *tr,
@@ -301,8 +313,9 @@ void set_graph_array(struct trace_array *tr)
 
 void trace_graph_thresh_return(struct ftrace_graph_ret *trace)
 {
-	if (tracing_thresh &&
-	    (trace->rettime - trace->calltime < tracing_thresh))
+	unsigned long thresh = ACCESS_ONCE(tracing_thresh);
+
+	if (thresh && (trace->rettime - trace->calltime < thresh))
 		return;
 	else
 		trace_graph_return(trace);
@@ -313,12 +326,8 @@ static int graph_trace_init(struct trace_array *tr)
 	int ret;
 
 	set_graph_array(tr);
-	if (tracing_thresh)
-		ret = register_ftrace_graph(&trace_graph_thresh_return,
-					    &trace_graph_thresh_entry);
-	else
-		ret = register_ftrace_graph(&trace_graph_return,
-					    &trace_graph_entry);
+	ret = register_ftrace_graph(&trace_graph_thresh_return,
+				    &trace_graph_thresh_entry);
 	if (ret)
 		return ret;
 	tracing_start_cmdline_record();
@@ -4,6 +4,11 @@
 #include <linux/kernel.h>
 #include <linux/ftrace.h>
 #include <linux/perf_event.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/uaccess.h>
+#include <linux/trace_clock.h>
 #include <asm/syscall.h>
 
 #include "trace_output.h"
@@ -678,3 +683,395 @@ static int syscall_exit_register(struct ftrace_event_call *event,
 	}
 	return 0;
 }
+
+/*
+ * Syscall latency histograms
+ *
+ * For the syscalls enabled in tracing/syscall_latency/enable, the time
+ * from entry to exit of one call in sample_rate is accounted in log2
+ * usecs buckets, per cpu, without emitting any event.
+ */
+#define SYSLAT_SLOTS	32
+
+struct syscall_lat_hist {
+	unsigned long		count;
+	u64			max;		/* in ns */
+	unsigned long		slots[SYSLAT_SLOTS];
+};
+
+static DECLARE_BITMAP(syslat_enabled, NR_syscalls);
+static struct syscall_lat_hist __percpu *syslat_hist[NR_syscalls];
+static int syslat_refcount;
+static u64 syslat_epoch;		/* when the probes were registered */
+static unsigned int syslat_sample_rate = 1;
+static DEFINE_PER_CPU(unsigned int, syslat_skipped);
+
+static void syslat_enter(void *ignore, struct pt_regs *regs, long id)
+{
+	int syscall_nr = syscall_get_nr(current, regs);
+	unsigned int rate = ACCESS_ONCE(syslat_sample_rate);
+
+	if (syscall_nr < 0 || syscall_nr >= NR_syscalls ||
+	    !test_bit(syscall_nr, syslat_enabled))
+		return;
+
+	/* probes run with preemption disabled */
+	if (rate > 1 && ++__get_cpu_var(syslat_skipped) < rate)
+		return;
+	__get_cpu_var(syslat_skipped) = 0;
+
+	current->syscall_lat_start = trace_clock();
+}
+
+static void syslat_exit(void *ignore, struct pt_regs *regs, long ret)
+{
+	u64 start = current->syscall_lat_start;
+	struct syscall_lat_hist *hist;
+	int syscall_nr;
+	s64 delta;
+	int slot;
+
+	if (!start)
+		return;
+	current->syscall_lat_start = 0;
+
+	syscall_nr = syscall_get_nr(current, regs);
+	if (syscall_nr < 0 || syscall_nr >= NR_syscalls ||
+	    !test_bit(syscall_nr, syslat_enabled) ||
+	    !syslat_hist[syscall_nr] || start < syslat_epoch)
+		return;
+
+	delta = trace_clock() - start;
+	if (delta < 0)
+		delta = 0;
+
+	hist = per_cpu_ptr(syslat_hist[syscall_nr], smp_processor_id());
+	slot = fls64(div_u64(delta, NSEC_PER_USEC));
+	hist->slots[min(slot, SYSLAT_SLOTS - 1)]++;
+	if (delta > hist->max)
+		hist->max = delta;
+	hist->count++;
+}
+
+/* called with syscall_trace_lock held */
+static int syslat_enable(int nr)
+{
+	int ret;
+
+	if (test_bit(nr, syslat_enabled))
+		return 0;
+
+	if (!syslat_hist[nr]) {
+		syslat_hist[nr] = alloc_percpu(struct syscall_lat_hist);
+		if (!syslat_hist[nr])
+			return -ENOMEM;
+	}
+
+	if (!syslat_refcount) {
+		syslat_epoch = trace_clock();
+		ret = register_trace_sys_enter(syslat_enter, NULL);
+		if (ret)
+			return ret;
+		ret = register_trace_sys_exit(syslat_exit, NULL);
+		if (ret) {
+			unregister_trace_sys_enter(syslat_enter, NULL);
+			return ret;
+		}
+	}
+	syslat_refcount++;
+	set_bit(nr, syslat_enabled);
+	return 0;
+}
+
+/* called with syscall_trace_lock held, the histogram is kept */
+static void syslat_disable(int nr)
+{
+	if (!test_and_clear_bit(nr, syslat_enabled))
+		return;
+
+	if (!--syslat_refcount) {
+		unregister_trace_sys_enter(syslat_enter, NULL);
+		unregister_trace_sys_exit(syslat_exit, NULL);
+	}
+}
+
+static void syslat_reset(void)
+{
+	int nr, cpu;
+
+	mutex_lock(&syscall_trace_lock);
+	for (nr = 0; nr < NR_syscalls; nr++) {
+		if (!syslat_hist[nr])
+			continue;
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(syslat_hist[nr], cpu), 0,
+			       sizeof(struct syscall_lat_hist));
+	}
+	mutex_unlock(&syscall_trace_lock);
+}
+
+static int syslat_find(const char *name)
+{
+	struct syscall_metadata *meta;
+	int nr;
+
+	if (!syscalls_metadata)
+		return -ENODEV;
+
+	for (nr = 0; nr < NR_syscalls; nr++) {
+		meta = syscalls_metadata[nr];
+		if (!meta)
+			continue;
+		/* the sys_ prefix is optional */
+		if (!strcmp(meta->name, name) ||
+		    (!strncmp(meta->name, "sys_", 4) &&
+		     !strcmp(meta->name + 4, name)))
+			return nr;
+	}
+	return -EINVAL;
+}
+
+static void *syslat_seq_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&syscall_trace_lock);
+	return *pos < NR_syscalls ? pos : NULL;
+}
+
+static void *syslat_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return *pos < NR_syscalls ? pos : NULL;
+}
+
+static void syslat_seq_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&syscall_trace_lock);
+}
+
+static int syslat_enable_show(struct seq_file *m, void *v)
+{
+	int nr = *(loff_t *)v;
+
+	if (test_bit(nr, syslat_enabled) && syscalls_metadata[nr])
+		seq_printf(m, "%s\n", syscalls_metadata[nr]->name);
+	return 0;
+}
+
+/* the bucket holding the @pct percentile of @count samples */
+static int syslat_percentile(unsigned long *slots, unsigned long count,
+			     int pct)
+{
+	unsigned long seen = 0, want;
+	int i;
+
+	want = DIV_ROUND_UP(count * pct, 100);
+	for (i = 0; i < SYSLAT_SLOTS; i++) {
+		seen += slots[i];
+		if (seen >= want)
+			break;
+	}
+	return min(i, SYSLAT_SLOTS - 1);
+}
+
+static int syslat_hist_show(struct seq_file *m, void *v)
+{
+	unsigned long slots[SYSLAT_SLOTS] = { };
+	int nr = *(loff_t *)v;
+	unsigned long count = 0;
+	u64 max = 0;
+	int cpu, i;
+
+	if (!syslat_hist[nr] || !syscalls_metadata[nr])
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct syscall_lat_hist *hist;
+
+		hist = per_cpu_ptr(syslat_hist[nr], cpu);
+		count += hist->count;
+		max = max(max, hist->max);
+		for (i = 0; i < SYSLAT_SLOTS; i++)
+			slots[i] += hist->slots[i];
+	}
+	if (!count)
+		return 0;
+
+	seq_printf(m, "%s: %lu sampled, max %llu us, p50 < %lu us, "
+		   "p99 < %lu us\n", syscalls_metadata[nr]->name, count,
+		   (unsigned long long)div_u64(max, NSEC_PER_USEC),
+		   1UL << syslat_percentile(slots, count, 50),
+		   1UL << syslat_percentile(slots, count, 99));
+	seq_printf(m, "%23s : count\n", "usecs");
+	for (i = 0; i < SYSLAT_SLOTS; i++) {
+		if (!slots[i])
+			continue;
+		if (i == SYSLAT_SLOTS - 1)
+			seq_printf(m, "%10lu -> ...      : %lu\n",
+				   1UL << (i - 1), slots[i]);
+		else
+			seq_printf(m, "%10lu -> %-10lu : %lu\n",
+				   i ? 1UL << (i - 1) : 0,
+				   (1UL << i) - 1, slots[i]);
+	}
+	return 0;
+}
+
+static const struct seq_operations syslat_enable_seq_ops = {
+	.start		= syslat_seq_start,
+	.next		= syslat_seq_next,
+	.stop		= syslat_seq_stop,
+	.show		= syslat_enable_show,
+};
+
+static const struct seq_operations syslat_hist_seq_ops = {
+	.start		= syslat_seq_start,
+	.next		= syslat_seq_next,
+	.stop		= syslat_seq_stop,
+	.show		= syslat_hist_show,
+};
+
+/*
+ * "futex" or "sys_futex" enables a syscall, "!futex" disables it;
+ * opening for writing without O_APPEND disables them all first.
+ */
+static ssize_t syslat_enable_write(struct file *file, const char __user *ubuf,
+				   size_t cnt, loff_t *ppos)
+{
+	char buf[KSYM_NAME_LEN], *name;
+	bool disable;
+	int nr, ret;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, cnt))
+		return -EFAULT;
+	buf[cnt] = 0;
+
+	name = strstrip(buf);
+	if (!*name)
+		return cnt;
+
+	disable = *name == '!';
+	if (disable)
+		name++;
+
+	nr = syslat_find(name);
+	if (nr < 0)
+		return nr;
+
+	mutex_lock(&syscall_trace_lock);
+	ret = 0;
+	if (disable)
+		syslat_disable(nr);
+	else
+		ret = syslat_enable(nr);
+	mutex_unlock(&syscall_trace_lock);
+
+	return ret ? ret : cnt;
+}
+
+static int syslat_enable_open(struct inode *inode, struct file *file)
+{
+	int nr;
+
+	if ((file->f_mode & FMODE_WRITE) && !(file->f_flags & O_APPEND)) {
+		mutex_lock(&syscall_trace_lock);
+		for (nr = 0; nr < NR_syscalls; nr++)
+			syslat_disable(nr);
+		mutex_unlock(&syscall_trace_lock);
+	}
+	if (file->f_mode & FMODE_READ)
+		return seq_open(file, &syslat_enable_seq_ops);
+	return 0;
+}
+
+static int syslat_enable_release(struct inode *inode, struct file *file)
+{
+	if (file->f_mode & FMODE_READ)
+		return seq_release(inode, file);
+	return 0;
+}
+
+static const struct file_operations syslat_enable_fops = {
+	.open		= syslat_enable_open,
+	.read		= seq_read,
+	.write		= syslat_enable_write,
+	.llseek		= seq_lseek,
+	.release	= syslat_enable_release,
+};
+
+static int syslat_hist_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &syslat_hist_seq_ops);
+}
+
+/* any write resets the histograms */
+static ssize_t syslat_hist_write(struct file *file, const char __user *ubuf,
+				 size_t cnt, loff_t *ppos)
+{
+	syslat_reset();
+	return cnt;
+}
+
+static const struct file_operations syslat_hist_fops = {
+	.open		= syslat_hist_open,
+	.read		= seq_read,
+	.write		= syslat_hist_write,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+static ssize_t syslat_rate_read(struct file *file, char __user *ubuf,
+				size_t cnt, loff_t *ppos)
+{
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%u\n", syslat_sample_rate);
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, len);
+}
+
+static ssize_t syslat_rate_write(struct file *file, const char __user *ubuf,
+				 size_t cnt, loff_t *ppos)
+{
+	char buf[16];
+	unsigned long val;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, cnt))
+		return -EFAULT;
+	buf[cnt] = 0;
+
+	if (strict_strtoul(strstrip(buf), 10, &val) || !val || val > UINT_MAX)
+		return -EINVAL;
+
+	syslat_sample_rate = val;
+	return cnt;
+}
+
+static const struct file_operations syslat_rate_fops = {
+	.read		= syslat_rate_read,
+	.write		= syslat_rate_write,
+};
+
+static __init int syslat_init_debugfs(void)
+{
+	struct dentry *d_tracer, *dir;
+
+	d_tracer = tracing_init_dentry();
+	if (!d_tracer)
+		return 0;
+
+	dir = debugfs_create_dir("syscall_latency", d_tracer);
+	if (!dir) {
+		pr_warning("Could not create debugfs 'syscall_latency' entry\n");
+		return 0;
+	}
+
+	trace_create_file("enable", 0644, dir, NULL, &syslat_enable_fops);
+	trace_create_file("hist", 0644, dir, NULL, &syslat_hist_fops);
+	trace_create_file("sample_rate", 0644, dir, NULL, &syslat_rate_fops);
+	return 0;
+}
+fs_initcall(syslat_init_debugfs);
@@ -34,6 +34,13 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hash.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/nodemask.h>
+#include <linux/device.h>
 
 #include "workqueue_sched.h"
 
@@ -106,6 +113,43 @@ enum {
 
 struct global_cwq;
 
+#ifdef CONFIG_WORKQUEUE_STATS
+/*
+ * Queueing to execution latency of the works of a cwq, in log2 buckets
+ * of usecs: the last one collects everything above 2^22 us, ~4s.
+ */
+#define WQ_STATS_LAT_SLOTS	24
+
+struct cwq_stats {
+	unsigned long		nr_executed;	/* L: works executed */
+	u64			max_latency;	/* L: in ns */
+	unsigned long		latency[WQ_STATS_LAT_SLOTS]; /* L */
+};
+
+/*
+ * Cpu time of the work functions executed by a gcwq.  The table is
+ * open addressed and never shrinks: the functions that find it full
+ * are only counted in nr_fn_dropped.
+ */
+#define WQ_STATS_FN_ORDER	7
+#define WQ_STATS_FN_SIZE	(1 << WQ_STATS_FN_ORDER)
+
+struct wq_fn_stat {
+	work_func_t		func;
+	unsigned long		nr_executed;
+	u64			cpu_time;	/* in ns */
+	u64			max_cpu_time;
+};
+
+struct gcwq_stats {
+	int			max_workers;	/* L: high watermark */
+	unsigned long		nr_created;	/* L: workers started */
+	unsigned long		nr_destroyed;	/* L: workers destroyed */
+	unsigned long		nr_fn_dropped;	/* L: fn table was full */
+	struct wq_fn_stat	fn[WQ_STATS_FN_SIZE]; /* L */
+};
+#endif
+
 /*
  * The poor guys doing the actual heavy lifting.  All on-duty workers
  * are either serving the manager role, on idle list or on busy hash.
@@ -127,6 +171,10 @@ struct worker {
 	unsigned int		flags;		/* X: flags */
 	int			id;		/* I: worker id */
 	struct work_struct	rebind_work;	/* L: rebind worker to cpu */
+
+	/* unbound workers: attributes applied, see worker_apply_attrs() */
+	struct workqueue_struct	*attrs_wq;
+	unsigned int		attrs_gen;
 };
 
 /*
@@ -157,6 +205,9 @@ struct global_cwq {
 	unsigned int		trustee_state;	/* L: trustee state */
 	wait_queue_head_t	trustee_wait;	/* trustee wait */
 	struct worker		*first_idle;	/* L: first idle worker */
+#ifdef CONFIG_WORKQUEUE_STATS
+	struct gcwq_stats	stats;
+#endif
 } ____cacheline_aligned_in_smp;
 
 /*
@@ -174,6 +225,9 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
+#ifdef CONFIG_WORKQUEUE_STATS
+	struct cwq_stats	stats;
+#endif
 };
 
 /*
@@ -215,6 +269,7 @@ struct workqueue_struct {
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
 		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct		**unbound; /* per node */
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
 	struct list_head	list;		/* W: list of all workqueues */
@@ -232,6 +287,19 @@ struct workqueue_struct {
 
 	int			saved_max_active; /* W: saved cwq max_active */
 	const char		*name;		/* I: workqueue name */
+
+	/*
+	 * Unbound workqueues: the cpus their workers may run on, the
+	 * nodes of those (whose gcwqs their works are queued on) and
+	 * the nice level of the workers.  Changed through sysfs with
+	 * wq_sysfs_mutex held, read without locking: a racing change is
+	 * picked up by the next work.
+	 */
+	cpumask_var_t		unbound_cpumask;
+	nodemask_t		unbound_nodes;
+	int			unbound_nice;
+	bool			unbound_custom;	/* not the defaults */
+	struct wq_device	*wq_dev;	/* in /sys/bus/workqueue */
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -250,19 +318,31 @@ EXPORT_SYMBOL_GPL(system_unbound_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
+static inline bool gcwq_cpu_unbound(unsigned int cpu)
+{
+	return cpu >= WORK_CPU_UNBOUND && cpu < WORK_CPU_NONE;
+}
+
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
+	int node;
+
 	if (cpu < nr_cpu_ids) {
 		if (sw & 1) {
 			cpu = cpumask_next(cpu, mask);
 			if (cpu < nr_cpu_ids)
 				return cpu;
 		}
-		if (sw & 2)
-			return WORK_CPU_UNBOUND;
-	}
-	return WORK_CPU_NONE;
+		if (!(sw & 2))
+			return WORK_CPU_NONE;
+		node = first_node(node_possible_map);
+	} else if (cpu < WORK_CPU_NONE)
+		node = next_node(cpu - WORK_CPU_UNBOUND, node_possible_map);
+	else
+		return WORK_CPU_NONE;
+
+	return node < MAX_NUMNODES ? WORK_CPU_UNBOUND + node : WORK_CPU_NONE;
 }
 
 static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
@@ -274,15 +354,15 @@ static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
+ * Extra gcwqs, one per possible node, are defined for invalid cpu numbers
  * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
  * specific CPU.  The following iterators are similar to
  * for_each_*_cpu() iterators but also considers the unbound gcwq.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound gcwqs
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound gcwqs
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  unbound gcwqs for unbound workqueues
  */
 #define for_each_gcwq_cpu(cpu)						\
 	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
@@ -438,26 +518,31 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global cpu workqueues, one per node, and nr_running counter for
+ * unbound gcwqs.  The gcwqs are always online, have GCWQ_DISASSOCIATED
+ * set, and all their workers have WORKER_UNBOUND set.  Works are queued
+ * on the gcwq of the node they are queued from, and its workers run on
+ * the cpus of the node, so that they run close to the data they touch.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq *unbound_global_cwq[MAX_NUMNODES];
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
+/* bumped when the attributes of the unbound workers have to be redone */
+static atomic_t wq_attrs_gen = ATOMIC_INIT(1);
+
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!gcwq_cpu_unbound(cpu))
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return unbound_global_cwq[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (!gcwq_cpu_unbound(cpu))
 		return &per_cpu(gcwq_nr_running, cpu);
 	else
 		return &unbound_gcwq_nr_running;
@@ -474,8 +559,8 @@ static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 			return wq->cpu_wq.single;
 #endif
 		}
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(gcwq_cpu_unbound(cpu)))
+		return wq->cpu_wq.unbound[cpu - WORK_CPU_UNBOUND];
 	return NULL;
 }
 
@@ -557,7 +642,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && !gcwq_cpu_unbound(cpu));
 	return get_gcwq(cpu);
 }
 
@@ -893,6 +978,80 @@ static inline struct list_head *gcwq_determine_ins_pos(struct global_cwq *gcwq,
 	return &twork->entry;
 }
 
+#ifdef CONFIG_WORKQUEUE_STATS
+/*
+ * The work may be queued on one cpu and executed on another: only a
+ * global clock gives a meaningful latency.
+ */
+static inline void wq_stats_queue(struct work_struct *work)
+{
+	work->queued_at = ktime_to_ns(ktime_get());
+}
+
+/* is about to execute @work, called with gcwq->lock held */
+static void wq_stats_execute(struct cpu_workqueue_struct *cwq,
+			     struct work_struct *work)
+{
+	struct cwq_stats *stats = &cwq->stats;
+	s64 delta = ktime_to_ns(ktime_get()) - work->queued_at;
+	int slot;
+
+	if (delta < 0)
+		delta = 0;
+	slot = fls64(div_u64(delta, NSEC_PER_USEC));
+	stats->latency[min(slot, WQ_STATS_LAT_SLOTS - 1)]++;
+	if (delta > stats->max_latency)
+		stats->max_latency = delta;
+	stats->nr_executed++;
+}
+
+/* has executed @f for @cpu_time ns, called with gcwq->lock held */
+static void wq_stats_executed(struct global_cwq *gcwq, work_func_t f,
+			      u64 cpu_time)
+{
+	unsigned long i = hash_ptr(f, WQ_STATS_FN_ORDER);
+	struct wq_fn_stat *fn;
+	int probe;
+
+	for (probe = 0; probe < WQ_STATS_FN_SIZE; probe++) {
+		fn = &gcwq->stats.fn[(i + probe) & (WQ_STATS_FN_SIZE - 1)];
+		if (fn->func == f)
+			goto found;
+		if (!fn->func) {
+			fn->func = f;
+			goto found;
+		}
+	}
+	gcwq->stats.nr_fn_dropped++;
+	return;
+found:
+	fn->nr_executed++;
+	fn->cpu_time += cpu_time;
+	if (cpu_time > fn->max_cpu_time)
+		fn->max_cpu_time = cpu_time;
+}
+
+static void wq_stats_worker_started(struct global_cwq *gcwq)
+{
+	gcwq->stats.nr_created++;
+	if (gcwq->nr_workers > gcwq->stats.max_workers)
+		gcwq->stats.max_workers = gcwq->nr_workers;
+}
+
+static void wq_stats_worker_destroyed(struct global_cwq *gcwq)
+{
+	gcwq->stats.nr_destroyed++;
+}
+#else
+static inline void wq_stats_queue(struct work_struct *work) { }
+static inline void wq_stats_execute(struct cpu_workqueue_struct *cwq,
+				    struct work_struct *work) { }
+static inline void wq_stats_executed(struct global_cwq *gcwq, work_func_t f,
+				     u64 cpu_time) { }
+static inline void wq_stats_worker_started(struct global_cwq *gcwq) { }
+static inline void wq_stats_worker_destroyed(struct global_cwq *gcwq) { }
+#endif
+
 /**
  * insert_work - insert a work into gcwq
  * @cwq: cwq @work belongs to
@@ -914,6 +1073,7 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 
 	/* we own @work, set data and link */
 	set_work_cwq(work, cwq, extra_flags);
+	wq_stats_queue(work);
 
 	/*
 	 * Ensure that we get the right work->data if we see the
@@ -934,6 +1094,28 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 		wake_up_worker(gcwq);
 }
 
+/*
+ * The unbound gcwq @wq queues on from @cpu: that of the node of @cpu,
+ * or of the current cpu if @cpu isn't a valid one, unless the node has
+ * none of the cpus of @wq.
+ */
+static unsigned int unbound_queue_cpu(unsigned int cpu,
+				      struct workqueue_struct *wq)
+{
+	int node;
+
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+		cpu = raw_smp_processor_id();
+
+	node = cpu_to_node(cpu);
+	if (node < 0 || !node_isset(node, wq->unbound_nodes)) {
+		node = first_node(wq->unbound_nodes);
+		if (node >= MAX_NUMNODES)
+			node = first_node(node_possible_map);
+	}
+	return WORK_CPU_UNBOUND + node;
+}
+
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
@@ -976,7 +1158,7 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 		} else
 			spin_lock_irqsave(&gcwq->lock, flags);
 	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		gcwq = get_gcwq(unbound_queue_cpu(cpu, wq));
 		spin_lock_irqsave(&gcwq->lock, flags);
 	}
 
@@ -1101,12 +1283,12 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		if (!(wq->flags & WQ_UNBOUND)) {
 			struct global_cwq *gcwq = get_work_gcwq(work);
 
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
+			if (gcwq && !gcwq_cpu_unbound(gcwq->cpu))
 				lcpu = gcwq->cpu;
 			else
 				lcpu = raw_smp_processor_id();
 		} else
-			lcpu = WORK_CPU_UNBOUND;
+			lcpu = unbound_queue_cpu(WORK_CPU_UNBOUND, wq);
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
 
@@ -1289,7 +1471,7 @@ static struct worker *alloc_worker(void)
  */
 static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 {
-	bool on_unbound_cpu = gcwq->cpu == WORK_CPU_UNBOUND;
+	bool on_unbound_cpu = gcwq_cpu_unbound(gcwq->cpu);
 	struct worker *worker = NULL;
 	int id = -1;
 
@@ -1314,7 +1496,8 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 					      "kworker/%u:%d", gcwq->cpu, id);
 	else
 		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+					      "kworker/u%u:%d",
+					      gcwq->cpu - WORK_CPU_UNBOUND, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
@@ -1355,6 +1538,7 @@ static void start_worker(struct worker *worker)
 {
 	worker->flags |= WORKER_STARTED;
 	worker->gcwq->nr_workers++;
+	wq_stats_worker_started(worker->gcwq);
 	worker_enter_idle(worker);
 	wake_up_process(worker->task);
 }
@@ -1377,8 +1561,10 @@ static void destroy_worker(struct worker *worker)
 	BUG_ON(worker->current_work);
 	BUG_ON(!list_empty(&worker->scheduled));
 
-	if (worker->flags & WORKER_STARTED)
+	if (worker->flags & WORKER_STARTED) {
 		gcwq->nr_workers--;
+		wq_stats_worker_destroyed(gcwq);
+	}
 	if (worker->flags & WORKER_IDLE)
 		gcwq->nr_idle--;
 
@@ -1431,8 +1617,11 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/*
+	 * Unbound gcwqs can't be set in cpumask, use cpu 0 instead: the
+	 * rescuer then goes through the cwqs of all nodes.
+	 */
+	if (gcwq_cpu_unbound(cpu))
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -1707,6 +1896,50 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color)
 		complete(&cwq->wq->first_flusher->done);
 }
 
+/**
+ * worker_apply_attrs - give an unbound worker the attributes of a workqueue
+ * @worker: self
+ * @wq: workqueue of the work about to be processed
+ *
+ * Unbound workers run on the cpus of the node of their gcwq, restricted
+ * to the cpumask of @wq if any, at the nice level of @wq.  Workqueues
+ * left at the defaults share those attributes, which are only redone
+ * when the worker moves on to a workqueue with others, or after a cpu
+ * went up or down or an attribute changed.
+ *
+ * CONTEXT:
+ * Might sleep.
+ */
+static void worker_apply_attrs(struct worker *worker,
+			       struct workqueue_struct *wq)
+{
+	struct workqueue_struct *key = wq->unbound_custom ? wq : NULL;
+	unsigned int gen = atomic_read(&wq_attrs_gen);
+	int node = worker->gcwq->cpu - WORK_CPU_UNBOUND;
+	int nice = key ? wq->unbound_nice : 0;
+	cpumask_var_t mask;
+
+	if (worker->attrs_wq == key && worker->attrs_gen == gen)
+		return;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	cpumask_and(mask, wq->unbound_cpumask, cpumask_of_node(node));
+	if (!cpumask_intersects(mask, cpu_online_mask))
+		cpumask_copy(mask, wq->unbound_cpumask);
+
+	/* PF_THREAD_BOUND allows this as long as it's done by ourself */
+	if (!cpumask_equal(&current->cpus_allowed, mask))
+		set_cpus_allowed_ptr(current, mask);
+	if (task_nice(current) != nice)
+		set_user_nice(current, nice);
+
+	free_cpumask_var(mask);
+	worker->attrs_wq = key;
+	worker->attrs_gen = gen;
+}
+
 /**
  * process_one_work - process single work
  * @worker: self
@@ -1730,6 +1963,7 @@ static void process_one_work(struct worker *worker, struct work_struct *work)
 	work_func_t f = work->func;
 	int work_color;
 	struct worker *collision;
+	u64 runtime;
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -1754,6 +1988,7 @@ static void process_one_work(struct worker *worker, struct work_struct *work)
 
 	/* claim and process */
 	debug_work_deactivate(work);
+	wq_stats_execute(cwq, work);
 	hlist_add_head(&worker->hentry, bwh);
 	worker->current_work = work;
 	worker->current_cwq = cwq;
@@ -1787,6 +2022,10 @@ static void process_one_work(struct worker *worker, struct work_struct *work)
 
 	spin_unlock_irq(&gcwq->lock);
 
+	if (worker->flags & WORKER_UNBOUND)
+		worker_apply_attrs(worker, cwq->wq);
+
+	runtime = current->se.sum_exec_runtime;
 	work_clear_pending(work);
 	lock_map_acquire(&cwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
@@ -1804,8 +2043,12 @@ static void process_one_work(struct worker *worker, struct work_struct *work)
 		dump_stack();
 	}
 
+	runtime = current->se.sum_exec_runtime - runtime;
+
 	spin_lock_irq(&gcwq->lock);
 
+	wq_stats_executed(gcwq, f, runtime);
+
 	/* clear cpu intensive status */
 	if (unlikely(cpu_intensive))
 		worker_clr_flags(worker, WORKER_CPU_INTENSIVE);
@@ -1943,13 +2186,36 @@ sleep:
  *
  * This should happen rarely.
  */
+static void rescue_cwq(struct worker *rescuer,
+		       struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+	spin_unlock_irq(&gcwq->lock);
+}
+
 static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -1960,32 +2226,18 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for the gcwqs of all
+	 * nodes.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-		spin_unlock_irq(&gcwq->lock);
+		if (!is_unbound)
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
+		else
+			for_each_cwq_cpu(tcpu, wq)
+				rescue_cwq(rescuer, get_cwq(tcpu, wq));
 	}
 
 	schedule();
@@ -2652,41 +2904,262 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
-static int alloc_cwqs(struct workqueue_struct *wq)
+/*
+ * The nodes whose unbound gcwqs the works of @wq are queued on: those
+ * with cpus @wq may run on.
+ */
+static void wq_update_unbound_nodes(struct workqueue_struct *wq)
+{
+	nodemask_t nodes = NODE_MASK_NONE;
+	unsigned int cpu;
+	int node;
+
+	for_each_cpu(cpu, wq->unbound_cpumask) {
+		node = cpu_to_node(cpu);
+		if (node >= 0)
+			node_set(node, nodes);
+	}
+	if (nodes_empty(nodes))
+		nodes = node_possible_map;
+	wq->unbound_nodes = nodes;
+}
+
+/*
+ * Unbound workqueues show up in /sys/bus/workqueue/devices with the
+ * attributes of their workers: cpumask and nice.
+ */
+struct wq_device {
+	struct workqueue_struct	*wq;
+	struct device		dev;
+};
+
+static DEFINE_MUTEX(wq_sysfs_mutex);
+static bool wq_sysfs_ready;	/* wq_sysfs_mutex: bus registered */
+
+static struct workqueue_struct *dev_to_wq(struct device *dev)
+{
+	return container_of(dev, struct wq_device, dev)->wq;
+}
+
+static void wq_attrs_changed(struct workqueue_struct *wq)
+{
+	wq->unbound_custom = wq->unbound_nice ||
+		!cpumask_equal(wq->unbound_cpumask, cpu_possible_mask);
+	atomic_inc(&wq_attrs_gen);
+}
+
+static ssize_t wq_cpumask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int len;
+
+	len = cpumask_scnprintf(buf, PAGE_SIZE - 1, wq->unbound_cpumask);
+	buf[len++] = '\n';
+	return len;
+}
+
+static ssize_t wq_cpumask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	cpumask_var_t mask;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = bitmap_parse(buf, count, cpumask_bits(mask), nr_cpumask_bits);
+	if (!ret && !cpumask_intersects(mask, cpu_online_mask))
+		ret = -EINVAL;
+	if (!ret) {
+		mutex_lock(&wq_sysfs_mutex);
+		cpumask_and(wq->unbound_cpumask, mask, cpu_possible_mask);
+		wq_update_unbound_nodes(wq);
+		wq_attrs_changed(wq);
+		mutex_unlock(&wq_sysfs_mutex);
+	}
+
+	free_cpumask_var(mask);
+	return ret ?: count;
+}
+
+static ssize_t wq_nice_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", dev_to_wq(dev)->unbound_nice);
+}
+
+static ssize_t wq_nice_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	long nice;
+
+	if (strict_strtol(buf, 10, &nice) || nice < -20 || nice > 19)
+		return -EINVAL;
+
+	mutex_lock(&wq_sysfs_mutex);
+	wq->unbound_nice = nice;
+	wq_attrs_changed(wq);
+	mutex_unlock(&wq_sysfs_mutex);
+	return count;
+}
+
+static struct device_attribute wq_sysfs_attrs[] = {
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
+	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
+	__ATTR_NULL,
+};
+
+static struct bus_type wq_subsys = {
+	.name		= "workqueue",
+	.dev_attrs	= wq_sysfs_attrs,
+};
+
+static void wq_device_release(struct device *dev)
+{
+	kfree(container_of(dev, struct wq_device, dev));
+}
+
+/* called with wq_sysfs_mutex held */
+static void __wq_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev;
+	int ret;
+
+	wq_dev = kzalloc(sizeof(*wq_dev), GFP_KERNEL);
+	if (!wq_dev)
+		return;
+
+	wq_dev->wq = wq;
+	wq_dev->dev.bus = &wq_subsys;
+	wq_dev->dev.release = wq_device_release;
+	dev_set_name(&wq_dev->dev, "%s", wq->name);
+
+	ret = device_register(&wq_dev->dev);
+	if (ret) {
+		printk(KERN_WARNING "workqueue: failed to register %s "
+		       "in sysfs (%d)\n", wq->name, ret);
+		put_device(&wq_dev->dev);
+		return;
+	}
+	wq->wq_dev = wq_dev;
+}
+
+static void wq_sysfs_register(struct workqueue_struct *wq)
+{
+	mutex_lock(&wq_sysfs_mutex);
+	if (wq_sysfs_ready && !wq->wq_dev)
+		__wq_sysfs_register(wq);
+	mutex_unlock(&wq_sysfs_mutex);
+}
+
+static void wq_sysfs_unregister(struct workqueue_struct *wq)
+{
+	mutex_lock(&wq_sysfs_mutex);
+	if (wq->wq_dev) {
+		device_unregister(&wq->wq_dev->dev);
+		wq->wq_dev = NULL;
+	}
+	mutex_unlock(&wq_sysfs_mutex);
+}
+
+/* the workqueues allocated before the driver core was up are added here */
+static int __init wq_sysfs_init(void)
+{
+	struct workqueue_struct *wq;
+	int ret;
+
+	ret = bus_register(&wq_subsys);
+	if (ret)
+		return ret;
+
+	mutex_lock(&wq_sysfs_mutex);
+	wq_sysfs_ready = true;
+	list_for_each_entry(wq, &workqueues, list)
+		if (wq->flags & WQ_UNBOUND)
+			__wq_sysfs_register(wq);
+	mutex_unlock(&wq_sysfs_mutex);
+	return 0;
+}
+core_initcall(wq_sysfs_init);
+
+/*
+ * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.
+ * Make sure that the alignment isn't lower than that of unsigned long
+ * long.
+ */
+#define CWQ_ALIGN	max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,	\
+			      __alignof__(unsigned long long))
+
+static struct cpu_workqueue_struct *alloc_single_cwq(int node)
 {
+	const size_t size = sizeof(struct cpu_workqueue_struct);
+	struct cpu_workqueue_struct *cwq;
+	void *ptr;
+
 	/*
-	 * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.
-	 * Make sure that the alignment isn't lower than that of
-	 * unsigned long long.
+	 * Allocate enough room to align cwq and put an extra pointer
+	 * at the end pointing back to the originally allocated pointer
+	 * which will be used for free.
 	 */
+	ptr = kzalloc_node(size + CWQ_ALIGN + sizeof(void *), GFP_KERNEL,
+			   node_online(node) ? node : -1);
+	if (!ptr)
+		return NULL;
+
+	cwq = PTR_ALIGN(ptr, CWQ_ALIGN);
+	*(void **)(cwq + 1) = ptr;
+	return cwq;
+}
+
+static void free_single_cwq(struct cpu_workqueue_struct *cwq)
+{
+	/* the pointer to free is stored right after the cwq */
+	if (cwq)
+		kfree(*(void **)(cwq + 1));
+}
+
+static int alloc_cwqs(struct workqueue_struct *wq)
+{
 	const size_t size = sizeof(struct cpu_workqueue_struct);
-	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
-				   __alignof__(unsigned long long));
 #ifdef CONFIG_SMP
 	bool percpu = !(wq->flags & WQ_UNBOUND);
 #else
 	bool percpu = false;
 #endif
+	unsigned int cpu;
 
-	if (percpu)
-		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
-	else {
-		void *ptr;
-
-		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
-		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
-		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+	if (wq->flags & WQ_UNBOUND) {
+		/* one cwq per possible node, on the memory of the node */
+		wq->cpu_wq.unbound = kzalloc(nr_node_ids * sizeof(void *),
+					     GFP_KERNEL);
+		if (!wq->cpu_wq.unbound)
+			return -ENOMEM;
+
+		for_each_cwq_cpu(cpu, wq) {
+			struct cpu_workqueue_struct *cwq;
+
+			cwq = alloc_single_cwq(cpu - WORK_CPU_UNBOUND);
+			if (!cwq)
+				return -ENOMEM;
+			/* just in case, make sure it's actually aligned */
+			BUG_ON(!IS_ALIGNED((unsigned long)cwq, CWQ_ALIGN));
+			wq->cpu_wq.unbound[cpu - WORK_CPU_UNBOUND] = cwq;
 		}
+		return 0;
 	}
 
+	if (percpu)
+		wq->cpu_wq.pcpu = __alloc_percpu(size, CWQ_ALIGN);
+	else
+		wq->cpu_wq.single = alloc_single_cwq(numa_node_id());
+
 	/* just in case, make sure it's actually aligned */
-	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
+	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, CWQ_ALIGN));
 	return wq->cpu_wq.v ? 0 : -ENOMEM;
 }
 
@@ -2697,15 +3170,21 @@ static void free_cwqs(struct workqueue_struct *wq)
 #else
 	bool percpu = false;
 #endif
+	unsigned int cpu;
 
-	if (percpu)
+	if (wq->flags & WQ_UNBOUND) {
+		if (!wq->cpu_wq.unbound)
+			return;
+		for_each_cwq_cpu(cpu, wq)
+			free_single_cwq(wq->cpu_wq.unbound[cpu - WORK_CPU_UNBOUND]);
+		kfree(wq->cpu_wq.unbound);
+	} else if (percpu)
 		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
-	}
+	else
+		free_single_cwq(wq->cpu_wq.single);
 }
 
+
 static int wq_clamp_max_active(int max_active, unsigned int flags,
 			       const char *name)
 {
@@ -2756,6 +3235,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 	if (alloc_cwqs(wq) < 0)
 		goto err;
 
+	if (flags & WQ_UNBOUND) {
+		if (!alloc_cpumask_var(&wq->unbound_cpumask, GFP_KERNEL))
+			goto err;
+		cpumask_copy(wq->unbound_cpumask, cpu_possible_mask);
+		wq_update_unbound_nodes(wq);
+	}
+
 	for_each_cwq_cpu(cpu, wq) {
 		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -2802,10 +3288,15 @@ struct workqueue_struct *__alloc_workqueue_key(const char *name,
 
 	spin_unlock(&workqueue_lock);
 
+	if (flags & WQ_UNBOUND)
+		wq_sysfs_register(wq);
+
 	return wq;
 err:
 	if (wq) {
 		free_cwqs(wq);
+		if (flags & WQ_UNBOUND)
+			free_cpumask_var(wq->unbound_cpumask);
 		free_mayday_mask(wq->mayday_mask);
 		kfree(wq->rescuer);
 		kfree(wq);
@@ -2826,6 +3317,8 @@ void destroy_workqueue(struct workqueue_struct *wq)
 
 	flush_workqueue(wq);
 
+	wq_sysfs_unregister(wq);
+
 	/*
 	 * wq list is used to freeze wq, remove from list after
 	 * flushing is complete in case freeze races us.
@@ -2851,6 +3344,8 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	}
 
 	free_cwqs(wq);
+	if (wq->flags & WQ_UNBOUND)
+		free_cpumask_var(wq->unbound_cpumask);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
@@ -2905,7 +3400,11 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_UNBOUND)
+		cpu = unbound_queue_cpu(cpu, wq);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3299,6 +3798,7 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 		break;
 
 	case CPU_POST_DEAD:
+		atomic_inc(&wq_attrs_gen);
 		gcwq->trustee_state = TRUSTEE_BUTCHER;
 		/* fall through */
 	case CPU_UP_CANCELED:
@@ -3308,6 +3808,8 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 
 	case CPU_DOWN_FAILED:
 	case CPU_ONLINE:
+		/* unbound workers may run on the cpu again */
+		atomic_inc(&wq_attrs_gen);
 		gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		if (gcwq->trustee_state != TRUSTEE_DONE) {
 			gcwq->trustee_state = TRUSTEE_RELEASE;
@@ -3522,6 +4024,178 @@ out_unlock:
 }
 #endif /* CONFIG_FREEZER */
 
+#ifdef CONFIG_WORKQUEUE_STATS
+/*
+ * debugfs: workqueue/latency, workqueue/pools and workqueue/functions.
+ * The counters are read without the gcwq locks, they are only stats.
+ */
+static int wq_latency_show(struct seq_file *m, void *v)
+{
+	struct workqueue_struct *wq;
+	unsigned int cpu;
+	int i;
+
+	spin_lock(&workqueue_lock);
+	list_for_each_entry(wq, &workqueues, list) {
+		unsigned long latency[WQ_STATS_LAT_SLOTS] = { };
+		unsigned long nr_executed = 0;
+		u64 max_latency = 0;
+
+		for_each_cwq_cpu(cpu, wq) {
+			struct cwq_stats *stats = &get_cwq(cpu, wq)->stats;
+
+			nr_executed += stats->nr_executed;
+			max_latency = max(max_latency, stats->max_latency);
+			for (i = 0; i < WQ_STATS_LAT_SLOTS; i++)
+				latency[i] += stats->latency[i];
+		}
+
+		seq_printf(m, "%s: %lu executed, max latency %llu us\n",
+			   wq->name, nr_executed, (unsigned long long)
+			   div_u64(max_latency, NSEC_PER_USEC));
+		if (!nr_executed)
+			continue;
+		seq_printf(m, "%23s : count\n", "usecs");
+		for (i = 0; i < WQ_STATS_LAT_SLOTS; i++) {
+			if (!latency[i])
+				continue;
+			if (i == WQ_STATS_LAT_SLOTS - 1)
+				seq_printf(m, "%10lu -> ...      : %lu\n",
+					   1UL << (i - 1), latency[i]);
+			else
+				seq_printf(m, "%10lu -> %-10lu : %lu\n",
+					   i ? 1UL << (i - 1) : 0,
+					   (1UL << i) - 1, latency[i]);
+		}
+	}
+	spin_unlock(&workqueue_lock);
+	return 0;
+}
+
+static int wq_pools_show(struct seq_file *m, void *v)
+{
+	unsigned int cpu;
+
+	seq_printf(m, "%7s %7s %7s %7s %7s %10s %10s %10s\n", "pool",
+		   "workers", "idle", "running", "max", "created",
+		   "destroyed", "fn_dropped");
+	for_each_gcwq_cpu(cpu) {
+		struct global_cwq *gcwq = get_gcwq(cpu);
+		struct gcwq_stats *stats = &gcwq->stats;
+
+		if (gcwq_cpu_unbound(cpu))
+			seq_printf(m, "    u%-2u", cpu - WORK_CPU_UNBOUND);
+		else
+			seq_printf(m, "%7u", cpu);
+		seq_printf(m, " %7d %7d %7d %7d %10lu %10lu %10lu\n",
+			   gcwq->nr_workers, gcwq->nr_idle,
+			   atomic_read(get_gcwq_nr_running(cpu)),
+			   stats->max_workers, stats->nr_created,
+			   stats->nr_destroyed, stats->nr_fn_dropped);
+	}
+	return 0;
+}
+
+static int wq_fn_cmp_func(const void *a, const void *b)
+{
+	const struct wq_fn_stat *l = a, *r = b;
+
+	if (l->func == r->func)
+		return 0;
+	return (unsigned long)l->func < (unsigned long)r->func ? -1 : 1;
+}
+
+static int wq_fn_cmp_cpu_time(const void *a, const void *b)
+{
+	const struct wq_fn_stat *l = a, *r = b;
+
+	if (l->cpu_time == r->cpu_time)
+		return 0;
+	return l->cpu_time > r->cpu_time ? -1 : 1;
+}
+
+/* the work functions of all the gcwqs, by decreasing cpu time */
+static int wq_functions_show(struct seq_file *m, void *v)
+{
+	struct wq_fn_stat *fns;
+	unsigned int cpu;
+	int i, n = 0, nr = 0;
+
+	fns = vmalloc((nr_cpu_ids + 1) * WQ_STATS_FN_SIZE * sizeof(*fns));
+	if (!fns)
+		return -ENOMEM;
+
+	for_each_gcwq_cpu(cpu) {
+		struct global_cwq *gcwq = get_gcwq(cpu);
+
+		spin_lock_irq(&gcwq->lock);
+		for (i = 0; i < WQ_STATS_FN_SIZE; i++)
+			if (gcwq->stats.fn[i].func)
+				fns[n++] = gcwq->stats.fn[i];
+		spin_unlock_irq(&gcwq->lock);
+	}
+
+	/* merge the entries of a function on different gcwqs */
+	sort(fns, n, sizeof(*fns), wq_fn_cmp_func, NULL);
+	for (i = 0; i < n; i++) {
+		if (nr && fns[nr - 1].func == fns[i].func) {
+			fns[nr - 1].nr_executed += fns[i].nr_executed;
+			fns[nr - 1].cpu_time += fns[i].cpu_time;
+			fns[nr - 1].max_cpu_time = max(fns[nr - 1].max_cpu_time,
+						       fns[i].max_cpu_time);
+		} else
+			fns[nr++] = fns[i];
+	}
+	sort(fns, nr, sizeof(*fns), wq_fn_cmp_cpu_time, NULL);
+
+	seq_printf(m, "%15s %12s %12s  %s\n", "cpu time (us)", "executed",
+		   "max (us)", "function");
+	for (i = 0; i < nr; i++)
+		seq_printf(m, "%15llu %12lu %12llu  %pf\n",
+			   (unsigned long long)
+			   div_u64(fns[i].cpu_time, NSEC_PER_USEC),
+			   fns[i].nr_executed, (unsigned long long)
+			   div_u64(fns[i].max_cpu_time, NSEC_PER_USEC),
+			   fns[i].func);
+
+	vfree(fns);
+	return 0;
+}
+
+#define WQ_STATS_FOPS(name)						\
+static int wq_##name##_open(struct inode *inode, struct file *file)	\
+{									\
+	return single_open(file, wq_##name##_show, NULL);		\
+}									\
+									\
+static const struct file_operations wq_##name##_fops = {		\
+	.open		= wq_##name##_open,				\
+	.read		= seq_read,					\
+	.llseek		= seq_lseek,					\
+	.release	= single_release,				\
+}
+
+WQ_STATS_FOPS(latency);
+WQ_STATS_FOPS(pools);
+WQ_STATS_FOPS(functions);
+
+static int __init wq_stats_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("workqueue", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	debugfs_create_file("latency", 0444, dir, NULL, &wq_latency_fops);
+	debugfs_create_file("pools", 0444, dir, NULL, &wq_pools_fops);
+	debugfs_create_file("functions", 0444, dir, NULL,
+			    &wq_functions_fops);
+	return 0;
+}
+late_initcall(wq_stats_init);
+#endif /* CONFIG_WORKQUEUE_STATS */
+
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
@@ -3529,6 +4203,13 @@ static int __init init_workqueues(void)
 
 	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
 
+	/* allocate the unbound gcwqs, on the memory of their node */
+	for_each_node(i) {
+		unbound_global_cwq[i] = kzalloc_node(sizeof(struct global_cwq),
+					GFP_KERNEL, node_online(i) ? i : -1);
+		BUG_ON(!unbound_global_cwq[i]);
+	}
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3536,7 +4217,7 @@ static int __init init_workqueues(void)
 		spin_lock_init(&gcwq->lock);
 		INIT_LIST_HEAD(&gcwq->worklist);
 		gcwq->cpu = cpu;
-		if (cpu == WORK_CPU_UNBOUND)
+		if (gcwq_cpu_unbound(cpu))
 			gcwq->flags |= GCWQ_DISASSOCIATED;
 
 		INIT_LIST_HEAD(&gcwq->idle_list);
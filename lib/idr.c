@@ -34,9 +34,15 @@
 #include <linux/err.h>
 #include <linux/string.h>
 #include <linux/idr.h>
+#include <linux/percpu.h>
+#include <linux/hardirq.h>
 
 static struct kmem_cache *idr_layer_cache;
 
+/* The layers idr_preload() put aside for idr_alloc(), per cpu */
+static DEFINE_PER_CPU(struct idr_layer *, idr_preload_head);
+static DEFINE_PER_CPU(int, idr_preload_cnt);
+
 static struct idr_layer *get_from_free_list(struct idr *idp)
 {
 	struct idr_layer *p;
@@ -52,6 +58,45 @@ static struct idr_layer *get_from_free_list(struct idr *idp)
 	return(p);
 }
 
+/**
+ * idr_layer_alloc - get a new layer
+ * @gfp_mask: allocation mask
+ * @layer_idr: the idr of the idr_pre_get() free list, or %NULL
+ *
+ * For idr_get_new*(), which can only use what idr_pre_get() put on the
+ * free list of @layer_idr.  Otherwise, for idr_alloc(), the layer is
+ * allocated with @gfp_mask, falling back to those idr_preload() left in
+ * the buffer of this cpu: no lock shared with other allocations.
+ */
+static struct idr_layer *idr_layer_alloc(gfp_t gfp_mask,
+					 struct idr *layer_idr)
+{
+	struct idr_layer *new;
+
+	if (layer_idr)
+		return get_from_free_list(layer_idr);
+
+	new = kmem_cache_zalloc(idr_layer_cache, gfp_mask | __GFP_NOWARN);
+	if (new)
+		return new;
+
+	/* the buffer is only filled, and so only used, in process context */
+	if (!in_interrupt()) {
+		preempt_disable();
+		new = __this_cpu_read(idr_preload_head);
+		if (new) {
+			__this_cpu_write(idr_preload_head, new->ary[0]);
+			__this_cpu_dec(idr_preload_cnt);
+			new->ary[0] = NULL;
+		}
+		preempt_enable();
+		if (new)
+			return new;
+	}
+
+	return kmem_cache_zalloc(idr_layer_cache, gfp_mask);
+}
+
 static void idr_layer_rcu_free(struct rcu_head *head)
 {
 	struct idr_layer *layer;
@@ -130,7 +175,8 @@ int idr_pre_get(struct idr *idp, gfp_t gfp_mask)
 }
 EXPORT_SYMBOL(idr_pre_get);
 
-static int sub_alloc(struct idr *idp, int *starting_id, struct idr_layer **pa)
+static int sub_alloc(struct idr *idp, int *starting_id, struct idr_layer **pa,
+		     gfp_t gfp_mask, struct idr *layer_idr)
 {
 	int n, m, sh;
 	struct idr_layer *p, *new;
@@ -184,7 +230,7 @@ static int sub_alloc(struct idr *idp, int *starting_id, struct idr_layer **pa)
 		 * Create the layer below if it is missing.
 		 */
 		if (!p->ary[m]) {
-			new = get_from_free_list(idp);
+			new = idr_layer_alloc(gfp_mask, layer_idr);
 			if (!new)
 				return -1;
 			new->layer = l-1;
@@ -200,7 +246,8 @@ static int sub_alloc(struct idr *idp, int *starting_id, struct idr_layer **pa)
 }
 
 static int idr_get_empty_slot(struct idr *idp, int starting_id,
-			      struct idr_layer **pa)
+			      struct idr_layer **pa, gfp_t gfp_mask,
+			      struct idr *layer_idr)
 {
 	struct idr_layer *p, *new;
 	int layers, v, id;
@@ -211,7 +258,7 @@ build_up:
 	p = idp->top;
 	layers = idp->layers;
 	if (unlikely(!p)) {
-		if (!(p = get_from_free_list(idp)))
+		if (!(p = idr_layer_alloc(gfp_mask, layer_idr)))
 			return -1;
 		p->layer = 0;
 		layers = 1;
@@ -230,7 +277,7 @@ build_up:
 			p->layer++;
 			continue;
 		}
-		if (!(new = get_from_free_list(idp))) {
+		if (!(new = idr_layer_alloc(gfp_mask, layer_idr))) {
 			/*
 			 * The allocation failed.  If we built part of
 			 * the structure tear it down.
@@ -254,28 +301,31 @@ build_up:
 	}
 	rcu_assign_pointer(idp->top, p);
 	idp->layers = layers;
-	v = sub_alloc(idp, &id, pa);
+	v = sub_alloc(idp, &id, pa, gfp_mask, layer_idr);
 	if (v == IDR_NEED_TO_GROW)
 		goto build_up;
 	return(v);
 }
 
+/*
+ * Install the user pointer in the empty slot found and mark it full
+ */
+static void idr_fill_slot(void *ptr, int id, struct idr_layer **pa)
+{
+	rcu_assign_pointer(pa[0]->ary[id & IDR_MASK],
+			   (struct idr_layer *)ptr);
+	pa[0]->count++;
+	idr_mark_full(pa, id);
+}
+
 static int idr_get_new_above_int(struct idr *idp, void *ptr, int starting_id)
 {
 	struct idr_layer *pa[MAX_LEVEL];
 	int id;
 
-	id = idr_get_empty_slot(idp, starting_id, pa);
-	if (id >= 0) {
-		/*
-		 * Successfully found an empty slot.  Install the user
-		 * pointer and mark the slot full.
-		 */
-		rcu_assign_pointer(pa[0]->ary[id & IDR_MASK],
-				(struct idr_layer *)ptr);
-		pa[0]->count++;
-		idr_mark_full(pa, id);
-	}
+	id = idr_get_empty_slot(idp, starting_id, pa, 0, idp);
+	if (id >= 0)
+		idr_fill_slot(ptr, id, pa);
 
 	return id;
 }
@@ -343,6 +393,98 @@ int idr_get_new(struct idr *idp, void *ptr, int *id)
 }
 EXPORT_SYMBOL(idr_get_new);
 
+/**
+ * idr_preload - preload for idr_alloc()
+ * @gfp_mask: allocation mask to use for preloading
+ *
+ * Fills the buffer of this cpu with enough layers for any one
+ * idr_alloc(), and returns with preemption disabled: the caller takes
+ * its lock, calls idr_alloc() with a @gfp_mask that does not sleep and
+ * drops the lock, then calls idr_preload_end().  An allocation failure
+ * is not reported here, idr_alloc() will fail if the layers it needs
+ * can not be had either.
+ *
+ *	idr_preload(GFP_KERNEL);
+ *	spin_lock(lock);
+ *
+ *	id = idr_alloc(idr, ptr, start, end, GFP_NOWAIT);
+ *
+ *	spin_unlock(lock);
+ *	idr_preload_end();
+ *	if (id < 0)
+ *		error;
+ */
+void idr_preload(gfp_t gfp_mask)
+{
+	/*
+	 * Interrupts never take from the buffer, so with preemption left
+	 * disabled the layers stay there for the caller's idr_alloc().
+	 */
+	WARN_ON_ONCE(in_interrupt());
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	preempt_disable();
+
+	/*
+	 * Allocating with preemption enabled, the task may move to
+	 * another cpu; it then just tops up the buffer of that one.
+	 */
+	while (__this_cpu_read(idr_preload_cnt) < IDR_FREE_MAX) {
+		struct idr_layer *new;
+
+		preempt_enable();
+		new = kmem_cache_zalloc(idr_layer_cache, gfp_mask);
+		preempt_disable();
+		if (!new)
+			break;
+
+		new->ary[0] = __this_cpu_read(idr_preload_head);
+		__this_cpu_write(idr_preload_head, new);
+		__this_cpu_inc(idr_preload_cnt);
+	}
+}
+EXPORT_SYMBOL(idr_preload);
+
+/**
+ * idr_alloc - allocate a new id
+ * @idp: idr handle
+ * @ptr: pointer to be associated with the new id
+ * @start: the minimum id (inclusive)
+ * @end: the maximum id (exclusive), <= 0 for the maximum
+ * @gfp_mask: memory allocation flags
+ *
+ * Allocates an unused id in [@start, @end) and associates it with @ptr,
+ * the layers it needs coming from @gfp_mask allocations, or from the
+ * buffer of idr_preload().  Needs no idr_pre_get().  The caller still
+ * serializes it against the other changes to @idp, as for idr_get_new().
+ *
+ * Returns the new id, -ENOMEM if memory could not be had, or -ENOSPC
+ * if there is no free id in the range.
+ */
+int idr_alloc(struct idr *idp, void *ptr, int start, int end, gfp_t gfp_mask)
+{
+	int max = end > 0 ? end - 1 : MAX_ID_MASK;
+	struct idr_layer *pa[MAX_LEVEL];
+	int id;
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (WARN_ON_ONCE(start < 0))
+		return -EINVAL;
+	if (unlikely(max < start))
+		return -ENOSPC;
+
+	id = idr_get_empty_slot(idp, start, pa, gfp_mask, NULL);
+	if (unlikely(id < 0))
+		return id == -1 ? -ENOMEM : -ENOSPC;
+	if (unlikely(id > max))
+		return -ENOSPC;
+
+	idr_fill_slot(ptr, id, pa);
+	return id;
+}
+EXPORT_SYMBOL(idr_alloc);
+
 static void idr_remove_warning(int id)
 {
 	printk(KERN_WARNING
@@ -781,7 +923,7 @@ int ida_get_new_above(struct ida *ida, int starting_id, int *p_id)
 
  restart:
 	/* get vacant slot */
-	t = idr_get_empty_slot(&ida->idr, idr_id, pa);
+	t = idr_get_empty_slot(&ida->idr, idr_id, pa, 0, &ida->idr);
 	if (t < 0)
 		return _idr_rc_to_errno(t);
 
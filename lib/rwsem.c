@@ -7,6 +7,7 @@
 #include <linux/sched.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <trace/events/lock.h>
 
 /*
  * Initialize an rwsem:
@@ -176,7 +177,10 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	struct rwsem_waiter waiter;
 	struct task_struct *tsk = current;
 	signed long count;
+	int waiters;
 
+	trace_contention_begin(sem, flags & RWSEM_WAITING_FOR_WRITE ?
+			       LCB_F_WRITE : LCB_F_READ);
 	set_task_state(tsk, TASK_UNINTERRUPTIBLE);
 
 	/* set up my own style of waitqueue */
@@ -185,7 +189,8 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	waiter.flags = flags;
 	get_task_struct(tsk);
 
-	if (list_empty(&sem->wait_list))
+	waiters = !list_empty(&sem->wait_list);
+	if (!waiters)
 		adjustment += RWSEM_WAITING_BIAS;
 	list_add_tail(&waiter.list, &sem->wait_list);
 
@@ -200,12 +205,15 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	 * locks that were queued ahead of us. */
 	if (count == RWSEM_WAITING_BIAS)
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_NO_ACTIVE);
-	else if (count > RWSEM_WAITING_BIAS &&
-		 adjustment == -RWSEM_ACTIVE_WRITE_BIAS)
+	else if (count > RWSEM_WAITING_BIAS && waiters &&
+		 (flags & RWSEM_WAITING_FOR_WRITE))
 		sem = __rwsem_do_wake(sem, RWSEM_WAKE_READ_OWNED);
 
 	spin_unlock_irq(&sem->wait_lock);
 
+	if (waiter.task)
+		lock_slept(&sem->dep_map);
+
 	/* wait to be given the lock */
 	for (;;) {
 		if (!waiter.task)
@@ -215,6 +223,7 @@ rwsem_down_failed_common(struct rw_semaphore *sem,
 	}
 
 	tsk->state = TASK_RUNNING;
+	trace_contention_end(sem, 0);
 
 	return sem;
 }
@@ -229,6 +238,85 @@ rwsem_down_read_failed(struct rw_semaphore *sem)
 					-RWSEM_ACTIVE_READ_BIAS);
 }
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Optimistic spinning for writers: while the write owner is running, it
+ * is likely to release the rwsem soon, so rather than sleeping, spin and
+ * try to take it as soon as it is free.
+ *
+ * We can only take it while nobody holds it and nobody waits for it:
+ * once there are waiters, __rwsem_do_wake() hands the rwsem over to the
+ * front of the queue, and a writer must queue up too.  Readers are not
+ * tracked, so we do not spin on a read-owned rwsem either.
+ */
+static int rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	struct task_struct *owner;
+	rwsem_count_t count;
+	int taken = 0;
+
+	/*
+	 * If we own the BKL, then don't spin. The owner of the rwsem
+	 * might be waiting on us to release the BKL.
+	 */
+	if (unlikely(current->lock_depth >= 0))
+		return 0;
+
+	preempt_disable();
+	for (;;) {
+		/*
+		 * If there's an owner, wait for it to either release the
+		 * rwsem or go to sleep.
+		 */
+		owner = ACCESS_ONCE(sem->owner);
+		if (owner && !rwsem_spin_on_owner(sem, owner))
+			break;
+
+		count = ACCESS_ONCE(sem->count);
+		if (count == RWSEM_UNLOCKED_VALUE &&
+		    cmpxchg(&sem->count, RWSEM_UNLOCKED_VALUE,
+			    RWSEM_ACTIVE_WRITE_BIAS) == RWSEM_UNLOCKED_VALUE) {
+			taken = 1;
+			break;
+		}
+
+		/*
+		 * Give up if there are waiters or readers.  When there is
+		 * no owner, we might also have preempted a writer between
+		 * acquiring the rwsem and setting the owner field: if we
+		 * are an RT task, that will live-lock.
+		 */
+		if (count != RWSEM_UNLOCKED_VALUE &&
+		    count != RWSEM_ACTIVE_WRITE_BIAS)
+			break;
+		if (!owner && (need_resched() || rt_task(current)))
+			break;
+
+		cpu_relax();
+	}
+	preempt_enable();
+
+	return taken;
+}
+
+/*
+ * wait for the write lock to be granted
+ */
+asmregparm struct rw_semaphore __sched *
+rwsem_down_write_failed(struct rw_semaphore *sem)
+{
+	/* we are no longer actively locking while we spin */
+	rwsem_atomic_add(-RWSEM_ACTIVE_WRITE_BIAS, sem);
+
+	trace_contention_begin(sem, LCB_F_WRITE | LCB_F_SPIN);
+	if (rwsem_optimistic_spin(sem)) {
+		trace_contention_end(sem, 0);
+		return sem;
+	}
+
+	return rwsem_down_failed_common(sem, RWSEM_WAITING_FOR_WRITE, 0);
+}
+#else
 /*
  * wait for the write lock to be granted
  */
@@ -238,6 +326,7 @@ rwsem_down_write_failed(struct rw_semaphore *sem)
 	return rwsem_down_failed_common(sem, RWSEM_WAITING_FOR_WRITE,
 					-RWSEM_ACTIVE_WRITE_BIAS);
 }
+#endif
 
 /*
  * handle waking up a waiter on the semaphore
@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 /*
@@ -37,6 +39,7 @@ struct compact_control {
 
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
+	bool background;		/* kcompactd: stop once order is met */
 	struct zone *zone;
 };
 
@@ -349,6 +352,9 @@ static int compact_finished(struct zone *zone,
 	if (fatal_signal_pending(current))
 		return COMPACT_PARTIAL;
 
+	if (cc->background && kthread_should_stop())
+		return COMPACT_PARTIAL;
+
 	/* Compaction run completes if the migrate and free scanner meet */
 	if (cc->free_pfn <= cc->migrate_pfn)
 		return COMPACT_COMPLETE;
@@ -360,6 +366,13 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	/*
+	 * kcompactd is not allocating a page of any particular migratetype,
+	 * it only has to make the order available again.
+	 */
+	if (cc->background)
+		return COMPACT_PARTIAL;
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		/* Job done if page is free of the right migratetype */
@@ -511,6 +524,157 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	return rc;
 }
 
+/*
+ * Background compaction: a kcompactd thread per node compacts zones whose
+ * free memory is fragmented for a costly order, so that the allocations
+ * which cannot compact for themselves (atomic, GFP_NOFS) find free
+ * high-order pages the next time around instead of failing or stalling.
+ */
+
+/*
+ * Returns true if compacting the zone for this order is worthwhile: there
+ * is enough free memory for migration to make progress, but the failure
+ * would be due to fragmentation rather than to a lack of memory.
+ */
+static bool kcompactd_zone_suitable(struct zone *zone, int order)
+{
+	unsigned long watermark;
+	int fragindex;
+
+	if (!populated_zone(zone))
+		return false;
+
+	watermark = low_wmark_pages(zone) + (2UL << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return false;
+
+	/* Watermark is already met for the order, nothing to do */
+	if (zone_watermark_ok(zone, order, low_wmark_pages(zone), 0, 0))
+		return false;
+
+	fragindex = fragmentation_index(zone, order);
+	return fragindex > sysctl_extfrag_threshold;
+}
+
+/*
+ * A high-order allocation entered the slow path, wake the node's kcompactd
+ * if the zone is fragmented for that order.  Called from atomic context.
+ */
+void wakeup_kcompactd(struct zone *zone, int order)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+
+	if (order < PAGE_ALLOC_COSTLY_ORDER)
+		return;
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+	if (!kcompactd_zone_suitable(zone, order))
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat, int order)
+{
+	int zoneid;
+
+	lru_add_drain();
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.background = true,
+			.zone = zone,
+		};
+
+		if (kthread_should_stop())
+			return;
+		if (!kcompactd_zone_suitable(zone, order))
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		count_vm_event(KCOMPACTD_WAKE);
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		int order;
+
+		wait_event_freezable(pgdat->kcompactd_wait,
+				     pgdat->kcompactd_max_order ||
+				     kthread_should_stop());
+
+		order = pgdat->kcompactd_max_order;
+		pgdat->kcompactd_max_order = 0;
+		if (order)
+			kcompactd_do_work(pgdat, order);
+	}
+	return 0;
+}
+
+/*
+ * Called by init and node hot-add to start the node's kcompactd.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	struct task_struct *tsk;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	tsk = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(tsk)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		return PTR_ERR(tsk);
+	}
+	pgdat->kcompactd = tsk;
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
 
 /* Compact all zones within a node */
 static int compact_node(int nid)
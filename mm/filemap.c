@@ -393,6 +393,8 @@ EXPORT_SYMBOL(filemap_write_and_wait_range);
  *
  * This function is used to add a page to the pagecache. It must be locked.
  * This function does not add the page to the LRU.  The caller must do that.
+ *
+ * Returns -EEXIST if a page is already cached at @offset.
  */
 int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		pgoff_t offset, gfp_t gfp_mask)
@@ -401,6 +403,18 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 
 	VM_BUG_ON(!PageLocked(page));
 
+	/*
+	 * Racing readahead and faults on the same range commonly find the
+	 * slot already populated.  Check that locklessly first so the loser
+	 * neither charges the page nor bounces mapping->tree_lock away from
+	 * the tasks inserting at other offsets of the file.
+	 */
+	rcu_read_lock();
+	error = radix_tree_lookup(&mapping->page_tree, offset) ? -EEXIST : 0;
+	rcu_read_unlock();
+	if (error)
+		goto out;
+
 	error = mem_cgroup_cache_charge(page, current->mm,
 					gfp_mask & GFP_RECLAIM_MASK);
 	if (error)
@@ -533,6 +547,66 @@ void add_page_wait_queue(struct page *page, wait_queue_t *waiter)
 }
 EXPORT_SYMBOL_GPL(add_page_wait_queue);
 
+/*
+ * Wake function for a kiocb queued by lock_page_async(): once the page
+ * lock bit is clear, drop off the wait queue and kick the retry.
+ */
+static int aio_wake_page_function(wait_queue_t *wait, unsigned mode,
+				  int sync, void *arg)
+{
+	struct wait_bit_key *key = arg;
+	struct wait_bit_queue *wait_bit =
+		container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+
+	if (wait_bit->key.flags != key->flags ||
+	    wait_bit->key.bit_nr != key->bit_nr ||
+	    test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+/*
+ * lock_page_async - lock a page without sleeping on behalf of an aio read
+ *
+ * Returns 0 with the page locked, or -EIOCBRETRY if the page is locked by
+ * someone else. In the latter case, unless @desc already holds data for
+ * the caller to return, @iocb has been queued to be kicked when the page
+ * gets unlocked.
+ */
+static int lock_page_async(struct page *page, struct kiocb *iocb,
+			   read_descriptor_t *desc)
+{
+	struct address_space *mapping = page->mapping;
+	wait_queue_head_t *q = page_waitqueue(page);
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+
+	for (;;) {
+		if (trylock_page(page))
+			return 0;
+		if (desc->written)
+			return -EIOCBRETRY;
+
+		wait->key.flags = &page->flags;
+		wait->key.bit_nr = PG_locked;
+		init_waitqueue_func_entry(&wait->wait, aio_wake_page_function);
+		add_wait_queue(q, &wait->wait);
+		/* pairs with the barrier in unlock_page() */
+		smp_mb();
+		if (PageLocked(page))
+			break;
+		remove_wait_queue(q, &wait->wait);
+	}
+
+	/* get the read going, nobody is going to wait on it synchronously */
+	if (mapping && mapping->a_ops->sync_page)
+		mapping->a_ops->sync_page(page);
+	return -EIOCBRETRY;
+}
+
 /**
  * unlock_page - unlock a locked page
  * @page: the page
@@ -962,15 +1036,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @iocb:	asynchronous kiocb, or %NULL to block for the data
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * With @iocb, the read never sleeps on a locked page: it stops early and
+ * reports -EIOCBRETRY in desc->error, and the aio core retries it once
+ * the page has been unlocked.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct kiocb *iocb)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1087,7 +1167,10 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		if (iocb)
+			error = lock_page_async(page, iocb, desc);
+		else
+			error = lock_page_killable(page);
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -1124,7 +1207,10 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			if (iocb)
+				error = lock_page_async(page, iocb, desc);
+			else
+				error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -1275,6 +1361,7 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		unsigned long nr_segs, loff_t pos)
 {
 	struct file *filp = iocb->ki_filp;
+	struct kiocb *aiocb = is_sync_kiocb(iocb) ? NULL : iocb;
 	ssize_t retval;
 	unsigned long seg = 0;
 	size_t count;
@@ -1347,7 +1434,12 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		/*
+		 * An aio read may only queue its kiocb for a retry while it
+		 * has nothing to report yet, see lock_page_async().
+		 */
+		do_generic_file_read(filp, ppos, &desc, file_read_actor,
+				     retval ? NULL : aiocb);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -1355,6 +1447,9 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		}
 		if (desc.count > 0)
 			break;
+		/* aio_rw_vect_retry() comes back for the other segments */
+		if (aiocb)
+			break;
 	}
 out:
 	return retval;
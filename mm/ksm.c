@@ -23,7 +23,6 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -127,6 +126,8 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @volatility: number of successive passes that found the checksum changed
+ * @skip_passes: passes left to skip before the page is looked at again
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -137,6 +138,8 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned short volatility;	/* passes with a changed checksum */
+	unsigned short skip_passes;	/* passes left before next compare */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -181,6 +184,15 @@ static unsigned long ksm_pages_unshared;
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
 
+/* The number of times a volatile page was skipped without comparing */
+static unsigned long ksm_pages_skipped;
+
+/*
+ * A page whose checksum changed on n consecutive passes is left alone for
+ * the next 2^n - 1 passes, up to this many.
+ */
+#define KSM_MAX_VOLATILITY	3
+
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
@@ -667,11 +679,20 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum only serves to notice pages that change between passes:
+ * identity is always established by memcmp_pages() before merging.  So
+ * sample one word in every four rather than hashing the full page, to
+ * keep the pass cheap while still touching every cacheline.
+ */
 static u32 calc_checksum(struct page *page)
 {
-	u32 checksum;
-	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	u32 *addr = kmap_atomic(page, KM_USER0);
+	u32 checksum = 17;
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(u32); i += 4)
+		checksum = (checksum ^ addr[i]) * 0x01000193;
 	kunmap_atomic(addr, KM_USER0);
 	return checksum;
 }
@@ -1140,6 +1161,13 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 
 	remove_rmap_item_from_tree(rmap_item);
 
+	/* Recently volatile: don't even bother looking this pass */
+	if (rmap_item->skip_passes) {
+		rmap_item->skip_passes--;
+		ksm_pages_skipped++;
+		return;
+	}
+
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
 	if (kpage) {
@@ -1166,8 +1194,12 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
+		if (rmap_item->volatility < KSM_MAX_VOLATILITY)
+			rmap_item->volatility++;
+		rmap_item->skip_passes = (1 << rmap_item->volatility) - 1;
 		return;
 	}
+	rmap_item->volatility = 0;
 
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
@@ -1890,6 +1922,13 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(pages_volatile);
 
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
@@ -1905,6 +1944,7 @@ static struct attribute *ksm_attrs[] = {
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
+	&pages_skipped_attr.attr,
 	&full_scans_attr.attr,
 	NULL,
 };
@@ -188,10 +188,9 @@ static void mem_cgroup_oom_notify(struct mem_cgroup *mem);
  * statistics based on the statistics developed by Rik Van Riel for clock-pro,
  * to help the administrator determine what knobs to tune.
  *
- * TODO: Add a water mark for the memory controller. Reclaim will begin when
- * we hit the water mark. May be even add a low water mark, such that
- * no reclaim occurs from a cgroup at it's low water mark, this is
- * a feature that will be implemented much later in the future.
+ * Background reclaim starts when usage rises above the high watermark,
+ * limit - high_wmark_distance, and goes on until usage is back below the
+ * low watermark, limit - low_wmark_distance.
  */
 struct mem_cgroup {
 	struct cgroup_subsys_state css;
@@ -254,6 +253,23 @@ struct mem_cgroup {
 	 * percpu counter.
 	 */
 	struct mem_cgroup_stat_cpu *stat;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	/*
+	 * the counter to account for slab objects of SLAB_ACCOUNT caches,
+	 * and this cgroup's own share of them per cache.
+	 */
+	struct res_counter kmem;
+	atomic_long_t kmem_cache_usage[MEM_CGROUP_KMEM_CACHES];
+#endif
+	/* the last reference may be dropped where it cannot be freed */
+	struct work_struct free_work;
+	/*
+	 * Watermarks for background reclaim, as distances below res.limit.
+	 * Zero low_wmark_distance disables background reclaim.
+	 */
+	unsigned long long high_wmark_distance;
+	unsigned long long low_wmark_distance;
+	struct work_struct bg_reclaim_work;
 };
 
 /* Stuffs for move charges at task migration. */
@@ -322,11 +338,15 @@ enum charge_type {
 #define _MEM			(0)
 #define _MEMSWAP		(1)
 #define _OOM_TYPE		(2)
+#define _KMEM			(3)
 #define MEMFILE_PRIVATE(x, val)	(((x) << 16) | (val))
 #define MEMFILE_TYPE(val)	(((val) >> 16) & 0xffff)
 #define MEMFILE_ATTR(val)	((val) & 0xffff)
 /* Used for OOM nofiier */
 #define OOM_CONTROL		(0)
+/* for background reclaim watermarks */
+#define WMARK_HIGH		(0)
+#define WMARK_LOW		(1)
 
 /*
  * Reclaim flags for mem_cgroup_hierarchical_reclaim
@@ -342,6 +362,7 @@ static void mem_cgroup_get(struct mem_cgroup *mem);
 static void mem_cgroup_put(struct mem_cgroup *mem);
 static struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *mem);
 static void drain_all_stock_async(void);
+static void mem_cgroup_check_wmark(struct mem_cgroup *mem);
 
 static struct mem_cgroup_per_zone *
 mem_cgroup_zoneinfo(struct mem_cgroup *mem, int nid, int zid)
@@ -612,6 +633,7 @@ static void memcg_check_events(struct mem_cgroup *mem, struct page *page)
 	/* threshold event is triggered in finer grain than soft limit */
 	if (unlikely(__memcg_event_check(mem, THRESHOLDS_EVENTS_THRESH))) {
 		mem_cgroup_threshold(mem);
+		mem_cgroup_check_wmark(mem);
 		if (unlikely(__memcg_event_check(mem, SOFTLIMIT_EVENTS_THRESH)))
 			mem_cgroup_update_tree(mem, page);
 	}
@@ -1322,6 +1344,109 @@ static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
 	return total;
 }
 
+/*
+ * Background reclaim: like kswapd for a zone, a worker frees pages from a
+ * memcg above its high watermark until usage is below the low watermark,
+ * so that its tasks are not stalled in direct reclaim at the hard limit.
+ */
+static struct workqueue_struct *memcg_bg_reclaim_wq;
+
+static bool mem_cgroup_above_wmark(struct mem_cgroup *mem, int wmark)
+{
+	unsigned long long limit, distance;
+
+	if (!mem->low_wmark_distance)
+		return false;
+
+	limit = res_counter_read_u64(&mem->res, RES_LIMIT);
+	if (limit == RESOURCE_MAX)
+		return false;
+
+	if (wmark == WMARK_HIGH)
+		distance = mem->high_wmark_distance;
+	else
+		distance = mem->low_wmark_distance;
+	if (distance >= limit)
+		return true;
+
+	return res_counter_read_u64(&mem->res, RES_USAGE) > limit - distance;
+}
+
+static void mem_cgroup_check_wmark(struct mem_cgroup *mem)
+{
+	/* charges go to every ancestor: any of them may need reclaim */
+	for (; mem; mem = parent_mem_cgroup(mem)) {
+		if (!mem_cgroup_above_wmark(mem, WMARK_HIGH))
+			continue;
+		if (!memcg_bg_reclaim_wq || work_pending(&mem->bg_reclaim_work))
+			continue;
+		/* the reference is dropped by the worker */
+		if (!css_tryget(&mem->css))
+			continue;
+		if (!queue_work(memcg_bg_reclaim_wq, &mem->bg_reclaim_work))
+			css_put(&mem->css);
+	}
+}
+
+static void mem_cgroup_bg_reclaim(struct work_struct *work)
+{
+	struct mem_cgroup *mem = container_of(work, struct mem_cgroup,
+					      bg_reclaim_work);
+	unsigned long reclaimed = 0, nr_to_reclaim;
+	unsigned long long usage, limit, low;
+	int priority = DEF_PRIORITY;
+	struct mem_cgroup *victim;
+	bool first = true;
+
+	while (!css_is_removed(&mem->css) &&
+	       mem_cgroup_above_wmark(mem, WMARK_LOW)) {
+		victim = mem_cgroup_select_victim(mem);
+		if (victim == mem) {
+			/*
+			 * A whole pass over the hierarchy freed nothing:
+			 * scan harder, and give up like kswapd once even
+			 * priority 0 does not help.
+			 */
+			if (!first && !reclaimed) {
+				if (priority == DEF_PRIORITY)
+					drain_all_stock_async();
+				if (--priority < 0) {
+					css_put(&victim->css);
+					break;
+				}
+			}
+			first = false;
+			reclaimed = 0;
+		}
+		if (!mem_cgroup_local_usage(victim)) {
+			css_put(&victim->css);
+			continue;
+		}
+
+		usage = res_counter_read_u64(&mem->res, RES_USAGE);
+		limit = res_counter_read_u64(&mem->res, RES_LIMIT);
+		low = limit - min(limit, mem->low_wmark_distance);
+		nr_to_reclaim = usage > low ? (usage - low) >> PAGE_SHIFT : 0;
+
+		reclaimed += mem_cgroup_shrink_bg(victim, nr_to_reclaim,
+						  mem->memsw_is_minimum,
+						  get_swappiness(victim),
+						  priority);
+		css_put(&victim->css);
+		cond_resched();
+	}
+	css_put(&mem->css);
+}
+
+static int __init mem_cgroup_bg_reclaim_init(void)
+{
+	if (mem_cgroup_disabled())
+		return 0;
+	memcg_bg_reclaim_wq = create_workqueue("memcg_bgreclaim");
+	return memcg_bg_reclaim_wq ? 0 : -ENOMEM;
+}
+module_init(mem_cgroup_bg_reclaim_init);
+
 static int mem_cgroup_oom_lock_cb(struct mem_cgroup *mem, void *data)
 {
 	int *val = (int *)data;
@@ -1493,10 +1618,14 @@ done:
 }
 
 /*
- * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * size of first charge trial.  Every charge that misses the per cpu stock
+ * takes the res_counter lock of each level of the hierarchy, so the stock
+ * is refilled in chunks big enough to make that rare.  Uncharged pages go
+ * back to the stock of their cpu, up to CHARGE_STOCK_MAX.
  */
-#define CHARGE_SIZE	(32 * PAGE_SIZE)
+#define CHARGE_BATCH	64U
+#define CHARGE_SIZE	(CHARGE_BATCH * PAGE_SIZE)
+#define CHARGE_STOCK_MAX	(2 * CHARGE_SIZE)
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	int charge;
@@ -1525,6 +1654,30 @@ static bool consume_stock(struct mem_cgroup *mem)
 	return ret;
 }
 
+/*
+ * Try to give an uncharged page back to the stock of this cpu instead of
+ * to the res_counter.  Only possible if the stock caches the same cgroup
+ * and, since a drained stock uncharges memsw too, if memsw is uncharged
+ * along with res.
+ */
+static bool uncharge_to_stock(struct mem_cgroup *mem)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = false;
+
+	/* Somebody waits for this cgroup to go under its limit */
+	if (atomic_read(&mem->oom_lock) || in_interrupt())
+		return false;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (mem == stock->cached && stock->charge < CHARGE_STOCK_MAX) {
+		stock->charge += PAGE_SIZE;
+		ret = true;
+	}
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
 /*
  * Returns stocks cached in percpu to res_counter and reset cached information.
  */
@@ -2308,6 +2461,9 @@ __do_uncharge(struct mem_cgroup *mem, const enum charge_type ctype)
 		batch->memsw_bytes += PAGE_SIZE;
 	return;
 direct_uncharge:
+	if (uncharge_memsw == do_swap_account && !test_thread_flag(TIF_MEMDIE)
+	    && uncharge_to_stock(mem))
+		return;
 	res_counter_uncharge(&mem->res, PAGE_SIZE);
 	if (uncharge_memsw)
 		res_counter_uncharge(&mem->memsw, PAGE_SIZE);
@@ -3207,6 +3363,11 @@ static u64 mem_cgroup_read(struct cgroup *cont, struct cftype *cft)
 		else
 			val = res_counter_read_u64(&mem->memsw, name);
 		break;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	case _KMEM:
+		val = res_counter_read_u64(&mem->kmem, name);
+		break;
+#endif
 	default:
 		BUG();
 		break;
@@ -3239,6 +3400,10 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			break;
 		if (type == _MEM)
 			ret = mem_cgroup_resize_limit(memcg, val);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			ret = res_counter_set_limit(&memcg->kmem, val);
+#endif
 		else
 			ret = mem_cgroup_resize_memsw_limit(memcg, val);
 		break;
@@ -3303,12 +3468,20 @@ static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 	case RES_MAX_USAGE:
 		if (type == _MEM)
 			res_counter_reset_max(&mem->res);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			res_counter_reset_max(&mem->kmem);
+#endif
 		else
 			res_counter_reset_max(&mem->memsw);
 		break;
 	case RES_FAILCNT:
 		if (type == _MEM)
 			res_counter_reset_failcnt(&mem->res);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		else if (type == _KMEM)
+			res_counter_reset_failcnt(&mem->kmem);
+#endif
 		else
 			res_counter_reset_failcnt(&mem->memsw);
 		break;
@@ -3534,6 +3707,50 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_wmark_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	if (MEMFILE_ATTR(cft->private) == WMARK_HIGH)
+		return memcg->high_wmark_distance;
+	return memcg->low_wmark_distance;
+}
+
+static int mem_cgroup_wmark_write(struct cgroup *cgrp, struct cftype *cft,
+				  const char *buffer)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	unsigned long long val, high, low;
+	int ret;
+
+	if (mem_cgroup_is_root(memcg))	/* root has no limit */
+		return -EINVAL;
+
+	ret = res_counter_memparse_write_strategy(buffer, &val);
+	if (ret)
+		return ret;
+
+	cgroup_lock();
+	high = memcg->high_wmark_distance;
+	low = memcg->low_wmark_distance;
+	if (MEMFILE_ATTR(cft->private) == WMARK_HIGH)
+		high = val;
+	else
+		low = val;
+
+	/* the high watermark is the closer one to the limit */
+	if (low && high > low) {
+		cgroup_unlock();
+		return -EINVAL;
+	}
+	memcg->high_wmark_distance = high;
+	memcg->low_wmark_distance = low;
+	cgroup_unlock();
+
+	mem_cgroup_check_wmark(memcg);
+	return 0;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -3921,6 +4138,18 @@ static struct cftype mem_cgroup_files[] = {
 		.unregister_event = mem_cgroup_oom_unregister_event,
 		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
 	},
+	{
+		.name = "high_wmark_distance",
+		.private = MEMFILE_PRIVATE(_MEM, WMARK_HIGH),
+		.write_string = mem_cgroup_wmark_write,
+		.read_u64 = mem_cgroup_wmark_read,
+	},
+	{
+		.name = "low_wmark_distance",
+		.private = MEMFILE_PRIVATE(_MEM, WMARK_LOW),
+		.write_string = mem_cgroup_wmark_write,
+		.read_u64 = mem_cgroup_wmark_read,
+	},
 };
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -3966,6 +4195,147 @@ static int register_memsw_files(struct cgroup *cont, struct cgroup_subsys *ss)
 }
 #endif
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/*
+ * Slab accounting.  Objects of caches created with SLAB_ACCOUNT are
+ * charged, by their full slab size, to the kmem counter of the cgroup of
+ * the allocating task.  The slab allocator remembers the charged cgroup
+ * in every object and hands it back on free.  Allocations from interrupt
+ * context, from kernel threads and from the root cgroup are not charged.
+ *
+ * Each charged object holds a reference on the mem_cgroup (not on its
+ * css), so that rmdir need not wait for dentries or sockets to go away.
+ */
+static struct kmem_cache *kmem_accounted_caches[MEM_CGROUP_KMEM_CACHES];
+static DEFINE_SPINLOCK(kmem_accounted_lock);
+
+/*
+ * Returns the index under which a per cache usage is kept for @s, or -1
+ * if all slots are taken, in which case @s is still accounted in total.
+ */
+int mem_cgroup_register_kmem_cache(struct kmem_cache *s)
+{
+	int id;
+
+	spin_lock(&kmem_accounted_lock);
+	for (id = 0; id < MEM_CGROUP_KMEM_CACHES; id++) {
+		if (!kmem_accounted_caches[id]) {
+			kmem_accounted_caches[id] = s;
+			break;
+		}
+	}
+	spin_unlock(&kmem_accounted_lock);
+
+	return id < MEM_CGROUP_KMEM_CACHES ? id : -1;
+}
+
+void mem_cgroup_unregister_kmem_cache(int id)
+{
+	if (id < 0)
+		return;
+	spin_lock(&kmem_accounted_lock);
+	kmem_accounted_caches[id] = NULL;
+	spin_unlock(&kmem_accounted_lock);
+}
+
+int mem_cgroup_charge_slab(int id, size_t size, struct mem_cgroup **memp)
+{
+	struct res_counter *fail_res;
+	struct mem_cgroup *mem;
+
+	*memp = NULL;
+	if (mem_cgroup_disabled() || in_interrupt())
+		return 0;
+
+	mem = try_get_mem_cgroup_from_mm(current->mm);
+	if (!mem)
+		return 0;
+	if (mem_cgroup_is_root(mem)) {
+		css_put(&mem->css);
+		return 0;
+	}
+
+	if (res_counter_charge(&mem->kmem, size, &fail_res)) {
+		css_put(&mem->css);
+		return -ENOMEM;
+	}
+	if (id >= 0)
+		atomic_long_add(size, &mem->kmem_cache_usage[id]);
+	mem_cgroup_get(mem);
+	css_put(&mem->css);
+
+	*memp = mem;
+	return 0;
+}
+
+void mem_cgroup_uncharge_slab(struct mem_cgroup *mem, int id, size_t size)
+{
+	res_counter_uncharge(&mem->kmem, size);
+	if (id >= 0)
+		atomic_long_sub(size, &mem->kmem_cache_usage[id]);
+	mem_cgroup_put(mem);
+}
+
+static int mem_cgroup_kmem_slabinfo_show(struct cgroup *cont,
+					 struct cftype *cft, struct seq_file *m)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
+	int id;
+
+	spin_lock(&kmem_accounted_lock);
+	for (id = 0; id < MEM_CGROUP_KMEM_CACHES; id++) {
+		struct kmem_cache *s = kmem_accounted_caches[id];
+		long usage = atomic_long_read(&mem->kmem_cache_usage[id]);
+
+		if (s && usage > 0)
+			seq_printf(m, "%s %ld\n", kmem_cache_name(s), usage);
+	}
+	spin_unlock(&kmem_accounted_lock);
+	return 0;
+}
+
+static struct cftype kmem_cgroup_files[] = {
+	{
+		.name = "kmem.usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_USAGE),
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_MAX_USAGE),
+		.trigger = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_LIMIT),
+		.write_string = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.failcnt",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_FAILCNT),
+		.trigger = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.slabinfo",
+		.read_seq_string = mem_cgroup_kmem_slabinfo_show,
+	},
+};
+
+static int register_kmem_files(struct cgroup *cont, struct cgroup_subsys *ss)
+{
+	return cgroup_add_files(cont, ss, kmem_cgroup_files,
+				ARRAY_SIZE(kmem_cgroup_files));
+}
+#else
+static int register_kmem_files(struct cgroup *cont, struct cgroup_subsys *ss)
+{
+	return 0;
+}
+#endif
+
 static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 {
 	struct mem_cgroup_per_node *pn;
@@ -4064,13 +4434,34 @@ static void mem_cgroup_get(struct mem_cgroup *mem)
 	atomic_inc(&mem->refcnt);
 }
 
+static void mem_cgroup_release(struct mem_cgroup *mem)
+{
+	struct mem_cgroup *parent = parent_mem_cgroup(mem);
+
+	__mem_cgroup_free(mem);
+	if (parent)
+		mem_cgroup_put(parent);
+}
+
+static void mem_cgroup_free_work(struct work_struct *work)
+{
+	mem_cgroup_release(container_of(work, struct mem_cgroup, free_work));
+}
+
 static void __mem_cgroup_put(struct mem_cgroup *mem, int count)
 {
 	if (atomic_sub_and_test(count, &mem->refcnt)) {
-		struct mem_cgroup *parent = parent_mem_cgroup(mem);
-		__mem_cgroup_free(mem);
-		if (parent)
-			mem_cgroup_put(parent);
+		/*
+		 * A slab object charged to a removed cgroup may be freed
+		 * from an RCU callback: vfree() and the soft limit tree
+		 * locks are not usable there.
+		 */
+		if (in_interrupt() || irqs_disabled()) {
+			INIT_WORK(&mem->free_work, mem_cgroup_free_work);
+			schedule_work(&mem->free_work);
+			return;
+		}
+		mem_cgroup_release(mem);
 	}
 }
 
@@ -4164,6 +4555,9 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	if (parent && parent->use_hierarchy) {
 		res_counter_init(&mem->res, &parent->res);
 		res_counter_init(&mem->memsw, &parent->memsw);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		res_counter_init(&mem->kmem, &parent->kmem);
+#endif
 		/*
 		 * We increment refcnt of the parent to ensure that we can
 		 * safely access it on res_counter_charge/uncharge.
@@ -4174,10 +4568,14 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	} else {
 		res_counter_init(&mem->res, NULL);
 		res_counter_init(&mem->memsw, NULL);
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+		res_counter_init(&mem->kmem, NULL);
+#endif
 	}
 	mem->last_scanned_child = 0;
 	spin_lock_init(&mem->reclaim_param_lock);
 	INIT_LIST_HEAD(&mem->oom_notify);
+	INIT_WORK(&mem->bg_reclaim_work, mem_cgroup_bg_reclaim);
 
 	if (parent)
 		mem->swappiness = get_swappiness(parent);
@@ -4217,6 +4615,8 @@ static int mem_cgroup_populate(struct cgroup_subsys *ss,
 
 	if (!ret)
 		ret = register_memsw_files(cont, ss);
+	if (!ret)
+		ret = register_kmem_files(cont, ss);
 	return ret;
 }
 
@@ -42,6 +42,7 @@
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
 #include <linux/mman.h>
+#include <linux/vmacache.h>
 #include <linux/swap.h>
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
@@ -57,6 +58,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/prefetch.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -689,9 +691,11 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 
 	/*
 	 * If it's a COW mapping, write protect it both
-	 * in the parent and the child
+	 * in the parent and the child.  A process forking repeatedly
+	 * mostly has ptes that are still protected from the last fork:
+	 * leave those alone rather than doing another atomic update.
 	 */
-	if (is_cow_mapping(vm_flags)) {
+	if (is_cow_mapping(vm_flags) && pte_write(pte)) {
 		ptep_set_wrprotect(src_mm, addr, src_pte);
 		pte = pte_wrprotect(pte);
 	}
@@ -719,6 +723,19 @@ out_set_pte:
 	return 0;
 }
 
+/*
+ * How many ptes ahead copy_pte_range() prefetches the struct page.  For
+ * a large process, the struct pages are cold and the atomic updates of
+ * copy_one_pte() would otherwise miss the cache one after the other.
+ */
+#define COPY_PTE_PREFETCH	8
+
+static inline void copy_pte_prefetch(pte_t pte)
+{
+	if (pte_present(pte) && pfn_valid(pte_pfn(pte)))
+		prefetchw(pfn_to_page(pte_pfn(pte)));
+}
+
 static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -754,6 +771,8 @@ again:
 			    spin_needbreak(src_ptl) || spin_needbreak(dst_ptl))
 				break;
 		}
+		if (addr + COPY_PTE_PREFETCH * PAGE_SIZE < end)
+			copy_pte_prefetch(src_pte[COPY_PTE_PREFETCH]);
 		if (pte_none(*src_pte)) {
 			progress++;
 			continue;
@@ -3183,6 +3202,194 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * find_vma() without mmap_sem: vmas are SLAB_DESTROY_BY_RCU, so whatever
+ * we walk into is some vma, and mm->mm_seq tells the caller whether the
+ * tree changed under us.  A tree being rebalanced can send us round in
+ * circles, hence the bound on the walk.
+ */
+static struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+						   unsigned long addr)
+{
+	struct vm_area_struct *vma = NULL, *tmp;
+	struct rb_node *rb_node;
+	int depth = 2 * BITS_PER_LONG;
+
+	/* current's own cache, read but not updated: it may be stale */
+	if (current->vmacache_seqnum == ACCESS_ONCE(mm->vmacache_seqnum)) {
+		tmp = ACCESS_ONCE(current->vmacache[VMACACHE_HASH(addr)]);
+		if (tmp && tmp->vm_mm == mm &&
+		    tmp->vm_end > addr && tmp->vm_start <= addr)
+			return tmp;
+	}
+
+	rb_node = ACCESS_ONCE(mm->mm_rb.rb_node);
+	while (rb_node && depth--) {
+		tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (tmp->vm_end > addr) {
+			vma = tmp;
+			if (tmp->vm_start <= addr)
+				break;
+			rb_node = ACCESS_ONCE(rb_node->rb_left);
+		} else
+			rb_node = ACCESS_ONCE(rb_node->rb_right);
+	}
+	return vma;
+}
+
+/*
+ * Walk the page tables down to the pmd without allocating anything.
+ * Called with interrupts disabled: page table pages are only freed after
+ * a TLB flush IPI, which cannot reach us until we are done, as in
+ * get_user_pages_fast().
+ */
+static bool speculative_pmd(struct mm_struct *mm, unsigned long address,
+			    pmd_t *pmdval)
+{
+	pgd_t pgd;
+	pud_t pud;
+
+	pgd = *pgd_offset(mm, address);
+	if (pgd_none(pgd) || pgd_bad(pgd))
+		return false;
+	pud = *pud_offset(&pgd, address);
+	if (pud_none(pud) || pud_bad(pud))
+		return false;
+	*pmdval = *pmd_offset(&pud, address);
+	barrier();
+	if (pmd_none(*pmdval) || pmd_bad(*pmdval))
+		return false;
+	return true;
+}
+
+/**
+ * handle_speculative_fault - fault in an anonymous page without mmap_sem
+ * @mm: the faulting mm
+ * @address: user address that faulted
+ * @flags: FAULT_FLAG_xxx
+ *
+ * Only the common case is handled: a not-present pte in a private
+ * anonymous vma which already has its anon_vma and page table.  The vma
+ * is looked up under RCU and copied; the copy is used from then on, and
+ * is checked against mm->mm_seq once more with the pte lock held, just
+ * before the pte is set.  Anything which changes the vma after that point
+ * has to take the pte lock before it touches this pte, so it cannot
+ * overtake us.
+ *
+ * Returns 0 if the fault was handled, VM_FAULT_RETRY if the caller has
+ * to take mmap_sem and go through handle_mm_fault().
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma, vma_copy;
+	struct page *page = NULL;
+	unsigned long irqflags;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	pmd_t pmdval;
+	unsigned seq;
+
+	seq = ACCESS_ONCE(mm->mm_seq.sequence);
+	smp_rmb();
+	if (seq & 1)
+		goto abort;
+
+	rcu_read_lock();
+	vma = find_vma_speculative(mm, address);
+	if (!vma || vma->vm_start > address) {
+		rcu_read_unlock();
+		goto abort;
+	}
+	vma_copy = *vma;
+	rcu_read_unlock();
+	if (read_seqcount_retry(&mm->mm_seq, seq))
+		goto abort;
+
+	if (vma_copy.vm_mm != mm || vma_copy.vm_ops || vma_copy.vm_file ||
+	    !vma_copy.anon_vma || vma_policy(&vma_copy))
+		goto abort;
+	if (vma_copy.vm_flags & (VM_SHARED | VM_GROWSDOWN | VM_GROWSUP |
+				 VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP))
+		goto abort;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma_copy.vm_flags & VM_WRITE))
+			goto abort;
+	} else if (!(vma_copy.vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto abort;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	if (flags & FAULT_FLAG_WRITE) {
+		page = alloc_zeroed_user_highpage_movable(&vma_copy, address);
+		if (!page)
+			goto abort;
+		__SetPageUptodate(page);
+
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			goto abort;
+		}
+
+		entry = mk_pte(page, vma_copy.vm_page_prot);
+		if (vma_copy.vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	} else
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      vma_copy.vm_page_prot));
+
+	local_irq_save(irqflags);
+	if (!speculative_pmd(mm, address, &pmdval))
+		goto abort_irq;
+
+	/*
+	 * Whoever holds the pte lock may be waiting for us to answer a TLB
+	 * flush IPI: do not spin on it with interrupts off.
+	 */
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto abort_irq;
+	}
+	if (!pte_none(*pte) || read_seqcount_retry(&mm->mm_seq, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto abort_irq;
+	}
+	/*
+	 * The vma is still what we copied, so the page table can only go
+	 * after a zap of this range, which needs the pte lock we now hold.
+	 */
+	local_irq_restore(irqflags);
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, &vma_copy, address);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&vma_copy, address, pte);
+	pte_unmap_unlock(pte, ptl);
+
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	return 0;
+
+abort_irq:
+	local_irq_restore(irqflags);
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+abort:
+	count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+	return VM_FAULT_RETRY;
+}
+#endif
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -100,6 +100,7 @@
 #define MPOL_MF_DISCONTIG_OK (MPOL_MF_INTERNAL << 0)	/* Skip checks for continuous vmas */
 #define MPOL_MF_INVERT (MPOL_MF_INTERNAL << 1)		/* Invert check for nodemask */
 #define MPOL_MF_STATS (MPOL_MF_INTERNAL << 2)		/* Gather statistics */
+#define MPOL_MF_YOUNG (MPOL_MF_INTERNAL << 3)		/* Only recently accessed pages */
 
 static struct kmem_cache *policy_cache;
 static struct kmem_cache *sn_cache;
@@ -489,6 +490,16 @@ static int check_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 		if (PageReserved(page) || PageKsm(page))
 			continue;
 		nid = page_to_nid(page);
+#ifdef CONFIG_MIGRATION
+		if (flags & MPOL_MF_YOUNG) {
+			if (!ptep_test_and_clear_young(vma, addr, pte))
+				continue;
+			if (node_isset(nid, *nodes))
+				vma->vm_mm->numa_samples_local++;
+			else
+				vma->vm_mm->numa_samples_remote++;
+		}
+#endif
 		if (node_isset(nid, *nodes) == !!(flags & MPOL_MF_INVERT))
 			continue;
 
@@ -937,6 +948,93 @@ static int migrate_to_node(struct mm_struct *mm, int source, int dest,
 	return err;
 }
 
+/*
+ * Automatic NUMA placement.
+ *
+ * While a task runs, its mm is sampled every numa_balancing_scan_period_ms:
+ * the next numa_balancing_scan_size_mb of its address space is walked, the
+ * pages accessed since the previous pass over that range are counted as
+ * local or remote to the node the task is running on, and the remote ones
+ * that are not shared with other processes are migrated to that node.
+ */
+int sysctl_numa_balancing __read_mostly;
+unsigned int sysctl_numa_balancing_scan_period_ms __read_mostly = 1000;
+unsigned int sysctl_numa_balancing_scan_size_mb __read_mostly = 64;
+
+static void numa_scan_work(struct work_struct *work)
+{
+	struct mm_struct *mm = container_of(work, struct mm_struct, numa_work);
+	int nid = mm->numa_scan_nid;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	nodemask_t nmask;
+	LIST_HEAD(pagelist);
+
+	nodes_clear(nmask);
+	node_set(nid, nmask);
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		/* Reached the end of the address space, start over */
+		vma = mm->mmap;
+		start = 0;
+	}
+	if (vma) {
+		start = max(start, vma->vm_start);
+		end = start + ((unsigned long)sysctl_numa_balancing_scan_size_mb
+			       << 20);
+		if (end < start)
+			end = TASK_SIZE;
+		check_range(mm, start, end, &nmask, MPOL_MF_MOVE |
+			    MPOL_MF_DISCONTIG_OK | MPOL_MF_INVERT |
+			    MPOL_MF_YOUNG, &pagelist);
+		mm->numa_scan_offset = end;
+	}
+	up_read(&mm->mmap_sem);
+
+	if (!list_empty(&pagelist))
+		migrate_pages(&pagelist, new_node_page, nid, 0);
+
+	clear_bit(MMF_NUMA_SCAN, &mm->flags);
+	mmput(mm);
+}
+
+void mm_init_numa(struct mm_struct *mm)
+{
+	INIT_WORK(&mm->numa_work, numa_scan_work);
+	mm->numa_next_scan = jiffies;
+	mm->numa_scan_offset = 0;
+	mm->numa_samples_local = 0;
+	mm->numa_samples_remote = 0;
+}
+
+/*
+ * Called from the timer tick: queue a placement scan of the running
+ * task's mm when one is due.
+ */
+void task_tick_numa(struct task_struct *p)
+{
+	struct mm_struct *mm = p->mm;
+
+	if (!sysctl_numa_balancing || !mm || nr_online_nodes < 2)
+		return;
+	if (p->flags & (PF_EXITING | PF_KTHREAD))
+		return;
+	if (time_before(jiffies, mm->numa_next_scan))
+		return;
+	mm->numa_next_scan = jiffies +
+		msecs_to_jiffies(sysctl_numa_balancing_scan_period_ms);
+
+	if (test_and_set_bit(MMF_NUMA_SCAN, &mm->flags))
+		return;
+	mm->numa_scan_nid = numa_node_id();
+	/* The running task holds a reference, so mm_users cannot be 0 */
+	atomic_inc(&mm->mm_users);
+	schedule_work(&mm->numa_work);
+}
+
 /*
  * Move pages between the two nodesets so as to preserve the physical
  * layout as much as possible.
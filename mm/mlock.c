@@ -407,7 +407,9 @@ success:
 	 */
 
 	if (lock) {
+		mm_vma_write_begin(mm);
 		vma->vm_flags = newflags;
+		mm_vma_write_end(mm);
 		ret = __mlock_vma_pages_range(vma, start, end);
 		if (ret < 0)
 			ret = __mlock_posix_error_return(ret);
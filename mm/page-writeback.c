@@ -219,6 +219,7 @@ int dirty_bytes_handler(struct ctl_table *table, int write,
  */
 static inline void __bdi_writeout_inc(struct backing_dev_info *bdi)
 {
+	__inc_bdi_stat(bdi, BDI_WRITTEN);
 	__prop_inc_percpu_max(&vm_completions, &bdi->completions,
 			      bdi->max_prop_frac);
 }
@@ -471,10 +472,57 @@ unsigned long bdi_dirty_limit(struct backing_dev_info *bdi, unsigned long dirty)
 	return bdi_dirty;
 }
 
+/*
+ * Estimate the rate at which the bdi completes writeback, from the pages
+ * written since the last sample.  Sampled at most every 200ms by whichever
+ * dirtier gets there first, and smoothed so that one idle or bursty period
+ * does not swing the throttling pauses.
+ */
+#define BANDWIDTH_INTERVAL	max(HZ/5, 1)
+
+static void bdi_update_bandwidth(struct backing_dev_info *bdi)
+{
+	unsigned long stamp = bdi->bw_time_stamp;
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - stamp;
+	unsigned long written, bw;
+
+	if (elapsed < BANDWIDTH_INTERVAL)
+		return;
+	if (cmpxchg(&bdi->bw_time_stamp, stamp, now) != stamp)
+		return;
+
+	written = bdi_stat(bdi, BDI_WRITTEN);
+	/* Long idle periods say nothing about the device's bandwidth */
+	if (elapsed <= HZ) {
+		bw = (written - bdi->written_stamp) * HZ / elapsed;
+		bdi->write_bandwidth = (bdi->write_bandwidth * 7 + bw) / 8;
+		if (!bdi->write_bandwidth)
+			bdi->write_bandwidth = 1;
+	}
+	bdi->written_stamp = written;
+}
+
+/*
+ * How long a task that dirtied @pages should sleep for the bdi's writeback
+ * to clean the same amount.
+ */
+static unsigned long bdi_dirty_pause(struct backing_dev_info *bdi,
+				     unsigned long pages)
+{
+	unsigned long pause;
+
+	pause = pages * HZ / bdi->write_bandwidth;
+	return clamp_val(pause, 1, HZ / 5);
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
- * the caller to perform writeback if the system is over `vm_dirty_ratio'.
+ * the caller to wait for the bdi flusher to write out some pages if the
+ * dirty limits are exceeded.  The dirtier itself does no writeback: it
+ * sleeps for as long as the bdi needs to write @write_chunk pages, so that
+ * all the IO is issued by the flusher thread in large sequential batches.
  * If we're over `background_thresh' then the writeback threads are woken to
  * perform some writeout.
  */
@@ -487,10 +535,14 @@ static void balance_dirty_pages(struct address_space *mapping,
 	unsigned long dirty_thresh;
 	unsigned long bdi_thresh;
 	unsigned long pages_written = 0;
-	unsigned long pause = 1;
+	unsigned long start_written;
+	unsigned long paused = 0;
+	unsigned long pause;
 	bool dirty_exceeded = false;
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 
+	start_written = bdi_stat(bdi, BDI_WRITTEN);
+
 	for (;;) {
 		struct writeback_control wbc = {
 			.sync_mode	= WB_SYNC_NONE,
@@ -556,29 +608,30 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * filesystems (i.e. NFS) in which data may have been
 		 * written to the server's write cache, but has not yet
 		 * been flushed to permanent storage.
-		 * Only move pages to writeback if this bdi is over its
-		 * threshold otherwise wait until the disk writes catch
-		 * up.
+		 * Leave the writeout to the flusher thread and wait for
+		 * it to write our share of pages.
 		 */
 		trace_wbc_balance_dirty_start(&wbc, bdi);
-		if (bdi_nr_reclaimable > bdi_thresh) {
-			writeback_inodes_wb(&bdi->wb, &wbc);
-			pages_written += write_chunk - wbc.nr_to_write;
+		if (!writeback_in_progress(bdi))
+			bdi_start_background_writeback(bdi);
+
+		bdi_update_bandwidth(bdi);
+		pages_written = bdi_stat(bdi, BDI_WRITTEN) - start_written;
+		if (pages_written >= write_chunk &&
+		    paused >= bdi_dirty_pause(bdi, write_chunk)) {
 			trace_wbc_balance_dirty_written(&wbc, bdi);
-			if (pages_written >= write_chunk)
-				break;		/* We've done our duty */
+			break;		/* The flusher has done our duty */
 		}
+
+		pause = bdi_dirty_pause(bdi, write_chunk);
 		trace_wbc_balance_dirty_wait(&wbc, bdi);
 		__set_current_state(TASK_INTERRUPTIBLE);
 		io_schedule_timeout(pause);
+		paused += pause;
 
-		/*
-		 * Increase the delay for each loop, up to our previous
-		 * default of taking a 100ms nap.
-		 */
-		pause <<= 1;
-		if (pause > HZ / 10)
-			pause = HZ / 10;
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current))
+			break;
 	}
 
 	if (!dirty_exceeded && bdi->dirty_exceeded)
@@ -1047,11 +1100,17 @@ static int __writepage(struct page *page, struct writeback_control *wbc,
 int generic_writepages(struct address_space *mapping,
 		       struct writeback_control *wbc)
 {
+	struct blk_plug plug;
+	int ret;
+
 	/* deal with chardevs and other special file */
 	if (!mapping->a_ops->writepage)
 		return 0;
 
-	return write_cache_pages(mapping, wbc, __writepage, mapping);
+	blk_start_plug(&plug);
+	ret = write_cache_pages(mapping, wbc, __writepage, mapping);
+	blk_finish_plug(&plug);
+	return ret;
 }
 
 EXPORT_SYMBOL(generic_writepages);
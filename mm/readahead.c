@@ -10,6 +10,7 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/gfp.h>
+#include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/blkdev.h>
@@ -109,9 +110,12 @@ EXPORT_SYMBOL(read_cache_pages);
 static int read_pages(struct address_space *mapping, struct file *filp,
 		struct list_head *pages, unsigned nr_pages)
 {
+	struct blk_plug plug;
 	unsigned page_idx;
 	int ret;
 
+	blk_start_plug(&plug);
+
 	if (mapping->a_ops->readpages) {
 		ret = mapping->a_ops->readpages(filp, mapping, pages, nr_pages);
 		/* Clean up the remaining pages */
@@ -130,6 +134,7 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 	}
 	ret = 0;
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
@@ -383,6 +388,83 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Several sequential streams reading one file through a shared struct file
+ * keep replacing each other's window in file->f_ra.  Remember the windows
+ * that were displaced, so that a stream coming back finds its own window
+ * again instead of restarting from a small initial one.
+ */
+#define RA_NR_STREAMS	4
+
+struct file_ra_streams {
+	struct file_ra_state ra[RA_NR_STREAMS];
+	unsigned int next;		/* slot to evict next */
+};
+
+static bool ra_is_expected(struct file_ra_state *ra, pgoff_t offset)
+{
+	return ra->size && (offset == ra->start + ra->size - ra->async_size ||
+			    offset == ra->start + ra->size);
+}
+
+static void ra_swap_window(struct file_ra_state *a, struct file_ra_state *b)
+{
+	swap(a->start, b->start);
+	swap(a->size, b->size);
+	swap(a->async_size, b->async_size);
+	swap(a->prev_pos, b->prev_pos);
+}
+
+/*
+ * Look for a displaced window that expects @offset and make it the
+ * current one, stashing the current window in its place.
+ */
+static bool ra_switch_stream(struct file *filp, struct file_ra_state *ra,
+			     pgoff_t offset)
+{
+	struct file_ra_streams *streams = filp->f_ra_streams;
+	int i;
+
+	if (!streams)
+		return false;
+
+	for (i = 0; i < RA_NR_STREAMS; i++) {
+		if (ra_is_expected(&streams->ra[i], offset)) {
+			ra_swap_window(ra, &streams->ra[i]);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The current window is about to be replaced by a new stream: remember it.
+ */
+static void ra_save_stream(struct file *filp, struct file_ra_state *ra)
+{
+	struct file_ra_streams *streams = filp->f_ra_streams;
+	struct file_ra_state *slot;
+
+	if (!ra->size)
+		return;
+
+	if (!streams) {
+		streams = kzalloc(sizeof(*streams), GFP_NOFS | __GFP_NOWARN);
+		if (!streams)
+			return;
+		if (cmpxchg(&filp->f_ra_streams, NULL, streams)) {
+			kfree(streams);
+			streams = filp->f_ra_streams;
+		}
+	}
+
+	slot = &streams->ra[streams->next++ % RA_NR_STREAMS];
+	slot->start = ra->start;
+	slot->size = ra->size;
+	slot->async_size = ra->async_size;
+	slot->prev_pos = ra->prev_pos;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -394,6 +476,15 @@ ondemand_readahead(struct address_space *mapping,
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
 
+	/*
+	 * Not the current stream: see if it is one of the interleaved
+	 * streams whose window was displaced, else remember the current
+	 * window before it gets replaced below.
+	 */
+	if (filp && ra == &filp->f_ra && !ra_is_expected(ra, offset) &&
+	    !ra_switch_stream(filp, ra, offset))
+		ra_save_stream(filp, ra);
+
 	/*
 	 * start of file
 	 */
@@ -508,6 +599,8 @@ void page_cache_sync_readahead(struct address_space *mapping,
 		return;
 	}
 
+	inc_bdi_stat(mapping->backing_dev_info, BDI_READAHEAD_MISS);
+
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
 }
@@ -545,6 +638,7 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	ClearPageReadahead(page);
+	inc_bdi_stat(mapping->backing_dev_info, BDI_READAHEAD_HIT);
 
 	/*
 	 * Defer asynchronous read-ahead on IO congestion.
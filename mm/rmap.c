@@ -1004,6 +1004,19 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 			dec_mm_counter(mm, MM_FILEPAGES);
 		set_pte_at(mm, address, pte,
 				swp_entry_to_pte(make_hwpoison_entry(page)));
+	} else if (PageAnon(page) && !PageSwapBacked(page) && !PageKsm(page) &&
+		   TTU_ACTION(flags) == TTU_UNMAP) {
+		/*
+		 * MADV_FREE'd page: discard it, unless it was written to
+		 * since, in which case it goes back to being swap backed.
+		 */
+		if (PageDirty(page)) {
+			set_pte_at(mm, address, pte, pteval);
+			SetPageSwapBacked(page);
+			ret = SWAP_FAIL;
+			goto out_unmap;
+		}
+		dec_mm_counter(mm, MM_ANONPAGES);
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
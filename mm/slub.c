@@ -27,6 +27,8 @@
 #include <linux/memory.h>
 #include <linux/math64.h>
 #include <linux/fault-inject.h>
+#include <linux/uaccess.h>
+#include <linux/memcontrol.h>
 
 /*
  * Lock order:
@@ -160,7 +162,7 @@ static inline int kmem_cache_debug(struct kmem_cache *s)
 		SLAB_FAILSLAB)
 
 #define SLUB_MERGE_SAME (SLAB_DEBUG_FREE | SLAB_RECLAIM_ACCOUNT | \
-		SLAB_CACHE_DMA | SLAB_NOTRACK)
+		SLAB_CACHE_DMA | SLAB_NOTRACK | SLAB_ACCOUNT)
 
 #define OO_SHIFT	16
 #define OO_MASK		((1 << OO_SHIFT) - 1)
@@ -263,6 +265,23 @@ static inline void *get_freepointer(struct kmem_cache *s, void *object)
 	return *(void **)(object + s->offset);
 }
 
+static inline void *get_freepointer_safe(struct kmem_cache *s, void *object)
+{
+	void *p;
+
+#ifdef CONFIG_DEBUG_PAGEALLOC
+	/*
+	 * The lockless fastpath may race with a free on another cpu and
+	 * read the free pointer of an object whose slab was just unmapped.
+	 * The cmpxchg will fail in that case, but the read must not fault.
+	 */
+	probe_kernel_read(&p, (void **)(object + s->offset), sizeof(p));
+#else
+	p = get_freepointer(s, object);
+#endif
+	return p;
+}
+
 static inline void set_freepointer(struct kmem_cache *s, void *object, void *fp)
 {
 	*(void **)(object + s->offset) = fp;
@@ -601,6 +620,10 @@ static int check_pad_bytes(struct kmem_cache *s, struct page *page, u8 *p)
 		/* We also have user information there */
 		off += 2 * sizeof(struct track);
 
+	if (s->flags & SLAB_ACCOUNT)
+		/* And the owning memory cgroup */
+		off += sizeof(void *);
+
 	if (s->size == off)
 		return 1;
 
@@ -1443,6 +1466,156 @@ static void unfreeze_slab(struct kmem_cache *s, struct page *page, int tail)
 	}
 }
 
+#ifdef CONFIG_CMPXCHG_LOCAL
+/*
+ * The transaction id of a cpu slab is bumped whenever the cpu freelist
+ * is modified outside the lockless fastpath.  The fastpaths replace the
+ * freelist and the tid together with a cmpxchg_double, which therefore
+ * fails if the task was preempted, migrated to another cpu (the tids of
+ * different cpus never collide since they start at the cpu number and
+ * advance by a multiple of NR_CPUS) or interrupted by a slow path.
+ */
+#ifdef CONFIG_PREEMPT
+#define TID_STEP  roundup_pow_of_two(CONFIG_NR_CPUS)
+#else
+/*
+ * Without preemption a fastpath cannot move to another cpu, interrupts
+ * are the only concern.
+ */
+#define TID_STEP 1
+#endif
+
+static inline unsigned long next_tid(unsigned long tid)
+{
+	return tid + TID_STEP;
+}
+
+static inline unsigned int tid_to_cpu(unsigned long tid)
+{
+	return tid % TID_STEP;
+}
+
+static inline unsigned long tid_to_event(unsigned long tid)
+{
+	return tid / TID_STEP;
+}
+
+static inline unsigned int init_tid(int cpu)
+{
+	return cpu;
+}
+
+static inline void note_cmpxchg_failure(const char *n,
+		struct kmem_cache *s, unsigned long tid)
+{
+#ifdef SLUB_DEBUG_CMPXCHG
+	unsigned long actual_tid = __this_cpu_read(s->cpu_slab->tid);
+
+	printk(KERN_INFO "%s %s: cmpxchg redo ", n, s->name);
+
+#ifdef CONFIG_PREEMPT
+	if (tid_to_cpu(tid) != tid_to_cpu(actual_tid))
+		printk("due to cpu change %d -> %d\n",
+			tid_to_cpu(tid), tid_to_cpu(actual_tid));
+	else
+#endif
+	if (tid_to_event(tid) != tid_to_event(actual_tid))
+		printk("due to cpu running other code. Event %ld->%ld\n",
+			tid_to_event(tid), tid_to_event(actual_tid));
+	else
+		printk("for unknown reason: actual=%lx was=%lx target=%lx\n",
+			actual_tid, tid, next_tid(tid));
+#endif
+	stat(s, CMPXCHG_DOUBLE_CPU_FAIL);
+}
+
+#endif
+
+static void init_kmem_cache_cpus(struct kmem_cache *s)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+
+		INIT_LIST_HEAD(&c->partial);
+#ifdef CONFIG_CMPXCHG_LOCAL
+		c->tid = init_tid(cpu);
+#endif
+	}
+}
+
+/*
+ * Per cpu partial slabs.
+ *
+ * A slab that gets its first free object back while it is not the cpu
+ * slab of anyone would normally go onto the node partial list, taking
+ * n->list_lock.  Instead it is frozen and queued on the partial list of
+ * the freeing cpu.  Further frees to it only take the slab lock, and the
+ * next refill of the cpu slab is served from that list without looking
+ * at the node.  Only once the list grows beyond s->cpu_partial slabs are
+ * they handed back to their nodes, all at once.
+ *
+ * The list is only touched with interrupts disabled by its own cpu, or
+ * by whoever flushes the cpu slabs of an offline cpu.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, &c->partial, lru) {
+		list_del(&page->lru);
+		slab_lock(page);
+		unfreeze_slab(s, page, 1);
+	}
+	c->nr_partial = 0;
+	stat(s, CPU_PARTIAL_DRAIN);
+}
+
+/*
+ * Queue a locked slab that just went from full to partial on the
+ * partial list of this cpu.  Returns false if per cpu partials are
+ * disabled for the cache, leaving the slab to the caller.
+ */
+static bool put_cpu_partial(struct kmem_cache *s, struct page *page)
+{
+	struct kmem_cache_cpu *c = __this_cpu_ptr(s->cpu_slab);
+
+	if (!s->cpu_partial || kmem_cache_debug(s))
+		return false;
+
+	__SetPageSlubFrozen(page);
+	list_add(&page->lru, &c->partial);
+	c->nr_partial++;
+	stat(s, CPU_PARTIAL_FREE);
+	return true;
+}
+
+/*
+ * Take a slab for allocation from the partial list of this cpu.  The
+ * slab is returned locked and still frozen.  Objects may have been
+ * freed to it since it was queued, but never allocated from it, so
+ * it has a freelist.
+ */
+static struct page *get_cpu_partial(struct kmem_cache *s,
+				struct kmem_cache_cpu *c, int node)
+{
+	struct page *page;
+
+	if (list_empty(&c->partial))
+		return NULL;
+
+	page = list_first_entry(&c->partial, struct page, lru);
+	if (node != NUMA_NO_NODE && page_to_nid(page) != node)
+		return NULL;
+
+	list_del(&page->lru);
+	c->nr_partial--;
+	slab_lock(page);
+	stat(s, CPU_PARTIAL_ALLOC);
+	return page;
+}
+
 /*
  * Remove the cpu slab
  */
@@ -1473,6 +1646,9 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 		page->inuse--;
 	}
 	c->page = NULL;
+#ifdef CONFIG_CMPXCHG_LOCAL
+	c->tid = next_tid(c->tid);
+#endif
 	unfreeze_slab(s, page, tail);
 }
 
@@ -1492,8 +1668,14 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+
+	if (c->page)
 		flush_slab(s, c);
+
+	if (c->nr_partial)
+		unfreeze_partials(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1588,7 +1770,8 @@ slab_out_of_memory(struct kmem_cache *s, gfp_t gfpflags, int nid)
  * Slow path. The lockless freelist is empty or we need to perform
  * debugging duties.
  *
- * Interrupts are disabled.
+ * Interrupts are disabled (they are disabled here when the fastpath
+ * is lockless).
  *
  * Processing is still very fast if new objects have been freed to the
  * regular freelist. In that case we simply take over the regular freelist
@@ -1607,6 +1790,19 @@ static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
 {
 	void **object;
 	struct page *new;
+#ifdef CONFIG_CMPXCHG_LOCAL
+	unsigned long flags;
+
+	local_irq_save(flags);
+#ifdef CONFIG_PREEMPT
+	/*
+	 * We may have been preempted and rescheduled on a different
+	 * cpu before disabling interrupts. Need to reload cpu area
+	 * pointer.
+	 */
+	c = this_cpu_ptr(s->cpu_slab);
+#endif
+#endif
 
 	/* We handle __GFP_ZERO in the caller */
 	gfpflags &= ~__GFP_ZERO;
@@ -1633,6 +1829,10 @@ load_freelist:
 	c->node = page_to_nid(c->page);
 unlock_out:
 	slab_unlock(c->page);
+#ifdef CONFIG_CMPXCHG_LOCAL
+	c->tid = next_tid(c->tid);
+	local_irq_restore(flags);
+#endif
 	stat(s, ALLOC_SLOWPATH);
 	return object;
 
@@ -1640,6 +1840,12 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
+	new = get_cpu_partial(s, c, node);
+	if (new) {
+		c->page = new;
+		goto load_freelist;
+	}
+
 	new = get_partial(s, gfpflags, node);
 	if (new) {
 		c->page = new;
@@ -1667,6 +1873,9 @@ new_slab:
 	}
 	if (!(gfpflags & __GFP_NOWARN) && printk_ratelimit())
 		slab_out_of_memory(s, gfpflags, node);
+#ifdef CONFIG_CMPXCHG_LOCAL
+	local_irq_restore(flags);
+#endif
 	return NULL;
 debug:
 	if (!alloc_debug_processing(s, c->page, object, addr))
@@ -1678,6 +1887,79 @@ debug:
 	goto unlock_out;
 }
 
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+static inline struct mem_cgroup **slab_owner(struct kmem_cache *s,
+					     void *object)
+{
+	return object + s->memcg_offset;
+}
+
+static inline int slab_charge(struct kmem_cache *s, struct mem_cgroup **memp)
+{
+	*memp = NULL;
+	if (!(s->flags & SLAB_ACCOUNT))
+		return 0;
+	return mem_cgroup_charge_slab(s->memcg_id, s->size, memp);
+}
+
+static inline void slab_commit_charge(struct kmem_cache *s, void *object,
+				      struct mem_cgroup *mem)
+{
+	if (!(s->flags & SLAB_ACCOUNT))
+		return;
+	if (object)
+		*slab_owner(s, object) = mem;
+	else if (mem)
+		mem_cgroup_uncharge_slab(mem, s->memcg_id, s->size);
+}
+
+static inline void slab_uncharge(struct kmem_cache *s, void *object)
+{
+	struct mem_cgroup *mem;
+
+	if (!(s->flags & SLAB_ACCOUNT))
+		return;
+	mem = *slab_owner(s, object);
+	if (mem)
+		mem_cgroup_uncharge_slab(mem, s->memcg_id, s->size);
+}
+
+static void slab_register_account(struct kmem_cache *s)
+{
+	if (s->flags & SLAB_ACCOUNT)
+		s->memcg_id = mem_cgroup_register_kmem_cache(s);
+}
+
+static void slab_unregister_account(struct kmem_cache *s)
+{
+	if (s->flags & SLAB_ACCOUNT)
+		mem_cgroup_unregister_kmem_cache(s->memcg_id);
+}
+#else
+static inline int slab_charge(struct kmem_cache *s, struct mem_cgroup **memp)
+{
+	*memp = NULL;
+	return 0;
+}
+
+static inline void slab_commit_charge(struct kmem_cache *s, void *object,
+				      struct mem_cgroup *mem)
+{
+}
+
+static inline void slab_uncharge(struct kmem_cache *s, void *object)
+{
+}
+
+static inline void slab_register_account(struct kmem_cache *s)
+{
+}
+
+static inline void slab_unregister_account(struct kmem_cache *s)
+{
+}
+#endif
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -1687,13 +1969,22 @@ debug:
  * If not then __slab_alloc is called for slow processing.
  *
  * Otherwise we can simply pick the next object from the lockless free list.
+ *
+ * With CONFIG_CMPXCHG_LOCAL the pick is done without disabling interrupts
+ * or preemption: freelist and tid are replaced by a cmpxchg_double that is
+ * retried if anything touched the cpu slab in between.
  */
 static __always_inline void *slab_alloc(struct kmem_cache *s,
 		gfp_t gfpflags, int node, unsigned long addr)
 {
 	void **object;
 	struct kmem_cache_cpu *c;
+	struct mem_cgroup *memcg;
+#ifdef CONFIG_CMPXCHG_LOCAL
+	unsigned long tid;
+#else
 	unsigned long flags;
+#endif
 
 	gfpflags &= gfp_allowed_mask;
 
@@ -1703,18 +1994,74 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	if (should_failslab(s->objsize, gfpflags, s->flags))
 		return NULL;
 
+	if (slab_charge(s, &memcg))
+		return NULL;
+
+#ifndef CONFIG_CMPXCHG_LOCAL
 	local_irq_save(flags);
+#else
+redo:
+#endif
+
+	/*
+	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
+	 * enabled. We may switch back and forth between cpus while
+	 * reading from one cpu area. That does not matter as long
+	 * as we end up on the original cpu again when doing the cmpxchg.
+	 */
 	c = __this_cpu_ptr(s->cpu_slab);
+
+#ifdef CONFIG_CMPXCHG_LOCAL
+	/*
+	 * The transaction ids are globally unique per cpu and per operation on
+	 * a per cpu queue. Thus they can be guarantee that the cmpxchg_double
+	 * occurs on the right processor and that there was no operation on the
+	 * linked list in between.
+	 */
+	tid = c->tid;
+	barrier();
+#endif
+
 	object = c->freelist;
 	if (unlikely(!object || !node_match(c, node)))
 
 		object = __slab_alloc(s, gfpflags, node, addr, c);
 
 	else {
+#ifdef CONFIG_CMPXCHG_LOCAL
+		/*
+		 * The cmpxchg will only match if there was no additional
+		 * operation and if we are on the right processor.
+		 *
+		 * The cmpxchg does the following atomically (without lock
+		 * semantics!)
+		 * 1. Relocate first pointer to the current per cpu area.
+		 * 2. Verify that tid and freelist have not been changed
+		 * 3. If they were not changed replace tid and freelist
+		 *
+		 * Since this is without lock semantics the protection is only
+		 * against code executing on this cpu *not* from access by
+		 * other cpus.
+		 */
+		if (unlikely(!irqsafe_cpu_cmpxchg_double(
+				s->cpu_slab->freelist, s->cpu_slab->tid,
+				object, tid,
+				get_freepointer_safe(s, object), next_tid(tid)))) {
+
+			note_cmpxchg_failure("slab_alloc", s, tid);
+			goto redo;
+		}
+#else
 		c->freelist = get_freepointer(s, object);
+#endif
 		stat(s, ALLOC_FASTPATH);
 	}
+
+#ifndef CONFIG_CMPXCHG_LOCAL
 	local_irq_restore(flags);
+#endif
+
+	slab_commit_charge(s, object, memcg);
 
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->objsize);
@@ -1779,7 +2126,11 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 {
 	void *prior;
 	void **object = (void *)x;
+#ifdef CONFIG_CMPXCHG_LOCAL
+	unsigned long flags;
 
+	local_irq_save(flags);
+#endif
 	stat(s, FREE_SLOWPATH);
 	slab_lock(page);
 
@@ -1802,15 +2153,27 @@ checks_ok:
 
 	/*
 	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
+	 * then add it, preferably to the partial list of this cpu.
 	 */
 	if (unlikely(!prior)) {
+		if (put_cpu_partial(s, page)) {
+			struct kmem_cache_cpu *c = __this_cpu_ptr(s->cpu_slab);
+
+			slab_unlock(page);
+			if (c->nr_partial > s->cpu_partial)
+				unfreeze_partials(s, c);
+			goto out;
+		}
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(s, FREE_ADD_PARTIAL);
 	}
 
 out_unlock:
 	slab_unlock(page);
+out:
+#ifdef CONFIG_CMPXCHG_LOCAL
+	local_irq_restore(flags);
+#endif
 	return;
 
 slab_empty:
@@ -1822,6 +2185,9 @@ slab_empty:
 		stat(s, FREE_REMOVE_PARTIAL);
 	}
 	slab_unlock(page);
+#ifdef CONFIG_CMPXCHG_LOCAL
+	local_irq_restore(flags);
+#endif
 	stat(s, FREE_SLAB);
 	discard_slab(s, page);
 	return;
@@ -1848,23 +2214,63 @@ static __always_inline void slab_free(struct kmem_cache *s,
 {
 	void **object = (void *)x;
 	struct kmem_cache_cpu *c;
+#ifdef CONFIG_CMPXCHG_LOCAL
+	unsigned long tid;
+	void **freelist;
+#else
 	unsigned long flags;
+#endif
 
+	slab_uncharge(s, object);
 	kmemleak_free_recursive(x, s->flags);
+#ifndef CONFIG_CMPXCHG_LOCAL
 	local_irq_save(flags);
-	c = __this_cpu_ptr(s->cpu_slab);
+#endif
 	kmemcheck_slab_free(s, object, s->objsize);
 	debug_check_no_locks_freed(object, s->objsize);
 	if (!(s->flags & SLAB_DEBUG_OBJECTS))
 		debug_check_no_obj_freed(object, s->objsize);
+
+#ifdef CONFIG_CMPXCHG_LOCAL
+redo:
+#endif
+	/*
+	 * Determine the currently cpus per cpu slab.
+	 * The cpu may change afterward. However that does not matter since
+	 * data is retrieved via this pointer. If we are on the same cpu
+	 * during the cmpxchg then the free will succeed.
+	 */
+	c = __this_cpu_ptr(s->cpu_slab);
+
+#ifdef CONFIG_CMPXCHG_LOCAL
+	tid = c->tid;
+	barrier();
+#endif
+
 	if (likely(page == c->page && c->node >= 0)) {
+#ifdef CONFIG_CMPXCHG_LOCAL
+		freelist = c->freelist;
+		set_freepointer(s, object, freelist);
+
+		if (unlikely(!irqsafe_cpu_cmpxchg_double(
+				s->cpu_slab->freelist, s->cpu_slab->tid,
+				freelist, tid,
+				object, next_tid(tid)))) {
+
+			note_cmpxchg_failure("slab_free", s, tid);
+			goto redo;
+		}
+#else
 		set_freepointer(s, object, c->freelist);
 		c->freelist = object;
+#endif
 		stat(s, FREE_FASTPATH);
 	} else
 		__slab_free(s, page, x, addr);
 
+#ifndef CONFIG_CMPXCHG_LOCAL
 	local_irq_restore(flags);
+#endif
 }
 
 void kmem_cache_free(struct kmem_cache *s, void *x)
@@ -1879,6 +2285,148 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Give back objects that went through no debug hooks, or whose hooks
+ * already ran.
+ */
+static void __kmem_cache_free_bulk(struct kmem_cache *s, size_t size,
+				   void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	c = __this_cpu_ptr(s->cpu_slab);
+	for (i = 0; i < size; i++) {
+		void **object = p[i];
+		struct page *page = virt_to_head_page(object);
+
+		if (likely(page == c->page && c->node >= 0)) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+		} else
+			__slab_free(s, page, object, _RET_IP_);
+	}
+#ifdef CONFIG_CMPXCHG_LOCAL
+	c->tid = next_tid(c->tid);
+#endif
+	local_irq_restore(flags);
+}
+
+/**
+ * kmem_cache_alloc_bulk - allocate several objects at once
+ * @s: the cache to allocate from
+ * @flags: gfp flags, as for kmem_cache_alloc()
+ * @size: number of objects wanted
+ * @p: array receiving the objects
+ *
+ * The objects are popped off the cpu freelist with interrupts disabled
+ * once for the whole batch.  Returns @size, or 0 if not all objects could
+ * be allocated, in which case nothing is left allocated.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long irqflags;
+	size_t i;
+
+	flags &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(flags);
+	might_sleep_if(flags & __GFP_WAIT);
+
+	if (should_failslab(s->objsize, flags, s->flags))
+		return 0;
+
+	if (unlikely(s->flags & SLAB_ACCOUNT)) {
+		/* Every object needs its own charge */
+		for (i = 0; i < size; i++) {
+			p[i] = slab_alloc(s, flags, NUMA_NO_NODE, _RET_IP_);
+			if (unlikely(!p[i])) {
+				kmem_cache_free_bulk(s, i, p);
+				return 0;
+			}
+		}
+		return size;
+	}
+
+	local_irq_save(irqflags);
+	c = __this_cpu_ptr(s->cpu_slab);
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+#ifdef CONFIG_CMPXCHG_LOCAL
+			/*
+			 * __slab_alloc() may enable interrupts: fail any
+			 * lockless fastpath that raced with the pops above.
+			 */
+			c->tid = next_tid(c->tid);
+#endif
+			p[i] = __slab_alloc(s, flags, NUMA_NO_NODE, _RET_IP_, c);
+			if (unlikely(!p[i]))
+				goto error;
+
+			c = __this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+		stat(s, ALLOC_FASTPATH);
+	}
+#ifdef CONFIG_CMPXCHG_LOCAL
+	c->tid = next_tid(c->tid);
+#endif
+	local_irq_restore(irqflags);
+
+	for (i = 0; i < size; i++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+
+		kmemcheck_slab_alloc(s, flags, p[i], s->objsize);
+		kmemleak_alloc_recursive(p[i], s->objsize, 1, s->flags, flags);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->objsize, s->size,
+				       flags);
+	}
+	return size;
+
+error:
+	local_irq_restore(irqflags);
+	__kmem_cache_free_bulk(s, i, p);
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/**
+ * kmem_cache_free_bulk - free several objects at once
+ * @s: the cache the objects belong to
+ * @size: number of objects
+ * @p: array of objects
+ *
+ * Objects belonging to the cpu slab are pushed onto the cpu freelist
+ * with interrupts disabled once for the whole batch.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		slab_uncharge(s, p[i]);
+		kmemleak_free_recursive(p[i], s->flags);
+		kmemcheck_slab_free(s, p[i], s->objsize);
+		debug_check_no_locks_freed(p[i], s->objsize);
+		if (!(s->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(p[i], s->objsize);
+		trace_kmem_cache_free(_RET_IP_, p[i]);
+	}
+
+	__kmem_cache_free_bulk(s, size, p);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /* Figure out on which slab page the object resides */
 static struct page *get_object_page(const void *x)
 {
@@ -2078,6 +2626,8 @@ static inline int alloc_kmem_cache_cpus(struct kmem_cache *s, gfp_t flags)
 	if (!s->cpu_slab)
 		return 0;
 
+	init_kmem_cache_cpus(s);
+
 	return 1;
 }
 
@@ -2255,7 +2805,20 @@ static int calculate_sizes(struct kmem_cache *s, int forced_order)
 		 * the object.
 		 */
 		size += 2 * sizeof(struct track);
+#endif
+
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	if (flags & SLAB_ACCOUNT) {
+		/*
+		 * Remember the memory cgroup an object is charged to,
+		 * so that the free uncharges the right one.
+		 */
+		s->memcg_offset = size;
+		size += sizeof(void *);
+	}
+#endif
 
+#ifdef CONFIG_SLUB_DEBUG
 	if (flags & SLAB_RED_ZONE)
 		/*
 		 * Add some empty padding so that we can catch
@@ -2344,6 +2907,23 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	 * list to avoid pounding the page allocator excessively.
 	 */
 	set_min_partial(s, ilog2(s->size));
+
+	/*
+	 * Bigger objects mean fewer objects per slab, so more slabs are
+	 * needed on the cpu partial list to absorb the same number of
+	 * frees.  Debug caches track every slab on the node lists.
+	 */
+	if (kmem_cache_debug(s))
+		s->cpu_partial = 0;
+	else if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 6;
+	else if (s->size >= 256)
+		s->cpu_partial = 13;
+	else
+		s->cpu_partial = 30;
+
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -2351,8 +2931,10 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	if (!init_kmem_cache_nodes(s, gfpflags & ~SLUB_DMA))
 		goto error;
 
-	if (alloc_kmem_cache_cpus(s, gfpflags & ~SLUB_DMA))
+	if (alloc_kmem_cache_cpus(s, gfpflags & ~SLUB_DMA)) {
+		slab_register_account(s);
 		return 1;
+	}
 
 	free_kmem_cache_nodes(s);
 error:
@@ -2497,6 +3079,7 @@ void kmem_cache_destroy(struct kmem_cache *s)
 		}
 		if (s->flags & SLAB_DESTROY_BY_RCU)
 			rcu_barrier();
+		slab_unregister_account(s);
 		sysfs_slab_remove(s);
 	}
 	up_write(&slub_lock);
@@ -3928,6 +4511,29 @@ static ssize_t min_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(min_partial);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long slabs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &slabs);
+	if (err)
+		return err;
+	if (slabs && kmem_cache_debug(s))
+		return -EINVAL;
+
+	s->cpu_partial = slabs;
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -4269,6 +4875,10 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CMPXCHG_DOUBLE_CPU_FAIL, cmpxchg_double_cpu_fail);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4277,6 +4887,7 @@ static struct attribute *slab_attrs[] = {
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
 	&min_partial_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&total_objects_attr.attr,
@@ -4323,6 +4934,10 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cmpxchg_double_cpu_fail_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_drain_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
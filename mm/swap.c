@@ -39,6 +39,7 @@ int page_cluster;
 
 static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
 static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
+static DEFINE_PER_CPU(struct pagevec, lru_lazyfree_pvecs);
 
 /*
  * This path almost never happens for VM activity - pages are normally
@@ -152,6 +153,67 @@ void  rotate_reclaimable_page(struct page *page)
 	}
 }
 
+static int page_can_lazyfree(struct page *page)
+{
+	return PageLRU(page) && PageAnon(page) && PageSwapBacked(page) &&
+		!PageSwapCache(page) && !PageUnevictable(page);
+}
+
+/*
+ * Move MADV_FREE'd anonymous pages to the inactive file list, where reclaim
+ * finds them even without swap, and clear PageSwapBacked so that it knows
+ * to discard rather than swap them out.
+ */
+static void pagevec_lazyfree(struct pagevec *pvec)
+{
+	int i;
+	int pgmoved = 0;
+	struct zone *zone = NULL;
+
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+		struct zone *pagezone = page_zone(page);
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		if (page_can_lazyfree(page)) {
+			del_page_from_lru_list(zone, page, page_lru(page));
+			ClearPageActive(page);
+			ClearPageReferenced(page);
+			ClearPageSwapBacked(page);
+			add_page_to_lru_list(zone, page, LRU_INACTIVE_FILE);
+			pgmoved++;
+		}
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	count_vm_events(PGLAZYFREE, pgmoved);
+	release_pages(pvec->pages, pvec->nr, pvec->cold);
+	pagevec_reinit(pvec);
+}
+
+/**
+ * mark_page_lazyfree - make a clean anonymous page discardable
+ * @page: the page, mapped only by the caller, whose pte is clean
+ *
+ * Called from MADV_FREE with the pte lock held.
+ */
+void mark_page_lazyfree(struct page *page)
+{
+	if (page_can_lazyfree(page)) {
+		struct pagevec *pvec = &get_cpu_var(lru_lazyfree_pvecs);
+
+		page_cache_get(page);
+		if (!pagevec_add(pvec, page))
+			pagevec_lazyfree(pvec);
+		put_cpu_var(lru_lazyfree_pvecs);
+	}
+}
+
 static void update_page_reclaim_stat(struct zone *zone, struct page *page,
 				     int file, int rotated)
 {
@@ -292,6 +354,10 @@ static void drain_cpu_pagevecs(int cpu)
 		pagevec_move_tail(pvec);
 		local_irq_restore(flags);
 	}
+
+	pvec = &per_cpu(lru_lazyfree_pvecs, cpu);
+	if (pagevec_count(pvec))
+		pagevec_lazyfree(pvec);
 }
 
 void lru_add_drain(void)
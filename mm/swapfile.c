@@ -35,6 +35,7 @@
 #include <asm/tlbflush.h>
 #include <linux/swapops.h>
 #include <linux/page_cgroup.h>
+#include <linux/zswap.h>
 
 static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 				 unsigned char);
@@ -443,14 +444,16 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate one swap slot for the swap cache.  Called with swap_lock held.
+ */
+static swp_entry_t __get_swap_page(void)
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
 
-	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
 	if (swap_for_hibernation)
@@ -474,19 +477,105 @@ swp_entry_t get_swap_page(void)
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
 		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
+		if (offset)
 			return swp_entry(type, offset);
-		}
 		next = swap_list.next;
 	}
 
 	nr_swap_pages++;
 noswap:
-	spin_unlock(&swap_lock);
 	return (swp_entry_t) {0};
 }
 
+/*
+ * Swap slots are handed out from small per-cpu caches, refilled in
+ * batches, so that CPUs swapping out concurrently take swap_lock once per
+ * SWAP_SLOTS_CACHE_SIZE pages instead of once per page.  Cached slots
+ * are allocated in swap_map[] (SWAP_HAS_CACHE without a page) and are
+ * returned by drain_swap_slots_caches() when their device goes away.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	spinlock_t lock;
+	int nr;
+	swp_entry_t slots[SWAP_SLOTS_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swap_slots_cache) = {
+	.lock = __SPIN_LOCK_UNLOCKED(swap_slots_cache.lock),
+};
+
+/*
+ * Do not let the caches strand a noticeable part of the free slots.
+ */
+static bool swap_slots_cache_enabled(void)
+{
+	return nr_swap_pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry = { 0 };
+
+	if (swap_for_hibernation)
+		return entry;
+
+	cache = &get_cpu_var(swap_slots_cache);
+	spin_lock(&cache->lock);
+	if (!cache->nr && swap_slots_cache_enabled()) {
+		spin_lock(&swap_lock);
+		while (cache->nr < SWAP_SLOTS_CACHE_SIZE) {
+			entry = __get_swap_page();
+			if (!entry.val)
+				break;
+			cache->slots[cache->nr++] = entry;
+		}
+		spin_unlock(&swap_lock);
+	}
+	if (cache->nr)
+		entry = cache->slots[--cache->nr];
+	else
+		entry.val = 0;
+	spin_unlock(&cache->lock);
+	put_cpu_var(swap_slots_cache);
+
+	if (!entry.val) {
+		spin_lock(&swap_lock);
+		entry = __get_swap_page();
+		spin_unlock(&swap_lock);
+	}
+	return entry;
+}
+
+/*
+ * Give the slots of swap device @type held in the per-cpu caches back.
+ */
+static void drain_swap_slots_caches(int type)
+{
+	swp_entry_t slots[SWAP_SLOTS_CACHE_SIZE];
+	int cpu, i, nr;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swap_slots_cache, cpu);
+
+		nr = 0;
+		spin_lock(&cache->lock);
+		for (i = 0; i < cache->nr; ) {
+			if (swp_type(cache->slots[i]) == type) {
+				slots[nr++] = cache->slots[i];
+				cache->slots[i] = cache->slots[--cache->nr];
+			} else
+				i++;
+		}
+		spin_unlock(&cache->lock);
+
+		for (i = 0; i < nr; i++)
+			swapcache_free(slots[i], NULL);
+	}
+}
+
 static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
@@ -562,6 +651,8 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 	/* free if no reference */
 	if (!usage) {
 		struct gendisk *disk = p->bdev->bd_disk;
+
+		zswap_invalidate(p->type, offset);
 		if (offset < p->lowest_bit)
 			p->lowest_bit = offset;
 		if (offset > p->highest_bit)
@@ -1646,6 +1737,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	drain_swap_slots_caches(type);
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
@@ -1702,6 +1795,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	zswap_invalidate_area(type);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -2212,10 +2306,10 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 		/* set SWAP_HAS_CACHE if there is no cache and entry is used */
 		if (!has_cache && count)
 			has_cache = SWAP_HAS_CACHE;
-		else if (has_cache)		/* someone else added cache */
+		else if (has_cache && count)	/* someone else added cache */
 			err = -EEXIST;
 		else				/* no users remaining */
-			err = -ENOENT;
+			err = -ENOENT;		/* or slot cached for swapout */
 
 	} else if (count || has_cache) {
 
@@ -45,6 +45,7 @@
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
+#include <linux/ksm.h>
 
 #include "internal.h"
 
@@ -128,6 +129,12 @@ struct scan_control {
  * From 0 .. 100.  Higher means more swappy.
  */
 int vm_swappiness = 60;
+
+/*
+ * Maximum number of tasks allowed in direct reclaim on a zone at once,
+ * 0 means no limit.
+ */
+int sysctl_direct_reclaim_limit = 8;
 long vm_total_pages;	/* The total number of pages which the VM controls */
 
 static LIST_HEAD(shrinker_list);
@@ -659,6 +666,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		struct address_space *mapping;
 		struct page *page;
 		int may_enter_fs;
+		int lazyfree;
 
 		cond_resched();
 
@@ -711,11 +719,18 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * MADV_FREE'd anonymous memory is discarded if still clean,
+		 * without going through swap.
+		 */
+		lazyfree = PageAnon(page) && !PageSwapBacked(page) &&
+			   !PageKsm(page);
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
 		 */
-		if (PageAnon(page) && !PageSwapCache(page)) {
+		if (PageAnon(page) && !lazyfree && !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
 			if (!add_to_swap(page))
@@ -729,7 +744,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
-		if (page_mapped(page) && mapping) {
+		if (page_mapped(page) && (mapping || lazyfree)) {
 			switch (try_to_unmap(page, TTU_UNMAP)) {
 			case SWAP_FAIL:
 				goto activate_locked;
@@ -815,7 +830,16 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (lazyfree) {
+			/* Unmapped, clean and off the LRU: only we hold it */
+			if (!page_freeze_refs(page, 1))
+				goto keep_locked;
+			if (PageDirty(page)) {
+				page_unfreeze_refs(page, 1);
+				goto keep_locked;
+			}
+			count_vm_event(PGLAZYFREED);
+		} else if (!mapping || !__remove_mapping(mapping, page))
 			goto keep_locked;
 
 		/*
@@ -1739,6 +1763,45 @@ static void set_lumpy_reclaim_mode(int priority, struct scan_control *sc)
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
+/*
+ * Many tasks entering direct reclaim on the same zone at once do little
+ * but contend on zone->lru_lock and isolate far more pages than needed.
+ * Let at most sysctl_direct_reclaim_limit of them scan a zone; the others
+ * wait for them and kswapd to make progress.
+ *
+ * Returns 1 if the caller took a reclaim slot and must release it with
+ * direct_reclaim_exit(), 0 if it may reclaim without a slot, and -1 if
+ * the zone no longer needs reclaiming by this task.
+ */
+static int direct_reclaim_enter(struct zone *zone, struct scan_control *sc)
+{
+	int limit = sysctl_direct_reclaim_limit;
+
+	if (!limit || current_is_kswapd() || !scanning_global_lru(sc))
+		return 0;
+
+	while (atomic_inc_return(&zone->nr_direct_reclaim) > limit) {
+		atomic_dec(&zone->nr_direct_reclaim);
+
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current))
+			return -1;
+
+		/* Someone else balanced the zone while we waited */
+		if (zone_watermark_ok(zone, sc->order, high_wmark_pages(zone),
+				      0, 0))
+			return -1;
+
+		congestion_wait(BLK_RW_ASYNC, HZ/50);
+	}
+	return 1;
+}
+
+static void direct_reclaim_exit(struct zone *zone)
+{
+	atomic_dec(&zone->nr_direct_reclaim);
+}
+
 static void shrink_zone(int priority, struct zone *zone,
 				struct scan_control *sc)
 {
@@ -1747,6 +1810,11 @@ static void shrink_zone(int priority, struct zone *zone,
 	enum lru_list l;
 	unsigned long nr_reclaimed = sc->nr_reclaimed;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	int throttled;
+
+	throttled = direct_reclaim_enter(zone, sc);
+	if (throttled < 0)
+		return;
 
 	get_scan_count(zone, sc, nr, priority);
 
@@ -1785,6 +1853,9 @@ static void shrink_zone(int priority, struct zone *zone,
 	if (inactive_anon_is_low(zone, sc) && nr_swap_pages > 0)
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
+	if (throttled)
+		direct_reclaim_exit(zone);
+
 	throttle_vm_writeout(sc->gfp_mask);
 }
 
@@ -2001,6 +2072,38 @@ unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 	return sc.nr_reclaimed;
 }
 
+/*
+ * Background reclaim for a memcg over its high watermark: one pass of
+ * shrink_zone() at @priority over every zone, as balance_pgdat() does for
+ * a node, stopping once @nr_to_reclaim pages have been freed.
+ */
+unsigned long mem_cgroup_shrink_bg(struct mem_cgroup *mem,
+				   unsigned long nr_to_reclaim,
+				   bool noswap, unsigned int swappiness,
+				   int priority)
+{
+	struct zone *zone;
+	struct scan_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.nr_to_reclaim = max_t(unsigned long, nr_to_reclaim,
+				       SWAP_CLUSTER_MAX),
+		.may_writepage = !laptop_mode,
+		.may_unmap = 1,
+		.may_swap = !noswap,
+		.swappiness = swappiness,
+		.order = 0,
+		.mem_cgroup = mem,
+	};
+
+	for_each_populated_zone(zone) {
+		shrink_zone(priority, zone, &sc);
+		if (sc.nr_reclaimed >= sc.nr_to_reclaim)
+			break;
+	}
+
+	return sc.nr_reclaimed;
+}
+
 unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem_cont,
 					   gfp_t gfp_mask,
 					   bool noswap,
@@ -0,0 +1,356 @@
+/*
+ * Compressed cache in front of the swap devices.
+ *
+ * Anonymous pages on their way out to swap are LZO-compressed into a RAM
+ * pool instead, and only reach the swap device once the pool has grown to
+ * its limit or a page does not compress.  Swapin decompresses from the pool
+ * without any I/O.
+ *
+ * The pool is made of individually kmalloc'ed compressed pages, indexed by
+ * swap offset in one rbtree per swap device.  An entry lives until its swap
+ * slot is freed, so a clean swap cache page dropped by reclaim can be read
+ * back from the pool again.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/rbtree.h>
+#include <linux/percpu.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+#include <linux/zswap.h>
+
+/* Compress pages only while this is set: zswap.enabled=1 or at runtime */
+static int zswap_enabled __read_mostly;
+module_param_named(enabled, zswap_enabled, int, 0644);
+
+/* The pool may take at most this percentage of RAM */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/* Pages compressing to more than this are sent to the swap device */
+#define ZSWAP_MAX_COMPRESSED	(PAGE_SIZE * 3 / 4)
+
+struct zswap_entry {
+	struct rb_node rbnode;
+	pgoff_t offset;
+	unsigned int length;
+	u8 data[0];
+};
+
+struct zswap_tree {
+	struct rb_root root;
+	spinlock_t lock;
+};
+
+static struct zswap_tree zswap_trees[MAX_SWAPFILES];
+static bool zswap_initialized __read_mostly;
+
+static DEFINE_PER_CPU(void *, zswap_workmem);
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+
+/* Statistics, exported through debugfs */
+static atomic_long_t zswap_pool_bytes = ATOMIC_LONG_INIT(0);
+static atomic_long_t zswap_stored_pages = ATOMIC_LONG_INIT(0);
+static u64 zswap_pool_hits;
+static u64 zswap_pool_misses;
+static u64 zswap_reject_pool_full;
+static u64 zswap_reject_compress;
+static u64 zswap_reject_alloc;
+
+static bool zswap_pool_full(void)
+{
+	unsigned long max_bytes;
+
+	max_bytes = (totalram_pages * zswap_max_pool_percent / 100) << PAGE_SHIFT;
+	return atomic_long_read(&zswap_pool_bytes) >= max_bytes;
+}
+
+static struct zswap_entry *zswap_rb_search(struct rb_root *root,
+					   pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (offset < entry->offset)
+			node = node->rb_left;
+		else if (offset > entry->offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * Insert @entry, returning the entry it replaced for the same offset,
+ * if any.
+ */
+static struct zswap_entry *zswap_rb_insert(struct rb_root *root,
+					   struct zswap_entry *entry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *old;
+
+	while (*link) {
+		parent = *link;
+		old = rb_entry(parent, struct zswap_entry, rbnode);
+		if (entry->offset < old->offset)
+			link = &parent->rb_left;
+		else if (entry->offset > old->offset)
+			link = &parent->rb_right;
+		else {
+			rb_replace_node(&old->rbnode, &entry->rbnode, root);
+			return old;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return NULL;
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	atomic_long_sub(entry->length, &zswap_pool_bytes);
+	atomic_long_dec(&zswap_stored_pages);
+	kfree(entry);
+}
+
+/**
+ * zswap_store - try to keep a page being swapped out in the compressed pool
+ * @page: locked swap cache page
+ *
+ * Returns 0 if the page is now held by the pool and need not be written
+ * to the swap device, negative errno otherwise.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page) };
+	struct zswap_tree *tree = &zswap_trees[swp_type(swp)];
+	struct zswap_entry *entry, *old;
+	size_t dlen = PAGE_SIZE * 2;
+	u8 *src, *dst;
+	int ret;
+
+	VM_BUG_ON(!PageLocked(page));
+	VM_BUG_ON(!PageSwapCache(page));
+
+	if (!zswap_initialized)
+		return -ENODEV;
+
+	if (!zswap_enabled) {
+		ret = -ENODEV;
+		goto reject;
+	}
+
+	if (zswap_pool_full()) {
+		zswap_reject_pool_full++;
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_workmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK || dlen > ZSWAP_MAX_COMPRESSED) {
+		put_cpu_var(zswap_dstmem);
+		zswap_reject_compress++;
+		ret = -EINVAL;
+		goto reject;
+	}
+
+	/*
+	 * We are in reclaim: do not recurse into it, and leave the
+	 * emergency reserves to those who free memory without our help.
+	 */
+	entry = kmalloc(sizeof(*entry) + dlen, GFP_NOWAIT | __GFP_NORETRY |
+			__GFP_NOMEMALLOC | __GFP_NOWARN);
+	if (!entry) {
+		put_cpu_var(zswap_dstmem);
+		zswap_reject_alloc++;
+		ret = -ENOMEM;
+		goto reject;
+	}
+	entry->offset = swp_offset(swp);
+	entry->length = dlen;
+	memcpy(entry->data, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	atomic_long_add(dlen, &zswap_pool_bytes);
+	atomic_long_inc(&zswap_stored_pages);
+
+	spin_lock(&tree->lock);
+	old = zswap_rb_insert(&tree->root, entry);
+	spin_unlock(&tree->lock);
+
+	/* The page was redirtied and written again to the same slot */
+	if (old)
+		zswap_free_entry(old);
+	return 0;
+
+reject:
+	/*
+	 * The page goes to the swap device: an older copy in the pool,
+	 * from before the page was redirtied, must not shadow it.
+	 */
+	zswap_invalidate(swp_type(swp), swp_offset(swp));
+	return ret;
+}
+
+/**
+ * zswap_load - fill a page being swapped in from the compressed pool
+ * @page: locked, !uptodate swap cache page
+ *
+ * Returns 0 if the page was found in the pool and is now filled.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page) };
+	struct zswap_tree *tree = &zswap_trees[swp_type(swp)];
+	struct zswap_entry *entry;
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret = -ENOENT;
+
+	if (!zswap_initialized)
+		return -ENODEV;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->root, swp_offset(swp));
+	if (entry) {
+		dst = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_decompress_safe(entry->data, entry->length,
+					    dst, &dlen);
+		kunmap_atomic(dst, KM_USER0);
+		BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+	}
+	spin_unlock(&tree->lock);
+
+	if (ret)
+		zswap_pool_misses++;
+	else
+		zswap_pool_hits++;
+	return ret;
+}
+
+/*
+ * The swap slot was freed: drop its compressed copy.
+ * Called under swap_lock.
+ */
+void zswap_invalidate(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = &zswap_trees[type];
+	struct zswap_entry *entry;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->root, offset);
+	if (entry)
+		rb_erase(&entry->rbnode, &tree->root);
+	spin_unlock(&tree->lock);
+
+	if (entry)
+		zswap_free_entry(entry);
+}
+
+/*
+ * The swap device is going away: drop whatever is left of it in the pool.
+ */
+void zswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = &zswap_trees[type];
+	struct rb_node *node;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->root))) {
+		rb_erase(node, &tree->root);
+		zswap_free_entry(rb_entry(node, struct zswap_entry, rbnode));
+	}
+	spin_unlock(&tree->lock);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_get_long(void *data, u64 *val)
+{
+	*val = atomic_long_read((atomic_long_t *)data);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_long_fops, zswap_get_long, NULL, "%llu\n");
+
+static void __init zswap_debugfs_init(void)
+{
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return;
+
+	debugfs_create_file("pool_bytes", S_IRUGO, zswap_debugfs_root,
+			    &zswap_pool_bytes, &zswap_long_fops);
+	debugfs_create_file("stored_pages", S_IRUGO, zswap_debugfs_root,
+			    &zswap_stored_pages, &zswap_long_fops);
+	debugfs_create_u64("pool_hits", S_IRUGO, zswap_debugfs_root,
+			   &zswap_pool_hits);
+	debugfs_create_u64("pool_misses", S_IRUGO, zswap_debugfs_root,
+			   &zswap_pool_misses);
+	debugfs_create_u64("reject_pool_full", S_IRUGO, zswap_debugfs_root,
+			   &zswap_reject_pool_full);
+	debugfs_create_u64("reject_compress", S_IRUGO, zswap_debugfs_root,
+			   &zswap_reject_compress);
+	debugfs_create_u64("reject_alloc", S_IRUGO, zswap_debugfs_root,
+			   &zswap_reject_alloc);
+}
+#else
+static inline void zswap_debugfs_init(void)
+{
+}
+#endif
+
+static int __init zswap_init(void)
+{
+	int cpu, i;
+
+	for (i = 0; i < MAX_SWAPFILES; i++) {
+		zswap_trees[i].root = RB_ROOT;
+		spin_lock_init(&zswap_trees[i].lock);
+	}
+
+	for_each_possible_cpu(cpu) {
+		void *workmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+		u8 *dstmem = kmalloc(PAGE_SIZE * 2, GFP_KERNEL);
+
+		if (!workmem || !dstmem) {
+			kfree(workmem);
+			kfree(dstmem);
+			goto nomem;
+		}
+		per_cpu(zswap_workmem, cpu) = workmem;
+		per_cpu(zswap_dstmem, cpu) = dstmem;
+	}
+
+	zswap_initialized = true;
+	zswap_debugfs_init();
+	return 0;
+
+nomem:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zswap_workmem, cpu));
+		kfree(per_cpu(zswap_dstmem, cpu));
+		per_cpu(zswap_workmem, cpu) = NULL;
+		per_cpu(zswap_dstmem, cpu) = NULL;
+	}
+	zswap_enabled = 0;
+	printk(KERN_ERR "zswap: cannot allocate compression buffers\n");
+	return -ENOMEM;
+}
+late_initcall(zswap_init);
@@ -29,7 +29,7 @@ static const struct stp_proto br_stp_proto = {
 };
 
 static struct pernet_operations br_net_ops = {
-	.exit	= br_net_exit,
+	.exit_batch = br_net_exit_batch,
 };
 
 static int __init br_init(void)
@@ -326,6 +326,7 @@ static void br_dev_free(struct net_device *dev)
 {
 	struct net_bridge *br = netdev_priv(dev);
 
+	br_fdb_hash_free(br);
 	free_percpu(br->stats);
 	free_netdev(dev);
 }
@@ -197,6 +197,12 @@ static struct net_device *new_bridge_dev(struct net *net, const char *name)
 		return NULL;
 	}
 
+	if (br_fdb_hash_alloc(br)) {
+		free_percpu(br->stats);
+		free_netdev(dev);
+		return NULL;
+	}
+
 	spin_lock_init(&br->lock);
 	INIT_LIST_HEAD(&br->port_list);
 	spin_lock_init(&br->hash_lock);
@@ -495,17 +501,19 @@ int br_del_if(struct net_bridge *br, struct net_device *dev)
 	return 0;
 }
 
-void __net_exit br_net_exit(struct net *net)
+/* One rtnl section and one grace period for a whole batch of namespaces */
+void __net_exit br_net_exit_batch(struct list_head *net_list)
 {
 	struct net_device *dev;
+	struct net *net;
 	LIST_HEAD(list);
 
 	rtnl_lock();
-	for_each_netdev(net, dev)
-		if (dev->priv_flags & IFF_EBRIDGE)
-			del_br(netdev_priv(dev), &list);
+	list_for_each_entry(net, net_list, exit_list)
+		for_each_netdev(net, dev)
+			if (dev->priv_flags & IFF_EBRIDGE)
+				del_br(netdev_priv(dev), &list);
 
 	unregister_netdevice_many(&list);
 	rtnl_unlock();
-
 }
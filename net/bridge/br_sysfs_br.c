@@ -345,6 +345,30 @@ static ssize_t store_flush(struct device *d,
 }
 static DEVICE_ATTR(flush, S_IWUSR, NULL, store_flush);
 
+static ssize_t show_fdb_hash_size(struct device *d,
+				  struct device_attribute *attr, char *buf)
+{
+	struct net_bridge *br = to_bridge(d);
+	return sprintf(buf, "%u\n", br->hash_size);
+}
+static DEVICE_ATTR(fdb_hash_size, S_IRUGO, show_fdb_hash_size, NULL);
+
+static ssize_t show_fdb_count(struct device *d,
+			      struct device_attribute *attr, char *buf)
+{
+	struct net_bridge *br = to_bridge(d);
+	return sprintf(buf, "%u\n", br->fdb_count);
+}
+static DEVICE_ATTR(fdb_count, S_IRUGO, show_fdb_count, NULL);
+
+static ssize_t show_fdb_learned(struct device *d,
+				struct device_attribute *attr, char *buf)
+{
+	struct net_bridge *br = to_bridge(d);
+	return sprintf(buf, "%lu\n", br->fdb_learned);
+}
+static DEVICE_ATTR(fdb_learned, S_IRUGO, show_fdb_learned, NULL);
+
 #ifdef CONFIG_BRIDGE_IGMP_SNOOPING
 static ssize_t show_multicast_router(struct device *d,
 				     struct device_attribute *attr, char *buf)
@@ -698,6 +722,9 @@ static struct attribute *bridge_attrs[] = {
 	&dev_attr_gc_timer.attr,
 	&dev_attr_group_addr.attr,
 	&dev_attr_flush.attr,
+	&dev_attr_fdb_hash_size.attr,
+	&dev_attr_fdb_count.attr,
+	&dev_attr_fdb_learned.attr,
 #ifdef CONFIG_BRIDGE_IGMP_SNOOPING
 	&dev_attr_multicast_router.attr,
 	&dev_attr_multicast_snooping.attr,
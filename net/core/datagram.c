@@ -56,6 +56,7 @@
 #include <net/checksum.h>
 #include <net/sock.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #include <trace/events/skb.h>
 
 /*
@@ -196,6 +197,10 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned flags,
 		if (skb)
 			return skb;
 
+		if (sk_can_busy_loop(sk) &&
+		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
+			continue;
+
 		/* User doesn't want to wait */
 		error = -EAGAIN;
 		if (!timeo)
@@ -557,6 +562,89 @@ fault:
 }
 EXPORT_SYMBOL(skb_copy_datagram_from_iovec);
 
+/**
+ *	zerocopy_sg_from_iovec - Build a zerocopy datagram from an iovec
+ *	@skb: buffer to fill, with room for the headers in its linear part
+ *	@from: io vector to copy from
+ *	@offset: offset in the io vector to start copying from
+ *	@count: number of segments in the io vector
+ *
+ *	The linear part of the skb is filled by copy, the rest of the iovec
+ *	is pinned and attached as page frags. skb->sk is charged for the
+ *	pinned pages. The caller sets dev_zerocopy once the skb is good to
+ *	send, so that it gets told when the pages are released.
+ *
+ *	Returns 0, -EFAULT or -EMSGSIZE.
+ */
+int zerocopy_sg_from_iovec(struct sk_buff *skb, const struct iovec *from,
+			   int offset, size_t count)
+{
+	int copy = skb_headlen(skb);
+	int copied = 0;
+	int i = 0;
+
+	/* Skip over offset */
+	while (count && offset >= from->iov_len) {
+		offset -= from->iov_len;
+		++from;
+		--count;
+	}
+
+	/* Copy up to the end of the linear part */
+	while (count && copy > 0) {
+		int size = min_t(unsigned int, copy, from->iov_len - offset);
+
+		if (copy_from_user(skb->data + copied, from->iov_base + offset,
+				   size))
+			return -EFAULT;
+		copy -= size;
+		copied += size;
+		offset += size;
+		if (offset == from->iov_len) {
+			offset = 0;
+			++from;
+			--count;
+		}
+	}
+
+	for (; count; ++from, --count, offset = 0) {
+		struct page *page[MAX_SKB_FRAGS];
+		unsigned long base = (unsigned long)from->iov_base + offset;
+		int len = from->iov_len - offset;
+		int pages, pinned, truesize;
+
+		if (!len)
+			continue;
+		pages = (PAGE_ALIGN(base + len) - (base & PAGE_MASK)) >>
+			PAGE_SHIFT;
+		if (i + pages > MAX_SKB_FRAGS)
+			return -EMSGSIZE;
+		pinned = get_user_pages_fast(base, pages, 0, &page[i]);
+		if (pinned != pages) {
+			while (pinned > 0)
+				put_page(page[i + --pinned]);
+			return -EFAULT;
+		}
+
+		truesize = pages * PAGE_SIZE;
+		skb->data_len += len;
+		skb->len += len;
+		skb->truesize += truesize;
+		atomic_add(truesize, &skb->sk->sk_wmem_alloc);
+		while (len) {
+			int off = base & ~PAGE_MASK;
+			int size = min_t(int, len, PAGE_SIZE - off);
+
+			skb_fill_page_desc(skb, i, page[i], off, size);
+			base += size;
+			len -= size;
+			i++;
+		}
+	}
+	return 0;
+}
+EXPORT_SYMBOL(zerocopy_sg_from_iovec);
+
 static int skb_copy_and_csum_datagram(const struct sk_buff *skb, int offset,
 				      u8 __user *to, int len,
 				      __wsum *csump)
@@ -38,17 +38,24 @@
 #include <asm/unaligned.h>
 #include <linux/filter.h>
 
-/* No hurry in this branch */
-static void *__load_pointer(struct sk_buff *skb, int k)
+/*
+ * No hurry in this branch
+ *
+ * Also called by the load helpers of the bpf jit.
+ */
+void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+					   int k, unsigned int size)
 {
 	u8 *ptr = NULL;
 
+	if (k >= SKF_AD_OFF)
+		return NULL;
 	if (k >= SKF_NET_OFF)
 		ptr = skb_network_header(skb) + k - SKF_NET_OFF;
 	else if (k >= SKF_LL_OFF)
 		ptr = skb_mac_header(skb) + k - SKF_LL_OFF;
 
-	if (ptr >= skb->head && ptr < skb_tail_pointer(skb))
+	if (ptr >= skb->head && ptr + size <= skb_tail_pointer(skb))
 		return ptr;
 	return NULL;
 }
@@ -58,11 +65,7 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 {
 	if (k >= 0)
 		return skb_header_pointer(skb, k, size, buffer);
-	else {
-		if (k >= SKF_AD_OFF)
-			return NULL;
-		return __load_pointer(skb, k);
-	}
+	return bpf_internal_load_pointer_neg_helper(skb, k, size);
 }
 
 /**
@@ -89,8 +92,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference_bh(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -293,7 +295,14 @@ load_b:
 		/*
 		 * Handle ancillary data, which are impossible
 		 * (or very difficult) to get parsing packet contents.
+		 * Only constant offsets reach them, which lets the bpf jit
+		 * resolve them at compile time.
 		 */
+		if (fentry->code == BPF_S_LD_W_IND ||
+		    fentry->code == BPF_S_LD_H_IND ||
+		    fentry->code == BPF_S_LD_B_IND)
+			return 0;
+
 		switch (k-SKF_AD_OFF) {
 		case SKF_AD_PROTOCOL:
 			A = ntohs(skb->protocol);
@@ -631,6 +640,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = sk_run_filter;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -638,6 +648,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference_bh(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
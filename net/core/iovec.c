@@ -261,3 +261,27 @@ out_fault:
 	goto out;
 }
 EXPORT_SYMBOL(csum_partial_copy_fromiovecend);
+
+/*
+ *	Number of pages spanned by an iovec, skipping the first offset bytes
+ */
+int iov_pages(const struct iovec *iov, int offset, unsigned long nr_segs)
+{
+	unsigned long base;
+	int pages = 0;
+
+	while (nr_segs && offset >= iov->iov_len) {
+		offset -= iov->iov_len;
+		++iov;
+		--nr_segs;
+	}
+
+	for (; nr_segs; ++iov, --nr_segs) {
+		base = (unsigned long)iov->iov_base + offset;
+		pages += (PAGE_ALIGN(base + iov->iov_len - offset) -
+			  (base & PAGE_MASK)) >> PAGE_SHIFT;
+		offset = 0;
+	}
+	return pages;
+}
+EXPORT_SYMBOL(iov_pages);
@@ -54,6 +54,9 @@
  * Also moved to /proc/net/pktgen/
  * --ro
  *
+ * Receive side: "rx <dev>" to pgctrl counts the pktgen packets arriving on
+ * dev, per cpu, with their one way latency; see /proc/net/pktgen/pgrx.
+ *
  * Sept 10:  Fixed threading/locking.  Lots of bone-headed and more clever
  *    mistakes.  Also merged in DaveM's patch in the -pre6 patch.
  * --Ben Greear <greearb@candelatech.com>
@@ -172,7 +175,7 @@
 #include <asm/dma.h>
 #include <asm/div64.h>		/* do_div */
 
-#define VERSION	"2.74"
+#define VERSION	"2.75"
 #define IP_NAME_SZ 32
 #define MAX_MPLS_LABELS 16 /* This is the max label stack depth */
 #define MPLS_STACK_BOTTOM htonl(0x00000100)
@@ -211,6 +214,7 @@
 #define PKTGEN_MAGIC 0xbe9be955
 #define PG_PROC_DIR "pktgen"
 #define PGCTRL	    "pgctrl"
+#define PGRX	    "pgrx"
 static struct proc_dir_entry *pg_proc_dir;
 
 #define MAX_CFLOWS  65536
@@ -440,6 +444,10 @@ static int pktgen_device_event(struct notifier_block *, unsigned long, void *);
 static void pktgen_run_all_threads(void);
 static void pktgen_reset_all_threads(void);
 static void pktgen_stop_all_threads_ifs(void);
+static void pktgen_rx_device_gone(struct net_device *dev);
+static int pktgen_rx_start(const char *ifname);
+static void pktgen_rx_stop(void);
+static void pktgen_rx_reset(void);
 
 static void pktgen_stop(struct pktgen_thread *t);
 static void pktgen_clear_counters(struct pktgen_dev *pkt_dev);
@@ -500,6 +508,18 @@ static ssize_t pgctrl_write(struct file *file, const char __user *buf,
 	else if (!strcmp(data, "reset"))
 		pktgen_reset_all_threads();
 
+	else if (!strncmp(data, "rx ", 3)) {
+		err = pktgen_rx_start(data + 3);
+		if (err)
+			goto out;
+	}
+
+	else if (!strcmp(data, "rx_stop"))
+		pktgen_rx_stop();
+
+	else if (!strcmp(data, "rx_reset"))
+		pktgen_rx_reset();
+
 	else
 		pr_warning("Unknown command: %s\n", data);
 
@@ -1930,20 +1950,30 @@ static void pktgen_change_name(struct net_device *dev)
 	list_for_each_entry(t, &pktgen_threads, th_list) {
 		struct pktgen_dev *pkt_dev;
 
+		/* every pktgen device of dev, keeping their "@..." suffixes */
 		list_for_each_entry(pkt_dev, &t->if_list, list) {
+			char name[sizeof(pkt_dev->odevname)];
+			const char *suffix;
+
 			if (pkt_dev->odev != dev)
 				continue;
 
-			remove_proc_entry(pkt_dev->entry->name, pg_proc_dir);
+			suffix = strchr(pkt_dev->odevname, '@');
+			snprintf(name, sizeof(name), "%s%s", dev->name,
+				 suffix ? suffix : "");
+
+			if (pkt_dev->entry)
+				remove_proc_entry(pkt_dev->entry->name,
+						  pg_proc_dir);
+			strcpy(pkt_dev->odevname, name);
 
-			pkt_dev->entry = proc_create_data(dev->name, 0600,
+			pkt_dev->entry = proc_create_data(name, 0600,
 							  pg_proc_dir,
 							  &pktgen_if_fops,
 							  pkt_dev);
 			if (!pkt_dev->entry)
 				pr_err("can't move proc entry for '%s'\n",
-				       dev->name);
-			break;
+				       name);
 		}
 	}
 }
@@ -1967,6 +1997,7 @@ static int pktgen_device_event(struct notifier_block *unused,
 
 	case NETDEV_UNREGISTER:
 		pktgen_mark_device(dev->name);
+		pktgen_rx_device_gone(dev);
 		break;
 	}
 
@@ -3501,6 +3532,12 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		pkt_dev->last_pkt_size = pkt_dev->skb->len;
 		pkt_dev->allocated_skbs++;
 		pkt_dev->clone_count = 0;	/* reset counter */
+	} else if (pkt_dev->last_ok &&
+		   pkt_dev->queue_map_min < pkt_dev->queue_map_max &&
+		   !(pkt_dev->flags & F_QUEUE_MAP_CPU)) {
+		/* spread the copies of a cloned skb over the queue range */
+		set_cur_queue_map(pkt_dev);
+		skb_set_queue_mapping(pkt_dev->skb, pkt_dev->cur_queue_map);
 	}
 
 	if (pkt_dev->delay && pkt_dev->last_ok)
@@ -3511,7 +3548,7 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 	__netif_tx_lock_bh(txq);
 
-	if (unlikely(netif_tx_queue_stopped(txq) || netif_tx_queue_frozen(txq))) {
+	if (unlikely(netif_xmit_frozen_or_stopped(txq))) {
 		ret = NETDEV_TX_BUSY;
 		pkt_dev->last_ok = 0;
 		goto unlock;
@@ -3862,6 +3899,244 @@ static int pktgen_remove_device(struct pktgen_thread *t,
 	return 0;
 }
 
+/*
+ * Receive side: count the pktgen packets arriving on one device, per cpu,
+ * for the receive rate and, from the send timestamp in the pktgen header,
+ * the one way latency.  The latency is only meaningful with the clocks of
+ * both ends in sync (or both on one host) and with clone_skb 0, as the
+ * copies of a cloned skb all carry the timestamp of the first.
+ */
+struct pktgen_rx_stats {
+	u64 packets;
+	u64 bytes;
+	ktime_t first;		/* arrival of the first packet */
+	ktime_t last;		/* and of the last one */
+	u64 lat_count;		/* packets with a sane timestamp */
+	u64 lat_sum;		/* nsecs */
+	u64 lat_min;
+	u64 lat_max;
+};
+
+static DEFINE_PER_CPU(struct pktgen_rx_stats, pktgen_rx_stats);
+
+static int pktgen_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev);
+
+static struct packet_type pktgen_rx_ip __read_mostly = {
+	.type = cpu_to_be16(ETH_P_IP),
+	.func = pktgen_rcv,
+};
+
+static struct packet_type pktgen_rx_ipv6 __read_mostly = {
+	.type = cpu_to_be16(ETH_P_IPV6),
+	.func = pktgen_rcv,
+};
+
+/* The device counted on, under pktgen_thread_lock */
+static struct net_device *pktgen_rx_dev;
+
+/* Offset of the pktgen header in a UDP packet, or -1 */
+static int pktgen_rx_offset(const struct sk_buff *skb,
+			    const struct packet_type *pt)
+{
+	if (pt == &pktgen_rx_ip) {
+		struct iphdr _iph;
+		const struct iphdr *iph;
+
+		iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+		if (!iph || iph->ihl < 5 || iph->protocol != IPPROTO_UDP ||
+		    (iph->frag_off & htons(IP_MF | IP_OFFSET)))
+			return -1;
+		return iph->ihl * 4 + sizeof(struct udphdr);
+	} else {
+		struct ipv6hdr _ip6h;
+		const struct ipv6hdr *ip6h;
+
+		ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+		if (!ip6h || ip6h->nexthdr != IPPROTO_UDP)
+			return -1;
+		return sizeof(struct ipv6hdr) + sizeof(struct udphdr);
+	}
+}
+
+static int pktgen_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_rx_stats *s;
+	struct pktgen_hdr _pgh;
+	const struct pktgen_hdr *pgh;
+	ktime_t now, sent;
+	s64 lat;
+	int offset;
+
+	if (skb->pkt_type == PACKET_OTHERHOST)
+		goto out;
+
+	offset = pktgen_rx_offset(skb, pt);
+	if (offset < 0)
+		goto out;
+	pgh = skb_header_pointer(skb, offset, sizeof(_pgh), &_pgh);
+	if (!pgh || pgh->pgh_magic != htonl(PKTGEN_MAGIC))
+		goto out;
+
+	now = ktime_get_real();
+	sent = ktime_set(ntohl(pgh->tv_sec),
+			 ntohl(pgh->tv_usec) * NSEC_PER_USEC);
+	lat = ktime_to_ns(ktime_sub(now, sent));
+
+	/* in softirq context, the cpu stays */
+	s = &__get_cpu_var(pktgen_rx_stats);
+	if (!s->packets)
+		s->first = now;
+	s->last = now;
+	s->packets++;
+	s->bytes += skb->len + skb->mac_len;
+
+	if (lat >= 0) {
+		if (!s->lat_count || lat < s->lat_min)
+			s->lat_min = lat;
+		if (lat > s->lat_max)
+			s->lat_max = lat;
+		s->lat_sum += lat;
+		s->lat_count++;
+	}
+out:
+	kfree_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+/* Called with pktgen_thread_lock held */
+static void __pktgen_rx_stop(void)
+{
+	if (!pktgen_rx_dev)
+		return;
+
+	dev_remove_pack(&pktgen_rx_ip);
+	dev_remove_pack(&pktgen_rx_ipv6);
+	dev_put(pktgen_rx_dev);
+	pktgen_rx_dev = NULL;
+}
+
+static int pktgen_rx_start(const char *ifname)
+{
+	struct net_device *dev;
+
+	dev = dev_get_by_name(&init_net, ifname);
+	if (!dev) {
+		pr_err("no such netdevice: \"%s\"\n", ifname);
+		return -ENODEV;
+	}
+
+	mutex_lock(&pktgen_thread_lock);
+	__pktgen_rx_stop();
+	pktgen_rx_dev = dev;
+	pktgen_rx_ip.dev = dev;
+	pktgen_rx_ipv6.dev = dev;
+	dev_add_pack(&pktgen_rx_ip);
+	dev_add_pack(&pktgen_rx_ipv6);
+	mutex_unlock(&pktgen_thread_lock);
+	return 0;
+}
+
+static void pktgen_rx_stop(void)
+{
+	mutex_lock(&pktgen_thread_lock);
+	__pktgen_rx_stop();
+	mutex_unlock(&pktgen_thread_lock);
+}
+
+static void pktgen_rx_device_gone(struct net_device *dev)
+{
+	mutex_lock(&pktgen_thread_lock);
+	if (pktgen_rx_dev == dev)
+		__pktgen_rx_stop();
+	mutex_unlock(&pktgen_thread_lock);
+}
+
+/* Racy against the packets being counted: stop first for exact numbers */
+static void pktgen_rx_reset(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(pktgen_rx_stats, cpu), 0,
+		       sizeof(struct pktgen_rx_stats));
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	struct pktgen_rx_stats total = { 0 };
+	ktime_t elapsed;
+	u64 pps = 0, bps = 0, ns;
+	int cpu;
+
+	mutex_lock(&pktgen_thread_lock);
+	seq_printf(seq, "RX: %s\n", pktgen_rx_dev ? pktgen_rx_dev->name :
+						    "off");
+	mutex_unlock(&pktgen_thread_lock);
+
+	for_each_possible_cpu(cpu) {
+		const struct pktgen_rx_stats *s = &per_cpu(pktgen_rx_stats, cpu);
+
+		if (!s->packets)
+			continue;
+		seq_printf(seq, "     cpu%d: pkts: %llu  bytes: %llu\n", cpu,
+			   (unsigned long long)s->packets,
+			   (unsigned long long)s->bytes);
+
+		if (!total.packets || ktime_lt(s->first, total.first))
+			total.first = s->first;
+		if (!total.packets || ktime_lt(total.last, s->last))
+			total.last = s->last;
+		total.packets += s->packets;
+		total.bytes += s->bytes;
+		if (s->lat_count) {
+			if (!total.lat_count || s->lat_min < total.lat_min)
+				total.lat_min = s->lat_min;
+			if (s->lat_max > total.lat_max)
+				total.lat_max = s->lat_max;
+			total.lat_sum += s->lat_sum;
+			total.lat_count += s->lat_count;
+		}
+	}
+
+	elapsed = ktime_sub(total.last, total.first);
+	ns = ktime_to_ns(elapsed);
+	if (ns) {
+		pps = div64_u64(total.packets * NSEC_PER_SEC, ns);
+		bps = div64_u64(total.bytes * 8 * NSEC_PER_SEC, ns);
+	}
+
+	seq_printf(seq, "Total: pkts: %llu  bytes: %llu  time: %lluus\n",
+		   (unsigned long long)total.packets,
+		   (unsigned long long)total.bytes,
+		   (unsigned long long)ktime_to_us(elapsed));
+	seq_printf(seq, "     %llupps %lluMb/sec (%llubps)\n",
+		   (unsigned long long)pps,
+		   (unsigned long long)div64_u64(bps, 1000000),
+		   (unsigned long long)bps);
+	if (total.lat_count)
+		seq_printf(seq, "     latency min: %lluns  avg: %lluns  max: %lluns\n",
+			   (unsigned long long)total.lat_min,
+			   (unsigned long long)div64_u64(total.lat_sum,
+							 total.lat_count),
+			   (unsigned long long)total.lat_max);
+	return 0;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, NULL);
+}
+
+static const struct file_operations pktgen_rx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
 static int __init pg_init(void)
 {
 	int cpu;
@@ -3880,6 +4155,14 @@ static int __init pg_init(void)
 		return -EINVAL;
 	}
 
+	pe = proc_create(PGRX, 0400, pg_proc_dir, &pktgen_rx_fops);
+	if (pe == NULL) {
+		pr_err("ERROR: cannot create %s procfs entry\n", PGRX);
+		remove_proc_entry(PGCTRL, pg_proc_dir);
+		proc_net_remove(&init_net, PG_PROC_DIR);
+		return -EINVAL;
+	}
+
 	/* Register us to receive netdevice events */
 	register_netdevice_notifier(&pktgen_notifier_block);
 
@@ -3895,6 +4178,7 @@ static int __init pg_init(void)
 	if (list_empty(&pktgen_threads)) {
 		pr_err("ERROR: Initialization failed for all threads\n");
 		unregister_netdevice_notifier(&pktgen_notifier_block);
+		remove_proc_entry(PGRX, pg_proc_dir);
 		remove_proc_entry(PGCTRL, pg_proc_dir);
 		proc_net_remove(&init_net, PG_PROC_DIR);
 		return -ENODEV;
@@ -3921,7 +4205,10 @@ static void __exit pg_cleanup(void)
 	/* Un-register us from receiving netdevice events */
 	unregister_netdevice_notifier(&pktgen_notifier_block);
 
+	pktgen_rx_stop();
+
 	/* Clean up proc file system */
+	remove_proc_entry(PGRX, pg_proc_dir);
 	remove_proc_entry(PGCTRL, pg_proc_dir);
 	proc_net_remove(&init_net, PG_PROC_DIR);
 }
@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
 
 #include <net/request_sock.h>
 
@@ -109,6 +110,9 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 	size_t lopt_size = sizeof(struct listen_sock) +
 		lopt->nr_table_entries * sizeof(struct request_sock *);
 
+	/* Wait for the SYNs processed without the listener lock */
+	synchronize_rcu();
+
 	if (lopt->qlen != 0) {
 		unsigned int i;
 
@@ -0,0 +1,281 @@
+/*
+ * net/core/rx_drop.c	Early drop of unwanted packets on receive.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * A device may be given a set of IPv4 source addresses and of TCP or UDP
+ * destination ports to drop.  The set is looked up in netif_rx() and
+ * netif_receive_skb(), before the packets are steered to another cpu,
+ * shown to the taps or handed to the protocols: a flood costs the
+ * driver and a hash lookup, nothing else.
+ *
+ * The rules are changed through /sys/class/net/<dev>/rx_drop, under
+ * RTNL, and read under RCU on receive.
+ */
+
+#include <linux/kernel.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/jhash.h>
+#include <linux/inet.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/rculist.h>
+#include <linux/rtnetlink.h>
+#include <net/ip.h>
+#include <net/rx_drop.h>
+
+#define RX_DROP_HASH_BITS	8
+#define RX_DROP_HASH_SIZE	(1 << RX_DROP_HASH_BITS)
+
+/* Either a source address, or a protocol and a destination port */
+struct rx_drop_rule {
+	struct hlist_node	node;
+	__be32			saddr;
+	__be16			dport;
+	u8			protocol;
+	struct rcu_head		rcu;
+};
+
+struct rx_drop_table {
+	unsigned int		nr_addr;
+	unsigned int		nr_port;
+	unsigned long __percpu	*dropped;
+	struct hlist_head	hash[RX_DROP_HASH_SIZE];
+};
+
+static inline struct hlist_head *rx_drop_bucket(const struct rx_drop_table *t,
+						 __be32 saddr, u8 protocol,
+						 __be16 dport)
+{
+	u32 h = jhash_2words((__force u32)saddr,
+			     (protocol << 16) | (__force u16)dport, 0);
+
+	return (struct hlist_head *)&t->hash[h & (RX_DROP_HASH_SIZE - 1)];
+}
+
+static struct rx_drop_rule *rx_drop_find(const struct rx_drop_table *t,
+					 __be32 saddr, u8 protocol,
+					 __be16 dport)
+{
+	struct rx_drop_rule *r;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(r, n, rx_drop_bucket(t, saddr, protocol, dport),
+				 node)
+		if (r->saddr == saddr && r->protocol == protocol &&
+		    r->dport == dport)
+			return r;
+	return NULL;
+}
+
+/* skb->data is the network header, as the drivers left it */
+bool __rx_drop_match(const struct rx_drop_table *t, struct sk_buff *skb)
+{
+	const struct iphdr *iph;
+	const __be16 *ports;
+	unsigned int ihl;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    !pskb_may_pull(skb, sizeof(struct iphdr)))
+		return false;
+
+	iph = (const struct iphdr *)skb->data;
+	if (t->nr_addr && rx_drop_find(t, iph->saddr, 0, 0))
+		goto drop;
+
+	if (!t->nr_port ||
+	    (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP) ||
+	    (iph->frag_off & htons(IP_OFFSET)))
+		return false;
+
+	ihl = iph->ihl * 4;
+	if (!pskb_may_pull(skb, ihl + 2 * sizeof(__be16)))
+		return false;
+	iph = (const struct iphdr *)skb->data;
+	ports = (const __be16 *)(skb->data + ihl);
+	if (!rx_drop_find(t, 0, iph->protocol, ports[1]))
+		return false;
+drop:
+	this_cpu_inc(*t->dropped);
+	return true;
+}
+
+ssize_t rx_drop_show(const struct net_device *dev, char *buf)
+{
+	const struct rx_drop_table *t = dev->rx_drop;
+	struct rx_drop_rule *r;
+	struct hlist_node *n;
+	ssize_t len = 0;
+	int i;
+
+	if (!t)
+		return 0;
+
+	for (i = 0; i < RX_DROP_HASH_SIZE; i++) {
+		hlist_for_each_entry(r, n, &t->hash[i], node) {
+			if (len >= PAGE_SIZE - 32)
+				return len;
+			if (r->saddr)
+				len += sprintf(buf + len, "%pI4\n", &r->saddr);
+			else
+				len += sprintf(buf + len, "%s:%u\n",
+					       r->protocol == IPPROTO_TCP ?
+					       "tcp" : "udp",
+					       ntohs(r->dport));
+		}
+	}
+	return len;
+}
+
+ssize_t rx_drop_count_show(const struct net_device *dev, char *buf)
+{
+	const struct rx_drop_table *t = dev->rx_drop;
+	unsigned long dropped = 0;
+	int cpu;
+
+	if (t)
+		for_each_possible_cpu(cpu)
+			dropped += *per_cpu_ptr(t->dropped, cpu);
+	return sprintf(buf, "%lu\n", dropped);
+}
+
+static void rx_drop_rule_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct rx_drop_rule, rcu));
+}
+
+static void rx_drop_del(struct rx_drop_table *t, struct rx_drop_rule *r)
+{
+	if (r->saddr)
+		t->nr_addr--;
+	else
+		t->nr_port--;
+	hlist_del_rcu(&r->node);
+	call_rcu(&r->rcu, rx_drop_rule_free_rcu);
+}
+
+static struct rx_drop_table *rx_drop_table_get(struct net_device *dev)
+{
+	struct rx_drop_table *t = dev->rx_drop;
+
+	if (t)
+		return t;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
+	t->dropped = alloc_percpu(unsigned long);
+	if (!t->dropped) {
+		kfree(t);
+		return NULL;
+	}
+	rcu_assign_pointer(dev->rx_drop, t);
+	return t;
+}
+
+/*
+ * Apply one command: "+<address>" or "-<address>" for a source address,
+ * "+tcp:<port>", "-udp:<port>"... for a destination port, "clear" to
+ * remove all the rules.  Called under RTNL.
+ */
+int rx_drop_change(struct net_device *dev, const char *buf, size_t len)
+{
+	struct rx_drop_table *t;
+	struct rx_drop_rule *r;
+	struct hlist_node *n, *next;
+	__be32 saddr = 0;
+	__be16 dport = 0;
+	u8 protocol = 0;
+	bool add;
+	int i;
+
+	ASSERT_RTNL();
+
+	if (len == 5 && !strncmp(buf, "clear", 5)) {
+		t = dev->rx_drop;
+		if (!t)
+			return 0;
+		for (i = 0; i < RX_DROP_HASH_SIZE; i++)
+			hlist_for_each_entry_safe(r, n, next, &t->hash[i], node)
+				rx_drop_del(t, r);
+		return 0;
+	}
+
+	if (len < 2 || (buf[0] != '+' && buf[0] != '-'))
+		return -EINVAL;
+	add = buf[0] == '+';
+	buf++;
+	len--;
+
+	if (len > 4 && (!strncmp(buf, "tcp:", 4) || !strncmp(buf, "udp:", 4))) {
+		char num[6];
+		unsigned long port;
+
+		protocol = buf[0] == 't' ? IPPROTO_TCP : IPPROTO_UDP;
+		if (len - 4 >= sizeof(num))
+			return -EINVAL;
+		memcpy(num, buf + 4, len - 4);
+		num[len - 4] = '\0';
+		if (strict_strtoul(num, 10, &port) || !port || port > 0xffff)
+			return -EINVAL;
+		dport = htons(port);
+	} else {
+		const char *end;
+
+		if (!in4_pton(buf, len, (u8 *)&saddr, -1, &end) ||
+		    end != buf + len || !saddr)
+			return -EINVAL;
+	}
+
+	t = rx_drop_table_get(dev);
+	if (!t)
+		return -ENOMEM;
+
+	r = rx_drop_find(t, saddr, protocol, dport);
+	if (!add) {
+		if (!r)
+			return -ENOENT;
+		rx_drop_del(t, r);
+		return 0;
+	}
+	if (r)
+		return 0;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+	r->saddr = saddr;
+	r->protocol = protocol;
+	r->dport = dport;
+	hlist_add_head_rcu(&r->node, rx_drop_bucket(t, saddr, protocol, dport));
+	if (saddr)
+		t->nr_addr++;
+	else
+		t->nr_port++;
+	return 0;
+}
+
+/* The device is being freed: nobody can look at its rules anymore */
+void rx_drop_flush(struct net_device *dev)
+{
+	struct rx_drop_table *t = dev->rx_drop;
+	struct rx_drop_rule *r;
+	struct hlist_node *n, *next;
+	int i;
+
+	if (!t)
+		return;
+
+	for (i = 0; i < RX_DROP_HASH_SIZE; i++)
+		hlist_for_each_entry_safe(r, n, next, &t->hash[i], node)
+			kfree(r);
+	free_percpu(t->dropped);
+	kfree(t);
+	dev->rx_drop = NULL;
+}
@@ -340,6 +340,17 @@ static void skb_release_data(struct sk_buff *skb)
 				put_page(skb_shinfo(skb)->frags[i].page);
 		}
 
+		/*
+		 * The frags were user pages: tell their owner the lower
+		 * device is done with them.
+		 */
+		if (skb_shinfo(skb)->tx_flags.dev_zerocopy) {
+			struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
+
+			if (uarg->callback)
+				uarg->callback(uarg);
+		}
+
 		if (skb_has_frags(skb))
 			skb_drop_fraglist(skb);
 
@@ -430,6 +441,41 @@ void __kfree_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(__kfree_skb);
 
+#define SKB_FREE_BULK	16
+
+/**
+ *	__kfree_skb_list - private function
+ *	@skb: first buffer of a list linked through ->next
+ *
+ *	Like __kfree_skb() on every buffer of the list, but the sk_buff
+ *	heads from skbuff_head_cache are handed back to the slab allocator
+ *	in batches.
+ */
+void __kfree_skb_list(struct sk_buff *skb)
+{
+	void *heads[SKB_FREE_BULK];
+	size_t n = 0;
+
+	while (skb) {
+		struct sk_buff *next = skb->next;
+
+		WARN_ON(atomic_read(&skb->users));
+		skb_release_all(skb);
+		if (skb->fclone == SKB_FCLONE_UNAVAILABLE) {
+			heads[n++] = skb;
+			if (n == SKB_FREE_BULK) {
+				kmem_cache_free_bulk(skbuff_head_cache, n, heads);
+				n = 0;
+			}
+		} else
+			kfree_skbmem(skb);
+		skb = next;
+	}
+	if (n)
+		kmem_cache_free_bulk(skbuff_head_cache, n, heads);
+}
+EXPORT_SYMBOL(__kfree_skb_list);
+
 /**
  *	kfree_skb - free an sk_buff
  *	@skb: buffer to free
@@ -522,6 +568,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->mac_header		= old->mac_header;
 	skb_dst_copy(new, old);
 	new->rxhash		= old->rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 #ifdef CONFIG_XFRM
 	new->sp			= secpath_get(old->sp);
 #endif
@@ -605,6 +654,55 @@ struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src)
 }
 EXPORT_SYMBOL_GPL(skb_morph);
 
+/**
+ *	skb_copy_ubufs	-	copy the user page frags of an skb to the kernel
+ *	@skb: the skb to modify
+ *	@gfp_mask: allocation priority
+ *
+ *	Must be called on an skb whose frags are user pages, before its data
+ *	is shared.  The frags are copied to kernel pages, the user pages
+ *	are released and their owner is told at once: the skb can then live
+ *	as long as it wants.
+ *
+ *	Returns 0, or -ENOMEM with the skb untouched.
+ */
+int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
+	int num_frags = skb_shinfo(skb)->nr_frags;
+	struct page *pages[MAX_SKB_FRAGS];
+	int i;
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+		u8 *vaddr;
+
+		pages[i] = alloc_page(gfp_mask);
+		if (!pages[i]) {
+			while (--i >= 0)
+				put_page(pages[i]);
+			return -ENOMEM;
+		}
+		vaddr = kmap_skb_frag(f);
+		memcpy(page_address(pages[i]), vaddr + f->page_offset, f->size);
+		kunmap_skb_frag(vaddr);
+	}
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+
+		put_page(f->page);
+		f->page = pages[i];
+		f->page_offset = 0;
+	}
+
+	skb_shinfo(skb)->tx_flags.dev_zerocopy = 0;
+	if (uarg->callback)
+		uarg->callback(uarg);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_copy_ubufs);
+
 /**
  *	skb_clone	-	duplicate an sk_buff
  *	@skb: buffer to clone
@@ -623,6 +721,9 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	struct sk_buff *n;
 
+	if (skb_orphan_frags(skb, gfp_mask))
+		return NULL;
+
 	n = skb + 1;
 	if (skb->fclone == SKB_FCLONE_ORIG &&
 	    n->fclone == SKB_FCLONE_UNAVAILABLE) {
@@ -730,6 +831,9 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 	 *	Allocate the copy buffer
 	 */
 	struct sk_buff *n;
+
+	if (skb_orphan_frags(skb, gfp_mask))
+		return NULL;
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
 	n = alloc_skb(skb->end, gfp_mask);
 #else
@@ -803,6 +907,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	if (skb_shared(skb))
 		BUG();
 
+	/* The frags are about to be shared with the new head */
+	if (skb_orphan_frags(skb, gfp_mask))
+		goto nodata;
+
 	size = SKB_DATA_ALIGN(size);
 
 	data = kmalloc(size + sizeof(struct skb_shared_info), gfp_mask);
@@ -1519,15 +1627,48 @@ static int __skb_splice_bits(struct sk_buff *skb, struct pipe_inode_info *pipe,
 	return 0;
 }
 
+/*
+ * Hand the filled spd over to the pipe on behalf of a caller holding the
+ * socket lock of @sk.
+ */
+static ssize_t sock_splice_to_pipe(struct sock *sk,
+				   struct pipe_inode_info *pipe,
+				   struct splice_pipe_desc *spd)
+{
+	ssize_t ret;
+
+	/*
+	 * Drop the socket lock, otherwise we have reverse
+	 * locking dependencies between sk_lock and i_mutex
+	 * here as compared to sendfile(). We enter here
+	 * with the socket lock held, and splice_to_pipe() will
+	 * grab the pipe inode lock. For sendfile() emulation,
+	 * we call into ->sendpage() with the i_mutex lock held
+	 * and networking will grab the socket lock.
+	 */
+	release_sock(sk);
+	ret = splice_to_pipe(pipe, spd);
+	lock_sock(sk);
+
+	return ret;
+}
+
 /*
  * Map data from the skb to a pipe. Should handle both the linear part,
  * the fragments, and the frag list. It does NOT handle frag lists within
  * the frag list, if such a thing exists. We'd probably need to recurse to
  * handle that cleanly.
+ *
+ * @sk is the receiving socket, whose page fragment cache is used to copy
+ * out linear data. @splice_cb moves the mapped pages into the pipe and
+ * has to deal with whatever locks the caller holds.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
-		    struct pipe_inode_info *pipe, unsigned int tlen,
-		    unsigned int flags)
+int skb_splice_bits_sk(struct sk_buff *skb, struct sock *sk,
+		       unsigned int offset, struct pipe_inode_info *pipe,
+		       unsigned int tlen, unsigned int flags,
+		       ssize_t (*splice_cb)(struct sock *,
+					    struct pipe_inode_info *,
+					    struct splice_pipe_desc *))
 {
 	struct partial_page partial[PIPE_DEF_BUFFERS];
 	struct page *pages[PIPE_DEF_BUFFERS];
@@ -1539,7 +1680,6 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 		.spd_release = sock_spd_release,
 	};
 	struct sk_buff *frag_iter;
-	struct sock *sk = skb->sk;
 	int ret = 0;
 
 	if (splice_grow_spd(pipe, &spd))
@@ -1565,24 +1705,21 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	}
 
 done:
-	if (spd.nr_pages) {
-		/*
-		 * Drop the socket lock, otherwise we have reverse
-		 * locking dependencies between sk_lock and i_mutex
-		 * here as compared to sendfile(). We enter here
-		 * with the socket lock held, and splice_to_pipe() will
-		 * grab the pipe inode lock. For sendfile() emulation,
-		 * we call into ->sendpage() with the i_mutex lock held
-		 * and networking will grab the socket lock.
-		 */
-		release_sock(sk);
-		ret = splice_to_pipe(pipe, &spd);
-		lock_sock(sk);
-	}
+	if (spd.nr_pages)
+		ret = splice_cb(sk, pipe, &spd);
 
 	splice_shrink_spd(pipe, &spd);
 	return ret;
 }
+EXPORT_SYMBOL_GPL(skb_splice_bits_sk);
+
+int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+		    struct pipe_inode_info *pipe, unsigned int tlen,
+		    unsigned int flags)
+{
+	return skb_splice_bits_sk(skb, skb->sk, offset, pipe, tlen, flags,
+				  sock_splice_to_pipe);
+}
 
 /**
  *	skb_store_bits - store bits from kernel buffer to skb
@@ -149,6 +149,9 @@ void free_fib_info(struct fib_info *fi)
 		if (nexthop_nh->nh_dev)
 			dev_put(nexthop_nh->nh_dev);
 		nexthop_nh->nh_dev = NULL;
+		if (nexthop_nh->nh_rth_input)
+			call_rcu_bh(&nexthop_nh->nh_rth_input->dst.rcu_head,
+				    dst_rcu_free);
 	} endfor_nexthops(fi);
 	fib_info_cnt--;
 	release_net(fi->fib_net);
@@ -645,6 +645,10 @@ static int ipgre_rcv(struct sk_buff *skb)
 		skb_reset_network_header(skb);
 		ipgre_ecn_decapsulate(iph, skb);
 
+		/* Merged by ipgre_gro_receive(): what is left is plain TCP */
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
 		netif_rx(skb);
 		rcu_read_unlock();
 		return(0);
@@ -678,6 +682,11 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (dev->type == ARPHRD_ETHER)
 		IPCB(skb)->flags = 0;
 
+	/* Only the segments built by GSO are left for the device to sum */
+	if (skb->ip_summed == CHECKSUM_PARTIAL && !skb_is_gso(skb) &&
+	    skb_checksum_help(skb))
+		goto tx_error;
+
 	if (dev->header_ops && dev->type == ARPHRD_IPGRE) {
 		gre_hlen = 0;
 		tiph = (struct iphdr *)skb->data;
@@ -767,7 +776,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if ((old_iph->frag_off&htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -787,7 +796,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU && !skb_is_gso(skb) &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -807,8 +817,10 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 
 	max_headroom = LL_RESERVED_SPACE(tdev) + gre_hlen + rt->dst.header_len;
 
+	/* A GSO packet gets its own skb_shared_info, we mark it below */
 	if (skb_headroom(skb) < max_headroom || skb_shared(skb)||
-	    (skb_cloned(skb) && !skb_clone_writable(skb, 0))) {
+	    (skb_cloned(skb) && !skb_clone_writable(skb, 0)) ||
+	    (skb_is_gso(skb) && skb_cloned(skb))) {
 		struct sk_buff *new_skb = skb_realloc_headroom(skb, max_headroom);
 		if (max_headroom > dev->needed_headroom)
 			dev->needed_headroom = max_headroom;
@@ -880,6 +892,9 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		}
 	}
 
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
 	nf_reset(skb);
 
 	IPTUNNEL_XMIT();
@@ -1230,6 +1245,20 @@ static void ipgre_tunnel_setup(struct net_device *dev)
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
 }
 
+/*
+ * Without checksum nor sequence number, the GRE header is the same for all
+ * the segments of a TCP packet: the stack may hand us large packets, which
+ * ipgre_gso_segment() splits on the way out.  o_flags never change.
+ */
+static void ipgre_tunnel_features(struct net_device *dev)
+{
+	struct ip_tunnel *tunnel = netdev_priv(dev);
+
+	if (!(tunnel->parms.o_flags & (GRE_CSUM | GRE_SEQ)))
+		dev->features |= NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_TSO |
+				 NETIF_F_TSO_ECN | NETIF_F_TSO6;
+}
+
 static int ipgre_tunnel_init(struct net_device *dev)
 {
 	struct ip_tunnel *tunnel;
@@ -1256,6 +1285,9 @@ static int ipgre_tunnel_init(struct net_device *dev)
 	} else
 		dev->header_ops = &ipgre_header_ops;
 
+	if (!dev->header_ops)
+		ipgre_tunnel_features(dev);
+
 	return 0;
 }
 
@@ -1277,10 +1309,239 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 	ign->tunnels_wc[0]	= tunnel;
 }
 
+/*
+ * GRO and GSO of the TCP packets carried in GRE.  Only the GRE headers
+ * without checksum nor sequence number are dealt with: those are the same
+ * for all the segments of a flow, and are merged or copied as they are.
+ */
+
+/* GRE header length, or 0 if the header is not for us */
+static inline int ipgre_gso_hlen(__be16 flags)
+{
+	if (flags & ~GRE_KEY)
+		return 0;
+	return flags & GRE_KEY ? 8 : 4;
+}
+
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct packet_type *ptype;
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	__be16 *greh;
+	__be16 type;
+	unsigned int hlen;
+	unsigned int off;
+	int ghl;
+	int mac_len = 0;
+	int nhoff;
+	int flush = 1;
+	int ip_summed;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	ghl = ipgre_gso_hlen(greh[0]);
+	if (!ghl)
+		goto out;
+
+	type = greh[1];
+	if (type == htons(ETH_P_TEB))
+		mac_len = ETH_HLEN;
+
+	hlen = off + ghl + mac_len;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (mac_len)
+		type = ((struct ethhdr *)((u8 *)greh + ghl))->h_proto;
+
+	rcu_read_lock();
+	ptype = gro_find_by_type(type);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* Same key and, over gretap, same ethernet header */
+		if (memcmp(greh, p->data + off, ghl + mac_len))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, ghl + mac_len);
+
+	/*
+	 * The inner protocol checks its own checksum: give it the sum of
+	 * the inner packet, computing it if the device did not.
+	 */
+	csum = skb->csum;
+	ip_summed = skb->ip_summed;
+	if (ip_summed == CHECKSUM_NONE) {
+		skb->csum = skb_checksum(skb, skb_gro_offset(skb),
+					 skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	} else
+		skb_postpull_rcsum(skb, greh, ghl + mac_len);
+
+	nhoff = skb_network_offset(skb);
+	skb_set_network_header(skb, skb_gro_offset(skb));
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb_set_network_header(skb, nhoff);
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->ip_summed = ip_summed;
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb)
+{
+	struct packet_type *ptype;
+	int nhoff = skb_network_offset(skb);
+	int off = nhoff + ip_hdrlen(skb);
+	__be16 *greh = (__be16 *)(skb->data + off);
+	__be16 type = greh[1];
+	int err = -ENOENT;
+
+	off += ipgre_gso_hlen(greh[0]);
+	if (type == htons(ETH_P_TEB)) {
+		type = ((struct ethhdr *)(skb->data + off))->h_proto;
+		off += ETH_HLEN;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_by_type(type);
+	if (ptype) {
+		skb_set_network_header(skb, off);
+		err = ptype->gro_complete(skb);
+		skb_set_network_header(skb, nhoff);
+	}
+	rcu_read_unlock();
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
+/* skb->data is the GRE header, the outer headers are in front of it */
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *seg;
+	int gso_type = skb_shinfo(skb)->gso_type;
+	__be16 protocol = skb->protocol;
+	int mac_len = skb->mac_len;
+	int mac_offset = skb_mac_header(skb) - skb->data;
+	int nhoff = skb_network_offset(skb);
+	int inner_mac_len = 0;
+	int tnl_hlen;
+	__be16 *greh;
+	__be16 type;
+	int ghl;
+
+	if (unlikely(!(gso_type & SKB_GSO_GRE) ||
+		     (gso_type & ~(SKB_GSO_TCPV4 |
+				   SKB_GSO_TCPV6 |
+				   SKB_GSO_DODGY |
+				   SKB_GSO_TCP_ECN |
+				   SKB_GSO_GRE))))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, 4)))
+		goto out;
+
+	greh = (__be16 *)skb->data;
+	ghl = ipgre_gso_hlen(greh[0]);
+	if (!ghl)
+		goto out;
+
+	type = greh[1];
+	if (type == htons(ETH_P_TEB))
+		inner_mac_len = ETH_HLEN;
+
+	if (unlikely(!pskb_may_pull(skb, ghl + inner_mac_len)))
+		goto out;
+
+	if (inner_mac_len)
+		type = ((struct ethhdr *)(skb->data + ghl))->h_proto;
+
+	tnl_hlen = ghl - mac_offset;
+
+	/* Segment the inner packet the way its own device would */
+	__skb_pull(skb, ghl);
+	skb_set_network_header(skb, inner_mac_len);
+	skb->protocol = type;
+	skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
+	segs = skb_gso_segment(skb, features & ~NETIF_F_GSO_MASK);
+
+	skb_shinfo(skb)->gso_type = gso_type;
+	skb->protocol = protocol;
+	__skb_push(skb, ghl);
+	skb_reset_transport_header(skb);
+	skb_set_network_header(skb, nhoff);
+	skb_set_mac_header(skb, mac_offset);
+	skb->mac_len = mac_len;
+
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	/* Then put our headers back in front of each segment */
+	for (seg = segs; seg; seg = seg->next) {
+		if (seg->ip_summed == CHECKSUM_PARTIAL &&
+		    !(features & (NETIF_F_HW_CSUM | NETIF_F_NO_CSUM)) &&
+		    skb_checksum_help(seg)) {
+			while (segs) {
+				seg = segs;
+				segs = segs->next;
+				kfree_skb(seg);
+			}
+			segs = ERR_PTR(-ENOMEM);
+			goto out;
+		}
+
+		__skb_push(seg, tnl_hlen);
+		memcpy(seg->data, skb_mac_header(skb), tnl_hlen);
+		skb_reset_mac_header(seg);
+		skb_set_network_header(seg, mac_len);
+		skb_set_transport_header(seg, tnl_hlen - ghl);
+		seg->mac_len = mac_len;
+		seg->protocol = protocol;
+	}
+
+out:
+	return segs;
+}
 
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -1328,21 +1589,22 @@ err_alloc_dev:
 	return err;
 }
 
-static void __net_exit ipgre_exit_net(struct net *net)
+/* One rtnl section and one grace period for a whole batch of namespaces */
+static void __net_exit ipgre_exit_batch_net(struct list_head *net_list)
 {
-	struct ipgre_net *ign;
+	struct net *net;
 	LIST_HEAD(list);
 
-	ign = net_generic(net, ipgre_net_id);
 	rtnl_lock();
-	ipgre_destroy_tunnels(ign, &list);
+	list_for_each_entry(net, net_list, exit_list)
+		ipgre_destroy_tunnels(net_generic(net, ipgre_net_id), &list);
 	unregister_netdevice_many(&list);
 	rtnl_unlock();
 }
 
 static struct pernet_operations ipgre_net_ops = {
 	.init = ipgre_init_net,
-	.exit = ipgre_exit_net,
+	.exit_batch = ipgre_exit_batch_net,
 	.id   = &ipgre_net_id,
 	.size = sizeof(struct ipgre_net),
 };
@@ -1440,6 +1702,7 @@ static int ipgre_tap_init(struct net_device *dev)
 	strcpy(tunnel->parms.name, dev->name);
 
 	ipgre_tunnel_bind_dev(dev);
+	ipgre_tunnel_features(dev);
 
 	return 0;
 }
@@ -803,21 +803,26 @@ err_alloc_dev:
 	return err;
 }
 
-static void __net_exit ipip_exit_net(struct net *net)
+/* One rtnl section and one grace period for a whole batch of namespaces */
+static void __net_exit ipip_exit_batch_net(struct list_head *net_list)
 {
-	struct ipip_net *ipn = net_generic(net, ipip_net_id);
+	struct net *net;
 	LIST_HEAD(list);
 
 	rtnl_lock();
-	ipip_destroy_tunnels(ipn, &list);
-	unregister_netdevice_queue(ipn->fb_tunnel_dev, &list);
+	list_for_each_entry(net, net_list, exit_list) {
+		struct ipip_net *ipn = net_generic(net, ipip_net_id);
+
+		ipip_destroy_tunnels(ipn, &list);
+		unregister_netdevice_queue(ipn->fb_tunnel_dev, &list);
+	}
 	unregister_netdevice_many(&list);
 	rtnl_unlock();
 }
 
 static struct pernet_operations ipip_net_ops = {
 	.init = ipip_init_net,
-	.exit = ipip_exit_net,
+	.exit_batch = ipip_exit_batch_net,
 	.id   = &ipip_net_id,
 	.size = sizeof(struct ipip_net),
 };
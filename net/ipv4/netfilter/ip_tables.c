@@ -24,9 +24,13 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/sort.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
 
@@ -293,6 +297,355 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+/*
+ * Rule classification for long tables.
+ *
+ * The rules are cut, in blob order, into chunks of IPT_CLS_RULES.  For
+ * each chunk and each of source address, destination address, protocol,
+ * source and destination port, the range of values is cut into the
+ * intervals on which no rule of the chunk changes its mind, and every
+ * interval gets the bitmap of the rules it may match.  The bitmaps of
+ * the intervals holding the packet's fields, ANDed, tell which rules of
+ * the chunk can match it; ipt_do_table() only evaluates those.
+ *
+ * Only the criteria whose failure makes ipt_do_table() go to the next
+ * rule without side effect are used: the struct ipt_ip addresses and
+ * protocol, and the ports of a tcp or udp match when it is the first
+ * match of the rule.  Anything else (interfaces, non prefix masks, the
+ * other matches) leaves the bit set, and is checked as before.
+ */
+#define IPT_CLS_RULES		128
+#define IPT_CLS_LONGS		BITS_TO_LONGS(IPT_CLS_RULES)
+#define IPT_CLS_BOUNDS		(3 * IPT_CLS_RULES + 1)
+#define IPT_CLS_NOPORT		0x10000	/* port key when ports aren't read */
+
+enum {
+	IPT_CLS_SRC,
+	IPT_CLS_DST,
+	IPT_CLS_PROTO,
+	IPT_CLS_SPT,
+	IPT_CLS_DPT,
+	IPT_CLS_DIMS
+};
+
+struct ipt_cls_dim {
+	unsigned int	n;		/* number of intervals, 0 if unused */
+	u32		bound[IPT_CLS_BOUNDS];	/* first value of each */
+	unsigned long	map[IPT_CLS_BOUNDS][IPT_CLS_LONGS];
+};
+
+struct ipt_cls_chunk {
+	unsigned int	n;		/* number of rules */
+	unsigned int	off[IPT_CLS_RULES];	/* blob offset of each */
+	struct ipt_cls_dim dim[IPT_CLS_DIMS];
+};
+
+struct ipt_classifier {
+	unsigned int	n;
+	struct ipt_cls_chunk chunk[0];
+};
+
+/* Per packet: its keys, and the rules of one chunk it may match */
+struct ipt_cls_state {
+	u32				key[IPT_CLS_DIMS];
+	const struct ipt_cls_chunk	*chunk;
+	unsigned long			map[IPT_CLS_LONGS];
+};
+
+/* What a rule asks of one field: a value in [lo, hi] (or out of it if
+ * inv) no greater than limit.  any: nothing we can use. */
+struct ipt_cls_range {
+	u32	lo, hi, limit;
+	bool	inv, any;
+};
+
+static void ipt_cls_addr(struct ipt_cls_range *r, __be32 addr, __be32 mask,
+			 bool inv)
+{
+	u32 a = ntohl(addr), m = ntohl(mask);
+
+	/* Only prefixes make intervals */
+	if (~m & (~m + 1))
+		return;
+	r->any = false;
+	r->inv = inv;
+	if (a & ~m) {
+		/* never equal */
+		r->lo = 1;
+		r->hi = 0;
+	} else {
+		r->lo = a;
+		r->hi = a | ~m;
+	}
+}
+
+static void ipt_cls_port(struct ipt_cls_range *r, const u16 pts[2], bool inv)
+{
+	r->any = false;
+	r->lo = pts[0];
+	r->hi = pts[1];
+	r->limit = 0xffff;
+	r->inv = inv;
+}
+
+static void ipt_cls_rule(const struct ipt_entry *e,
+			 struct ipt_cls_range r[IPT_CLS_DIMS])
+{
+	const struct xt_entry_match *m = (const void *)e->elems;
+	const struct xt_match *match;
+	unsigned int d;
+
+	for (d = 0; d < IPT_CLS_DIMS; d++) {
+		r[d].any = true;
+		r[d].limit = ~0U;
+	}
+
+	ipt_cls_addr(&r[IPT_CLS_SRC], e->ip.src.s_addr, e->ip.smsk.s_addr,
+		     e->ip.invflags & IPT_INV_SRCIP);
+	ipt_cls_addr(&r[IPT_CLS_DST], e->ip.dst.s_addr, e->ip.dmsk.s_addr,
+		     e->ip.invflags & IPT_INV_DSTIP);
+	if (e->ip.proto) {
+		r[IPT_CLS_PROTO].any = false;
+		r[IPT_CLS_PROTO].lo = r[IPT_CLS_PROTO].hi = e->ip.proto;
+		r[IPT_CLS_PROTO].inv = e->ip.invflags & IPT_INV_PROTO;
+	}
+
+	if (e->target_offset == sizeof(*e))
+		return;
+	match = m->u.kernel.match;
+	if (match->revision != 0)
+		return;
+	if (strcmp(match->name, "tcp") == 0) {
+		const struct xt_tcp *info = (const void *)m->data;
+
+		ipt_cls_port(&r[IPT_CLS_SPT], info->spts,
+			     info->invflags & XT_TCP_INV_SRCPT);
+		ipt_cls_port(&r[IPT_CLS_DPT], info->dpts,
+			     info->invflags & XT_TCP_INV_DSTPT);
+	} else if (strcmp(match->name, "udp") == 0 ||
+		   strcmp(match->name, "udplite") == 0) {
+		const struct xt_udp *info = (const void *)m->data;
+
+		ipt_cls_port(&r[IPT_CLS_SPT], info->spts,
+			     info->invflags & XT_UDP_INV_SRCPT);
+		ipt_cls_port(&r[IPT_CLS_DPT], info->dpts,
+			     info->invflags & XT_UDP_INV_DSTPT);
+	}
+}
+
+static inline bool ipt_cls_range_match(const struct ipt_cls_range *r, u32 v)
+{
+	return r->any ||
+	       (v <= r->limit && ((r->lo <= v && v <= r->hi) != r->inv));
+}
+
+static int ipt_cls_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void ipt_cls_build_dim(struct ipt_cls_dim *dim, unsigned int d,
+			      struct ipt_cls_range (*r)[IPT_CLS_DIMS],
+			      unsigned int nrules)
+{
+	unsigned int i, j, n = 0;
+
+	dim->bound[n++] = 0;
+	for (j = 0; j < nrules; j++) {
+		const struct ipt_cls_range *rr = &r[j][d];
+
+		if (rr->any)
+			continue;
+		dim->bound[n++] = rr->lo;
+		if (rr->hi != ~0U)
+			dim->bound[n++] = rr->hi + 1;
+		if (rr->limit != ~0U)
+			dim->bound[n++] = rr->limit + 1;
+	}
+	if (n == 1) {
+		/* Every rule takes any value */
+		dim->n = 0;
+		return;
+	}
+
+	sort(dim->bound, n, sizeof(u32), ipt_cls_cmp, NULL);
+	for (i = 1, j = 1; i < n; i++)
+		if (dim->bound[i] != dim->bound[j - 1])
+			dim->bound[j++] = dim->bound[i];
+	dim->n = j;
+
+	for (i = 0; i < dim->n; i++) {
+		bitmap_zero(dim->map[i], IPT_CLS_RULES);
+		for (j = 0; j < nrules; j++)
+			if (ipt_cls_range_match(&r[j][d], dim->bound[i]))
+				__set_bit(j, dim->map[i]);
+	}
+}
+
+/* Returns NULL for short tables, or if memory is short: the table is
+ * then walked rule by rule. */
+static struct ipt_classifier *
+ipt_cls_compile(const struct xt_table_info *info, const void *entry0)
+{
+	struct ipt_cls_range (*r)[IPT_CLS_DIMS];
+	struct ipt_classifier *cls;
+	struct ipt_cls_chunk *c;
+	const struct ipt_entry *iter;
+	unsigned int i = 0, j, d;
+
+	if (info->number < IPT_CLS_RULES)
+		return NULL;
+
+	cls = vmalloc(sizeof(*cls) + DIV_ROUND_UP(info->number, IPT_CLS_RULES) *
+		      sizeof(struct ipt_cls_chunk));
+	if (cls == NULL)
+		return NULL;
+	r = kmalloc(IPT_CLS_RULES * sizeof(*r), GFP_KERNEL);
+	if (r == NULL) {
+		vfree(cls);
+		return NULL;
+	}
+
+	cls->n = DIV_ROUND_UP(info->number, IPT_CLS_RULES);
+	xt_entry_foreach(iter, entry0, info->size) {
+		c = &cls->chunk[i / IPT_CLS_RULES];
+		j = i % IPT_CLS_RULES;
+		c->off[j] = (const void *)iter - entry0;
+		c->n = j + 1;
+		ipt_cls_rule(iter, r[j]);
+		if (++i % IPT_CLS_RULES == 0 || i == info->number)
+			for (d = 0; d < IPT_CLS_DIMS; d++)
+				ipt_cls_build_dim(&c->dim[d], d, r, c->n);
+	}
+
+	kfree(r);
+	return cls;
+}
+
+/* Returns false if ipt_do_table() must see every rule for this packet:
+ * the tcp and udp matches drop packets whose headers they can't read. */
+static bool ipt_cls_keys(struct ipt_cls_state *st, const struct sk_buff *skb,
+			 const struct iphdr *ip,
+			 const struct xt_action_param *par)
+{
+	const __be16 *ports;
+	__be16 _ports[2];
+	unsigned int len;
+
+	st->chunk = NULL;
+	st->key[IPT_CLS_SRC] = ntohl(ip->saddr);
+	st->key[IPT_CLS_DST] = ntohl(ip->daddr);
+	st->key[IPT_CLS_PROTO] = ip->protocol;
+	st->key[IPT_CLS_SPT] = st->key[IPT_CLS_DPT] = IPT_CLS_NOPORT;
+
+	switch (ip->protocol) {
+	case IPPROTO_TCP:
+		if (par->fragoff == 1)
+			return false;
+		len = sizeof(struct tcphdr);
+		break;
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+		len = sizeof(struct udphdr);
+		break;
+	default:
+		return true;
+	}
+	if (par->fragoff != 0)
+		return true;
+	if (skb->len < par->thoff + len)
+		return false;
+	ports = skb_header_pointer(skb, par->thoff, sizeof(_ports), _ports);
+	if (ports == NULL)
+		return false;
+	st->key[IPT_CLS_SPT] = ntohs(ports[0]);
+	st->key[IPT_CLS_DPT] = ntohs(ports[1]);
+	return true;
+}
+
+static void ipt_cls_map(struct ipt_cls_state *st,
+			const struct ipt_cls_chunk *c)
+{
+	unsigned int d, i, lo, hi;
+
+	memset(st->map, 0xff, sizeof(st->map));
+	for (d = 0; d < IPT_CLS_DIMS; d++) {
+		const struct ipt_cls_dim *dim = &c->dim[d];
+
+		if (dim->n == 0)
+			continue;
+		/* Last interval starting at or below the key */
+		lo = 0;
+		hi = dim->n;
+		while (hi - lo > 1) {
+			unsigned int mid = (lo + hi) / 2;
+
+			if (dim->bound[mid] <= st->key[d])
+				lo = mid;
+			else
+				hi = mid;
+		}
+		for (i = 0; i < IPT_CLS_LONGS; i++)
+			st->map[i] &= dim->map[lo][i];
+	}
+	st->chunk = c;
+}
+
+/* First rule at or after e that the packet may match */
+static struct ipt_entry *
+ipt_cls_next(struct ipt_cls_state *st, const struct ipt_classifier *cls,
+	     const void *table_base, struct ipt_entry *e)
+{
+	unsigned int off = (void *)e - table_base;
+	const struct ipt_cls_chunk *c;
+	unsigned int lo, hi, pos;
+
+	lo = 0;
+	hi = cls->n;
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (cls->chunk[mid].off[0] <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	c = &cls->chunk[lo];
+
+	lo = 0;
+	hi = c->n;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (c->off[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pos = lo;
+
+	for (;;) {
+		if (st->chunk != c)
+			ipt_cls_map(st, c);
+		pos = find_next_bit(st->map, c->n, pos);
+		if (pos < c->n)
+			return (void *)table_base + c->off[pos];
+		if (++c == &cls->chunk[cls->n])
+			return e;
+		pos = 0;
+	}
+}
+#else
+static inline void *
+ipt_cls_compile(const struct xt_table_info *info, const void *entry0)
+{
+	return NULL;
+}
+#endif
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -311,6 +664,10 @@ ipt_do_table(struct sk_buff *skb,
 	unsigned int *stackptr, origptr, cpu;
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+	const struct ipt_classifier *cls;
+	struct ipt_cls_state cls_state;
+#endif
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -338,6 +695,11 @@ ipt_do_table(struct sk_buff *skb,
 	jumpstack  = (struct ipt_entry **)private->jumpstack[cpu];
 	stackptr   = per_cpu_ptr(private->stackptr, cpu);
 	origptr    = *stackptr;
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+	cls = private->classifier;
+	if (cls != NULL && !ipt_cls_keys(&cls_state, skb, ip, &acpar))
+		cls = NULL;
+#endif
 
 	e = get_entry(table_base, private->hook_entry[hook]);
 
@@ -350,6 +712,11 @@ ipt_do_table(struct sk_buff *skb,
 		const struct xt_entry_match *ematch;
 
 		IP_NF_ASSERT(e);
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+		/* Skip the rules that can't match */
+		if (cls != NULL)
+			e = ipt_cls_next(&cls_state, cls, table_base, e);
+#endif
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
@@ -421,9 +788,14 @@ ipt_do_table(struct sk_buff *skb,
 		verdict = t->u.kernel.target->target(skb, &acpar);
 		/* Target might have changed stuff. */
 		ip = ip_hdr(skb);
-		if (verdict == IPT_CONTINUE)
+		if (verdict == IPT_CONTINUE) {
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+			if (cls != NULL &&
+			    !ipt_cls_keys(&cls_state, skb, ip, &acpar))
+				cls = NULL;
+#endif
 			e = ipt_next_entry(e);
-		else
+		} else
 			/* Verdict */
 			break;
 	} while (!acpar.hotdrop);
@@ -874,6 +1246,7 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+	newinfo->classifier = ipt_cls_compile(newinfo, entry0);
 	return ret;
 }
 
@@ -1779,6 +2152,8 @@ translate_compat_table(struct net *net,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+	newinfo->classifier = ipt_cls_compile(newinfo, entry1);
+
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
@@ -693,17 +693,23 @@ static int clean_nat(struct nf_conn *i, void *data)
 	return 0;
 }
 
-static void __net_exit nf_nat_net_exit(struct net *net)
+/* One grace period for a whole batch of namespaces */
+static void __net_exit nf_nat_net_exit_batch(struct list_head *net_list)
 {
-	nf_ct_iterate_cleanup(net, &clean_nat, NULL);
+	struct net *net;
+
+	list_for_each_entry(net, net_list, exit_list)
+		nf_ct_iterate_cleanup(net, &clean_nat, NULL);
 	synchronize_rcu();
-	nf_ct_free_hashtable(net->ipv4.nat_bysource, net->ipv4.nat_vmalloced,
-			     net->ipv4.nat_htable_size);
+	list_for_each_entry(net, net_list, exit_list)
+		nf_ct_free_hashtable(net->ipv4.nat_bysource,
+				     net->ipv4.nat_vmalloced,
+				     net->ipv4.nat_htable_size);
 }
 
 static struct pernet_operations nf_nat_net_ops = {
 	.init = nf_nat_net_init,
-	.exit = nf_nat_net_exit,
+	.exit_batch = nf_nat_net_exit_batch,
 };
 
 static int __init nf_nat_init(void)
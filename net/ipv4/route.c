@@ -1954,12 +1954,79 @@ static void ip_handle_martian_source(struct net_device *dev,
 #endif
 }
 
+/*
+ * Rather than a cache entry per flow, an input route may be shared by all
+ * the flows through a nexthop, when it would only differ by their source:
+ * the users of input routes take it from the IP header.  New sources, as
+ * under attack from random ones, then neither churn the route cache nor
+ * trigger its garbage collection.
+ */
+static bool rt_input_shareable(struct fib_result *res, unsigned int flags,
+			       u32 itag)
+{
+	if (flags & (RTCF_DIRECTSRC | RTCF_DOREDIRECT) || itag)
+		return false;
+#if defined(CONFIG_NET_CLS_ROUTE) && defined(CONFIG_IP_MULTIPLE_TABLES)
+	if (fib_rules_tclass(res))
+		return false;
+#endif
+	return true;
+}
+
 /* called in rcu_read_lock() section */
+static struct rtable *rt_nh_input_get(struct fib_nh *nh, int iif)
+{
+	struct rtable *rth = rcu_dereference(nh->nh_rth_input);
+
+	if (rth && rth->rt_iif == iif && !rt_is_expired(rth))
+		return rth;
+	return NULL;
+}
+
+static void rt_nh_input_use(struct sk_buff *skb, struct rtable *rth,
+			    bool noref)
+{
+	if (noref)
+		skb_dst_set_noref(skb, &rth->dst);
+	else {
+		dst_hold(&rth->dst);
+		skb_dst_set(skb, &rth->dst);
+	}
+}
+
+/* Make @rth the shared route of @nh, replacing a stale one */
+static int rt_nh_input_set(struct fib_nh *nh, struct rtable *rth,
+			   struct sk_buff *skb)
+{
+	struct rtable *old;
+
+	if (rth->rt_type == RTN_UNICAST) {
+		int err = arp_bind_neighbour(&rth->dst);
+
+		if (err) {
+			rt_drop(rth);
+			return err;
+		}
+	}
+
+	old = xchg(&nh->nh_rth_input, rth);
+	if (old)
+		rt_free(old);
+
+	skb_dst_set(skb, &rth->dst);
+	return 0;
+}
+
+/*
+ * Called in rcu_read_lock() section.  Sets *@share_nh to the nexthop the
+ * route in *@result is to be shared by, if any; *@result is NULL when that
+ * of the nexthop was attached to @skb already.
+ */
 static int __mkroute_input(struct sk_buff *skb,
 			   struct fib_result *res,
 			   struct in_device *in_dev,
-			   __be32 daddr, __be32 saddr, u32 tos,
-			   struct rtable **result)
+			   __be32 daddr, __be32 saddr, u32 tos, bool noref,
+			   struct rtable **result, struct fib_nh **share_nh)
 {
 	struct rtable *rth;
 	int err;
@@ -2010,6 +2077,19 @@ static int __mkroute_input(struct sk_buff *skb,
 		}
 	}
 
+	/* Not with options, which may look at the destination */
+	*share_nh = NULL;
+	if (skb->protocol == htons(ETH_P_IP) && ip_hdr(skb)->ihl == 5 &&
+	    FIB_RES_GW(*res) && FIB_RES_NH(*res).nh_scope == RT_SCOPE_LINK &&
+	    rt_input_shareable(res, flags, itag)) {
+		*share_nh = &FIB_RES_NH(*res);
+		rth = rt_nh_input_get(*share_nh, in_dev->dev->ifindex);
+		if (rth) {
+			rt_nh_input_use(skb, rth, noref);
+			*result = NULL;
+			return 0;
+		}
+	}
 
 	rth = dst_alloc(&ipv4_dst_ops);
 	if (!rth) {
@@ -2057,9 +2137,10 @@ static int ip_mkroute_input(struct sk_buff *skb,
 			    struct fib_result *res,
 			    const struct flowi *fl,
 			    struct in_device *in_dev,
-			    __be32 daddr, __be32 saddr, u32 tos)
+			    __be32 daddr, __be32 saddr, u32 tos, bool noref)
 {
 	struct rtable* rth = NULL;
+	struct fib_nh *share_nh;
 	int err;
 	unsigned hash;
 
@@ -2069,9 +2150,12 @@ static int ip_mkroute_input(struct sk_buff *skb,
 #endif
 
 	/* create a routing cache entry */
-	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
-	if (err)
+	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, noref,
+			      &rth, &share_nh);
+	if (err || !rth)
 		return err;
+	if (share_nh)
+		return rt_nh_input_set(share_nh, rth, skb);
 
 	/* put it into the cache */
 	hash = rt_hash(daddr, saddr, fl->iif,
@@ -2090,7 +2174,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
  */
 
 static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
-			       u8 tos, struct net_device *dev)
+			       u8 tos, struct net_device *dev, bool noref)
 {
 	struct fib_result res;
 	struct in_device *in_dev = __in_dev_get_rcu(dev);
@@ -2105,6 +2189,7 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	unsigned	flags = 0;
 	u32		itag = 0;
 	struct rtable * rth;
+	struct fib_nh * share_nh = NULL;
 	unsigned	hash;
 	__be32		spec_dst;
 	int		err = -EINVAL;
@@ -2161,6 +2246,18 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 		if (err)
 			flags |= RTCF_DIRECTSRC;
 		spec_dst = daddr;
+
+		/* Host routes to addresses of the input device */
+		if (res.prefixlen == 32 && FIB_RES_DEV(res) == dev &&
+		    rt_input_shareable(&res, flags, itag)) {
+			share_nh = &FIB_RES_NH(res);
+			rth = rt_nh_input_get(share_nh, dev->ifindex);
+			if (rth) {
+				rt_nh_input_use(skb, rth, noref);
+				err = 0;
+				goto done;
+			}
+		}
 		goto local_input;
 	}
 
@@ -2169,7 +2266,7 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	if (res.type != RTN_UNICAST)
 		goto martian_destination;
 
-	err = ip_mkroute_input(skb, &res, &fl, in_dev, daddr, saddr, tos);
+	err = ip_mkroute_input(skb, &res, &fl, in_dev, daddr, saddr, tos, noref);
 done:
 	if (free_res)
 		fib_res_put(&res);
@@ -2230,6 +2327,10 @@ local_input:
 		rth->rt_flags 	&= ~RTCF_LOCAL;
 	}
 	rth->rt_type	= res.type;
+	if (share_nh) {
+		err = rt_nh_input_set(share_nh, rth, skb);
+		goto done;
+	}
 	hash = rt_hash(daddr, saddr, fl.iif, rt_genid(net));
 	err = rt_intern_hash(hash, rth, NULL, skb, fl.iif);
 	goto done;
@@ -2349,7 +2450,7 @@ skip_cache:
 		rcu_read_unlock();
 		return -EINVAL;
 	}
-	res = ip_route_input_slow(skb, daddr, saddr, tos, dev);
+	res = ip_route_input_slow(skb, daddr, saddr, tos, dev, noref);
 	rcu_read_unlock();
 	return res;
 }
@@ -0,0 +1,190 @@
+/*
+ * TCP Fast Open: data in the SYN of repeat connections.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ *
+ * A server hands its clients a cookie, a MAC of their address, in the
+ * SYN-ACK of a first connection.  On the next ones they send it back in a
+ * SYN which also carries data, and the server proves them to own that
+ * address before it queues the data to a child socket created at once,
+ * without waiting for the ACK of its SYN-ACK: accept() and read() can
+ * proceed a round trip earlier.
+ */
+
+#include <linux/kernel.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/hash.h>
+#include <linux/spinlock.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+static __u32 tcp_fastopen_secret[4];
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+static void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+				    struct tcp_fastopen_cookie *foc)
+{
+	__u32 workspace[SHA_WORKSPACE_WORDS];
+	__u32 digest[SHA_DIGEST_WORDS];
+	__u32 mess[16];
+
+	memset(mess, 0, sizeof(mess));
+	memcpy(mess, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	mess[4] = (__force __u32)saddr;
+	mess[5] = (__force __u32)daddr;
+
+	sha_init(digest);
+	sha_transform(digest, (char *)mess, workspace);
+
+	BUILD_BUG_ON(TCP_FASTOPEN_COOKIE_SIZE > sizeof(digest));
+	memcpy(foc->val, digest, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+/**
+ * tcp_fastopen_check - may the data of this SYN be accepted right away?
+ * @sk: the listener
+ * @skb: the SYN
+ * @foc: the cookie it carries, if any
+ * @valid_foc: set to the cookie the SYN-ACK should give the client, if any
+ *
+ * Only for IPv4.  Called with the listener locked.
+ */
+bool tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			struct tcp_fastopen_cookie *foc,
+			struct tcp_fastopen_cookie *valid_foc)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (foc->len < 0 || !(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    !tp->fastopen_max_qlen)
+		return false;
+
+	if (atomic_read(&tp->fastopen_qlen) >= tp->fastopen_max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return false;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+				valid_foc);
+	if (foc->len == valid_foc->len &&
+	    !memcmp(foc->val, valid_foc->val, foc->len)) {
+		/* The client knows it already */
+		valid_foc->len = -1;
+		return skb->len > tcp_hdrlen(skb);
+	}
+
+	if (foc->len)
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	else
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+	return false;
+}
+
+/*
+ * The passively opened child is done with its SYN-ACK: the handshake
+ * completed or the connection is gone.  Called with the child locked.
+ */
+void tcp_fastopen_rsk_release(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct request_sock *req = tp->fastopen_rsk;
+	struct sock *listener = req->sk;
+
+	tp->fastopen_rsk = NULL;
+	atomic_dec(&tcp_sk(listener)->fastopen_qlen);
+	sock_put(listener);
+	reqsk_free(req);
+}
+
+/*
+ * Client side: the cookies and MSS of the servers recently talked to, in
+ * a direct-mapped cache where a destination may evict another.  IPv4 only.
+ */
+#define TCP_FASTOPEN_CACHE_BITS		8
+#define TCP_FASTOPEN_SYN_LOSS_MAX	6
+
+struct tcp_fastopen_cache_entry {
+#ifdef CONFIG_NET_NS
+	struct net			*net;
+#endif
+	__be32				daddr;
+	u16				mss;
+	u16				syn_loss;	/* recurring SYN-data losses */
+	unsigned long			last_syn_loss;
+	struct tcp_fastopen_cookie	cookie;
+};
+
+static struct tcp_fastopen_cache_entry
+		tcp_fastopen_cache[1 << TCP_FASTOPEN_CACHE_BITS];
+static DEFINE_SPINLOCK(tcp_fastopen_cache_lock);
+
+static struct tcp_fastopen_cache_entry *tcp_fastopen_cache_slot(struct sock *sk,
+								bool *hit)
+{
+	__be32 daddr = inet_sk(sk)->inet_daddr;
+	struct tcp_fastopen_cache_entry *e;
+
+	e = &tcp_fastopen_cache[hash_32((__force u32)daddr,
+					TCP_FASTOPEN_CACHE_BITS)];
+	*hit = e->daddr == daddr && net_eq(read_pnet(&e->net), sock_net(sk));
+	return e;
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct tcp_fastopen_cache_entry *e;
+	bool hit;
+
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	e = tcp_fastopen_cache_slot(sk, &hit);
+	if (hit) {
+		if (e->mss)
+			*mss = e->mss;
+		*cookie = e->cookie;
+		*syn_loss = e->syn_loss;
+		*last_syn_loss = e->last_syn_loss;
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct tcp_fastopen_cache_entry *e;
+	bool hit;
+
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	e = tcp_fastopen_cache_slot(sk, &hit);
+	if (!hit) {
+		memset(e, 0, sizeof(*e));
+		write_pnet(&e->net, sock_net(sk));
+		e->daddr = inet_sk(sk)->inet_daddr;
+	}
+	if (mss)
+		e->mss = mss;
+	if (!syn_lost)
+		e->syn_loss = 0;
+	else {
+		if (e->syn_loss < TCP_FASTOPEN_SYN_LOSS_MAX)
+			e->syn_loss++;
+		e->last_syn_loss = jiffies;
+	}
+	if (cookie->len > 0)
+		e->cookie = *cookie;
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
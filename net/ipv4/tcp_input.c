@@ -3748,7 +3748,7 @@ old_ack:
  * the fast version below fails.
  */
 void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
-		       u8 **hvpp, int estab)
+		       u8 **hvpp, int estab, struct tcp_fastopen_cookie *foc)
 {
 	unsigned char *ptr;
 	struct tcphdr *th = tcp_hdr(skb);
@@ -3856,6 +3856,24 @@ void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
 					break;
 				}
 				break;
+
+			case TCPOPT_FASTOPEN:
+				/* Valid only in SYNs: an even-sized cookie,
+				 * or none as a request for one.
+				 */
+				if (foc != NULL && th->syn && !estab) {
+					int len = opsize - TCPOLEN_FASTOPEN_BASE;
+
+					if (len == 0) {
+						foc->len = 0;
+					} else if (len >= TCP_FASTOPEN_COOKIE_MIN &&
+						   len <= TCP_FASTOPEN_COOKIE_MAX &&
+						   !(len & 1)) {
+						memcpy(foc->val, ptr, len);
+						foc->len = len;
+					}
+				}
+				break;
 			}
 
 			ptr += opsize-2;
@@ -3898,7 +3916,7 @@ static int tcp_fast_parse_options(struct sk_buff *skb, struct tcphdr *th,
 		if (tcp_parse_aligned_timestamp(tp, th))
 			return 1;
 	}
-	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1);
+	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1, NULL);
 	return 1;
 }
 
@@ -5441,6 +5459,42 @@ discard:
 }
 EXPORT_SYMBOL(tcp_rcv_established);
 
+/* Learn the Fast Open cookie and MSS of the server from its SYN-ACK, and
+ * retransmit what it did not take of the data in our SYN.
+ */
+static int tcp_rcv_fastopen_synack(struct sock *sk, struct sk_buff *synack,
+				   struct tcp_fastopen_cookie *cookie)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *data = tp->syn_data ? tcp_write_queue_head(sk) : NULL;
+	bool syn_drop;
+
+	if (!tp->syn_fastopen)  /* Ignore an unsolicited cookie */
+		cookie->len = -1;
+
+	/* The SYN-ACK neither has a cookie nor acknowledges the data.
+	 * Presumably the server received only the retransmitted (regular)
+	 * SYNs: either the original SYN-data or its SYN-ACK got lost.
+	 */
+	syn_drop = (cookie->len <= 0 && data && inet_csk(sk)->icsk_retransmits);
+
+	tcp_fastopen_cache_set(sk, tp->rx_opt.mss_clamp, cookie, syn_drop);
+
+	if (data) {
+		tcp_for_write_queue_from(data, sk) {
+			if (data == tcp_send_head(sk) ||
+			    tcp_retransmit_skb(sk, data))
+				break;
+		}
+		tcp_rearm_rto(sk);
+		return 1;
+	}
+
+	if (tp->syn_data)
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENACTIVE);
+	return 0;
+}
+
 static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 					 struct tcphdr *th, unsigned len)
 {
@@ -5448,9 +5502,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct tcp_cookie_values *cvp = tp->cookie_values;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	int saved_clamp = tp->rx_opt.mss_clamp;
 
-	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0, &foc);
 
 	if (th->ack) {
 		/* rfc793:
@@ -5461,10 +5516,11 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 		 *        a reset (unless the RST bit is set, if so drop
 		 *        the segment and return)"
 		 *
-		 *  We do not send data with SYN, so that RFC-correct
-		 *  test reduces to:
+		 *  A Fast Open server may acknowledge only the SYN, and
+		 *  none of the data it carried.
 		 */
-		if (TCP_SKB_CB(skb)->ack_seq != tp->snd_nxt)
+		if (!after(TCP_SKB_CB(skb)->ack_seq, tp->snd_una) ||
+		    after(TCP_SKB_CB(skb)->ack_seq, tp->snd_nxt))
 			goto reset_and_undo;
 
 		if (tp->rx_opt.saw_tstamp && tp->rx_opt.rcv_tsecr &&
@@ -5604,6 +5660,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 			sk_wake_async(sk, SOCK_WAKE_IO, POLL_OUT);
 		}
 
+		if ((tp->syn_fastopen || tp->syn_data) &&
+		    tcp_rcv_fastopen_synack(sk, skb, &foc))
+			return -1;
+
 		if (sk->sk_write_pending ||
 		    icsk->icsk_accept_queue.rskq_defer_accept ||
 		    icsk->icsk_ack.pingpong) {
@@ -5723,6 +5783,7 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock *req = tp->fastopen_rsk;
 	int queued = 0;
 	int res;
 
@@ -5777,6 +5838,15 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		return 0;
 	}
 
+	/* A Fast Open child: the client did not get our SYN-ACK and
+	 * retransmits its SYN.
+	 */
+	if (unlikely(req) && th->syn && !th->ack &&
+	    TCP_SKB_CB(skb)->seq == tcp_rsk(req)->rcv_isn) {
+		req->rsk_ops->rtx_syn_ack(sk, req, NULL);
+		goto discard;
+	}
+
 	res = tcp_validate_incoming(sk, skb, th, 0);
 	if (res <= 0)
 		return -res;
@@ -5785,10 +5855,18 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 	if (th->ack) {
 		int acceptable = tcp_ack(sk, skb, FLAG_SLOWPATH) > 0;
 
+		/* The SYN-ACK of a Fast Open child got through */
+		if (unlikely(req) && acceptable) {
+			tcp_fastopen_rsk_release(sk);
+			tcp_rearm_rto(sk);
+		}
+
 		switch (sk->sk_state) {
 		case TCP_SYN_RECV:
 			if (acceptable) {
-				tp->copied_seq = tp->rcv_nxt;
+				/* ...whose data may not be read yet */
+				if (!req)
+					tp->copied_seq = tp->rcv_nxt;
 				smp_mb();
 				tcp_set_state(sk, TCP_ESTABLISHED);
 				sk->sk_state_change(sk);
@@ -72,6 +72,7 @@
 #include <net/timewait_sock.h>
 #include <net/xfrm.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -1218,8 +1219,80 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
-int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
+/*
+ * Fast Open: create the child of @req at once, with the data of the SYN
+ * queued for reading, and put it in the accept queue.  The child keeps a
+ * copy of @req to retransmit the SYN-ACK until the handshake completes.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst)
 {
+	struct request_sock *rtx_req;
+	struct sk_buff *data;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	rtx_req = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (!rtx_req)
+		return -ENOMEM;
+
+	data = skb_clone(skb, GFP_ATOMIC);
+	if (!data)
+		goto free_rtx;
+
+	tcp_openreq_init_rwin(req, sk, dst);
+	child = tcp_v4_syn_recv_sock(sk, skb, req, dst_clone(dst));
+	if (!child) {
+		kfree_skb(data);
+		goto free_rtx;
+	}
+
+	tp = tcp_sk(child);
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+	tp->max_window = tp->snd_wnd;
+
+	/* Left unacknowledged, and retransmitted by the client, if it
+	 * does not fit.
+	 */
+	__skb_pull(data, tcp_hdrlen(skb));
+	if (sk_rmem_schedule(child, data->truesize)) {
+		skb_dst_drop(data);
+		skb_set_owner_r(data, child);
+		__skb_queue_tail(&child->sk_receive_queue, data);
+		tp->rcv_nxt += data->len;
+	} else
+		kfree_skb(data);
+	tcp_rsk(req)->rcv_nxt = tp->rcv_nxt;
+
+	memcpy(rtx_req, req, sizeof(struct tcp_request_sock));
+	rtx_req->dl_next = NULL;
+	rtx_req->sk = sk;
+	sock_hold(sk);
+	atomic_inc(&tcp_sk(sk)->fastopen_qlen);
+	tp->fastopen_rsk = rtx_req;
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, req, child);
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+	return 0;
+
+free_rtx:
+	__reqsk_free(rtx_req);
+	return -ENOMEM;
+}
+
+static int __tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb,
+				 bool unlocked)
+{
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
 	u8 *hash_location;
@@ -1274,7 +1347,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0, &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1380,12 +1453,26 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	tmp_ext.fastopen_cookie = NULL;
+	if (!want_cookie && !unlocked &&
+	    tcp_fastopen_check(sk, skb, &foc, &valid_foc)) {
+		if (!dst)
+			dst = inet_csk_route_req(sk, req);
+		if (dst && !tcp_v4_conn_req_fastopen(sk, skb, req, dst)) {
+			/* The child retransmits it, if this one fails */
+			tcp_v4_send_synack(sk, dst, req,
+					   (struct request_values *)&tmp_ext);
+			return 0;
+		}
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	} else if (valid_foc.len > 0)
+		tmp_ext.fastopen_cookie = &valid_foc;
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext) ||
-	    want_cookie)
+	    want_cookie ||
+	    inet_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT))
 		goto drop_and_free;
-
-	inet_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT);
 	return 0;
 
 drop_and_release:
@@ -1395,6 +1482,11 @@ drop_and_free:
 drop:
 	return 0;
 }
+
+int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
+{
+	return __tcp_v4_conn_request(sk, skb, false);
+}
 EXPORT_SYMBOL(tcp_v4_conn_request);
 
 
@@ -1613,6 +1705,53 @@ csum_err:
 }
 EXPORT_SYMBOL(tcp_v4_do_rcv);
 
+/*
+ * SYNs to a listener are answered without its lock, by all the cpus that
+ * receive them: only the SYN queue is written, under its own lock.  The
+ * less common cases are left to the locked path: retransmitted SYNs, for
+ * tcp_check_req(), and listeners with MD5 keys, cookie transactions or
+ * Fast Open, whose state is only safe to read under the listener lock.
+ *
+ * Returns false, with @skb left alone, for the locked path.
+ */
+static bool tcp_v4_syn_rcv_unlocked(struct sock *sk, struct sk_buff *skb)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	const struct tcphdr *th = tcp_hdr(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct request_sock *req, **prev;
+	struct listen_sock *lopt;
+
+	if (sk->sk_state != TCP_LISTEN ||
+	    !th->syn || th->ack || th->rst || th->fin)
+		return false;
+	if (tp->fastopen_max_qlen || tp->cookie_values)
+		return false;
+#ifdef CONFIG_TCP_MD5SIG
+	if (tp->md5sig_info)
+		return false;
+#endif
+	if (skb->len < tcp_hdrlen(skb) || tcp_checksum_complete(skb))
+		return false;
+
+	read_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	req = lopt != NULL ? inet_csk_search_req(sk, &prev, th->source,
+						 iph->saddr, iph->daddr) : NULL;
+	read_unlock(&queue->syn_wait_lock);
+	/* Closed listener, or a retransmission */
+	if (lopt == NULL || req != NULL)
+		return false;
+
+#ifdef CONFIG_TCP_MD5SIG
+	if (!tcp_v4_inbound_md5_hash(sk, skb))
+#endif
+		__tcp_v4_conn_request(sk, skb, true);
+	kfree_skb(skb);
+	return true;
+}
+
 /*
  *	From tcp_input.c
  */
@@ -1680,6 +1819,12 @@ process:
 
 	skb->dev = NULL;
 
+	if (tcp_v4_syn_rcv_unlocked(sk, skb)) {
+		sock_put(sk);
+		return 0;
+	}
+
+	sk_mark_napi_id(sk, skb);
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1741,6 +1886,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1965,6 +2111,10 @@ void tcp_v4_destroy_sock(struct sock *sk)
 		tp->cookie_values = NULL;
 	}
 
+	if (tp->fastopen_rsk)
+		tcp_fastopen_rsk_release(sk);
+	tcp_free_fastopen_req(tp);
+
 	percpu_counter_dec(&tcp_sockets_allocated);
 }
 EXPORT_SYMBOL(tcp_v4_destroy_sock);
@@ -2603,6 +2753,7 @@ struct proto tcp_prot = {
 	.sendmsg		= tcp_sendmsg,
 	.sendpage		= tcp_sendpage,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
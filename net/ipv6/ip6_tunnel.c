@@ -1384,23 +1384,22 @@ static struct xfrm6_tunnel ip6ip6_handler = {
 	.priority	=	1,
 };
 
-static void __net_exit ip6_tnl_destroy_tunnels(struct ip6_tnl_net *ip6n)
+static void __net_exit ip6_tnl_destroy_tunnels(struct ip6_tnl_net *ip6n,
+					       struct list_head *list)
 {
 	int h;
 	struct ip6_tnl *t;
-	LIST_HEAD(list);
 
 	for (h = 0; h < HASH_SIZE; h++) {
 		t = ip6n->tnls_r_l[h];
 		while (t != NULL) {
-			unregister_netdevice_queue(t->dev, &list);
+			unregister_netdevice_queue(t->dev, list);
 			t = t->next;
 		}
 	}
 
 	t = ip6n->tnls_wc[0];
-	unregister_netdevice_queue(t->dev, &list);
-	unregister_netdevice_many(&list);
+	unregister_netdevice_queue(t->dev, list);
 }
 
 static int __net_init ip6_tnl_init_net(struct net *net)
@@ -1432,18 +1431,23 @@ err_alloc_dev:
 	return err;
 }
 
-static void __net_exit ip6_tnl_exit_net(struct net *net)
+/* One rtnl section and one grace period for a whole batch of namespaces */
+static void __net_exit ip6_tnl_exit_batch_net(struct list_head *net_list)
 {
-	struct ip6_tnl_net *ip6n = net_generic(net, ip6_tnl_net_id);
+	struct net *net;
+	LIST_HEAD(list);
 
 	rtnl_lock();
-	ip6_tnl_destroy_tunnels(ip6n);
+	list_for_each_entry(net, net_list, exit_list)
+		ip6_tnl_destroy_tunnels(net_generic(net, ip6_tnl_net_id),
+					&list);
+	unregister_netdevice_many(&list);
 	rtnl_unlock();
 }
 
 static struct pernet_operations ip6_tnl_net_ops = {
 	.init = ip6_tnl_init_net,
-	.exit = ip6_tnl_exit_net,
+	.exit_batch = ip6_tnl_exit_batch_net,
 	.id   = &ip6_tnl_net_id,
 	.size = sizeof(struct ip6_tnl_net),
 };
@@ -1188,21 +1188,26 @@ err_alloc_dev:
 	return err;
 }
 
-static void __net_exit sit_exit_net(struct net *net)
+/* One rtnl section and one grace period for a whole batch of namespaces */
+static void __net_exit sit_exit_batch_net(struct list_head *net_list)
 {
-	struct sit_net *sitn = net_generic(net, sit_net_id);
+	struct net *net;
 	LIST_HEAD(list);
 
 	rtnl_lock();
-	sit_destroy_tunnels(sitn, &list);
-	unregister_netdevice_queue(sitn->fb_tunnel_dev, &list);
+	list_for_each_entry(net, net_list, exit_list) {
+		struct sit_net *sitn = net_generic(net, sit_net_id);
+
+		sit_destroy_tunnels(sitn, &list);
+		unregister_netdevice_queue(sitn->fb_tunnel_dev, &list);
+	}
 	unregister_netdevice_many(&list);
 	rtnl_unlock();
 }
 
 static struct pernet_operations sit_net_ops = {
 	.init = sit_init_net,
-	.exit = sit_exit_net,
+	.exit_batch = sit_exit_batch_net,
 	.id   = &sit_net_id,
 	.size = sizeof(struct sit_net),
 };
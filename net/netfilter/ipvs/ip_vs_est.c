@@ -54,6 +54,65 @@ static LIST_HEAD(est_list);
 static DEFINE_SPINLOCK(est_lock);
 static DEFINE_TIMER(est_timer, estimation_timer, 0, 0);
 
+/*
+ *	Add up the counters of all the cpus
+ */
+static void
+ip_vs_read_cpu_stats(struct ip_vs_stats_user *sum,
+		     struct ip_vs_cpu_stats __percpu *stats)
+{
+	int cpu;
+
+	sum->conns = 0;
+	sum->inpkts = 0;
+	sum->outpkts = 0;
+	sum->inbytes = 0;
+	sum->outbytes = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct ip_vs_cpu_stats *s = per_cpu_ptr(stats, cpu);
+		unsigned int start;
+		u64 inbytes, outbytes;
+
+		do {
+			start = u64_stats_fetch_begin_bh(&s->syncp);
+			inbytes = s->ustats.inbytes;
+			outbytes = s->ustats.outbytes;
+		} while (u64_stats_fetch_retry_bh(&s->syncp, start));
+
+		sum->conns += s->ustats.conns;
+		sum->inpkts += s->ustats.inpkts;
+		sum->outpkts += s->ustats.outpkts;
+		sum->inbytes += inbytes;
+		sum->outbytes += outbytes;
+	}
+}
+
+/*
+ *	Bring the counters of stats up to date, caller must hold stats->lock
+ */
+void ip_vs_sum_stats(struct ip_vs_stats *stats)
+{
+	struct ip_vs_stats_user *u = &stats->ustats;
+	struct ip_vs_stats_user sum;
+
+	ip_vs_read_cpu_stats(&sum, stats->cpustats);
+	u->conns = sum.conns - stats->ustats0.conns;
+	u->inpkts = sum.inpkts - stats->ustats0.inpkts;
+	u->outpkts = sum.outpkts - stats->ustats0.outpkts;
+	u->inbytes = sum.inbytes - stats->ustats0.inbytes;
+	u->outbytes = sum.outbytes - stats->ustats0.outbytes;
+}
+
+/*
+ *	Start the counters of stats from zero, caller must hold stats->lock
+ */
+void ip_vs_zero_sum_stats(struct ip_vs_stats *stats)
+{
+	ip_vs_read_cpu_stats(&stats->ustats0, stats->cpustats);
+	memset(&stats->ustats, 0, sizeof(stats->ustats));
+}
+
 static void estimation_timer(unsigned long arg)
 {
 	struct ip_vs_estimator *e;
@@ -68,6 +127,7 @@ static void estimation_timer(unsigned long arg)
 		s = container_of(e, struct ip_vs_stats, est);
 
 		spin_lock(&s->lock);
+		ip_vs_sum_stats(s);
 		n_conns = s->ustats.conns;
 		n_inpkts = s->ustats.inpkts;
 		n_outpkts = s->ustats.outpkts;
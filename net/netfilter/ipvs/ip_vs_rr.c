@@ -44,6 +44,10 @@ static int ip_vs_rr_update_svc(struct ip_vs_service *svc)
 
 /*
  * Round-Robin Scheduling
+ *
+ * No lock: the destinations don't change while we hold the service, and
+ * sched_data always points in their list.  CPUs racing here may pick the
+ * same server once, which evens out.
  */
 static struct ip_vs_dest *
 ip_vs_rr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
@@ -53,8 +57,7 @@ ip_vs_rr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 
 	IP_VS_DBG(6, "%s(): Scheduling...\n", __func__);
 
-	write_lock(&svc->sched_lock);
-	p = (struct list_head *)svc->sched_data;
+	p = (struct list_head *)ACCESS_ONCE(svc->sched_data);
 	p = p->next;
 	q = p;
 	do {
@@ -71,13 +74,11 @@ ip_vs_rr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 			goto out;
 		q = q->next;
 	} while (q != p);
-	write_unlock(&svc->sched_lock);
 	IP_VS_ERR_RL("RR: no destination available\n");
 	return NULL;
 
   out:
 	svc->sched_data = q;
-	write_unlock(&svc->sched_lock);
 	IP_VS_DBG_BUF(6, "RR: server %s:%u "
 		      "activeconns %d refcnt %d weight %d\n",
 		      IP_VS_DBG_ADDR(svc->af, &dest->addr), ntohs(dest->port),
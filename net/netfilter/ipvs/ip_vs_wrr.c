@@ -125,27 +125,33 @@ static int ip_vs_wrr_update_svc(struct ip_vs_service *svc)
 
 /*
  *    Weighted Round-Robin Scheduling
+ *
+ *    No lock: the destinations, mw and di don't change while we hold the
+ *    service.  The position is read once and stored back once, so CPUs
+ *    racing here only lose a step of the rotation.
  */
 static struct ip_vs_dest *
 ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest;
 	struct ip_vs_wrr_mark *mark = svc->sched_data;
-	struct list_head *p;
+	struct list_head *p, *cl;
+	int cw;
 
 	IP_VS_DBG(6, "%s(): Scheduling...\n", __func__);
 
 	/*
-	 * This loop will always terminate, because mark->cw in (0, max_weight]
+	 * This loop will always terminate, because cw in (0, max_weight]
 	 * and at least one server has its weight equal to max_weight.
 	 */
-	write_lock(&svc->sched_lock);
-	p = mark->cl;
+	cl = ACCESS_ONCE(mark->cl);
+	cw = ACCESS_ONCE(mark->cw);
+	p = cl;
 	while (1) {
-		if (mark->cl == &svc->destinations) {
+		if (cl == &svc->destinations) {
 			/* it is at the head of the destination list */
 
-			if (mark->cl == mark->cl->next) {
+			if (cl == cl->next) {
 				/* no dest entry */
 				IP_VS_ERR_RL("WRR: no destination available: "
 					     "no destinations present\n");
@@ -153,15 +159,15 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 				goto out;
 			}
 
-			mark->cl = svc->destinations.next;
-			mark->cw -= mark->di;
-			if (mark->cw <= 0) {
-				mark->cw = mark->mw;
+			cl = svc->destinations.next;
+			cw -= mark->di;
+			if (cw <= 0) {
+				cw = mark->mw;
 				/*
 				 * Still zero, which means no available servers.
 				 */
-				if (mark->cw == 0) {
-					mark->cl = &svc->destinations;
+				if (cw == 0) {
+					cl = &svc->destinations;
 					IP_VS_ERR_RL("WRR: no destination "
 						     "available\n");
 					dest = NULL;
@@ -169,19 +175,19 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 				}
 			}
 		} else
-			mark->cl = mark->cl->next;
+			cl = cl->next;
 
-		if (mark->cl != &svc->destinations) {
+		if (cl != &svc->destinations) {
 			/* not at the head of the list */
-			dest = list_entry(mark->cl, struct ip_vs_dest, n_list);
+			dest = list_entry(cl, struct ip_vs_dest, n_list);
 			if (!(dest->flags & IP_VS_DEST_F_OVERLOAD) &&
-			    atomic_read(&dest->weight) >= mark->cw) {
+			    atomic_read(&dest->weight) >= cw) {
 				/* got it */
 				break;
 			}
 		}
 
-		if (mark->cl == p && mark->cw == mark->di) {
+		if (cl == p && cw == mark->di) {
 			/* back to the start, and no dest is found.
 			   It is only possible when all dests are OVERLOADED */
 			dest = NULL;
@@ -199,7 +205,8 @@ ip_vs_wrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
 		      atomic_read(&dest->weight));
 
   out:
-	write_unlock(&svc->sched_lock);
+	mark->cl = cl;
+	mark->cw = cw;
 	return dest;
 }
 
@@ -702,6 +702,7 @@ void xt_free_table_info(struct xt_table_info *info)
 
 	free_percpu(info->stackptr);
 
+	vfree(info->classifier);
 	kfree(info);
 }
 EXPORT_SYMBOL(xt_free_table_info);
@@ -269,6 +269,75 @@ out_no_rpciod:
 	return ERR_PTR(err);
 }
 
+/*
+ * Open further connections to the server of a freshly created client.
+ * They are owned by the client that creates them; clones only borrow
+ * them, which is safe as they pin their parent.
+ */
+static int rpc_clnt_add_xprts(struct rpc_clnt *clnt,
+			      struct xprt_create *xprtargs,
+			      unsigned int nconnect)
+{
+	struct rpc_xprt *xprt;
+
+	if (nconnect > RPC_MAX_CONNECT)
+		nconnect = RPC_MAX_CONNECT;
+
+	clnt->cl_xprts = kcalloc(nconnect, sizeof(clnt->cl_xprts[0]),
+				 GFP_KERNEL);
+	if (clnt->cl_xprts == NULL)
+		return -ENOMEM;
+	clnt->cl_xprts[0] = clnt->cl_xprt;
+	clnt->cl_nr_xprts = 1;
+
+	while (clnt->cl_nr_xprts < nconnect) {
+		xprt = xprt_create_transport(xprtargs);
+		if (IS_ERR(xprt))
+			return PTR_ERR(xprt);
+		xprt->resvport = clnt->cl_xprt->resvport;
+		clnt->cl_xprts[clnt->cl_nr_xprts++] = xprt;
+	}
+	dprintk("RPC:       %s client for %s uses %u transports\n",
+			clnt->cl_protname, clnt->cl_server, clnt->cl_nr_xprts);
+	return 0;
+}
+
+static void rpc_clnt_put_xprts(struct rpc_clnt *clnt)
+{
+	unsigned int i;
+
+	/* cl_xprts[0] is cl_xprt, which has its own reference */
+	for (i = 1; i < clnt->cl_nr_xprts; i++)
+		xprt_put(clnt->cl_xprts[i]);
+	kfree(clnt->cl_xprts);
+}
+
+/*
+ * Pick the transport for a new task: round-robin, passing over any
+ * transport with more requests queued than another, e.g. one that is
+ * reconnecting or whose socket is backed up.
+ */
+static struct rpc_xprt *rpc_clnt_select_xprt(struct rpc_clnt *clnt)
+{
+	struct rpc_xprt *xprt, *best = NULL;
+	unsigned int i, start, load, best_load = UINT_MAX;
+
+	if (clnt->cl_nr_xprts <= 1)
+		return clnt->cl_xprt;
+
+	start = (unsigned int)atomic_inc_return(&clnt->cl_xprt_next);
+	for (i = 0; i < clnt->cl_nr_xprts; i++) {
+		xprt = clnt->cl_xprts[(start + i) % clnt->cl_nr_xprts];
+		load = xprt->sending.qlen + xprt->pending.qlen +
+			xprt->backlog.qlen;
+		if (load < best_load) {
+			best = xprt;
+			best_load = load;
+		}
+	}
+	return best;
+}
+
 /*
  * rpc_create - create an RPC client and transport with one call
  * @args: rpc_clnt create argument structure
@@ -339,6 +408,14 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (IS_ERR(clnt))
 		return clnt;
 
+	if (args->nconnect > 1) {
+		int err = rpc_clnt_add_xprts(clnt, &xprtargs, args->nconnect);
+		if (err != 0) {
+			rpc_shutdown_client(clnt);
+			return ERR_PTR(err);
+		}
+	}
+
 	if (!(args->flags & RPC_CLNT_CREATE_NOPING)) {
 		int err = rpc_ping(clnt);
 		if (err != 0) {
@@ -481,6 +558,7 @@ rpc_free_client(struct kref *kref)
 	}
 	if (clnt->cl_server != clnt->cl_inline_name)
 		kfree(clnt->cl_server);
+	rpc_clnt_put_xprts(clnt);
 out_free:
 	rpc_unregister_client(clnt);
 	rpc_free_iostats(clnt->cl_metrics);
@@ -577,6 +655,7 @@ void rpc_task_release_client(struct rpc_task *task)
 		list_del(&task->tk_task);
 		spin_unlock(&clnt->cl_lock);
 		task->tk_client = NULL;
+		task->tk_xprt = NULL;
 
 		rpc_release_client(clnt);
 	}
@@ -588,6 +667,7 @@ void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 	if (clnt != NULL) {
 		rpc_task_release_client(task);
 		task->tk_client = clnt;
+		task->tk_xprt = rpc_clnt_select_xprt(clnt);
 		kref_get(&clnt->cl_kref);
 		if (clnt->cl_softrtry)
 			task->tk_flags |= RPC_TASK_SOFT;
@@ -736,6 +816,7 @@ struct rpc_task *rpc_run_bc_task(struct rpc_rqst *req,
 		goto out;
 	}
 	task->tk_rqstp = req;
+	task->tk_xprt = req->rq_xprt;
 
 	/*
 	 * Set up the xdr_buf length.
@@ -831,8 +912,13 @@ EXPORT_SYMBOL_GPL(rpc_max_payload);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
-	if (clnt->cl_autobind)
-		xprt_clear_bound(clnt->cl_xprt);
+	unsigned int i;
+
+	if (!clnt->cl_autobind)
+		return;
+	xprt_clear_bound(clnt->cl_xprt);
+	for (i = 1; i < clnt->cl_nr_xprts; i++)
+		xprt_clear_bound(clnt->cl_xprts[i]);
 }
 EXPORT_SYMBOL_GPL(rpc_force_rebind);
 
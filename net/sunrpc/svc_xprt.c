@@ -392,6 +392,8 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
 		pool->sp_stats.sockets_queued++;
 		BUG_ON(xprt->xpt_pool != pool);
+		if (serv->sv_starved)
+			serv->sv_starved(pool);
 	}
 
 out_unlock:
@@ -114,12 +114,20 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/splice.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
 
-static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
-static DEFINE_SPINLOCK(unix_table_lock);
-static atomic_t unix_nr_socks = ATOMIC_INIT(0);
+/*
+ * The bound sockets are in the first UNIX_HASH_SIZE buckets, by the hash
+ * of their name or the inode of their path; the unbound ones are spread
+ * over the second UNIX_HASH_SIZE buckets, by their address.
+ */
+#define UNIX_TABLE_SIZE		(2 * UNIX_HASH_SIZE)
 
-#define unix_sockets_unbound	(&unix_socket_table[UNIX_HASH_SIZE])
+static struct hlist_head unix_socket_table[UNIX_TABLE_SIZE];
+static spinlock_t unix_table_locks[UNIX_TABLE_SIZE];
+static atomic_t unix_nr_socks = ATOMIC_INIT(0);
 
 #define UNIX_ABSTRACT(sk)	(unix_sk(sk)->addr->hash != UNIX_HASH_SIZE)
 
@@ -143,7 +151,10 @@ static inline void unix_set_secdata(struct scm_cookie *scm, struct sk_buff *skb)
 
 /*
  *  SMP locking strategy:
- *    hash table is protected with spinlock unix_table_lock
+ *    each hash table bucket is protected by its own spinlock in
+ *    unix_table_locks, sk->sk_hash is the bucket of a hashed socket;
+ *    binding moves a socket from its unbound bucket to a bound one with
+ *    both locks held, the lower bucket's first.
  *    each socket state is protected by separate spin lock.
  */
 
@@ -220,29 +231,57 @@ static int unix_mkname(struct sockaddr_un *sunaddr, int len, unsigned *hashp)
 	return len;
 }
 
+static inline unsigned unix_unbound_hash(struct sock *sk)
+{
+	return UNIX_HASH_SIZE + hash_ptr(sk, ilog2(UNIX_HASH_SIZE));
+}
+
+static inline unsigned unix_inode_hash(struct inode *i)
+{
+	return i->i_ino & (UNIX_HASH_SIZE - 1);
+}
+
+/* An unbound and a bound bucket; never the same */
+static void unix_table_double_lock(unsigned hash1, unsigned hash2)
+{
+	if (hash1 > hash2)
+		swap(hash1, hash2);
+	spin_lock(&unix_table_locks[hash1]);
+	spin_lock_nested(&unix_table_locks[hash2], SINGLE_DEPTH_NESTING);
+}
+
+static void unix_table_double_unlock(unsigned hash1, unsigned hash2)
+{
+	spin_unlock(&unix_table_locks[hash1]);
+	spin_unlock(&unix_table_locks[hash2]);
+}
+
 static void __unix_remove_socket(struct sock *sk)
 {
 	sk_del_node_init(sk);
 }
 
-static void __unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static void __unix_insert_socket(unsigned hash, struct sock *sk)
 {
 	WARN_ON(!sk_unhashed(sk));
-	sk_add_node(sk, list);
+	sk->sk_hash = hash;
+	sk_add_node(sk, &unix_socket_table[hash]);
 }
 
 static inline void unix_remove_socket(struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
+	spinlock_t *lock = &unix_table_locks[sk->sk_hash];
+
+	spin_lock(lock);
 	__unix_remove_socket(sk);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(lock);
 }
 
-static inline void unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static inline void unix_insert_socket(unsigned hash, struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
-	__unix_insert_socket(list, sk);
-	spin_unlock(&unix_table_lock);
+	spin_lock(&unix_table_locks[hash]);
+	__unix_insert_socket(hash, sk);
+	spin_unlock(&unix_table_locks[hash]);
 }
 
 static struct sock *__unix_find_socket_byname(struct net *net,
@@ -274,22 +313,22 @@ static inline struct sock *unix_find_socket_byname(struct net *net,
 {
 	struct sock *s;
 
-	spin_lock(&unix_table_lock);
+	spin_lock(&unix_table_locks[hash ^ type]);
 	s = __unix_find_socket_byname(net, sunname, len, type, hash);
 	if (s)
 		sock_hold(s);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash ^ type]);
 	return s;
 }
 
 static struct sock *unix_find_socket_byinode(struct inode *i)
 {
+	unsigned hash = unix_inode_hash(i);
 	struct sock *s;
 	struct hlist_node *node;
 
-	spin_lock(&unix_table_lock);
-	sk_for_each(s, node,
-		    &unix_socket_table[i->i_ino & (UNIX_HASH_SIZE - 1)]) {
+	spin_lock(&unix_table_locks[hash]);
+	sk_for_each(s, node, &unix_socket_table[hash]) {
 		struct dentry *dentry = unix_sk(s)->dentry;
 
 		if (dentry && dentry->d_inode == i) {
@@ -299,7 +338,7 @@ static struct sock *unix_find_socket_byinode(struct inode *i)
 	}
 	s = NULL;
 found:
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash]);
 	return s;
 }
 
@@ -349,6 +388,12 @@ static void unix_sock_destructor(struct sock *sk)
 
 	skb_queue_purge(&sk->sk_receive_queue);
 
+	/* page fragment left over from unix_stream_splice_read() */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	WARN_ON(atomic_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
 	WARN_ON(sk->sk_socket);
@@ -515,6 +560,9 @@ static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
+static ssize_t unix_stream_splice_read(struct socket *, loff_t *,
+				       struct pipe_inode_info *, size_t,
+				       unsigned int);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t);
 static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
@@ -543,6 +591,7 @@ static const struct proto_ops unix_stream_ops = {
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
 	.sendpage =	sock_no_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -629,7 +678,7 @@ static struct sock *unix_create1(struct net *net, struct socket *sock)
 	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->readlock); /* single task reading lock */
 	init_waitqueue_head(&u->peer_wait);
-	unix_insert_socket(unix_sockets_unbound, sk);
+	unix_insert_socket(unix_unbound_hash(sk), sk);
 out:
 	if (sk == NULL)
 		atomic_dec(&unix_nr_socks);
@@ -691,6 +740,7 @@ static int unix_autobind(struct socket *sock)
 	struct unix_sock *u = unix_sk(sk);
 	static u32 ordernum = 1;
 	struct unix_address *addr;
+	unsigned old_hash;
 	int err;
 
 	mutex_lock(&u->readlock);
@@ -698,6 +748,8 @@ static int unix_autobind(struct socket *sock)
 	err = 0;
 	if (u->addr)
 		goto out;
+	/* unbound, and only bind moves it, under readlock */
+	old_hash = sk->sk_hash;
 
 	err = -ENOMEM;
 	addr = kzalloc(sizeof(*addr) + sizeof(short) + 16, GFP_KERNEL);
@@ -711,12 +763,12 @@ retry:
 	addr->len = sprintf(addr->name->sun_path+1, "%05x", ordernum) + 1 + sizeof(short);
 	addr->hash = unix_hash_fold(csum_partial(addr->name, addr->len, 0));
 
-	spin_lock(&unix_table_lock);
+	unix_table_double_lock(old_hash, addr->hash ^ sk->sk_type);
 	ordernum = (ordernum+1)&0xFFFFF;
 
 	if (__unix_find_socket_byname(net, addr->name, addr->len, sock->type,
 				      addr->hash)) {
-		spin_unlock(&unix_table_lock);
+		unix_table_double_unlock(old_hash, addr->hash ^ sk->sk_type);
 		/* Sanity yield. It is unusual case, but yet... */
 		if (!(ordernum&0xFF))
 			yield();
@@ -726,8 +778,8 @@ retry:
 
 	__unix_remove_socket(sk);
 	u->addr = addr;
-	__unix_insert_socket(&unix_socket_table[addr->hash], sk);
-	spin_unlock(&unix_table_lock);
+	__unix_insert_socket(addr->hash, sk);
+	unix_table_double_unlock(old_hash, addr->hash);
 	err = 0;
 
 out:	mutex_unlock(&u->readlock);
@@ -799,9 +851,8 @@ static int unix_bind(struct socket *sock, struct sockaddr *uaddr, int addr_len)
 	struct dentry *dentry = NULL;
 	struct nameidata nd;
 	int err;
-	unsigned hash;
+	unsigned hash, new_hash, old_hash;
 	struct unix_address *addr;
-	struct hlist_head *list;
 
 	err = -EINVAL;
 	if (sunaddr->sun_family != AF_UNIX)
@@ -822,6 +873,8 @@ static int unix_bind(struct socket *sock, struct sockaddr *uaddr, int addr_len)
 	err = -EINVAL;
 	if (u->addr)
 		goto out_up;
+	/* unbound, and only bind moves it, under readlock */
+	old_hash = sk->sk_hash;
 
 	err = -ENOMEM;
 	addr = kmalloc(sizeof(*addr)+addr_len, GFP_KERNEL);
@@ -872,7 +925,12 @@ out_mknod_drop_write:
 		addr->hash = UNIX_HASH_SIZE;
 	}
 
-	spin_lock(&unix_table_lock);
+	if (!sunaddr->sun_path[0])
+		new_hash = addr->hash;
+	else
+		new_hash = unix_inode_hash(dentry->d_inode);
+
+	unix_table_double_lock(old_hash, new_hash);
 
 	if (!sunaddr->sun_path[0]) {
 		err = -EADDRINUSE;
@@ -881,10 +939,7 @@ out_mknod_drop_write:
 			unix_release_addr(addr);
 			goto out_unlock;
 		}
-
-		list = &unix_socket_table[addr->hash];
 	} else {
-		list = &unix_socket_table[dentry->d_inode->i_ino & (UNIX_HASH_SIZE-1)];
 		u->dentry = nd.path.dentry;
 		u->mnt    = nd.path.mnt;
 	}
@@ -892,10 +947,10 @@ out_mknod_drop_write:
 	err = 0;
 	__unix_remove_socket(sk);
 	u->addr = addr;
-	__unix_insert_socket(list, sk);
+	__unix_insert_socket(new_hash, sk);
 
 out_unlock:
-	spin_unlock(&unix_table_lock);
+	unix_table_double_unlock(old_hash, new_hash);
 out_up:
 	mutex_unlock(&u->readlock);
 out:
@@ -1387,10 +1442,10 @@ static int unix_dgram_sendmsg(struct kiocb *kiocb, struct socket *sock,
 
 	if (NULL == siocb->scm)
 		siocb->scm = &tmp_scm;
-	wait_for_unix_gc();
 	err = scm_send(sock, msg, siocb->scm);
 	if (err < 0)
 		return err;
+	wait_for_unix_gc(siocb->scm->fp);
 
 	err = -EOPNOTSUPP;
 	if (msg->msg_flags&MSG_OOB)
@@ -1536,10 +1591,10 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 
 	if (NULL == siocb->scm)
 		siocb->scm = &tmp_scm;
-	wait_for_unix_gc();
 	err = scm_send(sock, msg, siocb->scm);
 	if (err < 0)
 		return err;
+	wait_for_unix_gc(siocb->scm->fp);
 
 	err = -EOPNOTSUPP;
 	if (msg->msg_flags&MSG_OOB)
@@ -1928,6 +1983,116 @@ out:
 	return copied ? : err;
 }
 
+/*
+ * u->readlock is held across the pipe insertion to keep the stream in
+ * order; no path takes u->readlock with the pipe locked.
+ */
+static ssize_t unix_splice_to_pipe(struct sock *sk,
+				   struct pipe_inode_info *pipe,
+				   struct splice_pipe_desc *spd)
+{
+	return splice_to_pipe(pipe, spd);
+}
+
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t size, unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	struct unix_sock *u = unix_sk(sk);
+	struct scm_cookie scm;
+	ssize_t spliced = 0;
+	int err = 0;
+	long timeo;
+
+	/*
+	 * We can't seek on a socket input
+	 */
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -EINVAL;
+
+	timeo = sock_rcvtimeo(sk, (sock->file->f_flags & O_NONBLOCK) ||
+				  (flags & SPLICE_F_NONBLOCK));
+	memset(&scm, 0, sizeof(scm));
+
+	mutex_lock(&u->readlock);
+
+	while (size) {
+		struct sk_buff *skb;
+		int chunk, ret;
+
+		unix_state_lock(sk);
+		skb = skb_dequeue(&sk->sk_receive_queue);
+		if (skb == NULL) {
+			if (spliced)
+				goto unlock;
+			err = sock_error(sk);
+			if (err)
+				goto unlock;
+			if (sk->sk_shutdown & RCV_SHUTDOWN)
+				goto unlock;
+
+			unix_state_unlock(sk);
+			err = -EAGAIN;
+			if (!timeo)
+				break;
+			mutex_unlock(&u->readlock);
+
+			timeo = unix_stream_data_wait(sk, timeo);
+
+			if (signal_pending(current)) {
+				err = sock_intr_errno(timeo);
+				goto out;
+			}
+			mutex_lock(&u->readlock);
+			continue;
+ unlock:
+			unix_state_unlock(sk);
+			break;
+		}
+		unix_state_unlock(sk);
+
+		chunk = min_t(unsigned int, skb->len, size);
+		ret = skb_splice_bits_sk(skb, sk, 0, pipe, chunk, flags,
+					 unix_splice_to_pipe);
+		if (ret <= 0) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			if (!spliced)
+				err = ret;
+			break;
+		}
+		spliced += ret;
+		size -= ret;
+		skb_pull(skb, ret);
+
+		/*
+		 * A pipe can't carry descriptors: they are detached and
+		 * dropped like for a reader that passes no control buffer.
+		 */
+		if (UNIXCB(skb).fp)
+			unix_detach_fds(&scm, skb);
+
+		/* put the skb back if we didn't use it up.. */
+		if (skb->len) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			break;
+		}
+
+		consume_skb(skb);
+
+		if (scm.fp)
+			break;
+	}
+
+	mutex_unlock(&u->readlock);
+	scm_destroy(&scm);
+out:
+	return spliced ? : err;
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -2102,33 +2267,44 @@ static unsigned int unix_dgram_poll(struct file *file, struct socket *sock,
 }
 
 #ifdef CONFIG_PROC_FS
-static struct sock *first_unix_socket(int *i)
+struct unix_iter_state {
+	struct seq_net_private p;
+	int i;
+};
+
+/*
+ * The first socket of the net of seq from bucket iter->i on, returned
+ * with the lock of its bucket held.
+ */
+static struct sock *unix_seq_first_from(struct seq_file *seq)
 {
-	for (*i = 0; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	struct unix_iter_state *iter = seq->private;
+	struct hlist_node *node;
+	struct sock *s;
+
+	for (; iter->i < UNIX_TABLE_SIZE; iter->i++) {
+		spin_lock(&unix_table_locks[iter->i]);
+		sk_for_each(s, node, &unix_socket_table[iter->i])
+			if (sock_net(s) == seq_file_net(seq))
+				return s;
+		spin_unlock(&unix_table_locks[iter->i]);
 	}
 	return NULL;
 }
 
-static struct sock *next_unix_socket(int *i, struct sock *s)
+/* The socket after s, whose bucket is locked */
+static struct sock *unix_seq_next_socket(struct seq_file *seq, struct sock *s)
 {
-	struct sock *next = sk_next(s);
-	/* More in this chain? */
-	if (next)
-		return next;
-	/* Look for next non-empty chain. */
-	for ((*i)++; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
-	}
-	return NULL;
-}
+	struct unix_iter_state *iter = seq->private;
 
-struct unix_iter_state {
-	struct seq_net_private p;
-	int i;
-};
+	while ((s = sk_next(s)) != NULL)
+		if (sock_net(s) == seq_file_net(seq))
+			return s;
+
+	spin_unlock(&unix_table_locks[iter->i]);
+	iter->i++;
+	return unix_seq_first_from(seq);
+}
 
 static struct sock *unix_seq_idx(struct seq_file *seq, loff_t pos)
 {
@@ -2136,9 +2312,9 @@ static struct sock *unix_seq_idx(struct seq_file *seq, loff_t pos)
 	loff_t off = 0;
 	struct sock *s;
 
-	for (s = first_unix_socket(&iter->i); s; s = next_unix_socket(&iter->i, s)) {
-		if (sock_net(s) != seq_file_net(seq))
-			continue;
+	iter->i = 0;
+	for (s = unix_seq_first_from(seq); s;
+	     s = unix_seq_next_socket(seq, s)) {
 		if (off == pos)
 			return s;
 		++off;
@@ -2147,31 +2323,29 @@ static struct sock *unix_seq_idx(struct seq_file *seq, loff_t pos)
 }
 
 static void *unix_seq_start(struct seq_file *seq, loff_t *pos)
-	__acquires(unix_table_lock)
 {
-	spin_lock(&unix_table_lock);
 	return *pos ? unix_seq_idx(seq, *pos - 1) : SEQ_START_TOKEN;
 }
 
 static void *unix_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
 	struct unix_iter_state *iter = seq->private;
-	struct sock *sk = v;
-	++*pos;
 
-	if (v == SEQ_START_TOKEN)
-		sk = first_unix_socket(&iter->i);
-	else
-		sk = next_unix_socket(&iter->i, sk);
-	while (sk && (sock_net(sk) != seq_file_net(seq)))
-		sk = next_unix_socket(&iter->i, sk);
-	return sk;
+	++*pos;
+	if (v == SEQ_START_TOKEN) {
+		iter->i = 0;
+		return unix_seq_first_from(seq);
+	}
+	return unix_seq_next_socket(seq, v);
 }
 
 static void unix_seq_stop(struct seq_file *seq, void *v)
-	__releases(unix_table_lock)
 {
-	spin_unlock(&unix_table_lock);
+	struct unix_iter_state *iter = seq->private;
+
+	/* a socket is returned with its bucket locked */
+	if (v && v != SEQ_START_TOKEN)
+		spin_unlock(&unix_table_locks[iter->i]);
 }
 
 static int unix_seq_show(struct seq_file *seq, void *v)
@@ -2282,9 +2456,13 @@ static int __init af_unix_init(void)
 {
 	int rc = -1;
 	struct sk_buff *dummy_skb;
+	int i;
 
 	BUILD_BUG_ON(sizeof(struct unix_skb_parms) > sizeof(dummy_skb->cb));
 
+	for (i = 0; i < UNIX_TABLE_SIZE; i++)
+		spin_lock_init(&unix_table_locks[i]);
+
 	rc = proto_register(&unix_proto, 1);
 	if (rc != 0) {
 		printk(KERN_CRIT "%s: Cannot create unix_sock SLAB cache!\n",
@@ -66,6 +66,10 @@
  *		Reimplement with a cycle collecting algorithm. This should
  *		solve several problems with the previous code, like being racy
  *		wrt receive and holding up unrelated socket operations.
+ *
+ *	The collection runs from a work item: close() and the senders only
+ *	kick it off, and only senders of fds, with far too many of them in
+ *	flight, wait for the collection in progress.
  */
 
 #include <linux/kernel.h>
@@ -80,6 +84,7 @@
 #include <linux/proc_fs.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 #include <net/af_unix.h>
@@ -258,15 +263,50 @@ static void inc_inflight_move_tail(struct unix_sock *u)
 		list_move_tail(&u->link, &gc_candidates);
 }
 
+/* fds in flight from which sendmsg() starts a collection */
+#define UNIX_INFLIGHT_TRIGGER_GC	16000
+/* and from which the senders of more fds wait for it */
+#define UNIX_INFLIGHT_THROTTLE_GC	(4 * UNIX_INFLIGHT_TRIGGER_GC)
+
 static bool gc_in_progress = false;
+/* collections done, under unix_gc_lock */
+static unsigned int unix_gc_seq;
 
-void wait_for_unix_gc(void)
+static void __unix_gc(struct work_struct *work);
+static DECLARE_WORK(unix_gc_work, __unix_gc);
+
+/*
+ * Called by the senders, fpl being the fds they pass if any.  Only
+ * throttles: the collection in progress is waited for, not a new one,
+ * and only by senders of fds, while far too many are in flight.
+ */
+void wait_for_unix_gc(struct scm_fp_list *fpl)
 {
-	wait_event(unix_gc_wait, gc_in_progress == false);
+	unsigned int seq;
+
+	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC && !gc_in_progress)
+		unix_gc();
+
+	if (!fpl || unix_tot_inflight <= UNIX_INFLIGHT_THROTTLE_GC)
+		return;
+
+	spin_lock(&unix_gc_lock);
+	seq = unix_gc_seq;
+	if (!gc_in_progress) {
+		spin_unlock(&unix_gc_lock);
+		return;
+	}
+	spin_unlock(&unix_gc_lock);
+	wait_event(unix_gc_wait, ACCESS_ONCE(unix_gc_seq) != seq);
 }
 
-/* The external entry point: unix_gc() */
+/* The external entry point: unix_gc(), queues a collection */
 void unix_gc(void)
+{
+	schedule_work(&unix_gc_work);
+}
+
+static void __unix_gc(struct work_struct *work)
 {
 	struct unix_sock *u;
 	struct unix_sock *next;
@@ -276,7 +316,7 @@ void unix_gc(void)
 
 	spin_lock(&unix_gc_lock);
 
-	/* Avoid a recursive GC. */
+	/* The work may be running on another cpu already. */
 	if (gc_in_progress)
 		goto out;
 
@@ -372,6 +412,7 @@ void unix_gc(void)
 	/* All candidates should have been detached by now. */
 	BUG_ON(!list_empty(&gc_candidates));
 	gc_in_progress = false;
+	unix_gc_seq++;
 	wake_up(&unix_gc_wait);
 
  out:
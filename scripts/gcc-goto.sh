@@ -0,0 +1,5 @@
+#!/bin/sh
+# Test for gcc 'asm goto' support, needed by jump labels.
+# Prints "y" if the compiler given as $@ accepts it.
+
+echo "int main(void) { entry: asm goto (\"\"::::entry); return 0; }" | $@ -x c - -c -o /dev/null >/dev/null 2>&1 && echo "y"
@@ -36,16 +36,7 @@
 #define AVC_CACHE_SLOTS			512
 #define AVC_DEF_CACHE_THRESHOLD		512
 #define AVC_CACHE_RECLAIM		16
-
-#ifdef CONFIG_SECURITY_SELINUX_AVC_STATS
-#define avc_cache_stats_incr(field)				\
-do {								\
-	per_cpu(avc_cache_stats, get_cpu()).field++;		\
-	put_cpu();						\
-} while (0)
-#else
-#define avc_cache_stats_incr(field)	do {} while (0)
-#endif
+#define AVC_FRONT_SLOTS			16
 
 struct avc_entry {
 	u32			ssid;
@@ -65,9 +56,27 @@ struct avc_cache {
 	spinlock_t		slots_lock[AVC_CACHE_SLOTS]; /* lock for writes */
 	atomic_t		lru_hint;	/* LRU hint for reclaim scan */
 	atomic_t		active_nodes;
+	atomic_t		generation;	/* bumped when a decision changes */
 	u32			latest_notif;	/* latest revocation notification */
 };
 
+/*
+ * A small direct mapped cache per cpu in front of avc_cache, for the
+ * hottest triples.  An entry is only good for the generation of
+ * avc_cache it was filled in; any change to a cached decision bumps the
+ * generation, which drops all front entries at once.  Interrupts are
+ * disabled around entries, as permission checks happen in irq context.
+ */
+struct avc_front_entry {
+	u32			ssid;
+	u32			tsid;
+	u16			tclass;
+	int			generation;
+	struct av_decision	avd;
+};
+
+static DEFINE_PER_CPU(struct avc_front_entry [AVC_FRONT_SLOTS], avc_front_cache);
+
 struct avc_callback_node {
 	int (*callback) (u32 event, u32 ssid, u32 tsid,
 			 u16 tclass, u32 perms,
@@ -178,6 +187,7 @@ void __init avc_init(void)
 	}
 	atomic_set(&avc_cache.active_nodes, 0);
 	atomic_set(&avc_cache.lru_hint, 0);
+	atomic_set(&avc_cache.generation, 1);
 
 	avc_node_cachep = kmem_cache_create("avc_node", sizeof(struct avc_node),
 					     0, SLAB_PANIC, NULL);
@@ -327,6 +337,54 @@ static inline struct avc_node *avc_search_node(u32 ssid, u32 tsid, u16 tclass)
 	return ret;
 }
 
+/* The front cache must not keep anything filled before this */
+static void avc_front_invalidate(void)
+{
+	smp_wmb();
+	atomic_inc(&avc_cache.generation);
+}
+
+static int avc_front_lookup(u32 ssid, u32 tsid, u16 tclass, int generation,
+			    struct av_decision *avd)
+{
+	struct avc_front_entry *e;
+	unsigned long flags;
+	int hit = 0;
+
+	local_irq_save(flags);
+	e = &__get_cpu_var(avc_front_cache)[avc_hash(ssid, tsid, tclass) &
+					    (AVC_FRONT_SLOTS - 1)];
+	if (e->ssid == ssid && e->tsid == tsid && e->tclass == tclass &&
+	    e->generation == generation) {
+		memcpy(avd, &e->avd, sizeof(*avd));
+		hit = 1;
+	}
+	local_irq_restore(flags);
+
+	if (hit) {
+		avc_cache_stats_incr(lookups);
+		avc_cache_stats_incr(front_hits);
+	}
+	return hit;
+}
+
+static void avc_front_fill(u32 ssid, u32 tsid, u16 tclass, int generation,
+			   struct av_decision *avd)
+{
+	struct avc_front_entry *e;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	e = &__get_cpu_var(avc_front_cache)[avc_hash(ssid, tsid, tclass) &
+					    (AVC_FRONT_SLOTS - 1)];
+	e->ssid = ssid;
+	e->tsid = tsid;
+	e->tclass = tclass;
+	e->generation = generation;
+	memcpy(&e->avd, avd, sizeof(e->avd));
+	local_irq_restore(flags);
+}
+
 /**
  * avc_lookup - Look up an AVC entry.
  * @ssid: source security identifier
@@ -420,6 +478,7 @@ static struct avc_node *avc_insert(u32 ssid, u32 tsid, u16 tclass, struct av_dec
 			    pos->ae.tsid == tsid &&
 			    pos->ae.tclass == tclass) {
 				avc_node_replace(node, pos);
+				avc_front_invalidate();
 				goto found;
 			}
 		}
@@ -657,6 +716,7 @@ static int avc_update_node(u32 event, u32 perms, u32 ssid, u32 tsid, u16 tclass,
 		break;
 	}
 	avc_node_replace(node, orig);
+	avc_front_invalidate();
 out_unlock:
 	spin_unlock_irqrestore(lock, flag);
 out:
@@ -690,6 +750,7 @@ static void avc_flush(void)
 		rcu_read_unlock();
 		spin_unlock_irqrestore(lock, flag);
 	}
+	avc_front_invalidate();
 }
 
 /**
@@ -745,31 +806,38 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid,
 {
 	struct avc_node *node;
 	struct av_decision avd_entry, *avd;
-	int rc = 0;
+	int rc = 0, generation;
 	u32 denied;
 
 	BUG_ON(!requested);
 
 	rcu_read_lock();
 
+	/* Read before the decision, so that any change after is noticed */
+	generation = atomic_read(&avc_cache.generation);
+	smp_rmb();
+
+	avd = in_avd ? in_avd : &avd_entry;
+	if (avc_front_lookup(ssid, tsid, tclass, generation, avd))
+		goto decide;
+
 	node = avc_lookup(ssid, tsid, tclass);
 	if (!node) {
 		rcu_read_unlock();
 
-		if (in_avd)
-			avd = in_avd;
-		else
-			avd = &avd_entry;
-
 		security_compute_av(ssid, tsid, tclass, avd);
 		rcu_read_lock();
 		node = avc_insert(ssid, tsid, tclass, avd);
+		if (node)
+			avc_front_fill(ssid, tsid, tclass, generation, avd);
 	} else {
 		if (in_avd)
 			memcpy(in_avd, &node->ae.avd, sizeof(*in_avd));
 		avd = &node->ae.avd;
+		avc_front_fill(ssid, tsid, tclass, generation, avd);
 	}
 
+decide:
 	denied = requested & ~(avd->allowed);
 
 	if (denied) {
@@ -47,6 +47,9 @@ struct avc_cache_stats {
 	unsigned int allocations;
 	unsigned int reclaims;
 	unsigned int frees;
+	unsigned int front_hits;	/* in the per-cpu front cache */
+	unsigned int te_hits;		/* security server type cache */
+	unsigned int te_misses;
 };
 
 /*
@@ -97,6 +100,14 @@ void avc_disable(void);
 
 #ifdef CONFIG_SECURITY_SELINUX_AVC_STATS
 DECLARE_PER_CPU(struct avc_cache_stats, avc_cache_stats);
+
+#define avc_cache_stats_incr(field)				\
+do {								\
+	per_cpu(avc_cache_stats, get_cpu()).field++;		\
+	put_cpu();						\
+} while (0)
+#else
+#define avc_cache_stats_incr(field)	do {} while (0)
 #endif
 
 #endif /* _SELINUX_AVC_H_ */
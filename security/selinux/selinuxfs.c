@@ -1180,11 +1180,12 @@ static int sel_avc_stats_seq_show(struct seq_file *seq, void *v)
 
 	if (v == SEQ_START_TOKEN)
 		seq_printf(seq, "lookups hits misses allocations reclaims "
-			   "frees\n");
+			   "frees front_hits te_hits te_misses\n");
 	else
-		seq_printf(seq, "%u %u %u %u %u %u\n", st->lookups,
+		seq_printf(seq, "%u %u %u %u %u %u %u %u %u\n", st->lookups,
 			   st->hits, st->misses, st->allocations,
-			   st->reclaims, st->frees);
+			   st->reclaims, st->frees, st->front_hits,
+			   st->te_hits, st->te_misses);
 	return 0;
 }
 
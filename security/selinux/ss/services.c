@@ -51,6 +51,7 @@
 #include <linux/mutex.h>
 #include <linux/selinux.h>
 #include <linux/flex_array.h>
+#include <linux/jhash.h>
 #include <net/netlabel.h>
 
 #include "flask.h"
@@ -88,6 +89,90 @@ int ss_initialized;
  */
 static u32 latest_granting;
 
+/*
+ * The type enforcement part of an access decision only depends on the
+ * source and target types and the class, but walking the attributes of
+ * both in the avtab is most of the cost of a decision.  Contexts that
+ * differ only in user, role or MLS range, like those of many containers
+ * of one type, share it through this table.  An entry is only good for
+ * the latest_granting it was filled in, so a policy load or a boolean
+ * change drops them all.
+ *
+ * Lookups run under the read side of policy_rwlock, from any context, so
+ * an entry is written under an odd sequence taken with cmpxchg; a reader
+ * that sees one being written, or finds it changed after reading it,
+ * treats it as a miss, and a writer that finds it busy leaves it.
+ */
+#define TE_CACHE_SLOTS		1024
+
+struct te_cache_entry {
+	unsigned int seq;
+	u32 seqno;
+	u32 stype;
+	u32 ttype;
+	u16 tclass;
+	u32 allowed;
+	u32 auditallow;
+	u32 auditdeny;
+};
+
+static struct te_cache_entry te_cache[TE_CACHE_SLOTS];
+
+static struct te_cache_entry *te_cache_slot(u32 stype, u32 ttype, u16 tclass)
+{
+	return &te_cache[jhash_3words(stype, ttype, tclass, 0) &
+			 (TE_CACHE_SLOTS - 1)];
+}
+
+static int te_cache_lookup(u32 stype, u32 ttype, u16 tclass,
+			   struct av_decision *avd)
+{
+	struct te_cache_entry *e = te_cache_slot(stype, ttype, tclass);
+	struct te_cache_entry copy;
+	unsigned int seq;
+
+	seq = ACCESS_ONCE(e->seq);
+	if (seq & 1)
+		goto miss;
+	smp_rmb();
+	copy = *e;
+	smp_rmb();
+	if (ACCESS_ONCE(e->seq) != seq ||
+	    copy.seqno != latest_granting || copy.stype != stype ||
+	    copy.ttype != ttype || copy.tclass != tclass)
+		goto miss;
+
+	avd->allowed = copy.allowed;
+	avd->auditallow = copy.auditallow;
+	avd->auditdeny = copy.auditdeny;
+	avc_cache_stats_incr(te_hits);
+	return 1;
+
+miss:
+	avc_cache_stats_incr(te_misses);
+	return 0;
+}
+
+static void te_cache_store(u32 stype, u32 ttype, u16 tclass,
+			   struct av_decision *avd)
+{
+	struct te_cache_entry *e = te_cache_slot(stype, ttype, tclass);
+	unsigned int seq = ACCESS_ONCE(e->seq);
+
+	if ((seq & 1) || cmpxchg(&e->seq, seq, seq + 1) != seq)
+		return;
+	smp_wmb();
+	e->seqno = latest_granting;
+	e->stype = stype;
+	e->ttype = ttype;
+	e->tclass = tclass;
+	e->allowed = avd->allowed;
+	e->auditallow = avd->auditallow;
+	e->auditdeny = avd->auditdeny;
+	smp_wmb();
+	e->seq = seq + 2;
+}
+
 /* Forward declaration. */
 static int context_struct_to_string(struct context *context, char **scontext,
 				    u32 *scontext_len);
@@ -625,6 +710,9 @@ static void context_struct_compute_av(struct context *scontext,
 	 * If a specific type enforcement rule was defined for
 	 * this permission check, then use it.
 	 */
+	if (te_cache_lookup(scontext->type, tcontext->type, tclass, avd))
+		goto constraints;
+
 	avkey.target_class = tclass;
 	avkey.specified = AVTAB_AV;
 	sattr = flex_array_get(policydb.type_attr_map_array, scontext->type - 1);
@@ -651,7 +739,9 @@ static void context_struct_compute_av(struct context *scontext,
 
 		}
 	}
+	te_cache_store(scontext->type, tcontext->type, tclass, avd);
 
+constraints:
 	/*
 	 * Remove any permissions prohibited by a constraint (this includes
 	 * the MLS policy).
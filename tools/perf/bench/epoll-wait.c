@@ -0,0 +1,207 @@
+/*
+ * epoll-wait.c
+ *
+ * wait: epoll wakeup throughput with many fds and waiters
+ *
+ * The waiter threads sleep in epoll_wait() on a set of eventfds, either
+ * all on one shared epoll instance or each on its own instance with its
+ * own share of the fds.  A writer thread makes the fds readable, one
+ * after the other, as fast as it can; the waiters consume the events.
+ * The number of events handled per second shows how the wakeup paths
+ * scale with the number of threads and fds.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+
+#define EPOLL_WAIT_MAX_EVENTS	16
+
+static int		nr_threads;
+static int		nr_fds		= 64;
+static int		runtime		= 10;
+static bool		multiq;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of waiting threads, default: number of cpus"),
+	OPT_INTEGER('f', "nfds", &nr_fds,
+		    "Specify number of fds per thread"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_BOOLEAN('m', "multiq", &multiq,
+		    "One epoll instance per thread instead of a shared one"),
+	OPT_END()
+};
+
+static const char * const bench_epoll_wait_usage[] = {
+	"perf bench epoll wait <options>",
+	NULL
+};
+
+struct waiter {
+	pthread_t thread;
+	int epfd;
+	unsigned long events;
+};
+
+static volatile int done;
+static int *fds;
+
+static void *epoll_waiter(void *arg)
+{
+	struct waiter *w = arg;
+	struct epoll_event events[EPOLL_WAIT_MAX_EVENTS];
+	unsigned long nr = 0;
+	u_int64_t val;
+	int i, ret;
+
+	while (!done) {
+		/* time out once in a while, to notice the end */
+		ret = epoll_wait(w->epfd, events, EPOLL_WAIT_MAX_EVENTS, 100);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			die("epoll_wait failed: %s\n", strerror(errno));
+		}
+		/* edge triggered, so another waiter may have drained it */
+		for (i = 0; i < ret; i++)
+			if (read(events[i].data.fd, &val, sizeof(val)) ==
+			    sizeof(val))
+				nr++;
+	}
+	w->events = nr;
+	return NULL;
+}
+
+static void *epoll_writer(void *arg __used)
+{
+	u_int64_t val = 1;
+	int i, total = nr_threads * nr_fds;
+
+	while (!done) {
+		for (i = 0; i < total && !done; i++)
+			if (write(fds[i], &val, sizeof(val)) != sizeof(val) &&
+			    errno != EAGAIN)
+				die("eventfd write failed: %s\n",
+				    strerror(errno));
+	}
+	return NULL;
+}
+
+static int create_epoll(void)
+{
+	int epfd = epoll_create(1);
+
+	if (epfd < 0)
+		die("epoll_create failed: %s\n", strerror(errno));
+	return epfd;
+}
+
+int bench_epoll_wait(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	struct epoll_event ev;
+	struct waiter *waiters;
+	pthread_t writer;
+	unsigned long total = 0;
+	double secs;
+	int i, epfd = -1;
+
+	argc = parse_options(argc, argv, options,
+			     bench_epoll_wait_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads <= 0 || nr_fds <= 0 || runtime <= 0) {
+		fprintf(stderr, "Invalid threads, nfds or runtime\n");
+		return 1;
+	}
+
+	waiters = calloc(nr_threads, sizeof(*waiters));
+	fds = calloc(nr_threads * nr_fds, sizeof(*fds));
+	if (!waiters || !fds)
+		die("calloc failed\n");
+
+	if (!multiq)
+		epfd = create_epoll();
+	for (i = 0; i < nr_threads; i++)
+		waiters[i].epfd = multiq ? create_epoll() : epfd;
+
+	for (i = 0; i < nr_threads * nr_fds; i++) {
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0)
+			die("eventfd failed: %s\n", strerror(errno));
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.fd = fds[i];
+		if (epoll_ctl(waiters[i / nr_fds].epfd, EPOLL_CTL_ADD, fds[i],
+			      &ev))
+			die("epoll_ctl failed: %s\n", strerror(errno));
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&waiters[i].thread, NULL, epoll_waiter,
+				   &waiters[i]))
+			die("pthread_create failed\n");
+
+	BUG_ON(gettimeofday(&start, NULL));
+	if (pthread_create(&writer, NULL, epoll_writer, NULL))
+		die("pthread_create failed\n");
+	sleep(runtime);
+	done = 1;
+
+	if (pthread_join(writer, NULL))
+		die("pthread_join failed\n");
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(waiters[i].thread, NULL))
+			die("pthread_join failed\n");
+		total += waiters[i].events;
+	}
+	BUG_ON(gettimeofday(&stop, NULL));
+	timersub(&stop, &start, &diff);
+	secs = (double)diff.tv_sec + (double)diff.tv_usec / 1000000;
+
+	for (i = 0; i < nr_threads * nr_fds; i++)
+		close(fds[i]);
+	for (i = 0; i < nr_threads; i++)
+		if (multiq || !i)
+			close(waiters[i].epfd);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads on %s, %d fds each, for %d secs\n\n",
+		       nr_threads,
+		       multiq ? "one epoll instance each" :
+				"a shared epoll instance",
+		       nr_fds, runtime);
+		printf(" %14.0lf events/sec\n", total / secs);
+		printf(" %14.0lf events/sec per thread\n",
+		       total / secs / nr_threads);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", total / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	free(fds);
+	free(waiters);
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * futex-hash.c
+ *
+ * hash: Futex hash table contention
+ *
+ * Every thread has its own set of futexes and calls FUTEX_WAIT on them
+ * in turn, with a value that never matches: each call hashes the futex
+ * and takes its hash bucket lock, then returns EAGAIN right away.  With
+ * many threads this measures the spread and the contention of the hash
+ * buckets, not the sleeping.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static int		nr_threads;
+static int		nr_futexes	= 1024;
+static int		runtime		= 10;
+static bool		fshared;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads, default: number of cpus"),
+	OPT_INTEGER('f', "futexes", &nr_futexes,
+		    "Specify number of futexes per thread"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_BOOLEAN('s', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	u_int32_t *futexes;
+	unsigned long ops;
+};
+
+static volatile int done;
+static int nr_started;
+static pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+
+static void *hash_worker(void *arg)
+{
+	struct worker *w = arg;
+	int opflags = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+	unsigned long ops = 0;
+	int i;
+
+	pthread_mutex_lock(&start_mutex);
+	nr_started++;
+	pthread_cond_broadcast(&start_cond);
+	while (nr_started >= 0)
+		pthread_cond_wait(&start_cond, &start_mutex);
+	pthread_mutex_unlock(&start_mutex);
+
+	while (!done) {
+		for (i = 0; i < nr_futexes; i++) {
+			if (futex_wait(&w->futexes[i], 1234, NULL, opflags) &&
+			    errno != EAGAIN && errno != EWOULDBLOCK)
+				die("futex_wait failed: %s\n", strerror(errno));
+			ops++;
+		}
+	}
+	w->ops = ops;
+	return NULL;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	struct worker *workers;
+	unsigned long total = 0, min_ops = ~0UL, max_ops = 0;
+	double secs;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads <= 0 || nr_futexes <= 0 || runtime <= 0) {
+		fprintf(stderr, "Invalid threads, futexes or runtime\n");
+		return 1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		die("calloc failed\n");
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].futexes = calloc(nr_futexes, sizeof(u_int32_t));
+		if (!workers[i].futexes)
+			die("calloc failed\n");
+		if (pthread_create(&workers[i].thread, NULL, hash_worker,
+				   &workers[i]))
+			die("pthread_create failed\n");
+	}
+
+	/* start them all at once, once they are all up */
+	pthread_mutex_lock(&start_mutex);
+	while (nr_started < nr_threads)
+		pthread_cond_wait(&start_cond, &start_mutex);
+	nr_started = -1;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_mutex);
+
+	BUG_ON(gettimeofday(&start, NULL));
+	sleep(runtime);
+	done = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			die("pthread_join failed\n");
+		total += workers[i].ops;
+		if (workers[i].ops < min_ops)
+			min_ops = workers[i].ops;
+		if (workers[i].ops > max_ops)
+			max_ops = workers[i].ops;
+		free(workers[i].futexes);
+	}
+	BUG_ON(gettimeofday(&stop, NULL));
+	timersub(&stop, &start, &diff);
+	secs = (double)diff.tv_sec + (double)diff.tv_usec / 1000000;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads, %d %s futexes each, for %d secs\n\n",
+		       nr_threads, nr_futexes,
+		       fshared ? "shared" : "private", runtime);
+		printf(" %14.0lf ops/sec\n", total / secs);
+		printf(" %14.0lf ops/sec per thread (min %.0lf, max %.0lf)\n",
+		       total / secs / nr_threads, min_ops / secs,
+		       max_ops / secs);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", total / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	free(workers);
+	return 0;
+}
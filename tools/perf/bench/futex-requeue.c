@@ -0,0 +1,161 @@
+/*
+ * futex-requeue.c
+ *
+ * requeue: Futex requeue throughput with many waiters
+ *
+ * All the threads block on one futex, then the main thread moves them
+ * over to a second one with FUTEX_CMP_REQUEUE, nr_requeue per call and
+ * without waking any, as a condition variable broadcast does, and
+ * measures how long moving all of them takes.  The run is repeated and
+ * averaged.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static int		nr_threads;
+static int		nr_requeue	= 1;
+static int		loops		= 10;
+static bool		fshared;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of waiting threads, default: number of cpus"),
+	OPT_INTEGER('q', "nrequeue", &nr_requeue,
+		    "Specify number of threads requeued per call"),
+	OPT_INTEGER('n', "loop", &loops,
+		    "Specify number of runs"),
+	OPT_BOOLEAN('s', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_requeue_usage[] = {
+	"perf bench futex requeue <options>",
+	NULL
+};
+
+static u_int32_t futex1, futex2;
+static int nr_blocked;
+static pthread_mutex_t block_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t block_cond = PTHREAD_COND_INITIALIZER;
+
+static void *requeue_waiter(void *arg __used)
+{
+	int opflags = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	pthread_mutex_lock(&block_mutex);
+	nr_blocked++;
+	pthread_cond_signal(&block_cond);
+	pthread_mutex_unlock(&block_mutex);
+
+	/* requeued to futex2, and woken from there */
+	while (futex_wait(&futex1, 0, NULL, opflags))
+		if (errno != EINTR && errno != EAGAIN)
+			die("futex_wait failed: %s\n", strerror(errno));
+	return NULL;
+}
+
+int bench_futex_requeue(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	pthread_t *threads;
+	double usecs, sum = 0, sum_sq = 0, avg, stddev;
+	int i, j, ret, requeued, woken, opflags;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_requeue_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads <= 0 || nr_requeue <= 0 || loops <= 0) {
+		fprintf(stderr, "Invalid threads, nrequeue or loop count\n");
+		return 1;
+	}
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		die("calloc failed\n");
+	opflags = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	for (j = 0; j < loops; j++) {
+		nr_blocked = 0;
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL, requeue_waiter,
+					   NULL))
+				die("pthread_create failed\n");
+
+		pthread_mutex_lock(&block_mutex);
+		while (nr_blocked < nr_threads)
+			pthread_cond_wait(&block_cond, &block_mutex);
+		pthread_mutex_unlock(&block_mutex);
+		/* give the last ones the time to get into the kernel */
+		usleep(100000);
+
+		requeued = 0;
+		BUG_ON(gettimeofday(&start, NULL));
+		while (requeued < nr_threads) {
+			ret = futex_cmp_requeue(&futex1, 0, &futex2, 0,
+						nr_requeue, opflags);
+			if (ret < 0)
+				die("futex_cmp_requeue failed: %s\n",
+				    strerror(errno));
+			requeued += ret;
+		}
+		BUG_ON(gettimeofday(&stop, NULL));
+		timersub(&stop, &start, &diff);
+
+		usecs = (double)diff.tv_sec * 1000000 + diff.tv_usec;
+		sum += usecs;
+		sum_sq += usecs * usecs;
+
+		woken = 0;
+		while (woken < nr_threads) {
+			ret = futex_wake(&futex2, nr_threads, opflags);
+			if (ret < 0)
+				die("futex_wake failed: %s\n", strerror(errno));
+			woken += ret;
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i], NULL))
+				die("pthread_join failed\n");
+	}
+
+	avg = sum / loops;
+	stddev = sqrt(sum_sq / loops - avg * avg);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads on a %s futex, requeued %d per call, "
+		       "%d runs\n\n",
+		       nr_threads, fshared ? "shared" : "private", nr_requeue,
+		       loops);
+		printf(" %14.3lf msecs to requeue all (+- %.3lf)\n",
+		       avg / 1000, stddev / 1000);
+		printf(" %14.3lf usecs/requeue\n", avg / nr_threads);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3lf\n", avg / 1000);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	free(threads);
+	return 0;
+}
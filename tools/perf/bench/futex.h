@@ -0,0 +1,42 @@
+/*
+ * futex.h: glibc has no futex() wrappers, these are shared by the
+ * futex suites.
+ */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/futex.h>
+
+#ifndef FUTEX_PRIVATE_FLAG
+#define FUTEX_PRIVATE_FLAG	128
+#endif
+
+static inline int
+futex_wait(u_int32_t *uaddr, u_int32_t val, struct timespec *timeout,
+	   int opflags)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAIT | opflags, val, timeout,
+		       NULL, 0);
+}
+
+static inline int
+futex_wake(u_int32_t *uaddr, int nr_wake, int opflags)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAKE | opflags, nr_wake, NULL,
+		       NULL, 0);
+}
+
+/* wake up to nr_wake waiters on uaddr, move up to nr_requeue to uaddr2 */
+static inline int
+futex_cmp_requeue(u_int32_t *uaddr, u_int32_t val, u_int32_t *uaddr2,
+		  int nr_wake, int nr_requeue, int opflags)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_CMP_REQUEUE | opflags, nr_wake,
+		       nr_requeue, uaddr2, val);
+}
+
+#endif /* _FUTEX_H */
@@ -0,0 +1,159 @@
+/*
+ * mem-fault.c
+ *
+ * fault: Anonymous page fault throughput, optionally inside a memory cgroup
+ *
+ * Every process maps an anonymous area, touches each of its pages once
+ * and unmaps it again, so each loop charges and uncharges every page.
+ * Run it in nested memory cgroups to see the cost of hierarchical charging.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static const char	*length_str	= "64MB";
+static const char	*cgroup_dir;
+static int		loops		= 16;
+static int		nr_procs	= 1;
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "64MB",
+		    "Specify length of memory to fault in per process. "
+		    "available unit: B, MB, GB (upper and lower)"),
+	OPT_INTEGER('n', "loop", &loops,
+		    "Specify number of map/touch/unmap loops"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of processes faulting in parallel"),
+	OPT_STRING('g', "cgroup", &cgroup_dir, "dir",
+		    "Memory cgroup directory to run in"),
+	OPT_END()
+};
+
+static const char * const bench_mem_fault_usage[] = {
+	"perf bench mem fault <options>",
+	NULL
+};
+
+static void enter_cgroup(const char *dir)
+{
+	char path[PATH_MAX], pid[32];
+	int fd, len;
+
+	snprintf(path, sizeof(path), "%s/tasks", dir);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		die("cannot open %s: %s\n", path, strerror(errno));
+
+	len = snprintf(pid, sizeof(pid), "%d\n", getpid());
+	if (write(fd, pid, len) != len)
+		die("cannot move to %s: %s\n", dir, strerror(errno));
+	close(fd);
+}
+
+static void fault_loop(size_t length, long page_size)
+{
+	size_t off;
+	char *p;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap failed: %s\n", strerror(errno));
+
+		for (off = 0; off < length; off += page_size)
+			p[off] = 1;
+
+		munmap(p, length);
+	}
+}
+
+int bench_mem_fault(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long long nr_faults;
+	double secs;
+	size_t length;
+	pid_t pid;
+	int i, status;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_fault_usage, 0);
+
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+	if (loops <= 0 || nr_procs <= 0) {
+		fprintf(stderr, "Invalid loop or procs count\n");
+		return 1;
+	}
+
+	/* Children inherit the cgroup */
+	if (cgroup_dir)
+		enter_cgroup(cgroup_dir);
+
+	BUG_ON(gettimeofday(&start, NULL));
+
+	for (i = 0; i < nr_procs; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork failed: %s\n", strerror(errno));
+		if (!pid) {
+			fault_loop(length, page_size);
+			exit(0);
+		}
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			die("fault process failed\n");
+	}
+
+	BUG_ON(gettimeofday(&stop, NULL));
+	timersub(&stop, &start, &diff);
+
+	secs = (double)diff.tv_sec + (double)diff.tv_usec / 1000000;
+	nr_faults = (unsigned long long)nr_procs * loops *
+		((length + page_size - 1) / page_size);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d processes faulting %s each, %d times%s%s\n\n",
+		       nr_procs, length_str, loops,
+		       cgroup_dir ? ", in " : "",
+		       cgroup_dir ? cgroup_dir : "");
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long)(diff.tv_usec / 1000));
+		printf(" %14lf usecs/fault\n", secs * 1000000 / nr_faults);
+		printf(" %14.0lf faults/sec\n", nr_faults / secs);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", nr_faults / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * net-netns.c
+ *
+ * netns: Network namespace create/destroy throughput
+ *
+ * Every process forks children which each unshare() a new network
+ * namespace and exit right away, dropping it.  The namespaces are torn
+ * down asynchronously, but creating one waits for the teardown in
+ * progress, so a long enough run measures the rate the kernel sustains
+ * for both.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#ifndef CLONE_NEWNET
+#define CLONE_NEWNET	0x40000000
+#endif
+
+static int		loops		= 1000;
+static int		nr_procs	= 1;
+
+static const struct option options[] = {
+	OPT_INTEGER('n', "loop", &loops,
+		    "Specify number of namespaces per process"),
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of processes creating namespaces in parallel"),
+	OPT_END()
+};
+
+static const char * const bench_net_netns_usage[] = {
+	"perf bench net netns <options>",
+	NULL
+};
+
+static void netns_loop(void)
+{
+	pid_t pid;
+	int i, status;
+
+	for (i = 0; i < loops; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork failed: %s\n", strerror(errno));
+		if (!pid) {
+			if (unshare(CLONE_NEWNET))
+				exit(1);
+			exit(0);
+		}
+		if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			die("unshare(CLONE_NEWNET) failed, are you root?\n");
+	}
+}
+
+int bench_net_netns(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long nr_ns;
+	double secs;
+	pid_t pid;
+	int i, status;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_netns_usage, 0);
+
+	if (loops <= 0 || nr_procs <= 0) {
+		fprintf(stderr, "Invalid loop or procs count\n");
+		return 1;
+	}
+
+	BUG_ON(gettimeofday(&start, NULL));
+
+	for (i = 0; i < nr_procs; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork failed: %s\n", strerror(errno));
+		if (!pid) {
+			netns_loop();
+			exit(0);
+		}
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			die("netns process failed\n");
+	}
+
+	BUG_ON(gettimeofday(&stop, NULL));
+	timersub(&stop, &start, &diff);
+
+	secs = (double)diff.tv_sec + (double)diff.tv_usec / 1000000;
+	nr_ns = (unsigned long long)nr_procs * loops;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d processes creating and dropping %d network namespaces each\n\n",
+		       nr_procs, loops);
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long)(diff.tv_usec / 1000));
+		printf(" %14lf usecs/netns\n", secs * 1000000 / nr_ns);
+		printf(" %14.0lf netns/sec\n", nr_ns / secs);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", nr_ns / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	return 0;
+}
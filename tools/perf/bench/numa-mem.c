@@ -0,0 +1,361 @@
+/*
+ * numa-mem.c
+ *
+ * mem: NUMA memory bandwidth and convergence
+ *
+ * Every thread of every process streams over its own memory area, loop
+ * after loop.  The area can be faulted in on a given node first, and
+ * the threads can be bound to the nodes round robin or left to the
+ * scheduler.  After each loop a sample of the pages of the area is
+ * checked with move_pages(): the share on the node the thread runs on
+ * tells whether the kernel brought threads and their memory together.
+ * The run has converged at the first loop all the threads ended with
+ * at least CONVERGED_PCT percent of their pages local.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define CONVERGED_PCT		90
+/* one page in SAMPLE_STRIDE is checked for its node */
+#define SAMPLE_STRIDE		16
+#define MAX_NR_NODES		1024
+
+static int		nr_procs	= 1;
+static int		nr_threads;
+static int		mb		= 64;
+static int		loops		= 20;
+static int		first_node	= -1;
+static bool		bind_nodes;
+
+static const struct option options[] = {
+	OPT_INTEGER('p', "procs", &nr_procs,
+		    "Specify number of processes"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads per process, "
+		    "default: number of cpus / processes"),
+	OPT_INTEGER('m', "mb", &mb,
+		    "Specify MB of memory per thread"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of loops over the memory"),
+	OPT_INTEGER('N', "first-node", &first_node,
+		    "Fault the memory in on this node first"),
+	OPT_BOOLEAN('b', "bind", &bind_nodes,
+		    "Bind the threads to the nodes round robin"),
+	OPT_END()
+};
+
+static const char * const bench_numa_mem_usage[] = {
+	"perf bench numa mem <options>",
+	NULL
+};
+
+/* in memory shared by all the processes */
+struct loop_stat {
+	double end;		/* secs since the start */
+	double secs;		/* of the loop */
+	int local_pct;
+};
+
+struct worker {
+	pthread_t thread;
+	int index;		/* over all the processes */
+	struct loop_stat *stats;
+};
+
+static int nodes[MAX_NR_NODES];
+static int nr_nodes;
+static cpu_set_t all_cpus;
+static struct timeval start;
+static long page_size;
+
+static void read_nodes(void)
+{
+	struct dirent *d;
+	DIR *dir;
+	int node;
+
+	dir = opendir("/sys/devices/system/node");
+	if (!dir) {
+		/* not NUMA: a single node */
+		nodes[nr_nodes++] = 0;
+		return;
+	}
+	while ((d = readdir(dir)) && nr_nodes < MAX_NR_NODES)
+		if (sscanf(d->d_name, "node%d", &node) == 1)
+			nodes[nr_nodes++] = node;
+	closedir(dir);
+	if (!nr_nodes)
+		nodes[nr_nodes++] = 0;
+}
+
+/* the cpus of node, from its cpulist, e.g. "0-3,8-11" */
+static void node_cpus(int node, cpu_set_t *cpus)
+{
+	char path[PATH_MAX], buf[4096], *p;
+	int first, last;
+	FILE *f;
+
+	CPU_ZERO(cpus);
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f) {
+		*cpus = all_cpus;
+		return;
+	}
+	if (!fgets(buf, sizeof(buf), f))
+		buf[0] = '\0';
+	fclose(f);
+
+	p = buf;
+	while (*p >= '0' && *p <= '9') {
+		first = last = strtol(p, &p, 10);
+		if (*p == '-')
+			last = strtol(p + 1, &p, 10);
+		while (first <= last && first < CPU_SETSIZE)
+			CPU_SET(first++, cpus);
+		if (*p++ != ',')
+			break;
+	}
+	if (!CPU_COUNT(cpus))
+		*cpus = all_cpus;
+}
+
+static void set_affinity(cpu_set_t *cpus)
+{
+	if (sched_setaffinity(0, sizeof(*cpus), cpus))
+		die("sched_setaffinity failed: %s\n", strerror(errno));
+}
+
+static int current_node(void)
+{
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return 0;
+	return node;
+}
+
+/* percentage of the sampled pages of area that are on node */
+static int local_pct(void *area, size_t length, int node)
+{
+	unsigned long nr_samples = length / page_size / SAMPLE_STRIDE + 1;
+	unsigned long i, local = 0, valid = 0;
+	void **pages;
+	int *status;
+
+	pages = malloc(nr_samples * sizeof(*pages));
+	status = malloc(nr_samples * sizeof(*status));
+	if (!pages || !status)
+		die("malloc failed\n");
+
+	for (i = 0; i < nr_samples; i++)
+		pages[i] = (char *)area + (i * SAMPLE_STRIDE * page_size) % length;
+	if (syscall(SYS_move_pages, 0, nr_samples, pages, NULL, status, 0))
+		die("move_pages failed: %s\n", strerror(errno));
+
+	for (i = 0; i < nr_samples; i++) {
+		if (status[i] < 0)
+			continue;
+		valid++;
+		if (status[i] == node)
+			local++;
+	}
+	free(pages);
+	free(status);
+	return valid ? local * 100 / valid : 0;
+}
+
+static double since(struct timeval *from)
+{
+	struct timeval now, diff;
+
+	BUG_ON(gettimeofday(&now, NULL));
+	timersub(&now, from, &diff);
+	return (double)diff.tv_sec + (double)diff.tv_usec / 1000000;
+}
+
+static void *numa_worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t length = (size_t)mb << 20, i;
+	struct timeval loop_start;
+	u_int64_t *area;
+	cpu_set_t cpus;
+	int l;
+
+	if (first_node >= 0) {
+		node_cpus(first_node, &cpus);
+		set_affinity(&cpus);
+	}
+	area = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		die("mmap failed: %s\n", strerror(errno));
+	memset(area, 0, length);
+
+	if (bind_nodes) {
+		node_cpus(nodes[w->index % nr_nodes], &cpus);
+		set_affinity(&cpus);
+	} else if (first_node >= 0)
+		set_affinity(&all_cpus);
+
+	for (l = 0; l < loops; l++) {
+		BUG_ON(gettimeofday(&loop_start, NULL));
+		for (i = 0; i < length / sizeof(*area); i++)
+			area[i]++;
+		w->stats[l].secs = since(&loop_start);
+		w->stats[l].end = since(&start);
+		w->stats[l].local_pct = local_pct(area, length,
+						  current_node());
+	}
+
+	munmap(area, length);
+	return NULL;
+}
+
+static void numa_process(struct worker *workers)
+{
+	int i;
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, numa_worker,
+				   &workers[i]))
+			die("pthread_create failed\n");
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(workers[i].thread, NULL))
+			die("pthread_join failed\n");
+}
+
+int bench_numa_mem(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct loop_stat *stats, *s;
+	struct worker *workers;
+	double bytes, total_secs = 0, thread_secs, bw;
+	double sum_bw = 0, min_bw = 0, max_bw = 0, converged = -1;
+	int i, l, p, status, nr_workers, min_pct, sum_pct = 0;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_numa_mem_usage, 0);
+
+	if (nr_procs <= 0 || nr_threads < 0 || mb <= 0 || loops <= 0) {
+		fprintf(stderr, "Invalid procs, threads, mb or loop count\n");
+		return 1;
+	}
+	if (!nr_threads) {
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN) / nr_procs;
+		if (!nr_threads)
+			nr_threads = 1;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	read_nodes();
+	if (sched_getaffinity(0, sizeof(all_cpus), &all_cpus))
+		die("sched_getaffinity failed: %s\n", strerror(errno));
+
+	nr_workers = nr_procs * nr_threads;
+	stats = mmap(NULL, nr_workers * loops * sizeof(*stats),
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	workers = calloc(nr_workers, sizeof(*workers));
+	if (stats == MAP_FAILED || !workers)
+		die("cannot allocate the statistics\n");
+	for (i = 0; i < nr_workers; i++) {
+		workers[i].index = i;
+		workers[i].stats = stats + i * loops;
+	}
+
+	BUG_ON(gettimeofday(&start, NULL));
+	for (p = 0; p < nr_procs; p++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork failed: %s\n", strerror(errno));
+		if (!pid) {
+			numa_process(workers + p * nr_threads);
+			exit(0);
+		}
+	}
+	for (p = 0; p < nr_procs; p++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			die("numa process failed\n");
+	}
+
+	bytes = (double)((size_t)mb << 20) * loops;
+	for (i = 0; i < nr_workers; i++) {
+		thread_secs = 0;
+		for (l = 0; l < loops; l++)
+			thread_secs += workers[i].stats[l].secs;
+		bw = bytes / thread_secs / 1e9;
+		sum_bw += bw;
+		if (!i || bw < min_bw)
+			min_bw = bw;
+		if (!i || bw > max_bw)
+			max_bw = bw;
+		s = &workers[i].stats[loops - 1];
+		if (s->end > total_secs)
+			total_secs = s->end;
+		sum_pct += s->local_pct;
+	}
+
+	for (l = 0; l < loops && converged < 0; l++) {
+		min_pct = 100;
+		for (i = 0; i < nr_workers; i++)
+			if (workers[i].stats[l].local_pct < min_pct)
+				min_pct = workers[i].stats[l].local_pct;
+		if (min_pct < CONVERGED_PCT)
+			continue;
+		for (i = 0; i < nr_workers; i++)
+			if (workers[i].stats[l].end > converged)
+				converged = workers[i].stats[l].end;
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d processes of %d threads, %d MB each, %d loops, "
+		       "%d nodes%s\n\n",
+		       nr_procs, nr_threads, mb, loops, nr_nodes,
+		       bind_nodes ? ", bound" : "");
+		printf(" %14.3lf GB/sec\n",
+		       bytes * nr_workers / total_secs / 1e9);
+		printf(" %14.3lf GB/sec per thread (min %.3lf, max %.3lf)\n",
+		       sum_bw / nr_workers, min_bw, max_bw);
+		printf(" %14d%% local at the end, on average\n",
+		       sum_pct / nr_workers);
+		if (converged >= 0)
+			printf(" %14.3lf secs to converge\n", converged);
+		else
+			printf(" %14s did not converge\n", "");
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3lf %.3lf\n", bytes * nr_workers / total_secs / 1e9,
+		       converged);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	munmap(stats, nr_workers * loops * sizeof(*stats));
+	free(workers);
+	return 0;
+}
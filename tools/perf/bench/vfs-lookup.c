@@ -0,0 +1,236 @@
+/*
+ * vfs-lookup.c
+ *
+ * lookup: Parallel path lookup on shared or disjoint trees
+ *
+ * A directory tree of the given depth and fanout is created, with files
+ * in its leaf directories, either one tree shared by all the threads or
+ * one tree per thread.  The threads then stat() (or open() and close())
+ * every file of their tree by its full path, over and over.  A shared
+ * tree has all the threads walk the same dentries, disjoint trees only
+ * share the root and the superblock.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char	*base_dir	= "/tmp";
+static int		nr_threads;
+static int		depth		= 4;
+static int		fanout		= 4;
+static int		nr_files	= 8;
+static int		runtime		= 10;
+static bool		disjoint;
+static bool		use_open;
+
+static const struct option options[] = {
+	OPT_STRING('d', "dir", &base_dir, "dir",
+		    "Specify directory to create the trees in"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads, default: number of cpus"),
+	OPT_INTEGER('D', "depth", &depth,
+		    "Specify depth of the tree"),
+	OPT_INTEGER('w', "fanout", &fanout,
+		    "Specify number of subdirectories per directory"),
+	OPT_INTEGER('n', "files", &nr_files,
+		    "Specify number of files per leaf directory"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_BOOLEAN('j', "disjoint", &disjoint,
+		    "One tree per thread instead of a shared one"),
+	OPT_BOOLEAN('o', "open", &use_open,
+		    "open() and close() the files instead of stat()"),
+	OPT_END()
+};
+
+static const char * const bench_vfs_lookup_usage[] = {
+	"perf bench vfs lookup <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	char **paths;
+	unsigned long ops;
+};
+
+static volatile int done;
+static int nr_paths;
+
+/*
+ * Create the tree at dir, leaving the paths of its files at paths; or
+ * with destroy set, remove the tree it created.  Returns the number of
+ * files.
+ */
+static int walk_tree(const char *dir, int level, char **paths, bool destroy)
+{
+	char path[PATH_MAX];
+	int i, n = 0, fd;
+
+	if (!destroy && mkdir(dir, 0755) && errno != EEXIST)
+		die("cannot create %s: %s\n", dir, strerror(errno));
+
+	if (level == depth) {
+		for (i = 0; i < nr_files; i++) {
+			snprintf(path, sizeof(path), "%s/f%d", dir, i);
+			if (destroy) {
+				unlink(path);
+				continue;
+			}
+			fd = open(path, O_CREAT | O_WRONLY, 0644);
+			if (fd < 0)
+				die("cannot create %s: %s\n", path,
+				    strerror(errno));
+			close(fd);
+			paths[n] = strdup(path);
+			if (!paths[n])
+				die("strdup failed\n");
+			n++;
+		}
+	} else {
+		for (i = 0; i < fanout; i++) {
+			snprintf(path, sizeof(path), "%s/d%d", dir, i);
+			n += walk_tree(path, level + 1,
+				       paths ? paths + n : NULL, destroy);
+		}
+	}
+
+	if (destroy)
+		rmdir(dir);
+	return n;
+}
+
+static void *lookup_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+	struct stat st;
+	int i, fd;
+
+	while (!done) {
+		for (i = 0; i < nr_paths && !done; i++) {
+			if (use_open) {
+				fd = open(w->paths[i], O_RDONLY);
+				if (fd < 0)
+					die("cannot open %s: %s\n",
+					    w->paths[i], strerror(errno));
+				close(fd);
+			} else if (stat(w->paths[i], &st))
+				die("cannot stat %s: %s\n", w->paths[i],
+				    strerror(errno));
+			ops++;
+		}
+	}
+	w->ops = ops;
+	return NULL;
+}
+
+int bench_vfs_lookup(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	struct worker *workers;
+	char root[PATH_MAX], dir[PATH_MAX];
+	unsigned long total = 0;
+	int i, j, nr_trees;
+	double secs;
+
+	argc = parse_options(argc, argv, options,
+			     bench_vfs_lookup_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads <= 0 || depth < 0 || fanout <= 0 || nr_files <= 0 ||
+	    runtime <= 0) {
+		fprintf(stderr, "Invalid threads, tree shape or runtime\n");
+		return 1;
+	}
+
+	nr_paths = nr_files;
+	for (i = 0; i < depth; i++)
+		nr_paths *= fanout;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		die("calloc failed\n");
+
+	snprintf(root, sizeof(root), "%s/perf-bench-vfs-%d", base_dir,
+		 getpid());
+	if (mkdir(root, 0755))
+		die("cannot create %s: %s\n", root, strerror(errno));
+
+	nr_trees = disjoint ? nr_threads : 1;
+	for (i = 0; i < nr_threads; i++) {
+		if (i >= nr_trees) {
+			workers[i].paths = workers[0].paths;
+			continue;
+		}
+		workers[i].paths = calloc(nr_paths, sizeof(char *));
+		if (!workers[i].paths)
+			die("calloc failed\n");
+		snprintf(dir, sizeof(dir), "%s/t%d", root, i);
+		walk_tree(dir, 0, workers[i].paths, false);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, lookup_worker,
+				   &workers[i]))
+			die("pthread_create failed\n");
+
+	BUG_ON(gettimeofday(&start, NULL));
+	sleep(runtime);
+	done = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			die("pthread_join failed\n");
+		total += workers[i].ops;
+	}
+	BUG_ON(gettimeofday(&stop, NULL));
+	timersub(&stop, &start, &diff);
+	secs = (double)diff.tv_sec + (double)diff.tv_usec / 1000000;
+
+	for (i = 0; i < nr_trees; i++) {
+		snprintf(dir, sizeof(dir), "%s/t%d", root, i);
+		walk_tree(dir, 0, NULL, true);
+		for (j = 0; j < nr_paths; j++)
+			free(workers[i].paths[j]);
+		free(workers[i].paths);
+	}
+	rmdir(root);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads, %s of depth %d, %d files each, "
+		       "%s for %d secs\n\n",
+		       nr_threads, disjoint ? "a tree each" : "a shared tree",
+		       depth, nr_paths, use_open ? "open" : "stat", runtime);
+		printf(" %14.0lf lookups/sec\n", total / secs);
+		printf(" %14.0lf lookups/sec per thread\n",
+		       total / secs / nr_threads);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", total / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	free(workers);
+	return 0;
+}
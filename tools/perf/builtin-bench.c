@@ -13,6 +13,11 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  net   ... network stack setup performance
+ *  numa  ... memory placement on NUMA machines
+ *  futex ... futex operations
+ *  epoll ... epoll wakeups
+ *  vfs   ... path lookup
  *
  */
 
@@ -52,6 +57,65 @@ static struct bench_suite mem_suites[] = {
 	{ "memcpy",
 	  "Simple memory copy in various ways",
 	  bench_mem_memcpy },
+	{ "fault",
+	  "Anonymous page fault throughput, optionally in a memory cgroup",
+	  bench_mem_fault },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite net_suites[] = {
+	{ "netns",
+	  "Network namespace create/destroy throughput",
+	  bench_net_netns },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite numa_suites[] = {
+	{ "mem",
+	  "Memory bandwidth and convergence of threads across the nodes",
+	  bench_numa_mem },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite futex_suites[] = {
+	{ "hash",
+	  "Futex hash table contention",
+	  bench_futex_hash },
+	{ "wake",
+	  "Futex wakeup of many waiters",
+	  bench_futex_wake },
+	{ "requeue",
+	  "Futex requeue of many waiters",
+	  bench_futex_requeue },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite epoll_suites[] = {
+	{ "wait",
+	  "epoll wakeup throughput with many fds and threads",
+	  bench_epoll_wait },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite vfs_suites[] = {
+	{ "lookup",
+	  "Parallel path lookup on shared or disjoint trees",
+	  bench_vfs_lookup },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -71,6 +135,21 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "net",
+	  "network stack setup performance",
+	  net_suites },
+	{ "numa",
+	  "memory placement on NUMA machines",
+	  numa_suites },
+	{ "futex",
+	  "futex operations",
+	  futex_suites },
+	{ "epoll",
+	  "epoll wakeups",
+	  epoll_suites },
+	{ "vfs",
+	  "path lookup",
+	  vfs_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },
@@ -12,6 +12,7 @@
 
 #include "util/debug.h"
 #include "util/session.h"
+#include "util/event.h"
 
 #include <sys/types.h>
 #include <sys/prctl.h>
@@ -58,6 +59,7 @@ struct lock_stat {
 	u64			wait_time_min;
 	u64			wait_time_max;
 
+	unsigned int		flags;	/* LCB_F_* of the last contention */
 	int			discard; /* flag of blacklist */
 };
 
@@ -98,6 +100,10 @@ struct lock_seq_stat {
 	void                    *addr;
 
 	int                     read_count;
+
+	/* contention_begin -> contention_end */
+	struct lock_stat	*caller;
+	unsigned int		flags;
 };
 
 struct thread_stat {
@@ -342,6 +348,17 @@ struct trace_release_event {
 	const char		*name;
 };
 
+struct trace_contention_begin_event {
+	void			*addr;
+	unsigned int		flags;
+	struct ip_callchain	*callchain;
+};
+
+struct trace_contention_end_event {
+	void			*addr;
+	int			ret;
+};
+
 struct trace_lock_handler {
 	void (*acquire_event)(struct trace_acquire_event *,
 			      struct event *,
@@ -366,6 +383,18 @@ struct trace_lock_handler {
 			      int cpu,
 			      u64 timestamp,
 			      struct thread *thread);
+
+	void (*contention_begin_event)(struct trace_contention_begin_event *,
+				       struct event *,
+				       int cpu,
+				       u64 timestamp,
+				       struct thread *thread);
+
+	void (*contention_end_event)(struct trace_contention_end_event *,
+				     struct event *,
+				     int cpu,
+				     u64 timestamp,
+				     struct thread *thread);
 };
 
 static struct lock_seq_stat *get_seq(struct thread_stat *ts, void *addr)
@@ -631,6 +660,152 @@ static struct trace_lock_handler report_lock_ops  = {
 	.release_event		= report_lock_release_event,
 };
 
+/*
+ * perf lock contention: the lock:contention_begin/end tracepoints bracket
+ * the slow path of spinlocks, mutexes and rwsems, and need no lockdep.
+ * Lock instances are mostly anonymous without it, so the waits are
+ * accounted to their caller instead: the first function of the kernel
+ * callchain that is not part of a locking primitive.
+ */
+
+/* from include/trace/events/lock.h */
+#define LCB_F_SPIN	(1U << 0)
+#define LCB_F_READ	(1U << 1)
+#define LCB_F_WRITE	(1U << 2)
+#define LCB_F_MUTEX	(1U << 3)
+
+static const char *lock_function_prefixes[] = {
+	"_raw_",
+	"__raw_",
+	"do_raw_",
+	"queued_spin_lock",
+	"mutex_lock",
+	"__mutex_lock",
+	"down_read",
+	"down_write",
+	"__down",
+	"rwsem_",
+	"call_rwsem_",
+	NULL
+};
+
+static bool is_lock_function(const char *name)
+{
+	int i;
+
+	for (i = 0; lock_function_prefixes[i]; i++) {
+		if (!prefixcmp(name, lock_function_prefixes[i]))
+			return true;
+	}
+	return false;
+}
+
+static struct lock_stat *contention_caller(struct ip_callchain *chain,
+					   struct thread *thread)
+{
+	char unknown[32];
+	struct addr_location al;
+	bool kernel = false;
+	unsigned int i;
+
+	if (!chain)
+		goto out;
+
+	for (i = 0; i < chain->nr; i++) {
+		u64 ip = chain->ips[i];
+
+		if (ip >= PERF_CONTEXT_MAX) {
+			kernel = ip == PERF_CONTEXT_KERNEL;
+			continue;
+		}
+		if (!kernel)
+			break;
+
+		al.filtered = false;
+		thread__find_addr_location(thread, session,
+					   PERF_RECORD_MISC_KERNEL,
+					   MAP__FUNCTION, thread->pid, ip,
+					   &al, NULL);
+		if (!al.sym) {
+			snprintf(unknown, sizeof(unknown), "%#llx",
+				 (unsigned long long)ip);
+			return lock_stat_findnew((void *)(unsigned long)ip,
+						 unknown);
+		}
+		if (is_lock_function(al.sym->name))
+			continue;
+
+		return lock_stat_findnew(al.sym, al.sym->name);
+	}
+out:
+	return lock_stat_findnew(NULL, "[unknown]");
+}
+
+static void
+report_contention_begin_event(struct trace_contention_begin_event *begin,
+			      struct event *__event __used,
+			      int cpu __used,
+			      u64 timestamp,
+			      struct thread *thread)
+{
+	struct thread_stat *ts;
+	struct lock_seq_stat *seq;
+
+	ts = thread_stat_findnew(thread->pid);
+	seq = get_seq(ts, begin->addr);
+
+	/*
+	 * A mutex or rwsem writer that gave up spinning begins again
+	 * before sleeping: the wait started at the first one, but it is
+	 * the last one that tells whether we slept.
+	 */
+	if (seq->state != SEQ_STATE_CONTENDED) {
+		seq->state = SEQ_STATE_CONTENDED;
+		seq->prev_event_time = timestamp;
+		seq->caller = contention_caller(begin->callchain, thread);
+	}
+	seq->flags = begin->flags;
+}
+
+static void
+report_contention_end_event(struct trace_contention_end_event *end,
+			    struct event *__event __used,
+			    int cpu __used,
+			    u64 timestamp,
+			    struct thread *thread)
+{
+	struct lock_stat *ls;
+	struct thread_stat *ts;
+	struct lock_seq_stat *seq;
+	u64 contended_term;
+
+	ts = thread_stat_findnew(thread->pid);
+	seq = get_seq(ts, end->addr);
+
+	/* orphan event, the begin was before the recording */
+	if (seq->state != SEQ_STATE_CONTENDED)
+		goto free_seq;
+
+	ls = seq->caller;
+	ls->nr_contended++;
+	ls->flags = seq->flags;
+
+	contended_term = timestamp - seq->prev_event_time;
+	ls->wait_time_total += contended_term;
+	if (contended_term < ls->wait_time_min)
+		ls->wait_time_min = contended_term;
+	if (ls->wait_time_max < contended_term)
+		ls->wait_time_max = contended_term;
+free_seq:
+	list_del(&seq->list);
+	free(seq);
+}
+
+static struct trace_lock_handler contention_lock_ops  = {
+	.contention_begin_event	= report_contention_begin_event,
+	.contention_end_event	= report_contention_end_event,
+};
+
 static struct trace_lock_handler *trace_handler;
 
 static void
@@ -707,7 +882,46 @@ process_lock_release_event(void *data,
 }
 
 static void
-process_raw_event(void *data, int cpu, u64 timestamp, struct thread *thread)
+process_contention_begin_event(void *data,
+			       struct event *event __used,
+			       int cpu __used,
+			       u64 timestamp __used,
+			       struct thread *thread __used,
+			       struct ip_callchain *chain)
+{
+	struct trace_contention_begin_event begin_event;
+	u64 tmp;		/* this is required for casting... */
+
+	tmp = raw_field_value(event, "lock_addr", data);
+	memcpy(&begin_event.addr, &tmp, sizeof(void *));
+	begin_event.flags = (unsigned int)raw_field_value(event, "flags", data);
+	begin_event.callchain = chain;
+
+	if (trace_handler->contention_begin_event)
+		trace_handler->contention_begin_event(&begin_event, event, cpu, timestamp, thread);
+}
+
+static void
+process_contention_end_event(void *data,
+			     struct event *event __used,
+			     int cpu __used,
+			     u64 timestamp __used,
+			     struct thread *thread __used)
+{
+	struct trace_contention_end_event end_event;
+	u64 tmp;		/* this is required for casting... */
+
+	tmp = raw_field_value(event, "lock_addr", data);
+	memcpy(&end_event.addr, &tmp, sizeof(void *));
+	end_event.ret = (int)raw_field_value(event, "ret", data);
+
+	if (trace_handler->contention_end_event)
+		trace_handler->contention_end_event(&end_event, event, cpu, timestamp, thread);
+}
+
+static void
+process_raw_event(void *data, int cpu, u64 timestamp, struct thread *thread,
+		  struct ip_callchain *chain)
 {
 	struct event *event;
 	int type;
@@ -723,6 +937,10 @@ process_raw_event(void *data, int cpu, u64 timestamp, struct thread *thread)
 		process_lock_contended_event(data, event, cpu, timestamp, thread);
 	if (!strcmp(event->name, "lock_release"))
 		process_lock_release_event(data, event, cpu, timestamp, thread);
+	if (!strcmp(event->name, "contention_begin"))
+		process_contention_begin_event(data, event, cpu, timestamp, thread, chain);
+	if (!strcmp(event->name, "contention_end"))
+		process_contention_end_event(data, event, cpu, timestamp, thread);
 }
 
 static void print_bad_events(int bad, int total)
@@ -792,6 +1010,54 @@ static void print_result(void)
 	print_bad_events(bad, total);
 }
 
+static const char *contention_type(unsigned int flags)
+{
+	switch (flags) {
+	case LCB_F_SPIN:
+		return "spinlock";
+	case LCB_F_MUTEX:
+		return "mutex";
+	case LCB_F_MUTEX | LCB_F_SPIN:
+		return "mutex:spin";
+	case LCB_F_READ:
+		return "rwsem:R";
+	case LCB_F_WRITE:
+		return "rwsem:W";
+	case LCB_F_WRITE | LCB_F_SPIN:
+		return "rwsem:W:spin";
+	default:
+		return "unknown";
+	}
+}
+
+static void print_contention_result(void)
+{
+	struct lock_stat *st;
+
+	pr_info("%10s ", "contended");
+	pr_info("%15s ", "total wait (ns)");
+	pr_info("%15s ", "max wait (ns)");
+	pr_info("%15s ", "avg wait (ns)");
+	pr_info("%12s ", "type");
+	pr_info("%s", "caller");
+
+	pr_info("\n\n");
+
+	while ((st = pop_from_result())) {
+		/* callers whose waits all ended after the recording */
+		if (!st->nr_contended)
+			continue;
+
+		pr_info("%10u ", st->nr_contended);
+		pr_info("%15llu ", st->wait_time_total);
+		pr_info("%15llu ", st->wait_time_max);
+		pr_info("%15llu ", st->wait_time_total / st->nr_contended);
+		pr_info("%12s ", contention_type(st->flags));
+		pr_info("%s", st->name);
+		pr_info("\n");
+	}
+}
+
 static bool info_threads, info_map;
 
 static void dump_threads(void)
@@ -849,7 +1115,9 @@ static int process_sample_event(event_t *self, struct perf_session *s)
 		return -1;
 	}
 
-	process_raw_event(data.raw_data, data.cpu, data.time, thread);
+	process_raw_event(data.raw_data, data.cpu, data.time, thread,
+			  (s->sample_type & PERF_SAMPLE_CALLCHAIN) ?
+			  data.callchain : NULL);
 
 	return 0;
 }
@@ -857,6 +1125,7 @@ static int process_sample_event(event_t *self, struct perf_session *s)
 static struct perf_event_ops eops = {
 	.sample			= process_sample_event,
 	.comm			= event__process_comm,
+	.mmap			= event__process_mmap,
 	.ordered_samples	= true,
 };
 
@@ -902,6 +1171,27 @@ static const struct option report_options[] = {
 	OPT_END()
 };
 
+static void __cmd_contention(void)
+{
+	setup_pager();
+	select_key();
+	read_events();
+	sort_result();
+	print_contention_result();
+}
+
+static const char * const contention_usage[] = {
+	"perf lock contention [<options>]",
+	"perf lock contention record [<command>]",
+	NULL
+};
+
+static const struct option contention_options[] = {
+	OPT_STRING('k', "key", &sort_key, "wait_total",
+		    "key for sorting (contended, wait_total, wait_max, wait_min)"),
+	OPT_END()
+};
+
 static const char * const info_usage[] = {
 	"perf lock info [<options>]",
 	NULL
@@ -916,7 +1206,7 @@ static const struct option info_options[] = {
 };
 
 static const char * const lock_usage[] = {
-	"perf lock [<options>] {record|trace|report}",
+	"perf lock [<options>] {record|trace|report|contention}",
 	NULL
 };
 
@@ -939,16 +1229,28 @@ static const char *record_args[] = {
 	"-e", "lock:lock_release:r",
 };
 
-static int __cmd_record(int argc, const char **argv)
+static const char *contention_record_args[] = {
+	"record",
+	"-R",
+	"-f",
+	"-m", "1024",
+	"-c", "1",
+	"-g",
+	"-e", "lock:contention_begin:r",
+	"-e", "lock:contention_end:r",
+};
+
+static int __cmd_record(int argc, const char **argv,
+			const char **args, unsigned int nr_args)
 {
 	unsigned int rec_argc, i, j;
 	const char **rec_argv;
 
-	rec_argc = ARRAY_SIZE(record_args) + argc - 1;
+	rec_argc = nr_args + argc - 1;
 	rec_argv = calloc(rec_argc + 1, sizeof(char *));
 
-	for (i = 0; i < ARRAY_SIZE(record_args); i++)
-		rec_argv[i] = strdup(record_args[i]);
+	for (i = 0; i < nr_args; i++)
+		rec_argv[i] = strdup(args[i]);
 
 	for (j = 1; j < (unsigned int)argc; j++, i++)
 		rec_argv[i] = argv[j];
@@ -972,7 +1274,24 @@ int cmd_lock(int argc, const char **argv, const char *prefix __used)
 		usage_with_options(lock_usage, lock_options);
 
 	if (!strncmp(argv[0], "rec", 3)) {
-		return __cmd_record(argc, argv);
+		return __cmd_record(argc, argv, record_args,
+				    ARRAY_SIZE(record_args));
+	} else if (!strcmp(argv[0], "contention")) {
+		if (argc > 1 && !strncmp(argv[1], "rec", 3))
+			return __cmd_record(argc - 1, argv + 1,
+					    contention_record_args,
+					    ARRAY_SIZE(contention_record_args));
+		if (argc > 1 && !strcmp(argv[1], "report")) {
+			argc--;
+			argv++;
+		}
+		trace_handler = &contention_lock_ops;
+		sort_key = "wait_total";
+		argc = parse_options(argc, argv, contention_options,
+				     contention_usage, 0);
+		if (argc)
+			usage_with_options(contention_usage, contention_options);
+		__cmd_contention();
 	} else if (!strncmp(argv[0], "report", 6)) {
 		trace_handler = &report_lock_ops;
 		if (argc) {
@@ -0,0 +1,198 @@
+/*
+ * kvm asynchronous fault support
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/workqueue.h>
+
+#include "async_pf.h"
+
+static struct kmem_cache *async_pf_cache;
+static struct workqueue_struct *async_pf_wq;
+
+int kvm_async_pf_init(void)
+{
+	async_pf_cache = KMEM_CACHE(kvm_async_pf, 0);
+	if (!async_pf_cache)
+		return -ENOMEM;
+
+	/*
+	 * The faults sleep on swap-in: keep them off the events
+	 * workqueue, whose single thread per cpu they would stall.
+	 */
+	async_pf_wq = create_workqueue("kvm-async-pf");
+	if (!async_pf_wq) {
+		kmem_cache_destroy(async_pf_cache);
+		async_pf_cache = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void kvm_async_pf_deinit(void)
+{
+	if (async_pf_wq)
+		destroy_workqueue(async_pf_wq);
+	async_pf_wq = NULL;
+	if (async_pf_cache)
+		kmem_cache_destroy(async_pf_cache);
+	async_pf_cache = NULL;
+}
+
+void kvm_async_pf_vcpu_init(struct kvm_vcpu *vcpu)
+{
+	INIT_LIST_HEAD(&vcpu->async_pf.done);
+	INIT_LIST_HEAD(&vcpu->async_pf.queue);
+	spin_lock_init(&vcpu->async_pf.lock);
+}
+
+static void async_pf_execute(struct work_struct *work)
+{
+	struct kvm_async_pf *apf =
+		container_of(work, struct kvm_async_pf, work);
+	struct mm_struct *mm = apf->mm;
+	struct kvm_vcpu *vcpu = apf->vcpu;
+	unsigned long addr = apf->addr;
+	struct page *page = NULL;
+
+	might_sleep();
+
+	down_read(&mm->mmap_sem);
+	get_user_pages(NULL, mm, addr, 1, 1, 0, &page, NULL);
+	up_read(&mm->mmap_sem);
+
+	spin_lock(&vcpu->async_pf.lock);
+	list_add_tail(&apf->link, &vcpu->async_pf.done);
+	apf->page = page;
+	spin_unlock(&vcpu->async_pf.lock);
+
+	/*
+	 * apf may be freed by kvm_check_async_pf_completion() after
+	 * this point; the vcpu itself only goes away after
+	 * kvm_clear_async_pf_completion_queue() waited for us.
+	 */
+	kvm_vcpu_kick(vcpu);
+
+	mmput(mm);
+}
+
+/*
+ * Drops every fault of the vcpu, waiting for those being handled.
+ * Called from the vcpu thread, or once the vcpu can no longer run.
+ */
+void kvm_clear_async_pf_completion_queue(struct kvm_vcpu *vcpu)
+{
+	/* cancel outstanding work queue item */
+	while (!list_empty(&vcpu->async_pf.queue)) {
+		struct kvm_async_pf *work =
+			list_entry(vcpu->async_pf.queue.next,
+				   typeof(*work), queue);
+		list_del(&work->queue);
+		if (cancel_work_sync(&work->work)) {
+			mmput(work->mm);
+			kmem_cache_free(async_pf_cache, work);
+		}
+	}
+
+	spin_lock(&vcpu->async_pf.lock);
+	while (!list_empty(&vcpu->async_pf.done)) {
+		struct kvm_async_pf *work =
+			list_entry(vcpu->async_pf.done.next,
+				   typeof(*work), link);
+		list_del(&work->link);
+		if (work->page)
+			put_page(work->page);
+		kmem_cache_free(async_pf_cache, work);
+	}
+	spin_unlock(&vcpu->async_pf.lock);
+
+	vcpu->async_pf.queued = 0;
+}
+
+/*
+ * Tells the guest about one page that has been faulted in, if it can
+ * take the notification right now.  Called before entering the guest.
+ */
+void kvm_check_async_pf_completion(struct kvm_vcpu *vcpu)
+{
+	struct kvm_async_pf *work;
+
+	if (list_empty_careful(&vcpu->async_pf.done) ||
+	    !kvm_arch_can_inject_async_page_present(vcpu))
+		return;
+
+	spin_lock(&vcpu->async_pf.lock);
+	work = list_first_entry(&vcpu->async_pf.done, typeof(*work), link);
+	list_del(&work->link);
+	spin_unlock(&vcpu->async_pf.lock);
+
+	kvm_arch_async_page_present(vcpu, work);
+
+	list_del(&work->queue);
+	vcpu->async_pf.queued--;
+	if (work->page)
+		put_page(work->page);
+	kmem_cache_free(async_pf_cache, work);
+}
+
+/*
+ * Starts faulting in hva on behalf of the vcpu and tells the guest the
+ * page is not present yet.  Returns 0 if the fault must be handled
+ * synchronously instead.
+ */
+int kvm_setup_async_pf(struct kvm_vcpu *vcpu, unsigned long hva,
+		       struct kvm_arch_async_pf *arch)
+{
+	struct kvm_async_pf *work;
+
+	if (vcpu->async_pf.queued >= ASYNC_PF_PER_VCPU)
+		return 0;
+
+	/*
+	 * Another guest task already waits for this page: fault it in
+	 * synchronously rather than queueing the same swap-in twice.
+	 */
+	list_for_each_entry(work, &vcpu->async_pf.queue, queue)
+		if (work->addr == hva)
+			return 0;
+
+	/*
+	 * do alloc nowait since if we are going to sleep anyway we
+	 * may as well sleep faulting in page
+	 */
+	work = kmem_cache_zalloc(async_pf_cache, GFP_NOWAIT);
+	if (!work)
+		return 0;
+
+	work->page = NULL;
+	work->vcpu = vcpu;
+	work->addr = hva;
+	work->arch = *arch;
+	work->mm = current->mm;
+	atomic_inc(&work->mm->mm_users);
+
+	INIT_WORK(&work->work, async_pf_execute);
+	queue_work(async_pf_wq, &work->work);
+
+	list_add_tail(&work->queue, &vcpu->async_pf.queue);
+	vcpu->async_pf.queued++;
+	kvm_arch_async_page_not_present(vcpu, work);
+	return 1;
+}
@@ -0,0 +1,191 @@
+/*
+ * kvm per-vcpu dirty gfn rings
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/kvm.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+
+/*
+ * Entries kept free past the soft limit: the vcpu only checks its ring
+ * before entering the guest, and may dirty a few more pages (emulation,
+ * pv clock updates) before it gets to exit to userspace.
+ */
+#define KVM_DIRTY_RING_RSVD_ENTRIES	64
+#define KVM_DIRTY_RING_MAX_ENTRIES	65536
+
+int kvm_dirty_ring_max_size(void)
+{
+	return KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn);
+}
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size)
+{
+	ring->dirty_gfns = vmalloc(size);
+	if (!ring->dirty_gfns)
+		return -ENOMEM;
+	memset(ring->dirty_gfns, 0, size);
+
+	ring->size = size / sizeof(struct kvm_dirty_gfn);
+	ring->soft_limit = ring->size - KVM_DIRTY_RING_RSVD_ENTRIES;
+	ring->dirty_index = 0;
+	ring->reset_index = 0;
+	return 0;
+}
+
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+	vfree(ring->dirty_gfns);
+	ring->dirty_gfns = NULL;
+	ring->size = 0;
+}
+
+static u32 kvm_dirty_ring_used(struct kvm_dirty_ring *ring)
+{
+	return ring->dirty_index - ACCESS_ONCE(ring->reset_index);
+}
+
+bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return ring->size && kvm_dirty_ring_used(ring) >= ring->soft_limit;
+}
+
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset)
+{
+	if (offset >= ring->size * sizeof(struct kvm_dirty_gfn) / PAGE_SIZE)
+		return NULL;
+	return vmalloc_to_page((void *)ring->dirty_gfns + offset * PAGE_SIZE);
+}
+
+/*
+ * Called by the vcpu owning the ring only.  Fails when the ring is
+ * completely full, in which case the caller logs to the slot bitmap.
+ */
+int kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset)
+{
+	struct kvm_dirty_gfn *entry;
+
+	if (!ring->size || kvm_dirty_ring_used(ring) >= ring->size)
+		return -EBUSY;
+
+	entry = &ring->dirty_gfns[ring->dirty_index & (ring->size - 1)];
+	entry->slot = slot;
+	entry->offset = offset;
+	/* Publish the gfn before userspace may see the entry dirty */
+	smp_wmb();
+	entry->flags = KVM_DIRTY_GFN_F_DIRTY;
+	ring->dirty_index++;
+	return 0;
+}
+
+static int kvm_dirty_ring_protect(struct kvm *kvm, u32 slot, u64 offset)
+{
+	struct kvm_memslots *slots = kvm_memslots(kvm);
+	struct kvm_memory_slot *memslot;
+
+	/* Userspace owns the entry: don't trust it more than an ioctl arg */
+	if (slot >= slots->nmemslots)
+		return 0;
+	memslot = &slots->memslots[slot];
+	if (!memslot->dirty_bitmap || offset >= memslot->npages)
+		return 0;
+
+	return kvm_arch_protect_dirty_gfn(kvm, memslot->base_gfn + offset);
+}
+
+/*
+ * Recycles the entries userspace harvested, in ring order, stopping at
+ * the first one it did not hand back yet.  Called with slots_lock and
+ * mmu_lock held; returns whether a tlb flush is needed.
+ */
+static int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring,
+				u32 *cleared)
+{
+	struct kvm_dirty_gfn *entry;
+	u32 dirty_index = ACCESS_ONCE(ring->dirty_index);
+	int flush = 0;
+
+	while (ring->reset_index != dirty_index) {
+		entry = &ring->dirty_gfns[ring->reset_index & (ring->size - 1)];
+		if (!(ACCESS_ONCE(entry->flags) & KVM_DIRTY_GFN_F_RESET))
+			break;
+		/* Read the gfn only once userspace handed the entry back */
+		smp_rmb();
+		flush |= kvm_dirty_ring_protect(kvm, ACCESS_ONCE(entry->slot),
+						ACCESS_ONCE(entry->offset));
+		entry->flags = 0;
+		/* Free the entry for the vcpu only once it is cleared */
+		smp_wmb();
+		ring->reset_index++;
+		++*cleared;
+
+		if (need_resched() || spin_needbreak(&kvm->mmu_lock)) {
+			if (flush)
+				kvm_flush_remote_tlbs(kvm);
+			flush = 0;
+			cond_resched_lock(&kvm->mmu_lock);
+		}
+	}
+
+	return flush;
+}
+
+int kvm_vm_ioctl_reset_dirty_rings(struct kvm *kvm)
+{
+	struct kvm_vcpu *vcpu;
+	u32 cleared = 0;
+	int i, flush = 0;
+
+	if (!kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->slots_lock);
+	spin_lock(&kvm->mmu_lock);
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		if (vcpu->dirty_ring.size)
+			flush |= kvm_dirty_ring_reset(kvm, &vcpu->dirty_ring,
+						      &cleared);
+	/* Writes must fault again before userspace copies the pages */
+	if (flush)
+		kvm_flush_remote_tlbs(kvm);
+	spin_unlock(&kvm->mmu_lock);
+	mutex_unlock(&kvm->slots_lock);
+
+	return cleared;
+}
+
+int kvm_vm_ioctl_enable_dirty_log_ring(struct kvm *kvm, u32 size)
+{
+	int r;
+
+	/* A power of two number of pages, with room past the reserve */
+	if (!size || (size & (size - 1)) || size < PAGE_SIZE ||
+	    size > kvm_dirty_ring_max_size())
+		return -EINVAL;
+
+	mutex_lock(&kvm->lock);
+	r = -EBUSY;
+	if (atomic_read(&kvm->online_vcpus) || kvm->dirty_ring_size)
+		goto out;
+	kvm->dirty_ring_size = size;
+	r = 0;
+out:
+	mutex_unlock(&kvm->lock);
+	return r;
+}
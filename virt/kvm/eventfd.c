@@ -47,6 +47,8 @@ struct _irqfd {
 	struct kvm               *kvm;
 	struct eventfd_ctx       *eventfd;
 	int                       gsi;
+	/* Used for MSI fast-path, RCU protected, updated under irqfds.lock */
+	struct kvm_kernel_irq_routing_entry *irq_entry;
 	struct list_head          list;
 	poll_table                pt;
 	wait_queue_t              wait;
@@ -125,10 +127,22 @@ irqfd_wakeup(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
 	struct _irqfd *irqfd = container_of(wait, struct _irqfd, wait);
 	unsigned long flags = (unsigned long)key;
+	struct kvm_kernel_irq_routing_entry *irq;
 
-	if (flags & POLLIN)
-		/* An event has been signaled, inject an interrupt */
-		schedule_work(&irqfd->inject);
+	if (flags & POLLIN) {
+		/*
+		 * An event has been signaled, inject an interrupt: MSIs can
+		 * be delivered from here, anything else needs the workqueue
+		 */
+		rcu_read_lock();
+		irq = rcu_dereference(irqfd->irq_entry);
+		if (irq)
+			kvm_set_msi(irq, irqfd->kvm,
+				    KVM_USERSPACE_IRQ_SOURCE_ID, 1);
+		else
+			schedule_work(&irqfd->inject);
+		rcu_read_unlock();
+	}
 
 	if (flags & POLLHUP) {
 		/* The eventfd is closing, detach from KVM */
@@ -163,9 +177,36 @@ irqfd_ptable_queue_proc(struct file *file, wait_queue_head_t *wqh,
 	add_wait_queue(wqh, &irqfd->wait);
 }
 
+/*
+ * Points the irqfd at its routing entry if the gsi routes to a single
+ * MSI and nothing else, for irqfd_wakeup() to deliver itself.
+ *
+ * assumes kvm->irqfds.lock is held
+ */
+static void
+irqfd_update(struct kvm *kvm, struct _irqfd *irqfd,
+	     struct kvm_irq_routing_table *irq_rt)
+{
+	struct kvm_kernel_irq_routing_entry *e, *msi = NULL;
+	struct hlist_node *n;
+
+	if (irqfd->gsi < irq_rt->nr_rt_entries) {
+		hlist_for_each_entry(e, n, &irq_rt->map[irqfd->gsi], link) {
+			if (e->type != KVM_IRQ_ROUTING_MSI || msi) {
+				msi = NULL;
+				break;
+			}
+			msi = e;
+		}
+	}
+
+	rcu_assign_pointer(irqfd->irq_entry, msi);
+}
+
 static int
 kvm_irqfd_assign(struct kvm *kvm, int fd, int gsi)
 {
+	struct kvm_irq_routing_table *irq_rt;
 	struct _irqfd *irqfd, *tmp;
 	struct file *file = NULL;
 	struct eventfd_ctx *eventfd = NULL;
@@ -217,6 +258,10 @@ kvm_irqfd_assign(struct kvm *kvm, int fd, int gsi)
 
 	events = file->f_op->poll(file, &irqfd->pt);
 
+	irq_rt = rcu_dereference_check(kvm->irq_routing,
+				       lockdep_is_held(&kvm->irqfds.lock));
+	irqfd_update(kvm, irqfd, irq_rt);
+
 	list_add_tail(&irqfd->list, &kvm->irqfds.items);
 	spin_unlock_irq(&kvm->irqfds.lock);
 
@@ -320,6 +365,25 @@ kvm_irqfd_release(struct kvm *kvm)
 
 }
 
+/*
+ * Change irq_routing and irqfd.
+ * Caller must invoke synchronize_rcu afterwards.
+ */
+void kvm_irq_routing_update(struct kvm *kvm,
+			    struct kvm_irq_routing_table *irq_rt)
+{
+	struct _irqfd *irqfd;
+
+	spin_lock_irq(&kvm->irqfds.lock);
+
+	rcu_assign_pointer(kvm->irq_routing, irq_rt);
+
+	list_for_each_entry(irqfd, &kvm->irqfds.items, list)
+		irqfd_update(kvm, irqfd, irq_rt);
+
+	spin_unlock_irq(&kvm->irqfds.lock);
+}
+
 /*
  * create a host-wide workqueue for issuing deferred shutdown requests
  * aggregated from all vm* instances. We need our own isolated single-thread
@@ -41,6 +41,7 @@
 #include <linux/pagemap.h>
 #include <linux/mman.h>
 #include <linux/swap.h>
+#include <linux/swapops.h>
 #include <linux/bitops.h>
 #include <linux/spinlock.h>
 #include <linux/compat.h>
@@ -55,6 +56,7 @@
 #include <asm-generic/bitops/le.h>
 
 #include "coalesced_mmio.h"
+#include "async_pf.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/kvm.h>
@@ -80,6 +82,11 @@ EXPORT_SYMBOL_GPL(kvm_vcpu_cache);
 
 static __read_mostly struct preempt_ops kvm_preempt_ops;
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+/* The vcpu loaded on each cpu, whose ring gets the pages it dirties */
+static DEFINE_PER_CPU(struct kvm_vcpu *, kvm_running_vcpu);
+#endif
+
 struct dentry *kvm_debugfs_dir;
 
 static long kvm_vcpu_ioctl(struct file *file, unsigned int ioctl,
@@ -119,6 +126,9 @@ void vcpu_load(struct kvm_vcpu *vcpu)
 	mutex_lock(&vcpu->mutex);
 	cpu = get_cpu();
 	preempt_notifier_register(&vcpu->preempt_notifier);
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	__get_cpu_var(kvm_running_vcpu) = vcpu;
+#endif
 	kvm_arch_vcpu_load(vcpu, cpu);
 	put_cpu();
 }
@@ -127,6 +137,9 @@ void vcpu_put(struct kvm_vcpu *vcpu)
 {
 	preempt_disable();
 	kvm_arch_vcpu_put(vcpu);
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	__get_cpu_var(kvm_running_vcpu) = NULL;
+#endif
 	preempt_notifier_unregister(&vcpu->preempt_notifier);
 	preempt_enable();
 	mutex_unlock(&vcpu->mutex);
@@ -185,7 +198,9 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	vcpu->cpu = -1;
 	vcpu->kvm = kvm;
 	vcpu->vcpu_id = id;
+	vcpu->pid = NULL;
 	init_waitqueue_head(&vcpu->wq);
+	kvm_async_pf_vcpu_init(vcpu);
 
 	page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 	if (!page) {
@@ -197,8 +212,21 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	r = kvm_arch_vcpu_init(vcpu);
 	if (r < 0)
 		goto fail_free_run;
+
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	if (kvm->dirty_ring_size) {
+		r = kvm_dirty_ring_alloc(&vcpu->dirty_ring,
+					 kvm->dirty_ring_size);
+		if (r)
+			goto fail_uninit;
+	}
+#endif
 	return 0;
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+fail_uninit:
+	kvm_arch_vcpu_uninit(vcpu);
+#endif
 fail_free_run:
 	free_page((unsigned long)vcpu->run);
 fail:
@@ -208,7 +236,11 @@ EXPORT_SYMBOL_GPL(kvm_vcpu_init);
 
 void kvm_vcpu_uninit(struct kvm_vcpu *vcpu)
 {
+	put_pid(vcpu->pid);
 	kvm_arch_vcpu_uninit(vcpu);
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
+#endif
 	free_page((unsigned long)vcpu->run);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_uninit);
@@ -995,6 +1027,68 @@ pfn_t gfn_to_pfn(struct kvm *kvm, gfn_t gfn)
 }
 EXPORT_SYMBOL_GPL(gfn_to_pfn);
 
+/*
+ * Whether faulting in addr means reading it back from swap.  This is
+ * an unlocked peek at the pte, only good enough to pick a path.
+ */
+static bool hva_swapped_out(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *ptep, pte;
+
+	pgd = pgd_offset(mm, addr);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		return false;
+	pud = pud_offset(pgd, addr);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		return false;
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
+		return false;
+
+	ptep = pte_offset_map(pmd, addr);
+	pte = *ptep;
+	pte_unmap(ptep);
+
+	return is_swap_pte(pte);
+}
+
+/*
+ * Like gfn_to_pfn(), except that a page which has to be read back from
+ * swap is not waited for: *async is set instead, and nothing returned.
+ */
+pfn_t gfn_to_pfn_async(struct kvm *kvm, gfn_t gfn, bool *async)
+{
+	struct page *page[1];
+	unsigned long addr;
+	bool swapped;
+
+	*async = false;
+
+	addr = gfn_to_hva(kvm, gfn);
+	if (kvm_is_error_hva(addr)) {
+		get_page(bad_page);
+		return page_to_pfn(bad_page);
+	}
+
+	if (__get_user_pages_fast(addr, 1, 1, page) == 1)
+		return page_to_pfn(page[0]);
+
+	down_read(&current->mm->mmap_sem);
+	swapped = hva_swapped_out(current->mm, addr);
+	up_read(&current->mm->mmap_sem);
+
+	if (swapped) {
+		*async = true;
+		return 0;
+	}
+
+	return hva_to_pfn(kvm, addr);
+}
+EXPORT_SYMBOL_GPL(gfn_to_pfn_async);
+
 pfn_t gfn_to_pfn_memslot(struct kvm *kvm,
 			 struct kvm_memory_slot *slot, gfn_t gfn)
 {
@@ -1200,6 +1294,37 @@ int kvm_clear_guest(struct kvm *kvm, gpa_t gpa, unsigned long len)
 }
 EXPORT_SYMBOL_GPL(kvm_clear_guest);
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+static int kvm_dirty_ring_log(struct kvm *kvm, struct kvm_memory_slot *memslot,
+			      unsigned long rel_gfn)
+{
+	struct kvm_vcpu *vcpu;
+	int r = -EBUSY;
+
+	if (!kvm->dirty_ring_size)
+		return r;
+
+	/*
+	 * Pages dirtied outside of vcpu context, or by a vcpu whose ring
+	 * is full, go to the slot bitmap for KVM_GET_DIRTY_LOG instead.
+	 */
+	preempt_disable();
+	vcpu = __get_cpu_var(kvm_running_vcpu);
+	if (vcpu && vcpu->kvm == kvm)
+		r = kvm_dirty_ring_push(&vcpu->dirty_ring, memslot->id,
+					rel_gfn);
+	preempt_enable();
+	return r;
+}
+#else
+static inline int kvm_dirty_ring_log(struct kvm *kvm,
+				     struct kvm_memory_slot *memslot,
+				     unsigned long rel_gfn)
+{
+	return -EBUSY;
+}
+#endif
+
 void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 {
 	struct kvm_memory_slot *memslot;
@@ -1208,7 +1333,11 @@ void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 	if (memslot && memslot->dirty_bitmap) {
 		unsigned long rel_gfn = gfn - memslot->base_gfn;
 
-		generic___set_le_bit(rel_gfn, memslot->dirty_bitmap);
+		if (!kvm_dirty_ring_log(kvm, memslot, rel_gfn))
+			return;
+
+		/* Atomic: lockless fault paths may dirty neighbouring gfns */
+		generic_test_and_set_le_bit(rel_gfn, memslot->dirty_bitmap);
 	}
 }
 
@@ -1245,18 +1374,55 @@ void kvm_resched(struct kvm_vcpu *vcpu)
 }
 EXPORT_SYMBOL_GPL(kvm_resched);
 
-void kvm_vcpu_on_spin(struct kvm_vcpu *vcpu)
+/*
+ * Yields to a vcpu of the same VM whose thread is runnable but not
+ * running: it got preempted, hopefully while holding the lock we spin
+ * on. The search starts after the vcpu boosted last, so that the boosts
+ * go round-robin, and vcpus that are halted, in the guest, or spinning
+ * themselves are skipped. If there is no such vcpu, the lock holder is
+ * probably running, and we get back to the guest at once.
+ */
+void kvm_vcpu_on_spin(struct kvm_vcpu *me)
 {
-	ktime_t expires;
-	DEFINE_WAIT(wait);
-
-	prepare_to_wait(&vcpu->wq, &wait, TASK_INTERRUPTIBLE);
+	struct kvm *kvm = me->kvm;
+	struct kvm_vcpu *vcpu;
+	int last_boosted_vcpu = ACCESS_ONCE(kvm->last_boosted_vcpu);
+	int nr_vcpus = atomic_read(&kvm->online_vcpus);
+	int n, i;
+
+	me->in_spin_loop = true;
+	for (n = 1; n <= nr_vcpus; n++) {
+		struct task_struct *task = NULL;
+		struct pid *pid;
+		bool yielded;
+
+		i = (last_boosted_vcpu + n) % nr_vcpus;
+		vcpu = kvm_get_vcpu(kvm, i);
+		if (!vcpu || vcpu == me)
+			continue;
+		if (vcpu->in_spin_loop || waitqueue_active(&vcpu->wq))
+			continue;
 
-	/* Sleep for 100 us, and hope lock-holder got scheduled */
-	expires = ktime_add_ns(ktime_get(), 100000UL);
-	schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+		rcu_read_lock();
+		pid = rcu_dereference(vcpu->pid);
+		if (pid)
+			task = get_pid_task(pid, PIDTYPE_PID);
+		rcu_read_unlock();
+		if (!task)
+			continue;
+		if (task->flags & PF_VCPU) {
+			put_task_struct(task);
+			continue;
+		}
 
-	finish_wait(&vcpu->wq, &wait);
+		yielded = yield_to(task, 1);
+		put_task_struct(task);
+		if (yielded) {
+			kvm->last_boosted_vcpu = i;
+			break;
+		}
+	}
+	me->in_spin_loop = false;
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_on_spin);
 
@@ -1274,6 +1440,14 @@ static int kvm_vcpu_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 #ifdef KVM_COALESCED_MMIO_PAGE_OFFSET
 	else if (vmf->pgoff == KVM_COALESCED_MMIO_PAGE_OFFSET)
 		page = virt_to_page(vcpu->kvm->coalesced_mmio_ring);
+#endif
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	else if (vmf->pgoff >= KVM_DIRTY_LOG_PAGE_OFFSET) {
+		page = kvm_dirty_ring_get_page(&vcpu->dirty_ring,
+				vmf->pgoff - KVM_DIRTY_LOG_PAGE_OFFSET);
+		if (!page)
+			return VM_FAULT_SIGBUS;
+	}
 #endif
 	else
 		return VM_FAULT_SIGBUS;
@@ -1411,6 +1585,15 @@ static long kvm_vcpu_ioctl(struct file *filp,
 		r = -EINVAL;
 		if (arg)
 			goto out;
+		if (unlikely(vcpu->pid != task_pid(current))) {
+			/* The thread running this vcpu changed. */
+			struct pid *oldpid = vcpu->pid;
+			struct pid *newpid = get_task_pid(current, PIDTYPE_PID);
+
+			rcu_assign_pointer(vcpu->pid, newpid);
+			synchronize_rcu();
+			put_pid(oldpid);
+		}
 		r = kvm_arch_vcpu_ioctl_run(vcpu, vcpu->run);
 		break;
 	case KVM_GET_REGS: {
@@ -1628,6 +1811,14 @@ static long kvm_vm_ioctl(struct file *filp,
 			goto out;
 		break;
 	}
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_ENABLE_DIRTY_LOG_RING:
+		r = kvm_vm_ioctl_enable_dirty_log_ring(kvm, arg);
+		break;
+	case KVM_RESET_DIRTY_RINGS:
+		r = kvm_vm_ioctl_reset_dirty_rings(kvm);
+		break;
+#endif
 #ifdef KVM_COALESCED_MMIO_PAGE_OFFSET
 	case KVM_REGISTER_COALESCED_MMIO: {
 		struct kvm_coalesced_mmio_zone zone;
@@ -1812,6 +2003,10 @@ static long kvm_dev_ioctl_check_extension_generic(long arg)
 #ifdef CONFIG_HAVE_KVM_IRQCHIP
 	case KVM_CAP_IRQ_ROUTING:
 		return KVM_MAX_IRQ_ROUTES;
+#endif
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_CAP_DIRTY_LOG_RING:
+		return kvm_dirty_ring_max_size();
 #endif
 	default:
 		break;
@@ -2011,7 +2206,7 @@ static void kvm_io_bus_destroy(struct kvm_io_bus *bus)
 	kfree(bus);
 }
 
-/* kvm_io_bus_write - called under kvm->slots_lock */
+/* kvm_io_bus_write - called under kvm->srcu, the bus is never locked */
 int kvm_io_bus_write(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 		     int len, const void *val)
 {
@@ -2025,7 +2220,7 @@ int kvm_io_bus_write(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 	return -EOPNOTSUPP;
 }
 
-/* kvm_io_bus_read - called under kvm->slots_lock */
+/* kvm_io_bus_read - called under kvm->srcu, the bus is never locked */
 int kvm_io_bus_read(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 		    int len, void *val)
 {
@@ -2196,6 +2391,9 @@ static void kvm_sched_in(struct preempt_notifier *pn, int cpu)
 {
 	struct kvm_vcpu *vcpu = preempt_notifier_to_vcpu(pn);
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	__get_cpu_var(kvm_running_vcpu) = vcpu;
+#endif
 	kvm_arch_vcpu_load(vcpu, cpu);
 }
 
@@ -2205,6 +2403,9 @@ static void kvm_sched_out(struct preempt_notifier *pn,
 	struct kvm_vcpu *vcpu = preempt_notifier_to_vcpu(pn);
 
 	kvm_arch_vcpu_put(vcpu);
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	__get_cpu_var(kvm_running_vcpu) = NULL;
+#endif
 }
 
 int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,
@@ -2284,6 +2485,10 @@ int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,
 		goto out_free_5;
 	}
 
+	r = kvm_async_pf_init();
+	if (r)
+		goto out_free;
+
 	kvm_chardev_ops.owner = module;
 	kvm_vm_fops.owner = module;
 	kvm_vcpu_fops.owner = module;
@@ -2291,7 +2496,7 @@ int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,
 	r = misc_register(&kvm_dev);
 	if (r) {
 		printk(KERN_ERR "kvm: misc device register failed\n");
-		goto out_free;
+		goto out_unreg;
 	}
 
 	kvm_preempt_ops.sched_in = kvm_sched_in;
@@ -2301,6 +2506,8 @@ int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,
 
 	return 0;
 
+out_unreg:
+	kvm_async_pf_deinit();
 out_free:
 	kmem_cache_destroy(kvm_vcpu_cache);
 out_free_5:
@@ -2333,6 +2540,7 @@ void kvm_exit(void)
 	kvm_exit_debug();
 	misc_deregister(&kvm_dev);
 	kmem_cache_destroy(kvm_vcpu_cache);
+	kvm_async_pf_deinit();
 	sysdev_unregister(&kvm_sysdev);
 	sysdev_class_unregister(&kvm_sysdev_class);
 	unregister_reboot_notifier(&kvm_reboot_notifier);